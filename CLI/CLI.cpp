@@ -1089,6 +1089,21 @@ static CLIStatus page(int argc, char **argv, ostream& os)
 }
 
 
+/** Print the latest measurements of each channel, from memory. */
+static CLIStatus physical(int argc, char **argv, ostream& os)
+{
+	if (argc>2) return BAD_NUM_ARGS;
+	if (argc==2) {
+		if (strcmp(argv[1],"-s")) return BAD_VALUE;
+		gPhysStatus.stats(os);
+		os << endl;
+		return SUCCESS;
+	}
+	gPhysStatus.dump(os);
+	return SUCCESS;
+}
+
+
 static CLIStatus endcall(int argc, char **argv, ostream& os)
 {
 	if (argc!=2) return BAD_NUM_ARGS;
@@ -1304,6 +1319,7 @@ void Parser::addCommands()
 	addCommand("alarms", alarms, "-- show latest alarms");
 	addCommand("version", version,"-- print the version string");
 	addCommand("page", page, "print the paging table");
+	addCommand("physical", physical, "[-s] -- print the latest measurements of each channel, or with -s the reporting counters");
 	addCommand("power", power, "[minAtten maxAtten] -- report current attentuation or set min/max bounds");
         addCommand("rxgain", rxgain, "[newRxgain] -- get/set the RX gain in dB");
         //addCommand("noise", noise, "-- report receive noise level in RSSI dB");
@@ -955,9 +955,12 @@ std::string SoftVector::str() const
 void BitVector::pack(unsigned char* targ) const
 {
 	// Assumes MSB-first packing.
+	// The whole bytes go straight from the bits; the L3 decoder packs every frame it sees.
 	unsigned bytes = size()/8;
-	for (unsigned i=0; i<bytes; i++) {
-		targ[i] = peekField(i*8,8);
+	const char *dp = mStart;
+	for (unsigned i=0; i<bytes; i++, dp+=8) {
+		targ[i] = ((dp[0]&1)<<7) | ((dp[1]&1)<<6) | ((dp[2]&1)<<5) | ((dp[3]&1)<<4)
+			| ((dp[4]&1)<<3) | ((dp[5]&1)<<2) | ((dp[6]&1)<<1) | (dp[7]&1);
 	}
 	unsigned whole = bytes*8;
 	unsigned rem = size() - whole;
@@ -970,8 +973,9 @@ void BitVector::unpack(const unsigned char* src)
 {
 	// Assumes MSB-first packing.
 	unsigned bytes = size()/8;
+	char *dp = mStart;
 	for (unsigned i=0; i<bytes; i++) {
-		fillField(i*8,src[i],8);
+		for (int bit=7; bit>=0; bit--) *dp++ = (src[i]>>bit) & 1;
 	}
 	unsigned whole = bytes*8;
 	unsigned rem = size() - whole;
@@ -18,6 +18,7 @@
 #include "TurboCoder.h"
 #include <iostream>
 #include <cstdlib>
+#include <string.h>
 #include <math.h>
  
 using namespace std;
@@ -224,10 +225,43 @@ void testTurbo()
 	}
 }
 
+// Check pack() and unpack() against packing each octet with peekField() and fillField(),
+// for every length up to 100 bits and segments starting at every bit offset within an octet.
+void testPack()
+{
+	int bad = 0;
+	for (unsigned offset = 0; offset < 8; offset++) {
+		for (unsigned lth = 0; lth <= 100; lth++) {
+			BitVector whole = randomBitVector(offset+lth+8);
+			BitVector v = whole.segment(offset,lth);
+			unsigned char packed[14], expected[14];
+			memset(packed,0x5a,sizeof(packed));
+			memset(expected,0x5a,sizeof(expected));
+			v.pack(packed);
+			for (unsigned i = 0; i < lth/8; i++) expected[i] = v.peekField(i*8,8);
+			if (lth%8) expected[lth/8] = v.peekField(lth&~7,lth%8) << (8-lth%8);
+			if (memcmp(packed,expected,sizeof(packed))) bad++;
+
+			BitVector u(lth);
+			u.unpack(packed);
+			if (!veq(v,u)) bad++;
+			// unpack() must not write past the vector.
+			BitVector outer = randomBitVector(offset+lth+8);
+			BitVector before(outer);
+			outer.segment(offset,lth).unpack(packed);
+			for (unsigned i = 0; i < offset; i++) if (outer.bit(i) != before.bit(i)) bad++;
+			for (unsigned i = offset+lth; i < outer.size(); i++) if (outer.bit(i) != before.bit(i)) bad++;
+			if (!veq(outer.segment(offset,lth),v)) bad++;
+		}
+	}
+	cout << "pack/unpack " << (bad ? "fail" : "ok") << endl;
+}
+
 int main()
 {
 	test2O4();
 	test2O9();
 	testInterleavings();
 	testTurbo();
+	testPack();
 }
@@ -106,6 +106,25 @@ void ByteVector::dup(const ByteVector &other)
 #endif
 }
 
+// Move ownership of the memory of other to ourself.
+// We inherit the reference held by other, so the refcnt is unchanged.
+void ByteVector::transfer(ByteVector &other)
+{
+	if (&other == this) { return; }
+	if (other.mData == NULL) {
+		clone(other);
+	} else {
+		clear();
+		mData=other.mData;
+		mStart=other.mStart;
+		mSizeBits=other.mSizeBits;
+		mAllocEnd = other.mAllocEnd;
+		other.mData = NULL;
+	}
+	other.clear();
+	other.mStart = other.mAllocEnd = NULL;
+}
+
 // Return a segment of a ByteVector that shares the same memory as the original.
 ByteVector ByteVector::segment(size_t start, size_t span) const
 {
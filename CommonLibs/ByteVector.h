@@ -113,6 +113,10 @@ class ByteVector : public ItemWithSize, public MemCheckByteVector
 	void clear();	// Release the memory used by this ByteVector.
 	// clone semantics are weird: copies data from other to self.
 	void clone(const ByteVector& other); /** Copy data from another vector. */
+	// Take over the memory of other, leaving other empty.  Unlike dup() this does not touch the refcnt,
+	// which is not atomic, so it is the way to hand a buffer to another thread.
+	// If other does not own its memory it is copied instead.
+	void transfer(ByteVector& other);
 #if BYTEVECTOR_REFCNT
 	int getRefCnt() { return mData ? ((short*)mData)[0] : 0; }
 #endif
@@ -122,6 +126,10 @@ class ByteVector : public ItemWithSize, public MemCheckByteVector
 
 	// This is the allocSize from mStart, not from mData, ie, excluding the refcnt.
 	size_t allocSize() const { return mAllocEnd - mStart; }
+#if BYTEVECTOR_REFCNT
+	// Room in front of mStart for growLeft.  A vector that does not own its memory has none.
+	size_t headroom() const { return mData ? mStart - (mData + mDataOffset) : 0; }
+#endif
 	//size_t sizeBytes() const { return mEnd - mStart + !!mBitInd; }	// size in bytes
 	size_t sizeBytes() const { return (mSizeBits+7)/8; }	// size in bytes
 	size_t size() const { return sizeBytes(); }	// size in bytes
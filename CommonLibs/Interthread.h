@@ -238,6 +238,22 @@ template <class T, class Fifo=PointerFIFO> class InterthreadQueue {
 		return (T*)mQ.get();
 	}
 
+	/**
+		Blocking batch read: wait for at least one element, then take up to maxCount
+		elements with a single acquisition of the lock.
+		@return The number of elements placed in results, at least 1.
+	*/
+	unsigned readBatch(T** results, unsigned maxCount)
+	{
+		ScopedLock lock(mLock);
+		T* val;
+		while ((val = (T*)mQ.get()) == NULL) { mWriteSignal.wait(mLock); }
+		unsigned cnt = 0;
+		results[cnt++] = val;
+		while (cnt < maxCount && (val = (T*)mQ.get())) { results[cnt++] = val; }
+		return cnt;
+	}
+
 	/** Non-blocking write. */
 	void write(T* val)
 	{
@@ -62,7 +62,8 @@ long Timeval::delta(const Timeval& other) const
 {
 	// 2^31 milliseconds is just over 4 years.
 	long deltaS = other.sec() - sec();
-	long deltaUs = other.usec() - usec();
+	// usec() is unsigned; subtracting it directly wraps instead of going negative.
+	long deltaUs = (long)other.usec() - (long)usec();
 	return 1000*deltaS + deltaUs/1000;
 }
 	
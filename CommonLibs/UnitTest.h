@@ -0,0 +1,29 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+
+#ifndef UNITTEST_H
+#define UNITTEST_H
+
+// The failure count and check macro shared by the module *Test programs.
+// Include this in the test's one translation unit only; main() returns failures ? 1 : 0.
+
+#include <stdio.h>
+
+static int failures = 0;
+
+/** Count and report a failed condition, and carry on with the test. */
+#define CHECK(cond) if (!(cond)) { failures++; printf("FAIL line %d: %s\n",__LINE__,#cond); }
+
+#endif
@@ -188,6 +188,54 @@ std::ostream& operator<<(std::ostream& os, const Statistic<unsigned> &stat) { st
 std::ostream& operator<<(std::ostream& os, const Statistic<float> &stat) { stat.text(os); return os; }
 std::ostream& operator<<(std::ostream& os, const Statistic<double> &stat) { stat.text(os); return os; }
 
+// Bucket n holds durations up to 2^(n/4) usecs.
+static unsigned latencyBucket(double seconds)
+{
+	double usecs = seconds * 1e6;
+	if (usecs <= 1) { return 0; }
+	unsigned bucket = (unsigned) ceil(4 * log2(usecs));
+	return bucket < LatencyHistogram::sNumBuckets ? bucket : LatencyHistogram::sNumBuckets-1;
+}
+
+void LatencyHistogram::addPoint(double seconds)
+{
+	if (seconds < 0) { seconds = 0; }	// Someone set the clock back.
+	uint64_t nsecs = (uint64_t) (seconds * 1e9);
+	__sync_fetch_and_add(&mBuckets[latencyBucket(seconds)],1);
+	__sync_fetch_and_add(&mSumNsecs,nsecs);
+	__sync_fetch_and_add(&mCnt,1);
+	for (uint64_t max = mMaxNsecs; nsecs > max; max = mMaxNsecs) {
+		if (__sync_bool_compare_and_swap(&mMaxNsecs,max,nsecs)) { break; }
+	}
+}
+
+// Return the upper bound of the bucket containing the requested percentile,
+// but never more than the largest value actually seen.
+double LatencyHistogram::percentile(double pct) const
+{
+	unsigned cnt = mCnt;
+	double max = getMax();
+	if (cnt == 0) { return 0; }
+	double want = pct * cnt / 100.0;
+	unsigned sofar = 0;
+	for (unsigned n = 0; n < sNumBuckets; n++) {
+		sofar += mBuckets[n];
+		if (sofar && sofar >= want) {
+			double result = pow(2.0,n/4.0) / 1e6;
+			return result < max ? result : max;
+		}
+	}
+	return max;
+}
+
+void LatencyHistogram::text(std::ostream &os) const
+{
+	os << format("(N=%u avg=%.1f p50=%.1f p90=%.1f p99=%.1f max=%.1f usecs)",
+		mCnt, getAvg()*1e6, percentile(50)*1e6, percentile(90)*1e6, percentile(99)*1e6, getMax()*1e6);
+}
+
+std::ostream& operator<<(std::ostream& os, const LatencyHistogram &hist) { hist.text(os); return os; }
+
 std::string replaceAll(const std::string input, const std::string search, const std::string replace)
 {
 	std::string output = input;
@@ -125,6 +125,28 @@ template<class Type> struct Statistic {
 	//}
 };
 
+// Histogram of durations for reporting latency percentiles.
+// The buckets are spaced at quarter powers of two of microseconds, so the percentiles are
+// accurate to about 20%, which is plenty to compare one code path against another.
+// Not locked; the occasional lost increment does not matter for statistics.
+// The counters are updated with atomic operations so several threads may add points without a lock.
+// A reader may see a point counted in one field and not yet in another, which is fine for statistics.
+struct LatencyHistogram {
+	static const unsigned sNumBuckets = 100;	// Top bucket is 2^25 usecs, about 30 seconds.
+	unsigned mBuckets[sNumBuckets];
+	unsigned mCnt;
+	uint64_t mSumNsecs, mMaxNsecs;
+	LatencyHistogram() { clear(); }
+	void clear() { memset(mBuckets,0,sizeof(mBuckets)); mCnt = 0; mSumNsecs = mMaxNsecs = 0; }
+	void addPoint(double seconds);		// Add a duration as returned by the difference of two timef().
+	double percentile(double pct) const;	// pct in 0..100; result is in seconds.
+	double getAvg() const { unsigned cnt = mCnt; return cnt ? mSumNsecs/1e9/cnt : 0; }
+	double getMax() const { return mMaxNsecs/1e9; }
+	// Print N, avg, p50, p90, p99 and max in usecs.
+	void text(std::ostream &os) const;
+};
+std::ostream& operator<<(std::ostream& os, const LatencyHistogram &hist);
+
 // This I/O mechanism is so dumb:
 std::ostream& operator<<(std::ostream& os, const Statistic<int> &stat);
 std::ostream& operator<<(std::ostream& os, const Statistic<unsigned> &stat);
@@ -0,0 +1,217 @@
+/**@file Background batched writer for sqlite3 tables. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef WRITEBEHIND_H
+#define WRITEBEHIND_H
+
+#include <map>
+
+#include "Threads.h"
+#include "Logger.h"
+#include "sqlite3util.h"
+
+
+/**
+	Queues rows for a sqlite3 table and writes them from a background thread.
+	Rows queued under the same key between flushes are coalesced, so only the last one is written,
+	and each flush writes everything pending in a single sqlite transaction.
+	A failed flush is rolled back and its rows not queued again since are kept for the next one,
+	or dropped after maxFailures consecutive failures if that is not 0.
+
+	The subclass writes one row with writeRow().  It must call stop() in its own destructor,
+	so the last flush runs while its prepared statements still exist.
+*/
+template <class Key, class Row>
+class WriteBehind {
+
+	public:
+
+	typedef std::map<Key,Row> RowMap;
+
+	private:
+
+	const char *mName;			///< table name for the logs
+	sqlite3 *mWriteDB;			///< NULL until writeTo()
+	unsigned mNumTries;			///< sqlite attempts for each statement
+	unsigned mMaxFailures;		///< consecutive failed flushes before the rows are dropped, 0 for never
+
+	mutable Mutex mQueueLock;	///< protects mPending and the counters
+	Signal mWakeup;
+	RowMap mPending;			///< rows not yet written
+	unsigned mFailures;			///< consecutive failed flushes
+
+	Mutex mFlushLock;			///< one flush at a time
+	Thread *mThread;			///< created by start()
+	unsigned mInterval;			///< ms between flushes
+	volatile bool mStopping;
+
+	unsigned mQueued;			///< rows queued
+	unsigned mWritten;			///< rows written to the database
+	unsigned mFlushes;			///< sqlite transactions committed
+
+	protected:
+
+	WriteBehind(const char *wName)
+		:mName(wName),mWriteDB(NULL),mNumTries(5),mMaxFailures(0),mFailures(0),
+		mThread(NULL),mInterval(0),mStopping(false),mQueued(0),mWritten(0),mFlushes(0)
+	{ }
+
+	/** Stops the thread without a last flush; the subclass has already called stop(). */
+	virtual ~WriteBehind() { stopThread(); }
+
+	/** Write to this database from now on, or to none if NULL. */
+	void writeTo(sqlite3 *wDB, unsigned wNumTries=5, unsigned wMaxFailures=0)
+	{
+		ScopedLock flushLock(mFlushLock);
+		mWriteDB = wDB;
+		mNumTries = wNumTries ? wNumTries : 1;
+		mMaxFailures = wMaxFailures;
+	}
+
+	/** Queue the row, replacing any row queued under the same key. */
+	void queue(const Key& key, const Row& row)
+	{
+		ScopedLock lock(mQueueLock);
+		mPending[key] = row;
+		mQueued++;
+	}
+
+	/** Drop everything pending without writing it. */
+	void discard()
+	{
+		ScopedLock flushLock(mFlushLock);
+		ScopedLock lock(mQueueLock);
+		mPending.clear();
+	}
+
+	/** Write one row inside the flush transaction.  Return false to roll the flush back. */
+	virtual bool writeRow(const Key& key, const Row& row) = 0;
+
+	/** Run a bound statement for writeRow() and reset it.  Return true if it completed. */
+	bool runStatement(sqlite3_stmt *stmt)
+	{
+		int src = sqlite3_run_query(mWriteDB,stmt,mNumTries);
+		sqlite3_reset(stmt);
+		return src==SQLITE_DONE;
+	}
+
+	public:
+
+	/** Start the writer thread, flushing every interval ms.  Until then rows are only queued. */
+	void start(unsigned wInterval)
+	{
+		if (mThread) return;
+		mInterval = wInterval ? wInterval : 1;
+		mStopping = false;
+		mThread = new Thread;
+		mThread->start(flushLoop,this);
+	}
+
+	/** Stop the writer thread and flush what is pending. */
+	void stop()
+	{
+		stopThread();
+		flush();
+	}
+
+	/** Write everything queued now.  Return the number of rows written. */
+	unsigned flush()
+	{
+		ScopedLock flushLock(mFlushLock);
+		RowMap rows;
+		{
+			ScopedLock lock(mQueueLock);
+			rows.swap(mPending);
+		}
+		if (rows.empty() || !mWriteDB) return 0;
+
+		if (writeRows(rows)) {
+			ScopedLock lock(mQueueLock);
+			mWritten += rows.size();
+			mFlushes++;
+			mFailures = 0;
+			return rows.size();
+		}
+
+		ScopedLock lock(mQueueLock);
+		if (mMaxFailures && ++mFailures>=mMaxFailures) {
+			LOG(ALERT) << "cannot write " << mName << " after " << mFailures << " attempts, dropping "
+				<< rows.size() << " rows, error: " << sqlite3_errmsg(mWriteDB);
+			mFailures = 0;
+			return 0;
+		}
+		LOG(ALERT) << "cannot write " << mName << ": " << sqlite3_errmsg(mWriteDB);
+		// Put back the rows that have not been replaced since, and try them again next time.
+		for (typename RowMap::iterator itr = rows.begin(); itr!=rows.end(); ++itr) {
+			mPending.insert(*itr);
+		}
+		return 0;
+	}
+
+	unsigned pending() const { ScopedLock lock(mQueueLock); return mPending.size(); }
+	unsigned queued() const { ScopedLock lock(mQueueLock); return mQueued; }
+	unsigned written() const { ScopedLock lock(mQueueLock); return mWritten; }
+	unsigned flushes() const { ScopedLock lock(mQueueLock); return mFlushes; }
+	unsigned interval() const { return mInterval; }
+
+	private:
+
+	void stopThread()
+	{
+		if (!mThread) return;
+		{
+			ScopedLock lock(mQueueLock);
+			mStopping = true;
+			mWakeup.signal();
+		}
+		mThread->join();
+		delete mThread;
+		mThread = NULL;
+	}
+
+	bool writeRows(const RowMap& rows)
+	{
+		if (!sqlite3_command(mWriteDB,"BEGIN TRANSACTION",mNumTries)) return false;
+		for (typename RowMap::const_iterator itr = rows.begin(); itr!=rows.end(); ++itr) {
+			if (!writeRow(itr->first,itr->second)) {
+				sqlite3_command(mWriteDB,"ROLLBACK");
+				return false;
+			}
+		}
+		if (!sqlite3_command(mWriteDB,"COMMIT",mNumTries)) {
+			sqlite3_command(mWriteDB,"ROLLBACK");
+			return false;
+		}
+		return true;
+	}
+
+	static void *flushLoop(void *arg)
+	{
+		WriteBehind *writer = (WriteBehind*)arg;
+		while (!writer->mStopping) {
+			{
+				ScopedLock lock(writer->mQueueLock);
+				if (!writer->mStopping) writer->mWakeup.wait(writer->mQueueLock,writer->mInterval);
+			}
+			writer->flush();
+		}
+		return NULL;
+	}
+};
+
+#endif
+
+// vim: ts=4 sw=4
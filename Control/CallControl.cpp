@@ -33,6 +33,9 @@
 #include "MobilityManagement.h"
 #include "SMSControl.h"
 #include "CallControl.h"
+#include "ControlEngine.h"
+#include "MediaRelay.h"
+#include "JitterBuffer.h"
 
 #include <GSMCommon.h>
 #include <GSML3RRMessages.h>
@@ -85,7 +88,7 @@ unsigned allocateRTPPorts()
 	@param LCH The logical channel.
 	@param cause The L3 abort cause.
 */
-void forceGSMClearing(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, const GSM::L3Cause& cause)
+void forceGSMClearing(TransactionEntry *transaction, UMTS::LogicalChannel *LCH, const GSM::L3Cause& cause)
 {
 	LOG(INFO) << "Q.931 state " << transaction->GSMState();
 	// Already cleared?
@@ -101,76 +104,783 @@ void forceGSMClearing(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *L
 }
 
 
+
+
+namespace Control {
+
 /**
-	Force clearing on the SIP side.
-	@param transaction The call transaction record.
+	The media of a call in progress, between its TCH and its RTP session, for the MediaRelay.
+	The UMTS DTCHLogicalChannel speech calls are still stubs, so on this radio no uplink frames come out
+	and the downlink frames are dropped; the relay moves speech only for a channel that implements them.
 */
-void forceSIPClearing(TransactionEntry *transaction)
-{
-	SIP::SIPState state = transaction->SIPState();
-	LOG(INFO) << "SIP state " << state;
-	if (state==SIP::Cleared) return;
-	if (state!=SIP::MODClearing) {
-		// This also changes the SIP state to "clearing".
-		transaction->MODSendBYE();
-	} else {
-		transaction->MODResendBYE();
+class CallMediaPath : public MediaPath {
+
+	private:
+
+	TransactionEntry *mTransaction;
+	UMTS::DTCHLogicalChannel *mTCH;
+	unsigned mID;				///< for the log, since the transaction may be gone at the end
+	JitterBuffer mJitter;		///< the downlink playout
+
+	public:
+
+	CallMediaPath(TransactionEntry *wTransaction, UMTS::DTCHLogicalChannel *wTCH)
+		:mTransaction(wTransaction),mTCH(wTCH),mID(wTransaction->ID())
+	{ }
+
+	~CallMediaPath() { LOG(INFO) << "transaction " << mID << " downlink speech: " << mJitter; }
+
+	unsigned RTPRead(unsigned char *frame)
+	{
+		// Take whatever RTP has, then play this period's frame.
+		double now = timef();
+		unsigned char packet[160];
+		unsigned timestamp, sequence;
+		while (int length = mTransaction->rxPacket(packet,timestamp,sequence)) {
+			mJitter.put(packet,length,sequence,timestamp,now);
+		}
+		return mJitter.get(frame,now);
 	}
-	transaction->MODWaitForOK();
-}
 
+	void RTPWrite(const unsigned char *frame, unsigned length) { mTransaction->txFrame(const_cast<unsigned char*>(frame)); }
+
+	void radioWrite(const unsigned char *frame, unsigned length) { mTCH->sendTCH(frame); }
+
+	unsigned radioRead(unsigned char *frame)
+	{
+		unsigned char *uplink = mTCH->recvTCH();
+		if (!uplink) return 0;
+		// HACK -- Hardcoded for GSM/8000, as in the SIPEngine.
+		memcpy(frame,uplink,SIP::RTPGSM610FrameBytes);
+		delete[] uplink;
+		return SIP::RTPGSM610FrameBytes;
+	}
+};
 
 
 /**
-	Abort the call.  Does not remove the transaction from the table.
-	@param transaction The call transaction record.
-	@param LCH The logical channel.
-	@param cause The L3 abort cause.
+	A mobile originated or terminated call, from the Setup to the release of the channel,
+	run as a ControlMachine in gControlEngine instead of in a thread of its own.
+	The steps are the loops of the old blocking MOC and MTC controllers; where those blocked
+	in a channel read or a SIP wait, the machine returns and picks up again on the next event.
+	SIP reads are done only when there is something in the call's FIFO, or when a step's timer
+	runs out, where the SIPEngine's zero-timeout read takes the same timeout path as before.
+	The Q.931 timers are watched through the machine's timer too.
+	Once connected, the speech frames are moved by the MediaRelay, not by the machine.
+	However the call ends, the machine removes its transaction from the table.
 */
-void abortCall(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, const GSM::L3Cause& cause)
+class CallMachine : public ControlMachine {
+
+	public:
+
+	enum Step {
+		MOCSetupWait,		///< CM Service Accept sent, waiting for the Setup
+		MOCAlertWait,		///< INVITE sent, waiting for Ringing or OK
+		MOCAnswerWait,		///< ringing, waiting for OK
+		MOCConnectWait,		///< Connect sent, waiting for Connect Acknowledge
+		MTCConfirmWait,		///< Setup sent, waiting for Call Confirmed
+		MTCAnswerWait,		///< waiting for Alerting and Connect
+		MTCAckWait,			///< OK sent, waiting for the ACK
+		InCall,				///< connected
+		ByeWait				///< cleared on the GSM side, waiting for the response to our BYE
+	};
+
+	private:
+
+	Step mStep;
+	UMTS::LogicalChannel *mLCH;
+	TransactionEntry *mTransaction;		///< NULL until the Setup arrives in MOC
+	GSM::L3MobileIdentity mMobileID;	///< the caller, for MOC
+	GSM::L3CMServiceType mService;		///< the requested service, for MOC
+	Timeval mStepTime;					///< when the step's own timer runs out
+	bool mStepTimerActive;
+	Timeval mByeGiveUp;					///< SIP Timer.F for the BYE
+	unsigned mRTPPorts;					///< for the OK in MTC
+	bool mINFOPending;					///< waiting for the response to an RFC-2967 DTMF INFO
+	GSM::L3KeypadFacility mDTMFKey;		///< the key for that INFO
+	bool mDTMFSent;						///< the key already went out by RFC-2833
+	UMTS::DTCHLogicalChannel *mTCH;		///< the channel the MediaRelay has for this call, or NULL
+
+	public:
+
+	/** Start a MOC, waiting for the Setup. */
+	CallMachine(const GSM::L3MobileIdentity& wMobileID, const GSM::L3CMServiceType& wService, UMTS::LogicalChannel *wLCH)
+		:mStep(MOCSetupWait),mLCH(wLCH),mTransaction(NULL),
+		mMobileID(wMobileID),mService(wService),
+		mStepTimerActive(false),mRTPPorts(0),mINFOPending(false),mDTMFSent(false),mTCH(NULL)
+	{ }
+
+	/** Start a MTC for a transaction created by the SIP interface. */
+	CallMachine(TransactionEntry *wTransaction, UMTS::LogicalChannel *wLCH)
+		:mStep(MTCConfirmWait),mLCH(wLCH),mTransaction(wTransaction),
+		mStepTimerActive(false),mRTPPorts(0),mINFOPending(false),mDTMFSent(false),mTCH(NULL)
+	{ }
+
+	bool handle(Event event);
+
+	const char* name() const { return "call"; }
+
+	private:
+
+	bool started();
+	bool l3();
+	bool l3Frame(GSM::L3Frame *frame);
+	bool sip();
+	bool timer();
+	bool terminated();
+
+	/** Handle the Setup in MOC. */
+	bool MOCSetup(GSM::L3Frame *frame);
+	/** Act on the SIP state from MOCWaitForOK. */
+	bool MOCResponse(SIP::SIPState state);
+	/** Send Connect and ACK the OK. */
+	bool MOCConnect();
+	/** Send Trying and check for CANCEL while waiting for Call Confirmed. */
+	bool MTCConfirmPoll();
+	/** Allocate the ports and send the OK. */
+	bool MTCSendOK();
+	/** Act on the SIP state from MTCWaitForACK. */
+	bool MTCAck(SIP::SIPState state);
+	bool enterInCall();
+
+	/** Process a message from the phone, as callManagementDispatchGSM did.  Return true if the GSM side is cleared. */
+	bool dispatchGSM(const GSM::L3Message *message);
+	/** Acknowledge or reject the Start DTMF. */
+	void answerDTMF(bool success);
+	/** Answer the Start DTMF once the INFO is answered or timed out. */
+	bool DTMFResult(bool INFOOK);
+
+	/** The GSM side is cleared and the channel released; clear the SIP side. */
+	bool GSMCleared();
+	/** Abort the call in both domains. */
+	bool abort(const GSM::L3Cause& cause);
+	/** Clear the SIP side, if it is not already, and finish. */
+	bool clearSIP();
+	/** Remove the transaction.  Always returns false, the machine being done. */
+	bool finish();
+	/** Release the channel for the exception being handled, and finish. */
+	bool failed();
+
+	/** Hand the call's speech to the MediaRelay, if it has a traffic channel. */
+	void startMedia();
+	/** Take the call back from the MediaRelay. */
+	void stopMedia();
+
+	bool SIPWaiting() const;
+	void stepTimer(unsigned ms) { mStepTime.future(ms); mStepTimerActive = true; }
+	/** Set the machine's timer to the first of the step's timer and the Q.931 timers. */
+	void rearm();
+};
+
+}	// Control
+
+
+
+bool CallMachine::handle(Event event)
 {
-	LOG(INFO) << "cause: " << cause << ", transction: " << *transaction;
-	if (LCH) forceGSMClearing(transaction,LCH,cause);
-	forceSIPClearing(transaction);
+	try {
+		bool running = true;
+		switch (event) {
+			case StartEvent: running = started(); break;
+			case L3Event: running = l3(); break;
+			case SIPEvent: running = sip(); break;
+			case TimerEvent: running = timer(); break;
+			case TerminateEvent: running = terminated(); break;
+		}
+		if (running) rearm();
+		return running;
+	}
+	catch (ControlLayerException) { return failed(); }
+	catch (SIP::SIPException) { return failed(); }
 }
 
 
-/**
-	Abort the call and remove the transaction.
-	@param transaction The call transaction record.
-	@param LCH The logical channel.
-	@param cause The L3 abort cause.
-*/
-void abortAndRemoveCall(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, const GSM::L3Cause& cause)
+bool CallMachine::failed()
 {
-	abortCall(transaction,LCH,cause);
-	gTransactionTable.remove(transaction);
+	stopMedia();
+	unsigned ID = releaseForException(mLCH);
+	if (mTransaction) gTransactionTable.remove(mTransaction);
+	else if (ID) gTransactionTable.remove(ID);
+	mTransaction = NULL;
+	return false;
+}
+
+
+bool CallMachine::finish()
+{
+	stopMedia();
+	if (mTransaction) gTransactionTable.remove(mTransaction);
+	mTransaction = NULL;
+	return false;
+}
+
+
+bool CallMachine::SIPWaiting() const
+{
+	if (!mTransaction) return false;
+	return gSIPInterface.fifoSize(mTransaction->SIPCallID())>0;
+}
+
+
+void CallMachine::rearm()
+{
+	long wait = -1;
+	if (mStepTimerActive) {
+		wait = mStepTime.remaining();
+		if (wait<0) wait = 0;
+	}
+	if (mTransaction) {
+		long q931 = mTransaction->timerRemaining();
+		if (q931>=0 && (wait<0 || q931<wait)) wait = q931;
+	}
+	if (wait<0) cancelTimeout();
+	else timeout(wait);
+}
+
+
+bool CallMachine::started()
+{
+	if (mStep==MOCSetupWait) {
+		// GSM 04.08 5.2.1.2
+		// FIXME -- We need to set a proper timeout here.
+		stepTimer(20000);
+		// The Setup may already be here.
+		return l3();
+	}
+
+	// MTC
+	LOG(INFO) << "MTC on " << mLCH->type() << " transaction: "<< *mTransaction;
+	gControlEngine.attachCallID(this,mTransaction->SIPCallID());
+	unsigned L3TI = mTransaction->L3TI();
+	assert(L3TI<7);
+
+	// GSM 04.08 5.2.2.1
+	LOG(INFO) << "sending GSM Setup to call " << mTransaction->calling();
+	mLCH->send(GSM::L3Setup(L3TI,GSM::L3CallingPartyBCDNumber(mTransaction->calling())));
+	mTransaction->setTimer("303");
+	mTransaction->GSMState(GSM::CallPresent);
+
+	// Wait for Call Confirmed message.
+	LOG(DEBUG) << "wait for GSM Call Confirmed";
+	return MTCConfirmPoll() && l3();
+}
+
+
+bool CallMachine::l3()
+{
+	// While an INFO is outstanding, leave the next messages in the channel,
+	// so they are taken in order, as the blocking controller did.
+	while (!mINFOPending) {
+		GSM::L3Frame *frame = mLCH->recv(0);
+		if (!frame) return true;
+		if (!l3Frame(frame)) return false;
+	}
+	return true;
+}
+
+
+bool CallMachine::l3Frame(GSM::L3Frame *frame)
+{
+	if (mStep==MOCSetupWait) return MOCSetup(frame);
+
+	if (mStep==ByeWait) {
+		LOG(INFO) << "ignoring " << *frame << " after GSM clearing " << *mTransaction;
+		delete frame;
+		return true;
+	}
+
+	// Check for lower-layer error.
+	if (frame->primitive() == GSM::ERROR) {
+		LOG(NOTICE) << "radio link failure, dropped call " << *mTransaction;
+		delete frame;
+		return clearSIP();
+	}
+
+	// Parse and dispatch.
+	GSM::L3Message *msg = parseL3(*frame);
+	delete frame;
+	if (!msg) return true;
+	LOG(DEBUG) << "received " << *msg;
+	bool cleared = dispatchGSM(msg);
+	delete msg;
+	if (cleared) return GSMCleared();
+
+	switch (mStep) {
+		case MOCAlertWait:
+		case MOCAnswerWait:
+			if (mTransaction->clearingGSM()) return abort(GSM::L3Cause(0x7F));
+			return true;
+		case MOCConnectWait:
+			if (mTransaction->GSMState()==GSM::Active) return enterInCall();
+			return true;
+		case MTCConfirmWait:
+			if (mTransaction->GSMState()!=GSM::MTCConfirmed) return true;
+			// Early Assignment Mobile Terminated Call.
+			// Transaction table in 04.08 7.3.3 figure 7.10a
+			LOG(INFO) << "waiting for GSM Alerting and Connect";
+			mStep = MTCAnswerWait;
+			stepTimer(1000);
+			return true;
+		case MTCAnswerWait:
+			if (mTransaction->GSMState()==GSM::Active) return MTCSendOK();
+			if (mTransaction->GSMState()==GSM::CallReceived) {
+				LOG(DEBUG) << "sending SIP Ringing";
+				mTransaction->MTCSendRinging();
+			}
+			return true;
+		default:
+			return true;
+	}
+}
+
+
+bool CallMachine::sip()
+{
+	while (SIPWaiting()) {
+		switch (mStep) {
+			case MOCAlertWait:
+			case MOCAnswerWait:
+				if (!MOCResponse(mTransaction->MOCWaitForOK(0))) return false;
+				break;
+			case MTCConfirmWait:
+			case MTCAnswerWait:
+				// Check for SIP cancel.
+				if (mTransaction->MTCCheckForCancel()==SIP::Fail) {
+					LOG(NOTICE) << "call cancelled or failed on SIP side";
+					// Cause 0x15 is "rejected"
+					if (mStep==MTCConfirmWait) return abort(GSM::L3Cause(0x15));
+					return abort(GSM::L3Cause(0x7F));
+				}
+				break;
+			case MTCAckWait:
+				if (!MTCAck(mTransaction->MTCWaitForACK(0))) return false;
+				break;
+			case InCall:
+				if (mINFOPending) {
+					if (!DTMFResult(mTransaction->waitForINFOOK(0))) return false;
+					break;
+				}
+				// The main purpose of this is to initiate disconnects from the SIP side.
+				// Anything else waits for the step that reads it.
+				if (mTransaction->SIPState()!=SIP::Active) return true;
+				if (mTransaction->MTDCheckBYE() == SIP::MTDClearing) {
+					LOG(DEBUG) << "got SIP BYE " << *mTransaction;
+					if (mTransaction->GSMState()!=GSM::NullState && !mTransaction->clearingGSM()) {
+						// Initiate clearing in the GSM side.
+						mLCH->send(GSM::L3Disconnect(mTransaction->L3TI()));
+						mTransaction->setTimer("305");
+						mTransaction->GSMState(GSM::DisconnectIndication);
+					} else {
+						// GSM already cleared?
+						// Ack the BYE and end the call.
+						mTransaction->MTDSendOK();
+						if (mTransaction->GSMState()==GSM::NullState) return finish();
+					}
+				}
+				break;
+			case ByeWait:
+				mTransaction->MODWaitForOK(false);
+				return finish();
+			default:
+				// Leave it for a later step.
+				return true;
+		}
+	}
+	return true;
+}
+
+
+bool CallMachine::timer()
+{
+	// Any Q.931 timer expired?
+	if (mTransaction && mTransaction->GSMState()!=GSM::NullState && mTransaction->anyTimerExpired()) {
+		// Cause 0x66, "recover on timer expiry"
+		return abort(GSM::L3Cause(0x66));
+	}
+
+	if (!mStepTimerActive || !mStepTime.passed()) return true;
+	mStepTimerActive = false;
+
+	switch (mStep) {
+		case MOCSetupWait:
+			LOG(NOTICE) << "timeout";
+			throw ChannelReadTimeout();
+		case MOCAlertWait:
+		case MOCAnswerWait:
+			// Nothing queued, so this is the SIP timeout.
+			return MOCResponse(mTransaction->MOCWaitForOK(0));
+		case MTCConfirmWait:
+			return MTCConfirmPoll();
+		case MTCAnswerWait:
+			if (mTransaction->GSMState()==GSM::CallReceived) {
+				LOG(DEBUG) << "sending SIP Ringing";
+				mTransaction->MTCSendRinging();
+			}
+			stepTimer(1000);
+			return true;
+		case MTCAckWait:
+			return MTCAck(mTransaction->MTCWaitForACK(0));
+		case InCall:
+			if (mINFOPending) return DTMFResult(mTransaction->waitForINFOOK(0));
+			return true;
+		case ByeWait:
+			if (mByeGiveUp.passed()) {
+				// This gives up and clears the SIP side.
+				mTransaction->MODWaitForOK(false);
+				return finish();
+			}
+			LOG(NOTICE) << "response timeout, resending BYE";
+			mTransaction->MODResendBYE();
+			stepTimer(gConfig.getNum("SIP.Timer.E"));
+			return true;
+		default:
+			return true;
+	}
+}
+
+
+bool CallMachine::terminated()
+{
+	// During setup the request waits until the call connects, as it did before.
+	if (mStep!=InCall) return true;
+	if (!mTransaction->terminationRequested()) return true;
+	// Cause 25 is "pre-emptive clearing".
+	// If something else is requesting termination,
+	// it's probably because we need the channel for
+	// something else (like an emegency call) right away.
+	return abort(25);
+}
+
+
+bool CallMachine::MOCSetup(GSM::L3Frame *frame)
+{
+	mStepTimerActive = false;
+	// Parse here rather than with parseMessage, so the frame is still around to log if it is not a Setup.
+	GSM::L3Message *msg_setup = frame->primitive()==GSM::DATA ? GSM::parseL3(*frame) : NULL;
+	const GSM::L3Setup *setup = dynamic_cast<const GSM::L3Setup*>(msg_setup);
+	if (!setup) {
+		LOG(WARNING) << "Unexpected frame " << *frame;
+		bool isData = frame->primitive()==GSM::DATA;
+		delete frame;
+		if (!isData) throw UnexpectedPrimitive();
+		if (!msg_setup) throw UnsupportedMessage();
+		delete msg_setup;
+		throw UnexpectedMessage();
+	}
+	delete frame;
+	LOG(INFO) << *setup;
+	// Pull out the L3 short transaction information now.
+	// See GSM 04.07 11.2.3.1.3.
+	// Set the high bit, since this TI came from the MS.
+	unsigned L3TI = setup->TI() | 0x08;
+	if (!setup->haveCalledPartyBCDNumber()) {
+		// FIXME -- This is quick-and-dirty, not following GSM 04.08 5.
+		LOG(WARNING) << "MOC setup with no number";
+		// Cause 0x60 "Invalid mandatory information"
+		mLCH->send(GSM::L3ReleaseComplete(L3TI,0x60));
+		mLCH->send(GSM::L3ChannelRelease());
+		// The SIP side and transaction record don't exist yet.
+		// So we're done.
+		delete msg_setup;
+		return false;
+	}
+
+	LOG(DEBUG) << "SIP start engine";
+	// Pull out Number user is trying to call and use as the sip_uri.
+	const char *bcdDigits = setup->calledPartyBCDNumber().digits();
+
+	// Create a transaction table entry.
+	mTransaction = new TransactionEntry(
+		gConfig.getStr("SIP.Proxy.Speech").c_str(),
+		mMobileID,
+		mLCH,
+		mService,
+		L3TI,
+		setup->calledPartyBCDNumber());
+	LOG(DEBUG) << "transaction: " << *mTransaction;
+	gTransactionTable.add(mTransaction);
+	// The responses to the INVITE come here.
+	gControlEngine.attachCallID(this,mTransaction->SIPCallID());
+
+	// At this point, we have enough information start the SIP call setup.
+	// We also have a SIP side and a transaction that will need to be
+	// cleaned up on abort or clearing.
+
+	// Now start a call by contacting asterisk.
+	// Engine methods will return their current state.	
+	// The remote party will start ringing soon.
+	LOG(DEBUG) << "starting SIP (INVITE) Calling "<<bcdDigits;
+	unsigned basePort = allocateRTPPorts();
+	mTransaction->MOCSendINVITE(bcdDigits,gConfig.getStr("SIP.Local.IP").c_str(),basePort,SIP::RTPGSM610);
+	LOG(DEBUG) << "transaction: " << *mTransaction;
+
+	// Once we can start SIP call setup, send Call Proceeding.
+	LOG(INFO) << "Sending Call Proceeding";
+	mLCH->send(GSM::L3CallProceeding(L3TI));
+	mTransaction->GSMState(GSM::MOCProceeding);
+	// Finally done with the Setup message.
+	delete msg_setup;
+
+	// Look for RINGING or OK from the SIP side.
+	// There's a T310 running on the phone now.
+	// The phone will initiate clearing if it expires.
+	LOG(INFO) << "wait for Ringing or OK";
+	mStep = MOCAlertWait;
+	stepTimer(gConfig.getNum("SIP.Timer.A"));
+	return true;
+}
+
+
+bool CallMachine::MOCResponse(SIP::SIPState state)
+{
+	LOG(DEBUG) << "SIP state="<<state;
+	unsigned L3TI = mTransaction->L3TI();
+	if (mStep==MOCAlertWait) {
+		switch (state) {
+			case SIP::Busy:
+				LOG(INFO) << "SIP:Busy, abort";
+				return abort(GSM::L3Cause(0x11));
+			case SIP::Fail:
+				LOG(NOTICE) << "SIP:Fail, abort";
+				return abort(GSM::L3Cause(0x7F));
+			case SIP::Ringing:
+				LOG(INFO) << "SIP:Ringing, send Alerting and move on";
+				mLCH->send(GSM::L3Alerting(L3TI));
+				mTransaction->GSMState(GSM::CallReceived);
+				// There's a question here of what entity is generating the "patterns"
+				// (ringing, busy signal, etc.) during call set-up.  For now, we're ignoring 
+				// that question and hoping the phone will make its own ringing pattern.
+				// There's a timer on the phone that will initiate clearing if it expires.
+				LOG(INFO) << "wait for SIP OKAY";
+				mStep = MOCAnswerWait;
+				stepTimer(gConfig.getNum("SIP.Timer.A"));
+				return true;
+			case SIP::Active:
+				LOG(DEBUG) << "SIP:Active, move on";
+				mTransaction->GSMState(GSM::CallReceived);
+				return MOCConnect();
+			case SIP::Proceeding:
+				LOG(DEBUG) << "SIP:Proceeding, send progress";
+				mLCH->send(GSM::L3Progress(L3TI));
+				break;
+			case SIP::Timeout:
+				LOG(NOTICE) << "SIP:Timeout, reinvite";
+				mTransaction->MOCResendINVITE();
+				break;
+			default:
+				LOG(NOTICE) << "SIP unexpected state " << state;
+				break;
+		}
+		stepTimer(gConfig.getNum("SIP.Timer.A"));
+		return true;
+	}
+
+	// MOCAnswerWait
+	switch (state) {
+		case SIP::Busy:
+			// Should this be possible at this point?
+			LOG(INFO) << "SIP:Busy, abort";
+			return abort(GSM::L3Cause(0x11));
+		case SIP::Fail:
+			LOG(INFO) << "SIP:Fail, abort";
+			return abort(GSM::L3Cause(0x7F));
+		case SIP::Active:
+			return MOCConnect();
+		case SIP::Proceeding:
+			LOG(DEBUG) << "SIP:Proceeding, NOT sending progress";
+			break;
+		// For these cases, do nothing.
+		case SIP::Timeout:
+			// FIXME We should abort if this happens too often.
+			// For now, we are relying on the phone, which may have bugs of its own.
+		default:
+			break;
+	}
+	stepTimer(gConfig.getNum("SIP.Timer.A"));
+	return true;
 }
 
 
+bool CallMachine::MOCConnect()
+{
+	// Let the phone know the call is connected.
+	LOG(INFO) << "sending Connect to handset";
+	mLCH->send(GSM::L3Connect(mTransaction->L3TI()));
+	mTransaction->setTimer("313");
+	mTransaction->GSMState(GSM::ConnectIndication);
+
+	// The call is open.
+	mTransaction->MOCInitRTP();
+	mTransaction->MOCSendACK();
 
+	// FIXME -- We need to watch for a repeated OK in case the ACK got lost.
 
+	// Get the Connect Acknowledge message.
+	LOG(DEBUG) << "MOC Q.931 state=" << mTransaction->GSMState();
+	mStep = MOCConnectWait;
+	mStepTimerActive = false;
+	return true;
+}
+
+
+bool CallMachine::MTCConfirmPoll()
+{
+	if (mTransaction->MTCSendTrying()==SIP::Fail) {
+		LOG(NOTICE) << "call failed on SIP side";
+		mLCH->send(GSM::RELEASE);
+		// Cause 0x03 is "no route to destination"
+		return abort(GSM::L3Cause(0x03));
+	}
+	// FIXME -- What's the proper timeout here?
+	// It's the SIP TRYING timeout, whatever that is.
+	stepTimer(1000);
+	return sip();
+}
+
+
+bool CallMachine::MTCSendOK()
+{
+	// FIXME -- We should also have a SIP.Timer.F timeout here.
+	LOG(INFO) << "allocating port and sending SIP OKAY";
+	mRTPPorts = allocateRTPPorts();
+	mStep = MTCAckWait;
+	return MTCAck(mTransaction->MTCSendOK(mRTPPorts,SIP::RTPGSM610));
+}
+
+
+bool CallMachine::MTCAck(SIP::SIPState state)
+{
+	LOG(DEBUG) << "SIP call state "<< state;
+	switch (state) {
+		case SIP::Active:
+			mTransaction->MTCInitRTP();
+			// Send Connect Ack to make it all official.
+			LOG(DEBUG) << "MTC send GSM Connect Acknowledge";
+			mLCH->send(GSM::L3ConnectAcknowledge(mTransaction->L3TI()));
+			return enterInCall();
+		case SIP::Fail:
+			return abort(GSM::L3Cause(0x7F));
+		case SIP::Timeout:
+			mTransaction->MTCSendOK(mRTPPorts,SIP::RTPGSM610);
+			break;
+		case SIP::Connecting:
+			break;
+		default:
+			LOG(NOTICE) << "SIP unexpected state " << state;
+			break;
+	}
+	LOG(DEBUG) << "wait for SIP OKAY-ACK";
+	stepTimer(gConfig.getNum("SIP.Timer.H"));
+	return true;
+}
+
+
+bool CallMachine::enterInCall()
+{
+	LOG(INFO) << " call connected " << *mTransaction;
+	mStep = InCall;
+	mStepTimerActive = false;
+	startMedia();
+	// A termination request during setup takes effect now.
+	if (!terminated()) return false;
+	// Anything from the SIP side that waited for the call to connect.
+	return sip();
+}
+
+
+bool CallMachine::GSMCleared()
+{
+	if (mStep==MTCConfirmWait) {
+		LOG(INFO) << "Release from GSM side";
+		mLCH->send(GSM::RELEASE);
+	}
+	return clearSIP();
+}
+
+
+bool CallMachine::abort(const GSM::L3Cause& cause)
+{
+	LOG(INFO) << "cause: " << cause << ", transaction: " << *mTransaction;
+	forceGSMClearing(mTransaction,mLCH,cause);
+	return clearSIP();
+}
+
+
+void CallMachine::startMedia()
+{
+	mTCH = dynamic_cast<UMTS::DTCHLogicalChannel*>(mLCH);
+	if (!mTCH) {
+		LOG(NOTICE) << "no traffic channel for the speech of " << *mTransaction;
+		return;
+	}
+	// The latency limit is read once here, not for every frame.
+	gMediaRelay.add(mTCH,new CallMediaPath(mTransaction,mTCH),gConfig.getNum("GSM.MaxSpeechLatency"));
+}
+
+
+void CallMachine::stopMedia()
+{
+	if (!mTCH) return;
+	gMediaRelay.remove(mTCH);
+	mTCH = NULL;
+}
+
+
+bool CallMachine::clearSIP()
+{
+	stopMedia();
+	SIP::SIPState state = mTransaction->SIPState();
+	LOG(INFO) << "SIP state " << state;
+	if (state==SIP::Cleared) return finish();
+	// This also changes the SIP state to "clearing".
+	if (state!=SIP::MODClearing) mTransaction->MODSendBYE();
+	// Wait for the OK, resending the BYE on Timer.E, up to Timer.F.
+	mStep = ByeWait;
+	mINFOPending = false;
+	mByeGiveUp.future(gConfig.getNum("SIP.Timer.F"));
+	stepTimer(gConfig.getNum("SIP.Timer.E"));
+	return sip();
+}
+
+
+void CallMachine::answerDTMF(bool success)
+{
+	if (success) {
+		 mLCH->send(GSM::L3StartDTMFAcknowledge(mTransaction->L3TI(),mDTMFKey));
+	} else {
+		LOG (CRIT) << "DTMF sending attempt failed; is any DTMF method defined?";
+		// Cause 0x3f means "service or option not available".
+		mLCH->send(GSM::L3StartDTMFReject(mTransaction->L3TI(),0x3f));
+	}
+}
+
+
+bool CallMachine::DTMFResult(bool INFOOK)
+{
+	mINFOPending = false;
+	mStepTimerActive = false;
+	if (!INFOOK) LOG(ERR) << "DTMF RFC-2967 failed.";
+	answerDTMF(mDTMFSent || INFOOK);
+	// Take the messages held back while waiting.
+	return l3();
+}
 
 
 /**
 	Process a message received from the phone during a call.
 	This function processes all deviations from the "call connected" state.
 	For now, we handle call clearing and politely reject everything else.
-	@param transaction The transaction record for this call.
-	@param LCH The logical channel for the transaction.
 	@param message A pointer to the receiver message.
 	@return true If the call has been cleared and the channel released.
 */
-bool callManagementDispatchGSM(TransactionEntry *transaction, UMTS::DTCHLogicalChannel* LCH, const GSM::L3Message *message)
+bool CallMachine::dispatchGSM(const GSM::L3Message *message)
 {
+	TransactionEntry *transaction = mTransaction;
+	UMTS::LogicalChannel *LCH = mLCH;
 	LOG(DEBUG) << "from " << transaction->subscriber() << " message " << *message;
 
 	// FIXME -- This dispatch section should be something more efficient with PD and MTI swtiches.
 
-	// Actually check state before taking action.
-	//if (transaction->SIPState()==SIP::Cleared) return true;
-	//if (transaction->GSMState()==GSM::NullState) return true;
-
 	// Call connection steps.
 
 	// Connect Acknowledge
@@ -242,21 +952,23 @@ bool callManagementDispatchGSM(TransactionEntry *transaction, UMTS::DTCHLogicalC
 
 	// Release Complete (3nd step of MOD)
 	// GSM 04.08 5.4.3.4
+	// The OK to our BYE is taken in the ByeWait step.
 	if (dynamic_cast<const GSM::L3ReleaseComplete*>(message)) {
 		LOG(INFO) << "GSM Release Complete " << *transaction;
 		transaction->resetTimers();
 		LCH->send(GSM::L3ChannelRelease());
 		transaction->GSMState(GSM::NullState);
-		transaction->MODWaitForOK();
 		return true;
 	}
 
 	// IMSI Detach -- the phone is shutting off.
+	// The SIP side is cleared once this returns.
 	if (const GSM::L3IMSIDetachIndication* detach = dynamic_cast<const GSM::L3IMSIDetachIndication*>(message)) {
 		// The IMSI detach procedure will release the LCH.
 		LOG(INFO) << "GSM IMSI Detach " << *transaction;
-		IMSIDetachController(detach,LCH->DCCH());
-		forceSIPClearing(transaction);
+		UMTS::DCCHLogicalChannel *DCCH = dynamic_cast<UMTS::DCCHLogicalChannel*>(LCH);
+		if (!DCCH) DCCH = LCH->DCCH();
+		IMSIDetachController(detach,DCCH);
 		return true;
 	}
 
@@ -271,19 +983,17 @@ bool callManagementDispatchGSM(TransactionEntry *transaction, UMTS::DTCHLogicalC
 			if (!s) LOG(ERR) << "DTMF RFC-28333 failed.";
 			success |= s;
 		}
+		mDTMFKey = startDTMF->key();
+		mDTMFSent = success;
 		if (gConfig.defines("SIP.DTMF.RFC2967")) {
+			// DTMFResult answers the phone when the INFO is answered or times out.
 			unsigned bcd = GSM::encodeBCDChar(key);
-			bool s = transaction->sendINFOAndWaitForOK(bcd);
-			if (!s) LOG(ERR) << "DTMF RFC-2967 failed.";
-			success |= s;
-		}
-		if (success) {
-			 LCH->send(GSM::L3StartDTMFAcknowledge(transaction->L3TI(),startDTMF->key()));
-		} else {
-			LOG (CRIT) << "DTMF sending attempt failed; is any DTMF method defined?";
-			// Cause 0x3f means "service or option not available".
-			LCH->send(GSM::L3StartDTMFReject(transaction->L3TI(),0x3f));
+			transaction->sendINFO(bcd);
+			mINFOPending = true;
+			stepTimer(gConfig.getNum("SIP.Timer.A"));
+			return false;
 		}
+		answerDTMF(success);
 		return false;
 	}
 
@@ -333,226 +1043,13 @@ bool callManagementDispatchGSM(TransactionEntry *transaction, UMTS::DTCHLogicalC
 
 
 
-
-
 /**
-	Update vocoder data transfers in both directions.
-	@param transaction The transaction object for this call.
-	@param TCH The traffic channel for this call.
-	@return True if anything was transferred.
-*/
-bool updateCallTraffic(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *TCH)
-{
-	bool activity = false;
-
-	// Transfer in the downlink direction (RTP->GSM).
-	// Blocking call.  On average returns 1 time per 20 ms.
-	// Returns non-zero if anything really happened.
-	// Make the rxFrame buffer big enough for G.711.
-	unsigned char rxFrame[160];
-	if (transaction->rxFrame(rxFrame)) {
-		activity = true;
-		TCH->sendTCH(rxFrame);
-	}
-
-	// Transfer in the uplink direction (GSM->RTP).
-	// Flush FIFO to limit latency.
-	unsigned maxQ = gConfig.getNum("GSM.MaxSpeechLatency");
-	while (TCH->queueSize()>maxQ) delete[] TCH->recvTCH();
-	if (unsigned char *txFrame = TCH->recvTCH()) {
-		activity = true;
-		// Send on RTP.
-		transaction->txFrame(txFrame);
-		delete[] txFrame;
-	}
-
-	// Return a flag so the caller will know if anything transferred.
-	return activity;
-}
-
-
-
-
-/**
-	Check GSM signalling.
-	Can block for up to 52 GSM L1 frames (240 ms) because LCH::send is blocking.
-	@param transaction The call's TransactionEntry.
-	@param LCH The call's logical channel (TCH/FACCH or SDCCH).
-	@return true If the call was cleared, but the transaction is still there.
-*/
-bool updateGSMSignalling(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, unsigned timeout=0)
-{
-	if (transaction->GSMState()==GSM::NullState) return true;
-
-	// Any Q.931 timer expired?
-	if (transaction->anyTimerExpired()) {
-		// Cause 0x66, "recover on timer expiry"
-		abortCall(transaction,LCH,GSM::L3Cause(0x66));
-		return true;
-	}
-
-	// Look for a control message from MS side.
-	if (GSM::L3Frame *l3 = LCH->recv(timeout)) {
-		// Check for lower-layer error.
-		if (l3->primitive() == GSM::ERROR) return true;
-		// Parse and dispatch.
-		GSM::L3Message *l3msg = parseL3(*l3);
-		delete l3;
-		bool cleared = false;
-		if (l3msg) {
-			LOG(DEBUG) << "received " << *l3msg;
-			cleared = callManagementDispatchGSM(transaction, LCH, l3msg);
-			delete l3msg;
-		}
-		return cleared;
-	}
-
-	// If we are here, we have timed out, but assume the call is still running.
-	return false;
-}
-
-
-
-/**
-	Check SIP signalling.
-	@param transaction The call's TransactionEntry.
-	@param LCH The call's GSM logical channel (TCH/FACCH or SDCCH).
-	@param GSMCleared True if the call is already cleared in the GSM domain.
-	@return true If the call is cleared in the SIP domain.
-*/
-bool updateSIPSignalling(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, bool GSMCleared)
-{
-
-	// The main purpose of this code is to initiate disconnects from the SIP side.
-
-	if (transaction->SIPState()==SIP::Cleared) return true;
-
-	bool GSMClearedOrClearing = GSMCleared || transaction->clearingGSM();
-
-	if (transaction->MTDCheckBYE() == SIP::MTDClearing) {
-		LOG(DEBUG) << "got SIP BYE " << *transaction;
-		if (!GSMClearedOrClearing) {
-			// Initiate clearing in the GSM side.
-			LCH->send(GSM::L3Disconnect(transaction->L3TI()));
-			transaction->setTimer("305");
-			transaction->GSMState(GSM::DisconnectIndication);
-		} else {
-			// GSM already cleared?
-			// Ack the BYE and end the call.
-			transaction->MTDSendOK();
-		}
-	}
-
-	return transaction->SIPState()==SIP::Cleared;
-}
-
-
-
-/**
-	Check SIP and GSM signalling.
-	Can block for up to 52 GSM L1 frames (240 ms) because LCH::send is blocking.
-	@param transaction The call's TransactionEntry.
-	@param LCH The call's logical channel (TCH/FACCH or SDCCH).
-	@return true If the call is cleared in both domains.
-*/
-bool updateSignalling(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH, unsigned timeout=0)
-{
-
-	bool GSMCleared = (updateGSMSignalling(transaction,LCH,timeout));
-	bool SIPCleared = updateSIPSignalling(transaction,LCH,GSMCleared);
-	return GSMCleared && SIPCleared;
-}
-
-
-
-
-/**
-	Poll for activity while in a call.
-	Sleep if needed to prevent fast spinning.
-	Will block for up to 250 ms.
-	@param transaction The call's TransactionEntry.
-	@param TCH The call's TCH+FACCH.
-	@return true If the call was cleared.
-*/
-bool pollInCall(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *TCH)
-{
-	// See if the radio link disappeared.
-	if (TCH->radioFailure()) {
-		LOG(NOTICE) << "radio link failure, dropped call";
-		forceSIPClearing(transaction);
-		return true;
-	}
-
-	// Process pending SIP and GSM signalling.
-	// If this returns true, it means the call is fully cleared.
-	if (updateSignalling(transaction,TCH)) return true;
-
-	// Did an outside process request a termination?
-	if (transaction->terminationRequested()) {
-		// Cause 25 is "pre-emptive clearing".
-		abortCall(transaction,TCH,25);
-		// Do the hard release to short-cut the timers.
-		// If something else is requesting termination,
-		// it's probably because we need the channel for
-		// something else (like an emegency call) right away.
-		//TCH->send(GSM::HARDRELEASE);
-		return true;
-	}
-
-	// Transfer vocoder data.
-	// If anything happened, then the call is still up.
-	if (updateCallTraffic(transaction,TCH)) return false;
-
-	// If nothing happened, sleep so we don't burn up the CPU cycles.
-	msleep(50);
-	return false;
-}
-
-
-/**
-	Pause for a given time while managing the connection.
-	Returns on timeout or call clearing.
-	Used for debugging to simulate ringing at terminating end.
-	@param transaction The transaction record for the call.
-	@param TCH The TCH+FACCH sed for this call.
-	@param waitTime_ms The maximum time to wait, in ms.
-	@return true If the call is cleared during the wait.
-*/
-bool waitInCall(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *TCH, unsigned waitTime_ms)
-{
-	Timeval targetTime(waitTime_ms);
-	LOG(DEBUG);
-	while (!targetTime.passed()) {
-		if (pollInCall(transaction,TCH)) return true;
-	}
-	return false;
-}
-
-
-
-/**
-	This is the standard call manangement loop, regardless of the origination type.
-	This function returns when the call is cleared and the channel is released.
-	@param transaction The transaction record for this call, will be cleared on exit.
-	@param TCH The TCH+FACCH for the call.
-*/
-void callManagementLoop(TransactionEntry *transaction, UMTS::DTCHLogicalChannel* TCH)
-{
-	LOG(INFO) << " call connected " << *transaction;
-	// poll everything until the call is cleared
-	while (!pollInCall(transaction,TCH)) { }
-	gTransactionTable.remove(transaction);
-}
-
-
-
-
-/**
-	This function starts MOC on the SDCCH to the point of TCH assignment. 
+	This function accepts MOC on the DCCH and hands the call to a CallMachine,
+	which takes it from the Setup. 
 	@param req The CM Service Request that started all of this.
 	@param LCH The logical used to initiate call setup.
 */
-void Control::MOCStarter(const GSM::L3CMServiceRequest* req, UMTS::DTCHLogicalChannel *LCH)
+void Control::MOCStarter(const GSM::L3CMServiceRequest* req, UMTS::LogicalChannel *LCH)
 {
 	assert(LCH);
 	assert(req);
@@ -572,357 +1069,22 @@ void Control::MOCStarter(const GSM::L3CMServiceRequest* req, UMTS::DTCHLogicalCh
 	// For now, we are assuming that the phone won't make a call if it didn't
 	// get registered.
 
+	// The machine owns the channel from here, so the Setup goes to it.
+	gControlEngine.add(new CallMachine(mobileID,req->serviceType(),LCH),LCH);
+
 	// Let the phone know we're going ahead with the transaction.
 	LOG(INFO) << "sending CMServiceAccept";
 	LCH->send(GSM::L3CMServiceAccept());
-
-	// Get the Setup message.
-	// GSM 04.08 5.2.1.2
-	GSM::L3Message* msg_setup = getMessage(LCH);
-	const GSM::L3Setup *setup = dynamic_cast<const GSM::L3Setup*>(msg_setup);
-	if (!setup) {
-		if (msg_setup) {
-			LOG(WARNING) << "Unexpected message " << *msg_setup;
-			delete msg_setup;
-		}
-		throw UnexpectedMessage();
-	}
-	LOG(INFO) << *setup;
-	// Pull out the L3 short transaction information now.
-	// See GSM 04.07 11.2.3.1.3.
-	// Set the high bit, since this TI came from the MS.
-	unsigned L3TI = setup->TI() | 0x08;
-	if (!setup->haveCalledPartyBCDNumber()) {
-		// FIXME -- This is quick-and-dirty, not following GSM 04.08 5.
-		LOG(WARNING) << "MOC setup with no number";
-		// Cause 0x60 "Invalid mandatory information"
-		LCH->send(GSM::L3ReleaseComplete(L3TI,0x60));
-		LCH->send(GSM::L3ChannelRelease());
-		// The SIP side and transaction record don't exist yet.
-		// So we're done.
-		delete msg_setup;
-		return;
-	}
-
-	LOG(DEBUG) << "SIP start engine";
-	// Get the users sip_uri by pulling out the IMSI.
-	//const char *IMSI = mobileID.digits();
-	// Pull out Number user is trying to call and use as the sip_uri.
-	const char *bcdDigits = setup->calledPartyBCDNumber().digits();
-
-	// Create a transaction table entry so the TCH controller knows what to do later.
-	// The transaction on the TCH will be a continuation of this one.
-	TransactionEntry *transaction = new TransactionEntry(
-		gConfig.getStr("SIP.Proxy.Speech").c_str(),
-		mobileID,
-		LCH,
-		req->serviceType(),
-		L3TI,
-		setup->calledPartyBCDNumber());
-	LOG(DEBUG) << "transaction: " << *transaction;
-	gTransactionTable.add(transaction);
-
-	// At this point, we have enough information start the SIP call setup.
-	// We also have a SIP side and a transaction that will need to be
-	// cleaned up on abort or clearing.
-
-	// Now start a call by contacting asterisk.
-	// Engine methods will return their current state.	
-	// The remote party will start ringing soon.
-	LOG(DEBUG) << "starting SIP (INVITE) Calling "<<bcdDigits;
-	unsigned basePort = allocateRTPPorts();
-	transaction->MOCSendINVITE(bcdDigits,gConfig.getStr("SIP.Local.IP").c_str(),basePort,SIP::RTPGSM610);
-	LOG(DEBUG) << "transaction: " << *transaction;
-
-	// Once we can start SIP call setup, send Call Proceeding.
-	LOG(INFO) << "Sending Call Proceeding";
-	LCH->send(GSM::L3CallProceeding(L3TI));
-	transaction->GSMState(GSM::MOCProceeding);
-	// Finally done with the Setup message.
-	delete msg_setup;
-
-	// The transaction is moving on to the MOCController.
-	// If we need a TCH assignment, we do it here.
-	LOG(DEBUG) << "transaction: " << *transaction;
-#if 0
-	// For very early assignment, we need a mode change.
-	static const GSM::L3ChannelMode mode(GSM::L3ChannelMode::SpeechV1);
-	LCH->send(GSM::L3ChannelModeModify(LCH->channelDescription(),mode));
-	GSM::L3Message *msg_ack = getMessage(LCH);
-	const GSM::L3ChannelModeModifyAcknowledge *ack =
-	dynamic_cast<GSM::L3ChannelModeModifyAcknowledge*>(msg_ack);
-	if (!ack) {
-		if (msg_ack) {
-			LOG(WARNING) << "Unexpected message " << *msg_ack;
-			delete msg_ack;
-		}
-		throw UnexpectedMessage(transaction->ID());
-	}
-	// Cause 0x06 is "channel unacceptable"
-	bool modeOK = (ack->mode()==mode);
-	delete msg_ack;
-	if (!modeOK) return abortAndRemoveCall(transaction,LCH,GSM::L3Cause(0x06));
-#endif
-	MOCController(transaction,dynamic_cast<UMTS::DTCHLogicalChannel*>(LCH));
-}
-
-
-
-
-
-/**
-	Continue MOC process on the TCH.
-	@param transaction The call state and SIP interface.
-	@param TCH The traffic channel to be used.
-*/
-void Control::MOCController(TransactionEntry *transaction, UMTS::DTCHLogicalChannel* TCH)
-{
-	LOG(DEBUG) << "transaction: " << *transaction;
-	unsigned L3TI = transaction->L3TI();
-	assert(L3TI>7);
-	assert(TCH);
-
-
-	// Look for RINGING or OK from the SIP side.
-	// There's a T310 running on the phone now.
-	// The phone will initiate clearing if it expires.
-	// FIXME -- We should also have a SIP.Timer.B timeout on this end.
-	while (transaction->GSMState()!=GSM::CallReceived) {
-
-		if (updateGSMSignalling(transaction,TCH)) return;
-		if (transaction->clearingGSM()) return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-
-		LOG(INFO) << "wait for Ringing or OK";
-		SIP::SIPState state = transaction->MOCWaitForOK();
-		LOG(DEBUG) << "SIP state="<<state;
-		switch (state) {
-			case SIP::Busy:
-				LOG(INFO) << "SIP:Busy, abort";
-				return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x11));
-			case SIP::Fail:
-				LOG(NOTICE) << "SIP:Fail, abort";
-				return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-			case SIP::Ringing:
-				LOG(INFO) << "SIP:Ringing, send Alerting and move on";
-				TCH->send(GSM::L3Alerting(L3TI));
-				transaction->GSMState(GSM::CallReceived);
-				break;
-			case SIP::Active:
-				LOG(DEBUG) << "SIP:Active, move on";
-				transaction->GSMState(GSM::CallReceived);
-				break;
-			case SIP::Proceeding:
-				LOG(DEBUG) << "SIP:Proceeding, send progress";
-				TCH->send(GSM::L3Progress(L3TI));
-				break;
-			case SIP::Timeout:
-				LOG(NOTICE) << "SIP:Timeout, reinvite";
-				state = transaction->MOCResendINVITE();
-				break;
-			default:
-				LOG(NOTICE) << "SIP unexpected state " << state;
-				break;
-		}
-	}
-
-	// There's a question here of what entity is generating the "patterns"
-	// (ringing, busy signal, etc.) during call set-up.  For now, we're ignoring 
-	// that question and hoping the phone will make its own ringing pattern.
-
-
-	// Wait for the SIP session to start.
-	// There's a timer on the phone that will initiate clearing if it expires.
-	LOG(INFO) << "wait for SIP OKAY";
-	SIP::SIPState state = transaction->SIPState();
-	while (state!=SIP::Active) {
-
-		LOG(DEBUG) << "wait for SIP session start";
-		state = transaction->MOCWaitForOK();
-		LOG(DEBUG) << "SIP state "<< state;
-
-		// check GSM state
-		if (updateGSMSignalling(transaction,TCH)) return;
-		if (transaction->clearingGSM()) return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-
-		// parse out SIP state
-		switch (state) {
-			case SIP::Busy:
-				// Should this be possible at this point?
-				LOG(INFO) << "SIP:Busy, abort";
-				return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x11));
-			case SIP::Fail:
-				LOG(INFO) << "SIP:Fail, abort";
-				return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-			case SIP::Proceeding:
-				LOG(DEBUG) << "SIP:Proceeding, NOT sending progress";
-				//TCH->send(GSM::L3Progress(L3TI));
-				break;
-			// For these cases, do nothing.
-			case SIP::Timeout:
-				// FIXME We should abort if this happens too often.
-				// For now, we are relying on the phone, which may have bugs of its own.
-			case SIP::Active:
-			default:
-				break;
-		}
-	} 
-	
-	// Let the phone know the call is connected.
-	LOG(INFO) << "sending Connect to handset";
-	TCH->send(GSM::L3Connect(L3TI));
-	transaction->setTimer("313");
-	transaction->GSMState(GSM::ConnectIndication);
-
-	// The call is open.
-	transaction->MOCInitRTP();
-	transaction->MOCSendACK();
-
-	// FIXME -- We need to watch for a repeated OK in case the ACK got lost.
-
-	// Get the Connect Acknowledge message.
-	while (transaction->GSMState()!=GSM::Active) {
-		LOG(DEBUG) << "MOC Q.931 state=" << transaction->GSMState();
-		if (updateGSMSignalling(transaction,TCH,T313ms)) return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-	}
-
-	// At this point, everything is ready to run the call.
-	callManagementLoop(transaction,TCH);
-
-	// The radio link should have been cleared with the call.
-	// So just return.
 }
 
 
 
 
-void Control::MTCStarter(TransactionEntry *transaction, UMTS::DTCHLogicalChannel *LCH)
+void Control::MTCStarter(TransactionEntry *transaction, UMTS::LogicalChannel *LCH)
 {
 	assert(LCH);
-	LOG(INFO) << "MTC on " << LCH->type() << " transaction: "<< *transaction;
-
-	// Get transaction identifiers.
-	// This transaction was created by the SIPInterface when it
-	// processed the INVITE that started this call.
-	unsigned L3TI = transaction->L3TI();
-	assert(L3TI<7);
-
-	// GSM 04.08 5.2.2.1
-	LOG(INFO) << "sending GSM Setup to call " << transaction->calling();
-	LCH->send(GSM::L3Setup(L3TI,GSM::L3CallingPartyBCDNumber(transaction->calling())));
-	transaction->setTimer("303");
-	transaction->GSMState(GSM::CallPresent);
-
-	// Wait for Call Confirmed message.
-	LOG(DEBUG) << "wait for GSM Call Confirmed";
-	while (transaction->GSMState()!=GSM::MTCConfirmed) {
-		if (transaction->MTCSendTrying()==SIP::Fail) {
-			LOG(NOTICE) << "call failed on SIP side";
-			LCH->send(GSM::RELEASE);
-			// Cause 0x03 is "no route to destination"
-			return abortAndRemoveCall(transaction,LCH,GSM::L3Cause(0x03));
-		}
-		// FIXME -- What's the proper timeout here?
-		// It's the SIP TRYING timeout, whatever that is.
-		if (updateGSMSignalling(transaction,LCH,1000)) {
-			LOG(INFO) << "Release from GSM side";
-			LCH->send(GSM::RELEASE);
-			return;
-		}
-		// Check for SIP cancel, too.
-		if (transaction->MTCCheckForCancel()==SIP::Fail) {
-			LOG(NOTICE) << "call cancelled or failed on SIP side";
-			// Cause 0x15 is "rejected"
-			return abortAndRemoveCall(transaction,LCH,GSM::L3Cause(0x15));
-		}
-	}
-
-	// The transaction is moving to the MTCController.
-	// Once this update happens, don't change the transaction object again in this function.
-	LOG(DEBUG) << "transaction: " << *transaction;
-#if 0
-	if (veryEarly) {
-		// For very early assignment, we need a mode change.
-		static const GSM::L3ChannelMode mode(GSM::L3ChannelMode::SpeechV1);
-		LCH->send(GSM::L3ChannelModeModify(LCH->channelDescription(),mode));
-		GSM::L3Message* msg_ack = getMessage(LCH);
-		const GSM::L3ChannelModeModifyAcknowledge *ack =
-			dynamic_cast<GSM::L3ChannelModeModifyAcknowledge*>(msg_ack);
-		if (!ack) {
-			if (msg_ack) {
-				LOG(WARNING) << "Unexpected message " << *msg_ack;
-				delete msg_ack;
-			}
-			throw UnexpectedMessage(transaction->ID());
-		}
-		// Cause 0x06 is "channel unacceptable"
-		bool modeOK = (ack->mode()==mode);
-		delete msg_ack;
-		if (!modeOK) return abortAndRemoveCall(transaction,LCH,GSM::L3Cause(0x06));
-	}
-#endif
-	MTCController(transaction,dynamic_cast<UMTS::DTCHLogicalChannel*>(LCH));
-}
-
-
-void Control::MTCController(TransactionEntry *transaction, UMTS::DTCHLogicalChannel* TCH)
-{
-	// Early Assignment Mobile Terminated Call. 
-	// Transaction table in 04.08 7.3.3 figure 7.10a
-
-	LOG(DEBUG) << "transaction: " << *transaction;
-	unsigned L3TI = transaction->L3TI();
-	assert(L3TI<7);
-	assert(TCH);
-
-	// Get the alerting message.
-	LOG(INFO) << "waiting for GSM Alerting and Connect";
-	while (transaction->GSMState()!=GSM::Active) {
-		if (updateGSMSignalling(transaction,TCH,1000)) return;
-		if (transaction->GSMState()==GSM::Active) break;
-		if (transaction->GSMState()==GSM::CallReceived) {
-			LOG(DEBUG) << "sending SIP Ringing";
-			transaction->MTCSendRinging();
-		}
-		// Check for SIP cancel, too.
-		if (transaction->MTCCheckForCancel()==SIP::Fail) {
-			LOG(DEBUG) << "MTCCheckForCancel return Fail";
-			return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-		}
-	}
-
-	// FIXME -- We should also have a SIP.Timer.F timeout here.
-	LOG(INFO) << "allocating port and sending SIP OKAY";
-	unsigned RTPPorts = allocateRTPPorts();
-	SIP::SIPState state = transaction->MTCSendOK(RTPPorts,SIP::RTPGSM610);
-	while (state!=SIP::Active) {
-		LOG(DEBUG) << "wait for SIP OKAY-ACK";
-		if (updateGSMSignalling(transaction,TCH)) return;
-		state = transaction->MTCWaitForACK();
-		LOG(DEBUG) << "SIP call state "<< state;
-		switch (state) {
-			case SIP::Active:
-				break;
-			case SIP::Fail:
-				return abortAndRemoveCall(transaction,TCH,GSM::L3Cause(0x7F));
-			case SIP::Timeout:
-				state = transaction->MTCSendOK(RTPPorts,SIP::RTPGSM610);
-				break;
-			case SIP::Connecting:
-				break;
-			default:
-				LOG(NOTICE) << "SIP unexpected state " << state;
-				break;
-		}
-	}
-	transaction->MTCInitRTP();
-
-	// Send Connect Ack to make it all official.
-	LOG(DEBUG) << "MTC send GSM Connect Acknowledge";
-	TCH->send(GSM::L3ConnectAcknowledge(L3TI));
-
-	// At this point, everything is ready to run for the call.
-	// The radio link should have been cleared with the call.
-	callManagementLoop(transaction,TCH);
+	assert(transaction);
+	gControlEngine.add(new CallMachine(transaction,LCH),LCH);
 }
 
 
@@ -39,25 +39,25 @@ class TransactionEntry;
 
 /**@name MOC */
 //@{
-/** Run the MOC to the point of alerting, doing early assignment if needed. */
-void MOCStarter(const GSM::L3CMServiceRequest*, UMTS::DTCHLogicalChannel*);
-/** Complete the MOC connection. */
-void MOCController(Control::TransactionEntry*, UMTS::DTCHLogicalChannel*);
+/** Accept the MOC and hand the rest of the call, from the Setup on, to a call machine in gControlEngine. */
+void MOCStarter(const GSM::L3CMServiceRequest*, UMTS::LogicalChannel*);
 //@}
 
 
 /**@name MTC */
 //@{
-/** Run the MTC to the point of alerting, doing early assignment if needed. */
-void MTCStarter(Control::TransactionEntry*, UMTS::DTCHLogicalChannel*);
-/** Complete the MTC connection. */
-void MTCController(Control::TransactionEntry*, UMTS::DTCHLogicalChannel*);
+/** Hand the MTC, from the Setup on, to a call machine in gControlEngine. */
+void MTCStarter(Control::TransactionEntry*, UMTS::LogicalChannel*);
 //@}
 
 
 /**@name Test Call */
 //@{
-/** Run the test call. */
+/**
+	Run the test call.
+	Unlike the other controllers this is not a ControlMachine and blocks the calling thread until the test ends.
+	Nothing calls it on UMTS, since the TestCall CM service type is not dispatched, so it was left as it was.
+*/
 void TestCall(Control::TransactionEntry*, UMTS::DTCHLogicalChannel*);
 //@}
 
@@ -27,6 +27,7 @@
 
 #include <SIPEngine.h>
 #include <SIPInterface.h>
+#include <SIPUtility.h>
 
 #include <Logger.h>
 #undef WARNING
@@ -44,6 +45,12 @@ using namespace Control;
 // FIXME -- This needs an adjustable timeout.
 
 GSM::L3Message* Control::getMessage(UMTS::LogicalChannel *LCH, unsigned SAPI)
+{
+	return parseMessage(getFrame(LCH,SAPI));
+}
+
+
+GSM::L3Frame* Control::getFrame(UMTS::LogicalChannel *LCH, unsigned SAPI)
 {
 	// FIXME -- We need to set a proper timeout here.
 	unsigned timeout_ms = 20000;
@@ -53,6 +60,12 @@ GSM::L3Message* Control::getMessage(UMTS::LogicalChannel *LCH, unsigned SAPI)
 		throw ChannelReadTimeout();
 	}
 	LOG(DEBUG) << "received " << *rcv;
+	return rcv;
+}
+
+
+GSM::L3Message* Control::parseMessage(GSM::L3Frame *rcv)
+{
 	GSM::Primitive primitive = rcv->primitive();
 	if (primitive!=GSM::DATA) {
 		LOG(NOTICE) << "unexpected primitive " << primitive;
@@ -69,6 +82,56 @@ GSM::L3Message* Control::getMessage(UMTS::LogicalChannel *LCH, unsigned SAPI)
 }
 
 
+unsigned Control::releaseForException(UMTS::LogicalChannel *LCH)
+{
+	try {
+		throw;
+	}
+	catch (ChannelReadTimeout except) {
+		LOG(NOTICE) << "ChannelReadTimeout";
+		// Cause 0x03 means "abnormal release, timer expired".
+		LCH->send(GSM::L3ChannelRelease(0x03));
+		return except.transactionID();
+	}
+	catch (UnexpectedPrimitive except) {
+		LOG(NOTICE) << "UnexpectedPrimitive";
+		// Cause 0x62 means "message type not not compatible with protocol state".
+		LCH->send(GSM::L3ChannelRelease(0x62));
+		return except.transactionID();
+	}
+	catch (UnexpectedMessage except) {
+		LOG(NOTICE) << "UnexpectedMessage";
+		// Cause 0x62 means "message type not not compatible with protocol state".
+		LCH->send(GSM::L3ChannelRelease(0x62));
+		return except.transactionID();
+	}
+	catch (UnsupportedMessage except) {
+		LOG(NOTICE) << "UnsupportedMessage";
+		// Cause 0x61 means "message type not implemented".
+		LCH->send(GSM::L3ChannelRelease(0x61));
+		return except.transactionID();
+	}
+	catch (Q931TimerExpired except) {
+		LOG(NOTICE) << "Q.931 T3xx timer expired";
+		// Cause 0x03 means "abnormal release, timer expired".
+		LCH->send(GSM::L3ChannelRelease(0x03));
+		return except.transactionID();
+	}
+	catch (SIP::SIPTimeout except) {
+		LOG(WARNING) << "Uncaught SIPTimeout";
+		// Cause 0x03 means "abnormal release, timer expired".
+		LCH->send(GSM::L3ChannelRelease(0x03));
+		return except.transactionID();
+	}
+	catch (SIP::SIPError except) {
+		LOG(WARNING) << "Uncaught SIPError";
+		// Cause 0x01 means "abnormal release, unspecified".
+		LCH->send(GSM::L3ChannelRelease(0x01));
+		return except.transactionID();
+	}
+}
+
+
 
 
 
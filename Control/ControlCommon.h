@@ -97,6 +97,25 @@ const unsigned T313ms=3000;		///< send CONNECT --> recv CONNECT ACK
 */
 // FIXME -- This needs an adjustable timeout.
 GSM::L3Message* getMessage(UMTS::LogicalChannel* LCH, unsigned SAPI=0);
+
+/**
+	Get a frame from a LogicalChannel, as getMessage() does, but without parsing it.
+	Throws ChannelReadTimeout on timeout.  Caller must delete the returned pointer.
+*/
+GSM::L3Frame* getFrame(UMTS::LogicalChannel* LCH, unsigned SAPI=0);
+
+/**
+	Parse a received frame the way getMessage() does, and delete it.
+	Throws UnexpectedPrimitive or UnsupportedMessage; does not return NULL.
+*/
+GSM::L3Message* parseMessage(GSM::L3Frame *frame);
+
+/**
+	Release the channel with the cause for the control-layer or SIP exception being handled,
+	as the DCCH dispatcher does when a transaction throws.  Call only from inside a catch block.
+	@return The transaction ID carried by the exception, or 0.
+*/
+unsigned releaseForException(UMTS::LogicalChannel* LCH);
 //}
 
 //void DCCHDispatchMessage(const GSM::L3Message* msg, UMTS::DCCHLogicalChannel* DCCH);
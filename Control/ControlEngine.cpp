@@ -0,0 +1,345 @@
+/**@file Event loops for the call and SMS control machines. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <deque>
+#include <queue>
+#include <Utils.h>
+#include "ControlEngine.h"
+
+#include <Logger.h>
+
+using namespace std;
+using namespace Control;
+
+
+ControlMachine::ControlMachine()
+	:mID(0),mChannel(NULL),
+	mTimerGen(0),mTimerWhen(0),mTimerArmed(false),mTimerChanged(false)
+{ }
+
+
+void ControlMachine::timeout(unsigned ms)
+{
+	mTimerGen++;
+	mTimerWhen = timef() + ms/1000.0;
+	mTimerArmed = true;
+	mTimerChanged = true;
+}
+
+
+void ControlMachine::cancelTimeout()
+{
+	mTimerGen++;
+	mTimerArmed = false;
+	mTimerChanged = false;
+}
+
+
+
+namespace Control {
+
+/** One event loop thread, with its queue of events and its timers. */
+class ControlLoop {
+
+	public:
+
+	struct Posted {
+		unsigned mID;
+		ControlMachine::Event mEvent;
+		unsigned mTimerGen;
+	};
+
+	struct Timer {
+		double mWhen;
+		unsigned mID;
+		unsigned mGen;
+		// The priority_queue puts the greatest first, so the earliest time is the greatest.
+		bool operator<(const Timer& other) const { return mWhen > other.mWhen; }
+	};
+
+	ControlEngine *mEngine;
+	Thread *mThread;
+	Mutex mLock;
+	Signal mWakeup;
+	deque<Posted> mEvents;
+	priority_queue<Timer> mTimers;
+	volatile bool mStopping;
+
+	ControlLoop(ControlEngine *wEngine)
+		:mEngine(wEngine),mThread(NULL),mStopping(false)
+	{ }
+
+	void post(unsigned ID, ControlMachine::Event event, unsigned timerGen)
+	{
+		Posted posted = { ID, event, timerGen };
+		ScopedLock lock(mLock);
+		mEvents.push_back(posted);
+		mWakeup.signal();
+	}
+
+	void addTimer(double when, unsigned ID, unsigned gen)
+	{
+		Timer timer = { when, ID, gen };
+		// Only called from this loop's own thread, between events, so there is no need to signal.
+		ScopedLock lock(mLock);
+		mTimers.push(timer);
+	}
+
+	void run();
+
+	static void *runLoop(void *arg) { static_cast<ControlLoop*>(arg)->run(); return NULL; }
+};
+
+}	// Control
+
+
+void ControlLoop::run()
+{
+	while (!mStopping) {
+		mLock.lock();
+		// Move the timers that are due onto the event queue, behind what is already there.
+		double now = timef();
+		while (!mTimers.empty() && mTimers.top().mWhen<=now) {
+			const Timer& timer = mTimers.top();
+			Posted posted = { timer.mID, ControlMachine::TimerEvent, timer.mGen };
+			mEvents.push_back(posted);
+			mTimers.pop();
+		}
+		if (mEvents.empty()) {
+			// Sleep until the next timer, but wake up now and then to check for stop().
+			unsigned wait = 1000;
+			if (!mTimers.empty()) {
+				double untilNext = 1000.0*(mTimers.top().mWhen - now);
+				if (untilNext < wait) wait = (unsigned)untilNext + 1;
+			}
+			mWakeup.wait(mLock,wait);
+			mLock.unlock();
+			continue;
+		}
+		Posted posted = mEvents.front();
+		mEvents.pop_front();
+		mLock.unlock();
+		mEngine->dispatch(this,posted.mID,posted.mEvent,posted.mTimerGen);
+	}
+}
+
+
+
+ControlEngine::ControlEngine()
+	:mNextID(0),
+	mStarted(0),mFinished(0),mPeak(0),mEvents(0),mDropped(0)
+{ }
+
+
+void ControlEngine::start(unsigned numLoops)
+{
+	ScopedLock lock(mLock);
+	if (mLoops.size()) return;
+	if (numLoops==0) numLoops = 1;
+	LOG(INFO) << "starting " << numLoops << " control loops";
+	for (unsigned i=0; i<numLoops; i++) {
+		ControlLoop *loop = new ControlLoop(this);
+		mLoops.push_back(loop);
+		loop->mThread = new Thread;
+		loop->mThread->start(ControlLoop::runLoop,loop);
+	}
+}
+
+
+void ControlEngine::stop()
+{
+	mLock.lock();
+	vector<ControlLoop*> loops;
+	loops.swap(mLoops);
+	mLock.unlock();
+	for (unsigned i=0; i<loops.size(); i++) {
+		ControlLoop *loop = loops[i];
+		loop->mLock.lock();
+		loop->mStopping = true;
+		loop->mWakeup.signal();
+		loop->mLock.unlock();
+		loop->mThread->join();
+		delete loop->mThread;
+		delete loop;
+	}
+	ScopedLock lock(mLock);
+	for (map<unsigned,ControlMachine*>::iterator itr = mMachines.begin(); itr!=mMachines.end(); ++itr) {
+		delete itr->second;
+	}
+	mMachines.clear();
+	mChannels.clear();
+	mCallIDs.clear();
+}
+
+
+void ControlEngine::add(ControlMachine *machine, const void *channel)
+{
+	assert(machine);
+	{
+		ScopedLock lock(mLock);
+		assert(mLoops.size());
+		// ID 0 means "none".
+		if (++mNextID==0) mNextID++;
+		machine->mID = mNextID;
+		mMachines[machine->mID] = machine;
+		mStarted++;
+		if (mMachines.size()>mPeak) mPeak = mMachines.size();
+		if (channel) {
+			machine->mChannel = channel;
+			mChannels[channel] = machine->mID;
+		}
+	}
+	LOG(DEBUG) << machine->name() << " " << machine->mID;
+	post(machine->mID,ControlMachine::StartEvent);
+}
+
+
+void ControlEngine::attachChannel(ControlMachine *machine, const void *channel)
+{
+	ScopedLock lock(mLock);
+	if (machine->mChannel) {
+		map<const void*,unsigned>::iterator itr = mChannels.find(machine->mChannel);
+		if (itr!=mChannels.end() && itr->second==machine->mID) mChannels.erase(itr);
+	}
+	machine->mChannel = channel;
+	if (channel) mChannels[channel] = machine->mID;
+}
+
+
+void ControlEngine::attachCallID(ControlMachine *machine, const string& callID)
+{
+	ScopedLock lock(mLock);
+	if (machine->mCallID.size()) {
+		map<string,unsigned>::iterator itr = mCallIDs.find(machine->mCallID);
+		if (itr!=mCallIDs.end() && itr->second==machine->mID) mCallIDs.erase(itr);
+	}
+	machine->mCallID = callID;
+	if (callID.size()) mCallIDs[callID] = machine->mID;
+}
+
+
+bool ControlEngine::owns(const void *channel) const
+{
+	ScopedLock lock(mLock);
+	return mChannels.find(channel)!=mChannels.end();
+}
+
+
+bool ControlEngine::post(unsigned ID, ControlMachine::Event event, unsigned timerGen)
+{
+	ControlLoop *loop;
+	{
+		ScopedLock lock(mLock);
+		if (mMachines.find(ID)==mMachines.end()) return false;
+		loop = loopFor(ID);
+	}
+	loop->post(ID,event,timerGen);
+	return true;
+}
+
+
+bool ControlEngine::post(const void *channel, ControlMachine::Event event)
+{
+	unsigned ID;
+	{
+		ScopedLock lock(mLock);
+		map<const void*,unsigned>::const_iterator itr = mChannels.find(channel);
+		if (itr==mChannels.end()) return false;
+		ID = itr->second;
+	}
+	return post(ID,event);
+}
+
+
+bool ControlEngine::post(const string& callID, ControlMachine::Event event)
+{
+	unsigned ID;
+	{
+		ScopedLock lock(mLock);
+		map<string,unsigned>::const_iterator itr = mCallIDs.find(callID);
+		if (itr==mCallIDs.end()) return false;
+		ID = itr->second;
+	}
+	return post(ID,event);
+}
+
+
+void ControlEngine::dispatch(ControlLoop *loop, unsigned ID, ControlMachine::Event event, unsigned timerGen)
+{
+	ControlMachine *machine;
+	{
+		ScopedLock lock(mLock);
+		map<unsigned,ControlMachine*>::iterator itr = mMachines.find(ID);
+		if (itr==mMachines.end()) { mDropped++; return; }
+		machine = itr->second;
+		if (event==ControlMachine::TimerEvent) {
+			// A timer that was replaced or cancelled after it was queued.
+			if (!machine->mTimerArmed || timerGen!=machine->mTimerGen) { mDropped++; return; }
+		}
+		mEvents++;
+	}
+	// Only this loop touches the machine, so it can run without the engine lock.
+	if (event==ControlMachine::TimerEvent) machine->mTimerArmed = false;
+	bool running;
+	try {
+		running = machine->handle(event);
+	}
+	catch (...) {
+		// The machines catch their own exceptions; this is the last resort that keeps the loop alive.
+		LOG(ALERT) << "uncaught exception in " << machine->name() << " " << ID << ", dropping it";
+		running = false;
+	}
+	if (!running) {
+		finish(machine);
+		return;
+	}
+	if (machine->mTimerChanged) {
+		machine->mTimerChanged = false;
+		if (machine->mTimerArmed) loop->addTimer(machine->mTimerWhen,ID,machine->mTimerGen);
+	}
+}
+
+
+void ControlEngine::finish(ControlMachine *machine)
+{
+	LOG(DEBUG) << machine->name() << " " << machine->mID << " done";
+	{
+		ScopedLock lock(mLock);
+		if (machine->mChannel) {
+			map<const void*,unsigned>::iterator itr = mChannels.find(machine->mChannel);
+			if (itr!=mChannels.end() && itr->second==machine->mID) mChannels.erase(itr);
+		}
+		if (machine->mCallID.size()) {
+			map<string,unsigned>::iterator itr = mCallIDs.find(machine->mCallID);
+			if (itr!=mCallIDs.end() && itr->second==machine->mID) mCallIDs.erase(itr);
+		}
+		mMachines.erase(machine->mID);
+		mFinished++;
+	}
+	delete machine;
+}
+
+
+void ControlEngine::stats(ostream& os) const
+{
+	ScopedLock lock(mLock);
+	os << mLoops.size() << " loops, " << mMachines.size() << " machines running, " << mPeak << " at most, "
+		<< mStarted << " started, " << mFinished << " finished, "
+		<< mEvents << " events handled, " << mDropped << " dropped";
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,176 @@
+/**@file Event loops for the call and SMS control machines. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef CONTROLENGINE_H
+#define CONTROLENGINE_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <ostream>
+#include <Threads.h>
+
+namespace Control {
+
+class ControlEngine;
+class ControlLoop;
+
+/**
+	A call or SMS controller written as a state machine and run by the ControlEngine.
+	Instead of blocking in channel reads and SIP waits, the machine is called back with an event
+	when something may be waiting for it, and does what it can without blocking before it returns.
+	An event is only a hint: the machine reads its channel or its SIP queue without waiting
+	to find out what arrived, if anything.
+	All the events for a machine are handled on the same loop thread, one at a time,
+	so the machine needs no lock of its own.
+*/
+class ControlMachine {
+
+	public:
+
+	enum Event {
+		StartEvent,			///< the first event, after ControlEngine::add()
+		L3Event,			///< a frame arrived on the machine's channel
+		SIPEvent,			///< a SIP message arrived for the machine's call ID
+		TimerEvent,			///< the time set with timeout() has come
+		TerminateEvent		///< something outside asked for the transaction to end
+	};
+
+	private:
+
+	friend class ControlEngine;
+
+	unsigned mID;				///< assigned by ControlEngine::add()
+	const void *mChannel;		///< the channel the machine gets L3Events for, or NULL
+	std::string mCallID;		///< the SIP call ID the machine gets SIPEvents for, or empty
+	unsigned mTimerGen;			///< bumped on each timeout() or cancelTimeout(), so stale timers are ignored
+	double mTimerWhen;			///< when the timer fires, in timef() seconds
+	bool mTimerArmed;
+	bool mTimerChanged;			///< the engine has yet to queue the timer
+
+	protected:
+
+	/** Get a TimerEvent in ms milliseconds, replacing any timeout set before. */
+	void timeout(unsigned ms);
+
+	/** Cancel the timeout, if any. */
+	void cancelTimeout();
+
+	public:
+
+	ControlMachine();
+
+	virtual ~ControlMachine() {}
+
+	unsigned ID() const { return mID; }
+
+	/**
+		Handle an event without blocking.
+		@return false when the machine is done; the engine then deletes it.
+	*/
+	virtual bool handle(Event event) = 0;
+
+	/** A short name for logs. */
+	virtual const char* name() const = 0;
+};
+
+
+/**
+	Runs the control machines on a small pool of event loop threads,
+	so the number of calls in progress is not bounded by the number of threads.
+	Each machine stays on one loop, chosen from its ID.
+	The channels and SIP call IDs are mapped to the machines that own them, so the L3 and SIP receive
+	paths can post an event to the right loop instead of leaving the message for a blocked reader.
+*/
+class ControlEngine {
+
+	private:
+
+	mutable Mutex mLock;			///< protects the maps and the counters
+	std::map<unsigned,ControlMachine*> mMachines;	///< by machine ID
+	std::map<const void*,unsigned> mChannels;		///< channel -> machine ID
+	std::map<std::string,unsigned> mCallIDs;		///< SIP call ID -> machine ID
+	unsigned mNextID;
+	std::vector<ControlLoop*> mLoops;
+
+	unsigned mStarted;				///< machines added
+	unsigned mFinished;				///< machines finished and deleted
+	unsigned mPeak;					///< most machines at once
+	unsigned mEvents;				///< events handled
+	unsigned mDropped;				///< events for machines that were gone, and stale timers
+
+	friend class ControlLoop;
+
+	/** Queue an event for the machine with this ID.  Return false if there is no such machine. */
+	bool post(unsigned ID, ControlMachine::Event event, unsigned timerGen=0);
+
+	/** Run one event on the calling loop thread. */
+	void dispatch(ControlLoop *loop, unsigned ID, ControlMachine::Event event, unsigned timerGen);
+
+	/** Unmap and delete a machine that is done. */
+	void finish(ControlMachine *machine);
+
+	ControlLoop *loopFor(unsigned ID) const { return mLoops[ID % mLoops.size()]; }
+
+	public:
+
+	ControlEngine();
+
+	~ControlEngine() { stop(); }
+
+	/** Start the loop threads. */
+	void start(unsigned numLoops);
+
+	/** Stop the loop threads and delete any machines still running. */
+	void stop();
+
+	/**
+		Take ownership of a machine and send it the StartEvent.
+		@param machine The new machine, allocated with new.
+		@param channel The channel to send the machine L3Events for, or NULL.
+	*/
+	void add(ControlMachine *machine, const void *channel=NULL);
+
+	/** Send the machine L3Events for this channel, from now on. */
+	void attachChannel(ControlMachine *machine, const void *channel);
+
+	/** Send the machine SIPEvents for this call ID, from now on. */
+	void attachCallID(ControlMachine *machine, const std::string& callID);
+
+	/** Return true if a machine owns this channel. */
+	bool owns(const void *channel) const;
+
+	/** Post an event to the machine that owns this channel.  Return false if there is none. */
+	bool post(const void *channel, ControlMachine::Event event);
+
+	/** Post an event to the machine that owns this SIP call ID.  Return false if there is none. */
+	bool post(const std::string& callID, ControlMachine::Event event);
+
+	/** The number of machines running. */
+	unsigned size() const { ScopedLock lock(mLock); return mMachines.size(); }
+
+	void stats(std::ostream&) const;
+};
+
+
+}	// Control
+
+/** The one engine for the call and SMS controllers. */
+extern Control::ControlEngine gControlEngine;
+
+#endif
+
+// vim: ts=4 sw=4
@@ -0,0 +1,942 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the ControlEngine event delivery and timers, then run the real call and SMS machines through it.
+// The handsets sit behind fake DCCHs: what the BTS sends them is decoded from the L3 frames, and what
+// they send goes up through l3writeHighSide, so new transactions start in the DCCH dispatcher as they
+// do from the RRC.  The SIP switch is a UDP socket speaking SIP text to the real SIPInterface.
+// Checked: a MOC from the CM Service Request through connect and clearing, MTCs cancelled by the
+// switch and aborted by T303, an MO-SMS with its MESSAGE, and a MOC on a traffic channel whose
+// speech goes through the MediaRelay to the switch's RTP and back.  Then hundreds of concurrent MOCs
+// go through, reporting the calls completed, the setup latency and the threads used.
+// Build with the libraries of OpenBTS-UMTS and GetConfigurationKeys.cpp.
+// Usage: ControlEngineTest [calls] [hold ms] [loops]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <queue>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <Configuration.h>
+#include <Sockets.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include <UMTSConfig.h>
+#include <UMTSLogicalChannel.h>
+#include <TRXManager.h>
+#include <GSML3CCMessages.h>
+#include <GSML3MMMessages.h>
+#include <GSML3RRMessages.h>
+#include <PhysicalStatus.h>
+#include <SMSMessages.h>
+#include <SIPInterface.h>
+#include "ControlCommon.h"
+#include "CallControl.h"
+#include "MobilityManagement.h"
+#include "TransactionTable.h"
+#include "TMSITable.h"
+#include "MediaRelay.h"
+#include "ControlEngine.h"
+
+using namespace std;
+using namespace Control;
+
+ConfigurationTable gConfig(":memory:","ControlEngineTest",getConfigurationKeys());
+
+// The globals of OpenBTS-UMTS that the control layer uses.
+UMTS::UMTSConfig gNodeB;
+TransceiverManager gTRX;
+Control::TMSITable gTMSITable(":memory:");
+GSM::PhysicalStatus gPhysStatus(":memory:");
+Control::TransactionTable gTransactionTable(":memory:");
+Control::MediaRelay gMediaRelay;
+Control::ControlEngine gControlEngine;
+SIP::SIPInterface gSIPInterface;
+
+
+// A machine that records what it is sent.
+class Recorder : public ControlMachine {
+
+	public:
+
+	Mutex *mLock;
+	vector<int> *mLog;			///< events, with timers as 100+the timer number
+	unsigned mTimerNumber;
+	bool mThrow;				///< throw on the next L3Event
+
+	Recorder(Mutex *wLock, vector<int> *wLog) : mLock(wLock), mLog(wLog), mTimerNumber(0), mThrow(false) {}
+
+	void record(int what) { ScopedLock lock(*mLock); mLog->push_back(what); }
+
+	// Set a timer for the number of ms given by the event count, for each of the events.
+	void arm(unsigned number, unsigned ms) { mTimerNumber = number; timeout(ms); }
+
+	bool handle(Event event)
+	{
+		switch (event) {
+			case StartEvent:
+				record(StartEvent);
+				// This one is replaced before it fires, so it must never be seen.
+				arm(1,50);
+				arm(2,100);
+				return true;
+			case TimerEvent:
+				record(100+mTimerNumber);
+				if (mTimerNumber==2) arm(3,30);
+				return true;
+			case L3Event:
+				if (mThrow) throw 1;
+				record(event);
+				return true;
+			case TerminateEvent:
+				record(event);
+				return false;
+			default:
+				record(event);
+				return true;
+		}
+	}
+
+	const char* name() const { return "recorder"; }
+};
+
+
+static vector<int> snapshot(Mutex &lock, vector<int> &log)
+{
+	ScopedLock l(lock);
+	return log;
+}
+
+
+static void testEngine()
+{
+	Mutex lock;
+	vector<int> log;
+	int channel;
+	Recorder *machine = new Recorder(&lock,&log);
+	gControlEngine.add(machine,&channel);
+	gControlEngine.attachCallID(machine,"call-1");
+	CHECK(gControlEngine.owns(&channel));
+	CHECK(gControlEngine.size()==1);
+	CHECK(gControlEngine.post(&channel,ControlMachine::L3Event));
+	CHECK(gControlEngine.post(string("call-1"),ControlMachine::SIPEvent));
+	CHECK(!gControlEngine.post(string("call-2"),ControlMachine::SIPEvent));
+	int other;
+	CHECK(!gControlEngine.post(&other,ControlMachine::L3Event));
+	msleep(250);
+	vector<int> seen = snapshot(lock,log);
+	// Start, the two events in order, the second timer and the one it set.  The first timer never fires.
+	CHECK(seen.size()==5);
+	if (seen.size()==5) {
+		CHECK(seen[0]==ControlMachine::StartEvent);
+		CHECK(seen[1]==ControlMachine::L3Event);
+		CHECK(seen[2]==ControlMachine::SIPEvent);
+		CHECK(seen[3]==102);
+		CHECK(seen[4]==103);
+	}
+
+	// Moving the channel.
+	gControlEngine.attachChannel(machine,&other);
+	CHECK(!gControlEngine.owns(&channel));
+	CHECK(gControlEngine.post(&other,ControlMachine::L3Event));
+
+	// Returning false unmaps and deletes the machine.
+	CHECK(gControlEngine.post(&other,ControlMachine::TerminateEvent));
+	msleep(50);
+	CHECK(!gControlEngine.owns(&other));
+	CHECK(!gControlEngine.post(string("call-1"),ControlMachine::SIPEvent));
+	CHECK(gControlEngine.size()==0);
+	seen = snapshot(lock,log);
+	CHECK(seen.size()==7 && seen[6]==ControlMachine::TerminateEvent);
+
+	// An exception out of a machine drops it and leaves the loop running.
+	log.clear();
+	machine = new Recorder(&lock,&log);
+	machine->mThrow = true;
+	gControlEngine.add(machine,&channel);
+	gControlEngine.post(&channel,ControlMachine::L3Event);
+	msleep(50);
+	CHECK(gControlEngine.size()==0);
+	machine = new Recorder(&lock,&log);
+	gControlEngine.add(machine,&channel);
+	gControlEngine.post(&channel,ControlMachine::L3Event);
+	msleep(50);
+	seen = snapshot(lock,log);
+	CHECK(seen.size()==3 && seen[2]==ControlMachine::L3Event);
+	gControlEngine.post(&channel,ControlMachine::TerminateEvent);
+	msleep(50);
+	CHECK(gControlEngine.size()==0);
+}
+
+
+
+// The handsets.
+
+/** The PD and MTI of a downlink frame, as the handsets log them. */
+static unsigned code(GSM::L3PD PD, unsigned MTI) { return (PD<<8) | MTI; }
+
+static const unsigned sChannelRelease = code(GSM::L3RadioResourcePD,GSM::L3RRMessage::ChannelRelease);
+static const unsigned sCMServiceAccept = code(GSM::L3MobilityManagementPD,GSM::L3MMMessage::CMServiceAccept);
+
+/** What a handset has seen of its transaction. */
+struct Phone {
+	enum Kind { MOC, MTC, MOSMS };
+	Kind mKind;
+	string mIMSI;
+	UMTS::LogicalChannel *mChannel;
+	bool mConfirm;				///< answer the Setup of an MTC
+	double mStart;				///< when the CM Service Request went up
+	double mSetup;				///< the time from then to the Connect
+	vector<unsigned> mSeen;		///< the downlink frames, by PD and MTI
+	unsigned mCause;			///< from the Disconnect, if there was one
+	unsigned mPrimitives;		///< naked primitives, like RELEASE
+	bool mRPAck;				///< an MO-SMS got its RP-ACK
+
+	Phone(Kind wKind, const string& wIMSI)
+		:mKind(wKind),mIMSI(wIMSI),mChannel(NULL),mConfirm(true),mStart(0),mSetup(0),
+		mCause(0),mPrimitives(0),mRPAck(false)
+	{ }
+
+	bool released() const { return !mSeen.empty() && mSeen.back()==sChannelRelease; }
+	bool saw(unsigned what) const
+	{
+		for (unsigned i=0; i<mSeen.size(); i++) if (mSeen[i]==what) return true;
+		return false;
+	}
+};
+
+
+/**
+	All the handsets, run from one thread.
+	Downlink frames are queued as they are sent and handled here, and the handsets' answers
+	go up after a short delay, so the control machines never call back into themselves.
+*/
+class Handsets {
+
+	struct Item {
+		double mWhen;
+		Phone *mPhone;
+		GSM::L3Frame *mDownlink;	///< a frame from the BTS, or
+		ByteVector *mUplink;		///< one for the BTS
+		bool operator<(const Item& other) const { return mWhen > other.mWhen; }
+	};
+
+	mutable Mutex mLock;
+	Signal mWakeup;
+	priority_queue<Item> mItems;
+	Thread mThread;
+	volatile bool mStopping;
+	unsigned mHold;				///< ms from Connect to Disconnect
+
+	static void *run(void *arg) { ((Handsets*)arg)->loop(); return NULL; }
+
+	void loop();
+	void receive(Phone *phone, const GSM::L3Frame& frame);
+	void push(Phone *phone, GSM::L3Frame *downlink, ByteVector *uplink, unsigned delay);
+
+	public:
+
+	Handsets(unsigned wHold) : mStopping(false), mHold(wHold) { mThread.start(run,this); }
+	~Handsets();
+
+	/** Queue a frame from the BTS. */
+	void downlink(Phone *phone, const GSM::L3Frame& frame) { push(phone,new GSM::L3Frame(static_cast<const BitVector&>(frame),frame.primitive()),NULL,0); }
+	/** Send a message to the BTS after a delay. */
+	void send(Phone *phone, const GSM::L3Message& message, unsigned delay=2)
+		{ push(phone,NULL,new ByteVector(GSM::L3Frame(message)),delay); }
+	void send(Phone *phone, const vector<unsigned char>& octets, unsigned delay=2)
+		{ push(phone,NULL,new ByteVector(&octets[0],octets.size()),delay); }
+
+	/** Start the phone's transaction with a CM Service Request. */
+	void request(Phone *phone, unsigned delay);
+
+	unsigned hold() const { return mHold; }
+
+	/** A copy of the phone, for a consistent look at it. */
+	Phone look(const Phone *phone) const { ScopedLock lock(mLock); return *phone; }
+};
+
+static Handsets *gHandsets;
+
+
+/** A DCCH whose downlink goes to a handset instead of the RRC. */
+class TestDCCH : public UMTS::DCCHLogicalChannel {
+
+	Phone *mPhone;
+
+	public:
+
+	TestDCCH(Phone *wPhone) : UMTS::DCCHLogicalChannel(NULL), mPhone(wPhone) { mPhone->mChannel = this; }
+
+	using UMTS::DCCHLogicalChannel::send;
+	void send(const GSM::L3Frame& frame, unsigned SAPI=0) { gHandsets->downlink(mPhone,frame); }
+};
+
+
+/** A DTCH like the TestDCCH, whose speech is a frame every 20 ms up and a count of the frames down. */
+class TestDTCH : public UMTS::DTCHLogicalChannel {
+
+	Phone *mPhone;
+	mutable Mutex mLock;
+	double mStart;				///< the first uplink read
+	unsigned mUplink;			///< frames given to the relay
+	unsigned mDownlink;			///< frames from the relay that were the handset's own, back from the switch
+
+	public:
+
+	/** GSM 06.10, as the SIPEngine sends it. */
+	static const unsigned FrameLength = 33;
+	static const unsigned char Speech = 0x5a;
+
+	TestDTCH(Phone *wPhone) : mPhone(wPhone), mStart(0), mUplink(0), mDownlink(0) { mPhone->mChannel = this; }
+
+	using UMTS::DTCHLogicalChannel::send;
+	void send(const GSM::L3Frame& frame, unsigned SAPI=0) { gHandsets->downlink(mPhone,frame); }
+
+	unsigned char* recvTCH()
+	{
+		ScopedLock lock(mLock);
+		double now = timef();
+		if (!mStart) mStart = now;
+		if (mUplink > 1000*(now-mStart)/MediaFramePeriod) return NULL;
+		mUplink++;
+		unsigned char *frame = new unsigned char[FrameLength];
+		memset(frame,Speech,FrameLength);
+		return frame;
+	}
+
+	void sendTCH(const unsigned char* frame)
+	{
+		ScopedLock lock(mLock);
+		if (frame[0]==Speech) mDownlink++;
+	}
+
+	unsigned uplink() const { ScopedLock lock(mLock); return mUplink; }
+	unsigned downlink() const { ScopedLock lock(mLock); return mDownlink; }
+};
+
+
+Handsets::~Handsets()
+{
+	mLock.lock();
+	mStopping = true;
+	mWakeup.signal();
+	mLock.unlock();
+	mThread.join();
+}
+
+
+void Handsets::push(Phone *phone, GSM::L3Frame *downlink, ByteVector *uplink, unsigned delay)
+{
+	Item item = { timef() + delay/1000.0, phone, downlink, uplink };
+	ScopedLock lock(mLock);
+	mItems.push(item);
+	mWakeup.signal();
+}
+
+
+void Handsets::loop()
+{
+	ScopedLock lock(mLock);
+	while (!mStopping) {
+		double now = timef();
+		if (mItems.empty() || mItems.top().mWhen>now) {
+			unsigned wait = 100;
+			if (!mItems.empty()) wait = (unsigned)(1000*(mItems.top().mWhen-now)) + 1;
+			mWakeup.wait(mLock,wait);
+			continue;
+		}
+		Item item = mItems.top();
+		mItems.pop();
+		if (item.mDownlink) {
+			receive(item.mPhone,*item.mDownlink);
+			delete item.mDownlink;
+			continue;
+		}
+		// The uplink can start a machine or post to one, so it goes without the lock.
+		mLock.unlock();
+		item.mPhone->mChannel->l3writeHighSide(*item.mUplink);
+		delete item.mUplink;
+		mLock.lock();
+	}
+}
+
+
+/** The phone's CM Service Request, GSM 04.08 9.2.9, with the classmark of a typical phone and the IMSI. */
+static vector<unsigned char> CMServiceRequest(const Phone *phone)
+{
+	unsigned type = phone->mKind==Phone::MOSMS ? GSM::L3CMServiceType::ShortMessage : GSM::L3CMServiceType::MobileOriginatedCall;
+	unsigned char head[] = { 0x05, 0x24, (unsigned char)(0x70|type), 0x03, 0x57, 0x18, 0x81 };
+	vector<unsigned char> octets(head,head+sizeof(head));
+	const char *IMSI = phone->mIMSI.c_str();
+	unsigned digits = strlen(IMSI);
+	octets.push_back(digits/2+1);
+	octets.push_back(((IMSI[0]-'0')<<4) | ((digits%2)<<3) | GSM::IMSIType);
+	for (unsigned i=1; i<digits; i+=2) {
+		unsigned high = i+1<digits ? IMSI[i+1]-'0' : 0x0f;
+		octets.push_back((high<<4) | (IMSI[i]-'0'));
+	}
+	return octets;
+}
+
+
+void Handsets::request(Phone *phone, unsigned delay)
+{
+	{
+		ScopedLock lock(mLock);
+		phone->mStart = timef() + delay/1000.0;
+	}
+	send(phone,CMServiceRequest(phone),delay);
+}
+
+
+// What a handset does with a frame from the BTS.  Called with the lock held.
+void Handsets::receive(Phone *phone, const GSM::L3Frame& frame)
+{
+	if (frame.primitive()!=GSM::DATA) {
+		phone->mPrimitives++;
+		return;
+	}
+	GSM::L3PD PD = frame.PD();
+	unsigned MTI = frame.MTI();
+	if (PD==GSM::L3CallControlPD) MTI &= 0x3f;
+	phone->mSeen.push_back(code(PD,MTI));
+	// The MS side of the transaction identifier.
+	const unsigned TI = 0;
+
+	if (code(PD,MTI)==sCMServiceAccept) {
+		if (phone->mKind==Phone::MOC) {
+			send(phone,GSM::L3Setup(TI,GSM::L3CalledPartyBCDNumber("2600")));
+		} else if (phone->mKind==Phone::MOSMS) {
+			// CP-DATA with RP-DATA to SMSC 1234 and an SMS-SUBMIT of "hello" to 2600.
+			// GSM 04.11 7.2.1 and 7.3.1.2, GSM 03.40 9.2.2.2.
+			static const unsigned char CPData[] = {
+				0x09, 0x01, 0x16,
+				0x00, 0x2a, 0x00, 0x03, 0x91, 0x21, 0x43,
+				0x0e, 0x01, 0x00, 0x04, 0x81, 0x62, 0x00, 0x00, 0x00, 0x05, 0xe8, 0x32, 0x9b, 0xfd, 0x06 };
+			send(phone,vector<unsigned char>(CPData,CPData+sizeof(CPData)));
+		}
+		return;
+	}
+
+	if (PD==GSM::L3SMSPD) {
+		if (MTI!=SMS::CPMessage::DATA) return;
+		SMS::CPData data;
+		data.parse(frame);
+		// The network side adds 1 to the RP MTI.
+		phone->mRPAck = (data.RPDU().MTI() & ~1)==SMS::RPMessage::Ack;
+		send(phone,SMS::CPAck(TI));
+		return;
+	}
+
+	if (PD!=GSM::L3CallControlPD) return;
+	switch (MTI) {
+		case GSM::L3CCMessage::Connect:
+			phone->mSetup = timef() - phone->mStart;
+			send(phone,GSM::L3ConnectAcknowledge(TI));
+			// The user hangs up after the hold time.
+			send(phone,GSM::L3Disconnect(TI),mHold);
+			return;
+		case GSM::L3CCMessage::Setup:
+			if (!phone->mConfirm) return;
+			send(phone,GSM::L3CallConfirmed(TI|0x08));
+			send(phone,GSM::L3Alerting(TI|0x08),5);
+			send(phone,GSM::L3Connect(TI|0x08),10);
+			return;
+		case GSM::L3CCMessage::Disconnect:
+			// GSM 04.08 10.5.4.11, the cause value in the second octet.
+			phone->mCause = frame.peekField(33,7);
+			return;
+		case GSM::L3CCMessage::Release:
+			send(phone,GSM::L3ReleaseComplete(TI));
+			return;
+		default:
+			return;
+	}
+}
+
+
+
+// The SIP switch.
+
+/** A SIP message as text, taken apart just enough to answer it. */
+struct SIPText {
+	string mFirst;				///< the request or status line
+	vector<string> mHeaders;
+	string mBody;
+
+	SIPText(const char *text)
+	{
+		string all(text);
+		size_t end = all.find("\r\n\r\n");
+		if (end!=string::npos) mBody = all.substr(end+4);
+		istringstream lines(all.substr(0,end));
+		string line;
+		while (getline(lines,line)) {
+			if (!line.empty() && line[line.size()-1]=='\r') line.erase(line.size()-1);
+			if (mFirst.empty()) mFirst = line;
+			else mHeaders.push_back(line);
+		}
+	}
+
+	bool request() const { return mFirst.compare(0,4,"SIP/")!=0; }
+	string method() const { return mFirst.substr(0,mFirst.find(' ')); }
+	unsigned status() const { return request() ? 0 : atoi(mFirst.c_str()+8); }
+
+	/** The value of the first header with this name. */
+	string header(const char *name) const
+	{
+		size_t length = strlen(name);
+		for (unsigned i=0; i<mHeaders.size(); i++) {
+			const string& h = mHeaders[i];
+			if (h.size()>length && h[length]==':' && strncasecmp(h.c_str(),name,length)==0) {
+				size_t start = h.find_first_not_of(' ',length+1);
+				return start==string::npos ? string() : h.substr(start);
+			}
+		}
+		return string();
+	}
+};
+
+
+/**
+	Answers INVITE with 100, 180 and 200, and BYE and MESSAGE with 200, and sends the MTC requests.
+	The speech of all the calls goes to one RTP port, which sends each packet back where it came from.
+*/
+class Switch {
+
+	UDPSocket mSocket;
+	UDPSocket mRTP;
+	Thread mThread;
+	Thread mRTPThread;
+	volatile bool mStopping;
+	mutable Mutex mLock;
+	map<string,unsigned> mCounts;		///< requests received by method, responses by status, and call ID
+	vector<string> mMessages;			///< the bodies of the MESSAGEs
+	unsigned mRTPPackets;				///< RTP packets received and sent back
+
+	static void *run(void *arg) { ((Switch*)arg)->loop(); return NULL; }
+	static void *runRTP(void *arg) { ((Switch*)arg)->echo(); return NULL; }
+
+	void loop();
+	void echo();
+	void respond(const SIPText& request, unsigned code, const char *reason, const string& SDP="");
+	string SDP() const;
+
+	public:
+
+	Switch() : mSocket(0), mRTP(0), mStopping(false), mRTPPackets(0)
+	{
+		mSocket.destination(gConfig.getNum("SIP.Local.Port"),"127.0.0.1");
+		mThread.start(run,this);
+		mRTPThread.start(runRTP,this);
+	}
+
+	~Switch() { mStopping = true; mThread.join(); mRTPThread.join(); }
+
+	unsigned short port() const { return mSocket.port(); }
+
+	unsigned count(const string& method, const string& callID) const
+	{
+		ScopedLock lock(mLock);
+		map<string,unsigned>::const_iterator itr = mCounts.find(method+" "+callID);
+		return itr==mCounts.end() ? 0 : itr->second;
+	}
+
+	vector<string> messages() const { ScopedLock lock(mLock); return mMessages; }
+
+	unsigned RTPPackets() const { ScopedLock lock(mLock); return mRTPPackets; }
+
+	/** Start a call to the handset with this IMSI, or cancel it. */
+	void request(const char *method, const string& IMSI, const string& callID);
+};
+
+
+string Switch::SDP() const
+{
+	// The connection address is at the session level, where get_rtp_params looks for it.
+	ostringstream os;
+	os << "v=0\r\no=switch 1 1 IN IP4 127.0.0.1\r\ns=call\r\nc=IN IP4 127.0.0.1\r\nt=0 0\r\n"
+		<< "m=audio " << mRTP.port() << " RTP/AVP 3\r\na=rtpmap:3 GSM/8000\r\n";
+	return os.str();
+}
+
+
+void Switch::respond(const SIPText& request, unsigned code, const char *reason, const string& SDP)
+{
+	ostringstream os;
+	os << "SIP/2.0 " << code << " " << reason << "\r\n";
+	for (unsigned i=0; i<request.mHeaders.size(); i++) {
+		const string& h = request.mHeaders[i];
+		if (strncasecmp(h.c_str(),"Via:",4)==0 || strncasecmp(h.c_str(),"From:",5)==0
+			|| strncasecmp(h.c_str(),"Call-ID:",8)==0 || strncasecmp(h.c_str(),"CSeq:",5)==0) {
+			os << h << "\r\n";
+		}
+	}
+	string to = request.header("To");
+	if (code>100 && to.find("tag=")==string::npos) to += ";tag=switch";
+	os << "To: " << to << "\r\n";
+	os << "Contact: <sip:2600@127.0.0.1:" << port() << ">\r\n";
+	if (!SDP.empty()) os << "Content-Type: application/sdp\r\n";
+	os << "Content-Length: " << SDP.size() << "\r\n\r\n" << SDP;
+	mSocket.write(os.str().c_str());
+}
+
+
+void Switch::loop()
+{
+	char buf[MAX_UDP_LENGTH+1];
+	while (!mStopping) {
+		int len = mSocket.read(buf,100);
+		if (len<=0) continue;
+		buf[len] = 0;
+		SIPText message(buf);
+		if (!message.request()) {
+			ScopedLock lock(mLock);
+			mCounts[message.mFirst.substr(8,3)+" "+message.header("Call-ID")]++;
+			continue;
+		}
+		string method = message.method();
+		{
+			ScopedLock lock(mLock);
+			mCounts[method+" "+message.header("Call-ID")]++;
+			if (method=="MESSAGE") mMessages.push_back(message.mBody);
+		}
+		if (method=="INVITE") {
+			respond(message,100,"Trying");
+			respond(message,180,"Ringing");
+			respond(message,200,"OK",SDP());
+		} else if (method=="BYE" || method=="MESSAGE") {
+			respond(message,200,"OK");
+		}
+	}
+}
+
+
+void Switch::echo()
+{
+	char buf[MAX_UDP_LENGTH+1];
+	while (!mStopping) {
+		int len = mRTP.read(buf,100);
+		if (len<12) continue;
+		// The payload goes back as it came, under the switch's own SSRC.
+		memcpy(buf+8,"swch",4);
+		mRTP.send((const struct sockaddr*)mRTP.source(),buf,len);
+		ScopedLock lock(mLock);
+		mRTPPackets++;
+	}
+}
+
+
+void Switch::request(const char *method, const string& IMSI, const string& callID)
+{
+	bool invite = strcmp(method,"INVITE")==0;
+	string SDP = invite ? this->SDP() : string();
+	unsigned short local = gConfig.getNum("SIP.Local.Port");
+	ostringstream os;
+	os << method << " sip:IMSI" << IMSI << "@127.0.0.1:" << local << " SIP/2.0\r\n"
+		<< "Via: SIP/2.0/UDP 127.0.0.1:" << port() << ";branch=z9hG4bK" << callID << "\r\n"
+		<< "From: <sip:2600@127.0.0.1:" << port() << ">;tag=" << callID << "\r\n"
+		<< "To: <sip:IMSI" << IMSI << "@127.0.0.1:" << local << ">\r\n"
+		<< "Call-ID: " << callID << "\r\n"
+		<< "CSeq: 1 " << method << "\r\n"
+		<< "Contact: <sip:2600@127.0.0.1:" << port() << ">\r\n"
+		<< "Max-Forwards: 70\r\n";
+	if (invite) os << "Content-Type: application/sdp\r\n";
+	os << "Content-Length: " << SDP.size() << "\r\n\r\n" << SDP;
+	mSocket.write(os.str().c_str());
+}
+
+static Switch *gSwitch;
+
+
+
+// The transactions.
+
+static string IMSIFor(unsigned index)
+{
+	char IMSI[20];
+	sprintf(IMSI,"00101%010u",index);
+	return IMSI;
+}
+
+
+/** Wait for the handsets' channels to be released, and for the engine to drop the machines. */
+static bool waitDone(const vector<Phone*>& phones, unsigned ms)
+{
+	Timeval limit(ms);
+	do {
+		bool done = gControlEngine.size()==0;
+		for (unsigned i=0; done && i<phones.size(); i++) done = gHandsets->look(phones[i]).released();
+		if (done) return true;
+		msleep(10);
+	} while (!limit.passed());
+	return false;
+}
+
+
+// An OPTIONS keepalive from the switch, answered by the SIPInterface receive loop,
+// and an INVITE to no one, parsed and then dropped for want of a FIFO.
+static void testOPTIONS()
+{
+	gSwitch->request("OPTIONS",IMSIFor(5),"ping");
+	gSwitch->request("INVITE","stray","stray");
+	for (unsigned tries=0; !gSwitch->count("200","ping") && tries<100; tries++) msleep(10);
+	CHECK(gSwitch->count("200","ping")==1);
+	msleep(50);
+	CHECK(gSIPInterface.fifoSize("stray")==-1);
+	CHECK(gTransactionTable.size()==0);
+}
+
+
+// A MOC from the CM Service Request, through the DCCH dispatcher, to the OK for the BYE.
+static void testMOC()
+{
+	Phone phone(Phone::MOC,IMSIFor(1));
+	TestDCCH channel(&phone);
+	gHandsets->request(&phone,0);
+	vector<Phone*> phones(1,&phone);
+	CHECK(waitDone(phones,10000));
+	Phone seen = gHandsets->look(&phone);
+	static const unsigned expected[] = {
+		sCMServiceAccept,
+		code(GSM::L3CallControlPD,GSM::L3CCMessage::CallProceeding),
+		code(GSM::L3CallControlPD,GSM::L3CCMessage::Progress),
+		code(GSM::L3CallControlPD,GSM::L3CCMessage::Alerting),
+		code(GSM::L3CallControlPD,GSM::L3CCMessage::Connect),
+		code(GSM::L3CallControlPD,GSM::L3CCMessage::Release),
+		sChannelRelease };
+	CHECK(seen.mSeen==vector<unsigned>(expected,expected+sizeof(expected)/sizeof(expected[0])));
+	CHECK(seen.mSetup>0);
+	CHECK(gTransactionTable.size()==0);
+}
+
+
+// MTCs from INVITEs, one cancelled by the switch and one left unconfirmed until T303 runs out.
+static void testMTC()
+{
+	Phone cancelled(Phone::MTC,IMSIFor(2)), unconfirmed(Phone::MTC,IMSIFor(3));
+	cancelled.mConfirm = unconfirmed.mConfirm = false;
+	TestDCCH cancelledChannel(&cancelled), unconfirmedChannel(&unconfirmed);
+	Phone *phones[] = { &cancelled, &unconfirmed };
+	const char *callIDs[] = { "mtc-cancel", "mtc-t303" };
+
+	for (unsigned i=0; i<2; i++) {
+		// As if it had registered, so the MT transaction can take its TI from the TMSI table.
+		gTMSITable.assign(phones[i]->mIMSI.c_str());
+		gSwitch->request("INVITE",phones[i]->mIMSI,callIDs[i]);
+		// The SIPInterface makes the transaction and pages for it.
+		GSM::L3MobileIdentity mobileID(phones[i]->mIMSI.c_str());
+		TransactionEntry *transaction = NULL;
+		for (unsigned tries=0; !transaction && tries<200; tries++) {
+			msleep(10);
+			transaction = gTransactionTable.find(mobileID,callIDs[i]);
+		}
+		CHECK(transaction);
+		if (!transaction) return;
+		// Stand in for the paging response.
+		transaction->resetTimer("3113");
+		transaction->channel(phones[i]->mChannel);
+		MTCStarter(transaction,phones[i]->mChannel);
+	}
+
+	// Cancel the first once its Setup is out.
+	const unsigned setup = code(GSM::L3CallControlPD,GSM::L3CCMessage::Setup);
+	for (unsigned tries=0; !gHandsets->look(&cancelled).saw(setup) && tries<200; tries++) msleep(10);
+	gSwitch->request("CANCEL",cancelled.mIMSI,callIDs[0]);
+	Timeval limit(5000);
+	while (!gHandsets->look(&cancelled).released() && !limit.passed()) msleep(10);
+	Phone seen = gHandsets->look(&cancelled);
+	// Cause 0x15, "call rejected".
+	CHECK(seen.released() && seen.mCause==0x15);
+	CHECK(seen.saw(code(GSM::L3CallControlPD,GSM::L3CCMessage::ReleaseComplete)));
+	CHECK(seen.mPrimitives==1);
+
+	// T303 is 10 seconds.
+	vector<Phone*> both(phones,phones+2);
+	CHECK(waitDone(both,T303ms+5000));
+	seen = gHandsets->look(&unconfirmed);
+	// Cause 0x66, "recovery on timer expiry".
+	CHECK(seen.released() && seen.mCause==0x66);
+	for (unsigned i=0; i<2; i++) CHECK(gSwitch->count("BYE",callIDs[i])>=1);
+	CHECK(gTransactionTable.size()==0);
+}
+
+
+// An MO-SMS through the DCCH dispatcher, with the MESSAGE to the switch.
+static void testMOSMS()
+{
+	Phone phone(Phone::MOSMS,IMSIFor(4));
+	TestDCCH channel(&phone);
+	gHandsets->request(&phone,0);
+	vector<Phone*> phones(1,&phone);
+	CHECK(waitDone(phones,10000));
+	Phone seen = gHandsets->look(&phone);
+	CHECK(seen.saw(code(GSM::L3SMSPD,SMS::CPMessage::ACK)));
+	CHECK(seen.mRPAck);
+	vector<string> messages = gSwitch->messages();
+	CHECK(messages.size()==1 && messages[0]=="hello");
+	CHECK(gTransactionTable.size()==0);
+}
+
+
+// A MOC on a traffic channel, with the speech moved by the MediaRelay through CallMediaPath.
+static void testMedia()
+{
+	Phone phone(Phone::MOC,IMSIFor(4));
+	TestDTCH channel(&phone);
+	unsigned echoed = gSwitch->RTPPackets();
+	// There is no DCCH here for the dispatcher, so the request goes straight to the responder.
+	vector<unsigned char> octets = CMServiceRequest(&phone);
+	GSM::L3Frame frame((const char*)&octets[0],octets.size());
+	GSM::L3Message *request = GSM::parseL3(frame);
+	CHECK(request);
+	if (!request) return;
+	phone.mStart = timef();
+	CMServiceResponder(dynamic_cast<const GSM::L3CMServiceRequest*>(request),&channel);
+	delete request;
+	vector<Phone*> phones(1,&phone);
+	CHECK(waitDone(phones,10000+gHandsets->hold()));
+	echoed = gSwitch->RTPPackets() - echoed;
+	printf("speech for %u ms: %u frames up, %u at the switch, %u back down\n",
+		gHandsets->hold(),channel.uplink(),echoed,channel.downlink());
+	Phone seen = gHandsets->look(&phone);
+	CHECK(seen.released() && seen.mSetup>0);
+	// A frame each way every 20 ms, less the start and the end.
+	unsigned expected = gHandsets->hold()/MediaFramePeriod;
+	CHECK(channel.uplink()>=expected/2);
+	CHECK(echoed>=channel.uplink()/2);
+	CHECK(channel.downlink()>=echoed/2);
+	CHECK(gMediaRelay.size()==0);
+	CHECK(gTransactionTable.size()==0);
+}
+
+
+/** The threads in this process. */
+static unsigned threadCount()
+{
+	FILE *status = fopen("/proc/self/status","r");
+	if (!status) return 0;
+	char line[200];
+	unsigned count = 0;
+	while (fgets(line,sizeof(line),status)) {
+		if (sscanf(line,"Threads: %u",&count)==1) break;
+	}
+	fclose(status);
+	return count;
+}
+
+
+// Concurrent MOCs started over a second, each held for the hold time.
+static void runCalls(unsigned numCalls, unsigned loops)
+{
+	vector<Phone*> phones;
+	vector<TestDCCH*> channels;
+	for (unsigned i=0; i<numCalls; i++) {
+		phones.push_back(new Phone(Phone::MOC,IMSIFor(1000+i)));
+		channels.push_back(new TestDCCH(phones[i]));
+	}
+	double start = timef();
+	for (unsigned i=0; i<numCalls; i++) gHandsets->request(phones[i],(1000*i)/numCalls);
+	// Watch the peak while the calls are up.
+	unsigned peakMachines = 0, peakThreads = 0;
+	Timeval limit(30000+1000*numCalls/50);
+	while (!limit.passed()) {
+		unsigned machines = gControlEngine.size();
+		if (machines>peakMachines) peakMachines = machines;
+		unsigned threads = threadCount();
+		if (threads>peakThreads) peakThreads = threads;
+		if (timef()-start>1.5 && waitDone(phones,0)) break;
+		msleep(10);
+	}
+	double elapsed = timef() - start;
+
+	unsigned completed = 0;
+	double total = 0, worst = 0;
+	for (unsigned i=0; i<numCalls; i++) {
+		Phone seen = gHandsets->look(phones[i]);
+		if (!seen.released() || seen.mSetup<=0) continue;
+		completed++;
+		total += seen.mSetup;
+		if (seen.mSetup>worst) worst = seen.mSetup;
+	}
+	printf(" %u engine loops, %u threads in the process, up to %u machines at once\n",loops,peakThreads,peakMachines);
+	printf(" %u of %u calls completed in %.2f s, setup avg %.2f ms, max %.2f ms\n",
+		completed,numCalls,elapsed,completed ? 1000*total/completed : 0.0,1000*worst);
+	CHECK(completed==numCalls);
+	CHECK(gTransactionTable.size()==0);
+
+	for (unsigned i=0; i<numCalls; i++) {
+		delete channels[i];
+		delete phones[i];
+	}
+}
+
+
+static void *dispatchLoop(void *)
+{
+	Control::DCCHDispatcher();
+	return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned numCalls = argc>1 ? atoi(argv[1]) : 200;
+	unsigned hold = argc>2 ? atoi(argv[2]) : 2000;
+	unsigned loops = argc>3 ? atoi(argv[3]) : 2;
+
+	gControlEngine.start(2);
+	testEngine();
+	gControlEngine.stop();
+
+	// Everything the calls need is on this host, and each call gets ports of its own.
+	gSwitch = new Switch;
+	ostringstream proxy;
+	proxy << "127.0.0.1:" << gSwitch->port();
+	gConfig.set("SIP.Proxy.Speech",proxy.str());
+	gConfig.set("SIP.Proxy.SMS",proxy.str());
+	gConfig.set("SMS.MIMEType","text/plain");
+	gConfig.set("RTP.Start","20000");
+	gConfig.set("RTP.Range","8000");
+
+	gSIPInterface.start();
+	gMediaRelay.start();
+	gControlEngine.start(loops);
+	Thread dispatcher;
+	dispatcher.start(dispatchLoop,NULL);
+	gHandsets = new Handsets(hold);
+
+	testOPTIONS();
+	testMOC();
+	testMTC();
+	testMOSMS();
+	testMedia();
+	printf("%u concurrent calls, %u ms hold:\n",numCalls,hold);
+	runCalls(numCalls,loops);
+
+	delete gHandsets;
+	gControlEngine.stop();
+	gMediaRelay.stop();
+	delete gSwitch;
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	// The SIP and DCCH dispatch threads run for the life of the process, as in OpenBTS-UMTS.
+	fflush(stdout);
+	_exit(failures ? 1 : 0);
+}
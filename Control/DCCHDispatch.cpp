@@ -19,8 +19,10 @@
 #include "TransactionTable.h"
 #include "RadioResource.h"
 #include "MobilityManagement.h"
+#include "ControlEngine.h"
 #include <GSML3MMMessages.h>
 #include <GSML3RRMessages.h>
+#include <GSML3Decoder.h>
 #include <SIPUtility.h>
 #include <SIPInterface.h>
 
@@ -106,6 +108,50 @@ void DCCHDispatchMessage(const GSM::L3Message* msg, UMTS::DCCHLogicalChannel* DC
 }
 
 
+/**
+	Dispatch the first message of a transaction from its frame, and delete the frame.
+	Registrations, service requests and detaches are decoded onto the stack;
+	anything else goes through parseMessage.
+*/
+void DCCHDispatchFrame(GSM::L3Frame* frame, UMTS::DCCHLogicalChannel* DCCH)
+{
+	GSM::L3DecodedMessage decoded;
+	if (frame->primitive()==GSM::DATA && !decoded.decode(*frame)) {
+		LOG(NOTICE) << "unparsed message " << *frame;
+		delete frame;
+		throw UnsupportedMessage();
+	}
+	switch (decoded.kind()) {
+		case GSM::L3DecodedMessage::LocationUpdatingRequest: {
+			delete frame;
+			GSM::L3LocationUpdatingRequest message(decoded);
+			LOG(DEBUG) << *DCCH << " received " << message;
+			DCCHDispatchMM(&message,DCCH);
+			return;
+		}
+		case GSM::L3DecodedMessage::CMServiceRequest: {
+			delete frame;
+			GSM::L3CMServiceRequest message(decoded);
+			LOG(DEBUG) << *DCCH << " received " << message;
+			DCCHDispatchMM(&message,DCCH);
+			return;
+		}
+		case GSM::L3DecodedMessage::IMSIDetachIndication: {
+			delete frame;
+			GSM::L3IMSIDetachIndication message(decoded);
+			LOG(DEBUG) << *DCCH << " received " << message;
+			DCCHDispatchMM(&message,DCCH);
+			return;
+		}
+		default: break;
+	}
+	const GSM::L3Message *message = parseMessage(frame);
+	LOG(DEBUG) << *DCCH << " received " << *message;
+	DCCHDispatchMessage(message,DCCH);
+	delete message;
+}
+
+
 DCCHLogicalChannelFIFO gDCCHLogicalChannelFIFO;
 
 /** Example of a closed-loop, persistent-thread control function for the DCCH. */
@@ -115,63 +161,24 @@ void Control::DCCHDispatcher()
 	while (1) {
                 UMTS::DCCHLogicalChannel *DCCH = gDCCHLogicalChannelFIFO.read(20000);
                 if (DCCH==NULL) continue;
+		// A channel with a control machine on it gets its messages from the machine.
+		// This is a frame that raced the machine's start, so pass it on.
+		if (gControlEngine.post(DCCH,ControlMachine::L3Event)) continue;
 		try {
 			// Wait for a transaction to start.
 			LOG(DEBUG) << "waiting for " << *DCCH << " ESTABLISH";
 			DCCH->waitForPrimitive(GSM::ESTABLISH);
 			// Pull the first message and dispatch a new transaction.
-			const GSM::L3Message *message = getMessage(DCCH);
-			LOG(DEBUG) << *DCCH << " received " << *message;
-			DCCHDispatchMessage(message,DCCH);
-			delete message;
+			DCCHDispatchFrame(getFrame(DCCH),DCCH);
 		}
 
 		// Catch the various error cases.
 
-		catch (ChannelReadTimeout except) {
-			LOG(NOTICE) << "ChannelReadTimeout";
-			// Cause 0x03 means "abnormal release, timer expired".
-			DCCH->send(GSM::L3ChannelRelease(0x03));
-			gTransactionTable.remove(except.transactionID());
-		}
-		catch (UnexpectedPrimitive except) {
-			LOG(NOTICE) << "UnexpectedPrimitive";
-			// Cause 0x62 means "message type not not compatible with protocol state".
-			DCCH->send(GSM::L3ChannelRelease(0x62));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
-		}
-		catch (UnexpectedMessage except) {
-			LOG(NOTICE) << "UnexpectedMessage";
-			// Cause 0x62 means "message type not not compatible with protocol state".
-			DCCH->send(GSM::L3ChannelRelease(0x62));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
-		}
-		catch (UnsupportedMessage except) {
-			LOG(NOTICE) << "UnsupportedMessage";
-			// Cause 0x61 means "message type not implemented".
-			DCCH->send(GSM::L3ChannelRelease(0x61));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
-		}
-		catch (Q931TimerExpired except) {
-			LOG(NOTICE) << "Q.931 T3xx timer expired";
-			// Cause 0x03 means "abnormal release, timer expired".
-			// TODO -- Send diagnostics.
-			DCCH->send(GSM::L3ChannelRelease(0x03));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
-		}
-		catch (SIP::SIPTimeout except) {
-			// FIXME -- The transaction ID should be an argument here.
-			LOG(WARNING) << "Uncaught SIPTimeout, will leave a stray transcation";
-			// Cause 0x03 means "abnormal release, timer expired".
-			DCCH->send(GSM::L3ChannelRelease(0x03));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
+		catch (ControlLayerException) {
+			if (unsigned ID = releaseForException(DCCH)) gTransactionTable.remove(ID);
 		}
-		catch (SIP::SIPError except) {
-			// FIXME -- The transaction ID should be an argument here.
-			LOG(WARNING) << "Uncaught SIPError, will leave a stray transcation";
-			// Cause 0x01 means "abnormal release, unspecified".
-			DCCH->send(GSM::L3ChannelRelease(0x01));
-			if (except.transactionID()) gTransactionTable.remove(except.transactionID());
+		catch (SIP::SIPException) {
+			if (unsigned ID = releaseForException(DCCH)) gTransactionTable.remove(ID);
 		}
 	}
 }
@@ -0,0 +1,208 @@
+/**@file Adaptive playout buffer for the downlink speech of a call. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "JitterBuffer.h"
+#include "MediaRelay.h"
+
+using namespace std;
+using namespace Control;
+
+
+JitterBuffer::JitterBuffer(unsigned wFrameSamples, unsigned wMinDepth, unsigned wMaxDepth)
+	:mFrameSamples(wFrameSamples),mFramePeriod(MediaFramePeriod/1000.0),
+	mMinDepth(wMinDepth),mMaxDepth(wMaxDepth),
+	mStarted(false),mPlaying(false),
+	mPlayTimestamp(0),mNewestTimestamp(0),mNewestSequence(0),
+	mLastArrival(0),mLastTimestamp(0),mJitter(0),mAverageDepth(0),mLossRun(0),
+	mReceived(0),mPlayed(0),mLost(0),mLate(0),mDuplicates(0),mReordered(0),
+	mUnderruns(0),mSkipped(0),mResyncs(0)
+{
+	if (mMinDepth==0) mMinDepth = 1;
+	if (mMaxDepth>Slots/2) mMaxDepth = Slots/2;
+	if (mMaxDepth<mMinDepth) mMaxDepth = mMinDepth;
+	mTarget = mMinDepth;
+	for (unsigned i=0; i<Slots; i++) mSlots[i].mFull = false;
+	memset(mLatency,0,sizeof(mLatency));
+	memset(mLoss,0,sizeof(mLoss));
+}
+
+
+void JitterBuffer::restart(uint32_t timestamp, double now)
+{
+	for (unsigned i=0; i<Slots; i++) mSlots[i].mFull = false;
+	endLossRun();
+	mStarted = true;
+	mPlaying = false;
+	mBase = timestamp;
+	mPlayTimestamp = timestamp;
+	mNewestTimestamp = timestamp;
+	mLastArrival = now;
+	mLastTimestamp = timestamp;
+	mAverageDepth = 0;
+}
+
+
+unsigned JitterBuffer::depth() const
+{
+	int32_t span = (int32_t)(mNewestTimestamp - mPlayTimestamp);
+	if (span<0) return 0;
+	// Nothing has arrived at the playout point or after it.
+	const Slot &newest = mSlots[((mNewestTimestamp-mBase)/mFrameSamples)%Slots];
+	if (!newest.mFull || newest.mTimestamp!=mNewestTimestamp) return 0;
+	return span/mFrameSamples + 1;
+}
+
+
+void JitterBuffer::endLossRun()
+{
+	if (!mLossRun) return;
+	unsigned bucket = mLossRun>LossBuckets ? LossBuckets : mLossRun;
+	mLoss[bucket-1]++;
+	mLossRun = 0;
+}
+
+
+void JitterBuffer::adapt()
+{
+	// Enough delay to cover about three times the mean deviation of the arrivals.
+	unsigned target = mMinDepth + (unsigned)floor(3*mJitter/mFramePeriod + 0.5);
+	if (target>mMaxDepth) target = mMaxDepth;
+	mTarget = target;
+}
+
+
+void JitterBuffer::put(const unsigned char *frame, unsigned length, uint16_t sequence, uint32_t timestamp, double now)
+{
+	mReceived++;
+	int32_t ahead = (int32_t)(timestamp-mPlayTimestamp);
+	const int32_t window = Slots*mFrameSamples;
+	if (!mStarted || ahead<=-window || ahead>=window) {
+		// The first packet, a new stream, or a jump too far to bridge.
+		if (mStarted) mResyncs++;
+		restart(timestamp,now);
+		mNewestSequence = sequence;
+	} else {
+		// RFC-3550 A.8, in seconds.
+		double difference = (now-mLastArrival) - (int32_t)(timestamp-mLastTimestamp)*mFramePeriod/mFrameSamples;
+		mJitter += (fabs(difference) - mJitter)/16;
+		mLastArrival = now;
+		mLastTimestamp = timestamp;
+		if ((int16_t)(sequence-mNewestSequence)<0) mReordered++;
+		else mNewestSequence = sequence;
+		if (ahead<0) {
+			mLate++;
+			return;
+		}
+	}
+
+	Slot &s = mSlots[((timestamp-mBase)/mFrameSamples)%Slots];
+	if (s.mFull && s.mTimestamp==timestamp) {
+		mDuplicates++;
+		return;
+	}
+	if (length>FrameSize) length = FrameSize;
+	memcpy(s.mFrame,frame,length);
+	s.mLength = length;
+	s.mTimestamp = timestamp;
+	s.mArrival = now;
+	s.mFull = true;
+	if ((int32_t)(timestamp-mNewestTimestamp)>0) mNewestTimestamp = timestamp;
+}
+
+
+unsigned JitterBuffer::get(unsigned char *frame, double now)
+{
+	if (!mStarted) return 0;
+	adapt();
+	unsigned d = depth();
+	if (!mPlaying) {
+		// Prebuffer to the target depth.
+		if (d<mTarget) return 0;
+		mPlaying = true;
+		mAverageDepth = d;
+	}
+	if (d==0) {
+		// Ran dry.  Hold the playout point and buffer up to the target again,
+		// which adds a frame of delay each time it happens.
+		mUnderruns++;
+		mPlaying = false;
+		return 0;
+	}
+
+	// Too deep for too long, from a drop in the jitter or a fast sender clock.
+	mAverageDepth += (d-mAverageDepth)/16;
+	if (mAverageDepth>mTarget+2 && d>mTarget) {
+		Slot &s = mSlots[((mPlayTimestamp-mBase)/mFrameSamples)%Slots];
+		if (s.mFull && s.mTimestamp==mPlayTimestamp) {
+			s.mFull = false;
+			mSkipped++;
+		} else {
+			// It was missing anyway.
+			mLost++;
+			mLossRun++;
+		}
+		mPlayTimestamp += mFrameSamples;
+		mAverageDepth -= 1;
+	}
+
+	Slot &s = mSlots[((mPlayTimestamp-mBase)/mFrameSamples)%Slots];
+	mPlayTimestamp += mFrameSamples;
+	if (!s.mFull || s.mTimestamp!=mPlayTimestamp-mFrameSamples) {
+		mLost++;
+		mLossRun++;
+		return 0;
+	}
+	s.mFull = false;
+	memcpy(frame,s.mFrame,s.mLength);
+	mPlayed++;
+	endLossRun();
+	unsigned bucket = (unsigned)((now-s.mArrival)/0.010);
+	if (bucket>=LatencyBuckets) bucket = LatencyBuckets-1;
+	mLatency[bucket]++;
+	return s.mLength;
+}
+
+
+void JitterBuffer::stats(ostream& os) const
+{
+	os << "received " << mReceived << ", played " << mPlayed << ", lost " << mLost << ", late " << mLate
+		<< ", duplicates " << mDuplicates << ", reordered " << mReordered << ", underruns " << mUnderruns
+		<< ", skipped " << mSkipped << ", resyncs " << mResyncs
+		<< ", jitter " << 1000*mJitter << " ms, target " << mTarget << " frames";
+	os << ", latency ms:";
+	for (unsigned i=0; i<LatencyBuckets; i++) {
+		if (!mLatency[i]) continue;
+		if (i==LatencyBuckets-1) os << " " << 10*i << "+=" << mLatency[i];
+		else os << " " << 10*i << "-" << 10*(i+1) << "=" << mLatency[i];
+	}
+	os << ", loss bursts:";
+	for (unsigned i=0; i<LossBuckets; i++) {
+		if (!mLoss[i]) continue;
+		os << " " << i+1 << (i==LossBuckets-1 ? "+" : "") << "=" << mLoss[i];
+	}
+}
+
+
+ostream& Control::operator<<(ostream& os, const JitterBuffer& jitter)
+{
+	jitter.stats(os);
+	return os;
+}
+
+
+// vim: ts=4 sw=4
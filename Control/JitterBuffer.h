@@ -0,0 +1,143 @@
+/**@file Adaptive playout buffer for the downlink speech of a call. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <stdint.h>
+#include <ostream>
+
+namespace Control {
+
+/**
+	Holds the RTP speech frames of one call until their turn to go out on the downlink,
+	one frame per 20 ms frame period.
+	Frames are placed by RTP timestamp, so reordered packets are played in order and duplicates
+	are dropped; the sequence numbers are only used to count reordering.
+	The playout delay follows the RFC-3550 interarrival jitter of the stream, between the
+	minimum and maximum depths: playout starts once the target depth is buffered, waits when the
+	buffer runs dry, and skips a frame when the buffer stays deeper than the target,
+	which also absorbs a sender clock that runs fast.
+	Not locked; the MediaRelay calls it from its one thread.
+	Times are in seconds, from timef() or from a trace.
+*/
+class JitterBuffer {
+
+	public:
+
+	/** Latency histogram buckets, 10 ms each, with the last one for anything over. */
+	static const unsigned LatencyBuckets = 21;
+	/** Loss burst histogram buckets, by burst length, with the last one for anything longer. */
+	static const unsigned LossBuckets = 8;
+
+	private:
+
+	static const unsigned Slots = 32;			///< 640 ms of frames
+	static const unsigned FrameSize = 160;		///< room for G.711
+
+	struct Slot {
+		bool mFull;
+		uint32_t mTimestamp;
+		double mArrival;
+		unsigned mLength;
+		unsigned char mFrame[FrameSize];
+	};
+
+	Slot mSlots[Slots];
+	unsigned mFrameSamples;			///< RTP timestamp units per frame
+	double mFramePeriod;			///< seconds per frame
+	unsigned mMinDepth;				///< frames
+	unsigned mMaxDepth;
+
+	bool mStarted;					///< the first packet has arrived
+	bool mPlaying;					///< prebuffering is done
+	uint32_t mBase;					///< the timestamp the slots are counted from
+	uint32_t mPlayTimestamp;		///< the timestamp of the next frame to play
+	uint32_t mNewestTimestamp;		///< the newest frame received
+	uint16_t mNewestSequence;
+	double mLastArrival;			///< for the jitter estimate
+	uint32_t mLastTimestamp;
+	double mJitter;					///< RFC-3550 interarrival jitter, seconds
+	unsigned mTarget;				///< target depth, frames
+	double mAverageDepth;			///< smoothed depth at playout, frames
+	unsigned mLossRun;				///< frames lost in a row so far
+
+	// Statistics.
+	unsigned mReceived;
+	unsigned mPlayed;
+	unsigned mLost;					///< frames not there at their turn, with later frames already there
+	unsigned mLate;					///< arrived after their turn
+	unsigned mDuplicates;
+	unsigned mReordered;			///< arrived with an older sequence number than one already seen
+	unsigned mUnderruns;			///< frame periods with nothing to play
+	unsigned mSkipped;				///< frames dropped to bring the depth down
+	unsigned mResyncs;				///< restarts on a timestamp jump
+	unsigned mLatency[LatencyBuckets];	///< arrival to playout
+	unsigned mLoss[LossBuckets];	///< loss bursts by length
+
+	/** The span in frames from the playout point to the newest frame, or 0 if that has been played. */
+	unsigned depth() const;
+
+	void restart(uint32_t timestamp, double now);
+	void endLossRun();
+	void adapt();
+
+	public:
+
+	/**
+		@param wFrameSamples RTP timestamp units per frame, 160 for 20 ms at 8 kHz.
+		@param wMinDepth, wMaxDepth Limits on the target depth, in frames.
+	*/
+	JitterBuffer(unsigned wFrameSamples=160, unsigned wMinDepth=1, unsigned wMaxDepth=10);
+
+	/** Take a packet from RTP. */
+	void put(const unsigned char *frame, unsigned length, uint16_t sequence, uint32_t timestamp, double now);
+
+	/**
+		Take the frame for this frame period, called once per period.
+		@return its length, or 0 if there is none to play.
+	*/
+	unsigned get(unsigned char *frame, double now);
+
+	/** The current target depth, in frames. */
+	unsigned target() const { return mTarget; }
+
+	/** The estimated interarrival jitter, in seconds. */
+	double jitter() const { return mJitter; }
+
+	unsigned received() const { return mReceived; }
+	unsigned played() const { return mPlayed; }
+	unsigned lost() const { return mLost; }
+	unsigned late() const { return mLate; }
+	unsigned duplicates() const { return mDuplicates; }
+	unsigned reordered() const { return mReordered; }
+	unsigned underruns() const { return mUnderruns; }
+	unsigned skipped() const { return mSkipped; }
+	unsigned resyncs() const { return mResyncs; }
+	const unsigned *latencyHistogram() const { return mLatency; }
+	const unsigned *lossHistogram() const { return mLoss; }
+
+	/** Write the counters and histograms on one line. */
+	void stats(std::ostream&) const;
+};
+
+std::ostream& operator<<(std::ostream&, const JitterBuffer&);
+
+}	// Control
+
+#endif
+
+// vim: ts=4 sw=4
@@ -0,0 +1,235 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Play packet-arrival traces through the JitterBuffer, as the MediaRelay does: every 20 ms,
+// put the packets that have arrived and get one frame.  The synthetic traces cover a clean
+// stream, reordering and duplicates, random network jitter (against a fixed one-frame buffer,
+// which is about what the blocking oRTP read gave), sender clocks that run fast and slow,
+// random and burst loss, and a timestamp jump.  Each prints its counters and histograms.
+// Given a file, plays that trace instead: one packet per line, "arrival-ms sequence timestamp".
+// Build with JitterBuffer.cpp and CommonLibs.
+// Usage: JitterBufferTest [trace file]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <Configuration.h>
+#include <UnitTest.h>
+#include "JitterBuffer.h"
+
+using namespace std;
+using namespace Control;
+
+ConfigurationTable gConfig;
+
+struct Arrival {
+	double mTime;			// seconds
+	uint16_t mSequence;
+	uint32_t mTimestamp;
+	bool operator<(const Arrival& other) const { return mTime < other.mTime; }
+};
+
+typedef vector<Arrival> Trace;
+
+static void add(Trace &trace, double time, unsigned n, uint32_t timestampBase=1000)
+{
+	Arrival a = { time, (uint16_t)(5000+n), timestampBase + 160*n };
+	trace.push_back(a);
+}
+
+/** Play a trace, checking that every frame comes out in order, and print the result. */
+static void play(const char *name, Trace trace, JitterBuffer &jitter)
+{
+	stable_sort(trace.begin(),trace.end());
+	unsigned next = 0;
+	unsigned char frame[160];
+	uint32_t lastPlayed = 0;
+	bool anyPlayed = false;
+	double end = trace.back().mTime + 1.0;
+	// The frame periods fall between the packets of an even stream.
+	for (double now = trace.front().mTime + 0.010; now < end; now += 0.020) {
+		while (next<trace.size() && trace[next].mTime<=now) {
+			const Arrival &a = trace[next++];
+			// The payload carries the timestamp, to check the order.
+			*(uint32_t*)frame = a.mTimestamp;
+			jitter.put(frame,33,a.mSequence,a.mTimestamp,a.mTime);
+		}
+		if (jitter.get(frame,now)) {
+			uint32_t timestamp = *(uint32_t*)frame;
+			if (anyPlayed && (int32_t)(timestamp-lastPlayed)<=0 && (int32_t)(timestamp-lastPlayed)>-100000) {
+				CHECK((int32_t)(timestamp-lastPlayed)>0);
+			}
+			lastPlayed = timestamp;
+			anyPlayed = true;
+		}
+	}
+	ostringstream os;
+	os << jitter;
+	printf("%s:\n  %s\n",name,os.str().c_str());
+}
+
+/** Frames played within this latency, in ms. */
+static unsigned within(const JitterBuffer &jitter, unsigned ms)
+{
+	unsigned count = 0;
+	for (unsigned i=0; i<ms/10 && i<JitterBuffer::LatencyBuckets; i++) count += jitter.latencyHistogram()[i];
+	return count;
+}
+
+static double uniform() { return (random()%10000)/10000.0; }
+
+
+static void testClean()
+{
+	Trace trace;
+	for (unsigned n=0; n<500; n++) add(trace,0.020*n+0.001,n);
+	JitterBuffer jitter;
+	play("clean",trace,jitter);
+	CHECK(jitter.played()==500);
+	// It runs dry once, at the end of the trace.
+	CHECK(jitter.lost()==0 && jitter.late()==0 && jitter.underruns()==1);
+	CHECK(jitter.target()==1);
+	CHECK(within(jitter,30)==500);
+}
+
+
+static void testReorderDuplicates()
+{
+	Trace trace;
+	unsigned duplicates = 0;
+	for (unsigned n=0; n<500; n++) {
+		// Every 10th packet overtakes the one before it.
+		double delay = (n%10==8) ? 0.030 : 0.001;
+		add(trace,0.020*n+delay,n);
+		if (n%25==0) { add(trace,0.020*n+0.005,n); duplicates++; }
+	}
+	JitterBuffer jitter;
+	play("reordered and duplicated",trace,jitter);
+	CHECK(jitter.duplicates()==duplicates);
+	CHECK(jitter.reordered()==50);
+	// The jitter estimate grows to cover the reordering, so little is late.
+	CHECK(jitter.played()+jitter.late()==500);
+	CHECK(jitter.late()<10);
+}
+
+
+static void testJitter()
+{
+	Trace trace;
+	for (unsigned n=0; n<3000; n++) add(trace,0.020*n+0.080*uniform(),n);
+	JitterBuffer adaptive;
+	play("random jitter 0-80 ms, adaptive",trace,adaptive);
+	JitterBuffer fixed(160,1,1);
+	play("random jitter 0-80 ms, fixed one frame",trace,fixed);
+	CHECK(adaptive.played()>2900);
+	CHECK(adaptive.late()*5<fixed.late());
+	CHECK(adaptive.target()>1);
+}
+
+
+static void testDrift()
+{
+	{
+		// The sender clock is 0.5% fast: 30 frames too many in 2 minutes.
+		Trace trace;
+		for (unsigned n=0; n<6000; n++) add(trace,0.0199*n+0.001,n);
+		JitterBuffer jitter;
+		play("sender clock 0.5% fast",trace,jitter);
+		CHECK(jitter.skipped()>=20);
+		CHECK(jitter.late()==0);
+		// The delay stays bounded instead of growing by 600 ms.
+		CHECK(within(jitter,100)==jitter.played());
+	}
+	{
+		// 0.5% slow: the buffer runs dry now and then, but nothing is lost.
+		Trace trace;
+		for (unsigned n=0; n<6000; n++) add(trace,0.0201*n+0.001,n);
+		JitterBuffer jitter;
+		play("sender clock 0.5% slow",trace,jitter);
+		CHECK(jitter.played()==6000);
+		CHECK(jitter.lost()==0);
+		CHECK(jitter.underruns()>0);
+	}
+}
+
+
+static void testLoss()
+{
+	Trace trace;
+	unsigned dropped = 0;
+	for (unsigned n=0; n<3000; n++) {
+		if (n>=1000 && n<1003) { dropped++; continue; }
+		// Losses before the first packet or after the last are not seen.
+		if (n!=0 && n!=999 && n!=1003 && n!=2999 && uniform()<0.05) { dropped++; continue; }
+		add(trace,0.020*n+0.001,n);
+	}
+	JitterBuffer jitter;
+	play("5% random loss and a burst of 3",trace,jitter);
+	CHECK(jitter.lost()==dropped);
+	const unsigned *loss = jitter.lossHistogram();
+	CHECK(loss[0]>100);
+	CHECK(loss[2]>=1);
+}
+
+
+static void testResync()
+{
+	Trace trace;
+	for (unsigned n=0; n<500; n++) add(trace,0.020*n+0.001,n,n<250 ? 1000 : 900000);
+	JitterBuffer jitter;
+	play("timestamp jump",trace,jitter);
+	CHECK(jitter.resyncs()==1);
+	CHECK(jitter.played()>=498);
+}
+
+
+static bool readTrace(const char *path, Trace &trace)
+{
+	FILE *file = fopen(path,"r");
+	if (!file) return false;
+	double ms;
+	unsigned sequence, timestamp;
+	while (fscanf(file,"%lf %u %u",&ms,&sequence,&timestamp)==3) {
+		Arrival a = { ms/1000.0, (uint16_t)sequence, timestamp };
+		trace.push_back(a);
+	}
+	fclose(file);
+	return trace.size()>0;
+}
+
+
+int main(int argc, char **argv)
+{
+	srandom(1);
+	if (argc>1) {
+		Trace trace;
+		if (!readTrace(argv[1],trace)) {
+			printf("cannot read a trace from %s\n",argv[1]);
+			return 1;
+		}
+		JitterBuffer jitter;
+		play(argv[1],trace,jitter);
+		return 0;
+	}
+	testClean();
+	testReorderDuplicates();
+	testJitter();
+	testDrift();
+	testLoss();
+	testResync();
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/**@file Relay of vocoder frames between the traffic channels and RTP. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <unistd.h>
+#include <Utils.h>
+#include "MediaRelay.h"
+
+#include <Logger.h>
+
+using namespace std;
+using namespace Control;
+
+
+FrameRing::FrameRing(unsigned wSlots)
+	:mSlots(wSlots),mHead(0),mCount(0)
+{
+	assert(mSlots);
+	mFrames = new unsigned char[mSlots*MediaFrameSize];
+	mLengths = new unsigned[mSlots];
+}
+
+
+FrameRing::~FrameRing()
+{
+	delete[] mFrames;
+	delete[] mLengths;
+}
+
+
+
+namespace Control {
+
+/** A call being relayed. */
+struct MediaRelay::Call {
+
+	MediaPath *mPath;
+	unsigned mMaxLatency;		///< cached from the call setup
+	FrameRing mUplink;
+	FrameRing mDownlink;
+
+	Call(MediaPath *wPath, unsigned wMaxLatency)
+		:mPath(wPath),mMaxLatency(wMaxLatency),
+		mUplink(RingSlots),mDownlink(RingSlots)
+	{ }
+
+	~Call() { delete mPath; }
+
+	/** 320 ms each way, more than GSM.MaxSpeechLatency allows. */
+	static const unsigned RingSlots = 16;
+};
+
+}	// Control
+
+
+
+MediaRelay::MediaRelay()
+	:mThread(NULL),mStopping(false),
+	mPasses(0),mLate(0),mBusy(0),mUplinkFrames(0),mDownlinkFrames(0),mDropped(0)
+{ }
+
+
+MediaRelay::~MediaRelay()
+{
+	stop();
+}
+
+
+void MediaRelay::start()
+{
+	if (mThread) return;
+	mStopping = false;
+	mThread = new Thread;
+	mThread->start(serviceLoop,this);
+}
+
+
+void MediaRelay::stop()
+{
+	if (mThread) {
+		mStopping = true;
+		mThread->join();
+		delete mThread;
+		mThread = NULL;
+	}
+	ScopedLock lock(mLock);
+	for (map<const void*,Call*>::iterator itr = mCalls.begin(); itr!=mCalls.end(); ++itr) delete itr->second;
+	mCalls.clear();
+}
+
+
+void MediaRelay::add(const void *channel, MediaPath *path, unsigned maxLatency)
+{
+	assert(channel);
+	assert(path);
+	if (maxLatency==0) maxLatency = 1;
+	// Leave a slot free at the start of each pass for the radio reads.
+	if (maxLatency>=Call::RingSlots) maxLatency = Call::RingSlots-1;
+	Call *call = new Call(path,maxLatency);
+	Call *old = NULL;
+	{
+		ScopedLock lock(mLock);
+		map<const void*,Call*>::iterator itr = mCalls.find(channel);
+		if (itr!=mCalls.end()) old = itr->second;
+		mCalls[channel] = call;
+	}
+	if (old) {
+		LOG(NOTICE) << "replacing the call on channel " << channel;
+		ScopedLock pass(mPassLock);
+		delete old;
+	}
+}
+
+
+void MediaRelay::remove(const void *channel)
+{
+	Call *call;
+	{
+		ScopedLock lock(mLock);
+		map<const void*,Call*>::iterator itr = mCalls.find(channel);
+		if (itr==mCalls.end()) return;
+		call = itr->second;
+		mCalls.erase(itr);
+	}
+	// Wait for the pass in progress, which may still have the call.
+	ScopedLock pass(mPassLock);
+	delete call;
+}
+
+
+void *MediaRelay::serviceLoop(void *arg)
+{
+	MediaRelay *relay = static_cast<MediaRelay*>(arg);
+	const double period = MediaFramePeriod/1000.0;
+	double next = timef();
+	while (!relay->mStopping) {
+		// Keep to the frame period from the start, not from the end of the last pass.
+		next += period;
+		double now = timef();
+		if (now<next) usleep((unsigned)(1e6*(next-now)));
+		else if (now-next>period) {
+			relay->mLock.lock();
+			relay->mLate++;
+			relay->mLock.unlock();
+			next = now;
+		}
+		ScopedLock pass(relay->mPassLock);
+		relay->mLock.lock();
+		// This keeps its capacity from pass to pass.
+		relay->mPass.clear();
+		for (map<const void*,Call*>::iterator itr = relay->mCalls.begin(); itr!=relay->mCalls.end(); ++itr) {
+			relay->mPass.push_back(itr->second);
+		}
+		relay->mLock.unlock();
+		relay->service();
+	}
+	return NULL;
+}
+
+
+void MediaRelay::service()
+{
+	double start = timef();
+	unsigned up = 0, down = 0, dropped = 0;
+	for (unsigned i=0; i<mPass.size(); i++) {
+		Call *call = mPass[i];
+
+		// Downlink (RTP->radio).
+		FrameRing &downlink = call->mDownlink;
+		if (!downlink.full()) {
+			if (unsigned length = call->mPath->RTPRead(downlink.back())) downlink.push(length);
+		}
+		while (downlink.size()>call->mMaxLatency) { downlink.pop(); dropped++; }
+		if (!downlink.empty()) {
+			call->mPath->radioWrite(downlink.front(),downlink.frontLength());
+			downlink.pop();
+			down++;
+		}
+
+		// Uplink (radio->RTP).
+		// Take everything the radio has, then flush the ring to limit latency.
+		FrameRing &uplink = call->mUplink;
+		while (true) {
+			if (uplink.full()) { uplink.pop(); dropped++; }
+			unsigned length = call->mPath->radioRead(uplink.back());
+			if (!length) break;
+			uplink.push(length);
+		}
+		while (uplink.size()>call->mMaxLatency) { uplink.pop(); dropped++; }
+		if (uplink.empty()) continue;
+		call->mPath->RTPWrite(uplink.front(),uplink.frontLength());
+		uplink.pop();
+		up++;
+	}
+	ScopedLock lock(mLock);
+	mPasses++;
+	mUplinkFrames += up;
+	mDownlinkFrames += down;
+	mDropped += dropped;
+	mBusy += timef() - start;
+}
+
+
+void MediaRelay::stats(ostream& os) const
+{
+	ScopedLock lock(mLock);
+	os << mCalls.size() << " calls, " << mPasses << " passes, " << mLate << " late, "
+		<< mUplinkFrames << " uplink frames, " << mDownlinkFrames << " downlink frames, " << mDropped << " dropped, "
+		<< "busy " << (mPasses ? 1e6*mBusy/mPasses : 0.0) << " us per pass";
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,168 @@
+/**@file Relay of vocoder frames between the traffic channels and RTP. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef MEDIARELAY_H
+#define MEDIARELAY_H
+
+#include <map>
+#include <vector>
+#include <ostream>
+#include <Threads.h>
+
+namespace Control {
+
+/** Room for the largest vocoder frame, G.711 at 20 ms. */
+static const unsigned MediaFrameSize = 160;
+
+/** The frame period, the UMTS AMR TTI and the GSM speech frame. */
+static const unsigned MediaFramePeriod = 20;
+
+
+/**
+	A ring of vocoder frames, allocated once.
+	It is not locked; the owner locks it if it is shared.
+*/
+class FrameRing {
+
+	private:
+
+	unsigned char *mFrames;		///< mSlots frames of MediaFrameSize bytes
+	unsigned *mLengths;
+	unsigned mSlots;
+	unsigned mHead;				///< the oldest frame
+	unsigned mCount;
+
+	public:
+
+	FrameRing(unsigned wSlots);
+	~FrameRing();
+
+	unsigned size() const { return mCount; }
+	bool full() const { return mCount==mSlots; }
+	bool empty() const { return mCount==0; }
+
+	/** The slot to fill for the next frame.  The ring must not be full. */
+	unsigned char *back() { return mFrames + MediaFrameSize*((mHead+mCount)%mSlots); }
+	/** Add the frame written into back(). */
+	void push(unsigned length) { mLengths[(mHead+mCount)%mSlots] = length; mCount++; }
+
+	/** The oldest frame.  The ring must not be empty. */
+	const unsigned char *front() const { return mFrames + MediaFrameSize*mHead; }
+	unsigned frontLength() const { return mLengths[mHead]; }
+	/** Drop the oldest frame. */
+	void pop() { mHead = (mHead+1)%mSlots; mCount--; }
+};
+
+
+/** The two ends of a call's media as the MediaRelay sees them. */
+class MediaPath {
+
+	public:
+
+	virtual ~MediaPath() {}
+
+	/**
+		Read the next downlink frame from RTP into frame, without blocking.
+		Called once per frame period.
+		@return the frame length, or 0 if there is none.
+	*/
+	virtual unsigned RTPRead(unsigned char *frame) = 0;
+
+	/** Send an uplink frame on RTP. */
+	virtual void RTPWrite(const unsigned char *frame, unsigned length) = 0;
+
+	/**
+		Read the next uplink frame from the radio into frame, without blocking.
+		Called once per frame period until there is none.
+		@return the frame length, or 0 if there is none.
+	*/
+	virtual unsigned radioRead(unsigned char *frame) = 0;
+
+	/** Send a downlink frame to the handset. */
+	virtual void radioWrite(const unsigned char *frame, unsigned length) = 0;
+};
+
+
+/**
+	Moves the speech frames of all the calls in progress from one thread, once per frame period.
+	This replaces a polling loop in each call that looked up GSM.MaxSpeechLatency and
+	allocated a frame for every frame moved.  Here the latency limit is read when the call
+	is added, and each call has two FrameRings allocated when it is added:
+	the uplink ring is filled from the radio and emptied to RTP,
+	and the downlink ring is filled from RTP and emptied to the radio.
+	Both ends are polled without blocking, so only the relay thread touches the rings.
+	Calls are known by their traffic channels.
+*/
+class MediaRelay {
+
+	private:
+
+	struct Call;
+
+	mutable Mutex mLock;				///< protects mCalls and the counters
+	std::map<const void*,Call*> mCalls;	///< by channel
+	Mutex mPassLock;					///< held by the relay thread while it moves frames
+	std::vector<Call*> mPass;			///< the calls for the pass in progress
+	Thread *mThread;					///< created by start()
+	volatile bool mStopping;
+
+	unsigned mPasses;					///< frame periods serviced
+	unsigned mLate;						///< passes that started a full period late
+	double mBusy;						///< seconds spent moving frames
+	unsigned mUplinkFrames;				///< frames sent on RTP
+	unsigned mDownlinkFrames;			///< frames sent to the radio
+	unsigned mDropped;					///< uplink frames dropped to hold the latency limit
+
+	static void *serviceLoop(void *);
+
+	/** Move one frame each way for each call. */
+	void service();
+
+	public:
+
+	MediaRelay();
+	~MediaRelay();
+
+	/** Start the relay thread. */
+	void start();
+
+	/** Stop the relay thread and drop the calls. */
+	void stop();
+
+	/**
+		Start relaying a call's frames.  The relay takes ownership of the path.
+		@param channel The call's traffic channel, for remove().
+		@param maxLatency The most frames to hold in each direction before dropping the oldest.
+	*/
+	void add(const void *channel, MediaPath *path, unsigned maxLatency);
+
+	/** Stop relaying the call on this channel and delete its path.  Once this returns, the path is not used. */
+	void remove(const void *channel);
+
+	/** The number of calls being relayed. */
+	unsigned size() const { ScopedLock lock(mLock); return mCalls.size(); }
+
+	void stats(std::ostream&) const;
+};
+
+}	// Control
+
+/** The one relay for the calls' media. */
+extern Control::MediaRelay gMediaRelay;
+
+#endif
+
+// vim: ts=4 sw=4
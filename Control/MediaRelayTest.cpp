@@ -0,0 +1,294 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the FrameRing and the MediaRelay latency limit, then move speech for many calls at once
+// through the relay and through the old way, a thread per call running updateCallTraffic:
+// a blocking RTP read paced at 20 ms, a GSM.MaxSpeechLatency lookup and an allocated frame from
+// the traffic channel for every frame.  One radio thread produces an uplink frame for every call
+// every 20 ms, and every call's RTP has a downlink frame every 20 ms.
+// Reports the frames moved per second and the CPU used per call.
+// Build with MediaRelay.cpp and CommonLibs.
+// Usage: MediaRelayTest [calls] [seconds]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <sstream>
+#include <Configuration.h>
+#include <Interthread.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "MediaRelay.h"
+
+using namespace std;
+using namespace Control;
+
+ConfigurationTable gConfig;
+
+static const unsigned FrameLength = 33;		// GSM 06.10
+
+static double cpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+// A call's RTP and radio, counting what moves.
+// The radio's uplink frames are queued, allocated, as a traffic channel queues them.
+class TestPath : public MediaPath {
+
+	public:
+
+	InterthreadQueue<unsigned char> mRadioIn;	///< uplink frames from the radio
+	unsigned mRTPIn;		///< downlink frames available
+	unsigned mRTPOut;		///< uplink frames sent
+	unsigned mRadioOut;		///< downlink frames sent to the radio
+	unsigned char mLast;	///< the first byte of the last uplink frame
+	unsigned *mDeleted;
+
+	TestPath(unsigned *wDeleted=NULL) : mRTPIn(0), mRTPOut(0), mRadioOut(0), mLast(0), mDeleted(wDeleted) {}
+	~TestPath()
+	{
+		while (unsigned char *frame = mRadioIn.readNoBlock()) delete[] frame;
+		if (mDeleted) (*mDeleted)++;
+	}
+
+	unsigned RTPRead(unsigned char *frame)
+	{
+		if (!mRTPIn) return 0;
+		mRTPIn--;
+		memset(frame,0x55,FrameLength);
+		return FrameLength;
+	}
+
+	void RTPWrite(const unsigned char *frame, unsigned length) { mRTPOut++; mLast = frame[0]; }
+
+	void radioWrite(const unsigned char *frame, unsigned length) { mRadioOut++; }
+
+	unsigned radioRead(unsigned char *frame)
+	{
+		unsigned char *uplink = mRadioIn.readNoBlock();
+		if (!uplink) return 0;
+		memcpy(frame,uplink,FrameLength);
+		delete[] uplink;
+		return FrameLength;
+	}
+
+	void radio(unsigned char first)
+	{
+		unsigned char *frame = new unsigned char[FrameLength];
+		memset(frame,first,FrameLength);
+		mRadioIn.write(frame);
+	}
+};
+
+
+static void testRing()
+{
+	FrameRing ring(3);
+	CHECK(ring.empty());
+	for (unsigned i=0; i<3; i++) {
+		ring.back()[0] = i;
+		ring.push(10+i);
+	}
+	CHECK(ring.full());
+	CHECK(ring.front()[0]==0 && ring.frontLength()==10);
+	ring.pop();
+	ring.back()[0] = 3;
+	ring.push(13);
+	for (unsigned i=1; i<4; i++) {
+		CHECK(ring.front()[0]==i && ring.frontLength()==10+i);
+		ring.pop();
+	}
+	CHECK(ring.empty());
+}
+
+
+static void testRelay()
+{
+	MediaRelay relay;
+	unsigned deleted = 0;
+	TestPath *path = new TestPath(&deleted);
+	int channel;
+	relay.add(&channel,path,2);
+	// Five frames before the relay runs: the latency limit keeps the last two, sent one per pass.
+	for (unsigned i=0; i<5; i++) path->radio(i);
+	relay.start();
+	msleep(100);
+	CHECK(path->mRTPOut==2);
+	CHECK(path->mLast==4);
+	// More than the ring holds, all read in one pass.
+	for (unsigned i=0; i<40; i++) path->radio(i);
+	msleep(100);
+	CHECK(path->mRTPOut==4);
+	CHECK(path->mLast==39);
+	CHECK(path->mRadioIn.size()==0);
+	relay.remove(&channel);
+	CHECK(deleted==1);
+	CHECK(relay.size()==0);
+	relay.stop();
+}
+
+
+
+// The load: numCalls calls, each with a frame each way every 20 ms.
+
+static unsigned gNumCalls;
+static volatile bool gStopping;
+
+// The old traffic channel, with an allocated frame for each uplink frame.
+struct OldCall {
+	InterthreadQueue<unsigned char> mUplink;
+	unsigned mRTPOut;
+	unsigned mRadioOut;
+	Thread mThread;
+	OldCall() : mRTPOut(0), mRadioOut(0) {}
+};
+
+static vector<OldCall*> gOldCalls;
+static MediaRelay *gRelay;
+static vector<TestPath*> gPaths;
+
+// The radio side: an uplink frame for each call every 20 ms.
+static void *radioLoop(void *)
+{
+	double next = timef();
+	while (!gStopping) {
+		next += MediaFramePeriod/1000.0;
+		double now = timef();
+		if (now<next) usleep((unsigned)(1e6*(next-now)));
+		for (unsigned i=0; i<gNumCalls; i++) {
+			if (gRelay) {
+				gPaths[i]->radio(0xaa);
+			} else {
+				unsigned char *frame = new unsigned char[FrameLength];
+				memset(frame,0xaa,FrameLength);
+				gOldCalls[i]->mUplink.write(frame);
+			}
+		}
+	}
+	return NULL;
+}
+
+// updateCallTraffic, as it was, in the call's own thread.
+static void *oldCallLoop(void *arg)
+{
+	OldCall *call = (OldCall*)arg;
+	double next = timef();
+	while (!gStopping) {
+		// The blocking RTP read returns once per 20 ms.
+		next += MediaFramePeriod/1000.0;
+		double now = timef();
+		if (now<next) usleep((unsigned)(1e6*(next-now)));
+		unsigned char rxFrame[160];
+		memset(rxFrame,0x55,FrameLength);
+		call->mRadioOut++;
+		unsigned maxQ = gConfig.getNum("GSM.MaxSpeechLatency");
+		while (call->mUplink.size()>maxQ) delete[] call->mUplink.read();
+		if (unsigned char *txFrame = call->mUplink.readNoBlock()) {
+			call->mRTPOut++;
+			delete[] txFrame;
+		}
+	}
+	return NULL;
+}
+
+
+static void load(bool useRelay, unsigned seconds)
+{
+	gStopping = false;
+	gRelay = NULL;
+	if (useRelay) {
+		gRelay = new MediaRelay;
+		for (unsigned i=0; i<gNumCalls; i++) {
+			gPaths.push_back(new TestPath);
+			gPaths[i]->mRTPIn = 1000000;
+			gRelay->add(gPaths[i],gPaths[i],gConfig.getNum("GSM.MaxSpeechLatency"));
+		}
+		gRelay->start();
+	} else {
+		for (unsigned i=0; i<gNumCalls; i++) {
+			gOldCalls.push_back(new OldCall);
+			gOldCalls[i]->mThread.start(oldCallLoop,gOldCalls[i]);
+		}
+	}
+	Thread radio;
+	radio.start(radioLoop,NULL);
+
+	double cpu = cpuTime();
+	double start = timef();
+	sleep(seconds);
+	double elapsed = timef() - start;
+	cpu = cpuTime() - cpu;
+
+	unsigned up = 0, down = 0;
+	if (useRelay) {
+		for (unsigned i=0; i<gNumCalls; i++) {
+			up += gPaths[i]->mRTPOut;
+			down += gPaths[i]->mRadioOut;
+		}
+	} else {
+		for (unsigned i=0; i<gNumCalls; i++) {
+			up += gOldCalls[i]->mRTPOut;
+			down += gOldCalls[i]->mRadioOut;
+		}
+	}
+	gStopping = true;
+	radio.join();
+
+	printf(" %-6s: %u threads, %.0f frames/sec, %.1f us CPU per call per second",
+		useRelay ? "relay" : "old", useRelay ? 2 : gNumCalls+1,
+		(up+down)/elapsed, 1e6*cpu/elapsed/gNumCalls);
+	if (useRelay) {
+		ostringstream os;
+		gRelay->stats(os);
+		printf("\n         %s",os.str().c_str());
+		// The paths belong to the relay.
+		delete gRelay;
+		gRelay = NULL;
+		gPaths.clear();
+	} else {
+		for (unsigned i=0; i<gNumCalls; i++) {
+			gOldCalls[i]->mThread.join();
+			while (unsigned char *frame = gOldCalls[i]->mUplink.readNoBlock()) delete[] frame;
+			delete gOldCalls[i];
+		}
+		gOldCalls.clear();
+	}
+	printf("\n");
+	// Both ways should keep up with 50 frames a second each way for each call, less start-up.
+	CHECK((up+down)/elapsed > 0.9*100*gNumCalls);
+}
+
+
+int main(int argc, char **argv)
+{
+	gNumCalls = argc>1 ? atoi(argv[1]) : 500;
+	unsigned seconds = argc>2 ? atoi(argv[2]) : 3;
+	gConfig.set("GSM.MaxSpeechLatency","2");
+
+	testRing();
+	testRelay();
+
+	printf("%u calls, %u seconds:\n",gNumCalls,seconds);
+	load(false,seconds);
+	load(true,seconds);
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
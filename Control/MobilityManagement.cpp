@@ -53,7 +53,7 @@ void Control::CMServiceResponder(const GSM::L3CMServiceRequest* cmsrq, UMTS::Log
 	LOG(INFO) << *cmsrq;
 	switch (cmsrq->serviceType().type()) {
 		case GSM::L3CMServiceType::MobileOriginatedCall:
-			MOCStarter(cmsrq,dynamic_cast<UMTS::DTCHLogicalChannel*>(DCCH));
+			MOCStarter(cmsrq,DCCH);
 			break;
 		case GSM::L3CMServiceType::ShortMessage:
 			MOSMSController(cmsrq,dynamic_cast<UMTS::DCCHLogicalChannel*>(DCCH));
@@ -0,0 +1,197 @@
+/**@file DRX paging occasion scheduling for the UMTS PCH, 3GPP 25.304 8.3. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "PagingScheduler.h"
+
+#include <Logger.h>
+
+using namespace std;
+using namespace RRC;
+
+
+static uint64_t IMSIValue(const char* IMSI)
+{
+	// 25.304 8.3: the IMSI is taken as a decimal number; it is at most 15 digits, so it fits.
+	if (!IMSI) return 0;
+	return strtoull(IMSI,NULL,10);
+}
+
+
+PagingScheduler::PagingScheduler(unsigned cycleCoeff, unsigned blockIDs)
+	:mCycle(1<<cycleCoeff),mBlockIDs(blockIDs),
+	mBuckets(mCycle),mWheel(WheelSlots),
+	mStarted(false),mNow(0),mLastFN(0),
+	mPaged(0),mBlocks(0),mFirstPages(0),mFirstPageDelay(0),mExpired(0),mFullBlocks(0)
+{
+	assert(cycleCoeff<=12);		// The cycle must divide the hyperframe.
+	if (mBlockIDs==0 || mBlockIDs>MaxBlockIDs) mBlockIDs = MaxBlockIDs;
+}
+
+
+PagingScheduler::~PagingScheduler()
+{
+	for (EntryMap::iterator itr = mEntries.begin(); itr!=mEntries.end(); ++itr) delete itr->second;
+}
+
+
+unsigned PagingScheduler::occasion(const char* IMSI) const
+{
+	// K, the number of SCCPCHs with a PCH, is 1.
+	return IMSIValue(IMSI) % mCycle;
+}
+
+
+void PagingScheduler::schedule(Entry *entry, unsigned lifeFrames)
+{
+	if (lifeFrames==0) lifeFrames = 1;
+	entry->mExpiration = mNow + lifeFrames;
+	EntryList &slot = mWheel[entry->mExpiration % WheelSlots];
+	entry->mWheelPos = slot.insert(slot.end(),entry);
+}
+
+
+void PagingScheduler::unlink(Entry *entry)
+{
+	mBuckets[entry->mOccasion].erase(entry->mBucketPos);
+	mWheel[entry->mExpiration % WheelSlots].erase(entry->mWheelPos);
+	mEntries.erase(entry->mID);
+}
+
+
+bool PagingScheduler::add(const GSM::L3MobileIdentity& ID, const char* IMSI, UMTS::ChannelTypeL3 type,
+	unsigned transactionID, unsigned lifeFrames)
+{
+	EntryMap::iterator itr = mEntries.find(ID);
+	if (itr!=mEntries.end()) {
+		// Already paging; just renew.
+		Entry *entry = itr->second;
+		mWheel[entry->mExpiration % WheelSlots].erase(entry->mWheelPos);
+		schedule(entry,lifeFrames);
+		return false;
+	}
+	Entry *entry = new Entry;
+	entry->mID = ID;
+	entry->mType = type;
+	entry->mTransactionID = transactionID;
+	entry->mOccasion = occasion(IMSI);
+	entry->mAdded = mNow;
+	entry->mPaged = false;
+	EntryList &bucket = mBuckets[entry->mOccasion];
+	entry->mBucketPos = bucket.insert(bucket.end(),entry);
+	schedule(entry,lifeFrames);
+	mEntries[ID] = entry;
+	return true;
+}
+
+
+unsigned PagingScheduler::remove(const GSM::L3MobileIdentity& ID)
+{
+	EntryMap::iterator itr = mEntries.find(ID);
+	if (itr==mEntries.end()) return 0;
+	Entry *entry = itr->second;
+	unsigned transactionID = entry->mTransactionID;
+	unlink(entry);
+	delete entry;
+	return transactionID;
+}
+
+
+void PagingScheduler::expire(vector<unsigned>& expired)
+{
+	EntryList &slot = mWheel[mNow % WheelSlots];
+	EntryList::iterator itr = slot.begin();
+	while (itr!=slot.end()) {
+		Entry *entry = *itr;
+		// Later laps of the wheel stay for now.
+		if (entry->mExpiration>mNow) { ++itr; continue; }
+		++itr;
+		LOG(INFO) << "expiring " << entry->mID;
+		expired.push_back(entry->mTransactionID);
+		unlink(entry);
+		delete entry;
+		mExpired++;
+	}
+}
+
+
+unsigned PagingScheduler::page(unsigned FN, PagingBlock& block, vector<unsigned>& expired)
+{
+	FN %= UMTS::gHyperframe;
+	if (!mStarted) {
+		mStarted = true;
+		mLastFN = FN;
+		expire(expired);
+	}
+	unsigned step = (FN + UMTS::gHyperframe - mLastFN) % UMTS::gHyperframe;
+	for (unsigned i=0; i<step; i++) {
+		mNow++;
+		expire(expired);
+	}
+	mLastFN = FN;
+
+	block.clear();
+	block.mFN = FN;
+	EntryList &bucket = mBuckets[FN % mCycle];
+	EntryList::iterator itr = bucket.begin();
+	while (itr!=bucket.end() && block.mIDs.size()<mBlockIDs) {
+		Entry *entry = *itr++;
+		block.mIDs.push_back(entry->mID);
+		if (!entry->mPaged) {
+			entry->mPaged = true;
+			mFirstPages++;
+			mFirstPageDelay += mNow - entry->mAdded;
+		}
+	}
+	if (itr!=bucket.end()) {
+		// Full; the ones paged now go to the back of the line.
+		bucket.splice(bucket.end(),bucket,bucket.begin(),itr);
+		mFullBlocks++;
+	}
+	if (block.mIDs.size()) mBlocks++;
+	mPaged += block.mIDs.size();
+	return block.mIDs.size();
+}
+
+
+double PagingScheduler::meanFirstPageDelay() const
+{
+	return mFirstPages ? (double)mFirstPageDelay/mFirstPages : 0;
+}
+
+
+void PagingScheduler::stats(ostream& os) const
+{
+	os << mEntries.size() << " pending, cycle " << mCycle << " frames, " << mPaged << " pages in "
+		<< mBlocks << " blocks, " << mFullBlocks << " full, " << mExpired << " expired, "
+		<< "first page after " << meanFirstPageDelay() << " frames";
+}
+
+
+void PagingScheduler::dump(ostream& os) const
+{
+	for (EntryMap::const_iterator itr = mEntries.begin(); itr!=mEntries.end(); ++itr) {
+		const Entry *entry = itr->second;
+		os << entry->mID << " " << entry->mType << " occasion=" << entry->mOccasion
+			<< " expires=" << (int64_t)(entry->mExpiration - mNow)
+			<< (entry->mPaged ? " paged" : "") << endl;
+	}
+}
+
+
+// vim: ts=4 sw=4
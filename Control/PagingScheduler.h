@@ -0,0 +1,169 @@
+/**@file DRX paging occasion scheduling for the UMTS PCH, 3GPP 25.304 8.3. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef PAGINGSCHEDULER_H
+#define PAGINGSCHEDULER_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <ostream>
+
+#include <GSML3CommonElements.h>
+#include <UMTSCommon.h>
+
+
+namespace RRC {
+
+
+/** What goes out in one paging occasion: a PCH block. */
+class PagingBlock {
+
+	public:
+
+	unsigned mFN;								///< SFN of the paging occasion
+	std::vector<GSM::L3MobileIdentity> mIDs;	///< the identities for the PCH block
+
+	PagingBlock() :mFN(0) {}
+
+	void clear() { mIDs.clear(); }
+};
+
+
+/**
+	Schedules pages on the DRX paging occasions of idle mode UEs, 25.304 8.3.
+	A UE listens only on the paging occasions whose SFN mod the DRX cycle length matches its IMSI,
+	so the pending pages are kept in one bucket per occasion and each radio frame looks at
+	just its own bucket.
+	Each occasion packs up to a block's worth of identities; a bucket with more than that
+	rotates, so the ones left out go first in the next cycle.
+	Entries are paged every DRX cycle until they are removed or their lifetime runs out;
+	lifetimes run on a timer wheel of frames, so expiry looks at one wheel slot per frame
+	rather than at the whole list.
+	Time is counted in radio frames, from the SFNs passed to page().
+	Not locked; the Pager locks around it.
+*/
+class PagingScheduler {
+
+	public:
+
+	/** The most identities a PagingType1 message can carry, maxPage1 in 25.331. */
+	static const unsigned MaxBlockIDs = 8;
+
+	private:
+
+	static const unsigned WheelSlots = 1024;		///< frames, about 10 seconds
+
+	struct Entry;
+	typedef std::list<Entry*> EntryList;
+
+	struct Entry {
+		GSM::L3MobileIdentity mID;
+		UMTS::ChannelTypeL3 mType;
+		unsigned mTransactionID;
+		unsigned mOccasion;				///< SFN mod DRX cycle length
+		uint64_t mExpiration;			///< frame count
+		uint64_t mAdded;				///< frame count, for the latency statistics
+		bool mPaged;					///< paged at least once
+		EntryList::iterator mBucketPos;
+		EntryList::iterator mWheelPos;
+	};
+
+	typedef std::map<GSM::L3MobileIdentity,Entry*> EntryMap;
+
+	unsigned mCycle;					///< DRX cycle length, frames
+	unsigned mBlockIDs;					///< identities per PCH block
+
+	EntryMap mEntries;
+	std::vector<EntryList> mBuckets;	///< by paging occasion
+	std::vector<EntryList> mWheel;		///< by expiration frame mod WheelSlots
+
+	bool mStarted;						///< page() has been called
+	uint64_t mNow;						///< frames since the first page()
+	unsigned mLastFN;
+
+	// Statistics.
+	uint64_t mPaged;					///< identities sent
+	uint64_t mBlocks;					///< occasions with something to send
+	uint64_t mFirstPages;				///< entries paged for the first time
+	uint64_t mFirstPageDelay;			///< total frames from add to first page
+	uint64_t mExpired;
+	uint64_t mFullBlocks;				///< occasions with more to send than fit
+
+	void unlink(Entry*);
+	void schedule(Entry*, unsigned lifeFrames);
+
+	/** Expire the entries whose time is up in the current frame. */
+	void expire(std::vector<unsigned>& expired);
+
+	public:
+
+	/**
+		@param cycleCoeff The CN domain DRX cycle length coefficient k; the cycle is 2^k frames.
+		@param blockIDs The identities that fit in one PCH block, at most MaxBlockIDs.
+	*/
+	PagingScheduler(unsigned cycleCoeff, unsigned blockIDs=MaxBlockIDs);
+
+	~PagingScheduler();
+
+	unsigned cycle() const { return mCycle; }
+
+	/** The paging occasion of an IMSI: its SFN mod the DRX cycle length, for one SCCPCH with a PCH. */
+	unsigned occasion(const char* IMSI) const;
+
+	/**
+		Add an ID for paging, or renew its lifetime if it is already there.
+		@param ID The ID to page.
+		@param IMSI The IMSI of the UE, which sets its paging occasion; 0 if unknown.
+		@param lifeFrames How long to keep paging, in frames.
+		@return True if the ID is new.
+	*/
+	bool add(const GSM::L3MobileIdentity& ID, const char* IMSI, UMTS::ChannelTypeL3 type,
+		unsigned transactionID, unsigned lifeFrames);
+
+	/**
+		Stop paging an ID.
+		@return The transaction ID of the entry, or 0 if there was none.
+	*/
+	unsigned remove(const GSM::L3MobileIdentity& ID);
+
+	/**
+		Move time up to a frame, expire entries on the way and fill the block for that frame's occasion.
+		Frames skipped since the last call expire their entries but their occasions are not paged;
+		those UEs have stopped listening, and are paged again next cycle.
+		@param FN The SFN, 0..4095.
+		@param block The block to fill; cleared first.
+		@param expired Gets the transaction IDs of the entries that expired.
+		@return The number of identities in the block.
+	*/
+	unsigned page(unsigned FN, PagingBlock& block, std::vector<unsigned>& expired);
+
+	size_t size() const { return mEntries.size(); }
+
+	/** The mean frames from add to first page, over the entries paged so far. */
+	double meanFirstPageDelay() const;
+
+	void stats(std::ostream&) const;
+
+	void dump(std::ostream&) const;
+};
+
+
+}	// namespace RRC
+
+#endif
+// vim: ts=4 sw=4
@@ -0,0 +1,306 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the PagingScheduler, then simulate a cell with thousands of pages pending.
+// The simulation runs frame by frame: each frame pages its occasion, each UE answers a while
+// after its first page and is removed, and a new page arrives in its place, so the pending count
+// stays put.  It reports the scheduler's pages per second of CPU time, the pages per second of
+// air time the PCH carries, and the paging latency from add to first page.
+// The same load also runs through a plain list walked every frame, which is what the old
+// pageAll did, for comparison.
+// Build with PagingScheduler.cpp, GSML3CommonElements.cpp and CommonLibs.
+// Usage: PagingSchedulerTest [pending pages] [cycles]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "PagingScheduler.h"
+
+using namespace std;
+using namespace RRC;
+
+ConfigurationTable gConfig;
+
+
+static void testMath()
+{
+	PagingScheduler sched(6);
+	CHECK(sched.cycle()==64);
+	CHECK(sched.occasion("001010123456789")==21);
+	CHECK(sched.occasion("310260000000001")==1);
+	CHECK(sched.occasion(NULL)==0);
+	PagingScheduler long8(8);
+	CHECK(long8.occasion("310260000000001")==1);
+}
+
+
+static void testScheduler()
+{
+	PagingScheduler sched(6);
+	PagingBlock block;
+	vector<unsigned> expired;
+	GSM::L3MobileIdentity a("001010123456789");		// occasion 21
+	GSM::L3MobileIdentity b("310260000000001");		// occasion 1
+	CHECK(sched.add(a,a.digits(),UMTS::DCCHType,11,1000));
+	CHECK(sched.add(b,b.digits(),UMTS::DCCHType,12,1000));
+	CHECK(!sched.add(a,a.digits(),UMTS::DCCHType,11,1000));
+	CHECK(sched.size()==2);
+
+	// Each only on its own occasion.
+	unsigned pagedA = 0, pagedB = 0;
+	for (unsigned fn=0; fn<128; fn++) {
+		sched.page(fn,block,expired);
+		for (unsigned i=0; i<block.mIDs.size(); i++) {
+			if (block.mIDs[i]==a) { pagedA++; CHECK(fn%64==21); }
+			if (block.mIDs[i]==b) { pagedB++; CHECK(fn%64==1); }
+		}
+	}
+	CHECK(pagedA==2 && pagedB==2);
+	CHECK(sched.remove(b)==12);
+	CHECK(sched.remove(b)==0);
+
+	// Expiry, across the SFN wrap and the wheel laps: a is at frame 127 now, so renew it to frame 4127.
+	sched.add(a,a.digits(),UMTS::DCCHType,11,4000);
+	unsigned fn = 127;
+	for (unsigned i=0; i<3999; i++) {
+		fn = (fn+1)%4096;
+		sched.page(fn,block,expired);
+	}
+	CHECK(expired.size()==0 && sched.size()==1);
+	sched.page((fn+1)%4096,block,expired);
+	CHECK(expired.size()==1 && expired[0]==11 && sched.size()==0);
+
+	// Skipped frames still expire.
+	expired.clear();
+	sched.add(b,b.digits(),UMTS::DCCHType,12,10);
+	sched.page((fn+50)%4096,block,expired);
+	CHECK(expired.size()==1 && expired[0]==12);
+
+	// A crowded occasion rotates, eight at a time.
+	PagingScheduler crowded(6);
+	char IMSI[20];
+	for (unsigned i=0; i<20; i++) {
+		sprintf(IMSI,"0010100000%05u",i*64+5);
+		crowded.add(GSM::L3MobileIdentity(IMSI),IMSI,UMTS::DCCHType,i+1,100000);
+	}
+	vector<unsigned> counts(20,0);
+	for (unsigned fn=0; fn<64*5; fn++) {
+		crowded.page(fn,block,expired);
+		CHECK(block.mIDs.size()==0 || fn%64==5);
+		CHECK(block.mIDs.size()<=PagingScheduler::MaxBlockIDs);
+		for (unsigned i=0; i<block.mIDs.size(); i++) counts[(atoi(block.mIDs[i].digits()+10)-5)/64]++;
+	}
+	// 40 pages over 5 cycles, two each.
+	for (unsigned i=0; i<20; i++) CHECK(counts[i]==2);
+}
+
+
+
+// The simulation.
+
+static const unsigned LifeFrames = 3200;			// SIP Timer B, 32 s
+static const unsigned ResponseFrames = 30;			// from first page to the paging response
+
+static void randomIMSI(char *IMSI)
+{
+	sprintf(IMSI,"00101%05u%05u",(unsigned)random()%100000,(unsigned)random()%100000);
+}
+
+/** What the simulation needs from a pager. */
+struct SimPager {
+	virtual ~SimPager() {}
+	virtual void add(const char *IMSI, unsigned transactionID) = 0;
+	virtual void remove(const char *IMSI) = 0;
+	/** Page one frame, and return the IDs paged. */
+	virtual const vector<GSM::L3MobileIdentity>& page(unsigned fn) = 0;
+};
+
+struct SchedulerPager : public SimPager {
+	PagingScheduler mScheduler;
+	PagingBlock mBlock;
+	vector<unsigned> mExpired;
+	SchedulerPager() :mScheduler(6) {}
+	void add(const char *IMSI, unsigned transactionID)
+		{ mScheduler.add(GSM::L3MobileIdentity(IMSI),IMSI,UMTS::DCCHType,transactionID,LifeFrames); }
+	void remove(const char *IMSI) { mScheduler.remove(GSM::L3MobileIdentity(IMSI)); }
+	const vector<GSM::L3MobileIdentity>& page(unsigned fn)
+	{
+		mExpired.clear();
+		mScheduler.page(fn,mBlock,mExpired);
+		return mBlock.mIDs;
+	}
+};
+
+/** A list walked every frame, for expiry and for the IDs on this occasion. */
+struct ListPager : public SimPager {
+	struct Entry {
+		GSM::L3MobileIdentity mID;
+		unsigned mOccasion;
+		unsigned mExpiration;
+	};
+	list<Entry> mList;
+	vector<GSM::L3MobileIdentity> mIDs;
+	unsigned mNow;
+	bool mStarted;
+	ListPager() :mNow(0),mStarted(false) {}
+	void add(const char *IMSI, unsigned)
+	{
+		GSM::L3MobileIdentity ID(IMSI);
+		for (list<Entry>::iterator itr = mList.begin(); itr!=mList.end(); ++itr) {
+			if (itr->mID==ID) { itr->mExpiration = mNow+LifeFrames; return; }
+		}
+		Entry entry;
+		entry.mID = ID;
+		entry.mOccasion = strtoull(IMSI,NULL,10)%64;
+		entry.mExpiration = mNow+LifeFrames;
+		mList.push_back(entry);
+	}
+	void remove(const char *IMSI)
+	{
+		GSM::L3MobileIdentity ID(IMSI);
+		for (list<Entry>::iterator itr = mList.begin(); itr!=mList.end(); ++itr) {
+			if (itr->mID==ID) { mList.erase(itr); return; }
+		}
+	}
+	const vector<GSM::L3MobileIdentity>& page(unsigned fn)
+	{
+		if (mStarted) mNow++;
+		mStarted = true;
+		mIDs.clear();
+		list<Entry> paged;
+		list<Entry>::iterator itr = mList.begin();
+		while (itr!=mList.end()) {
+			if (itr->mExpiration<=mNow) { itr = mList.erase(itr); continue; }
+			if (itr->mOccasion==fn%64 && mIDs.size()<PagingScheduler::MaxBlockIDs) {
+				mIDs.push_back(itr->mID);
+				paged.splice(paged.end(),mList,itr++);
+				continue;
+			}
+			++itr;
+		}
+		// Rotate, as the scheduler does.
+		mList.splice(mList.end(),paged);
+		return mIDs;
+	}
+};
+
+
+struct SimResult {
+	double mSeconds;				///< CPU time
+	unsigned long mPages;
+	unsigned long mAnswered;
+	double mLatency;				///< mean frames from add to first page
+};
+
+struct SimPage {
+	string mIMSI;
+	unsigned mAdded;
+	int mAnswer;				///< frame of the answer, or -1 if not paged yet
+};
+
+static SimResult simulate(SimPager& pager, unsigned pending, unsigned frames)
+{
+	srandom(1);
+	// By IMSI, for the answers; the IMSIs are random enough to go straight in a map.
+	map<string,SimPage> pages;
+	// Answers due, by frame.
+	vector<vector<string> > answers(ResponseFrames+1);
+	char IMSI[20];
+	unsigned transactionID = 1;
+	for (unsigned i=0; i<pending; i++) {
+		randomIMSI(IMSI);
+		SimPage page = { IMSI, 0, -1 };
+		pages[IMSI] = page;
+		pager.add(IMSI,transactionID++);
+	}
+
+	SimResult result = { 0, 0, 0, 0 };
+	unsigned long latency = 0;
+	double start = timef();
+	for (unsigned frame=0; frame<frames; frame++) {
+		unsigned fn = frame%4096;
+		const vector<GSM::L3MobileIdentity>& paged = pager.page(fn);
+		result.mPages += paged.size();
+		for (unsigned i=0; i<paged.size(); i++) {
+			map<string,SimPage>::iterator itr = pages.find(paged[i].digits());
+			if (itr==pages.end() || itr->second.mAnswer>=0) continue;
+			itr->second.mAnswer = frame+ResponseFrames;
+			latency += frame - itr->second.mAdded;
+			answers[(frame+ResponseFrames)%answers.size()].push_back(itr->first);
+		}
+		// The answers due now end their pages, and new ones take their place.
+		vector<string> &due = answers[frame%answers.size()];
+		for (unsigned i=0; i<due.size(); i++) {
+			pager.remove(due[i].c_str());
+			pages.erase(due[i]);
+			result.mAnswered++;
+			randomIMSI(IMSI);
+			SimPage page = { IMSI, frame, -1 };
+			pages[IMSI] = page;
+			pager.add(IMSI,transactionID++);
+		}
+		due.clear();
+	}
+	result.mSeconds = timef() - start;
+	result.mLatency = result.mAnswered ? (double)latency/result.mAnswered : 0;
+	return result;
+}
+
+static void report(const char *name, const SimResult& r, unsigned frames)
+{
+	printf(" %-9s: %9.0f pages/sec CPU, %5.0f pages/sec on air, %7.0f ms mean latency, %lu answered\n",
+		name, r.mPages/r.mSeconds, r.mPages/(frames*0.01), r.mLatency*10, r.mAnswered);
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned pending = argc>1 ? atoi(argv[1]) : 0;
+	unsigned cycles = argc>2 ? atoi(argv[2]) : 100;
+
+	testMath();
+	testScheduler();
+
+	vector<unsigned> loads;
+	if (pending) loads.push_back(pending);
+	else { loads.push_back(500); loads.push_back(2000); loads.push_back(10000); }
+	unsigned frames = cycles*64;
+	for (unsigned i=0; i<loads.size(); i++) {
+		printf("%u pending pages, DRX cycle 640 ms, %u frames:\n",loads[i],frames);
+		SchedulerPager scheduler;
+		SimResult r = simulate(scheduler,loads[i],frames);
+		report("scheduler",r,frames);
+		ostringstream os;
+		scheduler.mScheduler.stats(os);
+		printf("  %s\n",os.str().c_str());
+		CHECK(r.mAnswered>0);
+		ListPager list;
+		SimResult l = simulate(list,loads[i],frames);
+		report("list",l,frames);
+		// Same pages, the same way.
+		CHECK(l.mPages==r.mPages && l.mAnswered==r.mAnswered);
+	}
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
+
+// vim: ts=4 sw=4
@@ -18,15 +18,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <list>
+#include <string.h>
 
 #include "RadioResource.h"
 
 #include <UMTSCommon.h>
 #include <UMTSLogicalChannel.h>
 #include <UMTSConfig.h>
+#include <URRCMessages.h>
 
 #include "TransactionTable.h"
+#include "TMSITable.h"
+
+#include <Globals.h>
 
 #include <Logger.h>
 #undef WARNING
@@ -45,23 +49,30 @@ void Pager::addID(const GSM::L3MobileIdentity& newID, UMTS::ChannelTypeL3 chanTy
 {
 	transaction.GSMState(GSM::Paging);
 	transaction.setTimer("3113",wLife);
+	// The IMSI sets the paging occasion, so look it up for a TMSI.
+	// If it is not known the UE gets occasion 0, and may not hear the page.
+	char *IMSI = NULL;
+	switch (newID.type()) {
+		case GSM::IMSIType: IMSI = strdup(newID.digits()); break;
+		case GSM::TMSIType: IMSI = gTMSITable.IMSI(newID.TMSI()); break;
+		default: break;
+	}
+	if (!IMSI) LOG(NOTICE) << "no IMSI for " << newID << ", using paging occasion 0";
 	// Add a mobile ID to the paging list for a given lifetime.
 	ScopedLock lock(mLock);
-	// If this ID is already in the list, just reset its timer.
-	// Uhg, another linear time search.
-	// This would be faster if the paging list were ordered by ID.
-	// But the list should usually be short, so it may not be worth the effort.
-	for (PagingEntryList::iterator lp = mPageIDs.begin(); lp != mPageIDs.end(); ++lp) {
-		if (lp->ID()==newID) {
-			LOG(DEBUG) << newID << " already in table";
-			lp->renew(wLife);
-			mPageSignal.signal();
-			return;
-		}
+	if (!mScheduler) {
+		LOG(WARNING) << "pager not started, not paging " << newID;
+		free(IMSI);
+		return;
 	}
-	// If this ID is new, put it in the list.
-	mPageIDs.push_back(PagingEntry(newID,chanType,transaction.ID(),wLife));
-	LOG(INFO) << newID << " added to table";
+	// If this ID is already in the list, this just resets its timer.
+	// The lifetime is counted in radio frames.
+	if (mScheduler->add(newID,IMSI,chanType,transaction.ID(),wLife/10)) {
+		LOG(INFO) << newID << " added to table";
+	} else {
+		LOG(DEBUG) << newID << " already in table";
+	}
+	free(IMSI);
 	mPageSignal.signal();
 }
 
@@ -71,62 +82,53 @@ unsigned Pager::removeID(const GSM::L3MobileIdentity& delID)
 	// Return the associated transaction ID, or 0 if none found.
 	LOG(INFO) << delID;
 	ScopedLock lock(mLock);
-	for (PagingEntryList::iterator lp = mPageIDs.begin(); lp != mPageIDs.end(); ++lp) {
-		if (lp->ID()==delID) {
-			unsigned retVal = lp->transactionID();
-			mPageIDs.erase(lp);
-			return retVal;
-		}
-	}
-	return 0;
+	if (!mScheduler) return 0;
+	return mScheduler->remove(delID);
 }
 
 
 
-unsigned Pager::pageAll()
+unsigned Pager::pageFrame(unsigned FN)
 {
-	// Traverse the full list and page all IDs.
+	// Page the IDs whose paging occasion is this frame.
 	// Remove expired IDs.
 	// Return the number of IDs paged.
-	// This is a linear time operation.
-
-	ScopedLock lock(mLock);
-
-	// Clear expired entries.
-	PagingEntryList::iterator lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		if (!lp->expired()) ++lp;
-		else {
-			LOG(INFO) << "erasing " << lp->ID();
-			// Non-responsive, dead transaction?
-			gTransactionTable.removePaging(lp->transactionID());
-			// remove from the list
-			lp=mPageIDs.erase(lp);
-		}
-	}
-
-	LOG(INFO) << "paging " << mPageIDs.size() << " mobile(s)";
-
-	// Page remaining entries, two at a time if possible.
-	// These PCH send operations are non-blocking.
-	lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		// TODO UMTS -- This needs a rewrite for UMTS.
-		assert(0);
+	PagingBlock block;
+	vector<unsigned> expired;
+	mLock.lock();
+	unsigned count = mScheduler->page(FN,block,expired);
+	mLock.unlock();
+
+	// Non-responsive, dead transactions?
+	for (unsigned i=0; i<expired.size(); i++) {
+		if (expired[i]) gTransactionTable.removePaging(expired[i]);
 	}
 
-	return mPageIDs.size();
+	if (!count) return 0;
+	LOG(INFO) << "paging " << count << " mobile(s) in frame " << FN;
+	ByteVector pch;
+	if (!UMTS::encodePagingType1(block.mIDs,pch)) return 0;
+	// TODO UMTS -- The PCH has no FEC yet (see mPchFec in UMTSConfig), and there is no PICH,
+	// so the block goes nowhere.
+	LOG(DEBUG) << "PCH " << pch;
+	return count;
 }
 
 size_t Pager::pagingEntryListSize()
 {
 	ScopedLock lock(mLock);
-	return mPageIDs.size();
+	return mScheduler ? mScheduler->size() : 0;
 }
 
 void Pager::start()
 {
 	if (mRunning) return;
+	mLock.lock();
+	if (!mScheduler) {
+		// The DRX cycle length advertised in SIB1 for the CS domain.
+		mScheduler = new PagingScheduler(gConfig.getNum("UMTS.CN-DSI.CycleLengthCoeff"));
+	}
+	mLock.unlock();
 	mRunning=true;
 	mPagingThread.start((void* (*)(void*))PagerServiceLoopAdapter, (void*)this);
 }
@@ -141,22 +143,21 @@ void* RRC::PagerServiceLoopAdapter(Pager *pager)
 
 void Pager::serviceLoop()
 {
+	UMTS::Time next = gNodeB.clock().get();
 	while (mRunning) {
 
-		LOG(DEBUG) << "Pager blocking for signal";
 		mLock.lock();
-		while (mPageIDs.size()==0) mPageSignal.wait(mLock);
+		if (mScheduler->size()==0) {
+			LOG(DEBUG) << "Pager blocking for signal";
+			while (mScheduler->size()==0) mPageSignal.wait(mLock);
+			next = gNodeB.clock().get();
+		}
 		mLock.unlock();
 
-		// page everything
-		pageAll();
-
-		// Wait for pending activity to clear the channel.
-		// TODO UMTS -- Needs to be written for UMTS.
-		// This wait is what causes PCH to have lower priority than AGCH.
-		//unsigned load = gNodeB.getPCH()->load();
-		//LOG(DEBUG) << "Pager waiting for " << load << " multiframes";
-		//if (load) usleep(UMTS::gFrameMicroseconds*load);
+		// One paging occasion per radio frame.
+		++next;
+		gNodeB.clock().wait(next);
+		pageFrame(next.FN());
 	}
 }
 
@@ -165,11 +166,10 @@ void Pager::serviceLoop()
 void Pager::dump(ostream& os) const
 {
 	ScopedLock lock(mLock);
-	PagingEntryList::const_iterator lp = mPageIDs.begin();
-	while (lp != mPageIDs.end()) {
-		os << lp->ID() << " " << lp->type() << " " << lp->expired() << endl;
-		++lp;
-	}
+	if (!mScheduler) return;
+	mScheduler->dump(os);
+	mScheduler->stats(os);
+	os << endl;
 }
 
 
@@ -19,11 +19,11 @@
 #ifndef RADIORESOURCE_H
 #define RADIORESOURCE_H
 
-#include <list>
-
 #include <GSML3CommonElements.h>
 #include <UMTSCommon.h>
 
+#include "PagingScheduler.h"
+
 
 
 namespace GSM {
@@ -100,59 +100,18 @@ void* AccessGrantServiceLoop(void*);
 /**@ Paging mechanisms */
 //@{
 
-/** An entry in the paging list. */
-class PagingEntry {
-
-	private:
-
-	GSM::L3MobileIdentity mID;		///< The mobile ID.
-	UMTS::ChannelTypeL3 mType;		///< The needed channel type.
-	unsigned mTransactionID;		///< The associated transaction ID.
-	Timeval mExpiration;			///< The expiration time for this entry.
-
-	public:
-
-	/**
-		Create a new entry, with current timestamp.
-		@param wID The ID to be paged.
-		@param wLife The number of milliseconds to keep paging.
-	*/
-	PagingEntry(const GSM::L3MobileIdentity& wID, UMTS::ChannelTypeL3 wType,
-			unsigned wTransactionID, unsigned wLife)
-		:mID(wID),mType(wType),mTransactionID(wTransactionID),mExpiration(wLife)
-	{}
-
-	/** Access the ID. */
-	const GSM::L3MobileIdentity& ID() const { return mID; }
-
-	/** Access the channel type needed. */
-	UMTS::ChannelTypeL3 type() const { return mType; }
-
-	unsigned transactionID() const { return mTransactionID; }
-
-	/** Renew the timer. */
-	void renew(unsigned wLife) { mExpiration = Timeval(wLife); }
-
-	/** Returns true if the entry is expired. */
-	bool expired() const { return mExpiration.passed(); }
-
-};
-
-typedef std::list<PagingEntry> PagingEntryList;
-
-
 /**
-	The pager is a global object that generates paging messages on the CCCH.
+	The pager is a global object that pages idle mode UEs on the PCH.
 	To page a mobile, add the mobile ID to the pager.
 	The entry will be deleted automatically when it expires.
-	All pager operations are linear time.
-	Not much point in optimizing since the main operation is inherently linear.
+	The PagingScheduler decides what goes out on each paging occasion; the paging thread
+	runs it once per radio frame while there is anything to page.
 */
 class Pager {
 
 	private:
 
-	PagingEntryList mPageIDs;				///< List of ID's to be paged.
+	PagingScheduler *mScheduler;			///< made by start(), from the configuration
 	mutable Mutex mLock;					///< Lock for thread-safe access.
 	Signal mPageSignal;						///< signal to wake the paging loop
 	Thread mPagingThread;					///< Thread for the paging loop.
@@ -161,10 +120,10 @@ class Pager {
 	public:
 
 	Pager()
-		:mRunning(false)
+		:mScheduler(NULL),mRunning(false)
 	{}
 
-	/** Set the output FIFO and start the paging loop. */
+	/** Set up the scheduler and start the paging loop. */
 	void start();
 
 	/**
@@ -191,12 +150,12 @@ class Pager {
 	private:
 
 	/**
-		Traverse the paging list, paging all IDs.
+		Page the occasion of one radio frame and drop the expired entries.
 		@return Number of IDs paged.
 	*/
-	unsigned pageAll();
+	unsigned pageFrame(unsigned FN);
 
-	/** A loop that repeatedly calls pageAll. */
+	/** A loop that calls pageFrame for every radio frame. */
 	void serviceLoop();
 
 	/** C-style adapter. */
@@ -204,7 +163,7 @@ class Pager {
 
 public:
 
-	/** return size of PagingEntryList */
+	/** return the number of IDs being paged */
 	size_t pagingEntryListSize();
 
 	/** Dump the paging list to an ostream. */
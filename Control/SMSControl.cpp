@@ -39,6 +39,7 @@
 #include "SMSControl.h"
 #include "ControlCommon.h"
 #include "TransactionTable.h"
+#include "ControlEngine.h"
 #include <Regexp.h>
 
 #include <UMTSLogicalChannel.h>
@@ -59,6 +60,26 @@ using namespace SIP;
 #include <Logger.h>
 #undef WARNING
 
+/**
+	Check an L3Frame read from SAP3.
+	Delete it and throw exception if it is not the expected primitive or not SMS.
+*/
+static void checkFrameSMS(UMTS::DCCHLogicalChannel *LCH, GSM::L3Frame *frame, GSM::Primitive primitive=GSM::DATA)
+{
+	LOG(DEBUG) << "getFrameSMS on " << *LCH << " in frame " << *frame;
+	if (frame->primitive() != primitive) {
+		LOG(NOTICE) << "unexpected primitive on " << *LCH << ", expecting " << primitive << ", got " << *frame;
+		delete frame;
+		throw UnexpectedPrimitive();
+	}
+	if ((frame->primitive() == GSM::DATA) && (frame->PD() != GSM::L3SMSPD)) {
+		LOG(NOTICE) << "unexpected (non-SMS) protocol on " << *LCH << " in frame " << *frame;
+		delete frame;
+		throw UnexpectedMessage();
+	}
+}
+
+
 /**
 	Read an L3Frame from SAP3.
 	Throw exception on failure.  Will NOT return a NULL pointer.
@@ -71,20 +92,17 @@ GSM::L3Frame* getFrameSMS(UMTS::DCCHLogicalChannel *LCH, GSM::Primitive primitiv
 		LOG(NOTICE) << "channel read time out on " << *LCH << " SAP3";
 		throw ChannelReadTimeout();
 	}
-	LOG(DEBUG) << "getFrameSMS on " << *LCH << " in frame " << *retVal;
-	if (retVal->primitive() != primitive) {
-		LOG(NOTICE) << "unexpected primitive on " << *LCH << ", expecting " << primitive << ", got " << *retVal;
-		throw UnexpectedPrimitive();
-	}
-	if ((retVal->primitive() == GSM::DATA) && (retVal->PD() != GSM::L3SMSPD)) {
-		LOG(NOTICE) << "unexpected (non-SMS) protocol on " << *LCH << " in frame " << *retVal;
-		throw UnexpectedMessage();
-	}
+	checkFrameSMS(LCH,retVal,primitive);
 	return retVal;
 }
 
 
-bool sendSIP(TransactionEntry *transaction, const char* address, const char* body, const char* contentType)
+/**
+	Send the message to the SMS server.
+	@param wait If false, return once the MESSAGE is sent and leave the response to the caller.
+	@return true for OK or ACCEPTED, false otherwise, or true if not waiting.
+*/
+bool sendSIP(TransactionEntry *transaction, const char* address, const char* body, const char* contentType, bool wait=true)
 {
 	// Steps:
 	// 1 -- Complete transaction record.
@@ -101,9 +119,10 @@ bool sendSIP(TransactionEntry *transaction, const char* address, const char* bod
 
 	// Step 2 -- Send the message to the server.
 	transaction->MOSMSSendMESSAGE(address,gConfig.getStr("SIP.Local.IP").c_str(),contentType);
+	if (!wait) return true;
 
 	// Step 3 -- Wait for OK or ACCEPTED.
-	SIPState state = transaction->MOSMSWaitForSubmit();
+	SIPState state = transaction->MOSMSWaitForSubmit(gConfig.getNum("SIP.Timer.A"));
 
 	// Step 4 -- Done
 	return state==SIP::Cleared;
@@ -113,9 +132,10 @@ bool sendSIP(TransactionEntry *transaction, const char* address, const char* bod
 	Process the RPDU.
 	@param mobileID The sender's IMSI.
 	@param RPDU The RPDU to process.
+	@param wait For RP-DATA, wait for the SMS server, as in sendSIP.
 	@return true if successful.
 */
-bool handleRPDU(TransactionEntry *transaction, const RLFrame& RPDU)
+bool handleRPDU(TransactionEntry *transaction, const RLFrame& RPDU, bool wait=true)
 {
 	LOG(DEBUG) << "SMS: handleRPDU MTI=" << RPDU.MTI();
 	switch ((RPMessage::MessageType)RPDU.MTI()) {
@@ -148,7 +168,7 @@ bool handleRPDU(TransactionEntry *transaction, const RLFrame& RPDU)
 
 				address = submit.DA().digits();
 			}
-			return sendSIP(transaction, address, body.str().data(),contentType.c_str());
+			return sendSIP(transaction, address, body.str().data(),contentType.c_str(),wait);
 		}
 		case RPMessage::Ack:
 		case RPMessage::SMMA:
@@ -162,73 +182,345 @@ bool handleRPDU(TransactionEntry *transaction, const RLFrame& RPDU)
 
 
 
-void Control::MOSMSController(const GSM::L3CMServiceRequest *req, UMTS::DCCHLogicalChannel *LCH)
+/**
+	Form the RP-DATA for a message to the MS.
+	Throws exception if the message cannot be parsed or has an unsupported type.
+*/
+static RPData deliverRPData(const char *callingPartyDigits, const char* message, const char* contentType, unsigned L3TI, UMTS::DCCHLogicalChannel *LCH)
 {
-	assert(req);
-	assert(req->serviceType().type() == GSM::L3CMServiceType::ShortMessage);
-	assert(LCH);
-	assert(LCH->type() != UMTS::DCCHType);
+#if 0
+	// HACK -- Check for "Easter Eggs"
+	// TL-PID
+	unsigned TLPID=0;
+	if (strncmp(message,"#!TLPID",7)==0) sscanf(message,"#!TLPID%d",&TLPID);
 
-	LOG(INFO) << "MOSMS, req " << *req;
+	// Step 1
+	// Send the first message.
+	// CP-DATA, containing RP-DATA.
+	unsigned reference = random() % 255;
+	CPData deliver(L3TI,
+		RPData(reference,
+			RPAddress(gConfig.getStr("SMS.FakeSrcSMSC").c_str()),
+			TLDeliver(callingPartyDigits,message,TLPID)));
+#else
+	// TODO: Read MIME Type from smqueue!!
+	unsigned reference = random() % 255;
+	RPData rp_data;
 
-	// If we got a TMSI, find the IMSI.
-	// Note that this is a copy, not a reference.
-	GSM::L3MobileIdentity mobileID = req->mobileID();
-	resolveIMSI(mobileID,LCH);
+	if (strncmp(contentType,"text/plain",10)==0) {
+		rp_data = RPData(reference,
+			RPAddress(gConfig.getStr("SMS.FakeSrcSMSC").c_str()),
+			TLDeliver(callingPartyDigits,message,0));
+	} else if (strncmp(contentType,"application/vnd.3gpp.sms",24)==0) {
+		BitVector RPDUbits(strlen(message)*4);
+		if (!RPDUbits.unhex(message)) {
+			LOG(WARNING) << "Hex string parsing failed (in incoming SIP MESSAGE)";
+			throw UnexpectedMessage();
+		}
 
-	// Create a transaction record.
-	TransactionEntry *transaction = new TransactionEntry(gConfig.getStr("SIP.Proxy.SMS").c_str(),mobileID,LCH);
-	gTransactionTable.add(transaction);
-	LOG(DEBUG) << "MOSMS: transaction: " << *transaction;
+		try {
+			RLFrame RPDU(RPDUbits);
+			LOG(DEBUG) << "SMS RPDU: " << RPDU;
 
-	// See GSM 04.11 Arrow Diagram A5 for the transaction
-	// Step 1	MS->Network	CP-DATA containing RP-DATA
-	// Step 2	Network->MS	CP-ACK
-	// Step 3	Network->MS	CP-DATA containing RP-ACK
-	// Step 4	MS->Network	CP-ACK
+			rp_data.parse(RPDU);
+			LOG(DEBUG) << "SMS RP-DATA " << rp_data;
+		}
+		catch (SMSReadError) {
+			LOG(WARNING) << "SMS parsing failed (above L3)";
+			// Cause 95, "semantically incorrect message".
+			LCH->send(CPData(L3TI,RPError(95,reference)),3);
+			throw UnexpectedMessage();
+		}
+		catch (GSM::L3ReadError) {
+			LOG(WARNING) << "SMS parsing failed (in L3)";
+			// TODO:: send error back to the phone
+			throw UnsupportedMessage();
+		}
+	} else {
+		LOG(WARNING) << "Unsupported content type (in incoming SIP MESSAGE) -- type: " << contentType;
+		throw UnexpectedMessage();
+	}
+#endif
+	return rp_data;
+}
 
-	// LAPDm operation, from GSM 04.11, Annex F:
-	// """
-	// Case A: Mobile originating short message transfer, no parallel call:
-	// The mobile station side will initiate SAPI 3 establishment by a SABM command
-	// on the DCCH after the cipher mode has been set. If no hand over occurs, the
-	// SAPI 3 link will stay up until the last CP-ACK is received by the MSC, and
-	// the clearing procedure is invoked.
-	// """
 
-	// FIXME: check provisioning
+/**
+	Take the CP-DATA carrying the MS's answer to our RP-DATA, and acknowledge it with CP-ACK.
+	Deletes the frame.  Throws exception on parsing failure.
+	@return true if the answer is RP-ACK.
+*/
+static bool receiveRPAck(GSM::L3Frame *CM, unsigned L3TI, UMTS::DCCHLogicalChannel *LCH)
+{
+	LOG(DEBUG) << "MTSMS: data from MS " << *CM;
+	if (CM->MTI()!=CPMessage::DATA) {
+		LOG(NOTICE) << "Unexpected SMS CP message with TI=" << CM->MTI();
+		delete CM;
+		throw UnexpectedMessage();
+	}
 
-	// Let the phone know we're going ahead with the transaction.
-	LOG(INFO) << "sending CMServiceAccept";
-	LCH->send(GSM::L3CMServiceAccept());
-	// Wait for SAP3 to connect.
-	// The first read on SAP3 is the ESTABLISH primitive.
-	delete getFrameSMS(LCH,GSM::ESTABLISH);
+	// FIXME -- Check L3 TI.
+
+	// Parse to check for RP-ACK.
+	CPData data;
+	try {
+		data.parse(*CM);
+		delete CM;
+		LOG(DEBUG) << "CPData " << data;
+	}
+	catch (SMSReadError) {
+		LOG(WARNING) << "SMS parsing failed (above L3)";
+		delete CM;
+		// Cause 95, "semantically incorrect message".
+		LCH->send(CPError(L3TI,95),3);
+		throw UnexpectedMessage();
+	}
+	catch (GSM::L3ReadError) {
+		LOG(WARNING) << "SMS parsing failed (in L3)";
+		delete CM;
+		throw UnsupportedMessage();
+	}
+
+	// FIXME -- Check SMS reference.
+
+	bool success = true;
+	if (data.RPDU().MTI()!=RPMessage::Ack) {
+		LOG(WARNING) << "unexpected RPDU " << data.RPDU();
+		success = false;
+	}
+
+	// Step 4
+	// Send CP-ACK to the MS.
+	LOG(INFO) << "MTSMS: sending CPAck";
+	LCH->send(CPAck(L3TI),3);
+	return success;
+}
+
+
+
+
+namespace Control {
+
+/**
+	A MOSMS or MTSMS transfer, GSM 04.11 Arrow Diagram A5, run as a ControlMachine in gControlEngine.
+	The steps are those of the old blocking controllers; where those waited for SAP3 or for the
+	SMS server, the machine returns and picks up again on the next event.
+	Each wait for the MS has the same 20 second limit as getFrameSMS.
+	However the transfer ends, the machine removes its transaction from the table.
+*/
+class SMSMachine : public ControlMachine {
+
+	public:
+
+	enum Step {
+		MODataWait,			///< CM Service Accept sent, waiting for CP-DATA with RP-DATA
+		MOSubmitWait,		///< MESSAGE sent, waiting for the SMS server
+		MOAckWait,			///< CP-DATA with RP-ACK or RP-ERROR sent, waiting for CP-ACK
+		MTEstablishWait,	///< waiting for SAP3 to connect
+		MTAckWait,			///< CP-DATA with RP-DATA sent, waiting for CP-ACK
+		MTDataWait			///< waiting for CP-DATA with RP-ACK
+	};
+
+	private:
+
+	Step mStep;
+	UMTS::DCCHLogicalChannel *mLCH;
+	TransactionEntry *mTransaction;
+	unsigned mRef;						///< the RP message reference, for MOSMS
+
+	public:
+
+	SMSMachine(Step wStep, TransactionEntry *wTransaction, UMTS::DCCHLogicalChannel *wLCH)
+		:mStep(wStep),mLCH(wLCH),mTransaction(wTransaction),mRef(0)
+	{ }
+
+	bool handle(Event event);
+
+	const char* name() const { return "SMS"; }
+
+	private:
+
+	bool started();
+	bool l3();
+	bool l3Frame(GSM::L3Frame *frame);
+	bool sip();
+	bool timer();
+
+	/** Take CP-DATA with RP-DATA, acknowledge it and send it on. */
+	bool MOData(GSM::L3Frame *frame);
+	/** Answer the RP-DATA and wait for the CP-ACK. */
+	bool MOResult(bool success);
+	/** Send CP-DATA with RP-DATA to the MS. */
+	bool MTDeliver();
+
+	/** Wait for the MS in the given step. */
+	void waitFor(Step step) { mStep = step; timeout(20000); }
+	/** Remove the transaction.  Always returns false, the machine being done. */
+	bool finish();
+	/** Release the channel for the exception being handled, and finish. */
+	bool failed();
+};
+
+}	// Control
+
+
+
+bool SMSMachine::handle(Event event)
+{
+	try {
+		switch (event) {
+			case StartEvent: return started();
+			case L3Event: return l3();
+			case SIPEvent: return sip();
+			case TimerEvent: return timer();
+			case TerminateEvent:
+				// The transfer is short and the blocking controllers did not check this either.
+				return true;
+		}
+		return true;
+	}
+	catch (ControlLayerException) { return failed(); }
+	catch (SIP::SIPException) { return failed(); }
+}
+
+
+bool SMSMachine::failed()
+{
+	releaseForException(mLCH);
+	return finish();
+}
+
+
+bool SMSMachine::finish()
+{
+	gTransactionTable.remove(mTransaction);
+	mTransaction = NULL;
+	return false;
+}
+
+
+bool SMSMachine::started()
+{
+	if (mStep==MODataWait) {
+		waitFor(MODataWait);
+		// The CP-DATA may already be here.
+		return l3();
+	}
+
+	// MTSMS
+	// Attach the channel to the transaction and update the state.
+	LOG(DEBUG) << "transaction: "<< *mTransaction;
+	mTransaction->channel(mLCH);
+	mTransaction->GSMState(GSM::SMSDelivering);
+	LOG(INFO) << "transaction: "<< *mTransaction;
+	if (mLCH->multiframeMode(3)) return MTDeliver();
+	// Start ABM in SAP3.
+	mLCH->send(GSM::ESTABLISH,3);
+	// The next read on SAP3 should the ESTABLISH primitive.
+	waitFor(MTEstablishWait);
+	return l3();
+}
+
+
+bool SMSMachine::l3()
+{
+	// While waiting for the SMS server, leave the next messages in the channel.
+	while (mStep!=MOSubmitWait) {
+		GSM::L3Frame *frame = mLCH->recv(0,3);
+		if (!frame) return true;
+		if (!l3Frame(frame)) return false;
+	}
+	return true;
+}
+
+
+bool SMSMachine::l3Frame(GSM::L3Frame *frame)
+{
+	switch (mStep) {
+		case MODataWait:
+			// In GSM the SAP3 ESTABLISH comes first, but the UMTS RLC has no SAP3 to establish.
+			if (frame->primitive()==GSM::ESTABLISH) {
+				delete frame;
+				return true;
+			}
+			return MOData(frame);
+		case MOAckWait: {
+			// Step 4
+			// Get CP-ACK from the MS.
+			checkFrameSMS(mLCH,frame);
+			if (frame->MTI()!=CPMessage::ACK) {
+				LOG(NOTICE) << "unexpected SMS CP message with TI=" << frame->MTI();
+				delete frame;
+				throw UnexpectedMessage();
+			}
+			LOG(DEBUG) << "ack from MS: " << *frame;
+			CPAck ack;
+			ack.parse(*frame);
+			delete frame;
+			LOG(INFO) << "CPAck " << ack;
+
+			// Done.
+			mLCH->send(GSM::L3ChannelRelease());
+			LOG(INFO) << "closing the Um channel";
+			return finish();
+		}
+		case MTEstablishWait:
+			checkFrameSMS(mLCH,frame,GSM::ESTABLISH);
+			delete frame;
+			return MTDeliver();
+		case MTAckWait:
+			// Step 2
+			// Get the CP-ACK.
+			// FIXME -- Check TI.
+			checkFrameSMS(mLCH,frame);
+			LOG(DEBUG) << "MTSMS: ack from MS " << *frame;
+			if (frame->MTI()!=CPMessage::ACK) {
+				LOG(WARNING) << "MS rejected our RP-DATA with CP message with TI=" << frame->MTI();
+				delete frame;
+				throw UnexpectedMessage();
+			}
+			delete frame;
+			// Step 3
+			// Get CP-DATA containing RP-ACK and message reference.
+			LOG(DEBUG) << "MTSMS: waiting for RP-ACK";
+			waitFor(MTDataWait);
+			return true;
+		case MTDataWait:
+			checkFrameSMS(mLCH,frame);
+			// Ack in SIP domain.
+			if (receiveRPAck(frame,mTransaction->L3TI(),mLCH)) mTransaction->MTSMSSendOK();
+			return finish();
+		default:
+			delete frame;
+			return true;
+	}
+}
 
+
+bool SMSMachine::MOData(GSM::L3Frame *CM)
+{
 	// Step 1
-	// Now get the first message.
 	// Should be CP-DATA, containing RP-DATA.
-	GSM::L3Frame *CM = getFrameSMS(LCH);
+	checkFrameSMS(mLCH,CM);
 	LOG(DEBUG) << "data from MS " << *CM;
 	if (CM->MTI()!=CPMessage::DATA) {
 		LOG(NOTICE) << "unexpected SMS CP message with TI=" << CM->MTI();
+		delete CM;
 		throw UnexpectedMessage();
 	}
 	unsigned L3TI = CM->TI() | 0x08;
-	transaction->L3TI(L3TI);
+	mTransaction->L3TI(L3TI);
 
 	// Step 2
 	// Respond with CP-ACK.
 	// This just means that we got the message.
 	LOG(INFO) << "sending CPAck";
-	LCH->send(CPAck(L3TI),3);
+	mLCH->send(CPAck(L3TI),3);
 
 	// Parse the message in CM and process RP part.
 	// This is where we actually parse the message and send it out.
-	// FIXME -- We need to set the message ref correctly,
-	// even if the parsing fails.
-	// The compiler gives a warning here.  Let it.  It will remind someone to fix it.
-	unsigned ref;
+	// RP-DATA goes to the SMS server without waiting; the response comes as a SIPEvent.
+	bool submitted = false;
 	bool success = false;
 	try {
 		CPData data;
@@ -236,49 +528,131 @@ void Control::MOSMSController(const GSM::L3CMServiceRequest *req, UMTS::DCCHLogi
 		delete CM;
 		LOG(INFO) << "CPData " << data;
 		// Transfer out the RPDU -> TPDU -> delivery.
-		ref = data.RPDU().reference();
+		mRef = data.RPDU().reference();
+		submitted = (RPMessage::MessageType)data.RPDU().MTI()==RPMessage::Data;
 		// This handler invokes higher-layer parsers, too.
-		success = handleRPDU(transaction,data.RPDU());
+		success = handleRPDU(mTransaction,data.RPDU(),!submitted);
 	}
 	catch (SMSReadError) {
 		LOG(WARNING) << "SMS parsing failed (above L3)";
+		delete CM;
 		// Cause 95, "semantically incorrect message".
-		LCH->send(CPData(L3TI,RPError(95,ref)),3);
+		mLCH->send(CPData(L3TI,RPError(95,mRef)),3);
 		throw UnexpectedMessage();
 	}
 	catch (GSM::L3ReadError) {
 		LOG(WARNING) << "SMS parsing failed (in L3)";
+		delete CM;
 		throw UnsupportedMessage();
 	}
 
+	if (!submitted) return MOResult(success);
+	gControlEngine.attachCallID(this,mTransaction->SIPCallID());
+	mStep = MOSubmitWait;
+	timeout(gConfig.getNum("SIP.Timer.A"));
+	// The response may have come before the call ID was attached.
+	return sip();
+}
+
+
+bool SMSMachine::MOResult(bool success)
+{
 	// Step 3
 	// Send CP-DATA containing RP-ACK and message reference.
+	unsigned L3TI = mTransaction->L3TI();
 	if (success) {
 		LOG(INFO) << "sending RPAck in CPData";
-		LCH->send(CPData(L3TI,RPAck(ref)),3);
+		mLCH->send(CPData(L3TI,RPAck(mRef)),3);
 	} else {
 		LOG(INFO) << "sending RPError in CPData";
 		// Cause 127 is "internetworking error, unspecified".
 		// See GSM 04.11 Table 8.4.
-		LCH->send(CPData(L3TI,RPError(127,ref)),3);
+		mLCH->send(CPData(L3TI,RPError(127,mRef)),3);
 	}
+	waitFor(MOAckWait);
+	// Take anything that arrived while waiting for the SMS server.
+	return l3();
+}
 
-	// Step 4
-	// Get CP-ACK from the MS.
-	CM = getFrameSMS(LCH);
-	if (CM->MTI()!=CPMessage::ACK) {
-		LOG(NOTICE) << "unexpected SMS CP message with TI=" << CM->MTI();
-		throw UnexpectedMessage();
+
+bool SMSMachine::MTDeliver()
+{
+	unsigned L3TI = mTransaction->L3TI();
+	CPData deliver(L3TI,deliverRPData(mTransaction->calling().digits(),mTransaction->message(),
+								mTransaction->messageType(),L3TI,mLCH));
+	LOG(INFO) << "sending " << deliver;
+	mLCH->send(deliver,3);
+	LOG(DEBUG) << "MTSMS: waiting for CP-ACK";
+	waitFor(MTAckWait);
+	return l3();
+}
+
+
+bool SMSMachine::sip()
+{
+	if (mStep!=MOSubmitWait) return true;
+	if (gSIPInterface.fifoSize(mTransaction->SIPCallID())==0) return true;
+	return MOResult(mTransaction->MOSMSWaitForSubmit(0)==SIP::Cleared);
+}
+
+
+bool SMSMachine::timer()
+{
+	if (mStep==MOSubmitWait) {
+		// Nothing queued, so this takes the SIP timeout path.
+		return MOResult(mTransaction->MOSMSWaitForSubmit(0)==SIP::Cleared);
 	}
-	LOG(DEBUG) << "ack from MS: " << *CM;
-	CPAck ack;
-	ack.parse(*CM);
-	LOG(INFO) << "CPAck " << ack;
+	LOG(NOTICE) << "channel read time out on " << *mLCH << " SAP3";
+	throw ChannelReadTimeout();
+}
 
-	// Done.
-	LCH->send(GSM::L3ChannelRelease());
-	gTransactionTable.remove(transaction);
-	LOG(INFO) << "closing the Um channel";
+
+
+
+void Control::MOSMSController(const GSM::L3CMServiceRequest *req, UMTS::DCCHLogicalChannel *LCH)
+{
+	assert(req);
+	assert(req->serviceType().type() == GSM::L3CMServiceType::ShortMessage);
+	assert(LCH);
+	// This was ported from the GSM check that the SMS did not arrive on the SACCH as != DCCHType,
+	// which is the channel every UMTS SMS arrives on.  The channel it can not arrive on is the CCCH.
+	assert(LCH->type() != UMTS::CCCHType);
+
+	LOG(INFO) << "MOSMS, req " << *req;
+
+	// If we got a TMSI, find the IMSI.
+	// Note that this is a copy, not a reference.
+	GSM::L3MobileIdentity mobileID = req->mobileID();
+	resolveIMSI(mobileID,LCH);
+
+	// Create a transaction record.
+	TransactionEntry *transaction = new TransactionEntry(gConfig.getStr("SIP.Proxy.SMS").c_str(),mobileID,LCH);
+	gTransactionTable.add(transaction);
+	LOG(DEBUG) << "MOSMS: transaction: " << *transaction;
+
+	// See GSM 04.11 Arrow Diagram A5 for the transaction
+	// Step 1	MS->Network	CP-DATA containing RP-DATA
+	// Step 2	Network->MS	CP-ACK
+	// Step 3	Network->MS	CP-DATA containing RP-ACK
+	// Step 4	MS->Network	CP-ACK
+
+	// LAPDm operation, from GSM 04.11, Annex F:
+	// """
+	// Case A: Mobile originating short message transfer, no parallel call:
+	// The mobile station side will initiate SAPI 3 establishment by a SABM command
+	// on the DCCH after the cipher mode has been set. If no hand over occurs, the
+	// SAPI 3 link will stay up until the last CP-ACK is received by the MSC, and
+	// the clearing procedure is invoked.
+	// """
+
+	// FIXME: check provisioning
+
+	// The machine owns the channel from here, so the CP-DATA goes to it.
+	gControlEngine.add(new SMSMachine(SMSMachine::MODataWait,transaction,LCH),LCH);
+
+	// Let the phone know we're going ahead with the transaction.
+	LOG(INFO) << "sending CMServiceAccept";
+	LCH->send(GSM::L3CMServiceAccept());
 }
 
 
@@ -295,62 +669,7 @@ bool Control::deliverSMSToMS(const char *callingPartyDigits, const char* message
 		delete getFrameSMS(LCH,GSM::ESTABLISH);
 	}
 
-#if 0
-	// HACK -- Check for "Easter Eggs"
-	// TL-PID
-	unsigned TLPID=0;
-	if (strncmp(message,"#!TLPID",7)==0) sscanf(message,"#!TLPID%d",&TLPID);
-
-	// Step 1
-	// Send the first message.
-	// CP-DATA, containing RP-DATA.
-	unsigned reference = random() % 255;
-	CPData deliver(L3TI,
-		RPData(reference,
-			RPAddress(gConfig.getStr("SMS.FakeSrcSMSC").c_str()),
-			TLDeliver(callingPartyDigits,message,TLPID)));
-#else
-	// TODO: Read MIME Type from smqueue!!
-	unsigned reference = random() % 255;
-	RPData rp_data;
-
-	if (strncmp(contentType,"text/plain",10)==0) {
-		rp_data = RPData(reference,
-			RPAddress(gConfig.getStr("SMS.FakeSrcSMSC").c_str()),
-			TLDeliver(callingPartyDigits,message,0));
-	} else if (strncmp(contentType,"application/vnd.3gpp.sms",24)==0) {
-		BitVector RPDUbits(strlen(message)*4);
-		if (!RPDUbits.unhex(message)) {
-			LOG(WARNING) << "Hex string parsing failed (in incoming SIP MESSAGE)";
-			throw UnexpectedMessage();
-		}
-
-		try {
-			RLFrame RPDU(RPDUbits);
-			LOG(DEBUG) << "SMS RPDU: " << RPDU;
-
-			rp_data.parse(RPDU);
-			LOG(DEBUG) << "SMS RP-DATA " << rp_data;
-		}
-		catch (SMSReadError) {
-			LOG(WARNING) << "SMS parsing failed (above L3)";
-			// Cause 95, "semantically incorrect message".
-			LCH->send(CPData(L3TI,RPError(95,reference)),3);
-			throw UnexpectedMessage();
-		}
-		catch (GSM::L3ReadError) {
-			LOG(WARNING) << "SMS parsing failed (in L3)";
-			// TODO:: send error back to the phone
-			throw UnsupportedMessage();
-		}
-	} else {
-		LOG(WARNING) << "Unsupported content type (in incoming SIP MESSAGE) -- type: " << contentType;
-		throw UnexpectedMessage();
-	}
-
-	CPData deliver(L3TI,rp_data);
-
-#endif
+	CPData deliver(L3TI,deliverRPData(callingPartyDigits,message,contentType,L3TI,LCH));
 
 	// Start ABM in SAP3.
 	//LCH->send(GSM::ESTABLISH,3);
@@ -372,50 +691,12 @@ bool Control::deliverSMSToMS(const char *callingPartyDigits, const char* message
 		LOG(WARNING) << "MS rejected our RP-DATA with CP message with TI=" << CM->MTI();
 		throw UnexpectedMessage();
 	}
+	delete CM;
 
 	// Step 3
 	// Get CP-DATA containing RP-ACK and message reference.
 	LOG(DEBUG) << "MTSMS: waiting for RP-ACK";
-	CM = getFrameSMS(LCH);
-	LOG(DEBUG) << "MTSMS: data from MS " << *CM;
-	if (CM->MTI()!=CPMessage::DATA) {
-		LOG(NOTICE) << "Unexpected SMS CP message with TI=" << CM->MTI();
-		throw UnexpectedMessage();
-	}
-
-	// FIXME -- Check L3 TI.
-
-	// Parse to check for RP-ACK.
-	CPData data;
-	try {
-		data.parse(*CM);
-		delete CM;
-		LOG(DEBUG) << "CPData " << data;
-	}
-	catch (SMSReadError) {
-		LOG(WARNING) << "SMS parsing failed (above L3)";
-		// Cause 95, "semantically incorrect message".
-		LCH->send(CPError(L3TI,95),3);
-		throw UnexpectedMessage();
-	}
-	catch (GSM::L3ReadError) {
-		LOG(WARNING) << "SMS parsing failed (in L3)";
-		throw UnsupportedMessage();
-	}
-
-	// FIXME -- Check SMS reference.
-
-	bool success = true;
-	if (data.RPDU().MTI()!=RPMessage::Ack) {
-		LOG(WARNING) << "unexpected RPDU " << data.RPDU();
-		success = false;
-	}
-
-	// Step 4
-	// Send CP-ACK to the MS.
-	LOG(INFO) << "MTSMS: sending CPAck";
-	LCH->send(CPAck(L3TI),3);
-	return success;
+	return receiveRPAck(getFrameSMS(LCH),L3TI,LCH);
 }
 
 
@@ -441,29 +722,7 @@ void Control::MTSMSController(TransactionEntry *transaction, UMTS::DCCHLogicalCh
 	// MSC has given the last CP-ack and invokes the clearing procedure. 
 	// """
 
-
-	// Attach the channel to the transaction and update the state.
-	LOG(DEBUG) << "transaction: "<< *transaction;
-	transaction->channel(LCH);
-	transaction->GSMState(GSM::SMSDelivering);
-	LOG(INFO) << "transaction: "<< *transaction;
-
-	bool success = deliverSMSToMS(transaction->calling().digits(),transaction->message(),
-								transaction->messageType(),transaction->L3TI(),LCH);
-
-#if 0
-	// Close the Dm channel?
-	if (LCH->type()!=GSM::SACCHType) {
-		LCH->send(GSM::L3ChannelRelease());
-		LOG(INFO) << "closing the Um channel";
-	}
-#endif
-
-	// Ack in SIP domain.
-	if (success) transaction->MTSMSSendOK();
-
-	// Done.
-	gTransactionTable.remove(transaction);
+	gControlEngine.add(new SMSMachine(SMSMachine::MTEstablishWait,transaction,LCH),LCH);
 }
 
 
@@ -36,7 +36,7 @@ namespace Control {
 
 class TransactionEntry;
 
-/** MOSMS state machine.  */
+/** Accept a MOSMS and hand it to an SMS machine in the ControlEngine.  */
 void MOSMSController(const GSM::L3CMServiceRequest *req, UMTS::DCCHLogicalChannel *LCH);
 
 /** MOSMS-with-parallel-call state machine.  */
@@ -52,7 +52,7 @@ void InCallMOSMSController(const SMS::CPData *msg, Control::TransactionEntry* tr
 */
 bool deliverSMSToMS(const char *callingPartyDigits, const char* message, const char* contentType, unsigned TI, UMTS::DCCHLogicalChannel *LCH);
 
-/** MTSMS */
+/** Hand a MTSMS to an SMS machine in the ControlEngine, which delivers it on LCH and removes the transaction.  */
 void MTSMSController(Control::TransactionEntry* transaction, UMTS::DCCHLogicalChannel *LCH);
 
 }
@@ -57,7 +57,13 @@ static const char* createTMSITable = {
 
 
 
+static const char* touchTMSI = "UPDATE TMSI_TABLE SET ACCESSED=?1 WHERE TMSI=?2 AND ACCESSED<?1";
+
+
+
 TMSITable::TMSITable(const char* wPath)
+	:WriteBehind<unsigned,unsigned>("TMSI table access times"),
+	mTouchStmt(NULL),mLookups(0),mHits(0),mWrites(0)
 {
 	int rc = sqlite3_open(wPath,&mDB);
 	if (rc) {
@@ -71,17 +77,74 @@ TMSITable::TMSITable(const char* wPath)
 	if (!sqlite3_command(mDB,createTMSITable)) {
 		LOG(EMERG) << "Cannot create TMSI table";
 	}
+	if (sqlite3_prepare_statement(mDB,&mTouchStmt,touchTMSI)) {
+		LOG(ALERT) << "Cannot prepare TMSI table access update";
+		mTouchStmt = NULL;
+	} else {
+		writeTo(mDB);
+	}
+	load();
 }
 
 
 
 TMSITable::~TMSITable()
 {
+	stop();
+	if (mTouchStmt) sqlite3_finalize(mTouchStmt);
 	if (mDB) sqlite3_close(mDB);
 }
 
 
 
+void TMSITable::load()
+{
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_statement(mDB,&stmt,"SELECT TMSI,IMSI FROM TMSI_TABLE")) {
+		LOG(ALERT) << "Cannot read TMSI table";
+		return;
+	}
+	ScopedLock lock(mLock);
+	while (sqlite3_run_query(mDB,stmt)==SQLITE_ROW) {
+		unsigned TMSI = (unsigned)sqlite3_column_int64(stmt,0);
+		const char *IMSI = (const char*)sqlite3_column_text(stmt,1);
+		if (!IMSI) continue;
+		mIMSIs[TMSI] = IMSI;
+		mTMSIs[IMSI] = TMSI;
+	}
+	sqlite3_finalize(stmt);
+	LOG(INFO) << "loaded " << mIMSIs.size() << " TMSI table entries";
+}
+
+
+
+void TMSITable::start()
+{
+	if (!mDB) return;
+	unsigned interval = gConfig.getNum("Control.Reporting.TMSIAccessFlushInterval");
+	WriteBehind<unsigned,unsigned>::start(1000*(interval ? interval : 1));
+}
+
+
+
+bool TMSITable::writeRow(const unsigned& TMSI, const unsigned& accessed)
+{
+	sqlite3_bind_int64(mTouchStmt,1,accessed);
+	sqlite3_bind_int64(mTouchStmt,2,TMSI);
+	return runStatement(mTouchStmt);
+}
+
+
+
+bool TMSITable::command(const char* query)
+{
+	if (!sqlite3_command(mDB,query)) return false;
+	ScopedLock lock(mLock);
+	mWrites++;
+	return true;
+}
+
+
 
 unsigned TMSITable::assign(const char* IMSI, const GSM::L3LocationUpdatingRequest* lur)
 {
@@ -91,10 +154,11 @@ unsigned TMSITable::assign(const char* IMSI, const GSM::L3LocationUpdatingReques
 
 	LOG(DEBUG) << "IMSI=" << IMSI;
 	// Is there already a record?
-	unsigned TMSI;
-	if (sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) {
+	// Assignments are serialized so two cannot insert the same IMSI.
+	ScopedLock assignLock(mAssignLock);
+	unsigned TMSI = this->TMSI(IMSI);
+	if (TMSI) {
 		LOG(DEBUG) << "found TMSI " << TMSI;
-		touch(TMSI);
 		return TMSI;
 	}
 
@@ -122,14 +186,19 @@ unsigned TMSITable::assign(const char* IMSI, const GSM::L3LocationUpdatingReques
 					IMSI,now,now,lai.MCC(),lai.MNC(),lai.LAC());
 		}
 	}
-	if (!sqlite3_command(mDB,query)) {
+	if (!command(query)) {
 		LOG(ALERT) << "TMSI creation failed";
 		return 0;
 	}
-	if (!sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) {
+	// TMSI is the rowid, and only assign() inserts on this connection.
+	TMSI = (unsigned)sqlite3_last_insert_rowid(mDB);
+	if (!TMSI) {
 		LOG(ERR) << "TMSI database inconsistancy";
 		return 0;
 	}
+	ScopedLock lock(mLock);
+	mIMSIs[TMSI] = IMSI;
+	mTMSIs[IMSI] = TMSI;
 	return TMSI;
 }
 	
@@ -137,11 +206,8 @@ unsigned TMSITable::assign(const char* IMSI, const GSM::L3LocationUpdatingReques
 
 void TMSITable::touch(unsigned TMSI) const
 {
-	// Update timestamp.
-	char query[100];
-	sprintf(query,"UPDATE TMSI_TABLE SET ACCESSED = %u WHERE TMSI == %u",
-		(unsigned)time(NULL),TMSI);
-	sqlite3_command(mDB,query);
+	// Record the timestamp; flush() writes it.
+	const_cast<TMSITable*>(this)->queue(TMSI,(unsigned)time(NULL));
 }
 
 
@@ -149,16 +215,24 @@ void TMSITable::touch(unsigned TMSI) const
 // Returned string must be free'd by the caller.
 char* TMSITable::IMSI(unsigned TMSI) const
 {
-	char* IMSI = NULL;
-	if (sqlite3_single_lookup(mDB,"TMSI_TABLE","TMSI",TMSI,"IMSI",IMSI)) touch(TMSI);
-	return IMSI;
+	ScopedLock lock(mLock);
+	mLookups++;
+	map<unsigned,string>::const_iterator itr = mIMSIs.find(TMSI);
+	if (itr==mIMSIs.end()) return NULL;
+	mHits++;
+	touch(TMSI);
+	return strdup(itr->second.c_str());
 }
 
 unsigned TMSITable::TMSI(const char* IMSI) const
 {
-	unsigned TMSI=0;
-	if (sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) touch(TMSI);
-	return TMSI;
+	ScopedLock lock(mLock);
+	mLookups++;
+	map<string,unsigned>::const_iterator itr = mTMSIs.find(IMSI);
+	if (itr==mTMSIs.end()) return 0;
+	mHits++;
+	touch(itr->second);
+	return itr->second;
 }
 
 
@@ -187,6 +261,8 @@ void printAge(unsigned seconds, ostream& os)
 
 void TMSITable::dump(ostream& os) const
 {
+	// Show the current access times.
+	const_cast<TMSITable*>(this)->flush();
 	sqlite3_stmt *stmt;
 	if (sqlite3_prepare_statement(mDB,&stmt,"SELECT TMSI,IMSI,CREATED,ACCESSED FROM TMSI_TABLE")) {
 		LOG(ERR) << "sqlite3_prepare_statement failed";
@@ -205,9 +281,24 @@ void TMSITable::dump(ostream& os) const
 
 
 
+void TMSITable::stats(ostream& os) const
+{
+	ScopedLock lock(mLock);
+	os << "entries=" << mIMSIs.size() << " lookups=" << mLookups << " hits=" << mHits
+		<< " pending=" << pending() << " touched=" << written() << " writes=" << mWrites+flushes()
+		<< " interval=" << interval()/1000 << "s";
+}
+
+
+
 void TMSITable::clear()
 {
-	sqlite3_command(mDB,"DELETE FROM TMSI_TABLE WHERE 1");
+	ScopedLock assignLock(mAssignLock);
+	discard();
+	command("DELETE FROM TMSI_TABLE WHERE 1");
+	ScopedLock lock(mLock);
+	mIMSIs.clear();
+	mTMSIs.clear();
 }
 
 
@@ -217,7 +308,7 @@ bool TMSITable::IMEI(const char* IMSI, const char *IMEI)
 	char query[100];
 	sprintf(query,"UPDATE TMSI_TABLE SET IMEI=\"%s\",ACCESSED=%u WHERE IMSI=\"%s\"",
 		IMEI,(unsigned)time(NULL),IMSI);
-	return sqlite3_command(mDB,query);
+	return command(query);
 }
 
 
@@ -230,7 +321,7 @@ bool TMSITable::classmark(const char* IMSI, const GSM::L3MobileStationClassmark2
 		"UPDATE TMSI_TABLE SET A5_SUPPORT=%u,ACCESSED=%u,POWER_CLASS=%u "
 		" WHERE IMSI=\"%s\"",
 		A5Bits,(unsigned)time(NULL),classmark.powerClass(),IMSI);
-	return sqlite3_command(mDB,query);
+	return command(query);
 }
 
 
@@ -238,8 +329,8 @@ void TMSITable::putAuthTokens(const char* IMSI, uint64_t upperRAND, uint64_t low
 {
 	char query[300];
 	sprintf(query,"UPDATE TMSI_TABLE SET RANDUPPER=%llu,RANDLOWER=%llu,SRES=%u,ACCESSED=%u WHERE IMSI=\"%s\"",
-		upperRAND,lowerRAND,SRES,(unsigned)time(NULL),IMSI);
-	if (!sqlite3_command(mDB,query)) {
+		(unsigned long long)upperRAND,(unsigned long long)lowerRAND,SRES,(unsigned)time(NULL),IMSI);
+	if (!command(query)) {
 		LOG(ALERT) << "cannot write to TMSI table";
 	}
 }
@@ -273,7 +364,7 @@ void TMSITable::putKc(const char* IMSI, string Kc)
 {
 	char query[300];
 	sprintf(query,"UPDATE TMSI_TABLE SET kc=\"%s\" WHERE IMSI=\"%s\"", Kc.c_str(), IMSI);
-	if (!sqlite3_command(mDB,query)) {
+	if (!command(query)) {
 		LOG(ALERT) << "cannot write Kc to TMSI table";
 	}
 }
@@ -309,7 +400,7 @@ unsigned TMSITable::nextL3TI(const char* IMSI)
 	char query[200];
 	sprintf(query,"UPDATE TMSI_TABLE SET L3TI=%u,ACCESSED=%u WHERE IMSI='%s'",
 		next, (unsigned)time(NULL),IMSI);
-	if (!sqlite3_command(mDB,query)) {
+	if (!command(query)) {
 		LOG(ALERT) << "cannot write L3TI to TMSI_TABLE";
 	}
 	return next;
@@ -18,14 +18,14 @@
 #define TMSITABLE_H
 
 #include <map>
+#include <string>
+#include <ostream>
 
 #include <Timeval.h>
 #include <Threads.h>
+#include <WriteBehind.h>
 #include <string.h>
 
-
-struct sqlite3;
-
 namespace GSM {
 class L3LocationUpdatingRequest;
 class L3MobileStationClassmark2;
@@ -35,12 +35,30 @@ class L3MobileIdentity;
 
 namespace Control {
 
-class TMSITable {
+/**
+	The TMSI table, kept in sqlite3 and cached in memory.
+	The IMSI<->TMSI mapping is loaded when the table is opened and is written through on assignment,
+	so lookups are answered from memory.  Only this class writes TMSI_TABLE, so the cache stays authoritative.
+	A lookup only records the access time; a background thread started by start() writes the recorded
+	times every Control.Reporting.TMSIAccessFlushInterval seconds in one sqlite transaction.
+*/
+class TMSITable : private WriteBehind<unsigned,unsigned> {
 
 	private:
 
 	sqlite3 *mDB;			///< database connection
 
+	mutable Mutex mLock;						///< protects the maps and counters below
+	std::map<unsigned,std::string> mIMSIs;		///< IMSI by TMSI
+	std::map<std::string,unsigned> mTMSIs;		///< TMSI by IMSI
+
+	Mutex mAssignLock;			///< one assignment at a time
+	sqlite3_stmt *mTouchStmt;	///< prepared access time update
+
+	mutable unsigned mLookups;	///< IMSI and TMSI lookups
+	mutable unsigned mHits;		///< lookups that found an entry
+	unsigned mWrites;			///< sqlite writes outside the access time flushes
+
 
 	public:
 
@@ -48,6 +66,12 @@ class TMSITable {
 
 	~TMSITable();
 
+	/** Start the thread that writes the access times. */
+	void start();
+
+	/** Write the access times recorded so far.  Return the number of entries written. */
+	using WriteBehind<unsigned,unsigned>::flush;
+
 	/**
 		Create a new entry in the table.
 		@param IMSI	The IMSI to create an entry for.
@@ -58,7 +82,7 @@ class TMSITable {
 
 	/**
 		Find an IMSI in the table.
-		This is a log-time operation.
+		This is a log-time operation on the cache.
 		@param TMSI The TMSI to find.
 		@return Pointer to IMSI to be freed by the caller, or NULL.
 	*/
@@ -66,7 +90,7 @@ class TMSITable {
 
 	/**
 		Find a TMSI in the table.
-		This is a linear-time operation.
+		This is a log-time operation on the cache.
 		@param IMSI The IMSI to mach.
 		@return A TMSI value or zero on failure.
 	*/
@@ -74,6 +98,9 @@ class TMSITable {
 
 	/** Write entries as text to a stream. */
 	void dump(std::ostream&) const;
+
+	/** Write the cache and database access counts to a stream. */
+	void stats(std::ostream&) const;
 	
 	/** Clear the table completely. */
 	void clear();
@@ -101,8 +128,17 @@ class TMSITable {
 
 	private:
 
-	/** Update the "accessed" time on a record. */
+	/** Record the "accessed" time of a record, to be written by the next flush.  Caller holds mLock. */
 	void touch(unsigned TMSI) const;
+
+	/** Write one access time in the flush transaction. */
+	bool writeRow(const unsigned& TMSI, const unsigned& accessed);
+
+	/** Run a write query on the database and count it. */
+	bool command(const char* query);
+
+	/** Load the IMSI<->TMSI mapping from the database. */
+	void load();
 };
 
 
@@ -0,0 +1,232 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the TMSITable cache against its database, then run a registration storm against it
+// and against the old way, a sqlite lookup and an ACCESSED update for every lookup.
+// Each registration resolves the IMSI to a TMSI, assigns (most subscribers are already in the table),
+// and looks the IMSI up again by TMSI, as the paging response and CM service request do.
+// Reports lookup latency and the number of sqlite write transactions.
+// Build with TMSITable.cpp and CommonLibs; pass the registration count and a scratch directory.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <sqlite3util.h>
+#include <Configuration.h>
+#include <Utils.h>
+#include <GSML3CommonElements.h>
+#include <UnitTest.h>
+#include "TMSITable.h"
+
+using namespace std;
+using namespace Control;
+
+ConfigurationTable gConfig;
+
+// The one out-of-line GSM function TMSITable.cpp uses.
+int GSM::L3LocationAreaIdentity::MNC() const { return 1; }
+
+static void imsiOf(unsigned n, char *buf) { sprintf(buf,"0010100%08u",n); }
+
+// Count the commits on a connection, which is what costs on a real disk.
+static int countCommit(void *arg) { (*(unsigned*)arg)++; return 0; }
+
+static unsigned readAccessed(sqlite3 *db, unsigned TMSI)
+{
+	unsigned accessed = 0;
+	char key[20];
+	sprintf(key,"%u",TMSI);
+	sqlite3_single_lookup(db,"TMSI_TABLE","TMSI",key,"ACCESSED",accessed);
+	return accessed;
+}
+
+static void testCache(const string& path)
+{
+	unlink(path.c_str());
+	unsigned tmsis[1000];
+	{
+		TMSITable table(path.c_str());
+		char imsi[20];
+		for (unsigned n = 0; n < 1000; n++) {
+			imsiOf(n,imsi);
+			CHECK(table.TMSI(imsi) == 0);
+			tmsis[n] = table.assign(imsi);
+			CHECK(tmsis[n] != 0);
+			CHECK(table.assign(imsi) == tmsis[n]);
+			CHECK(table.TMSI(imsi) == tmsis[n]);
+			char *back = table.IMSI(tmsis[n]);
+			CHECK(back && strcmp(back,imsi) == 0);
+			free(back);
+		}
+		CHECK(table.IMSI(0x7fffffff) == NULL);
+	}
+
+	// Reopen: the mapping comes back from the database.
+	sqlite3 *db;
+	CHECK(sqlite3_open(path.c_str(),&db) == 0);
+	CHECK(sqlite3_command(db,"UPDATE TMSI_TABLE SET ACCESSED=5"));
+	{
+		TMSITable table(path.c_str());
+		char imsi[20];
+		for (unsigned n = 0; n < 1000; n++) {
+			imsiOf(n,imsi);
+			CHECK(table.TMSI(imsi) == tmsis[n]);
+		}
+		// Lookups do not write until flushed, then write once per entry.
+		CHECK(readAccessed(db,tmsis[0]) == 5);
+		char *back = table.IMSI(tmsis[0]);
+		free(back);
+		CHECK(table.flush() == 1000);
+		CHECK(table.flush() == 0);
+		CHECK(readAccessed(db,tmsis[0]) > 5 && readAccessed(db,tmsis[999]) > 5);
+
+		// A newer time written directly is not overwritten by an older one.
+		CHECK(table.TMSI(imsi) == tmsis[999]);
+		CHECK(sqlite3_command(db,"UPDATE TMSI_TABLE SET ACCESSED=4000000000"));
+		table.flush();
+		CHECK(readAccessed(db,tmsis[999]) == 4000000000u);
+
+		table.clear();
+		CHECK(table.TMSI(imsi) == 0);
+		CHECK(table.IMSI(tmsis[999]) == NULL);
+	}
+	sqlite3_close(db);
+}
+
+
+// The old TMSITable lookups.
+class OldTable {
+	sqlite3 *mDB;
+	public:
+	unsigned mCommits;
+	OldTable(const char *path) : mCommits(0) {
+		sqlite3_open(path,&mDB);
+		sqlite3_commit_hook(mDB,countCommit,&mCommits);
+	}
+	~OldTable() { sqlite3_close(mDB); }
+	void touch(unsigned TMSI) {
+		char query[100];
+		sprintf(query,"UPDATE TMSI_TABLE SET ACCESSED = %u WHERE TMSI == %u",(unsigned)time(NULL),TMSI);
+		sqlite3_command(mDB,query);
+	}
+	unsigned TMSI(const char *IMSI) {
+		unsigned TMSI=0;
+		if (sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) touch(TMSI);
+		return TMSI;
+	}
+	char *IMSI(unsigned TMSI) {
+		char *IMSI = NULL;
+		if (sqlite3_single_lookup(mDB,"TMSI_TABLE","TMSI",TMSI,"IMSI",IMSI)) touch(TMSI);
+		return IMSI;
+	}
+	unsigned assign(const char *IMSI) {
+		unsigned TMSI;
+		if (sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) { touch(TMSI); return TMSI; }
+		char query[200];
+		unsigned now = (unsigned)time(NULL);
+		sprintf(query,"INSERT INTO TMSI_TABLE (IMSI,CREATED,ACCESSED) VALUES ('%s',%u,%u)",IMSI,now,now);
+		if (!sqlite3_command(mDB,query)) return 0;
+		if (!sqlite3_single_lookup(mDB,"TMSI_TABLE","IMSI",IMSI,"TMSI",TMSI)) return 0;
+		return TMSI;
+	}
+};
+
+
+struct Latency {
+	double mTotal, mMax;
+	unsigned mCount;
+	Latency() : mTotal(0), mMax(0), mCount(0) {}
+	void add(double t) { mTotal += t; mCount++; if (t > mMax) mMax = t; }
+	void print(const char *what) {
+		printf("  %-8s lookup: avg %8.2f us, max %8.2f ms\n",what,mCount ? 1e6*mTotal/mCount : 0.0,1e3*mMax);
+	}
+};
+
+// Fill a table with subscribers, then register them in a storm; every 10th registration is a new subscriber.
+template <class Table>
+static double storm(Table &table, unsigned subscribers, unsigned registrations, Latency &latency)
+{
+	char imsi[20];
+	double start = timef();
+	for (unsigned r = 0; r < registrations; r++) {
+		unsigned n = (r % 10 == 9) ? subscribers + r : (r * 7919) % subscribers;
+		imsiOf(n,imsi);
+		double t = timef();
+		unsigned tmsi = table.TMSI(imsi);
+		latency.add(timef() - t);
+		if (!tmsi) tmsi = table.assign(imsi);
+		else CHECK(table.assign(imsi) == tmsi);
+		t = timef();
+		char *back = table.IMSI(tmsi);
+		latency.add(timef() - t);
+		CHECK(back && strcmp(back,imsi) == 0);
+		free(back);
+	}
+	return timef() - start;
+}
+
+static void makeSubscribers(const string& path, unsigned subscribers)
+{
+	unlink(path.c_str());
+	TMSITable table(path.c_str());
+	sqlite3 *db;
+	sqlite3_open(path.c_str(),&db);
+	sqlite3_command(db,"BEGIN TRANSACTION");
+	char imsi[20], query[200];
+	for (unsigned n = 0; n < subscribers; n++) {
+		imsiOf(n,imsi);
+		sprintf(query,"INSERT INTO TMSI_TABLE (IMSI,CREATED,ACCESSED) VALUES ('%s',1,1)",imsi);
+		sqlite3_command(db,query);
+	}
+	sqlite3_command(db,"COMMIT");
+	sqlite3_close(db);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned registrations = argc > 1 ? atoi(argv[1]) : 2000;
+	string dir = argc > 2 ? argv[2] : "/tmp";
+	string path = dir + "/TMSITableTest.db";
+	gConfig.set("Control.Reporting.TMSIAccessFlushInterval","1");
+
+	testCache(path);
+
+	unsigned subscribers = 10000;
+	printf("%u registrations, %u subscribers:\n",registrations,subscribers);
+	{
+		makeSubscribers(path,subscribers);
+		OldTable table(path.c_str());
+		Latency latency;
+		double elapsed = storm(table,subscribers,registrations,latency);
+		printf(" old: %.0f registrations/sec, %u sqlite commits\n",elapsed > 0 ? registrations/elapsed : 0.0,table.mCommits);
+		latency.print("old");
+	}
+	{
+		makeSubscribers(path,subscribers);
+		TMSITable table(path.c_str());
+		table.start();
+		Latency latency;
+		double elapsed = storm(table,subscribers,registrations,latency);
+		table.flush();
+		ostringstream os;
+		table.stats(os);
+		printf(" new: %.0f registrations/sec, %s\n",elapsed > 0 ? registrations/elapsed : 0.0,os.str().c_str());
+		latency.print("new");
+	}
+	unlink(path.c_str());
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+/**@file Hash index for the TransactionTable lookups. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef TRANSACTIONINDEX_H
+#define TRANSACTIONINDEX_H
+
+#include <vector>
+
+namespace Control {
+
+/**
+	A hash multimap from an integer key to the objects with that key, so the TransactionTable can find
+	a transaction by channel or subscriber without scanning every entry.
+	The key is the channel pointer, or a hash of the mobile identity; since several objects can share a key,
+	and different subscribers can share a hash, the caller looks at the items in the key's bucket and checks
+	each one for a real match.
+	Chained with a short vector per bucket; the table doubles when it has more items than buckets.
+	Not locked; the TransactionTable protects it with its own mLock.
+*/
+template <class T>
+class TransactionIndex {
+
+	public:
+
+	struct Item {
+		unsigned long mKey;
+		T *mValue;
+	};
+	typedef std::vector<Item> Bucket;
+
+	private:
+
+	std::vector<Bucket> mBuckets;
+	unsigned mCount;
+
+	// Channel pointers have their low bits clear, so fold the high bits of the product down.
+	static unsigned hash(unsigned long key) {
+		unsigned h = (unsigned)(key ^ (key >> 16 >> 16)) * 2654435761u;
+		return h ^ (h >> 16);
+	}
+	unsigned slot(unsigned long key) const { return hash(key) & (mBuckets.size() - 1); }
+
+	void resize(unsigned numBuckets) {
+		std::vector<Bucket> old(numBuckets);
+		old.swap(mBuckets);
+		for (unsigned b = 0; b < old.size(); b++) {
+			for (unsigned i = 0; i < old[b].size(); i++) { mBuckets[slot(old[b][i].mKey)].push_back(old[b][i]); }
+		}
+	}
+
+	public:
+
+	TransactionIndex() : mBuckets(64), mCount(0) {}
+
+	unsigned size() const { return mCount; }
+
+	/** The bucket holding the items with this key, among others; the caller must check mKey. */
+	const Bucket& bucket(unsigned long key) const { return mBuckets[slot(key)]; }
+
+	void insert(unsigned long key, T *value) {
+		if (mCount + 1 > mBuckets.size()) resize(2 * mBuckets.size());
+		Item item = { key, value };
+		mBuckets[slot(key)].push_back(item);
+		mCount++;
+	}
+
+	/** Remove the item for this key and value.  Return true if it was there. */
+	bool erase(unsigned long key, T *value) {
+		Bucket &b = mBuckets[slot(key)];
+		for (unsigned i = 0; i < b.size(); i++) {
+			if (b[i].mKey != key || b[i].mValue != value) continue;
+			b[i] = b.back();
+			b.pop_back();
+			mCount--;
+			return true;
+		}
+		return false;
+	}
+};
+
+}	// Control
+
+#endif
+
+// vim: ts=4 sw=4
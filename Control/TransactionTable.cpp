@@ -33,6 +33,7 @@
 #include <SIPInterface.h>
 
 #include <CallControl.h>
+#include "ControlEngine.h"
 
 #include <Logger.h>
 #undef WARNING
@@ -103,9 +104,10 @@ TransactionEntry::TransactionEntry(
 	mCalling(wCalling),
 	mSIP(proxy,mSubscriber.digits()),
 	mGSMState(wState),
-	mNumSQLTries(gConfig.getNum("Control.NumSQLTries")),
+	mCreated(0),mChanged(0),
 	mChannel(wChannel),
-	mTerminationRequested(false)
+	mTerminationRequested(false),
+	mInTable(false),mIndexedChannel(NULL)
 {
 	if (wMessage) mMessage.assign(wMessage); //strncpy(mMessage,wMessage,160);
 	else mMessage.assign(""); //mMessage[0]='\0';
@@ -126,9 +128,10 @@ TransactionEntry::TransactionEntry(
 	mCalled(wCalled),
 	mSIP(proxy,mSubscriber.digits()),
 	mGSMState(GSM::MOCInitiated),
-	mNumSQLTries(gConfig.getNum("Control.NumSQLTries")),
+	mCreated(0),mChanged(0),
 	mChannel(wChannel),
-	mTerminationRequested(false)
+	mTerminationRequested(false),
+	mInTable(false),mIndexedChannel(NULL)
 {
 	assert(mSubscriber.type()==GSM::IMSIType);
 	mMessage.assign(""); //mMessage[0]='\0';
@@ -148,9 +151,10 @@ TransactionEntry::TransactionEntry(
 	mL3TI(wL3TI),
 	mSIP(proxy,mSubscriber.digits()),
 	mGSMState(GSM::MOCInitiated),
-	mNumSQLTries(2*gConfig.getNum("Control.NumSQLTries")),
+	mCreated(0),mChanged(0),
 	mChannel(wChannel),
-	mTerminationRequested(false)
+	mTerminationRequested(false),
+	mInTable(false),mIndexedChannel(NULL)
 {
 	mMessage.assign(""); //mMessage[0]='\0';
 	initTimers();
@@ -170,9 +174,10 @@ TransactionEntry::TransactionEntry(
 	mL3TI(7),mCalled(wCalled),
 	mSIP(proxy,mSubscriber.digits()),
 	mGSMState(GSM::SMSSubmitting),
-	mNumSQLTries(gConfig.getNum("Control.NumSQLTries")),
+	mCreated(0),mChanged(0),
 	mChannel(wChannel),
-	mTerminationRequested(false)
+	mTerminationRequested(false),
+	mInTable(false),mIndexedChannel(NULL)
 {
 	assert(mSubscriber.type()==GSM::IMSIType);
 	if (wMessage!=NULL) mMessage.assign(wMessage); //strncpy(mMessage,wMessage,160);
@@ -191,9 +196,10 @@ TransactionEntry::TransactionEntry(
 	mL3TI(7),
 	mSIP(proxy,mSubscriber.digits()),
 	mGSMState(GSM::SMSSubmitting),
-	mNumSQLTries(gConfig.getNum("Control.NumSQLTries")),
+	mCreated(0),mChanged(0),
 	mChannel(wChannel),
-	mTerminationRequested(false)
+	mTerminationRequested(false),
+	mInTable(false),mIndexedChannel(NULL)
 {
 	assert(mSubscriber.type()==GSM::IMSIType);
 	mMessage[0]='\0';
@@ -207,10 +213,7 @@ TransactionEntry::~TransactionEntry()
 	ScopedLock lock(mLock);
 
 	// Delete the SQL table entry.
-	char query[100];
-	sprintf(query,"DELETE FROM TRANSACTION_TABLE WHERE ID=%u",mID);
-	runQuery(query);
-
+	if (mInTable) gTransactionTable.mWriter.remove(mID);
 }
 
 
@@ -238,6 +241,19 @@ bool TransactionEntry::anyTimerExpired() const
 }
 
 
+long TransactionEntry::timerRemaining() const
+{
+	ScopedLock lock(mLock);
+	long retVal = -1;
+	for (TimerTable::const_iterator itr = mTimers.begin(); itr!=mTimers.end(); ++itr) {
+		if (!(itr->second).active()) continue;
+		long remaining = (itr->second).remaining();
+		if (retVal<0 || remaining<retVal) retVal = remaining;
+	}
+	return retVal;
+}
+
+
 void TransactionEntry::resetTimers()
 {
 	ScopedLock lock(mLock);
@@ -319,26 +335,32 @@ void TransactionEntry::messageType(const char *wContentType)
 
 
 
-void TransactionEntry::runQuery(const char* query) const
+void TransactionEntry::insertIntoDatabase()
 {
-	for (unsigned i=0; i<mNumSQLTries; i++) {
-		if (sqlite3_command(gTransactionTable.DB(),query)) return;
-	}
-	LOG(ALERT) << "transaction table access failed after " << mNumSQLTries << "attempts. query:" << query << " error: " << sqlite3_errmsg(gTransactionTable.DB());
+	// This should be called only from gTransactionTable::add.
+	// Caller should hold mLock.
+	mInTable = true;
+	mCreated = mChanged = (unsigned)time(NULL);
+	mPrevSIPState = mSIP.state();
+	echoRow();
 }
 
 
 
-void TransactionEntry::insertIntoDatabase()
+void TransactionEntry::echoRow() const
 {
-	// This should be called only from gTransactionTable::add.
+	// Caller should hold mLock.
+	if (!mInTable) return;
+
+	TransactionRow row;
+	row.mID = mID;
+	row.mCreated = mCreated;
+	row.mChanged = mChanged;
+	if (mChannel) row.mChannel = mChannel->descriptiveString();
 
 	ostringstream serviceTypeSS;
 	serviceTypeSS << mService;
-
-	ostringstream sipStateSS;
-	sipStateSS << mSIP.state();
-	mPrevSIPState = mSIP.state();
+	row.mType = serviceTypeSS.str();
 
 	char subscriber[25];
 	switch (mSubscriber.type()) {
@@ -349,52 +371,36 @@ void TransactionEntry::insertIntoDatabase()
 			sprintf(subscriber,"invalid");
 			LOG(ERR) << "non-valid subscriber ID in transaction table: " << mSubscriber;
 	}
+	row.mSubscriber = subscriber;
+
+	row.mL3TI = mL3TI;
+	row.mCallID = mSIP.callID();
+	row.mProxy = mSIP.proxyIP();
+	row.mCalled = mCalled.digits();
+	row.mCalling = mCalling.digits();
 
 	const char* stateString = GSM::CallStateString(mGSMState);
 	assert(stateString);
+	row.mGSMState = stateString;
+	const char* sipStateString = SIP::SIPStateString(mPrevSIPState);
+	assert(sipStateString);
+	row.mSIPState = sipStateString;
 
-	char query[500];
-	unsigned now = (unsigned)time(NULL);
-	sprintf(query,"INSERT INTO TRANSACTION_TABLE "
-		        "(ID,CREATED,CHANGED,TYPE,SUBSCRIBER,L3TI,CALLED,CALLING,GSMSTATE,SIPSTATE,SIP_CALLID,SIP_PROXY) "
-		"VALUES  (%u,%u,     %u,     '%s','%s',      %u,'%s',  '%s',   '%s',    '%s',      '%s',      '%s')",
-		mID,now,now,
-		serviceTypeSS.str().c_str(),
-		subscriber,
-		mL3TI,
-		mCalled.digits(),
-		mCalling.digits(),
-		stateString,
-		sipStateSS.str().c_str(),
-		mSIP.callID().c_str(),
-		mSIP.proxyIP().c_str()
-	);
-
-	runQuery(query);
-
-	if (!mChannel) return;
-	sprintf(query,"UPDATE TRANSACTION_TABLE SET CHANNEL='%s' WHERE ID=%u",
-			mChannel->descriptiveString(), mID);
-	runQuery(query);
+	gTransactionTable.mWriter.write(row);
 }
 
 
 
 void TransactionEntry::channel(UMTS::LogicalChannel* wChannel)
 {
-	ScopedLock lock(mLock);
-	mChannel = wChannel;
-
-	char query[500];
-	if (mChannel) {
-		sprintf(query,"UPDATE TRANSACTION_TABLE SET CHANGED=%u,CHANNEL='%s' WHERE ID=%u",
-				(unsigned)time(NULL), mChannel->descriptiveString(), mID);
-	} else {
-		sprintf(query,"UPDATE TRANSACTION_TABLE SET CHANGED=%u,CHANNEL=NULL WHERE ID=%u",
-				(unsigned)time(NULL), mID);
+	{
+		ScopedLock lock(mLock);
+		mChannel = wChannel;
+		mChanged = (unsigned)time(NULL);
+		echoRow();
 	}
-
-	runQuery(query);
+	// Not holding mLock, since the table locks itself before its entries.
+	gTransactionTable.reindexChannel(this);
 }
 
 
@@ -402,17 +408,9 @@ void TransactionEntry::GSMState(GSM::CallState wState)
 {
 	ScopedLock lock(mLock);
 	mStateTimer.now();
-	unsigned now = mStateTimer.sec();
-
+	mChanged = mStateTimer.sec();
 	mGSMState = wState;
-	const char* stateString = GSM::CallStateString(wState);
-	assert(stateString);
-
-	char query[150];
-	sprintf(query,
-		"UPDATE TRANSACTION_TABLE SET GSMSTATE='%s',CHANGED=%u WHERE ID=%u",
-		stateString,now, mID);
-	runQuery(query);
+	echoRow();
 }
 
 
@@ -421,18 +419,8 @@ SIP::SIPState TransactionEntry::echoSIPState(SIP::SIPState state) const
 	// Caller should hold mLock.
 	if (mPrevSIPState==state) return state;
 	mPrevSIPState = state;
-
-	const char* stateString = SIP::SIPStateString(state);
-	assert(stateString);
-
-	unsigned now = time(NULL);
-
-	char query[150];
-	sprintf(query,
-		"UPDATE TRANSACTION_TABLE SET SIPSTATE='%s',CHANGED=%u WHERE ID=%u",
-		stateString,now,mID);
-	runQuery(query);
-
+	mChanged = (unsigned)time(NULL);
+	echoRow();
 	return state;
 }
 
@@ -455,10 +443,10 @@ SIP::SIPState TransactionEntry::MOCResendINVITE()
 	return state;
 }
 
-SIP::SIPState TransactionEntry::MOCWaitForOK()
+SIP::SIPState TransactionEntry::MOCWaitForOK(unsigned readTimeout)
 {
 	ScopedLock lock(mLock);
-	SIP::SIPState state = mSIP.MOCWaitForOK();
+	SIP::SIPState state = mSIP.MOCWaitForOK(readTimeout);
 	echoSIPState(state);
 	return state;
 }
@@ -488,10 +476,10 @@ SIP::SIPState TransactionEntry::MTCSendRinging()
 	return state;
 }
 
-SIP::SIPState TransactionEntry::MTCWaitForACK()
+SIP::SIPState TransactionEntry::MTCWaitForACK(unsigned readTimeout)
 {
 	ScopedLock lock(mLock);
-	SIP::SIPState state = mSIP.MTCWaitForACK();
+	SIP::SIPState state = mSIP.MTCWaitForACK(readTimeout);
 	echoSIPState(state);
 	return state;
 }
@@ -529,10 +517,10 @@ SIP::SIPState TransactionEntry::MODResendBYE()
 	return state;
 }
 
-SIP::SIPState TransactionEntry::MODWaitForOK()
+SIP::SIPState TransactionEntry::MODWaitForOK(bool wait)
 {
 	ScopedLock lock(mLock);
-	SIP::SIPState state = mSIP.MODWaitForOK();
+	SIP::SIPState state = mSIP.MODWaitForOK(wait);
 	echoSIPState(state);
 	return state;
 }
@@ -561,10 +549,10 @@ SIP::SIPState TransactionEntry::MOSMSSendMESSAGE(const char* calledUser, const c
 	return state;
 }
 
-SIP::SIPState TransactionEntry::MOSMSWaitForSubmit()
+SIP::SIPState TransactionEntry::MOSMSWaitForSubmit(unsigned readTimeout)
 {
 	ScopedLock lock(mLock);
-	SIP::SIPState state = mSIP.MOSMSWaitForSubmit();
+	SIP::SIPState state = mSIP.MOSMSWaitForSubmit(readTimeout);
 	echoSIPState(state);
 	return state;
 }
@@ -583,6 +571,18 @@ bool TransactionEntry::sendINFOAndWaitForOK(unsigned info)
 	return mSIP.sendINFOAndWaitForOK(info);
 }
 
+void TransactionEntry::sendINFO(unsigned info)
+{
+	ScopedLock lock(mLock);
+	mSIP.sendINFO(info);
+}
+
+bool TransactionEntry::waitForINFOOK(unsigned readTimeout)
+{
+	ScopedLock lock(mLock);
+	return mSIP.waitForINFOOK(readTimeout);
+}
+
 void TransactionEntry::SIPUser(const char* IMSI)
 {
 	ScopedLock lock(mLock);
@@ -599,12 +599,7 @@ void TransactionEntry::called(const GSM::L3CalledPartyBCDNumber& wCalled)
 {
 	ScopedLock lock(mLock);
 	mCalled = wCalled;
-
-	char query[151];
-	snprintf(query,150,
-		"UPDATE TRANSACTION_TABLE SET CALLED='%s' WHERE ID=%u",
-		mCalled.digits(), mID);
-	runQuery(query);
+	echoRow();
 }
 
 
@@ -612,12 +607,20 @@ void TransactionEntry::L3TI(unsigned wL3TI)
 {
 	ScopedLock lock(mLock);
 	mL3TI = wL3TI;
+	echoRow();
+}
 
-	char query[151];
-	snprintf(query,150,
-		"UPDATE TRANSACTION_TABLE SET L3TI=%u WHERE ID=%u",
-		mL3TI, mID);
-	runQuery(query);
+
+void TransactionEntry::terminate()
+{
+	const UMTS::LogicalChannel *chan;
+	{
+		ScopedLock lock(mLock);
+		mTerminationRequested=true;
+		chan = mChannel;
+	}
+	// Don't wait for the machine to look; it may not have anything else to wake it.
+	if (chan) gControlEngine.post(chan,ControlMachine::TerminateEvent);
 }
 
 
@@ -650,6 +653,7 @@ TransactionTable::TransactionTable(const char* path)
 	// Clear any previous entires.
 	if (!sqlite3_command(gTransactionTable.DB(),"DELETE FROM TRANSACTION_TABLE"))
 		LOG(WARNING) << "cannot clear previous transaction table";
+	mWriter.open(mDB,gConfig.getNum("Control.NumSQLTries"));
 }
 
 
@@ -658,10 +662,17 @@ TransactionTable::~TransactionTable()
 {
 	// Don't bother disposing of the memory,
 	// since this is only invoked when the application exits.
+	mWriter.close();
 	if (mDB) sqlite3_close(mDB);
 }
 
 
+void TransactionTable::start()
+{
+	mWriter.start(gConfig.getNum("Control.Reporting.TransactionFlushInterval"));
+}
+
+
 
 
 unsigned TransactionTable::newID()
@@ -671,15 +682,42 @@ unsigned TransactionTable::newID()
 }
 
 
+unsigned long TransactionTable::subscriberKey(const GSM::L3MobileIdentity& mobileID)
+{
+	// Only the hash bucket depends on this; the lookups compare the identities.
+	if (mobileID.type()==GSM::TMSIType) return mobileID.TMSI();
+	unsigned long key = 2166136261u ^ mobileID.type();
+	for (const char *dp = mobileID.digits(); *dp; dp++) key = (key ^ *dp) * 16777619u;
+	return key;
+}
+
+
 void TransactionTable::add(TransactionEntry* value)
 {
 	LOG(INFO) << "new transaction " << *value;
 	ScopedLock lock(mLock);
 	mTable[value->ID()]=value;
+	mBySubscriber.insert(subscriberKey(value->subscriber()),value);
+	ScopedLock entryLock(value->mLock);
+	value->mIndexedChannel = value->mChannel;
+	if (value->mIndexedChannel) mByChannel.insert((unsigned long)value->mIndexedChannel,value);
 	value->insertIntoDatabase();
 }
 
 
+void TransactionTable::reindexChannel(TransactionEntry* entry)
+{
+	ScopedLock lock(mLock);
+	TransactionMap::iterator itr = mTable.find(entry->ID());
+	if (itr==mTable.end() || itr->second!=entry) return;	// Not added yet.
+	const UMTS::LogicalChannel* chan = entry->channel();
+	if (chan==entry->mIndexedChannel) return;
+	if (entry->mIndexedChannel) mByChannel.erase((unsigned long)entry->mIndexedChannel,entry);
+	entry->mIndexedChannel = chan;
+	if (chan) mByChannel.insert((unsigned long)chan,entry);
+}
+
+
 
 TransactionEntry* TransactionTable::find(unsigned key)
 {
@@ -701,9 +739,12 @@ TransactionEntry* TransactionTable::find(unsigned key)
 
 void TransactionTable::innerRemove(TransactionMap::iterator itr)
 {
-	LOG(DEBUG) << "removing transaction: " << *(itr->second);
-	gSIPInterface.removeCall(itr->second->SIPCallID());
-	delete itr->second;
+	TransactionEntry* entry = itr->second;
+	LOG(DEBUG) << "removing transaction: " << *entry;
+	mBySubscriber.erase(subscriberKey(entry->subscriber()),entry);
+	if (entry->mIndexedChannel) mByChannel.erase((unsigned long)entry->mIndexedChannel,entry);
+	gSIPInterface.removeCall(entry->SIPCallID());
+	delete entry;
 	mTable.erase(itr);
 }
 
@@ -754,25 +795,36 @@ void TransactionTable::clearDeadEntries()
 }
 
 
+void TransactionTable::sweepDeadEntries()
+{
+	// Caller should hold mLock.
+	if (!mNextSweep.passed()) return;
+	mNextSweep.future(1000);
+	clearDeadEntries();
+}
+
+
+// The lookups below used to scan the whole table in ID order and return the first match,
+// so where several transactions match they return the one with the lowest ID, as before.
 
 
 TransactionEntry* TransactionTable::find(const UMTS::LogicalChannel *chan)
 {
 	LOG(DEBUG) << "by channel: " << *chan << " (" << chan << ")";
 
-	// Yes, it's linear time.
-	// Since clearDeadEntries is also linear, do that here, too.
-	clearDeadEntries();
-
-	// Brute force search.
 	ScopedLock lock(mLock);
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		const UMTS::LogicalChannel* thisChan = itr->second->channel();
-		//LOG(DEBUG) << "looking for " << *chan << " (" << chan << ")" << ", found " << *(thisChan) << " (" << thisChan << ")";
-		if ((void*)thisChan == (void*)chan) return itr->second;
+	sweepDeadEntries();
+	TransactionEntry* found = NULL;
+	unsigned long key = (unsigned long)chan;
+	const TransactionIndex<TransactionEntry>::Bucket& bucket = mByChannel.bucket(key);
+	for (unsigned i=0; i<bucket.size(); i++) {
+		TransactionEntry* entry = bucket[i].mValue;
+		if (bucket[i].mKey!=key || (void*)entry->channel()!=(void*)chan) continue;
+		if (found && found->ID() < entry->ID()) continue;
+		if (entry->dead()) continue;
+		found = entry;
 	}
-	//LOG(DEBUG) << "no match for " << *chan << " (" << chan << ")";
-	return NULL;
+	return found;
 }
 
 
@@ -780,17 +832,20 @@ TransactionEntry* TransactionTable::find(const GSM::L3MobileIdentity& mobileID,
 {
 	LOG(DEBUG) << "by ID and state: " << mobileID << " in " << state;
 
-	// Yes, it's linear time.
-	// Since clearDeadEntries is also linear, do that here, too.
-	clearDeadEntries();
-
-	// Brtue force search.
 	ScopedLock lock(mLock);
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		if (itr->second->GSMState() != state) continue;
-		if (itr->second->subscriber() == mobileID) return itr->second;
+	sweepDeadEntries();
+	TransactionEntry* found = NULL;
+	unsigned long key = subscriberKey(mobileID);
+	const TransactionIndex<TransactionEntry>::Bucket& bucket = mBySubscriber.bucket(key);
+	for (unsigned i=0; i<bucket.size(); i++) {
+		TransactionEntry* entry = bucket[i].mValue;
+		if (bucket[i].mKey!=key || entry->subscriber()!=mobileID) continue;
+		if (entry->GSMState() != state) continue;
+		if (found && found->ID() < entry->ID()) continue;
+		if (entry->dead()) continue;
+		found = entry;
 	}
-	return NULL;
+	return found;
 }
 
 
@@ -800,71 +855,67 @@ TransactionEntry* TransactionTable::find(const GSM::L3MobileIdentity& mobileID,
 	LOG(DEBUG) << "by ID and call-ID: " << mobileID << ", call " << callID;
 
 	string callIDString = string(callID);
-	// Yes, it's linear time.
-	// Since clearDeadEntries is also linear, do that here, too.
-	clearDeadEntries();
-
-	// Brtue force search.
 	ScopedLock lock(mLock);
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		if (itr->second->mSIP.callID() != callIDString) continue;
-		if (itr->second->subscriber() == mobileID) return itr->second;
+	sweepDeadEntries();
+	TransactionEntry* found = NULL;
+	unsigned long key = subscriberKey(mobileID);
+	const TransactionIndex<TransactionEntry>::Bucket& bucket = mBySubscriber.bucket(key);
+	for (unsigned i=0; i<bucket.size(); i++) {
+		TransactionEntry* entry = bucket[i].mValue;
+		if (bucket[i].mKey!=key || entry->subscriber()!=mobileID) continue;
+		if (entry->SIPCallID() != callIDString) continue;
+		if (found && found->ID() < entry->ID()) continue;
+		if (entry->dead()) continue;
+		found = entry;
 	}
-	return NULL;
+	return found;
 }
 
 
 TransactionEntry* TransactionTable::answeredPaging(const GSM::L3MobileIdentity& mobileID)
 {
-	// Yes, it's linear time.
-	// Even in a 6-ARFCN system, it should rarely be more than a dozen entries.
-
-	// Since clearDeadEntries is also linear, do that here, too.
-	clearDeadEntries();
-
-	// Brtue force search.
 	ScopedLock lock(mLock);
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		if (itr->second->GSMState() != GSM::Paging) continue;
-		if (itr->second->subscriber() == mobileID) {
-			// Stop T3113 and change the state.
-			itr->second->GSMState(GSM::AnsweredPaging);
-			itr->second->resetTimer("3113");
-			return itr->second;
-		}
-	}
-	return NULL;
+	TransactionEntry* entry = find(mobileID,GSM::Paging);
+	if (!entry) return NULL;
+	// Stop T3113 and change the state.
+	entry->GSMState(GSM::AnsweredPaging);
+	entry->resetTimer("3113");
+	return entry;
 }
 
 
 UMTS::LogicalChannel* TransactionTable::findChannel(const GSM::L3MobileIdentity& mobileID)
 {
-	// Yes, it's linear time.
-	// Even in a 6-ARFCN system, it should rarely be more than a dozen entries.
-
-	// Since clearDeadEntries is also linear, do that here, too.
-	clearDeadEntries();
-
-	// Brtue force search.
 	ScopedLock lock(mLock);
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		if (itr->second->subscriber() != mobileID) continue;
-		UMTS::LogicalChannel* chan = itr->second->channel();
+	sweepDeadEntries();
+	TransactionEntry* found = NULL;
+	unsigned long key = subscriberKey(mobileID);
+	const TransactionIndex<TransactionEntry>::Bucket& bucket = mBySubscriber.bucket(key);
+	for (unsigned i=0; i<bucket.size(); i++) {
+		TransactionEntry* entry = bucket[i].mValue;
+		if (bucket[i].mKey!=key || entry->subscriber()!=mobileID) continue;
+		UMTS::LogicalChannel* chan = entry->channel();
 		if (!chan) continue;
-		if (chan->type() == UMTS::DTCHType) return chan;
-		if (chan->type() == UMTS::DCCHType) return chan;
+		if (chan->type() != UMTS::DTCHType && chan->type() != UMTS::DCCHType) continue;
+		if (found && found->ID() < entry->ID()) continue;
+		if (entry->dead()) continue;
+		found = entry;
 	}
-	return NULL;
+	return found ? found->channel() : NULL;
 }
 
 
 unsigned TransactionTable::countChan(const UMTS::LogicalChannel* chan)
 {
 	ScopedLock lock(mLock);
-	clearDeadEntries();
+	sweepDeadEntries();
 	unsigned count = 0;
-	for (TransactionMap::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
-		if (itr->second->channel() == chan) count++;
+	unsigned long key = (unsigned long)chan;
+	const TransactionIndex<TransactionEntry>::Bucket& bucket = mByChannel.bucket(key);
+	for (unsigned i=0; i<bucket.size(); i++) {
+		TransactionEntry* entry = bucket[i].mValue;
+		if (bucket[i].mKey!=key || entry->channel()!=chan) continue;
+		if (!entry->dead()) count++;
 	}
 	return count;
 }
@@ -33,6 +33,9 @@
 #include <GSML3CCElements.h>
 #include <SIPEngine.h>
 
+#include "TransactionIndex.h"
+#include "TransactionWriter.h"
+
 
 namespace UMTS {
 class LogicalChannel;
@@ -85,12 +88,16 @@ class TransactionEntry {
 	Timeval mStateTimer;					///< timestamp of last state change.
 	TimerTable mTimers;						///< table of Z100-type state timers
 
-	unsigned mNumSQLTries;					///< number of SQL tries for DB operations
+	unsigned mCreated;						///< time the entry was added to gTransactionTable
+	mutable unsigned mChanged;				///< time of the last state or channel change
 
 	UMTS::LogicalChannel *mChannel;			///< current channel of the transaction
 
 	bool mTerminationRequested;
 
+	bool mInTable;							///< added to gTransactionTable, so mirrored to its database
+	const UMTS::LogicalChannel *mIndexedChannel;	///< key in gTransactionTable's channel index, under its lock
+
 	public:
 
 	/** This form is used for MTC or MT-SMS with TI generated by the network. */
@@ -165,8 +172,8 @@ class TransactionEntry {
 	//@}
 
 
-	/** Initiate the termination process. */
-	void terminate() { ScopedLock lock(mLock); mTerminationRequested=true; }
+	/** Initiate the termination process, and wake up the control machine running the transaction, if any. */
+	void terminate();
 
 	bool terminationRequested();
 
@@ -177,39 +184,42 @@ class TransactionEntry {
 
 	SIP::SIPState MOCSendINVITE(const char* calledUser, const char* calledDomain, short rtpPort, unsigned codec);
 	SIP::SIPState MOCResendINVITE();
-	SIP::SIPState MOCWaitForOK();
+	SIP::SIPState MOCWaitForOK(unsigned readTimeout);
 	SIP::SIPState MOCSendACK();
 	void MOCInitRTP() { ScopedLock lock(mLock); return mSIP.MOCInitRTP(); }
 	SIP::SIPState SOSResendINVITE() { return MOCResendINVITE(); }
-	SIP::SIPState SOSWaitForOK() { return MOCWaitForOK(); }
+	SIP::SIPState SOSWaitForOK(unsigned readTimeout) { return MOCWaitForOK(readTimeout); }
 	SIP::SIPState SOSSendACK() { return MOCSendACK(); }
 	void SOSInitRTP() { MOCInitRTP(); }
 
 
 	SIP::SIPState MTCSendTrying();
 	SIP::SIPState MTCSendRinging();
-	SIP::SIPState MTCWaitForACK();
+	SIP::SIPState MTCWaitForACK(unsigned readTimeout);
 	SIP::SIPState MTCCheckForCancel();
 	SIP::SIPState MTCSendOK(short rtpPort, unsigned codec);
 	void MTCInitRTP() { ScopedLock lock(mLock); mSIP.MTCInitRTP(); }
 
 	SIP::SIPState MODSendBYE();
 	SIP::SIPState MODResendBYE();
-	SIP::SIPState MODWaitForOK();
+	SIP::SIPState MODWaitForOK(bool wait=true);
 
 	SIP::SIPState MTDCheckBYE();
 	SIP::SIPState MTDSendOK();
 
 	// TODO: Remove contentType from here and use the setter above.
 	SIP::SIPState MOSMSSendMESSAGE(const char* calledUser, const char* calledDomain, const char* contentType);
-	SIP::SIPState MOSMSWaitForSubmit();
+	SIP::SIPState MOSMSWaitForSubmit(unsigned readTimeout);
 
 	SIP::SIPState MTSMSSendOK();
 
 	bool sendINFOAndWaitForOK(unsigned info);
+	void sendINFO(unsigned info);
+	bool waitForINFOOK(unsigned readTimeout);
 
 	void txFrame(unsigned char* frame) { return mSIP.txFrame(frame); }
 	int rxFrame(unsigned char* frame) { return mSIP.rxFrame(frame); }
+	int rxPacket(unsigned char* frame, unsigned& timestamp, unsigned& sequence) { return mSIP.rxPacket(frame,timestamp,sequence); }
 	bool startDTMF(char key) { return mSIP.startDTMF(key); }
 	void stopDTMF() { mSIP.stopDTMF(); }
 
@@ -246,6 +256,9 @@ class TransactionEntry {
 	/** Return true if any Q.931 timer is expired. */
 	bool anyTimerExpired() const;
 
+	/** Return the ms until the first active Q.931 timer expires, 0 if one already has, or -1 if none is active. */
+	long timerRemaining() const;
+
 	/** Reset all Q.931 timers. */
 	void resetTimers();
 	
@@ -271,8 +284,11 @@ class TransactionEntry {
 	/** Set up a new entry in gTransactionTable's sqlite3 database. */
 	void insertIntoDatabase();
 
-	/** Run a database query. */
-	void runQuery(const char* query) const;
+	/**
+		Queue the current state of the entry for gTransactionTable's database writer.
+		The caller should hold mLock.
+	*/
+	void echoRow() const;
 
 	/** Echo latest SIPSTATE to the database. */
 	SIP::SIPState echoSIPState(SIP::SIPState state) const;
@@ -287,6 +303,9 @@ class TransactionMap : public std::map<unsigned,TransactionEntry*> {};
 
 /**
 	A table for tracking the states of active transactions.
+	The table in memory is the real one; it is indexed by channel and by subscriber,
+	so the lookups other than by ID only look at the transactions for that channel or subscriber.
+	The sqlite3 database is a copy for outside viewers, written behind by mWriter.
 */
 class TransactionTable {
 
@@ -295,8 +314,13 @@ class TransactionTable {
 	sqlite3 *mDB;			///< database connection
 
 	TransactionMap mTable;
+	TransactionIndex<TransactionEntry> mByChannel;		///< keyed by channel pointer
+	TransactionIndex<TransactionEntry> mBySubscriber;	///< keyed by subscriberKey()
 	mutable Mutex mLock;
 	unsigned mIDCounter;
+	Timeval mNextSweep;		///< next time to look for dead entries
+
+	TransactionWriter mWriter;
 
 	public:
 
@@ -310,6 +334,9 @@ class TransactionTable {
 
 	// TransactionTable does not need a destructor.
 
+	/** Start writing the database. */
+	void start();
+
 	/**
 		Return a new ID for use in the table.
 	*/
@@ -390,6 +417,9 @@ class TransactionTable {
 
 	size_t dump(std::ostream& os) const;
 
+	/** Database writer statistics. */
+	void writerStats(std::ostream& os) const { mWriter.stats(os); }
+
 
 	private:
 
@@ -405,11 +435,24 @@ class TransactionTable {
 	*/
 	void clearDeadEntries();
 
+	/**
+		Call clearDeadEntries if it has not been done in the last second.
+		The lookups skip dead entries, so this just keeps them from piling up.
+		The caller should hold mLock.
+	*/
+	void sweepDeadEntries();
+
 	/**
 		Remove and entry from the table and from gSIPInterface.
 	*/
 	void innerRemove(TransactionMap::iterator);
 
+	/** The key for mBySubscriber. */
+	static unsigned long subscriberKey(const GSM::L3MobileIdentity&);
+
+	/** Move the entry in mByChannel after its channel changed. */
+	void reindexChannel(TransactionEntry*);
+
 };
 
 
@@ -0,0 +1,491 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the TransactionIndex against brute force and the TransactionWriter against the transactions it mirrors,
+// then compare the cost of call setup and teardown with hundreds of transactions in the table, the old way and the new.
+// The old way is what TransactionTable did: lookups scan the whole table under its lock, looking at each entry
+// under the entry's lock, and every change runs an sqlite UPDATE, built with sprintf, before returning.
+// The new way looks in the channel and subscriber indexes and queues rows for a TransactionWriter.
+// Each call is: add, 4 finds by channel, 4 GSM and 4 SIP state changes, a channel change,
+// 2 finds by subscriber and call ID, and remove.  Several threads run calls at once.
+// Usage: TransactionTableTest [database] [calls per thread] [threads]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <sqlite3.h>
+#include <Configuration.h>
+#include <Threads.h>
+#include <Utils.h>
+#include <sqlite3util.h>
+#include <UnitTest.h>
+#include "TransactionIndex.h"
+#include "TransactionWriter.h"
+
+using namespace std;
+using namespace Control;
+
+ConfigurationTable gConfig;
+
+static const char* createTransactionTable = {
+	"CREATE TABLE IF NOT EXISTS TRANSACTION_TABLE ("
+		"ID INTEGER PRIMARY KEY, "
+		"CHANNEL TEXT DEFAULT NULL,"
+		"CREATED INTEGER NOT NULL, "
+		"CHANGED INTEGER NOT NULL, "
+		"TYPE TEXT, "
+		"SUBSCRIBER TEXT, "
+		"L3TI INTEGER, "
+		"SIP_CALLID TEXT, "
+		"SIP_PROXY TEXT, "
+		"CALLED TEXT, "
+		"CALLING TEXT, "
+		"GSMSTATE TEXT, "
+		"SIPSTATE TEXT "
+	")"
+};
+
+static const char *sGSMStates[] = { "MOC initiated", "MOC proceeding", "call delivered", "active" };
+static const char *sSIPStates[] = { "Starting", "Proceeding", "Ringing", "Active" };
+
+// Stands in for a TransactionEntry.
+struct Txn {
+	mutable Mutex mLock;
+	unsigned mID;
+	unsigned long mChannel;		// Stands in for the channel pointer.
+	unsigned long mIndexedChannel;
+	string mSubscriber;
+	string mCallID;
+	unsigned mGSMState, mSIPState;
+
+	unsigned GSMState() const { ScopedLock lock(mLock); return mGSMState; }
+	unsigned long channel() const { return mChannel; }
+
+	TransactionRow row() const {
+		TransactionRow row;
+		row.mID = mID;
+		row.mCreated = row.mChanged = time(NULL);
+		char chan[30];
+		sprintf(chan,"DCCH %lu",mChannel);
+		row.mChannel = chan;
+		row.mType = "MOC";
+		row.mSubscriber = mSubscriber;
+		row.mL3TI = 0;
+		row.mCallID = mCallID;
+		row.mProxy = "127.0.0.1";
+		row.mCalled = "2100";
+		row.mCalling = "";
+		row.mGSMState = sGSMStates[mGSMState];
+		row.mSIPState = sSIPStates[mSIPState];
+		return row;
+	}
+};
+
+static unsigned long subscriberKey(const string& imsi)
+{
+	unsigned long key = 2166136261u;
+	for (const char *dp = imsi.c_str(); *dp; dp++) key = (key ^ *dp) * 16777619u;
+	return key;
+}
+
+// A table of transactions, the old way or the new.
+class Table {
+	public:
+	virtual ~Table() {}
+	virtual void add(Txn*) = 0;
+	virtual Txn* findByChannel(unsigned long chan) = 0;
+	virtual Txn* findBySubscriber(const string& imsi, const string& callID) = 0;
+	virtual void GSMState(Txn*, unsigned) = 0;
+	virtual void SIPState(Txn*, unsigned) = 0;
+	virtual void channel(Txn*, unsigned long) = 0;
+	virtual void remove(Txn*) = 0;
+	virtual const char *name() = 0;
+};
+
+class OldTable : public Table {
+	sqlite3 *mDB;
+	Mutex mLock;
+	map<unsigned,Txn*> mTable;
+
+	void runQuery(const char *query) {
+		for (unsigned i=0; i<3; i++) {
+			if (sqlite3_command(mDB,query)) return;
+		}
+		printf("query failed: %s\n",query);
+	}
+
+	public:
+	OldTable(sqlite3 *wDB) : mDB(wDB) {}
+	const char *name() { return "old"; }
+
+	void add(Txn *txn) {
+		ScopedLock lock(mLock);
+		mTable[txn->mID] = txn;
+		ScopedLock tlock(txn->mLock);
+		char query[500];
+		unsigned now = time(NULL);
+		sprintf(query,"INSERT INTO TRANSACTION_TABLE "
+			"(ID,CREATED,CHANGED,TYPE,SUBSCRIBER,L3TI,CALLED,CALLING,GSMSTATE,SIPSTATE,SIP_CALLID,SIP_PROXY) "
+			"VALUES  (%u,%u,%u,'%s','%s',%u,'%s','%s','%s','%s','%s','%s')",
+			txn->mID,now,now,"MOC",txn->mSubscriber.c_str(),0,"2100","",
+			sGSMStates[txn->mGSMState],sSIPStates[txn->mSIPState],txn->mCallID.c_str(),"127.0.0.1");
+		runQuery(query);
+		sprintf(query,"UPDATE TRANSACTION_TABLE SET CHANNEL='DCCH %lu' WHERE ID=%u",txn->mChannel,txn->mID);
+		runQuery(query);
+	}
+	Txn* findByChannel(unsigned long chan) {
+		ScopedLock lock(mLock);
+		for (map<unsigned,Txn*>::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
+			itr->second->GSMState();	// clearDeadEntries looks at every entry under its lock.
+		}
+		for (map<unsigned,Txn*>::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
+			if (itr->second->channel()==chan) return itr->second;
+		}
+		return NULL;
+	}
+	Txn* findBySubscriber(const string& imsi, const string& callID) {
+		ScopedLock lock(mLock);
+		for (map<unsigned,Txn*>::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
+			itr->second->GSMState();
+		}
+		for (map<unsigned,Txn*>::iterator itr = mTable.begin(); itr!=mTable.end(); ++itr) {
+			Txn *txn = itr->second;
+			ScopedLock tlock(txn->mLock);
+			if (txn->mCallID!=callID) continue;
+			if (txn->mSubscriber==imsi) return txn;
+		}
+		return NULL;
+	}
+	void GSMState(Txn *txn, unsigned state) {
+		ScopedLock tlock(txn->mLock);
+		txn->mGSMState = state;
+		char query[150];
+		sprintf(query,"UPDATE TRANSACTION_TABLE SET GSMSTATE='%s',CHANGED=%u WHERE ID=%u",
+			sGSMStates[state],(unsigned)time(NULL),txn->mID);
+		runQuery(query);
+	}
+	void SIPState(Txn *txn, unsigned state) {
+		ScopedLock tlock(txn->mLock);
+		txn->mSIPState = state;
+		char query[150];
+		sprintf(query,"UPDATE TRANSACTION_TABLE SET SIPSTATE='%s',CHANGED=%u WHERE ID=%u",
+			sSIPStates[state],(unsigned)time(NULL),txn->mID);
+		runQuery(query);
+	}
+	void channel(Txn *txn, unsigned long chan) {
+		ScopedLock tlock(txn->mLock);
+		txn->mChannel = chan;
+		char query[500];
+		sprintf(query,"UPDATE TRANSACTION_TABLE SET CHANGED=%u,CHANNEL='DCCH %lu' WHERE ID=%u",
+			(unsigned)time(NULL),chan,txn->mID);
+		runQuery(query);
+	}
+	void remove(Txn *txn) {
+		ScopedLock lock(mLock);
+		mTable.erase(txn->mID);
+		ScopedLock tlock(txn->mLock);
+		char query[100];
+		sprintf(query,"DELETE FROM TRANSACTION_TABLE WHERE ID=%u",txn->mID);
+		runQuery(query);
+	}
+};
+
+class NewTable : public Table {
+	Mutex mLock;
+	map<unsigned,Txn*> mTable;
+	TransactionIndex<Txn> mByChannel, mBySubscriber;
+
+	public:
+	TransactionWriter mWriter;
+
+	const char *name() { return "new"; }
+
+	void add(Txn *txn) {
+		ScopedLock lock(mLock);
+		mTable[txn->mID] = txn;
+		mBySubscriber.insert(subscriberKey(txn->mSubscriber),txn);
+		ScopedLock tlock(txn->mLock);
+		txn->mIndexedChannel = txn->mChannel;
+		mByChannel.insert(txn->mIndexedChannel,txn);
+		mWriter.write(txn->row());
+	}
+	Txn* findByChannel(unsigned long chan) {
+		ScopedLock lock(mLock);
+		Txn *found = NULL;
+		const TransactionIndex<Txn>::Bucket& bucket = mByChannel.bucket(chan);
+		for (unsigned i=0; i<bucket.size(); i++) {
+			Txn *txn = bucket[i].mValue;
+			if (bucket[i].mKey!=chan || txn->channel()!=chan) continue;
+			if (found && found->mID < txn->mID) continue;
+			txn->GSMState();	// The dead() check.
+			found = txn;
+		}
+		return found;
+	}
+	Txn* findBySubscriber(const string& imsi, const string& callID) {
+		ScopedLock lock(mLock);
+		Txn *found = NULL;
+		unsigned long key = subscriberKey(imsi);
+		const TransactionIndex<Txn>::Bucket& bucket = mBySubscriber.bucket(key);
+		for (unsigned i=0; i<bucket.size(); i++) {
+			Txn *txn = bucket[i].mValue;
+			if (bucket[i].mKey!=key || txn->mSubscriber!=imsi) continue;
+			ScopedLock tlock(txn->mLock);
+			if (txn->mCallID!=callID) continue;
+			if (found && found->mID < txn->mID) continue;
+			found = txn;
+		}
+		return found;
+	}
+	void GSMState(Txn *txn, unsigned state) {
+		ScopedLock tlock(txn->mLock);
+		txn->mGSMState = state;
+		mWriter.write(txn->row());
+	}
+	void SIPState(Txn *txn, unsigned state) {
+		ScopedLock tlock(txn->mLock);
+		txn->mSIPState = state;
+		mWriter.write(txn->row());
+	}
+	void channel(Txn *txn, unsigned long chan) {
+		{
+			ScopedLock tlock(txn->mLock);
+			txn->mChannel = chan;
+			mWriter.write(txn->row());
+		}
+		ScopedLock lock(mLock);
+		mByChannel.erase(txn->mIndexedChannel,txn);
+		txn->mIndexedChannel = chan;
+		mByChannel.insert(chan,txn);
+	}
+	void remove(Txn *txn) {
+		ScopedLock lock(mLock);
+		mTable.erase(txn->mID);
+		mBySubscriber.erase(subscriberKey(txn->mSubscriber),txn);
+		mByChannel.erase(txn->mIndexedChannel,txn);
+		mWriter.remove(txn->mID);
+	}
+};
+
+static Mutex sIDLock;
+static unsigned sNextID = 1000;
+static unsigned long sNextChannel = 0x10000;
+
+static Txn *newTxn()
+{
+	ScopedLock lock(sIDLock);
+	Txn *txn = new Txn;
+	txn->mID = sNextID++;
+	txn->mChannel = txn->mIndexedChannel = sNextChannel += 64;	// Like pointers to channel objects.
+	char buf[40];
+	sprintf(buf,"IMSI0010100000%05u",txn->mID % 100000);
+	txn->mSubscriber = buf;
+	sprintf(buf,"%u@127.0.0.1",(unsigned)random());
+	txn->mCallID = buf;
+	txn->mGSMState = txn->mSIPState = 0;
+	return txn;
+}
+
+static void testIndex()
+{
+	TransactionIndex<Txn> index;
+	multimap<unsigned long,Txn*> model;
+	vector<Txn> txns(2000);
+	for (unsigned n = 0; n < 100000; n++) {
+		Txn *txn = &txns[random() % txns.size()];
+		unsigned long key = (random() % 300) * 64;
+		bool present = false;
+		for (multimap<unsigned long,Txn*>::iterator itr = model.lower_bound(key); itr!=model.upper_bound(key); ++itr) {
+			if (itr->second==txn) { present = true; model.erase(itr); break; }
+		}
+		CHECK(index.erase(key,txn)==present);
+		if (!present) { index.insert(key,txn); model.insert(pair<unsigned long,Txn*>(key,txn)); }
+		CHECK(index.size()==model.size());
+		if (n % 97 == 0) {
+			multiset<Txn*> want, got;
+			for (multimap<unsigned long,Txn*>::iterator itr = model.lower_bound(key); itr!=model.upper_bound(key); ++itr) {
+				want.insert(itr->second);
+			}
+			const TransactionIndex<Txn>::Bucket& bucket = index.bucket(key);
+			for (unsigned i=0; i<bucket.size(); i++) { if (bucket[i].mKey==key) got.insert(bucket[i].mValue); }
+			CHECK(want==got);
+		}
+	}
+}
+
+static map<unsigned,Txn*>::iterator pick(map<unsigned,Txn*>& live)
+{
+	map<unsigned,Txn*>::iterator itr = live.lower_bound(1000 + random() % (sNextID - 1000));
+	return itr==live.end() ? live.begin() : itr;
+}
+
+// Check that after a flush the database holds the rows for the live transactions and nothing else.
+static void checkDatabase(sqlite3 *db, const map<unsigned,Txn*>& live)
+{
+	sqlite3_stmt *stmt;
+	if (sqlite3_prepare_statement(db,&stmt,"SELECT ID,GSMSTATE,SIPSTATE,CHANNEL FROM TRANSACTION_TABLE")) { failures++; return; }
+	unsigned rows = 0, bad = 0;
+	while (sqlite3_run_query(db,stmt)==SQLITE_ROW) {
+		rows++;
+		unsigned id = sqlite3_column_int(stmt,0);
+		map<unsigned,Txn*>::const_iterator itr = live.find(id);
+		if (itr==live.end()) { bad++; continue; }
+		TransactionRow want = itr->second->row();
+		if (want.mGSMState != (const char*)sqlite3_column_text(stmt,1)) bad++;
+		if (want.mSIPState != (const char*)sqlite3_column_text(stmt,2)) bad++;
+		if (want.mChannel != (const char*)sqlite3_column_text(stmt,3)) bad++;
+	}
+	sqlite3_finalize(stmt);
+	CHECK(rows==live.size());
+	CHECK(bad==0);
+}
+
+struct Run {
+	Table *mTable;
+	vector<Txn*> mLive;		// This thread's transactions.
+	unsigned mCalls;
+	double mMaxFind;		// Longest single lookup, in seconds.
+	pthread_t mThread;
+	Run() : mTable(NULL), mCalls(0), mMaxFind(0) {}
+};
+
+static void timedFind(Run *run, Txn *txn, bool bySubscriber)
+{
+	double start = timef();
+	Txn *found = bySubscriber ? run->mTable->findBySubscriber(txn->mSubscriber,txn->mCallID) : run->mTable->findByChannel(txn->channel());
+	double elapsed = timef() - start;
+	if (elapsed > run->mMaxFind) run->mMaxFind = elapsed;
+	if (found!=txn) { failures++; printf("FAIL: %s lookup found the wrong transaction\n",run->mTable->name()); }
+}
+
+static void *runCalls(void *arg)
+{
+	Run *run = (Run*)arg;
+	Table *table = run->mTable;
+	for (unsigned n = 0; n < run->mCalls; n++) {
+		// Tear down one of the calls in progress and set up another in its place.
+		unsigned which = random() % run->mLive.size();
+		Txn *old = run->mLive[which];
+		table->remove(old);
+		delete old;
+		Txn *txn = newTxn();
+		run->mLive[which] = txn;
+		table->add(txn);
+		for (unsigned s = 0; s < 4; s++) {
+			timedFind(run,txn,false);
+			table->GSMState(txn,s);
+			table->SIPState(txn,s);
+		}
+		table->channel(txn,txn->channel()+32);	// Moved to a traffic channel.
+		timedFind(run,txn,true);
+		timedFind(run,txn,true);
+	}
+	return NULL;
+}
+
+static void bench(Table *table, unsigned live, unsigned calls, unsigned numThreads)
+{
+	vector<Run> runs(numThreads);
+	for (unsigned t = 0; t < numThreads; t++) {
+		runs[t].mTable = table;
+		runs[t].mCalls = calls;
+		for (unsigned n = 0; n < live / numThreads; n++) {
+			Txn *txn = newTxn();
+			runs[t].mLive.push_back(txn);
+			table->add(txn);
+		}
+	}
+	double start = timef();
+	for (unsigned t = 0; t < numThreads; t++) { pthread_create(&runs[t].mThread,NULL,runCalls,&runs[t]); }
+	double maxFind = 0;
+	for (unsigned t = 0; t < numThreads; t++) {
+		pthread_join(runs[t].mThread,NULL);
+		if (runs[t].mMaxFind > maxFind) maxFind = runs[t].mMaxFind;
+	}
+	double elapsed = timef() - start;
+	printf("%s: %u transactions, %u threads: %.0f setup+teardown/sec, longest lookup %.2f ms\n",
+		table->name(),live,numThreads,numThreads*calls/elapsed,1000*maxFind);
+	for (unsigned t = 0; t < numThreads; t++) {
+		for (unsigned n = 0; n < runs[t].mLive.size(); n++) { table->remove(runs[t].mLive[n]); delete runs[t].mLive[n]; }
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "/var/tmp/TransactionTableTest.db";
+	unsigned calls = argc > 2 ? atoi(argv[2]) : 50;
+	unsigned numThreads = argc > 3 ? atoi(argv[3]) : 4;
+	srandom(1);
+	testIndex();
+
+	unlink(path);
+	sqlite3 *db;
+	if (sqlite3_open(path,&db)) { printf("cannot open %s\n",path); return 1; }
+	if (!sqlite3_command(db,createTransactionTable)) { printf("cannot create table\n"); return 1; }
+
+	// The writer mirrors the table.
+	{
+		NewTable table;
+		CHECK(table.mWriter.open(db,3));
+		table.mWriter.start(20);
+		map<unsigned,Txn*> live;
+		for (unsigned n = 0; n < 3000; n++) {
+			if (live.size() > 200 && random() % 3 == 0) {
+				map<unsigned,Txn*>::iterator itr = pick(live);
+				table.remove(itr->second);
+				delete itr->second;
+				live.erase(itr);
+			} else if (live.size() && random() % 2) {
+				Txn *txn = pick(live)->second;
+				table.GSMState(txn,random() % 4);
+				table.SIPState(txn,random() % 4);
+			} else {
+				Txn *txn = newTxn();
+				live[txn->mID] = txn;
+				table.add(txn);
+			}
+			if (n % 500 == 0) usleep(30000);	// Let some flushes happen in the middle.
+		}
+		table.mWriter.stop();
+		checkDatabase(db,live);
+		table.mWriter.stats(cout);
+		cout << endl;
+		for (map<unsigned,Txn*>::iterator itr = live.begin(); itr!=live.end(); ++itr) { table.remove(itr->second); delete itr->second; }
+		table.mWriter.flush();
+		checkDatabase(db,map<unsigned,Txn*>());
+		table.mWriter.close();
+	}
+
+	unsigned sizes[] = { 100, 500 };
+	for (unsigned i = 0; i < 2; i++) {
+		OldTable old(db);
+		bench(&old,sizes[i],calls,numThreads);
+		NewTable table;
+		table.mWriter.open(db,3);
+		table.mWriter.start(250);
+		bench(&table,sizes[i],calls * 20,numThreads);
+		table.mWriter.close();
+		table.mWriter.stats(cout);
+		cout << endl;
+	}
+	sqlite3_close(db);
+	unlink(path);
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
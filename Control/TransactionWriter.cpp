@@ -0,0 +1,121 @@
+/**@file Background writer for the transaction table database. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "TransactionWriter.h"
+
+#include <sqlite3.h>
+#include <sqlite3util.h>
+
+#include <Logger.h>
+
+
+using namespace std;
+using namespace Control;
+
+
+static const char* replaceRow =
+	"INSERT OR REPLACE INTO TRANSACTION_TABLE "
+	"(ID,CHANNEL,CREATED,CHANGED,TYPE,SUBSCRIBER,L3TI,SIP_CALLID,SIP_PROXY,CALLED,CALLING,GSMSTATE,SIPSTATE) "
+	"VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?)";
+
+static const char* deleteRow = "DELETE FROM TRANSACTION_TABLE WHERE ID=?";
+
+
+TransactionWriter::TransactionWriter()
+	:WriteBehind<unsigned,TransactionRow>("transaction table"),
+	mReplaceStmt(NULL),mDeleteStmt(NULL)
+{ }
+
+
+TransactionWriter::~TransactionWriter()
+{
+	close();
+}
+
+
+void TransactionWriter::close()
+{
+	stop();
+	writeTo(NULL);
+	if (mReplaceStmt) sqlite3_finalize(mReplaceStmt);
+	if (mDeleteStmt) sqlite3_finalize(mDeleteStmt);
+	mReplaceStmt = mDeleteStmt = NULL;
+}
+
+
+bool TransactionWriter::open(sqlite3 *wDB, unsigned wNumTries)
+{
+	unsigned numTries = wNumTries ? wNumTries : 1;
+	if (!wDB) return false;
+	if (sqlite3_prepare_statement(wDB,&mReplaceStmt,replaceRow,numTries) ||
+		sqlite3_prepare_statement(wDB,&mDeleteStmt,deleteRow,numTries)) {
+		LOG(ALERT) << "cannot prepare transaction table statements: " << sqlite3_errmsg(wDB);
+		mReplaceStmt = mDeleteStmt = NULL;
+		return false;
+	}
+	writeTo(wDB,numTries,numTries);
+	return true;
+}
+
+
+void TransactionWriter::remove(unsigned ID)
+{
+	TransactionRow row;
+	row.mID = ID;
+	row.mDeleted = true;
+	queue(ID,row);
+}
+
+
+static void bindText(sqlite3_stmt *stmt, int col, const string& value)
+{
+	sqlite3_bind_text(stmt,col,value.data(),value.size(),SQLITE_STATIC);
+}
+
+
+bool TransactionWriter::writeRow(const unsigned& ID, const TransactionRow& row)
+{
+	if (row.mDeleted) {
+		sqlite3_bind_int64(mDeleteStmt,1,ID);
+		return runStatement(mDeleteStmt);
+	}
+	sqlite3_stmt *stmt = mReplaceStmt;
+	sqlite3_bind_int64(stmt,1,ID);
+	if (row.mChannel.empty()) sqlite3_bind_null(stmt,2);
+	else bindText(stmt,2,row.mChannel);
+	sqlite3_bind_int64(stmt,3,row.mCreated);
+	sqlite3_bind_int64(stmt,4,row.mChanged);
+	bindText(stmt,5,row.mType);
+	bindText(stmt,6,row.mSubscriber);
+	sqlite3_bind_int64(stmt,7,row.mL3TI);
+	bindText(stmt,8,row.mCallID);
+	bindText(stmt,9,row.mProxy);
+	bindText(stmt,10,row.mCalled);
+	bindText(stmt,11,row.mCalling);
+	bindText(stmt,12,row.mGSMState);
+	bindText(stmt,13,row.mSIPState);
+	return runStatement(stmt);
+}
+
+
+void TransactionWriter::stats(ostream& os) const
+{
+	os << "queued=" << queued() << " written=" << written() << " flushes=" << flushes()
+		<< " pending=" << pending() << " interval=" << interval() << "ms";
+}
+
+
+// vim: ts=4 sw=4
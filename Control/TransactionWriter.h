@@ -0,0 +1,90 @@
+/**@file Background writer for the transaction table database. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef TRANSACTIONWRITER_H
+#define TRANSACTIONWRITER_H
+
+#include <string>
+#include <map>
+#include <ostream>
+#include <WriteBehind.h>
+
+namespace Control {
+
+/** One row of TRANSACTION_TABLE. */
+struct TransactionRow {
+	unsigned mID;
+	bool mDeleted;				///< delete the row instead of writing it
+	unsigned mCreated;
+	unsigned mChanged;
+	std::string mChannel;		///< empty for NULL
+	std::string mType;
+	std::string mSubscriber;
+	unsigned mL3TI;
+	std::string mCallID;
+	std::string mProxy;
+	std::string mCalled;
+	std::string mCalling;
+	std::string mGSMState;
+	std::string mSIPState;
+
+	TransactionRow() : mID(0), mDeleted(false), mCreated(0), mChanged(0), mL3TI(0) {}
+};
+
+
+/**
+	Mirrors the in-memory TransactionTable to its sqlite3 database from a background thread.
+	The TransactionTable is the authoritative copy; the database is only for outside viewers,
+	so callers queue the current row for a transaction and go on without waiting for sqlite.
+	Rows are keyed by transaction ID, so only the last one queued between flushes is written.
+*/
+class TransactionWriter : public WriteBehind<unsigned,TransactionRow> {
+
+	private:
+
+	sqlite3_stmt *mReplaceStmt;
+	sqlite3_stmt *mDeleteStmt;
+
+	bool writeRow(const unsigned& ID, const TransactionRow& row);
+
+	public:
+
+	TransactionWriter();
+	~TransactionWriter();
+
+	/**
+		Use this database, which already has TRANSACTION_TABLE.  Return false if the statements cannot be prepared.
+		A flush that fails wNumTries times in a row drops its rows.
+	*/
+	bool open(sqlite3 *wDB, unsigned wNumTries);
+
+	/** Stop and let go of the database, which can then be closed. */
+	void close();
+
+	/** Queue the row, replacing any row queued for the same transaction. */
+	void write(const TransactionRow& row) { queue(row.mID,row); }
+
+	/** Queue the deletion of the row for this transaction. */
+	void remove(unsigned ID);
+
+	void stats(std::ostream&) const;
+};
+
+}	// Control
+
+#endif
+
+// vim: ts=4 sw=4
@@ -65,6 +65,18 @@ void L3LocationAreaIdentity::parseV( const L3Frame& src, size_t &rp )
 	mLAC = src.readField(rp, 16);
 }
 
+void L3LocationAreaIdentity::decodeV(const unsigned char *value)
+{
+	// The same digit order as parseV.
+	mMCC[1] = value[0] >> 4;
+	mMCC[0] = value[0] & 0x0f;
+	mMNC[2] = value[1] >> 4;
+	mMCC[2] = value[1] & 0x0f;
+	mMNC[1] = value[2] >> 4;
+	mMNC[0] = value[2] & 0x0f;
+	mLAC = (value[3] << 8) | value[4];
+}
+
 
 bool L3LocationAreaIdentity::operator==(const L3LocationAreaIdentity& other) const
 {
@@ -211,6 +223,44 @@ void L3MobileIdentity::parseV( const L3Frame& src, size_t &rp, size_t expectedLe
 	}
 }
 
+
+bool L3MobileIdentity::decodeV(const unsigned char *value, size_t length)
+{
+	// See GSM 04.08 10.5.1.4, and parseV, which this must match.
+	if (length==0) return true;
+
+	// The first digit is in the high half of the first octet.
+	int numDigits = 0;
+	mDigits[numDigits++] = (value[0] >> 4) + '0';
+	bool oddCount = value[0] & 0x08;
+	mType = (MobileIDType)(value[0] & 0x07);
+
+	switch (mType) {
+		case TMSIType:
+			mDigits[0]='\0';
+			if (length!=5) return false;
+			mTMSI = (value[1]<<24) | (value[2]<<16) | (value[3]<<8) | value[4];
+			return true;
+		case IMSIType:
+		case IMEISVType:
+		case IMEIType:
+			// GSM 03.03 2.2: at most 15 digits.
+			if (length>8) return false;
+			for (size_t i=1; i<length; i++) {
+				mDigits[numDigits++] = (value[i] & 0x0f) + '0';
+				mDigits[numDigits++] = (value[i] >> 4) + '0';
+			}
+			if (!oddCount) numDigits--;
+			mDigits[numDigits]='\0';
+			return true;
+		default:
+			LOG(NOTICE) << "non-standard identity type " << (int)mType;
+			mDigits[0]='\0';
+			mType = NoIDType;
+			return length==1;
+	}
+}
+
 void L3MobileIdentity::text(ostream& os) const
 {
 	os << mType << "=";
@@ -232,6 +282,14 @@ void L3MobileStationClassmark1::parseV(const L3Frame& src, size_t& rp)
 	mRFPowerCapability = src.readField(rp,3);
 }
 
+void L3MobileStationClassmark1::decodeV(const unsigned char *value)
+{
+	mRevisionLevel = (value[0] >> 5) & 0x03;
+	mES_IND = (value[0] >> 4) & 0x01;
+	mA5_1 = (value[0] >> 3) & 0x01;
+	mRFPowerCapability = value[0] & 0x07;
+}
+
 void L3MobileStationClassmark1::text(ostream& os) const
 {
 	os << "revision=" << mRevisionLevel;
@@ -275,6 +333,28 @@ void L3MobileStationClassmark2::parseV(const L3Frame& src, size_t& rp, size_t le
 	rp += len*8;
 }
 
+void L3MobileStationClassmark2::decodeV(const unsigned char *value, size_t length)
+{
+	unsigned char octets[3] = { 0, 0, 0 };
+	for (size_t i=0; i<length && i<3; i++) octets[i] = value[i];
+	mRevisionLevel = (octets[0] >> 5) & 0x03;
+	mES_IND = (octets[0] >> 4) & 0x01;
+	mA5_1 = (octets[0] >> 3) & 0x01;
+	mRFPowerCapability = octets[0] & 0x07;
+	mPSCapability = (octets[1] >> 6) & 0x01;
+	mSSScreenIndicator = (octets[1] >> 4) & 0x03;
+	mSMCapability = (octets[1] >> 3) & 0x01;
+	mVBS = (octets[1] >> 2) & 0x01;
+	mVGCS = (octets[1] >> 1) & 0x01;
+	mFC = octets[1] & 0x01;
+	mCM3 = (octets[2] >> 7) & 0x01;
+	mLCSVACapability = (octets[2] >> 5) & 0x01;
+	mSoLSA = (octets[2] >> 3) & 0x01;
+	mCMSF = (octets[2] >> 2) & 0x01;
+	mA5_3 = (octets[2] >> 1) & 0x01;
+	mA5_2 = octets[2] & 0x01;
+}
+
 void L3MobileStationClassmark2::text(ostream& os) const
 {
 	os << "revision=" << mRevisionLevel;
@@ -75,6 +75,11 @@ class L3LocationAreaIdentity : public L3ProtocolElement {
 		unsigned wLAC = gConfig.getNum("UMTS.Identity.LAC")
 	);
 
+	/** Initialize the LAI from packed octets, for L3DecodedMessage, without gConfig. */
+	explicit L3LocationAreaIdentity(const unsigned char *value)
+		:L3ProtocolElement()
+	{ decodeV(value); }
+
 	/** Sometimes we need to compare these things. */
 	bool operator==(const L3LocationAreaIdentity&) const;
 
@@ -84,6 +89,9 @@ class L3LocationAreaIdentity : public L3ProtocolElement {
 	void writeV(L3Frame& dest, size_t &wp) const;
 	void text(std::ostream&) const;
 
+	/** Decode the value part from packed octets, for L3DecodedMessage. */
+	void decodeV(const unsigned char *value);
+
 	int MCC() const { return mMCC[0]*100 + mMCC[1]*10 + mMCC[2]; }
 	int MNC() const;
 	int LAC() const { return mLAC; }
@@ -145,6 +153,12 @@ class L3MobileIdentity : public L3ProtocolElement {
 	void parseV( const L3Frame& src, size_t &rp, size_t expectedLength );
 	void parseV(const L3Frame&, size_t&) { abort(); }
 	void text(std::ostream&) const;
+
+	/**
+		Decode the value part from packed octets, for L3DecodedMessage.
+		@return false where parseLV would throw.
+	*/
+	bool decodeV(const unsigned char *value, size_t length);
 };
 
 
@@ -169,6 +183,9 @@ class L3MobileStationClassmark1 : public L3ProtocolElement {
 	void parseV(const L3Frame&, size_t&, size_t) { assert(0); }
 	void text(std::ostream&) const;
 
+	/** Decode the value part from packed octets, for L3DecodedMessage. */
+	void decodeV(const unsigned char *value);
+
 };
 
 /**
@@ -197,12 +214,25 @@ class L3MobileStationClassmark2 : public L3ProtocolElement {
 
 	public:
 
+	/** All zero, as a classmark sent with no value part decodes. */
+	L3MobileStationClassmark2()
+		:mRevisionLevel(0),mES_IND(0),mA5_1(0),mA5_3(0),mA5_2(0),mRFPowerCapability(0),
+		mPSCapability(0),mSSScreenIndicator(0),mSMCapability(0),mVBS(0),mVGCS(0),mFC(0),
+		mCM3(0),mLCSVACapability(0),mSoLSA(0),mCMSF(0)
+	{ }
+
 	size_t lengthV() const { return 3; }	
 	void writeV(L3Frame&, size_t&) const { assert(0); }
 	void parseV(const L3Frame &src, size_t &rp);
 	void parseV(const L3Frame&, size_t&, size_t);
 	void text(std::ostream&) const;
 
+	/**
+		Decode the value part from packed octets, for L3DecodedMessage.
+		Octets missing from a short value part are taken as zero; extra ones are ignored.
+	*/
+	void decodeV(const unsigned char *value, size_t length);
+
 	// These return true if the encryption type is supported.
 	bool A5_1() const { return mA5_1==0; }
 	bool A5_2() const { return mA5_2!=0; }
@@ -0,0 +1,235 @@
+/**@file Table-driven decoding of the most frequent uplink L3 messages, without the heap. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "GSML3Decoder.h"
+#include "GSML3MMMessages.h"
+#include "GSML3RRMessages.h"
+#include <Logger.h>
+
+
+using namespace std;
+using namespace GSM;
+
+
+
+/**@name The element tables. */
+//@{
+
+/** Where a decoded value part goes. */
+enum IEField {
+	NoField,
+	UpdatingTypeField,
+	CipheringKeySequenceField,
+	ServiceTypeField,
+	LAIField,
+	Classmark1Field,
+	Classmark2Field,
+	MobileIDField,
+	RPDUField
+};
+
+/** The formats of the mandatory elements, GSM 04.07 11.2.1.1.4. */
+enum IEFormat {
+	HalfOctetsFormat,		///< two type 1 V elements sharing an octet, the first in the low half
+	VFormat,				///< fixed length value
+	LVFormat				///< length and value
+};
+
+struct IEDescriptor {
+	IEFormat mFormat;
+	unsigned mLength;		///< V only
+	IEField mField;			///< or the low half-octet
+	IEField mHighField;		///< the high half-octet
+};
+
+struct MessageDescriptor {
+	L3DecodedMessage::Kind mKind;
+	L3PD mPD;
+	unsigned mMTIMask;
+	unsigned mMTI;
+	const IEDescriptor *mIEs;
+	unsigned mNumIEs;
+};
+
+static const IEDescriptor sLocationUpdatingRequestIEs[] = {
+	{ HalfOctetsFormat, 1, UpdatingTypeField, CipheringKeySequenceField },
+	{ VFormat, 5, LAIField, NoField },
+	{ VFormat, 1, Classmark1Field, NoField },
+	{ LVFormat, 0, MobileIDField, NoField },
+};
+
+static const IEDescriptor sCMServiceRequestIEs[] = {
+	{ HalfOctetsFormat, 1, ServiceTypeField, CipheringKeySequenceField },
+	// The parsers treat classmark 2 as LV, and so does the spec.
+	{ LVFormat, 0, Classmark2Field, NoField },
+	{ LVFormat, 0, MobileIDField, NoField },
+};
+
+static const IEDescriptor sIMSIDetachIndicationIEs[] = {
+	{ VFormat, 1, Classmark1Field, NoField },
+	{ LVFormat, 0, MobileIDField, NoField },
+};
+
+static const IEDescriptor sPagingResponseIEs[] = {
+	{ HalfOctetsFormat, 1, CipheringKeySequenceField, NoField },
+	{ LVFormat, 0, Classmark2Field, NoField },
+	{ LVFormat, 0, MobileIDField, NoField },
+};
+
+static const IEDescriptor sCPDataIEs[] = {
+	{ LVFormat, 0, RPDUField, NoField },
+};
+
+#define IE_COUNT(table) (sizeof(table)/sizeof(table[0]))
+
+static const MessageDescriptor sMessages[] = {
+	// The MM message types have the send sequence number in bit 7, as parseL3MM masks it.
+	{ L3DecodedMessage::LocationUpdatingRequest, L3MobilityManagementPD, 0xbf,
+		L3MMMessage::LocationUpdatingRequest, sLocationUpdatingRequestIEs, IE_COUNT(sLocationUpdatingRequestIEs) },
+	{ L3DecodedMessage::CMServiceRequest, L3MobilityManagementPD, 0xbf,
+		L3MMMessage::CMServiceRequest, sCMServiceRequestIEs, IE_COUNT(sCMServiceRequestIEs) },
+	{ L3DecodedMessage::IMSIDetachIndication, L3MobilityManagementPD, 0xbf,
+		L3MMMessage::IMSIDetachIndication, sIMSIDetachIndicationIEs, IE_COUNT(sIMSIDetachIndicationIEs) },
+	{ L3DecodedMessage::PagingResponse, L3RadioResourcePD, 0xff,
+		L3RRMessage::PagingResponse, sPagingResponseIEs, IE_COUNT(sPagingResponseIEs) },
+	// CP-DATA is 0x01, GSM 04.11 8.1.3.
+	{ L3DecodedMessage::CPData, L3SMSPD, 0xff, 0x01, sCPDataIEs, IE_COUNT(sCPDataIEs) },
+};
+
+/** The table entry for this header, or NULL. */
+static const MessageDescriptor* findMessage(L3PD PD, unsigned MTI)
+{
+	for (unsigned i=0; i<IE_COUNT(sMessages); i++) {
+		const MessageDescriptor &candidate = sMessages[i];
+		if (candidate.mPD==PD && (MTI & candidate.mMTIMask)==candidate.mMTI) return &candidate;
+	}
+	return NULL;
+}
+
+//@}
+
+
+
+L3DecodedMessage::L3DecodedMessage()
+	:mKind(NotDecoded),mPD(L3UndefinedPD),mTI(0),mMTI(0),mLength(0),
+	mUpdatingType(0),mCipheringKeySequence(0),
+	mHaveLAI(false),mLAIOffset(0),
+	mRPDUOffset(0),mRPDULength(0)
+{ }
+
+
+L3DecodedMessage::Kind L3DecodedMessage::kindOf(const L3Frame& source)
+{
+	if (source.size()<16) return NotDecoded;
+	const MessageDescriptor *message = findMessage(source.PD(),source.MTI());
+	return message ? message->mKind : NotDecoded;
+}
+
+
+bool L3DecodedMessage::decode(const L3Frame& source)
+{
+	mKind = NotDecoded;
+	mLength = source.size()/8;
+	if (mLength<2) return true;
+	mPD = source.PD();
+	mTI = source.peekField(0,4);
+	mMTI = source.MTI();
+	const MessageDescriptor *message = findMessage(mPD,mMTI);
+	// pack() writes a partial last octet too.
+	if (!message || (source.size()+7)/8>MaxOctets) return true;
+	source.pack(mOctets);
+
+	mKind = message->mKind;
+	mMTI &= message->mMTIMask;
+	// An element left out by a short LV keeps its empty value, not the last message's.
+	mHaveLAI = false;
+	mClassmark2 = L3MobileStationClassmark2();
+	mMobileID = L3MobileIdentity();
+	mRPDULength = 0;
+	unsigned rp = 2;
+	for (unsigned i=0; i<message->mNumIEs; i++) {
+		const IEDescriptor &ie = message->mIEs[i];
+		switch (ie.mFormat) {
+			case HalfOctetsFormat: {
+				if (rp>=mLength) return false;
+				unsigned char high = mOctets[rp] >> 4;
+				if (!store(ie.mField,&mOctets[rp],0)) return false;
+				if (!store(ie.mHighField,&high,0)) return false;
+				rp++;
+				break;
+			}
+			case VFormat:
+				if (rp+ie.mLength>mLength) return false;
+				if (!store(ie.mField,&mOctets[rp],ie.mLength)) return false;
+				rp += ie.mLength;
+				break;
+			case LVFormat: {
+				if (rp>=mLength) return false;
+				unsigned length = mOctets[rp++];
+				if (rp+length>mLength) return false;
+				if (!store(ie.mField,&mOctets[rp],length)) return false;
+				rp += length;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+
+bool L3DecodedMessage::store(unsigned field, const unsigned char *value, unsigned length)
+{
+	switch ((IEField)field) {
+		case NoField: return true;
+		// The half-octets are in the low half of value[0].
+		case UpdatingTypeField: mUpdatingType = value[0] & 0x0f; return true;
+		case CipheringKeySequenceField: mCipheringKeySequence = value[0] & 0x0f; return true;
+		case ServiceTypeField:
+			mServiceType = L3CMServiceType((L3CMServiceType::TypeCode)(value[0] & 0x0f));
+			return true;
+		case LAIField:
+			mHaveLAI = true;
+			mLAIOffset = value - mOctets;
+			return true;
+		case Classmark1Field: mClassmark1.decodeV(value); return true;
+		case Classmark2Field: mClassmark2.decodeV(value,length); return true;
+		case MobileIDField: return mMobileID.decodeV(value,length);
+		case RPDUField:
+			mRPDUOffset = value - mOctets;
+			mRPDULength = length;
+			return true;
+	}
+	return false;
+}
+
+
+
+ostream& GSM::operator<<(ostream& os, L3DecodedMessage::Kind kind)
+{
+	switch (kind) {
+		case L3DecodedMessage::NotDecoded: os << "not decoded"; break;
+		case L3DecodedMessage::LocationUpdatingRequest: os << "Location Updating Request"; break;
+		case L3DecodedMessage::CMServiceRequest: os << "CM Service Request"; break;
+		case L3DecodedMessage::IMSIDetachIndication: os << "IMSI Detach Indication"; break;
+		case L3DecodedMessage::PagingResponse: os << "Paging Response"; break;
+		case L3DecodedMessage::CPData: os << "CP-DATA"; break;
+		default: os << "?" << (int)kind << "?";
+	}
+	return os;
+}
+
+
+// vim: ts=4 sw=4
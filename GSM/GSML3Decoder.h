@@ -0,0 +1,121 @@
+/**@file Table-driven decoding of the most frequent uplink L3 messages, without the heap. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef GSML3DECODER_H
+#define GSML3DECODER_H
+
+#include "GSML3Message.h"
+#include "GSML3CommonElements.h"
+#include "GSML3MMElements.h"
+
+
+namespace GSM {
+
+
+/**
+	One uplink L3 message decoded from the octets of its frame.
+	The generic parsers walk the frame a bit at a time and build a new message object
+	from the factory for every message; registration and SMS storms are made of
+	just a few message types, so those are decoded here instead, in one pass over the
+	packed octets, driven by a table of the information elements of each message.
+	The result is meant to live on the stack; the message classes of the decoded types
+	have constructors that take it, and parseL3 uses those.
+	Only the mandatory elements are decoded, as in the generic parsers.
+*/
+class L3DecodedMessage {
+
+	public:
+
+	/** The messages decoded here. */
+	enum Kind {
+		NotDecoded,						///< anything else; use parseL3
+		LocationUpdatingRequest,		///< GSM 04.08 9.2.15
+		CMServiceRequest,				///< GSM 04.08 9.2.9
+		IMSIDetachIndication,			///< GSM 04.08 9.2.12
+		PagingResponse,					///< GSM 04.08 9.1.25
+		CPData							///< GSM 04.11 7.2.1
+	};
+
+	/** The largest L3 message, in octets. */
+	static const unsigned MaxOctets = 256;
+
+	private:
+
+	Kind mKind;
+	L3PD mPD;
+	unsigned mTI;							///< the whole first half-octet of the header
+	unsigned mMTI;
+	unsigned char mOctets[MaxOctets];		///< the packed frame
+	unsigned mLength;						///< octets in the frame
+
+	public:
+
+	/**@name The decoded elements, as far as the message has them. */
+	//@{
+	unsigned mUpdatingType;					///< location updating type, 10.5.3.5
+	unsigned mCipheringKeySequence;			///< 10.5.1.2
+	L3CMServiceType mServiceType;
+	bool mHaveLAI;							///< false if the message has no LAI
+	unsigned mLAIOffset;					///< the LAI value part, 10.5.1.3, in mOctets
+	L3MobileStationClassmark1 mClassmark1;
+	L3MobileStationClassmark2 mClassmark2;
+	L3MobileIdentity mMobileID;
+	unsigned mRPDUOffset;					///< CP-User Data, in mOctets
+	unsigned mRPDULength;
+	//@}
+
+	L3DecodedMessage();
+
+	/**
+		The kind of message in a frame, from its header alone.
+		Callers check this first so that other messages are not packed for nothing.
+	*/
+	static Kind kindOf(const L3Frame& source);
+
+	/**
+		Decode a frame.
+		@return False if the frame is one of the messages decoded here but is malformed.
+		If the frame is some other message, this returns true with kind() NotDecoded.
+	*/
+	bool decode(const L3Frame& source);
+
+	Kind kind() const { return mKind; }
+	L3PD PD() const { return mPD; }
+	unsigned TI() const { return mTI; }
+	unsigned MTI() const { return mMTI; }
+
+	/** The packed LAI, for L3LocationAreaIdentity::decodeV, if mHaveLAI. */
+	const unsigned char* LAI() const { return mOctets + mLAIOffset; }
+
+	/** The RPDU of a CP-DATA message. */
+	const unsigned char* RPDU() const { return mOctets + mRPDUOffset; }
+
+	private:
+
+	/** Store one value part found by the element table. */
+	bool store(unsigned field, const unsigned char *value, unsigned length);
+};
+
+
+std::ostream& operator<<(std::ostream& os, L3DecodedMessage::Kind);
+
+
+}; // GSM
+
+
+#endif
+
+// vim: ts=4 sw=4
@@ -0,0 +1,404 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check L3DecodedMessage against the bit-by-bit parsers, then time them both.
+// The fuzz builds random registrations, service requests, detaches, paging responses and
+// CP-DATAs, mangles some octets, and has both decode each one: both must accept or reject it,
+// and an accepted one must come out the same.  The old parsers assert on a frame that ends
+// inside an element, so frames are padded, and the ones that would still run off the end only
+// go to the new decoder, which must reject them.
+// The benchmark decodes a mix of the same messages, valid, in a loop: the old way, a factory
+// object parsed from the bits, then the new decoder into a heap object, as parseL3 does now,
+// and into one on the stack, as the DCCH dispatcher does.  It reports messages per second.
+// Build with the GSM L3 sources, SMS/SMSMessages.cpp, SMS/SMSTransfer.cpp and CommonLibs.
+// Usage: GSML3DecoderTest [fuzz frames] [benchmark seconds]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <vector>
+#include <Configuration.h>
+#include <Utils.h>
+#include "GSML3Decoder.h"
+#include "GSML3MMMessages.h"
+#include "GSML3RRMessages.h"
+#include <SMSMessages.h>
+#include <UnitTest.h>
+
+using namespace std;
+using namespace GSM;
+
+ConfigurationTable gConfig;
+
+
+static L3Frame frameOf(const unsigned char *octets, unsigned length)
+{
+	L3Frame frame(DATA,length*8);
+	frame.unpack(octets);
+	return frame;
+}
+
+template <class T> static string textOf(const T& thing)
+{
+	ostringstream os;
+	os << thing;
+	return os.str();
+}
+
+
+static void testKnown()
+{
+	// A location updating request with an IMSI.
+	const unsigned char lur[] = { 0x05, 0x08, 0x70, 0x00, 0xf1, 0x10, 0x03, 0xe9, 0x57,
+		0x08, 0x09, 0x10, 0x10, 0x10, 0x32, 0x54, 0x76, 0x98 };
+	L3DecodedMessage decoded;
+	CHECK(decoded.decode(frameOf(lur,sizeof(lur))));
+	CHECK(decoded.kind()==L3DecodedMessage::LocationUpdatingRequest);
+	CHECK(decoded.mUpdatingType==0 && decoded.mCipheringKeySequence==7);
+	CHECK(decoded.mHaveLAI);
+	CHECK(decoded.mMobileID.type()==IMSIType);
+	CHECK(strcmp(decoded.mMobileID.digits(),"001010123456789")==0);
+	L3LocationUpdatingRequest message(decoded);
+	CHECK(message.mobileID()==decoded.mMobileID);
+	CHECK(message.LAI().MCC()==1 && message.LAI().MNC()==1 && message.LAI().LAC()==1001);
+
+	// The send sequence number does not change the type.
+	const unsigned char cmsrq[] = { 0x05, 0x64, 0x71, 0x03, 0x57, 0x18, 0x81,
+		0x05, 0xf4, 0x12, 0x34, 0x56, 0x78 };
+	CHECK(decoded.decode(frameOf(cmsrq,sizeof(cmsrq))));
+	CHECK(decoded.kind()==L3DecodedMessage::CMServiceRequest && !decoded.mHaveLAI);
+	CHECK(decoded.mServiceType.type()==L3CMServiceType::MobileOriginatedCall);
+	CHECK(decoded.mMobileID.type()==TMSIType && decoded.mMobileID.TMSI()==0x12345678);
+
+	// A short TMSI, and a frame that ends inside its mobile identity.
+	const unsigned char shortTMSI[] = { 0x05, 0x01, 0x57, 0x02, 0xf4, 0x12 };
+	CHECK(!decoded.decode(frameOf(shortTMSI,sizeof(shortTMSI))));
+	const unsigned char truncated[] = { 0x05, 0x01, 0x57, 0x05, 0xf4, 0x12 };
+	CHECK(!decoded.decode(frameOf(truncated,sizeof(truncated))));
+
+	// CP-DATA keeps its transaction identifier.
+	const unsigned char cpData[] = { 0x89, 0x01, 0x03, 0x00, 0x01, 0x02 };
+	CHECK(decoded.decode(frameOf(cpData,sizeof(cpData))));
+	CHECK(decoded.kind()==L3DecodedMessage::CPData && decoded.TI()==8 && decoded.mRPDULength==3);
+	SMS::CPData data(decoded);
+	CHECK(data.TI()==8 && data.RPDU().size()==24 && data.RPDU().peekField(16,8)==2);
+
+	// Others are left to parseL3.
+	const unsigned char setup[] = { 0x03, 0x05, 0x04, 0x01, 0xa0 };
+	CHECK(L3DecodedMessage::kindOf(frameOf(setup,sizeof(setup)))==L3DecodedMessage::NotDecoded);
+	CHECK(decoded.decode(frameOf(setup,sizeof(setup))));
+	CHECK(decoded.kind()==L3DecodedMessage::NotDecoded);
+}
+
+
+
+// The fuzz.
+
+static unsigned char randomOctet() { return random() & 0xff; }
+
+/** A random mobile identity LV, mostly well formed. */
+static void addMobileID(vector<unsigned char>& octets)
+{
+	unsigned type = random()%8;
+	if (random()%4) type = 1 + random()%4;
+	unsigned length = type==TMSIType ? 5 : 1 + random()%8;
+	if (random()%8==0) length = random()%10;
+	octets.push_back(length);
+	for (unsigned i=0; i<length; i++) octets.push_back(randomOctet());
+	if (length) octets[octets.size()-length] = (octets[octets.size()-length] & 0xf8) | type;
+}
+
+static void addLV(vector<unsigned char>& octets, unsigned maxLength)
+{
+	unsigned length = random() % (maxLength+1);
+	octets.push_back(length);
+	for (unsigned i=0; i<length; i++) octets.push_back(randomOctet());
+}
+
+static vector<unsigned char> randomMessage(unsigned which)
+{
+	vector<unsigned char> octets;
+	switch (which) {
+		case 0:		// Location Updating Request
+			octets.push_back(0x05);
+			octets.push_back(0x08 | (random()%2 ? 0x40 : 0));
+			for (unsigned i=0; i<7; i++) octets.push_back(randomOctet());
+			addMobileID(octets);
+			break;
+		case 1:		// CM Service Request
+			octets.push_back(0x05);
+			octets.push_back(0x24 | (random()%2 ? 0x40 : 0));
+			octets.push_back(randomOctet());
+			addLV(octets,4);
+			addMobileID(octets);
+			break;
+		case 2:		// IMSI Detach Indication
+			octets.push_back(0x05);
+			octets.push_back(0x01);
+			octets.push_back(randomOctet());
+			addMobileID(octets);
+			break;
+		case 3:		// Paging Response
+			octets.push_back(0x06);
+			octets.push_back(0x27);
+			octets.push_back(randomOctet());
+			addLV(octets,4);
+			addMobileID(octets);
+			break;
+		default:	// CP-DATA
+			octets.push_back(0x09 | (random()%16)<<4);
+			octets.push_back(0x01);
+			addLV(octets,160);
+			break;
+	}
+	return octets;
+}
+
+/** The octets the old parser reads for a mobile identity LV, from its length octet. */
+static unsigned mobileIDReach(const unsigned char *octets, unsigned at)
+{
+	unsigned length = octets[at];
+	if (length==0) return 1;
+	// It reads a TMSI whatever the length says.
+	if ((octets[at+1] & 0x07)==TMSIType && length<5) return 1+5;
+	return 1+length;
+}
+
+/**
+	True if the old parser stays inside the frame; the classmark 2 always reads 3 octets.
+	@param shortClassmark Set if a short classmark 2 is the only overrun; the decoder takes those.
+*/
+static bool oldParserFits(L3DecodedMessage::Kind kind, const unsigned char *octets, unsigned length,
+	bool *shortClassmark=NULL)
+{
+	unsigned at = 0;
+	if (shortClassmark) *shortClassmark = false;
+	switch (kind) {
+		case L3DecodedMessage::LocationUpdatingRequest: at = 9; break;
+		case L3DecodedMessage::IMSIDetachIndication: at = 3; break;
+		case L3DecodedMessage::CMServiceRequest:
+		case L3DecodedMessage::PagingResponse:
+			if (length<=3) return false;
+			at = 3 + 1 + octets[3];
+			if (octets[3] && 3+1+3>length) {
+				if (shortClassmark && at<length && at+mobileIDReach(octets,at)<=length) *shortClassmark = true;
+				return false;
+			}
+			break;
+		case L3DecodedMessage::CPData:
+			return length>2 && 3+(unsigned)octets[2]<=length;
+		default: return true;
+	}
+	if (at>=length) return false;
+	if (at+1<length) return at+mobileIDReach(octets,at)<=length;
+	return octets[at]==0;
+}
+
+/** Parse the old way, or return NULL if the parser threw. */
+static L3Message *oldParse(const L3Frame& frame)
+{
+	try {
+		switch (frame.PD()) {
+			case L3MobilityManagementPD: return parseL3MM(frame);
+			case L3RadioResourcePD: return parseL3RR(frame);
+			case L3SMSPD: return SMS::parseSMS(frame);
+			default: return NULL;
+		}
+	}
+	catch (L3ReadError) { return NULL; }
+}
+
+static unsigned gCompared, gRejected, gOverruns;
+
+static void compare(const L3DecodedMessage& decoded, const L3Message *old, unsigned classmarkLength)
+{
+	switch (decoded.kind()) {
+		case L3DecodedMessage::LocationUpdatingRequest:
+			CHECK(textOf(*old)==textOf(L3LocationUpdatingRequest(decoded)));
+			break;
+		case L3DecodedMessage::IMSIDetachIndication:
+			CHECK(textOf(*old)==textOf(L3IMSIDetachIndication(decoded)));
+			break;
+		case L3DecodedMessage::CMServiceRequest: {
+			// A short classmark leaves the old one partly unset.
+			const L3CMServiceRequest *request = dynamic_cast<const L3CMServiceRequest*>(old);
+			if (classmarkLength>=3) CHECK(textOf(*old)==textOf(L3CMServiceRequest(decoded)));
+			CHECK(request->mobileID()==decoded.mMobileID);
+			CHECK(textOf(request->mobileID())==textOf(decoded.mMobileID));
+			CHECK(request->serviceType()==decoded.mServiceType);
+			break;
+		}
+		case L3DecodedMessage::PagingResponse: {
+			const L3PagingResponse *response = dynamic_cast<const L3PagingResponse*>(old);
+			if (classmarkLength>=3) CHECK(textOf(*old)==textOf(L3PagingResponse(decoded)));
+			CHECK(textOf(response->mobileID())==textOf(decoded.mMobileID));
+			break;
+		}
+		case L3DecodedMessage::CPData: {
+			const SMS::CPData *data = dynamic_cast<const SMS::CPData*>(old);
+			SMS::CPData fresh(decoded);
+			CHECK(data->TI()==fresh.TI());
+			CHECK(textOf(*data)==textOf(fresh));
+			break;
+		}
+		default: break;
+	}
+}
+
+static void fuzz(unsigned count)
+{
+	gCompared = gRejected = gOverruns = 0;
+	L3DecodedMessage decoded;
+	for (unsigned n=0; n<count; n++) {
+		vector<unsigned char> octets = randomMessage(random()%5);
+		unsigned length = octets.size();
+		// Mangle a few octets, sometimes the header.
+		unsigned mangles = random()%4;
+		for (unsigned i=0; i<mangles; i++) {
+			unsigned at = random()%length;
+			if (at<2 && random()%4) continue;
+			octets[at] = randomOctet();
+		}
+		// Sometimes cut it short.
+		if (random()%8==0) length = random()%(length+1);
+		octets.resize(length);
+		unsigned classmarkLength = length>3 ? octets[3] : 0;
+
+		// Pad, so the old parser mostly has somewhere to run to.
+		unsigned padded = length + random()%12;
+		if (padded>L3DecodedMessage::MaxOctets) padded = L3DecodedMessage::MaxOctets;
+		octets.resize(padded+4);
+		for (unsigned i=length; i<octets.size(); i++) octets[i] = randomOctet();
+		L3Frame frame = frameOf(&octets[0],padded);
+
+		bool ok = decoded.decode(frame);
+		if (decoded.kind()==L3DecodedMessage::NotDecoded) continue;
+		bool shortClassmark;
+		if (!oldParserFits(decoded.kind(),&octets[0],padded,&shortClassmark)) {
+			if (!shortClassmark) CHECK(!ok);
+			gOverruns++;
+			continue;
+		}
+		L3Message *old = oldParse(frame);
+		CHECK(ok==(old!=NULL));
+		if (ok && old) {
+			compare(decoded,old,classmarkLength);
+			gCompared++;
+		}
+		if (!ok) gRejected++;
+		delete old;
+	}
+	printf("fuzz: %u frames, %u compared, %u rejected by both, %u would overrun the old parser\n",
+		count,gCompared,gRejected,gOverruns);
+}
+
+
+
+// The benchmark.
+
+static vector<L3Frame*> gCorpus;
+
+static void makeCorpus()
+{
+	// Mostly registrations, as in a storm, with the rest of the mix.
+	static const unsigned mix[] = { 0, 0, 0, 0, 1, 1, 2, 3, 4, 4 };
+	L3DecodedMessage decoded;
+	while (gCorpus.size()<1000) {
+		vector<unsigned char> octets = randomMessage(mix[gCorpus.size()%10]);
+		L3Frame *frame = new L3Frame(frameOf(&octets[0],octets.size()));
+		bool ok = decoded.decode(*frame) && oldParserFits(decoded.kind(),&octets[0],octets.size());
+		L3Message *old = ok ? oldParse(*frame) : NULL;
+		if (!old) { delete frame; continue; }
+		delete old;
+		gCorpus.push_back(frame);
+	}
+}
+
+enum Way { OldWay, HeapWay, StackWay };
+
+static unsigned decodeOne(Way way, const L3Frame& frame)
+{
+	if (way==OldWay) {
+		L3Message *msg = oldParse(frame);
+		unsigned mti = msg->MTI();
+		delete msg;
+		return mti;
+	}
+	L3DecodedMessage decoded;
+	decoded.decode(frame);
+	if (way==HeapWay) {
+		L3Message *msg = NULL;
+		switch (decoded.kind()) {
+			case L3DecodedMessage::LocationUpdatingRequest: msg = new L3LocationUpdatingRequest(decoded); break;
+			case L3DecodedMessage::CMServiceRequest: msg = new L3CMServiceRequest(decoded); break;
+			case L3DecodedMessage::IMSIDetachIndication: msg = new L3IMSIDetachIndication(decoded); break;
+			case L3DecodedMessage::PagingResponse: msg = new L3PagingResponse(decoded); break;
+			case L3DecodedMessage::CPData: msg = new SMS::CPData(decoded); break;
+			default: return 0;
+		}
+		unsigned mti = msg->MTI();
+		delete msg;
+		return mti;
+	}
+	switch (decoded.kind()) {
+		case L3DecodedMessage::LocationUpdatingRequest: return L3LocationUpdatingRequest(decoded).MTI();
+		case L3DecodedMessage::CMServiceRequest: return L3CMServiceRequest(decoded).MTI();
+		case L3DecodedMessage::IMSIDetachIndication: return L3IMSIDetachIndication(decoded).MTI();
+		case L3DecodedMessage::PagingResponse: return L3PagingResponse(decoded).MTI();
+		case L3DecodedMessage::CPData: return SMS::CPData(decoded).MTI();
+		default: return 0;
+	}
+}
+
+static double bench(Way way, double seconds)
+{
+	unsigned count = 0, sum = 0;
+	double start = timef();
+	double elapsed = 0;
+	while (elapsed<seconds) {
+		for (unsigned i=0; i<gCorpus.size(); i++) sum += decodeOne(way,*gCorpus[i]);
+		count += gCorpus.size();
+		elapsed = timef() - start;
+	}
+	CHECK(sum!=0);
+	return count/elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+	unsigned frames = argc>1 ? atoi(argv[1]) : 200000;
+	double seconds = argc>2 ? atof(argv[2]) : 2;
+	// The default LAI comes from these.
+	gConfig.set("UMTS.Identity.MCC","001");
+	gConfig.set("UMTS.Identity.MNC","01");
+	gConfig.set("UMTS.Identity.LAC",1000);
+	srandom(1);
+
+	testKnown();
+	fuzz(frames);
+
+	makeCorpus();
+	double oldRate = bench(OldWay,seconds);
+	double heapRate = bench(HeapWay,seconds);
+	double stackRate = bench(StackWay,seconds);
+	printf("benchmark, messages/sec: old %.0f, new on the heap %.0f (x%.1f), new on the stack %.0f (x%.1f)\n",
+		oldRate,heapRate,heapRate/oldRate,stackRate,stackRate/oldRate);
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
+
+// vim: ts=4 sw=4
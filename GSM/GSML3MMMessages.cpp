@@ -20,6 +20,7 @@
 
 #include "GSML3CommonElements.h"
 #include "GSML3MMMessages.h"
+#include "GSML3Decoder.h"
 #include <Logger.h>
 
 
@@ -106,6 +107,16 @@ void L3MMMessage::text(ostream& os) const
 }
 
 
+L3LocationUpdatingRequest::L3LocationUpdatingRequest(const L3DecodedMessage& decoded)
+	:L3MMMessage(),
+	mClassmark(decoded.mClassmark1),
+	mMobileIdentity(decoded.mMobileID),
+	mLAI(decoded.LAI())
+{
+	assert(decoded.mHaveLAI);
+}
+
+
 void L3LocationUpdatingRequest::parseBody( const  L3Frame &src, size_t &rp )
 {
 		// skip updating type
@@ -172,6 +183,13 @@ void L3LocationUpdatingReject::text(ostream& os) const
 
 
 
+L3IMSIDetachIndication::L3IMSIDetachIndication(const L3DecodedMessage& decoded)
+	:L3MMMessage(),
+	mClassmark(decoded.mClassmark1),
+	mMobileIdentity(decoded.mMobileID)
+{ }
+
+
 void L3IMSIDetachIndication::parseBody(const L3Frame& src, size_t &rp)
 {
 	mClassmark.parseV(src, rp);
@@ -200,6 +218,14 @@ void L3CMServiceReject::text(ostream& os) const
 
 
 
+L3CMServiceRequest::L3CMServiceRequest(const L3DecodedMessage& decoded)
+	:L3MMMessage(),
+	mClassmark(decoded.mClassmark2),
+	mMobileIdentity(decoded.mMobileID),
+	mServiceType(decoded.mServiceType)
+{ }
+
+
 void L3CMServiceRequest::parseBody( const L3Frame &src, size_t &rp )
 {
 	rp += 4;			// skip ciphering key seq number
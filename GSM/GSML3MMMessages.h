@@ -27,6 +27,8 @@
 
 namespace GSM {
 
+class L3DecodedMessage;
+
 
 /**
 	This a virtual class for L3 messages in the Mobility Management protocol.
@@ -105,6 +107,9 @@ class L3LocationUpdatingRequest : public L3MMMessage
 public:
 	L3LocationUpdatingRequest():L3MMMessage() {}
 
+	/** From the fast decoder; skips the LAI default from gConfig. */
+	explicit L3LocationUpdatingRequest(const L3DecodedMessage&);
+
 	const L3MobileIdentity& mobileID() const
 		{ return mMobileIdentity; }
 	const L3LocationAreaIdentity& LAI() const
@@ -200,6 +205,11 @@ class L3IMSIDetachIndication : public L3MMMessage {
 
 	public:
 
+	L3IMSIDetachIndication():L3MMMessage() {}
+
+	/** From the fast decoder. */
+	explicit L3IMSIDetachIndication(const L3DecodedMessage&);
+
 	const L3MobileIdentity& mobileID() const
 		{ return mMobileIdentity; }
 
@@ -275,6 +285,9 @@ public:
 		mServiceType()
 	{ }
 
+	/** From the fast decoder. */
+	explicit L3CMServiceRequest(const L3DecodedMessage&);
+
 	/** Accessors */
 	//@{
 	const L3CMServiceType& serviceType() const { return mServiceType; }
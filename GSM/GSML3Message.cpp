@@ -17,6 +17,7 @@
 #include "GSML3RRMessages.h"
 #include "GSML3MMMessages.h"
 #include "GSML3CCMessages.h"
+#include "GSML3Decoder.h"
 #include <Logger.h>
 
 
@@ -134,6 +135,29 @@ GSM::L3Message* GSM::parseL3(const GSM::L3Frame& source)
 	L3PD PD = source.PD();
 	
 	L3Message *retVal = NULL;
+
+	// The usual messages go through the table-driven decoder; only those are packed for it.
+	// RR is not parsed here, so neither is the paging response.
+	L3DecodedMessage::Kind kind = L3DecodedMessage::kindOf(source);
+	if (kind!=L3DecodedMessage::NotDecoded && kind!=L3DecodedMessage::PagingResponse) {
+		L3DecodedMessage decoded;
+		if (!decoded.decode(source)) {
+			LOG(NOTICE) << "L3 parsing failed for " << source;
+			return NULL;
+		}
+		switch (decoded.kind()) {
+			case L3DecodedMessage::LocationUpdatingRequest: retVal = new L3LocationUpdatingRequest(decoded); break;
+			case L3DecodedMessage::CMServiceRequest: retVal = new L3CMServiceRequest(decoded); break;
+			case L3DecodedMessage::IMSIDetachIndication: retVal = new L3IMSIDetachIndication(decoded); break;
+			case L3DecodedMessage::CPData: retVal = new SMS::CPData(decoded); break;
+			default: break;
+		}
+		if (retVal) {
+			LOG(INFO) << "L3 recv " << *retVal;
+			return retVal;
+		}
+	}
+
 	try {
 		switch (PD) {
 			//case L3RadioResourcePD: retVal=parseL3RR(source); break;
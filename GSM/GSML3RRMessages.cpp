@@ -20,6 +20,7 @@
 #include <iostream>
 
 #include "GSML3RRMessages.h"
+#include "GSML3Decoder.h"
 #include <Logger.h>
 
 
@@ -226,6 +227,13 @@ size_t L3PagingResponse::l2BodyLength() const
 	return 1 + mClassmark.lengthLV() + mMobileID.lengthLV();
 }
 
+L3PagingResponse::L3PagingResponse(const L3DecodedMessage& decoded)
+	:L3RRMessageNRO(),
+	mClassmark(decoded.mClassmark2),
+	mMobileID(decoded.mMobileID)
+{ }
+
+
 void L3PagingResponse::parseBody(const L3Frame& src, size_t &rp)
 {
 	// THIS CODE IS CORRECT.  DON'T CHANGE IT. -- DAB
@@ -26,6 +26,8 @@
 
 namespace GSM {
 
+class L3DecodedMessage;
+
 
 /**
 	This a virtual class for L3 messages in the Radio Resource protocol.
@@ -215,6 +217,11 @@ class L3PagingResponse : public L3RRMessageNRO {
 
 	public:
 
+	L3PagingResponse():L3RRMessageNRO() {}
+
+	/** From the fast decoder. */
+	explicit L3PagingResponse(const L3DecodedMessage&);
+
 	const L3MobileIdentity& mobileID() const { return mMobileID; }
 
 	int MTI() const { return PagingResponse; }
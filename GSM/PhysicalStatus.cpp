@@ -22,7 +22,6 @@
 #include <sqlite3util.h>
 
 #include <GSML3RRElements.h>
-#include <GSMLogicalChannel.h>
 
 #include <iostream>
 #include <iomanip>
@@ -50,7 +49,34 @@ static const char* createPhysicalStatus = {
 	")"
 };
 
+static const char* writePhysicalStatus =
+	"INSERT OR REPLACE INTO PHYSTATUS (CN_TN_TYPE_AND_OFFSET, ARFCN, ACCESSED, "
+		"RXLEV_FULL_SERVING_CELL, RXLEV_SUB_SERVING_CELL, "
+		"RXQUAL_FULL_SERVING_CELL_BER, RXQUAL_SUB_SERVING_CELL_BER, "
+		"RSSI, TIME_ERR, TRANS_PWR, TIME_ADVC, FER) "
+	"VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12)";
+
+
+
+PhysicalStatusRecord::PhysicalStatusRecord()
+	:mARFCN(0),mAccessed(0),mRXLevFull(0),mRXLevSub(0),mRXQualFullBER(0),mRXQualSubBER(0),
+	mRSSI(0),mTimingError(0),mMSPower(0),mMSTiming(0),mFER(0)
+{ }
+
+
+void PhysicalStatusRecord::setMeasurements(const L3MeasurementResults& measResults)
+{
+	mRXLevFull = measResults.RXLEV_FULL_SERVING_CELL_dBm();
+	mRXLevSub = measResults.RXLEV_SUB_SERVING_CELL_dBm();
+	mRXQualFullBER = measResults.RXQUAL_FULL_SERVING_CELL_BER();
+	mRXQualSubBER = measResults.RXQUAL_SUB_SERVING_CELL_BER();
+}
+
+
+
 PhysicalStatus::PhysicalStatus(const char* wPath)
+	:WriteBehind<string,Record>("PHYSTATUS table"),
+	mReports(0),mWriteStmt(NULL)
 {
 	int rc = sqlite3_open(wPath, &mDB);
 	if (rc) {
@@ -60,109 +86,103 @@ PhysicalStatus::PhysicalStatus(const char* wPath)
 		return;
 	}
 	if (!sqlite3_command(mDB, createPhysicalStatus)) {
-		LOG(EMERG) << "Cannot create TMSI table";
+		LOG(EMERG) << "Cannot create PHYSTATUS table";
+	}
+	if (sqlite3_prepare_statement(mDB, &mWriteStmt, writePhysicalStatus)) {
+		LOG(ALERT) << "Cannot prepare PHYSTATUS update";
+		mWriteStmt = NULL;
+		return;
 	}
+	writeTo(mDB);
 }
 
 PhysicalStatus::~PhysicalStatus()
 {
+	stop();
+	if (mWriteStmt) sqlite3_finalize(mWriteStmt);
 	if (mDB) sqlite3_close(mDB);
 }
 
-bool PhysicalStatus::createEntry(const LogicalChannel* chan)
+
+
+void PhysicalStatus::start()
 {
-	assert(mDB);
-	assert(chan);
+	if (!mDB) return;
+	unsigned interval = gConfig.getNum("Control.Reporting.PhysStatusFlushInterval");
+	WriteBehind<string,Record>::start(interval ? interval : 1000);
+}
 
-	ScopedLock lock(mLock);
 
-	const char* chanString = chan->descriptiveString();
-	LOG(DEBUG) << chan->descriptiveString();
-
-	/* Check to see if the key exists. */
-	if (!sqlite3_exists(mDB, "PHYSTATUS", "CN_TN_TYPE_AND_OFFSET", chanString)) {
-		/* No? Ok, it should now. */
-		char query[500];
-		sprintf(query, "INSERT INTO PHYSTATUS (CN_TN_TYPE_AND_OFFSET, ACCESSED) VALUES "
-					   "(\"%s\", %u)",
-				chanString, (unsigned)time(NULL));
-		return sqlite3_command(mDB, query);
-	}
 
-	return false;
+bool PhysicalStatus::writeRow(const string& chan, const Record& record)
+{
+	sqlite3_bind_text(mWriteStmt,1,chan.c_str(),-1,SQLITE_STATIC);
+	sqlite3_bind_int(mWriteStmt,2,record.mARFCN);
+	sqlite3_bind_int64(mWriteStmt,3,record.mAccessed);
+	sqlite3_bind_int(mWriteStmt,4,record.mRXLevFull);
+	sqlite3_bind_int(mWriteStmt,5,record.mRXLevSub);
+	sqlite3_bind_double(mWriteStmt,6,record.mRXQualFullBER);
+	sqlite3_bind_double(mWriteStmt,7,record.mRXQualSubBER);
+	sqlite3_bind_double(mWriteStmt,8,record.mRSSI);
+	sqlite3_bind_double(mWriteStmt,9,record.mTimingError);
+	sqlite3_bind_int(mWriteStmt,10,record.mMSPower);
+	sqlite3_bind_int(mWriteStmt,11,record.mMSTiming);
+	sqlite3_bind_double(mWriteStmt,12,record.mFER);
+	return runStatement(mWriteStmt);
 }
 
-bool PhysicalStatus::setPhysical(const LogicalChannel* chan,
-								const L3MeasurementResults& measResults)
-{
-	// TODO -- It would be better if the argument what just the channel
-	// and the key was just the descriptiveString.
 
-	assert(mDB);
-	assert(chan);
 
+void PhysicalStatus::setPhysical(const char* chan, const Record& record)
+{
+	assert(chan);
+	string key(chan);
 	ScopedLock lock(mLock);
+	Record &latest = mRecords[key];
+	latest = record;
+	latest.mAccessed = (unsigned)time(NULL);
+	queue(key,latest);
+	mReports++;
+}
+
 
-	createEntry(chan);
-
-	char query[500];
-	sprintf(query,
-		"UPDATE PHYSTATUS SET "
-		"RXLEV_FULL_SERVING_CELL=%d, "
-		"RXLEV_SUB_SERVING_CELL=%d, "
-		"RXQUAL_FULL_SERVING_CELL_BER=%f, "
-		"RXQUAL_SUB_SERVING_CELL_BER=%f, "
-		"RSSI=%f, "
-		"TIME_ERR=%f, "
-		"TRANS_PWR=%u, "
-		"TIME_ADVC=%u, "
-		"FER=%f, "
-		"ACCESSED=%u, "
-		"ARFCN=%u "
-		"WHERE CN_TN_TYPE_AND_OFFSET==\"%s\"",
-		measResults.RXLEV_FULL_SERVING_CELL_dBm(),
-		measResults.RXLEV_SUB_SERVING_CELL_dBm(),
-		measResults.RXQUAL_FULL_SERVING_CELL_BER(),
-		measResults.RXQUAL_SUB_SERVING_CELL_BER(),
-		chan->RSSI(), chan->timingError(),
-		chan->actualMSPower(), chan->actualMSTiming(),
-		chan->FER(),
-		(unsigned)time(NULL),
-		chan->ARFCN(),
-		chan->descriptiveString());
-
-	LOG(DEBUG) << "Query: " << query;
-
-	return sqlite3_command(mDB, query);
+bool PhysicalStatus::getPhysical(const char* chan, Record& record) const
+{
+	ScopedLock lock(mLock);
+	RecordMap::const_iterator itr = mRecords.find(chan);
+	if (itr==mRecords.end()) return false;
+	record = itr->second;
+	return true;
 }
 
-#if 0
+
+
 void PhysicalStatus::dump(ostream& os) const
 {
-	sqlite3_stmt *stmt;
-	sqlite3_prepare_statement(mDB, &stmt,
-		"SELECT CN,TN,TYPE_AND_OFFSET,FER,RSSI,TRANS_PWR,TIME_ADVC,RXLEV_FULL_SERVING_CELL,RXQUAL_FULL_SERVING_CELL_BER FROM PHYSTATUS");
-
-	while (sqlite3_run_query(mDB,stmt) == SQLITE_ROW) {
-		os << setw(2) << sqlite3_column_int(stmt, 0) << " " << sqlite3_column_int(stmt, 1);
-		os << " " << setw(9) << (TypeAndOffset)sqlite3_column_int(stmt, 2);
-
-		char buffer[1024];
-		sprintf(buffer, "%10d %5.2f %4d %5d %4d",
-			sqlite3_column_int(stmt, 3),
-			100.0*sqlite3_column_double(stmt, 4), (int)round(sqlite3_column_double(stmt, 5)),
-			sqlite3_column_int(stmt, 6), sqlite3_column_int(stmt, 7));
-		os << " " << buffer;
-
-		sprintf(buffer, "%5d %5.2f",
-			sqlite3_column_int(stmt, 8), 100.0*sqlite3_column_double(stmt, 9));
-		os << " " << buffer;
-
-		os << endl;
+	ScopedLock lock(mLock);
+	os << "         channel ARFCN  FER%   RSSI TAerr  pwr   TA RXLEV RXQL%  age" << endl;
+	unsigned now = (unsigned)time(NULL);
+	for (RecordMap::const_iterator itr = mRecords.begin(); itr!=mRecords.end(); ++itr) {
+		const Record &record = itr->second;
+		os << setw(16) << itr->first;
+		char buffer[200];
+		sprintf(buffer, " %5u %5.2f %6.2f %5.2f %4u %4u %4d %5.2f %4us",
+			record.mARFCN, 100.0*record.mFER, record.mRSSI,
+			record.mTimingError, record.mMSPower, record.mMSTiming,
+			record.mRXLevFull, 100.0*record.mRXQualFullBER,
+			now>record.mAccessed ? now-record.mAccessed : 0);
+		os << buffer << endl;
 	}
-	sqlite3_finalize(stmt);
 }
-#endif
+
+
+
+void PhysicalStatus::stats(ostream& os) const
+{
+	ScopedLock lock(mLock);
+	os << "channels=" << mRecords.size() << " reports=" << mReports << " pending=" << pending()
+		<< " written=" << written() << " writes=" << flushes() << " interval=" << interval() << "ms";
+}
 
 
 // vim: ts=4 sw=4
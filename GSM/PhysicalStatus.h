@@ -19,29 +19,64 @@
 #define PHYSICALSTATUS_H
 
 #include <map>
+#include <string>
+#include <ostream>
 
 #include <Timeval.h>
 #include <Threads.h>
-
-
-struct sqlite3;
+#include <WriteBehind.h>
 
 
 namespace GSM {
 
 class L3MeasurementResults;
-class LogicalChannel;
+
+/** The latest measurements of one channel, one PHYSTATUS row. */
+struct PhysicalStatusRecord {
+	unsigned mARFCN;				///< actual ARFCN
+	unsigned mAccessed;				///< Unix time of last update
+	int mRXLevFull;					///< serving cell RXLEV-FULL, dBm
+	int mRXLevSub;					///< serving cell RXLEV-SUB, dBm
+	float mRXQualFullBER;			///< serving cell RXQUAL-FULL, as a BER
+	float mRXQualSubBER;			///< serving cell RXQUAL-SUB, as a BER
+	float mRSSI;					///< RSSI relative to full scale input
+	float mTimingError;				///< timing advance error in symbol periods
+	unsigned mMSPower;				///< handset tx power in dBm
+	unsigned mMSTiming;				///< handset timing advance in symbol periods
+	float mFER;						///< uplink FER
+
+	PhysicalStatusRecord();
+
+	/** Set the serving cell values from a measurement report. */
+	void setMeasurements(const L3MeasurementResults& measResults);
+};
+
 
 /**
 	A table for tracking the state of channels.
+	Reports only update the latest values of their channel in memory, which is what the CLI reads;
+	a background thread started by start() writes the channels reported since its last pass to the
+	PHYSTATUS table every Control.Reporting.PhysStatusFlushInterval milliseconds, in one sqlite transaction,
+	so the channel service loops never wait on the disk.
 */
-class PhysicalStatus {
+class PhysicalStatus : private WriteBehind<std::string,PhysicalStatusRecord> {
+
+public:
+
+	typedef PhysicalStatusRecord Record;
 
 private:
 
-	Mutex mLock;		///< to reduce the load on the filesystem locking
+	typedef std::map<std::string,Record> RecordMap;
+
 	sqlite3 *mDB;		///< database connection
 
+	mutable Mutex mLock;	///< protects mRecords and mReports
+	RecordMap mRecords;		///< latest values, by channel
+	unsigned mReports;		///< setPhysical calls
+
+	sqlite3_stmt *mWriteStmt;	///< prepared row replacement
+
 public:
 
 	/**
@@ -52,30 +87,37 @@ public:
 
 	~PhysicalStatus();
 
+	/** Start the thread that writes the table. */
+	void start();
+
+	/** Write the channels reported since the last flush.  Return the number of rows written. */
+	using WriteBehind<std::string,Record>::flush;
+
 	/** 
-		Add reporting information associated with a channel to the table.
-		@param chan The channel to report.
-		@param measResults The measurement report.
-		@return The result of the SQLite query: true for the query being executed successfully, false otherwise.
+		Record the latest measurements of a channel, to be written by the next flush.
+		Nothing calls this on UMTS yet: the RRC measurement reports are not decoded
+		(see measurementReport in URRCMessages.cpp), so the table stays empty.
+		@param chan The channel's descriptive string, the table key.
+		@param record The measurements; mAccessed is set here.
 	*/
-	bool setPhysical(const LogicalChannel* chan, const L3MeasurementResults& measResults);
+	void setPhysical(const char* chan, const Record& record);
+
+	/** Get the latest measurements of a channel; return false if it has not reported. */
+	bool getPhysical(const char* chan, Record& record) const;
 
 	/**
-		Dump the physical status table to the output stream.
+		Dump the latest measurements of each channel to the output stream.
 		@param os The output stream to dump the channel information to.
 	*/
-//	void dump(std::ostream& os) const;
+	void dump(std::ostream& os) const;
 
-	private:
-
-	/** 
-		Create entry in table. This is for the initial creation.
-		@param chan The channel to create an entry for.
-		@return The result of the SQLite query: true for the query being executed successfully, false otherwise.
-	*/
-	bool createEntry(const LogicalChannel* chan);
+	/** Write the report and database write counts to a stream. */
+	void stats(std::ostream& os) const;
 
+	private:
 
+	/** Write one channel in the flush transaction. */
+	bool writeRow(const std::string& chan, const Record& record);
 };
 
 
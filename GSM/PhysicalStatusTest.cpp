@@ -0,0 +1,205 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check that PhysicalStatus keeps the latest values and writes them on flush, then time
+// measurement reports from many channels against it and against the old way, an existence check,
+// an insert for a new channel and an update, all on the reporting thread, for every report.
+// Reports the per-report cost on the caller's thread and the number of sqlite commits.
+// Build with PhysicalStatus.cpp, the GSM L3 elements and CommonLibs; pass the report count and a scratch directory.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <sqlite3util.h>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "PhysicalStatus.h"
+
+using namespace std;
+using namespace GSM;
+
+ConfigurationTable gConfig;
+
+// Count the commits on a connection, which is what costs on a real disk.
+static int countCommit(void *arg) { (*(unsigned*)arg)++; return 0; }
+
+static void channelOf(unsigned n, char *buf) { sprintf(buf,"C%uT%u DCH-%u",n/8,n%8,n); }
+
+static PhysicalStatus::Record recordOf(unsigned n, unsigned report)
+{
+	PhysicalStatus::Record record;
+	record.mARFCN = 9800 + n;
+	record.mRXLevFull = -110 + (int)(report%60);
+	record.mRXLevSub = -110 + (int)(report%50);
+	record.mRXQualFullBER = 0.001*(report%7);
+	record.mRXQualSubBER = 0.002*(report%7);
+	record.mRSSI = -0.5*(report%40);
+	record.mTimingError = 0.25*(report%4);
+	record.mMSPower = report%33;
+	record.mMSTiming = n%64;
+	record.mFER = 0.01*(report%10);
+	return record;
+}
+
+static void testStatus(const string& path)
+{
+	unlink(path.c_str());
+	sqlite3 *db;
+	CHECK(sqlite3_open(path.c_str(),&db) == 0);
+	{
+		PhysicalStatus status(path.c_str());
+		char chan[40];
+		PhysicalStatus::Record record;
+		CHECK(!status.getPhysical("C0T0 DCH-0",record));
+		for (unsigned report = 0; report < 5; report++) {
+			for (unsigned n = 0; n < 100; n++) {
+				channelOf(n,chan);
+				status.setPhysical(chan,recordOf(n,report));
+			}
+		}
+		// The latest values are there at once; the database waits for the flush.
+		CHECK(status.getPhysical("C12T3 DCH-99",record));
+		CHECK(record.mARFCN == 9899 && record.mMSPower == 4 && record.mAccessed > 0);
+		unsigned rows = 1;
+		sqlite3_single_lookup(db,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET","C12T3 DCH-99","ARFCN",rows);
+		CHECK(rows == 1);
+		CHECK(status.flush() == 100);
+		CHECK(status.flush() == 0);
+		unsigned ARFCN = 0, power = 0;
+		CHECK(sqlite3_single_lookup(db,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET","C12T3 DCH-99","ARFCN",ARFCN));
+		CHECK(sqlite3_single_lookup(db,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET","C12T3 DCH-99","TRANS_PWR",power));
+		CHECK(ARFCN == 9899 && power == 4);
+
+		// Only the channels reported since are written again.
+		status.setPhysical("C0T0 DCH-0",recordOf(0,20));
+		status.setPhysical("C0T0 DCH-0",recordOf(0,21));
+		CHECK(status.flush() == 1);
+		CHECK(sqlite3_single_lookup(db,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET","C0T0 DCH-0","TRANS_PWR",power));
+		CHECK(power == 21);
+
+		ostringstream os;
+		status.dump(os);
+		CHECK(os.str().find("C12T3 DCH-99") != string::npos);
+
+		// The destructor writes what is left.
+		status.setPhysical("C0T1 DCH-1",recordOf(1,30));
+	}
+	unsigned power = 0;
+	CHECK(sqlite3_single_lookup(db,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET","C0T1 DCH-1","TRANS_PWR",power));
+	CHECK(power == 30);
+	sqlite3_close(db);
+}
+
+
+// The old PhysicalStatus::setPhysical, with the channel accessors replaced by the record.
+class OldStatus {
+	sqlite3 *mDB;
+	Mutex mLock;
+	public:
+	unsigned mCommits;
+	OldStatus(const char *path) : mCommits(0) {
+		PhysicalStatus create(path);
+		sqlite3_open(path,&mDB);
+		sqlite3_commit_hook(mDB,countCommit,&mCommits);
+	}
+	~OldStatus() { sqlite3_close(mDB); }
+	bool setPhysical(const char *chan, const PhysicalStatus::Record& record) {
+		ScopedLock lock(mLock);
+		char query[500];
+		if (!sqlite3_exists(mDB,"PHYSTATUS","CN_TN_TYPE_AND_OFFSET",chan)) {
+			sprintf(query,"INSERT INTO PHYSTATUS (CN_TN_TYPE_AND_OFFSET, ACCESSED) VALUES (\"%s\", %u)",
+				chan,(unsigned)time(NULL));
+			sqlite3_command(mDB,query);
+		}
+		sprintf(query,
+			"UPDATE PHYSTATUS SET RXLEV_FULL_SERVING_CELL=%d, RXLEV_SUB_SERVING_CELL=%d, "
+			"RXQUAL_FULL_SERVING_CELL_BER=%f, RXQUAL_SUB_SERVING_CELL_BER=%f, RSSI=%f, TIME_ERR=%f, "
+			"TRANS_PWR=%u, TIME_ADVC=%u, FER=%f, ACCESSED=%u, ARFCN=%u "
+			"WHERE CN_TN_TYPE_AND_OFFSET==\"%s\"",
+			record.mRXLevFull,record.mRXLevSub,record.mRXQualFullBER,record.mRXQualSubBER,
+			record.mRSSI,record.mTimingError,record.mMSPower,record.mMSTiming,record.mFER,
+			(unsigned)time(NULL),record.mARFCN,chan);
+		return sqlite3_command(mDB,query);
+	}
+};
+
+
+struct Latency {
+	double mTotal, mMax;
+	unsigned mCount;
+	Latency() : mTotal(0), mMax(0), mCount(0) {}
+	void add(double t) { mTotal += t; mCount++; if (t > mMax) mMax = t; }
+	void print(const char *what) {
+		printf("  %-8s report: avg %8.2f us, max %8.2f ms\n",what,mCount ? 1e6*mTotal/mCount : 0.0,1e3*mMax);
+	}
+};
+
+// Per second, or 0 if nothing was timed.
+static double rate(unsigned count, double elapsed) { return elapsed > 0 ? count/elapsed : 0.0; }
+
+// Report from every channel in turn, as the channel service loops do.
+template <class Status>
+static double reports(Status &status, unsigned channels, unsigned count, Latency &latency)
+{
+	char chan[40];
+	double start = timef();
+	for (unsigned r = 0; r < count; r++) {
+		unsigned n = r % channels;
+		channelOf(n,chan);
+		PhysicalStatus::Record record = recordOf(n,r);
+		double t = timef();
+		status.setPhysical(chan,record);
+		latency.add(timef() - t);
+	}
+	return timef() - start;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned count = argc > 1 ? atoi(argv[1]) : 5000;
+	string dir = argc > 2 ? argv[2] : "/tmp";
+	string path = dir + "/PhysicalStatusTest.db";
+	gConfig.set("Control.Reporting.PhysStatusFlushInterval","100");
+
+	testStatus(path);
+
+	unsigned channels = 256;
+	printf("%u measurement reports, %u channels:\n",count,channels);
+	{
+		unlink(path.c_str());
+		OldStatus status(path.c_str());
+		Latency latency;
+		double elapsed = reports(status,channels,count,latency);
+		printf(" old: %.0f reports/sec, %u sqlite commits\n",rate(count,elapsed),status.mCommits);
+		latency.print("old");
+	}
+	{
+		unlink(path.c_str());
+		PhysicalStatus status(path.c_str());
+		status.start();
+		Latency latency;
+		double elapsed = reports(status,channels,count,latency);
+		status.flush();
+		ostringstream os;
+		status.stats(os);
+		printf(" new: %.0f reports/sec, %s\n",rate(count,elapsed),os.str().c_str());
+		latency.print("new");
+	}
+	unlink(path.c_str());
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -14,12 +14,16 @@
 
 #include <stdint.h>
 #include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
 #include "LLC.h"
 #define GGSN_IMPLEMENTATION 1
 #include "SgsnBase.h"
 #include "Sgsn.h"
 #include "Ggsn.h"
 #include "miniggsn.h"
+#include "GgsnTrace.h"
 //#include "MSInfo.h"	// To dump MSInfo
 #include "GPRSL3Messages.h"
 #define CASENAME(x) case x: return #x;
@@ -105,43 +109,97 @@ static void sethighpri()
 }
 
 
+// Pin the calling thread to a CPU from GGSN.Workers.CPUs, if any.
+static void setaffinity(unsigned index)
+{
+	int cpu = miniggsn_worker_cpu(index);
+	if (cpu < 0) { return; }
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu,&cpus);
+	int err = pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+	if (err) {
+		SGSNERROR("ggsn: could not pin thread to cpu "<<cpu<<": "<<strerror(err));
+	} else {
+		SGSNLOG("ggsn: thread pinned to"<<LOGVAR(cpu));
+	}
+}
+
+// A reader thread services its share of the tun queues.  Each wakeup drains a batch of packets from every
+// one of its queues that is readable, so under load we do one poll() per batch instead of one per packet.
+// The packets go to the workers that own their connections; see miniggsn_dispatch().
 void *miniGgsnReadServiceLoop(void *arg)
 {
-	Ggsn *ggsn = (Ggsn*)arg;
+	GgsnReader *reader = (GgsnReader*)arg;
+	Ggsn *ggsn = &gGgsn;
 	sethighpri();
+	setaffinity(reader->mIndex);
+	struct pollfd fds[MG_MAX_TUN_QUEUES];
+	int nfds = 0;
+	for (int q = reader->mIndex; q < tun_nqueues; q += ggsn->mNumReaders) {
+		fds[nfds].fd = tun_fds[q];
+		fds[nfds].events = POLLIN;
+		nfds++;
+	}
 	while (ggsn->active()) {
-		struct pollfd fds[1];
-		fds[0].fd = tun_fd;
-		fds[0].events = POLLIN;
-		fds[0].revents = 0;		// being cautious
+		for (int i = 0; i < nfds; i++) {
+			fds[i].revents = 0;		// being cautious
+		}
 		// We time out occassionally to check if the user wants to shut the sgsn down.
-                MGINFO("ggsn: polling at %s",timestr().c_str());
-		if (-1 == poll(fds,1,ggsn->mStopTimeout)) {
+		int nready = poll(fds,nfds,ggsn->mStopTimeout);
+		if (nready < 0) {
+			if (errno == EINTR) { continue; }
 			SGSNERROR("ggsn: poll failure");
 			return 0;
 		}
-                MGINFO("ggsn: polling %0x at %s",fds[0].revents,timestr().c_str());
-		if (fds[0].revents & POLLIN) {
-			miniggsn_handle_read();
+		if (nready == 0) { continue; }
+		MG_STAT_ADD(mRxWakeups,1);
+		for (int i = 0; i < nfds; i++) {
+			if (fds[i].revents & POLLIN) {
+				miniggsn_handle_read(fds[i].fd,reader->mBufs);
+			}
 		}
 	}
 	return 0;
 }
 
-void *miniGgsnWriteServiceLoop(void *arg)
+// A worker takes as many packets as are waiting in its queue, up to the batch size, with one lock acquisition,
+// and forwards them all before going back to sleep: uplink packets are written to the worker's tun queue,
+// downlink packets from the readers are sent on to the MS.
+// Note that a tun fd accepts exactly one packet per write(), so the batching is on the queue side.
+void *miniGgsnWorkerServiceLoop(void *arg)
 {
+	GgsnWorker *worker = (GgsnWorker*)arg;
+	Ggsn *ggsn = &gGgsn;
 	sethighpri();
-	Ggsn *ggsn = (Ggsn*)arg;
+	setaffinity(worker->mIndex);
+	unsigned maxBatch = miniggsn_tx_batch_size();
+	PdpPdu **batch = new PdpPdu*[maxBatch];
 	while (ggsn->active()) {
 		// 8-6-2012 This interthreadqueue is clumping things up.  Try taking out the timeout.
 		//PdpPdu *npdu = ggsn->mTxQ.read(ggsn->mStopTimeout);
-		PdpPdu *npdu = ggsn->mTxQ.read();
-        	SGSNLOG("Got pdu to send: " << npdu->mpdu);
-		if (npdu) {
-			miniggsn_snd_npdu_by_mgc(npdu->mgp, npdu->mpdu.begin(), npdu->mpdu.size());
+		unsigned cnt = worker->mQ.readBatch(batch,maxBatch);
+		gGgsnTrace.tick();
+		uint32_t now = time(NULL);
+		unsigned uplink = 0;
+		for (unsigned i = 0; i < cnt; i++) {
+			PdpPdu *npdu = batch[i];
+			if (npdu->mDownlink) {
+				miniggsn_deliver_pdu(npdu->mgp,npdu->mpdu,now);
+			} else {
+				SGSNLOG("Got pdu to send: " << npdu->mpdu);
+				miniggsn_snd_npdu_by_mgc(npdu->mgp, npdu->mpdu.begin(), npdu->mpdu.size(), worker->mTunFd);
+				uplink++;
+			}
 			delete npdu;
 		}
+		if (uplink) {
+			MG_STAT_ADD(mTxBatches,1);
+			MG_STAT_ADD(mTxPackets,uplink);
+			if (uplink > gMgTunStats.mTxBatchMax) { gMgTunStats.mTxBatchMax = uplink; }
+		}
 	}
+	delete [] batch;
 	return 0;
 }
 
@@ -188,8 +246,21 @@ bool Ggsn::start()
 {
 	if (gGgsn.mActive) { return false; }
 	if (!miniggsn_init()) { return false; }
-	gGgsn.mGgsnRecvThread.start(miniGgsnReadServiceLoop,&gGgsn);
-	gGgsn.mGgsnSendThread.start(miniGgsnWriteServiceLoop,&gGgsn);
+	gGgsn.mNumWorkers = miniggsn_num_workers();
+	gGgsn.mNumReaders = min((unsigned)tun_nqueues,gGgsn.mNumWorkers);
+	for (unsigned n = 0; n < gGgsn.mNumWorkers; n++) {
+		GgsnWorker *worker = &gGgsn.mWorkers[n];
+		worker->mIndex = n;
+		worker->mTunFd = tun_fds[n % tun_nqueues];
+		worker->mThread.start(miniGgsnWorkerServiceLoop,worker);
+	}
+	for (unsigned n = 0; n < gGgsn.mNumReaders; n++) {
+		GgsnReader *reader = &gGgsn.mReaders[n];
+		reader->mIndex = n;
+		if (!reader->mBufs) { reader->mBufs = miniggsn_rxbufs_alloc(); }
+		reader->mThread.start(miniGgsnReadServiceLoop,reader);
+	}
+	SGSNLOG("ggsn: started"<<LOGVAR2("workers",gGgsn.mNumWorkers)<<LOGVAR2("readers",gGgsn.mNumReaders));
 	if (gConfig.getStr("GGSN.ShellScript").size() > 1) {
 		gGgsn.mGgsnShellThread.start(miniGgsnShellServiceLoop,&gGgsn);
 		gGgsn.mShellThreadActive = true;
@@ -206,8 +277,8 @@ bool Ggsn::start()
 void Ggsn::stop()
 {
 	if (!gGgsn.mActive) {return;}
-	gGgsn.mGgsnRecvThread.join();
-	gGgsn.mGgsnSendThread.join();
+	for (unsigned n = 0; n < gGgsn.mNumReaders; n++) { gGgsn.mReaders[n].mThread.join(); }
+	for (unsigned n = 0; n < gGgsn.mNumWorkers; n++) { gGgsn.mWorkers[n].mThread.join(); }
 	if (gGgsn.mShellThreadActive) {
 		gGgsn.mGgsnShellThread.join();
 		gGgsn.mShellThreadActive = false;
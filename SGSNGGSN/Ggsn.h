@@ -27,7 +27,7 @@ namespace SGSN {
 class LlcEntityGmm;
 class L3GprsFrame;
 void *miniGgsnReadServiceLoop(void *arg);
-void *miniGgsnWriteServiceLoop(void *arg);
+void *miniGgsnWorkerServiceLoop(void *arg);
 void sendPdpDeactivateAll(SgsnInfo *si, SmCause::Cause cause);
 void sendSmStatus(SgsnInfo *si,SmCause::Cause cause);
 void sendPdpContextAccept(SgsnInfo *si, PdpContext *pdp);
@@ -37,13 +37,34 @@ struct PdpPdu : SingleLinkListNode {
 	ByteVector mpdu;
 	//PdpContext *mpdp;
 	mg_con_t *mgp;
+	bool mDownlink;		// From the tun to the MS, else from the MS to the tun.
 	public:
 	//PdpPdu *next() { return mNext; }
 	//void setNext(PdpPdu*wNext) { mNext = wNext; }
-	PdpPdu(ByteVector wpdu,mg_con_t *wmgp) : mpdu(wpdu), mgp(wmgp) { RN_MEMCHKNEW(PdpPdu) }
+	PdpPdu(ByteVector wpdu,mg_con_t *wmgp) : mpdu(wpdu), mgp(wmgp), mDownlink(false) { RN_MEMCHKNEW(PdpPdu) }
+	// A downlink packet from a tun reader.  Takes the buffer over from wpdu instead of sharing it; see MgRxBuf.
+	PdpPdu(mg_con_t *wmgp,ByteVector &wpdu) : mgp(wmgp), mDownlink(true) { mpdu.transfer(wpdu); RN_MEMCHKNEW(PdpPdu) }
 	~PdpPdu() { RN_MEMCHKDEL(PdpPdu) }
 };
 
+// A GGSN forwarding worker.  Each PDP context belongs to one worker, chosen by mg_con_worker(),
+// which forwards all its packets in both directions, so the packets for a context stay in order
+// no matter how many workers there are.
+struct GgsnWorker {
+	unsigned mIndex;
+	int mTunFd;			// The tun queue this worker writes uplink packets to.
+	Thread mThread;
+	InterthreadQueue<PdpPdu,SingleLinkList<> > mQ;
+};
+
+// A thread that reads some of the tun queues and passes the packets to their workers.
+struct GgsnReader {
+	unsigned mIndex;
+	MgRxBuf *mBufs;		// This reader's receive buffers.
+	Thread mThread;
+	GgsnReader() : mBufs(0) {}
+};
+
 
 struct ShellRequest {
 	std::string msrCommand;
@@ -61,16 +82,27 @@ class Ggsn {
 	// secondary pdp contexts, which we dont support yet.
 	// It is conceivable that the PdpContext can be deleted while there
 	bool mActive;
-	Thread mGgsnRecvThread;
-	Thread mGgsnSendThread;
 	Thread mGgsnShellThread;
 	Bool_z mShellThreadActive;
 	public:
 	static const unsigned mStopTimeout = 3000;	// How often the service loops check for active.
-	InterthreadQueue<PdpPdu,SingleLinkList<> > mTxQ;
+	// GGSN.Workers forwarding threads, and min(GGSN.Tun.Queues,GGSN.Workers) tun readers.
+	// Reader n reads the tun queues q where q % mNumReaders == n.
+	GgsnWorker mWorkers[MG_MAX_WORKERS];
+	unsigned mNumWorkers;
+	GgsnReader mReaders[MG_MAX_TUN_QUEUES];
+	unsigned mNumReaders;
 	InterthreadQueue<ShellRequest> mShellQ;
 
+	GgsnWorker *workerFor(mg_con_t *mgp) { return &mWorkers[mg_con_worker(mgp,mNumWorkers)]; }
+	// Pass a downlink packet from a tun reader to the worker that owns the connection.
+	void steerDownlink(mg_con_t *mgp, ByteVector &pdu) {
+		workerFor(mgp)->mQ.write(new PdpPdu(mgp,pdu));
+		MG_STAT_ADD(mRxSteered,1);
+	}
+
 	public:
+	Ggsn() : mActive(false), mNumWorkers(1), mNumReaders(0) {}
 	static void handleL3SmMsg(SgsnInfo *si, L3GprsFrame &frame);
 
 	// If it returns false, the service loop exits.
@@ -136,7 +168,7 @@ class PdpContext
 #endif
 
 	void pdpWriteLowSide(ByteVector &payload);
-	void pdpWriteHighSide(unsigned char *packet, unsigned packetlen);
+	void pdpWriteHighSide(ByteVector &sdu);
 
 	// Once the connection is set up we dont care about this stuff any more,
 	// but we have to cache it for UMTS because the PdpContextAccept message is not sent out instantly.
@@ -238,15 +270,16 @@ class PdpContext
 	void PdpContext::pdpWriteLowSide(ByteVector &payload) {
 		SNDCPDEBUG("pdpWriteLowSide"<<LOGVAR2("packetlen",payload.size()));
 		PdpPdu *newpdu = new PdpPdu(payload,this->mgp);
-		gGgsn.mTxQ.write(newpdu);
+		gGgsn.workerFor(this->mgp)->mQ.write(newpdu);
 	}
-	void PdpContext::pdpWriteHighSide(unsigned char *packet, unsigned packetlen) {
-		SNDCPDEBUG("pdpWriteHighSide"<<LOGVAR2("packetlen",packetlen));
+	// The sdu is the buffer the GGSN read the packet into.  For UMTS it is handed off to the RLC,
+	// so it may be empty on return; see miniggsn_deliver().
+	void PdpContext::pdpWriteHighSide(ByteVector &sdu) {
+		SNDCPDEBUG("pdpWriteHighSide"<<LOGVAR2("packetlen",sdu.size()));
 		// pat 12-17:  Dont use a ByteVectorTemp until the implementation is fixed: if you accidentally
 		// dup the resulting ByteVectorTemp havoc ensues.
 		// If you change this back to ByteVector, make SURE you restore the clone in rlcWriteHighSide().
 		//ByteVectorTemp sdu(packet,packetlen);
-		ByteVector sdu(packet,packetlen);
 		//mpdpDownstream->snWriteHighSide(sdu);
 		mpcGmm->getSI()->sgsnWriteHighSide(sdu,mNSapi);
 	}
@@ -0,0 +1,189 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <Threads.h>
+#include <Utils.h>
+#include "GgsnFirewall.h"
+
+namespace SGSN {
+
+GgsnFirewall * volatile gGgsnFirewall = NULL;
+volatile unsigned gGgsnFirewallEpoch = 0;
+volatile unsigned gGgsnFirewallReaders[2] = { 0, 0 };
+static Mutex sFirewallInstallLock;
+
+void ggsnFirewallInstall(GgsnFirewall *fw)
+{
+	ScopedLock lock(sFirewallInstallLock);
+	// Make sure the new table is completely written before the GGSN write thread can see it.
+	__sync_synchronize();
+	GgsnFirewall *old = gGgsnFirewall;
+	gGgsnFirewall = fw;		// A single aligned pointer store, so a reader sees the old or new one.
+	// A reader that can still hold the old table counted itself in before it loaded the pointer.
+	// Readers that start after a flip count under the other epoch and load the new table.
+	// A reader that read the epoch just before a flip may count itself in under the old one late,
+	// so flip twice and wait for each side to drain; then nobody can be using the old table.
+	for (unsigned flip = 0; flip < 2; flip++) {
+		unsigned epoch = __sync_fetch_and_add(&gGgsnFirewallEpoch,1) & 1;
+		while (gGgsnFirewallReaders[epoch]) { usleep(100); }
+	}
+	delete old;
+}
+
+// Sort by start address, then the shortest prefix first so that the enclosing prefix precedes
+// the prefixes nested inside it.
+bool GgsnFirewall::Rule::operator<(const Rule &other) const
+{
+	if (mBase != other.mBase) { return mBase < other.mBase; }
+	if (mBits != other.mBits) { return mBits < other.mBits; }
+	return mOrder < other.mOrder;
+}
+
+bool GgsnFirewall::addPrefix(uint32_t basehl, unsigned bits, Action action)
+{
+	if (bits > 32) { return false; }
+	Rule rule;
+	rule.mBits = bits;
+	rule.mBase = bits ? (basehl & ~((1ull << (32 - bits)) - 1)) : 0;
+	rule.mAction = action;
+	rule.mOrder = mRules.size();
+	mRules.push_back(rule);
+	return true;
+}
+
+bool GgsnFirewall::addRule(uint32_t basenl, uint32_t masknl, Action action)
+{
+	uint32_t mask = ntohl(masknl);
+	unsigned bits = 0;
+	while (bits < 32 && (mask & (0x80000000u >> bits))) { bits++; }
+	if (bits < 32 && (mask << bits)) { return false; }	// Not a contiguous prefix.
+	return addPrefix(ntohl(basenl),bits,action);
+}
+
+bool GgsnFirewall::addRules(const char *spec, std::string &errmsg)
+{
+	std::string copy(spec);
+	const char *seps = " \t,;\n";
+	char *save;
+	for (char *tok = strtok_r(&copy[0],seps,&save); tok; tok = strtok_r(NULL,seps,&save)) {
+		Action action;
+		if (0 == strcasecmp(tok,"deny")) { action = Deny; }
+		else if (0 == strcasecmp(tok,"allow")) { action = Allow; }
+		else { errmsg = format("expected 'allow' or 'deny' at '%s'",tok); return false; }
+		char *addr = strtok_r(NULL,seps,&save);
+		if (addr == NULL) { errmsg = format("missing address after '%s'",tok); return false; }
+		char *slash = strchr(addr,'/');
+		unsigned bits = 32;
+		if (slash) {
+			*slash = 0;
+			char *end;
+			bits = strtoul(slash+1,&end,10);
+			if (end == slash+1 || *end || bits > 32) { errmsg = format("invalid prefix length in '%s/%s'",addr,slash+1); return false; }
+		}
+		struct in_addr inaddr;
+		if (!inet_aton(addr,&inaddr)) { errmsg = format("invalid address '%s'",addr); return false; }
+		addPrefix(ntohl(inaddr.s_addr),bits,action);
+	}
+	return true;
+}
+
+void GgsnFirewall::addRange(uint32_t start, Action action)
+{
+	// Merge with the previous range if the action is the same.
+	if (mRangeStart.size() && mRangeAction.back() == action) { return; }
+	mRangeStart.push_back(start);
+	mRangeAction.push_back(action);
+}
+
+void GgsnFirewall::compile()
+{
+	std::vector<Rule> rules(mRules);
+	std::sort(rules.begin(),rules.end());
+	// Two prefixes are either disjoint or one is inside the other, so sweeping through them in order
+	// we only need a stack of the prefixes enclosing the current position.
+	// The action at any address is that of the innermost enclosing prefix.
+	mRangeStart.clear();
+	mRangeAction.clear();
+	std::vector<const Rule*> stack;
+	uint64_t pos = 0;
+	for (unsigned i = 0; i < rules.size(); i++) {
+		const Rule *rule = &rules[i];
+		// Identical prefixes are adjacent after the sort; the last one added wins.
+		if (i+1 < rules.size() && rules[i+1].mBase == rule->mBase && rules[i+1].mBits == rule->mBits) { continue; }
+		while (stack.size() && stack.back()->end() <= rule->mBase) {
+			// Close out the enclosing prefixes that end before this rule starts.
+			const Rule *top = stack.back();
+			stack.pop_back();
+			if (top->end() > pos) {
+				addRange(pos,top->mAction);
+				pos = top->end();
+			}
+		}
+		if (rule->mBase > pos) {
+			addRange(pos,stack.size() ? stack.back()->mAction : Allow);
+			pos = rule->mBase;
+		}
+		stack.push_back(rule);
+	}
+	while (stack.size()) {
+		const Rule *top = stack.back();
+		stack.pop_back();
+		if (top->end() > pos) {
+			addRange(pos,top->mAction);
+			pos = top->end();
+		}
+	}
+	if (pos < (1ull << 32)) { addRange(pos,Allow); }
+
+	unsigned numIndex = 1u << sIndexBits;
+	mIndex.resize(numIndex + 1);
+	unsigned r = 0, nranges = mRangeStart.size();
+	for (unsigned h = 0; h < numIndex; h++) {
+		uint32_t first = h << (32 - sIndexBits);
+		while (r+1 < nranges && mRangeStart[r+1] <= first) { r++; }
+		mIndex[h] = r;
+	}
+	mIndex[numIndex] = nranges - 1;
+}
+
+GgsnFirewall::Action GgsnFirewall::lookup(uint32_t addrnl) const
+{
+	uint32_t addr = ntohl(addrnl);
+	unsigned h = addr >> (32 - sIndexBits);
+	unsigned lo = mIndex[h], hi = mIndex[h+1];
+	// We want the last range in lo..hi that starts at or before addr.
+	while (lo < hi) {
+		unsigned mid = (lo + hi + 1) / 2;
+		if (mRangeStart[mid] <= addr) { lo = mid; } else { hi = mid - 1; }
+	}
+	return (Action) mRangeAction[lo];
+}
+
+void GgsnFirewall::text(std::ostream &os) const
+{
+	os << "firewall" << LOGVAR2("rules",numRules()) << LOGVAR2("ranges",numRanges()) << "\n";
+	for (unsigned i = 0; i < mRules.size(); i++) {
+		const Rule &rule = mRules[i];
+		struct in_addr inaddr;
+		inaddr.s_addr = htonl(rule.mBase);
+		os << "  " << actionName(rule.mAction) << " " << inet_ntoa(inaddr) << "/" << rule.mBits << "\n";
+	}
+}
+
+};	// namespace
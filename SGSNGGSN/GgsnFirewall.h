@@ -0,0 +1,108 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef GGSNFIREWALL_H
+#define GGSNFIREWALL_H
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <ostream>
+
+namespace SGSN {
+
+// The mini-GGSN firewall, checked for the destination address of every uplink packet.
+// The rules are address prefixes with an allow or deny action, and the longest matching prefix wins,
+// so you can deny 10.0.0.0/8 and then allow 10.1.2.0/24.  Addresses that match no rule are allowed.
+//
+// compile() flattens the rules into the sorted list of disjoint address ranges they carve the address space into,
+// each with the action of the longest prefix covering it, so the rules never have to be looked at per packet.
+// There are at most 2*rules+1 ranges.  To find the range we index by the top 16 bits of the address,
+// which usually lands directly on the answer; otherwise we binary search the few ranges within that /16.
+// This takes 256K for the index regardless of the number of rules, which is a lot less than a DIR-24-8 table.
+class GgsnFirewall {
+	public:
+	enum Action { Allow = 0, Deny = 1 };
+	static const char *actionName(Action action) { return action == Deny ? "deny" : "allow"; }
+
+	private:
+	struct Rule {
+		uint32_t mBase;			// In host order, with the bits below the prefix cleared.
+		unsigned mBits;			// Prefix length 0..32.
+		Action mAction;
+		unsigned mOrder;		// Later rules for the same prefix replace earlier ones.
+		uint64_t end() const { return (uint64_t)mBase + (1ull << (32 - mBits)); }	// One past the last address.
+		bool operator<(const Rule &other) const;
+	};
+	std::vector<Rule> mRules;
+
+	// The compiled table.
+	std::vector<uint32_t> mRangeStart;	// Sorted; mRangeStart[0] is 0.
+	std::vector<uint8_t> mRangeAction;
+	std::vector<uint32_t> mIndex;		// For each /16, the range containing its first address, plus a sentinel.
+	static const unsigned sIndexBits = 16;
+	void addRange(uint32_t start, Action action);
+
+	public:
+	GgsnFirewall() { compile(); }
+	// Add a rule.  The base and mask are in network order, the way the old firewall took them.
+	// Returns false if the mask is not a contiguous prefix.
+	bool addRule(uint32_t basenl, uint32_t masknl, Action action);
+	// Add a rule for a prefix in host order with the specified number of bits.
+	bool addPrefix(uint32_t basehl, unsigned bits, Action action);
+	// Add rules from a string like "deny 10.0.0.0/8 allow 10.1.0.0/16", separated by spaces or commas.
+	// An address without a /bits is a single host.  Returns false and sets errmsg if the string is bad.
+	bool addRules(const char *spec, std::string &errmsg);
+	unsigned numRules() const { return mRules.size(); }
+	unsigned numRanges() const { return mRangeStart.size(); }
+
+	// Build the lookup table from the rules.  Must be called after the rules are added and before lookup.
+	void compile();
+
+	// Address in network order, as it appears in the IP header.
+	Action lookup(uint32_t addrnl) const;
+	bool denied(uint32_t addrnl) const { return lookup(addrnl) == Deny; }
+
+	void text(std::ostream &os) const;	// Print the rules.
+};
+
+// The firewall in use by the GGSN, or NULL if the firewall is disabled.
+// It is replaced as a whole by ggsnFirewallInstall() when the rules change, so a packet is checked against
+// either the old rules or the new rules, never half of each.
+// Read it only through a GgsnFirewallRef, which keeps the table from being deleted while it is used.
+extern GgsnFirewall * volatile gGgsnFirewall;
+void ggsnFirewallInstall(GgsnFirewall *fw);
+
+// Readers count themselves in under the current epoch before they load gGgsnFirewall.
+// ggsnFirewallInstall() stores the new table, moves to the next epoch and waits for the readers
+// of the previous epoch to finish before it deletes the old table, so readers never wait or lock.
+extern volatile unsigned gGgsnFirewallEpoch;
+extern volatile unsigned gGgsnFirewallReaders[2];
+
+class GgsnFirewallRef {
+	unsigned mEpoch;
+	GgsnFirewall *mFirewall;
+	GgsnFirewallRef(const GgsnFirewallRef&);			// Not copyable.
+	GgsnFirewallRef &operator=(const GgsnFirewallRef&);
+	public:
+	GgsnFirewallRef() : mEpoch(gGgsnFirewallEpoch & 1) {
+		__sync_fetch_and_add(&gGgsnFirewallReaders[mEpoch],1);	// A full barrier, so the load below follows it.
+		mFirewall = gGgsnFirewall;
+	}
+	~GgsnFirewallRef() { __sync_fetch_and_sub(&gGgsnFirewallReaders[mEpoch],1); }
+	GgsnFirewall *get() const { return mFirewall; }
+	GgsnFirewall *operator->() const { return mFirewall; }
+};
+
+};	// namespace
+#endif
@@ -0,0 +1,232 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the compiled GGSN firewall against a brute force longest prefix match,
+// then measure lookups/sec with 10, 1000 and 100000 rules, compiled and as the old linear rule list,
+// then replace the rules while other threads are looking up.
+// Usage: GgsnFirewallTest
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <Configuration.h>
+#include <Utils.h>
+#include <Threads.h>
+#include <UnitTest.h>
+#include "GgsnFirewall.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+struct TestRule { uint32_t base; unsigned bits; GgsnFirewall::Action action; };
+
+static uint32_t maskOf(unsigned bits) { return bits ? ~((1ull << (32 - bits)) - 1) : 0; }
+
+// Longest prefix wins; among identical prefixes the last one wins.
+static GgsnFirewall::Action bruteLookup(const vector<TestRule> &rules, uint32_t addr)
+{
+	int best = -1;
+	for (unsigned i = 0; i < rules.size(); i++) {
+		uint32_t mask = maskOf(rules[i].bits);
+		if ((addr & mask) == (rules[i].base & mask) && (best < 0 || rules[i].bits >= rules[best].bits)) { best = i; }
+	}
+	return best < 0 ? GgsnFirewall::Allow : rules[best].action;
+}
+
+static uint32_t randAddr() { return ((uint32_t)rand() << 16) ^ (uint32_t)rand(); }
+
+// Random rules clustered in a few areas so that they nest and overlap.
+static vector<TestRule> randomRules(unsigned num)
+{
+	vector<TestRule> rules;
+	uint32_t areas[4] = { randAddr(), randAddr(), randAddr(), randAddr() };
+	for (unsigned i = 0; i < num; i++) {
+		TestRule rule;
+		rule.bits = rand() % 33;
+		rule.base = areas[rand() % 4] ^ (randAddr() >> (8 + rand() % 24));
+		rule.action = (rand() % 3) ? GgsnFirewall::Deny : GgsnFirewall::Allow;
+		rules.push_back(rule);
+	}
+	return rules;
+}
+
+static void testRandom(unsigned numRules, unsigned numLookups)
+{
+	vector<TestRule> rules = randomRules(numRules);
+	GgsnFirewall fw;
+	for (unsigned i = 0; i < rules.size(); i++) { fw.addPrefix(rules[i].base,rules[i].bits,rules[i].action); }
+	fw.compile();
+	for (unsigned n = 0; n < numLookups; n++) {
+		// Half the addresses are near a rule boundary.
+		uint32_t addr;
+		if (n & 1) {
+			addr = randAddr();
+		} else {
+			const TestRule &rule = rules[rand() % rules.size()];
+			uint32_t start = rule.base & maskOf(rule.bits), end = start | ~maskOf(rule.bits);
+			addr = (rand() & 1 ? start : end) + (rand() % 3) - 1;
+		}
+		if (fw.lookup(htonl(addr)) != bruteLookup(rules,addr)) {
+			if (failures++ < 10) { printf("FAIL: %u rules, address %08x\n",numRules,addr); }
+		}
+	}
+}
+
+static void testBasics()
+{
+	GgsnFirewall empty;
+	CHECK(empty.lookup(inet_addr("1.2.3.4")) == GgsnFirewall::Allow);
+
+	GgsnFirewall fw;
+	string err;
+	CHECK(fw.addRules("deny 10.0.0.0/8, allow 10.1.0.0/16 deny 10.1.2.3 deny 0.0.0.0/0 allow 8.8.8.0/24",err));
+	fw.compile();
+	CHECK(fw.lookup(inet_addr("10.9.9.9")) == GgsnFirewall::Deny);
+	CHECK(fw.lookup(inet_addr("10.1.9.9")) == GgsnFirewall::Allow);
+	CHECK(fw.lookup(inet_addr("10.1.2.3")) == GgsnFirewall::Deny);
+	CHECK(fw.lookup(inet_addr("10.1.2.4")) == GgsnFirewall::Allow);
+	CHECK(fw.lookup(inet_addr("8.8.8.8")) == GgsnFirewall::Allow);
+	CHECK(fw.lookup(inet_addr("8.8.9.8")) == GgsnFirewall::Deny);
+	CHECK(fw.lookup(inet_addr("255.255.255.255")) == GgsnFirewall::Deny);
+	CHECK(fw.lookup(inet_addr("0.0.0.0")) == GgsnFirewall::Deny);
+
+	// The old style network order base and mask.
+	GgsnFirewall fw2;
+	CHECK(fw2.addRule(inet_addr("192.168.0.0"),inet_addr("255.255.0.0"),GgsnFirewall::Deny));
+	CHECK(!fw2.addRule(inet_addr("192.168.0.0"),inet_addr("255.0.255.0"),GgsnFirewall::Deny));
+	CHECK(fw2.addRule(inet_addr("192.168.1.1"),0xffffffff,GgsnFirewall::Allow));
+	fw2.compile();
+	CHECK(fw2.denied(inet_addr("192.168.7.7")));
+	CHECK(!fw2.denied(inet_addr("192.168.1.1")));
+	CHECK(!fw2.denied(inet_addr("192.169.0.0")));
+
+	// Later identical rule replaces the earlier one.
+	GgsnFirewall fw3;
+	CHECK(fw3.addRules("deny 1.2.3.0/24 allow 1.2.3.0/24",err));
+	fw3.compile();
+	CHECK(!fw3.denied(inet_addr("1.2.3.4")));
+
+	GgsnFirewall bad;
+	CHECK(!bad.addRules("deny",err));
+	CHECK(!bad.addRules("block 1.2.3.4",err));
+	CHECK(!bad.addRules("deny 1.2.3.4/33",err));
+	CHECK(!bad.addRules("deny 1.2.3.x/8",err));
+}
+
+// The old firewall: a list of deny rules, checked in turn.
+struct OldRule { uint32_t ipBasenl, ipMasknl; };
+
+// A deny list like an operator would have: scattered /16 to /32 prefixes.
+static void bench(unsigned numRules)
+{
+	vector<TestRule> rules;
+	for (unsigned i = 0; i < numRules; i++) {
+		TestRule rule = { randAddr(), 16 + (unsigned)rand() % 17, GgsnFirewall::Deny };
+		rules.push_back(rule);
+	}
+	GgsnFirewall fw;
+	vector<OldRule> old;
+	for (unsigned i = 0; i < rules.size(); i++) {
+		fw.addPrefix(rules[i].base,rules[i].bits,GgsnFirewall::Deny);
+		OldRule o = { htonl(rules[i].base), htonl(maskOf(rules[i].bits)) };
+		old.push_back(o);
+	}
+	double start = timef();
+	fw.compile();
+	double compileTime = timef() - start;
+
+	const unsigned numAddrs = 4096;
+	uint32_t addrs[numAddrs];
+	// Half the packets are to a denied address.
+	for (unsigned i = 0; i < numAddrs; i++) {
+		addrs[i] = htonl((i & 1) ? randAddr() : rules[rand() % numRules].base + rand() % 256);
+	}
+	unsigned sink = 0;
+
+	unsigned iterations = 20000000;
+	start = timef();
+	for (unsigned n = 0; n < iterations; n++) { sink += fw.denied(addrs[n % numAddrs]); }
+	double compiled = (timef() - start) / iterations;
+
+	iterations = 200000000 / (numRules * 10);
+	if (iterations < 1000) { iterations = 1000; }
+	start = timef();
+	for (unsigned n = 0; n < iterations; n++) {
+		uint32_t dst = addrs[n % numAddrs];
+		for (unsigned r = 0; r < old.size(); r++) {
+			if ((dst & old[r].ipMasknl) == (old[r].ipBasenl & old[r].ipMasknl)) { sink++; break; }
+		}
+	}
+	double linear = (timef() - start) / iterations;
+
+	printf("rules=%-6u ranges=%-6u compile %.1f ms; compiled %.1f nsec (%.1fM lookups/sec), linear list %.1f nsec (%.3fM lookups/sec)%s\n",
+		numRules,fw.numRanges(),compileTime*1e3,compiled*1e9,1e-6/compiled,linear*1e9,1e-6/linear,sink==1?" ":"");
+}
+
+// Readers look up through a GgsnFirewallRef while the rules are replaced underneath them.
+// A reader that used a table after it was deleted would see garbage, or crash.
+static volatile bool sStopReaders = false;
+static volatile unsigned sBadLookups = 0, sLookups = 0;
+static void *firewallReader(void *)
+{
+	while (!sStopReaders) {
+		GgsnFirewallRef fw;
+		if (fw.get() == NULL) { continue; }
+		bool ok = fw->lookup(htonl(0x0a000001)) == GgsnFirewall::Deny && fw->lookup(htonl(0x0b000001)) == GgsnFirewall::Allow;
+		if (!ok) { __sync_fetch_and_add(&sBadLookups,1); }
+		__sync_fetch_and_add(&sLookups,1);
+	}
+	return NULL;
+}
+
+static void testInstall()
+{
+	Thread readers[3];
+	for (unsigned r = 0; r < 3; r++) { readers[r].start(firewallReader,NULL); }
+	for (unsigned n = 0; n < 200; n++) {
+		GgsnFirewall *fw = new GgsnFirewall;
+		fw->addPrefix(0x0a000000,8,GgsnFirewall::Deny);
+		fw->compile();
+		ggsnFirewallInstall(fw);
+		CHECK(gGgsnFirewall == fw && gGgsnFirewall->denied(inet_addr("10.0.0.1")));
+	}
+	sStopReaders = true;
+	for (unsigned r = 0; r < 3; r++) { readers[r].join(); }
+	CHECK(sBadLookups == 0 && sLookups > 0);
+	CHECK(gGgsnFirewallReaders[0] == 0 && gGgsnFirewallReaders[1] == 0);
+	ggsnFirewallInstall(NULL);
+	printf("install: %u lookups during 200 installs, %u bad\n",sLookups,sBadLookups);
+}
+
+int main(int argc, char **argv)
+{
+	srand(1);
+	testBasics();
+	testRandom(1,10000);
+	testRandom(10,100000);
+	testRandom(300,100000);
+	testRandom(3000,20000);
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+
+	bench(10);
+	bench(1000);
+	bench(100000);
+
+	testInstall();
+	return failures ? 1 : 0;
+}
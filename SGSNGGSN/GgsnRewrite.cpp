@@ -0,0 +1,113 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include "GgsnRewrite.h"
+#include "miniggsn.h"
+
+namespace SGSN {
+
+// The ttl shares a 16 bit word with the protocol, so that is the word that changes.
+void ip_rewrite_ttl(unsigned char *packet)
+{
+	struct iphdr *iph = (struct iphdr*)packet;
+	uint16_t oldword, newword;
+	memcpy(&oldword,&iph->ttl,2);
+	iph->ttl--;
+	memcpy(&newword,&iph->ttl,2);
+	iph->check = ip_csum_update16(iph->check,oldword,newword);
+}
+
+// Return the TCP header if this is the first fragment of a TCP packet with the whole TCP header in it, else NULL.
+static struct tcphdr *ip_tcp_header(unsigned char *packet, unsigned len)
+{
+	struct iphdr *iph = (struct iphdr*)packet;
+	if (iph->protocol != IPPROTO_TCP) { return 0; }
+	if (ntohs(iph->frag_off) & IP_OFFMASK) { return 0; }
+	unsigned iphlen = 4 * iph->ihl;
+	if (len < iphlen + sizeof(struct tcphdr)) { return 0; }
+	struct tcphdr *tcph = (struct tcphdr*)(packet + iphlen);
+	if (tcph->doff < 5 || len < iphlen + 4 * tcph->doff) { return 0; }
+	return tcph;
+}
+
+bool ip_rewrite_mss(unsigned char *packet, unsigned len, unsigned mss)
+{
+	struct tcphdr *tcph = ip_tcp_header(packet,len);
+	if (tcph == 0 || !tcph->syn) { return false; }
+	unsigned char *opt = (unsigned char*)tcph + sizeof(struct tcphdr);
+	unsigned char *end = (unsigned char*)tcph + 4 * tcph->doff;
+	while (opt < end) {
+		unsigned kind = opt[0];
+		if (kind == TCPOPT_EOL) { break; }
+		if (kind == TCPOPT_NOP) { opt++; continue; }
+		if (opt + 2 > end || opt[1] < 2 || opt + opt[1] > end) { break; }	// Malformed; leave it alone.
+		if (kind == TCPOPT_MAXSEG && opt[1] == TCPOLEN_MAXSEG) {
+			uint16_t oldmss = (opt[2] << 8) | opt[3];
+			if (oldmss <= mss) { return false; }
+			// The option may follow a single NOP, putting the value at an odd offset where it straddles
+			// two of the 16 bit words the checksum is made of; then update the checksum for both words.
+			// The option area is a multiple of 4 bytes, so both words are inside it.
+			unsigned offset = opt + 2 - (unsigned char*)tcph;
+			unsigned char *word = (unsigned char*)tcph + (offset & ~1u);
+			if (offset & 1) {
+				uint32_t oldwords, newwords;
+				memcpy(&oldwords,word,4);
+				opt[2] = mss >> 8; opt[3] = mss & 0xff;
+				memcpy(&newwords,word,4);
+				tcph->check = ip_csum_update32(tcph->check,oldwords,newwords);
+			} else {
+				uint16_t oldword, newword;
+				memcpy(&oldword,word,2);
+				opt[2] = mss >> 8; opt[3] = mss & 0xff;
+				memcpy(&newword,word,2);
+				tcph->check = ip_csum_update16(tcph->check,oldword,newword);
+			}
+			return true;
+		}
+		opt += opt[1];
+	}
+	return false;
+}
+
+void ip_rewrite_addr(unsigned char *packet, unsigned len, bool src, uint32_t addrnl)
+{
+	struct iphdr *iph = (struct iphdr*)packet;
+	uint32_t *field = src ? &iph->saddr : &iph->daddr;
+	uint32_t oldaddr = *field;
+	if (oldaddr == addrnl) { return; }
+	*field = addrnl;
+	iph->check = ip_csum_update32(iph->check,oldaddr,addrnl);
+
+	if (ntohs(iph->frag_off) & IP_OFFMASK) { return; }
+	unsigned iphlen = 4 * iph->ihl;
+	if (iph->protocol == IPPROTO_TCP) {
+		if (len < iphlen + sizeof(struct tcphdr)) { return; }
+		struct tcphdr *tcph = (struct tcphdr*)(packet + iphlen);
+		tcph->check = ip_csum_update32(tcph->check,oldaddr,addrnl);
+	} else if (iph->protocol == IPPROTO_UDP) {
+		if (len < iphlen + sizeof(struct udphdr)) { return; }
+		struct udphdr *udph = (struct udphdr*)(packet + iphlen);
+		if (udph->check == 0) { return; }	// The sender did not compute one.
+		udph->check = ip_csum_update32(udph->check,oldaddr,addrnl);
+		if (udph->check == 0) { udph->check = 0xffff; }	// 0 means none for UDP.
+	}
+}
+
+};	// namespace
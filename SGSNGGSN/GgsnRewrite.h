@@ -0,0 +1,41 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef GGSNREWRITE_H
+#define GGSNREWRITE_H
+#include <stdint.h>
+
+namespace SGSN {
+
+// Header rewrites done by the GGSN on the packets it forwards.
+// Each one patches the packet in place and updates the IP and TCP/UDP checksums for just the words it changed,
+// using the RFC 1624 incremental update in iputils.cpp, instead of recomputing them over the whole packet.
+// The packet is a raw IPv4 packet starting with the IP header, len bytes long.  The header must already have
+// been checked, as miniggsn_snd_npdu_by_mgc() does for uplink; these only check what they need to stay in bounds.
+
+// Decrement the TTL.  The caller checks it is not already 0.
+void ip_rewrite_ttl(unsigned char *packet);
+
+// If this is a TCP SYN with an MSS option larger than mss, lower it to mss.  Return true if the packet was changed.
+// An MS behind an RLC with a smaller MTU than the server believes in, or behind a tunnel, needs this to avoid
+// fragments or black holes; it is applied to SYNs in both directions.
+bool ip_rewrite_mss(unsigned char *packet, unsigned len, unsigned mss);
+
+// Replace the source (if src) or destination address, given in network order.
+// The TCP or UDP checksum is updated too, because it covers the addresses in the pseudo-header.
+// Only the first fragment of a fragmented packet has the TCP or UDP header.
+void ip_rewrite_addr(unsigned char *packet, unsigned len, bool src, uint32_t addrnl);
+
+};	// namespace
+#endif
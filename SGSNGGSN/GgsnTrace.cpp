@@ -0,0 +1,203 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <Utils.h>
+#include "GgsnTrace.h"
+
+namespace SGSN {
+
+GgsnTrace gGgsnTrace;
+
+// The trace file is this header followed by the records, in the byte order of the machine that wrote it.
+static const char sTraceMagic[8] = { 'G','G','S','N','T','R','C','1' };
+struct TraceFileHeader {
+	char mMagic[8];
+	uint32_t mRecordSize;
+	uint32_t mCount;
+};
+
+const char *GgsnTrace::verdictName(unsigned verdict)
+{
+	switch (verdict) {
+	case Forwarded: return "forwarded";
+	case Duplicate: return "duplicate";
+	case DupTossed: return "duptossed";
+	case NoContext: return "nocontext";
+	case BadPacket: return "badpacket";
+	case Denied: return "denied";
+	case WriteError: return "writeerror";
+	}
+	return "unknown";
+}
+
+bool GgsnTrace::init(unsigned numRecords)
+{
+	if (mRecords) { return true; }
+	unsigned size = 16;
+	while (size < numRecords) { size <<= 1; }
+	Record *records = (Record*)calloc(size,sizeof(Record));
+	if (records == NULL) { return false; }
+	mMask = size - 1;
+	mPos = 0;
+	mRecords = records;
+	return true;
+}
+
+void GgsnTrace::clear()
+{
+	if (mRecords == NULL) { return; }
+	// Anything still being written will reappear; that is harmless.
+	for (unsigned i = 0; i <= mMask; i++) { mRecords[i].mSeq = 0; }
+}
+
+void GgsnTrace::tick()
+{
+	if (mSample == 0) { return; }
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	mNow = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void GgsnTrace::record(Dir dir, Verdict verdict, unsigned con, const unsigned char *packet, unsigned len)
+{
+	uint32_t pos = __sync_fetch_and_add(&mPos,1);
+	Record *rp = &mRecords[pos & mMask];
+	rp->mSeq = 0;			// Mark it incomplete while we write it.
+	__sync_synchronize();
+
+	rp->mTime = mNow;
+	rp->mLen = len;
+	rp->mDir = dir;
+	rp->mVerdict = verdict;
+	rp->mSpare = 0;
+	rp->mCon = con;
+	rp->mSport = rp->mDport = 0;
+	if (len >= sizeof(struct iphdr)) {
+		const struct iphdr *iph = (const struct iphdr*)packet;
+		rp->mSrc = iph->saddr;
+		rp->mDst = iph->daddr;
+		rp->mProto = iph->protocol;
+		unsigned iphlen = 4 * iph->ihl;
+		// The ports are the first 4 bytes of both the TCP and UDP headers.
+		if ((iph->protocol == IPPROTO_TCP || iph->protocol == IPPROTO_UDP) && len >= iphlen + 4) {
+			memcpy(&rp->mSport,packet + iphlen,2);
+			memcpy(&rp->mDport,packet + iphlen + 2,2);
+		}
+	} else {
+		rp->mSrc = rp->mDst = 0;
+		rp->mProto = 0;
+	}
+	__sync_synchronize();
+	rp->mSeq = pos + 1;
+}
+
+void GgsnTrace::snapshot(std::vector<Record> &out, unsigned maxRecords) const
+{
+	out.clear();
+	if (mRecords == NULL) { return; }
+	uint32_t end = mPos;
+	unsigned count = end < mMask + 1 ? end : mMask + 1;
+	if (count > maxRecords) { count = maxRecords; }
+	out.reserve(count);
+	for (uint32_t pos = end - count; pos != end; pos++) {
+		const volatile Record *rp = &mRecords[pos & mMask];
+		uint32_t seq1 = rp->mSeq;
+		__sync_synchronize();
+		Record copy;
+		memcpy(&copy,(const void*)rp,sizeof(copy));
+		__sync_synchronize();
+		// Keep it only if it is the record we wanted and no one wrote it while we copied it.
+		if (seq1 != pos + 1 || rp->mSeq != seq1) { continue; }
+		out.push_back(copy);
+	}
+}
+
+void GgsnTrace::Record::text(std::ostream &os) const
+{
+	time_t secs = mTime / 1000000;
+	struct tm tm;
+	localtime_r(&secs,&tm);
+	char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET,&mSrc,src,sizeof(src));
+	inet_ntop(AF_INET,&mDst,dst,sizeof(dst));
+	const char *proto = mProto == IPPROTO_TCP ? "tcp" : mProto == IPPROTO_UDP ? "udp" : mProto == IPPROTO_ICMP ? "icmp" : NULL;
+	os << format("%02d:%02d:%02d.%06u %s %-10s con=%-3u ",tm.tm_hour,tm.tm_min,tm.tm_sec,(unsigned)(mTime % 1000000),
+		mDir == Uplink ? "up  " : "down",verdictName(mVerdict),mCon);
+	if (proto) { os << proto; } else { os << "proto=" << (unsigned)mProto; }
+	if (mSport || mDport) {
+		os << format(" %s:%u > %s:%u",src,ntohs(mSport),dst,ntohs(mDport));
+	} else {
+		os << format(" %s > %s",src,dst);
+	}
+	os << " len=" << mLen << "\n";
+}
+
+void GgsnTrace::dump(std::ostream &os, unsigned maxRecords) const
+{
+	std::vector<Record> records;
+	snapshot(records,maxRecords);
+	os << "trace" << LOGVAR2("size",size()) << LOGVAR2("sample",sample()) << LOGVAR2("total",total())
+	   << LOGVAR2("shown",records.size()) << "\n";
+	for (unsigned i = 0; i < records.size(); i++) { records[i].text(os); }
+}
+
+bool GgsnTrace::save(const char *filename, std::string &errmsg) const
+{
+	std::vector<Record> records;
+	snapshot(records,mMask + 1);
+	FILE *fp = fopen(filename,"w");
+	if (fp == NULL) { errmsg = format("could not open %s: %s",filename,strerror(errno)); return false; }
+	TraceFileHeader hdr;
+	memcpy(hdr.mMagic,sTraceMagic,sizeof(hdr.mMagic));
+	hdr.mRecordSize = sizeof(Record);
+	hdr.mCount = records.size();
+	bool ok = fwrite(&hdr,sizeof(hdr),1,fp) == 1;
+	if (ok && records.size()) { ok = fwrite(&records[0],sizeof(Record),records.size(),fp) == records.size(); }
+	if (fclose(fp) != 0) { ok = false; }
+	if (!ok) { errmsg = format("error writing %s: %s",filename,strerror(errno)); }
+	return ok;
+}
+
+bool GgsnTrace::load(const char *filename, std::vector<Record> &out, std::string &errmsg)
+{
+	out.clear();
+	FILE *fp = fopen(filename,"r");
+	if (fp == NULL) { errmsg = format("could not open %s: %s",filename,strerror(errno)); return false; }
+	TraceFileHeader hdr;
+	bool ok = fread(&hdr,sizeof(hdr),1,fp) == 1 && 0 == memcmp(hdr.mMagic,sTraceMagic,sizeof(sTraceMagic))
+		&& hdr.mRecordSize == sizeof(Record);
+	if (!ok) {
+		errmsg = format("%s is not a GGSN trace file",filename);
+	} else {
+		out.resize(hdr.mCount);
+		if (hdr.mCount && fread(&out[0],sizeof(Record),hdr.mCount,fp) != hdr.mCount) {
+			errmsg = format("%s is truncated",filename);
+			out.clear();
+			ok = false;
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+};	// namespace
@@ -0,0 +1,106 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef GGSNTRACE_H
+#define GGSNTRACE_H
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <ostream>
+
+namespace SGSN {
+
+// A binary trace of GGSN packet events, for when you want to know what happened to the packets
+// without paying for formatting a log message for each one.
+// Each event is a fixed size record written into a ring in memory: no formatting, no allocation, no locks.
+// The GGSN read and write threads both record events, so a slot is claimed with an atomic increment
+// of the ring position.  The records are decoded later by "sgsn trace" or saved to a file.
+//
+// Sampling: 0 turns tracing off; N records one in N forwarded packets.  Dropped packets are always recorded
+// while tracing is on, since those are usually what you are looking for.
+class GgsnTrace {
+	public:
+	enum Dir { Downlink = 0, Uplink = 1 };	// Downlink is from the tun device to the MS.
+	enum Verdict {
+		Forwarded,		// Sent on.
+		Duplicate,		// A duplicate TCP packet that was sent on anyway.
+		DupTossed,		// A duplicate TCP packet that was discarded.
+		NoContext,		// No PDP context for the destination address.
+		BadPacket,		// Failed the uplink header checks.
+		Denied,			// Discarded by the firewall.
+		WriteError,		// The tun write failed.
+	};
+	static const char *verdictName(unsigned verdict);
+
+	// 32 bytes.  Addresses and ports are kept in network order as they came out of the packet.
+	struct Record {
+		uint64_t mTime;			// Microseconds since the epoch, as of the last tick().
+		uint32_t mSrc, mDst;
+		uint16_t mSport, mDport;	// 0 unless TCP or UDP.
+		uint16_t mLen;
+		uint8_t mProto;
+		uint8_t mDir;
+		uint8_t mVerdict;
+		uint8_t mSpare;
+		uint16_t mCon;			// mg_con_t index + 1, or 0 if none.
+		uint32_t mSeq;			// Ring position + 1, written last; see snapshot().
+		void text(std::ostream &os) const;
+	};
+
+	private:
+	Record *mRecords;
+	unsigned mMask;				// Number of records - 1.
+	volatile uint32_t mPos;		// Total records claimed.
+	volatile unsigned mSample;
+	volatile uint64_t mNow;		// Set by tick().
+	unsigned mSkip;				// Counts forwarded packets for sampling.
+	void record(Dir dir, Verdict verdict, unsigned con, const unsigned char *packet, unsigned len);
+
+	public:
+	GgsnTrace() : mRecords(0), mMask(0), mPos(0), mSample(0), mNow(0), mSkip(0) {}
+	// Allocate the ring, rounding the size up to a power of two.  Only called once, at GGSN startup.
+	bool init(unsigned numRecords);
+	void setSample(unsigned sample) { mSample = sample; }
+	unsigned sample() const { return mSample; }
+	unsigned size() const { return mRecords ? mMask + 1 : 0; }
+	uint32_t total() const { return mPos; }
+	void clear();
+
+	// Reading the clock for every packet would cost more than the rest of the record, so the GGSN threads
+	// call this once per batch of packets and the records in the batch get that time.
+	// A 64 bit store is not atomic on 32 bit machines, but a torn time costs a wrong timestamp at worst.
+	void tick();
+
+	// Called for every packet.  The test for whether to record is inline so that it costs nothing when off.
+	// The sampling count is not locked; two threads may occasionally miss an increment, which only makes
+	// the sampling less exact.
+	void trace(Dir dir, Verdict verdict, unsigned con, const unsigned char *packet, unsigned len) {
+		unsigned sample = mSample;
+		if (sample == 0 || mRecords == 0) { return; }
+		if (verdict == Forwarded && sample > 1 && ++mSkip % sample) { return; }
+		record(dir,verdict,con,packet,len);
+	}
+
+	// Copy out up to maxRecords of the most recent complete records, oldest first.
+	// Records being written at the time, or overwritten while we copy them, are skipped.
+	void snapshot(std::vector<Record> &out, unsigned maxRecords) const;
+	void dump(std::ostream &os, unsigned maxRecords) const;
+	// Save the records to a file for decoding later with load().
+	bool save(const char *filename, std::string &errmsg) const;
+	static bool load(const char *filename, std::vector<Record> &out, std::string &errmsg);
+};
+extern GgsnTrace gGgsnTrace;
+
+};	// namespace
+#endif
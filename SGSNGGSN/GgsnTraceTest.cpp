@@ -0,0 +1,194 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the GGSN packet trace ring with two writer threads and a reader, save and load it,
+// then measure the cost per packet of tracing against formatting a log line for each packet.
+// Usage: GgsnTraceTest            run the tests
+//        GgsnTraceTest tracefile  decode a file written by "sgsn trace save"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <iostream>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "GgsnTrace.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+// The packet length and ports encode the writer and a counter so the reader can check each record is whole.
+static void makePacket(unsigned char *buf, unsigned writer, unsigned n)
+{
+	memset(buf,0,40);
+	struct iphdr *iph = (struct iphdr*)buf;
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = htonl(0x0a000000 + n);
+	iph->daddr = htonl(0xc0a86300 + writer);
+	struct tcphdr *tcph = (struct tcphdr*)(buf + 20);
+	tcph->source = htons(n & 0xffff);
+	tcph->dest = htons(writer);
+}
+
+static bool recordOk(const GgsnTrace::Record &rec)
+{
+	unsigned n = ntohl(rec.mSrc) - 0x0a000000;
+	unsigned writer = ntohl(rec.mDst) - 0xc0a86300;
+	return rec.mProto == IPPROTO_TCP && writer < 2 && ntohs(rec.mDport) == writer && ntohs(rec.mSport) == (n & 0xffff)
+		&& rec.mLen == (n & 0x3ff) + 40 && rec.mDir == writer && rec.mCon == (n & 0xff);
+}
+
+static GgsnTrace sTrace;
+static const unsigned sPerWriter = 2000000;
+
+static void *writer(void *arg)
+{
+	unsigned w = (unsigned)(uintptr_t)arg;
+	unsigned char buf[64];
+	for (unsigned n = 0; n < sPerWriter; n++) {
+		makePacket(buf,w,n);
+		if (n % 32 == 0) { sTrace.tick(); }
+		sTrace.trace((GgsnTrace::Dir)w,GgsnTrace::Forwarded,n & 0xff,buf,(n & 0x3ff) + 40);
+	}
+	return NULL;
+}
+
+static void testConcurrent()
+{
+	sTrace.init(1000);
+	CHECK(sTrace.size() == 1024);
+	sTrace.setSample(1);
+	pthread_t threads[2];
+	for (uintptr_t w = 0; w < 2; w++) { pthread_create(&threads[w],NULL,writer,(void*)w); }
+	unsigned snapshots = 0, records = 0;
+	vector<GgsnTrace::Record> out;
+	while (sTrace.total() < 2 * sPerWriter) {
+		sTrace.snapshot(out,1024);
+		snapshots++;
+		for (unsigned i = 0; i < out.size(); i++) {
+			records++;
+			if (!recordOk(out[i])) { if (failures++ < 10) { printf("FAIL: torn record\n"); } }
+			if (i && out[i].mSeq <= out[i-1].mSeq) { if (failures++ < 10) { printf("FAIL: records out of order\n"); } }
+		}
+	}
+	for (unsigned w = 0; w < 2; w++) { pthread_join(threads[w],NULL); }
+	CHECK(sTrace.total() == 2 * sPerWriter);
+	sTrace.snapshot(out,5000);
+	CHECK(out.size() == 1024);
+	printf("concurrent: %u snapshots of %u records checked while writing\n",snapshots,records);
+
+	// Sampling: one in 10 forwarded packets, all the drops.
+	sTrace.clear();
+	sTrace.snapshot(out,5000);
+	CHECK(out.size() == 0);
+	sTrace.setSample(10);
+	unsigned char buf[64];
+	makePacket(buf,0,0);
+	uint32_t before = sTrace.total();
+	for (unsigned n = 0; n < 100; n++) { sTrace.trace(GgsnTrace::Uplink,GgsnTrace::Forwarded,0,buf,40); }
+	for (unsigned n = 0; n < 5; n++) { sTrace.trace(GgsnTrace::Uplink,GgsnTrace::Denied,0,buf,40); }
+	CHECK(sTrace.total() - before == 15);
+	sTrace.setSample(0);
+	sTrace.trace(GgsnTrace::Uplink,GgsnTrace::Denied,0,buf,40);
+	CHECK(sTrace.total() - before == 15);
+
+	// A runt packet must not be read past its end.
+	sTrace.setSample(1);
+	sTrace.trace(GgsnTrace::Downlink,GgsnTrace::BadPacket,0,buf,8);
+	sTrace.snapshot(out,1);
+	CHECK(out.size() == 1 && out[0].mSrc == 0 && out[0].mLen == 8);
+
+	// Save and load.
+	char filename[] = "/tmp/ggsntraceXXXXXX";
+	int fd = mkstemp(filename);
+	close(fd);
+	string errmsg;
+	CHECK(sTrace.save(filename,errmsg));
+	vector<GgsnTrace::Record> loaded;
+	CHECK(GgsnTrace::load(filename,loaded,errmsg));
+	sTrace.snapshot(out,5000);
+	CHECK(loaded.size() == out.size() && loaded.size() && 0 == memcmp(&loaded[0],&out[0],loaded.size() * sizeof(out[0])));
+	unlink(filename);
+	CHECK(!GgsnTrace::load("/dev/null",loaded,errmsg));
+	out.back().text(cout);
+}
+
+// What the GGSN did for each packet when logging at INFO: format the packet, then log it.
+static void formatPacket(const unsigned char *packet, int len)
+{
+	const struct iphdr *iph = (const struct iphdr*)packet;
+	const struct tcphdr *tcph = (const struct tcphdr*) (packet + 4 * iph->ihl);
+	char infobuf[200], nbuf1[40], nbuf2[40];
+	struct in_addr a1, a2;
+	a1.s_addr = iph->saddr; a2.s_addr = iph->daddr;
+	strcpy(nbuf1,inet_ntoa(a1)); strcpy(nbuf2,inet_ntoa(a2));
+	sprintf(infobuf,"proto=%s %d byte packet seq=%u ack=%u id=%u frag=%u from %s:%d to %s:%d",
+		"tcp", len, tcph->seq, tcph->ack_seq, iph->id, iph->frag_off, nbuf1,tcph->source, nbuf2,tcph->dest);
+	char *tmp;
+	if (asprintf(&tmp,"ggsn: received %s at %s",infobuf,timestr().c_str()) > 0) {
+		std::ostringstream ss;	// Where LOG(INFO) would put it.
+		ss << tmp;
+		free(tmp);
+	}
+}
+
+static void bench()
+{
+	GgsnTrace trace;
+	trace.init(8192);
+	unsigned char buf[64];
+	makePacket(buf,1,12345);
+	const unsigned iterations = 10000000;
+	unsigned samples[] = { 0, 100, 1 };
+	for (unsigned i = 0; i < 3; i++) {
+		trace.setSample(samples[i]);
+		double start = timef();
+		// With a tick for every batch of 32 packets, as the GGSN does with the default GGSN.Tun.BatchSize.
+		for (unsigned n = 0; n < iterations; n++) {
+			if (n % 32 == 0) { trace.tick(); }
+			trace.trace(GgsnTrace::Downlink,GgsnTrace::Forwarded,n & 0xff,buf,1400);
+		}
+		double elapsed = (timef() - start) / iterations;
+		printf("trace sample=%-3u %.1f nsec/packet\n",samples[i],elapsed*1e9);
+	}
+	unsigned count = 200000;
+	double start = timef();
+	for (unsigned n = 0; n < count; n++) { formatPacket(buf,1400); }
+	printf("formatted log line %.1f nsec/packet\n",(timef() - start) / count * 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		vector<GgsnTrace::Record> records;
+		string errmsg;
+		if (!GgsnTrace::load(argv[1],records,errmsg)) { cerr << errmsg << endl; return 1; }
+		for (unsigned i = 0; i < records.size(); i++) { records[i].text(cout); }
+		return 0;
+	}
+	testConcurrent();
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+	bench();
+	return failures ? 1 : 0;
+}
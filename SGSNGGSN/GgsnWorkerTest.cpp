@@ -0,0 +1,253 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Loopback benchmark of the GGSN forwarding workers.  Must be run as root.
+// A local traffic generator sends UDP packets to addresses routed to a multi-queue tun device.
+// Each packet carries a sequence number for its destination address, which stands in for a PDP context.
+// min(queues,workers) reader threads drain the tun queues and steer each packet to a worker by its
+// destination address, as miniggsn_dispatch() does with mg_con_worker(); the workers do some simulated
+// per-packet work and check that the packets for each address arrive in order.
+// Reports packets/sec for 1, 2, 4 and 8 workers.
+// Usage: GgsnWorkerTest [packets] [queues] [work] [cpus]
+// where work is the simulated per-packet work in checksum passes over the packet,
+// and cpus is the number of CPUs to pin the workers to round robin, 0 to not pin them.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <Configuration.h>
+#include <Interthread.h>
+#include <LinkedLists.h>
+#include <Utils.h>
+#include "miniggsn.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+namespace SGSN {
+FILE *mg_log_fp = NULL;		// These normally live in miniggsn.cpp.
+int mg_debug_level = 0;
+};
+
+static const char *sTunName = "ggsnwork";
+static const char *sRoute = "192.168.214.0/24";
+static const unsigned sNumFlows = 250;
+static const unsigned sPayload = 200;
+static volatile bool sSending;
+static unsigned sNumPackets, sWork, sCpus;
+
+struct WorkPdu : SingleLinkListNode {
+	unsigned char mData[1522];
+	int mLen;
+	bool mStop;
+	WorkPdu() : mLen(0), mStop(false) {}
+};
+
+struct Worker {
+	unsigned mIndex;
+	InterthreadQueue<WorkPdu,SingleLinkList<> > mQ;
+	unsigned mPackets, mOutOfOrder;
+	uint32_t mSum;
+	uint32_t mNextSeq[sNumFlows];
+	pthread_t mThread;
+};
+static Worker sWorkers[MG_MAX_WORKERS];
+static unsigned sNumWorkers;
+
+struct Reader {
+	unsigned mIndex, mNumReaders;
+	int *mFds;
+	int mNumQueues;
+	unsigned mPackets;
+	pthread_t mThread;
+};
+
+static void pin(unsigned index)
+{
+	if (!sCpus) { return; }
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(index % sCpus,&cpus);
+	pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+}
+
+// The payload starts with the sequence number for the destination address.
+static void *generator(void *)
+{
+	int sock = socket(AF_INET,SOCK_DGRAM,0);
+	unsigned char payload[sPayload];
+	memset(payload,0x5a,sizeof(payload));
+	uint32_t seq[sNumFlows];
+	memset(seq,0,sizeof(seq));
+	struct sockaddr_in to;
+	memset(&to,0,sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(5000);
+	uint32_t base = ntohl(inet_addr("192.168.214.0"));
+	for (unsigned n = 0; n < sNumPackets; n++) {
+		unsigned flow = n % sNumFlows;
+		to.sin_addr.s_addr = htonl(base + 1 + flow);
+		memcpy(payload,&seq[flow],4);
+		while (sendto(sock,payload,sizeof(payload),0,(struct sockaddr*)&to,sizeof(to)) < 0) {
+			if (errno != ENOBUFS) { perror("sendto"); break; }
+			usleep(10);	// The tun transmit queue is full; let the readers catch up.
+		}
+		seq[flow]++;
+	}
+	close(sock);
+	sSending = false;
+	return 0;
+}
+
+// Steer by destination address, like mg_con_worker().
+static void *reader(void *arg)
+{
+	Reader *rd = (Reader*)arg;
+	pin(rd->mIndex);
+	struct pollfd pfds[MG_MAX_TUN_QUEUES];
+	int nfds = 0;
+	for (int q = rd->mIndex; q < rd->mNumQueues; q += rd->mNumReaders) {
+		pfds[nfds].fd = rd->mFds[q];
+		pfds[nfds].events = POLLIN;
+		nfds++;
+	}
+	WorkPdu *pdu = new WorkPdu;
+	while (true) {
+		for (int i = 0; i < nfds; i++) { pfds[i].revents = 0; }
+		if (poll(pfds,nfds,sSending ? 100 : 50) <= 0) { if (!sSending) break; continue; }
+		for (int i = 0; i < nfds; i++) {
+			if (!(pfds[i].revents & POLLIN)) { continue; }
+			for (unsigned b = 0; b < 32; b++) {
+				int len = read(pfds[i].fd,pdu->mData,1520);
+				if (len <= 0) { break; }
+				if (len < (int)(sizeof(struct iphdr) + 8 + 4)) { continue; }
+				pdu->mLen = len;
+				struct iphdr *iph = (struct iphdr*)pdu->mData;
+				sWorkers[ntohl(iph->daddr) % sNumWorkers].mQ.write(pdu);
+				rd->mPackets++;
+				pdu = new WorkPdu;
+			}
+		}
+	}
+	delete pdu;
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	Worker *w = (Worker*)arg;
+	pin(w->mIndex);
+	uint32_t base = ntohl(inet_addr("192.168.214.0"));
+	WorkPdu *batch[32];
+	while (true) {
+		unsigned cnt = w->mQ.readBatch(batch,32);
+		for (unsigned i = 0; i < cnt; i++) {
+			WorkPdu *pdu = batch[i];
+			if (pdu->mStop) { delete pdu; return 0; }
+			struct iphdr *iph = (struct iphdr*)pdu->mData;
+			unsigned flow = ntohl(iph->daddr) - base - 1;
+			uint32_t seq;
+			memcpy(&seq,pdu->mData + 4*iph->ihl + 8,4);
+			if (flow < sNumFlows) {
+				// Packets may be lost in the tun, but must not be reordered.
+				if (seq < w->mNextSeq[flow]) { w->mOutOfOrder++; }
+				w->mNextSeq[flow] = seq + 1;
+			}
+			for (unsigned k = 0; k < sWork; k++) { w->mSum += ip_checksum(pdu->mData,pdu->mLen,NULL); }
+			w->mPackets++;
+			delete pdu;
+		}
+	}
+}
+
+static void run(int *fds, int nq, unsigned numWorkers)
+{
+	// Flush anything left over from the previous run.
+	unsigned char junk[1522];
+	for (int q = 0; q < nq; q++) { while (read(fds[q],junk,1520) > 0) {} }
+
+	sNumWorkers = numWorkers;
+	for (unsigned n = 0; n < numWorkers; n++) {
+		Worker *w = &sWorkers[n];
+		w->mIndex = n;
+		w->mPackets = w->mOutOfOrder = w->mSum = 0;
+		memset(w->mNextSeq,0,sizeof(w->mNextSeq));
+		pthread_create(&w->mThread,NULL,worker,w);
+	}
+	unsigned numReaders = min((unsigned)nq,numWorkers);
+	Reader readers[MG_MAX_TUN_QUEUES];
+	sSending = true;
+	double start = timef();
+	for (unsigned n = 0; n < numReaders; n++) {
+		Reader *rd = &readers[n];
+		rd->mIndex = n; rd->mNumReaders = numReaders; rd->mFds = fds; rd->mNumQueues = nq; rd->mPackets = 0;
+		pthread_create(&rd->mThread,NULL,reader,rd);
+	}
+	pthread_t gen;
+	pthread_create(&gen,NULL,generator,NULL);
+	pthread_join(gen,NULL);
+	unsigned read = 0;
+	for (unsigned n = 0; n < numReaders; n++) { pthread_join(readers[n].mThread,NULL); read += readers[n].mPackets; }
+	unsigned done = 0, outOfOrder = 0;
+	for (unsigned n = 0; n < numWorkers; n++) {
+		WorkPdu *stop = new WorkPdu;
+		stop->mStop = true;
+		sWorkers[n].mQ.write(stop);
+		pthread_join(sWorkers[n].mThread,NULL);
+		done += sWorkers[n].mPackets;
+		outOfOrder += sWorkers[n].mOutOfOrder;
+	}
+	double elapsed = timef() - start;
+	printf("workers=%u readers=%u queues=%d sent=%u forwarded=%u %.0f packets/sec outoforder=%u\n",
+		numWorkers,numReaders,nq,sNumPackets,done,done/elapsed,outOfOrder);
+	if (outOfOrder || done != read) { printf("FAIL\n"); }
+}
+
+int main(int argc, char **argv)
+{
+	sNumPackets = argc > 1 ? atoi(argv[1]) : 200000;
+	int queues = argc > 2 ? atoi(argv[2]) : 4;
+	sWork = argc > 3 ? atoi(argv[3]) : 4;
+	sCpus = argc > 4 ? atoi(argv[4]) : 0;
+	if (queues > MG_MAX_TUN_QUEUES) { queues = MG_MAX_TUN_QUEUES; }
+	printf("%ld cpus online, %u flows, %u checksum passes of work per packet\n",sysconf(_SC_NPROCESSORS_ONLN),sNumFlows,sWork);
+
+	int fds[MG_MAX_TUN_QUEUES];
+	int nq = ip_tun_open_queues(sTunName,sRoute,fds,queues);
+	if (nq <= 0) {
+		printf("could not open tun device %s; this test must be run as root\n",sTunName);
+		return 1;
+	}
+	for (int q = 0; q < nq; q++) {
+		int flags = fcntl(fds[q],F_GETFL,0);
+		fcntl(fds[q],F_SETFL,flags | O_NONBLOCK);
+	}
+	unsigned counts[] = { 1, 2, 4, 8 };
+	for (unsigned i = 0; i < 4; i++) { run(fds,nq,counts[i]); }
+	for (int q = 0; q < nq; q++) { close(fds[q]); }
+	// The device was made persistent; remove it.
+	runcmd("/sbin/ip","ip","tuntap","del","dev",sTunName,"mode","tun",nq > 1 ? "multi_queue" : NULL,NULL);
+	return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the word-wide ip_checksum and the incremental updates against the original halfword-at-a-time routine,
+// check the header rewrites leave every checksum valid, then time them.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "miniggsn.h"
+#include "GgsnRewrite.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+namespace SGSN {
+FILE *mg_log_fp = NULL;		// These normally live in miniggsn.cpp.
+int mg_debug_level = 0;
+};
+
+// The original ip_checksum.
+static unsigned int old_checksum(void *ptr, unsigned len, void *dummyhdr)
+{
+	uint32_t i, sum = 0;
+	uint16_t *pp = (uint16_t*)ptr;
+	while (len > 1) { sum += *pp++; len -= 2; }
+	if (len == 1) {
+		uint16_t foo = 0;
+		unsigned char *cp = (unsigned char*)&foo;
+		*cp = *(unsigned char *)pp;
+		sum += foo;
+	}
+	if (dummyhdr) {
+		pp = (uint16_t*)dummyhdr;
+		for (i = 0; i < 6; i++) { sum += pp[i]; }
+	}
+	sum = ((sum >> 16)) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return 0xffff & ~sum;
+}
+
+static void randomFill(unsigned char *buf, unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) { buf[i] = random(); }
+}
+
+// Ones complement arithmetic has two zeros, so compare checksums as values.
+static bool sameChecksum(unsigned a, unsigned b) { return a == b || (a == 0 && b == 0xffff) || (a == 0xffff && b == 0); }
+
+static void testFull()
+{
+	uint16_t aligned[1600];
+	unsigned char *buf = (unsigned char*)aligned;
+	for (unsigned n = 0; n < 20000; n++) {
+		unsigned len = random() % 1520;
+		randomFill(buf,len + 2);
+		// Mostly random data, sometimes all ones to stress the carries.
+		if (n % 10 == 0) { memset(buf,0xff,len); }
+		uint16_t dummy[6];
+		randomFill((unsigned char*)dummy,sizeof(dummy));
+		if (ip_checksum(buf,len,NULL) != old_checksum(buf,len,NULL) ||
+			ip_checksum(buf,len,dummy) != old_checksum(buf,len,dummy)) {
+			failures++;
+			printf("FAIL: full checksum len=%u\n",len);
+			return;
+		}
+	}
+	// Unaligned data; the old routine needs it aligned, so compare against a copy.
+	uint16_t copy[800];
+	for (unsigned n = 0; n < 2000; n++) {
+		unsigned len = random() % 1520, off = 1 + random() % 7;
+		randomFill(buf + off,len);
+		memcpy(copy,buf + off,len);
+		if (ip_checksum(buf + off,len,NULL) != old_checksum(copy,len,NULL)) {
+			failures++;
+			printf("FAIL: unaligned checksum len=%u offset=%u\n",len,off);
+			return;
+		}
+	}
+	// Continuing a partial sum over pieces of even length is the same as summing the whole.
+	randomFill(buf,1500);
+	uint32_t sum = ip_csum_add(0,buf,20);
+	sum = ip_csum_add(sum,buf + 20,1000);
+	sum = ip_csum_add(sum,buf + 1020,480);
+	CHECK(ip_csum_fold(sum) == old_checksum(buf,1500,NULL));
+	printf("full checksum ok\n");
+}
+
+static void testIncremental()
+{
+	uint16_t buf[32];
+	for (unsigned n = 0; n < 200000; n++) {
+		randomFill((unsigned char*)buf,sizeof(buf));
+		buf[5] = 0;
+		buf[5] = old_checksum(buf,sizeof(buf),NULL);
+		if (n % 7 == 0) { buf[3] = 0; buf[5] = 0; buf[5] = old_checksum(buf,sizeof(buf),NULL); }
+		if (n & 1) {
+			unsigned i = random() % 32;
+			if (i == 5) { continue; }
+			uint16_t oldval = buf[i], newval = (n % 5 == 0) ? ~oldval : random();
+			buf[i] = newval;
+			buf[5] = ip_csum_update16(buf[5],oldval,newval);
+		} else {
+			unsigned i = random() % 31;
+			if (i == 4 || i == 5) { continue; }
+			uint32_t oldval, newval = random();
+			memcpy(&oldval,&buf[i],4);
+			memcpy(&buf[i],&newval,4);
+			buf[5] = ip_csum_update32(buf[5],oldval,newval);
+		}
+		if (old_checksum(buf,sizeof(buf),NULL) != 0) {
+			failures++;
+			printf("FAIL: incremental update at iteration %u\n",n);
+			return;
+		}
+	}
+	// A header whose checksum field is zero; RFC 1624 equation 2 would get this wrong.
+	uint16_t check = 0, oldval = 0, newval = 0;
+	CHECK(sameChecksum(ip_csum_update16(check,oldval,newval),0));
+	printf("incremental update ok\n");
+}
+
+// Build a TCP or UDP packet with valid checksums.
+static unsigned makePacket(unsigned char *packet, int proto, unsigned optlen, unsigned payload)
+{
+	memset(packet,0,60);
+	struct iphdr *iph = (struct iphdr*)packet;
+	unsigned l4len = (proto == IPPROTO_TCP ? sizeof(struct tcphdr) + optlen : sizeof(struct udphdr)) + payload;
+	unsigned len = sizeof(struct iphdr) + l4len;
+	iph->version = 4; iph->ihl = 5; iph->ttl = 1 + random() % 255; iph->protocol = proto;
+	iph->tot_len = htons(len); iph->id = random();
+	iph->saddr = random(); iph->daddr = random();
+	unsigned char *l4 = packet + sizeof(struct iphdr);
+	randomFill(l4 + (proto == IPPROTO_TCP ? sizeof(struct tcphdr) + optlen : sizeof(struct udphdr)),payload);
+	uint32_t pseudo[3];
+	pseudo[0] = iph->saddr; pseudo[1] = iph->daddr; pseudo[2] = htonl((proto << 16) | l4len);
+	if (proto == IPPROTO_TCP) {
+		struct tcphdr *tcph = (struct tcphdr*)l4;
+		tcph->source = random(); tcph->dest = random(); tcph->seq = random();
+		tcph->doff = (sizeof(struct tcphdr) + optlen) / 4;
+		tcph->syn = 1;
+		tcph->check = 0;
+		tcph->check = old_checksum(l4,l4len,pseudo);
+	} else {
+		struct udphdr *udph = (struct udphdr*)l4;
+		udph->source = random(); udph->dest = random(); udph->len = htons(l4len);
+		udph->check = 0;
+		udph->check = old_checksum(l4,l4len,pseudo);
+		if (udph->check == 0) { udph->check = 0xffff; }
+	}
+	iph->check = 0;
+	iph->check = old_checksum(iph,sizeof(*iph),NULL);
+	return len;
+}
+
+// Check the IP checksum and, if the packet is not a later fragment, the TCP or UDP checksum, from scratch.
+static bool checksumsOk(unsigned char *packet, unsigned len)
+{
+	struct iphdr *iph = (struct iphdr*)packet;
+	if (old_checksum(iph,4 * iph->ihl,NULL) != 0) { return false; }
+	unsigned l4len = len - 4 * iph->ihl;
+	uint32_t pseudo[3];
+	pseudo[0] = iph->saddr; pseudo[1] = iph->daddr; pseudo[2] = htonl((iph->protocol << 16) | l4len);
+	unsigned char *l4 = packet + 4 * iph->ihl;
+	if (iph->protocol == IPPROTO_UDP && ((struct udphdr*)l4)->check == 0) { return true; }
+	return old_checksum(l4,l4len,pseudo) == 0;
+}
+
+static void testRewrite()
+{
+	uint16_t aligned[800];
+	unsigned char *packet = (unsigned char*)aligned;
+	for (unsigned n = 0; n < 50000; n++) {
+		int proto = (n & 1) ? IPPROTO_TCP : IPPROTO_UDP;
+		unsigned len = makePacket(packet,proto,proto == IPPROTO_TCP ? 8 : 0,random() % 1400);
+		struct iphdr *iph = (struct iphdr*)packet;
+		unsigned ttl = iph->ttl;
+		ip_rewrite_ttl(packet);
+		CHECK(iph->ttl == ttl - 1);
+		ip_rewrite_addr(packet,len,n & 2,random());
+		if (!checksumsOk(packet,len)) {
+			failures++;
+			printf("FAIL: rewrite %s at iteration %u\n",proto == IPPROTO_TCP ? "tcp" : "udp",n);
+			return;
+		}
+	}
+
+	// MSS clamping, with the option at an even offset and after a NOP at an odd offset.
+	for (unsigned odd = 0; odd < 2; odd++) {
+		for (unsigned n = 0; n < 10000; n++) {
+			unsigned len = makePacket(packet,IPPROTO_TCP,8,random() % 100);
+			struct tcphdr *tcph = (struct tcphdr*)(packet + sizeof(struct iphdr));
+			unsigned char *opt = (unsigned char*)(tcph + 1);
+			// Put the options in and redo the checksum the slow way.
+			unsigned oldmss = 536 + random() % 1000;
+			memset(opt,TCPOPT_NOP,8);
+			unsigned char *mssopt = opt + odd;
+			mssopt[0] = TCPOPT_MAXSEG; mssopt[1] = TCPOLEN_MAXSEG; mssopt[2] = oldmss >> 8; mssopt[3] = oldmss & 0xff;
+			struct iphdr *iph = (struct iphdr*)packet;
+			uint32_t pseudo[3];
+			pseudo[0] = iph->saddr; pseudo[1] = iph->daddr; pseudo[2] = htonl((IPPROTO_TCP << 16) | (len - 20));
+			tcph->check = 0;
+			tcph->check = old_checksum(tcph,len - 20,pseudo);
+			unsigned clamp = 1000;
+			bool changed = ip_rewrite_mss(packet,len,clamp);
+			unsigned newmss = (mssopt[2] << 8) | mssopt[3];
+			CHECK(changed == (oldmss > clamp));
+			CHECK(newmss == (oldmss > clamp ? clamp : oldmss));
+			if (!checksumsOk(packet,len)) {
+				failures++;
+				printf("FAIL: mss clamp odd=%u at iteration %u\n",odd,n);
+				break;
+			}
+		}
+	}
+	// Not a SYN, so left alone.
+	unsigned len = makePacket(packet,IPPROTO_TCP,4,0);
+	struct tcphdr *tcph = (struct tcphdr*)(packet + sizeof(struct iphdr));
+	unsigned char *opt = (unsigned char*)(tcph + 1);
+	opt[0] = TCPOPT_MAXSEG; opt[1] = TCPOLEN_MAXSEG; opt[2] = 0x05; opt[3] = 0xb4;
+	tcph->syn = 0;
+	CHECK(!ip_rewrite_mss(packet,len,1000));
+	// A malformed option length stops the scan.
+	tcph->syn = 1;
+	opt[1] = 0;
+	CHECK(!ip_rewrite_mss(packet,len,1000));
+	printf("rewrite ok\n");
+}
+
+static void bench()
+{
+	uint16_t aligned[800];
+	unsigned char *buf = (unsigned char*)aligned;
+	randomFill(buf,1500);
+	unsigned sizes[] = { 20, 40, 576, 1500 };
+	volatile unsigned sink = 0;
+	for (unsigned s = 0; s < 4; s++) {
+		unsigned len = sizes[s];
+		unsigned reps = 20000000 / len;
+		double t0 = timef();
+		for (unsigned i = 0; i < reps; i++) { buf[0] = i; sink += old_checksum(buf,len,NULL); }
+		double t1 = timef();
+		for (unsigned i = 0; i < reps; i++) { buf[0] = i; sink += ip_checksum(buf,len,NULL); }
+		double t2 = timef();
+		printf("full checksum %4u bytes: old %6.1f nsec, new %6.1f nsec, %.1fx\n",len,
+			(t1 - t0) / reps * 1e9,(t2 - t1) / reps * 1e9,(t1 - t0) / (t2 - t1));
+	}
+
+	// The per-packet header work the GGSN does on uplink: decrement the TTL and fix the checksum,
+	// plus an MSS clamp on a SYN, by full recompute versus incrementally.
+	unsigned len = makePacket(buf,IPPROTO_TCP,4,1400);
+	struct iphdr *iph = (struct iphdr*)buf;
+	struct tcphdr *tcph = (struct tcphdr*)(buf + sizeof(struct iphdr));
+	unsigned char *opt = (unsigned char*)(tcph + 1);
+	opt[0] = TCPOPT_MAXSEG; opt[1] = TCPOLEN_MAXSEG;
+	unsigned reps = 5000000;
+	double t0 = timef();
+	for (unsigned i = 0; i < reps; i++) {
+		iph->ttl = 64;
+		iph->ttl--;
+		iph->check = 0;
+		iph->check = old_checksum(iph,sizeof(*iph),NULL);
+		opt[2] = 0x05; opt[3] = 0xb4;
+		opt[2] = 1000 >> 8; opt[3] = 1000 & 0xff;
+		uint32_t pseudo[3] = { iph->saddr, iph->daddr, htonl((IPPROTO_TCP << 16) | (len - 20)) };
+		tcph->check = 0;
+		tcph->check = old_checksum(tcph,len - 20,pseudo);
+	}
+	double t1 = timef();
+	for (unsigned i = 0; i < reps; i++) {
+		iph->ttl = 64;
+		ip_rewrite_ttl(buf);
+		opt[2] = 0x05; opt[3] = 0xb4;
+		ip_rewrite_mss(buf,len,1000);
+	}
+	double t2 = timef();
+	sink += iph->check;
+	printf("ttl + mss clamp on a %u byte SYN: recompute %6.1f nsec, incremental %6.1f nsec, %.1fx\n",len,
+		(t1 - t0) / reps * 1e9,(t2 - t1) / reps * 1e9,(t1 - t0) / (t2 - t1));
+}
+
+int main(int argc, char **argv)
+{
+	srandom(1);
+	testFull();
+	testIncremental();
+	testRewrite();
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+	bench();
+	return failures ? 1 : 0;
+}
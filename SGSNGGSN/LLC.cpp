@@ -264,6 +264,18 @@ void LlcEngine::llcWriteHighSide(ByteVector &sdu,int nsapi)
 void LlcEngine::llcWriteLowSide(ByteVector &bv,SgsnInfo *si)
 {
 	if (bv.size() < 2) { return; }
+	LlcUserDataFrame fast;
+	if (fast.match(bv)) {
+		LlcEntityUserData *lle = getLlcEntityUserData(fast.mSapi);
+		Sndcp *sndcp = lle->getSndcp(fast.mNSapi);
+		if (sndcp) {
+			lle->mVUR++;
+			ByteVector payload(LlcUserDataFrame::payload(bv));
+			sndcp->sndcpWriteLowSideWhole(fast.mPduNum,payload);
+			return;
+		}
+		// No sndcp; the full path reports it.
+	}
 	LlcFrame lframe(bv);
 	int llcsapi = lframe.getSapi();
 	LLCDEBUG("llcWriteLowSide sapi="<<llcsapi);
@@ -294,6 +306,40 @@ LlcEntityGmm *LlcEngine::getLlcGmm()
 	return dynamic_cast<LlcEntityGmm*>(getLlcEntity(LlcSapi::GPRSMM));
 }
 
+bool LlcUserDataFrame::match(const ByteVector &frame)
+{
+	if (frame.size() <= HeaderLength + FcsLength) { return false; }
+	const ByteType *bp = frame.begin();
+	// LLC address: PD bit 0 and a user data SAPI.
+	if (bp[0] & 0x80) { return false; }
+	mSapi = bp[0] & 0xf;
+	if (!LlcEngine::isValidDataSapi(mSapi)) { return false; }
+	// LLC control: UI format, 110 in the top bits, and not encrypted.
+	if ((bp[1] & 0xe0) != 0xc0 || (bp[2] & 0x02)) { return false; }
+	// SNDCP: first and last segment of a UNITDATA PDU, no compression, segment 0.
+	if ((bp[3] & 0x70) != 0x60 || bp[4] != 0 || (bp[5] & 0xf0)) { return false; }
+	mNSapi = bp[3] & 0xf;
+	mPduNum = ((bp[5] & 0xf) << 8) | bp[6];
+	return true;
+}
+
+bool LlcUserDataFrame::encapsulate(ByteVector &sdu, unsigned sapi, bool isCmd, unsigned nu, unsigned nsapi, unsigned pdunum)
+{
+	if (sdu.headroom() < HeaderLength || sdu.sizeRemaining() < FcsLength || sdu.getRefCnt() != 1) { return false; }
+	if (sdu.sizeBits() % 8) { return false; }
+	ByteType *bp = sdu.growLeft(HeaderLength);
+	bp[0] = (isCmd ? 0x40 : 0) | (sapi & 0xf);
+	nu &= 0x1ff;
+	bp[1] = 0xc0 | (nu >> 6);
+	bp[2] = ((nu & 0x3f) << 2) | 0x01;		// E = 0, PM = 1.
+	bp[3] = 0x60 | (nsapi & 0xf);			// F and T bits.
+	bp[4] = 0;								// No compression.
+	bp[5] = (pdunum >> 8) & 0xf;			// Segment 0.
+	bp[6] = pdunum & 0xff;
+	gLlcParity.appendFCS(sdu);
+	return true;
+}
+
 void LlcEntity::lleWriteLowSide(LlcFrame &frame)
 {
 	mVUR++;
@@ -518,6 +564,13 @@ void Sndcp::flush(unsigned num, bool force)
 		}
 		if (i == sp->mSegCount) {	// success.
 			SNDCPDEBUG("flush"<<LOGVAR(num)<<LOGVAR(sp->mSegCount));
+			if (sp->mSegCount == 1) {	// Nothing to reassemble, so no need to copy it.
+				ByteVector result(sp->segs[0]);
+				sp->segs[0].clear();
+				sp->mSegCount = 0;
+				getSgsnInfo()->sgsnSend2PdpLowSide(mNSapi,result);
+				return;
+			}
 			ByteVector result(totsize);
 			result.setAppendP(0);
 			for (i = 0; i < sp->mSegCount; i++) {
@@ -560,16 +613,10 @@ int Sndcp::diffSNS(int v1, int v2)
 	return diff;
 }
 
-// uplink data from MS comes in here.
-void Sndcp::sndcpWriteLowSide(SndcpFrame &frame)
+// Move the receive window up to pdunum, flushing the ones that fall out of it.
+// Return false if pdunum is too old to be in the window.
+bool Sndcp::recvWindow(unsigned pdunum)
 {
-	// Todo: segment it.
-	unsigned segnum = frame.getSegmentNumber();
-	unsigned pdunum = frame.getPduNumber();
-	ByteVector payload(frame.getPayload());
-	SNDCPDEBUG("uplink packet"<<LOGVAR(pdunum)<<LOGVAR(segnum)<<LOGVAR2("size",payload.size())
-		<<" header="<<frame.head(MIN(20,frame.size())));
-
 	int diff = diffSNS(pdunum,mRecvNPdu);
 	if (diff >= 0) {	// Is pdunum greater than or eql mRecvNPdu?
 		// If pdunum is totally off, dont move it?
@@ -583,8 +630,22 @@ void Sndcp::sndcpWriteLowSide(SndcpFrame &frame)
 	} else if (-diff >= (int)sMemory) {
 		// Too old to be in our window.
 		LLCWARN("SNDCP packet too old, discarded (number="<<pdunum<<",current="<<mRecvNPdu<<")");
-		return;	// discard incoming frame.
+		return false;
 	}
+	return true;
+}
+
+// uplink data from MS comes in here.
+void Sndcp::sndcpWriteLowSide(SndcpFrame &frame)
+{
+	// Todo: segment it.
+	unsigned segnum = frame.getSegmentNumber();
+	unsigned pdunum = frame.getPduNumber();
+	ByteVector payload(frame.getPayload());
+	SNDCPDEBUG("uplink packet"<<LOGVAR(pdunum)<<LOGVAR(segnum)<<LOGVAR2("size",payload.size())
+		<<" header="<<frame.head(MIN(20,frame.size())));
+
+	if (!recvWindow(pdunum)) { return; }	// discard incoming frame.
 
 	// Save the pdu.
 	if (frame.getF()) {	// first segment; flag marks that PCOMP/DCOMP byte is present.
@@ -600,6 +661,18 @@ void Sndcp::sndcpWriteLowSide(SndcpFrame &frame)
 	}
 }
 
+// This is what sndcpWriteLowSide does for segment 0 without the M bit, without going through mSegs.
+// Any segments left in the slot from an earlier pdu with this number are left alone, as they would be there.
+void Sndcp::sndcpWriteLowSideWhole(unsigned pdunum, ByteVector &payload)
+{
+	SNDCPDEBUG("uplink packet"<<LOGVAR(pdunum)<<LOGVAR2("size",payload.size()));
+	if (!recvWindow(pdunum)) { return; }	// discard incoming frame.
+	OneSdu *sp = &mSegs[pdunum%sMemory];
+	sp->segs[0].clear();
+	sp->mSegCount = 0;
+	getSgsnInfo()->sgsnSend2PdpLowSide(mNSapi,payload);
+}
+
 // Send the pdu segment on its way.
 // TODO: we are assuming unacknowledged mode.
 void Sndcp::sndcpWriteSegment(ByteVector &pduSeg, unsigned segnum, unsigned flags)
@@ -630,6 +703,14 @@ void Sndcp::sndcpWriteHighSide(ByteVector &sdu)
 	unsigned segnum = 0;
 	unsigned segsize = getMaxPduSize();
 	segsize -= 12;	// be safe.  If you dont do this, the blackberry rejects the packets.
+	// The GGSN leaves room around the packet, so usually the headers can be put on in place.
+	if (sdu.size() <= segsize &&
+		LlcUserDataFrame::encapsulate(sdu,mlle->getLlcSapi(),true,mlle->mVU,mNSapi,mSendNPdu % mSNS)) {
+		mlle->mVU++;
+		mSendNPdu = (mSendNPdu+1) % mSNS;
+		mlle->mSI->sgsnSend2MsHighSide(sdu,"user pdu",0);
+		return;
+	}
 	for (; sdu.size() > segsize; segnum++) {
 		flags |= M_BIT;	// Not last segment.
 		ByteVector seg(sdu.segment(0,segsize));
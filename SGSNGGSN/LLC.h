@@ -383,6 +383,33 @@ struct LlcEntityGmm : public LlcEntity
 	unsigned getLlcSapi() { return 1; }
 };
 
+// The fast path for user data.
+// Nearly every user data frame is an unacknowledged (UI) LLC frame on a user data SAPI carrying a whole,
+// uncompressed SNDCP UNITDATA PDU: a fixed 7 byte header in front of the IP packet and the 3 byte FCS after it.
+// match() checks the raw frame bytes against that template and pulls out the few fields that vary,
+// and encapsulate() writes the headers and FCS around a downlink packet in place, so these frames
+// skip the generic LlcFrame and SndcpFrame parsing and the SNDCP reassembly buffers, which allocate and copy
+// every frame.  Anything else, including all signalling and segmented PDUs, goes through the full path.
+struct LlcUserDataFrame
+{
+	static const unsigned SndcpHeaderLength = 4;	// Flags, DCOMP/PCOMP, segment and pdu number.
+	static const unsigned HeaderLength = LlcFrame::UIHeaderLength + SndcpHeaderLength;
+	static const unsigned FcsLength = 3;
+	unsigned mSapi;		// LLC SAPI.
+	unsigned mNSapi;
+	unsigned mPduNum;	// SNDCP N-PDU number.
+
+	// Return true if the uplink frame, which still has the FCS on the end, matches the template.
+	bool match(const ByteVector &frame);
+	// Return the IP packet in a matched frame.  It shares the frame's memory.
+	static ByteVector payload(const ByteVector &frame) {
+		return frame.segment(HeaderLength,frame.size() - HeaderLength - FcsLength);
+	}
+	// Prepend the SNDCP and LLC UI headers to a downlink packet and append the FCS, in place.
+	// Return false, leaving the sdu alone, if it does not have the room or its memory is shared.
+	static bool encapsulate(ByteVector &sdu, unsigned sapi, bool isCmd, unsigned nu, unsigned nsapi, unsigned pdunum);
+};
+
 // 3GPP 04.64: SNDCP, with yet another stupid header.
 // It is a miracle any data gets through at all.
 // The NSAPI are on the high (network) side, and the SAPI are the low side at LLC.
@@ -462,6 +489,7 @@ class Sndcp
 	// If force, delete it even if incomplete.
 	void flush(unsigned num, bool force);
 	int diffSNS(int v1, int v2);
+	bool recvWindow(unsigned pdunum);
 	// SDU segmented to this size.  May be negotiated using XID command, which we dont implement.
 	unsigned getMaxPduSize();
 	void sndcpWriteSegment(ByteVector &pduSeg, unsigned segnum, unsigned flags);
@@ -472,6 +500,8 @@ class Sndcp
 	void sndcpWriteHighSide(ByteVector &sdu);
 	// uplink data from MS comes in here.
 	void sndcpWriteLowSide(SndcpFrame &frame);
+	// The same for a whole unsegmented PDU from the fast path; see LlcUserDataFrame.
+	void sndcpWriteLowSideWhole(unsigned pdunum, ByteVector &payload);
 };
 #if LLC_IMPLEMENTATION
 Sndcp::Sndcp(unsigned wNSapi, unsigned wLlcSapi, LlcEntityUserData *wlle) :
@@ -0,0 +1,261 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the LLC/SNDCP user data fast path against the generic frame classes, then compare their cost.
+// Uplink: the generic way is what LlcEngine::llcWriteLowSide() did for every frame: an LlcFrame,
+// the format switch, an LlcFrameUI, a SndcpFrame, and the copy in Sndcp::flush().
+// The fast way is LlcUserDataFrame::match() and a segment of the frame.
+// Downlink: the generic way is Sndcp::sndcpWriteSegment() and LlcEntity::lleWriteHighSide(), which allocate
+// an LlcDlFrame and copy the packet into it; the fast way is LlcUserDataFrame::encapsulate() on a packet
+// that has head and tail room, as the GGSN receive buffers do.
+// Reports allocations and ns per frame.
+// Build with LLC.cpp and CommonLibs; the SGSN functions LLC.cpp calls are stubbed out below.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "LLC.h"
+#include "Sgsn.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+// Stubs for the SGSN, which this test does not link.
+namespace SGSN {
+FILE *mg_log_fp = NULL;
+bool sgsnDebug() { return false; }
+void handleL3Msg(SgsnInfo *, ByteVector &) {}
+const char *L3GprsMsgType2Name(ByteVector &) { return "none"; }
+void sendImplicitlyDetached(SgsnInfo *) {}
+PdpContext *GmmInfo::getPdp(unsigned) { return NULL; }
+void SgsnInfo::sgsnSend2MsHighSide(ByteVector &, const char *, int) {}
+void SgsnInfo::sgsnSend2PdpLowSide(int, ByteVector &) {}
+void L3GprsFrame::dump(std::ostream &) {}
+std::ostream &operator<<(std::ostream &os, const SgsnInfo *) { return os; }
+};
+
+// Count every allocation made in the process.  The deletes below free them to match.
+// They are kept out of line so the compiler pairs the calls, and not malloc with free.
+static volatile unsigned sAllocs = 0;
+__attribute__((noinline)) void *operator new(size_t size) throw(std::bad_alloc) {
+	__sync_fetch_and_add(&sAllocs,1);
+	void *p = malloc(size ? size : 1);
+	if (!p) { throw std::bad_alloc(); }
+	return p;
+}
+__attribute__((noinline)) void *operator new[](size_t size) throw(std::bad_alloc) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void *p) throw() { free(p); }
+__attribute__((noinline)) void operator delete[](void *p) throw() { free(p); }
+
+static const unsigned sHeadroom = 16;	// MG_RX_HEADROOM
+static const unsigned sTailroom = 4;	// MG_RX_TAILROOM
+static const unsigned sSndcpFlags = 0x60;	// F and T bits.
+
+// A packet in a buffer laid out like the GGSN receive buffers.
+static ByteVector makePacket(unsigned len, unsigned seed)
+{
+	ByteVector pkt(sHeadroom + len + sTailroom);
+	pkt.trimLeft(sHeadroom);
+	pkt.setAppendP(0);
+	for (unsigned i = 0; i < len; i++) { pkt.appendByte((i * 7 + seed) & 0xff); }
+	return pkt;
+}
+
+// A copy of the packet, not a share, with the same room around it, so encapsulate sees it is the only user.
+static ByteVector copyPacket(ByteVector &pkt)
+{
+	ByteVector copy(sHeadroom + pkt.size() + sTailroom);
+	copy.trimLeft(sHeadroom);
+	copy.setAppendP(0);
+	copy.append(pkt);
+	return copy;
+}
+
+// The downlink frame built the generic way.
+static ByteVector genericDownlink(ByteVector &sdu, unsigned sapi, unsigned nu, unsigned nsapi, unsigned pdunum)
+{
+	LlcDlFrame result(sdu.size()+4);
+	result.appendByte(nsapi | sSndcpFlags);
+	result.appendByte(0);
+	result.appendField(0,4);
+	result.appendField(pdunum,12);
+	result.append(sdu);
+	result.growLeft(LlcFrame::UIHeaderLength);
+	result.writeAddrHeader(sapi,true);
+	LlcFrameUI uiframe(result);
+	uiframe.writeUIHeader(nu);
+	gLlcParity.appendFCS(result);
+	return result;
+}
+
+// The uplink payload found the generic way, including the flush() copy.
+static ByteVector genericUplink(ByteVector &bv, unsigned &nsapi, unsigned &pdunum)
+{
+	LlcFrame lframe(bv);
+	(void) lframe.getSapi();
+	lframe.trimRight(3);
+	LlcMsg *msg = lframe.switchFrame();
+	LlcFrameUI *ui = static_cast<LlcFrameUI*>(msg);
+	ByteVector sndcpbv(ui->tail(LlcFrame::UIHeaderLength));
+	SndcpFrame sframe(sndcpbv);
+	nsapi = sframe.getNSapi();
+	pdunum = sframe.getPduNumber();
+	(void) sframe.getSegmentNumber();
+	ByteVector seg(sframe.getPayload());
+	ByteVector result(seg.size());
+	result.setAppendP(0);
+	result.append(seg);
+	delete ui;
+	return result;
+}
+
+static void testFormat()
+{
+	unsigned sapis[] = { LlcSapi::UserData3, LlcSapi::UserData5, LlcSapi::UserData9, LlcSapi::UserData11 };
+	for (unsigned n = 0; n < 2000; n++) {
+		unsigned len = 1 + (n * 37) % 1500;
+		unsigned sapi = sapis[n % 4], nu = n % 512, nsapi = 5 + n % 11, pdunum = (n * 13) % 4096;
+		ByteVector pkt = makePacket(len,n);
+		ByteVector pktcopy = copyPacket(pkt);
+		ByteVector generic = genericDownlink(pkt,sapi,nu,nsapi,pdunum);
+		CHECK(LlcUserDataFrame::encapsulate(pktcopy,sapi,true,nu,nsapi,pdunum));
+		CHECK(pktcopy == generic);
+		CHECK(gLlcParity.checkFCS(pktcopy));
+
+		// Parse it back both ways.
+		LlcUserDataFrame fast;
+		CHECK(fast.match(pktcopy));
+		CHECK(fast.mSapi == sapi && fast.mNSapi == nsapi && fast.mPduNum == pdunum);
+		unsigned gnsapi, gpdunum;
+		ByteVector gpayload = genericUplink(pktcopy,gnsapi,gpdunum);
+		ByteVector fpayload = LlcUserDataFrame::payload(pktcopy);
+		CHECK(gnsapi == nsapi && gpdunum == pdunum);
+		CHECK(fpayload == gpayload && fpayload == pkt);
+	}
+
+	// Frames that must go through the full path.
+	ByteVector pkt = makePacket(100,1);
+	ByteVector good = copyPacket(pkt);
+	CHECK(LlcUserDataFrame::encapsulate(good,LlcSapi::UserData3,true,1,5,1));
+	LlcUserDataFrame fast;
+	CHECK(fast.match(good));
+	struct { unsigned byte, mask, val; const char *what; } bad[] = {
+		{ 0, 0x0f, LlcSapi::GPRSMM, "signalling SAPI" },
+		{ 0, 0x80, 0x80, "PD bit" },
+		{ 1, 0xe0, 0xe0, "U format" },
+		{ 1, 0x80, 0x00, "I format" },
+		{ 2, 0x02, 0x02, "encrypted" },
+		{ 3, 0x10, 0x10, "more segments" },
+		{ 3, 0x40, 0x00, "not first segment" },
+		{ 3, 0x20, 0x00, "acknowledged mode" },
+		{ 4, 0xff, 0x11, "compressed" },
+		{ 5, 0xf0, 0x10, "segment 1" },
+	};
+	for (unsigned i = 0; i < sizeof(bad)/sizeof(bad[0]); i++) {
+		ByteVector frame = copyPacket(good);
+		ByteType *bp = frame.begin();
+		bp[bad[i].byte] = (bp[bad[i].byte] & ~bad[i].mask) | bad[i].val;
+		if (fast.match(frame)) { failures++; printf("FAIL: matched frame with %s\n",bad[i].what); }
+	}
+	ByteVector tiny(LlcUserDataFrame::HeaderLength + LlcUserDataFrame::FcsLength);
+	tiny.fill(0);
+	CHECK(!fast.match(tiny));
+
+	// encapsulate must leave the packet alone if it cannot do it in place.
+	ByteVector noroom(100);
+	noroom.fill(0x55);
+	CHECK(!LlcUserDataFrame::encapsulate(noroom,LlcSapi::UserData3,true,1,5,1));
+	CHECK(noroom.size() == 100);
+	ByteVector shared = makePacket(100,2);
+	ByteVector other(shared);	// Shares the memory.
+	CHECK(!LlcUserDataFrame::encapsulate(shared,LlcSapi::UserData3,true,1,5,1));
+	CHECK(shared.size() == 100);
+}
+
+static void benchUplink(unsigned len, unsigned count)
+{
+	ByteVector pkt = makePacket(len,3);
+	CHECK(LlcUserDataFrame::encapsulate(pkt,LlcSapi::UserData3,false,1,5,1));
+	unsigned sum = 0;
+
+	unsigned allocs = sAllocs;
+	double start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		unsigned nsapi, pdunum;
+		ByteVector payload = genericUplink(pkt,nsapi,pdunum);
+		sum += payload.size() + nsapi + pdunum;
+	}
+	double generic = timef() - start;
+	unsigned genericAllocs = sAllocs - allocs;
+
+	allocs = sAllocs;
+	start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		LlcUserDataFrame fast;
+		if (fast.match(pkt)) {
+			ByteVector payload(LlcUserDataFrame::payload(pkt));
+			sum += payload.size() + fast.mNSapi + fast.mPduNum;
+		}
+	}
+	double fast = timef() - start;
+	unsigned fastAllocs = sAllocs - allocs;
+	printf("uplink   %4u bytes: generic %6.1f ns %.1f allocs, fast %6.1f ns %.1f allocs per frame (%u)\n",len,
+		1e9*generic/count,(double)genericAllocs/count,1e9*fast/count,(double)fastAllocs/count,sum & 1);
+}
+
+static void benchDownlink(unsigned len, unsigned count)
+{
+	unsigned sum = 0;
+	ByteVector *pkts = new ByteVector[count];
+	for (unsigned n = 0; n < count; n++) { ByteVector pkt = makePacket(len,n); pkts[n].transfer(pkt); }
+
+	unsigned allocs = sAllocs;
+	double start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		ByteVector frame = genericDownlink(pkts[n],LlcSapi::UserData3,n%512,5,n%4096);
+		sum += frame.size();
+	}
+	double generic = timef() - start;
+	unsigned genericAllocs = sAllocs - allocs;
+
+	allocs = sAllocs;
+	start = timef();
+	for (unsigned n = 0; n < count; n++) {
+		if (LlcUserDataFrame::encapsulate(pkts[n],LlcSapi::UserData3,true,n%512,5,n%4096)) {
+			sum += pkts[n].size();
+		}
+	}
+	double fast = timef() - start;
+	unsigned fastAllocs = sAllocs - allocs;
+	delete [] pkts;
+	printf("downlink %4u bytes: generic %6.1f ns %.1f allocs, fast %6.1f ns %.1f allocs per frame (%u)\n",len,
+		1e9*generic/count,(double)genericAllocs/count,1e9*fast/count,(double)fastAllocs/count,sum & 1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned count = argc > 1 ? atoi(argv[1]) : 200000;
+	testFormat();
+	unsigned sizes[] = { 40, 576, 1400 };
+	for (unsigned i = 0; i < 3; i++) { benchUplink(sizes[i],count); }
+	for (unsigned i = 0; i < 3; i++) { benchDownlink(sizes[i],count); }
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "MgConTable.h"
+
+namespace SGSN {
+
+void MgConTable::chainAdd(std::vector<int> &head, std::vector<int> &next, unsigned bucket, int ind)
+{
+	next[ind] = head[bucket];
+	head[bucket] = ind;
+}
+
+void MgConTable::chainRemove(std::vector<int> &head, std::vector<int> &next, unsigned bucket, int ind)
+{
+	for (int *pp = &head[bucket]; *pp >= 0; pp = &next[*pp]) {
+		if (*pp == ind) { *pp = next[ind]; next[ind] = -1; return; }
+	}
+}
+
+void MgConTable::freeAppend(int ind)
+{
+	mFreePrev[ind] = mFreeTail;
+	mFreeNext[ind] = -1;
+	if (mFreeTail >= 0) { mFreeNext[mFreeTail] = ind; } else { mFreeHead = ind; }
+	mFreeTail = ind;
+	mOnFree[ind] = true;
+}
+
+void MgConTable::freeRemove(int ind)
+{
+	int prev = mFreePrev[ind], next = mFreeNext[ind];
+	if (prev >= 0) { mFreeNext[prev] = next; } else { mFreeHead = next; }
+	if (next >= 0) { mFreePrev[next] = prev; } else { mFreeTail = prev; }
+	mOnFree[ind] = false;
+}
+
+void MgConTable::init(mg_con_t *cons, int numCons)
+{
+	ScopedLock lock(mLock);
+	mCons = cons;
+	mNumCons = numCons;
+	unsigned buckets = 16;
+	while (buckets < (unsigned)numCons) { buckets <<= 1; }
+	mMask = buckets - 1;
+	mIpHead.assign(buckets,-1); mIpNext.assign(numCons,-1);
+	mKeyHead.assign(buckets,-1); mKeyNext.assign(numCons,-1);
+	mCtxHead.assign(buckets,-1); mCtxNext.assign(numCons,-1);
+	mKeyed.assign(numCons,false);
+	mFreePrev.assign(numCons,-1); mFreeNext.assign(numCons,-1);
+	mOnFree.assign(numCons,false);
+	mFreeHead = mFreeTail = -1;
+	for (int i = 0; i < numCons; i++) {
+		chainAdd(mIpHead,mIpNext,ipHash(cons[i].mg_ip),i);
+		freeAppend(i);
+	}
+}
+
+mg_con_t *MgConTable::findByIp(uint32_t ipnl) const
+{
+	if (mNumCons == 0) { return NULL; }
+	for (int ind = mIpHead[ipHash(ipnl)]; ind >= 0; ind = mIpNext[ind]) {
+		if (mCons[ind].mg_ip == ipnl) { return &mCons[ind]; }
+	}
+	return NULL;
+}
+
+mg_con_t *MgConTable::findByCtx(const PdpContext *pdp) const
+{
+	ScopedLock lock(mLock);
+	if (mNumCons == 0) { return NULL; }
+	for (int ind = mCtxHead[ctxHash(pdp)]; ind >= 0; ind = mCtxNext[ind]) {
+		if (mCons[ind].mg_pdp == pdp) { return &mCons[ind]; }
+	}
+	return NULL;
+}
+
+mg_con_t *MgConTable::findFree(uint32_t ptmsi, int nsapi, double now, double reuseTimeout)
+{
+	ScopedLock lock(mLock);
+	if (mNumCons == 0) { return NULL; }
+	unsigned bucket = keyHash(ptmsi,nsapi);
+	for (int ind = mKeyHead[bucket]; ind >= 0; ind = mKeyNext[ind]) {
+		if (mCons[ind].mg_ptmsi == ptmsi && mCons[ind].mg_nsapi == nsapi) { return &mCons[ind]; }
+	}
+
+	// Dont reuse an ip address for reuseTimeout.
+	// TCP packets will continue to arrive for an IP address
+	// for quite some time after it becomes inactive.
+	int ind = mFreeHead;
+	if (ind < 0) { return NULL; }
+	mg_con_t *mgp = &mCons[ind];
+	if (mgp->mg_time_last_close && mgp->mg_time_last_close + reuseTimeout > now) { return NULL; }
+	// The connection stays on the free list until it is opened.
+	if (mKeyed[ind]) { chainRemove(mKeyHead,mKeyNext,keyHash(mgp->mg_ptmsi,mgp->mg_nsapi),ind); }
+	mgp->mg_ptmsi = ptmsi;
+	mgp->mg_nsapi = nsapi;
+	chainAdd(mKeyHead,mKeyNext,bucket,ind);
+	mKeyed[ind] = true;
+	return mgp;
+}
+
+void MgConTable::open(mg_con_t *mgp, PdpContext *pdp)
+{
+	ScopedLock lock(mLock);
+	int ind = indexOf(mgp);
+	if (mgp->mg_pdp) { chainRemove(mCtxHead,mCtxNext,ctxHash(mgp->mg_pdp),ind); }
+	mgp->mg_pdp = pdp;
+	if (pdp) { chainAdd(mCtxHead,mCtxNext,ctxHash(pdp),ind); }
+	if (mOnFree[ind]) { freeRemove(ind); }
+}
+
+void MgConTable::close(mg_con_t *mgp, double now)
+{
+	ScopedLock lock(mLock);
+	int ind = indexOf(mgp);
+	if (mgp->mg_pdp) { chainRemove(mCtxHead,mCtxNext,ctxHash(mgp->mg_pdp),ind); }
+	mgp->mg_pdp = NULL;
+	mgp->mg_time_last_close = now;
+	// Keep the free list in close order.
+	if (mOnFree[ind]) { freeRemove(ind); }
+	freeAppend(ind);
+}
+
+int MgConTable::check(std::ostream &os) const
+{
+	ScopedLock lock(mLock);
+	int errors = 0, numFree = 0;
+	for (int i = 0; i < mNumCons; i++) {
+		mg_con_t *mgp = &mCons[i];
+		if (findByIp(mgp->mg_ip) != mgp) {
+			os << "connection " << i << " not found by ip\n"; errors++;
+		}
+		if (mKeyed[i]) {
+			int ind = mKeyHead[keyHash(mgp->mg_ptmsi,mgp->mg_nsapi)];
+			while (ind >= 0 && ind != i) { ind = mKeyNext[ind]; }
+			if (ind != i) { os << "connection " << i << " not found by ptmsi,nsapi\n"; errors++; }
+		}
+		if (mgp->mg_pdp) {
+			int ind = mCtxHead[ctxHash(mgp->mg_pdp)];
+			while (ind >= 0 && ind != i) { ind = mCtxNext[ind]; }
+			if (ind != i) { os << "connection " << i << " not found by context\n"; errors++; }
+		}
+		if (mOnFree[i] != (mgp->mg_pdp == NULL)) {
+			os << "connection " << i << " free list membership wrong\n"; errors++;
+		}
+		if (mOnFree[i]) { numFree++; }
+	}
+	double prevTime = 0;
+	int cnt = 0;
+	for (int ind = mFreeHead; ind >= 0 && cnt <= mNumCons; ind = mFreeNext[ind], cnt++) {
+		if (mCons[ind].mg_time_last_close < prevTime) {
+			os << "free list out of order at " << ind << "\n"; errors++;
+		}
+		prevTime = mCons[ind].mg_time_last_close;
+	}
+	if (cnt != numFree) { os << "free list has " << cnt << " entries, expected " << numFree << "\n"; errors++; }
+	return errors;
+}
+
+};	// namespace
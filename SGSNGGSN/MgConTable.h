@@ -0,0 +1,77 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef MGCONTABLE_H
+#define MGCONTABLE_H
+#include <stdint.h>
+#include <arpa/inet.h>	// For ntohl
+#include <vector>
+#include <ostream>
+#include <Threads.h>
+#include "miniggsn.h"
+
+namespace SGSN {
+
+// Hash indexes over the table of mg_con_t so we dont scan the whole table for every downlink packet
+// and every PDP context activation.
+// There are three indexes: by IP address, by (ptmsi,nsapi) and by PdpContext, plus a free list.
+// The indexes are chained hash tables that store table indexes, with power of two bucket counts
+// at least as large as the table.
+//
+// The IP addresses are assigned once at init and never change, so the IP index is never modified
+// after init and findByIp() needs no lock.  That is the per-packet path from the GGSN read thread.
+// Everything else is called from the SGSN side and is protected by mLock.
+//
+// The free list holds the connections with no PdpContext, in the order they were closed.
+// Since the reuse timeout is the same for everyone, if the head of the list is not old enough yet,
+// nothing behind it is either.
+class MgConTable {
+	mg_con_t *mCons;
+	int mNumCons;
+	unsigned mMask;				// Number of hash buckets - 1.
+	std::vector<int> mIpHead, mIpNext;
+	std::vector<int> mKeyHead, mKeyNext;
+	std::vector<int> mCtxHead, mCtxNext;
+	std::vector<bool> mKeyed;	// True if the connection has been assigned to a (ptmsi,nsapi).
+	std::vector<int> mFreePrev, mFreeNext;
+	std::vector<bool> mOnFree;
+	int mFreeHead, mFreeTail;
+	mutable Mutex mLock;
+
+	unsigned ipHash(uint32_t ipnl) const { return ntohl(ipnl) & mMask; }	// Addresses are consecutive, so no collisions.
+	unsigned keyHash(uint32_t ptmsi, int nsapi) const { return ((ptmsi ^ (nsapi << 27)) * 2654435761u) >> 7 & mMask; }
+	unsigned ctxHash(const PdpContext *pdp) const { return ((unsigned)((uintptr_t)pdp >> 4) * 2654435761u) >> 7 & mMask; }
+	void chainAdd(std::vector<int> &head, std::vector<int> &next, unsigned bucket, int ind);
+	void chainRemove(std::vector<int> &head, std::vector<int> &next, unsigned bucket, int ind);
+	void freeAppend(int ind);
+	void freeRemove(int ind);
+	int indexOf(const mg_con_t *mgp) const { return mgp - mCons; }
+
+	public:
+	MgConTable() : mCons(0), mNumCons(0), mMask(0), mFreeHead(-1), mFreeTail(-1) {}
+	// Index the table, whose mg_ip addresses must already be set and unique, and all connections unused.
+	void init(mg_con_t *cons, int numCons);
+	mg_con_t *findByIp(uint32_t ipnl) const;
+	mg_con_t *findByCtx(const PdpContext *pdp) const;
+	// Return the connection previously used by this ptmsi and nsapi, whether or not it is in use,
+	// otherwise the connection that has been free longest, if it has been free for at least reuseTimeout seconds.
+	mg_con_t *findFree(uint32_t ptmsi, int nsapi, double now, double reuseTimeout);
+	void open(mg_con_t *mgp, PdpContext *pdp);
+	void close(mg_con_t *mgp, double now);
+	// Check the indexes against the table.  Return the number of errors, which are printed on os.
+	int check(std::ostream &os) const;
+};
+
+};	// namespace
+#endif
@@ -0,0 +1,153 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the MgConTable indexes against a linear scan through random PDP context open/close/reuse,
+// then measure the per-packet lookup by IP at 10, 500 and 5000 contexts, indexed and linear.
+// Usage: MgConTableTest [number of random operations]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "MgConTable.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+static const double sReuseTimeout = 180;
+
+static void fail(const char *what, int op)
+{
+	if (failures++ < 10) { printf("FAIL: %s at operation %d\n",what,op); }
+}
+
+static mg_con_t *allocCons(int num)
+{
+	mg_con_t *cons = (mg_con_t*)calloc(num,sizeof(mg_con_t));
+	uint32_t base = ntohl(inet_addr("10.20.0.1"));
+	for (int i = 0; i < num; i++) { cons[i].mg_ip = htonl(base + i); }
+	return cons;
+}
+
+static mg_con_t *linearByIp(mg_con_t *cons, int num, uint32_t ip)
+{
+	for (int i = 0; i < num; i++) { if (cons[i].mg_ip == ip) return &cons[i]; }
+	return NULL;
+}
+
+static void testRandom(int num, int numOps)
+{
+	mg_con_t *cons = allocCons(num);
+	MgConTable table;
+	table.init(cons,num);
+	// Fake PdpContext pointers, each used once; the table never dereferences them.
+	uintptr_t nextPdp = 16;
+	double now = 1000;
+	uint32_t base = ntohl(cons[0].mg_ip);
+	for (int op = 0; op < numOps; op++) {
+		now += (rand() % 100) / 10.0;
+		if (rand() % 2) {
+			// Activate a PDP context for a random ptmsi, nsapi; some are repeats.
+			uint32_t ptmsi = 0xc0000000 + rand() % (2*num);
+			int nsapi = 5 + rand() % 3;
+			mg_con_t *expect = NULL;
+			bool anyFree = false;
+			for (int i = 0; i < num; i++) {
+				if (cons[i].mg_ptmsi == ptmsi && cons[i].mg_nsapi == nsapi) { expect = &cons[i]; break; }
+				if (!cons[i].mg_pdp && (!cons[i].mg_time_last_close || cons[i].mg_time_last_close + sReuseTimeout <= now)) { anyFree = true; }
+			}
+			mg_con_t *mgp = table.findFree(ptmsi,nsapi,now,sReuseTimeout);
+			if (expect) {
+				if (mgp != expect) { fail("findFree did not return the previous connection",op); }
+			} else if (mgp) {
+				if (mgp->mg_pdp) { fail("findFree returned a connection in use",op); }
+				if (mgp->mg_time_last_close && mgp->mg_time_last_close + sReuseTimeout > now) { fail("findFree reused an address too soon",op); }
+			} else if (anyFree) {
+				fail("findFree missed a free connection",op);
+			}
+			if (mgp) {
+				if (mgp->mg_pdp) { table.close(mgp,now); }	// As if the old context were freed first.
+				table.open(mgp,(PdpContext*)(nextPdp += 16));
+			}
+		} else {
+			// Deactivate a random connection.
+			mg_con_t *mgp = &cons[rand() % num];
+			if (mgp->mg_pdp) { table.close(mgp,now); }
+		}
+		// Lookups.
+		uint32_t ip = htonl(base + rand() % (num + 10));
+		if (table.findByIp(ip) != linearByIp(cons,num,ip)) { fail("findByIp",op); }
+		mg_con_t *some = &cons[rand() % num];
+		if (some->mg_pdp && table.findByCtx(some->mg_pdp) != some) { fail("findByCtx",op); }
+		if (table.findByCtx((PdpContext*)(nextPdp + 16)) != NULL) { fail("findByCtx of unknown context",op); }
+		if (op % 97 == 0 && table.check(cout)) { fail("check",op); }
+	}
+	if (table.check(cout)) { fail("final check",numOps); }
+	free(cons);
+}
+
+static void benchLookup(int num)
+{
+	mg_con_t *cons = allocCons(num);
+	MgConTable table;
+	table.init(cons,num);
+	uint32_t base = ntohl(cons[0].mg_ip);
+	const int numIps = 4096;
+	uint32_t ips[numIps];
+	for (int i = 0; i < numIps; i++) { ips[i] = htonl(base + rand() % num); }
+	unsigned iterations = 20000000 / (num < 100 ? 1 : num / 100);
+	unsigned sink = 0;
+
+	double start = timef();
+	for (unsigned n = 0; n < iterations; n++) { sink += (uintptr_t) linearByIp(cons,num,ips[n % numIps]); }
+	double linear = (timef() - start) / iterations;
+
+	iterations = 20000000;
+	start = timef();
+	for (unsigned n = 0; n < iterations; n++) { sink += (uintptr_t) table.findByIp(ips[n % numIps]); }
+	double indexed = (timef() - start) / iterations;
+
+	// A full PDP context cycle: find free, open, close.
+	unsigned cycles = 1000000;
+	start = timef();
+	for (unsigned n = 0; n < cycles; n++) {
+		mg_con_t *mgp = table.findFree(n,5,1e9 + n,0);
+		if (mgp) { table.open(mgp,(PdpContext*)(uintptr_t)(16 + 16*n)); table.close(mgp,1e9 + n); }
+	}
+	double cycle = (timef() - start) / cycles;
+
+	printf("contexts=%-5d lookup by ip: linear %.1f nsec, indexed %.1f nsec; find/open/close %.1f nsec %s\n",
+		num,linear*1e9,indexed*1e9,cycle*1e9,sink==1?" ":"");
+	free(cons);
+}
+
+int main(int argc, char **argv)
+{
+	int numOps = argc > 1 ? atoi(argv[1]) : 200000;
+	srand(1);
+	testRandom(10,numOps);
+	testRandom(254,numOps);
+	testRandom(5000,numOps/4);
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+
+	benchLookup(10);
+	benchLookup(500);
+	benchLookup(5000);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef MGDUPFILTER_H
+#define MGDUPFILTER_H
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+namespace SGSN {
+
+// Return a 64 bit fingerprint of a downlink TCP packet for duplicate detection, or 0 if the packet
+// should never be considered a duplicate (not TCP, RST or URG, or truncated).
+// It hashes the fields the original duplicate check compared - addresses, IP length, ports and
+// sequence number - plus the first 16 bytes of TCP payload.
+// The IP ID is deliberately left out, as it was before: a retransmitted segment is a new IP packet
+// with a new ID, and those retransmissions are the duplicates we are after.
+static inline uint64_t mgDupFingerprint(const unsigned char *packet, int packetlen)
+{
+	const struct iphdr *iph = (const struct iphdr*)packet;
+	if (packetlen < (int)sizeof(struct iphdr) || iph->protocol != IPPROTO_TCP) { return 0; }
+	int iphlen = 4 * iph->ihl;
+	if (packetlen < iphlen + (int)sizeof(struct tcphdr)) { return 0; }
+	const struct tcphdr *tcph = (const struct tcphdr*) (packet + iphlen);
+	if (tcph->rst | tcph->urg) { return 0; }
+
+	uint32_t words[9];
+	words[0] = iph->saddr;
+	words[1] = iph->daddr;
+	words[2] = iph->tot_len;
+	words[3] = (uint32_t)tcph->source << 16 | tcph->dest;
+	words[4] = tcph->seq;
+	words[5] = words[6] = words[7] = words[8] = 0;
+	int payload = iphlen + 4 * tcph->doff;
+	int prefix = packetlen - payload;
+	if (prefix > 16) { prefix = 16; }
+	if (prefix > 0) { memcpy(&words[5],packet + payload,prefix); }
+
+	// Multiply-xorshift over the words, then the murmur3 finalizer.
+	uint64_t h = 0x9e3779b97f4a7c15ull;
+	for (unsigned i = 0; i < 9; i++) { h = (h ^ words[i]) * 0xff51afd7ed558ccdull; h ^= h >> 29; }
+	h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull; h ^= h >> 33;
+	return h ? h : 1;	// 0 means an unused entry.
+}
+
+// The recent downlink packet fingerprints for one mg_con_t.
+// The old check compared each packet against the whole history, so the cost grew with the history depth.
+// This is a small set associative table instead: the fingerprint picks a bucket of 4 entries, one cache line,
+// so the cost per packet is a hash and four compares regardless of the history size N.
+// The size is bounded by N: a new fingerprint replaces the oldest entry in its bucket, so each bucket
+// remembers the last 4 packets that hashed to it.
+// The age is bounded by the window: a fingerprint older than the window no longer counts as a duplicate,
+// so a reused IP address does not inherit the history of the previous PDP context.
+// All zeros is a valid empty filter, so it can live in the calloced mg_con_t.
+// N must be a power of two and at least 4.
+template <unsigned N>
+struct MgDupFilterT {
+	static const unsigned sWays = 4;
+	static const unsigned sBuckets = N / sWays;
+	struct Entry {
+		uint64_t mFp;		// 0 if unused.
+		uint32_t mTime;		// Seconds, when first seen.
+		uint32_t mSeq;		// Arrival order, to find the oldest in the bucket.
+	};
+	Entry mEntries[sBuckets][sWays];
+	uint32_t mSeq;
+	uint32_t mDuplicates;	// Counters for this connection.
+	uint32_t mPackets;
+
+	void clear() { memset(this,0,sizeof(*this)); }
+
+	// Return true if fp was seen within window seconds of now; otherwise remember it and return false.
+	bool check(uint64_t fp, uint32_t now, uint32_t window) {
+		mPackets++;
+		Entry *bucket = mEntries[(unsigned)(fp >> 32) & (sBuckets - 1)];
+		unsigned victim = 0;
+		for (unsigned k = 0; k < sWays; k++) {
+			if (bucket[k].mFp == fp) {
+				if (now - bucket[k].mTime <= window) { mDuplicates++; return true; }
+				bucket[k].mTime = now;	// Too old to count; start over from now.
+				return false;
+			}
+			// Take an unused entry, else the oldest.
+			if (bucket[victim].mFp && (!bucket[k].mFp || (int32_t)(bucket[k].mSeq - bucket[victim].mSeq) < 0)) { victim = k; }
+		}
+		bucket[victim].mFp = fp;
+		bucket[victim].mTime = now;
+		bucket[victim].mSeq = ++mSeq;
+		return false;
+	}
+};
+
+// Keep track of about the last 64 tcp packets received per connection, for up to 10 seconds.
+#define MG_DUP_HISTORY 64
+#define MG_DUP_WINDOW 10
+typedef MgDupFilterT<MG_DUP_HISTORY> MgDupFilter;
+
+};	// namespace
+#endif
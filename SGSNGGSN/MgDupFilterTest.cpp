@@ -0,0 +1,202 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the GGSN duplicate packet filter against a simple model of its buckets,
+// then measure the per-packet cost at several history depths, hashed and as the old linear scan.
+// Usage: MgDupFilterTest
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <deque>
+#include <vector>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "MgDupFilter.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+// Build a TCP packet from a stream of segments: flow selects the ports, seg the sequence number.
+static int makePacket(unsigned char *buf, unsigned flow, unsigned seg, unsigned ipid, unsigned paylen)
+{
+	memset(buf,0,40);
+	struct iphdr *iph = (struct iphdr*)buf;
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tot_len = htons(40 + paylen);
+	iph->id = htons(ipid);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = inet_addr("203.0.113.5");
+	iph->daddr = inet_addr("192.168.99.7");
+	struct tcphdr *tcph = (struct tcphdr*)(buf + 20);
+	tcph->source = htons(80);
+	tcph->dest = htons(40000 + flow);
+	tcph->seq = htonl(1000 + seg * 1400);
+	tcph->doff = 5;
+	for (unsigned i = 0; i < paylen; i++) { buf[40+i] = (unsigned char)(seg * 7 + i); }
+	return 40 + paylen;
+}
+
+// The old per-connection history, for comparison.
+struct OldPacket { uint16_t source, dest, totlen; uint32_t seq, saddr, daddr; };
+static bool oldCheck(OldPacket *hist, unsigned depth, unsigned &oldest, const unsigned char *packet)
+{
+	const struct iphdr *iph = (const struct iphdr*)packet;
+	const struct tcphdr *tcph = (const struct tcphdr*)(packet + 4 * iph->ihl);
+	for (unsigned i = 0; i < depth; i++) {
+		if (hist[i].saddr == iph->saddr && hist[i].daddr == iph->daddr && hist[i].totlen == iph->tot_len &&
+		    hist[i].seq == tcph->seq && hist[i].source == tcph->source && hist[i].dest == tcph->dest) { return true; }
+	}
+	OldPacket &p = hist[oldest];
+	if (++oldest >= depth) { oldest = 0; }
+	p.saddr = iph->saddr; p.daddr = iph->daddr; p.totlen = iph->tot_len;
+	p.seq = tcph->seq; p.source = tcph->source; p.dest = tcph->dest;
+	return false;
+}
+
+static void testBasics()
+{
+	unsigned char a[100], b[100];
+	MgDupFilter f;
+	f.clear();
+	int alen = makePacket(a,1,1,100,40);
+	uint64_t fpa = mgDupFingerprint(a,alen);
+	CHECK(fpa != 0);
+	CHECK(!f.check(fpa,1000,MG_DUP_WINDOW));
+	// A retransmission has a new IP ID but is still a duplicate.
+	int blen = makePacket(b,1,1,101,40);
+	CHECK(mgDupFingerprint(b,blen) == fpa);
+	CHECK(f.check(mgDupFingerprint(b,blen),1001,MG_DUP_WINDOW));
+	// Same sequence number with different payload is not.
+	b[45] ^= 1;
+	CHECK(mgDupFingerprint(b,blen) != fpa);
+	// Too old.
+	CHECK(!f.check(fpa,1000 + MG_DUP_WINDOW + 1,MG_DUP_WINDOW));
+	CHECK(f.check(fpa,1000 + MG_DUP_WINDOW + 2,MG_DUP_WINDOW));
+	CHECK(f.mDuplicates == 2);
+
+	// Not candidates.
+	struct tcphdr *tcph = (struct tcphdr*)(a + 20);
+	tcph->rst = 1;
+	CHECK(mgDupFingerprint(a,alen) == 0);
+	tcph->rst = 0;
+	CHECK(mgDupFingerprint(a,30) == 0);
+	((struct iphdr*)a)->protocol = IPPROTO_UDP;
+	CHECK(mgDupFingerprint(a,alen) == 0);
+
+	// The history is bounded: with fingerprints spread evenly over the buckets,
+	// the last MG_DUP_HISTORY are remembered and the one before is gone.
+	f.clear();
+	for (unsigned n = 0; n <= MG_DUP_HISTORY; n++) { CHECK(!f.check((uint64_t)n << 32 | 1,2000,MG_DUP_WINDOW)); }
+	CHECK(!f.check(1,2000,MG_DUP_WINDOW));
+	CHECK(f.check((uint64_t)MG_DUP_HISTORY << 32 | 1,2000,MG_DUP_WINDOW));
+	CHECK(f.check((uint64_t)1 << 32 | 1,2000,MG_DUP_WINDOW));
+}
+
+// Random fingerprints from a small key space against a model of the table: a list of the last 4
+// fingerprints per bucket.
+template <unsigned N>
+static void testRandom(unsigned numOps)
+{
+	const unsigned ways = MgDupFilterT<N>::sWays, buckets = MgDupFilterT<N>::sBuckets;
+	MgDupFilterT<N> *f = new MgDupFilterT<N>;
+	f->clear();
+	vector<deque<pair<uint64_t,uint32_t> > > ref(buckets);
+	uint32_t now = 5000;
+	for (unsigned op = 0; op < numOps; op++) {
+		if (rand() % 50 == 0) { now++; }
+		uint64_t fp = ((uint64_t)(rand() % (3*N)) << 32) | (rand() % 4 + 1);
+		deque<pair<uint64_t,uint32_t> > &bucket = ref[(fp >> 32) & (buckets - 1)];
+		bool expect = false, found = false;
+		for (unsigned i = 0; i < bucket.size(); i++) {
+			if (bucket[i].first == fp) {
+				found = true;
+				if (now - bucket[i].second <= 3) { expect = true; } else { bucket[i].second = now; }
+				break;
+			}
+		}
+		bool got = f->check(fp,now,3);
+		if (got != expect) {
+			if (failures++ < 10) { printf("FAIL: N=%u op %u got %d expected %d\n",N,op,got,expect); }
+			break;
+		}
+		if (!found) {
+			bucket.push_back(make_pair(fp,now));
+			if (bucket.size() > ways) { bucket.pop_front(); }
+		}
+	}
+	if (f->mPackets != numOps && !failures) { failures++; printf("FAIL: packet count\n"); }
+	delete f;
+}
+
+// Replay a download with some retransmissions through the old scan and the new filter at the given depth.
+template <unsigned N>
+static void bench()
+{
+	const unsigned numPackets = 4096;
+	vector<vector<unsigned char> > packets(numPackets);
+	unsigned seg = 0;
+	for (unsigned i = 0; i < numPackets; i++) {
+		unsigned char buf[1500];
+		// One packet in 20 repeats a recent segment.
+		unsigned s = (i % 20 == 19 && seg > 10) ? seg - 1 - rand() % 10 : seg++;
+		int len = makePacket(buf,i % 4,s,i,1400);
+		packets[i].assign(buf,buf+len);
+	}
+
+	unsigned iterations = 4000000;
+	unsigned dupsOld = 0, dupsNew = 0;
+	vector<OldPacket> hist(N);
+	memset(&hist[0],0,N * sizeof(OldPacket));
+	unsigned oldest = 0;
+	double start = timef();
+	for (unsigned n = 0; n < iterations; n++) {
+		dupsOld += oldCheck(&hist[0],N,oldest,&packets[n % numPackets][0]);
+	}
+	double linear = (timef() - start) / iterations;
+
+	MgDupFilterT<N> *f = new MgDupFilterT<N>;
+	f->clear();
+	start = timef();
+	for (unsigned n = 0; n < iterations; n++) {
+		const vector<unsigned char> &p = packets[n % numPackets];
+		dupsNew += f->check(mgDupFingerprint(&p[0],p.size()),100,MG_DUP_WINDOW);
+	}
+	double hashed = (timef() - start) / iterations;
+	delete f;
+	printf("history=%-4u linear scan %.1f nsec/packet (%u dups), fingerprint %.1f nsec/packet (%u dups)\n",
+		N,linear*1e9,dupsOld,hashed*1e9,dupsNew);
+}
+
+int main(int argc, char **argv)
+{
+	srand(1);
+	testBasics();
+	testRandom<4>(100000);
+	testRandom<64>(200000);
+	testRandom<256>(200000);
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+
+	bench<16>();
+	bench<64>();
+	bench<256>();
+	bench<1024>();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Loopback benchmark of the GGSN downlink handoff to the RLC SDU queue.
+// A thread writes packets into a datagram socketpair standing in for the tun device; the GGSN side reads them
+// and queues them for a consumer thread standing in for the UMTS MAC, which frees them.
+// The old way reads into a static buffer and copies each packet into a new ByteVector which the SDU shares;
+// the new way reads straight into a ByteVector and hands it to the SDU with ByteVector::transfer,
+// copying only packets up to the copybreak size, as miniggsn_deliver() does.
+// Reports allocations, bytes copied and packets per second.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <new>
+#include <deque>
+#include <Configuration.h>
+#include <ByteVector.h>
+#include <Threads.h>
+#include <Utils.h>
+#include <UnitTest.h>
+
+using namespace std;
+
+ConfigurationTable gConfig;
+
+// Count every allocation made in the process.  The default operator delete frees these.
+static volatile unsigned sAllocs = 0;
+void *operator new(size_t size) throw(std::bad_alloc) {
+	__sync_fetch_and_add(&sAllocs,1);
+	void *p = malloc(size ? size : 1);
+	if (!p) { throw std::bad_alloc(); }
+	return p;
+}
+void *operator new[](size_t size) throw(std::bad_alloc) { return operator new(size); }
+
+static const unsigned sMaxPdu = 1520;
+static const unsigned sHeadroom = 16;
+static const unsigned sCopyBreak = 256;
+static unsigned sCopies, sCopied;	// Packets and bytes copied on the GGSN side.
+
+// Stands in for URlcDownSdu.
+struct Sdu : public ByteVector {
+	Sdu(ByteVector &data) : ByteVector(data) {}
+	Sdu(ByteVector &data, bool) : ByteVector((size_t)0) { transfer(data); }
+};
+
+// Stands in for the RLC SDU queue and the MAC thread that drains it.
+static Mutex sQLock;
+static Signal sQSignal;
+static deque<Sdu*> sQ;
+static volatile bool sDone;
+static unsigned sConsumed, sConsumedBytes;
+static uint32_t sChecksum;
+
+static void *consumer(void *)
+{
+	while (1) {
+		Sdu *sdu;
+		{
+			ScopedLock lock(sQLock);
+			while (sQ.empty() && !sDone) { sQSignal.wait(sQLock); }
+			if (sQ.empty()) { return NULL; }
+			sdu = sQ.front();
+			sQ.pop_front();
+		}
+		sConsumed++;
+		sConsumedBytes += sdu->size();
+		sChecksum += sdu->getUInt32(0) + sdu->getByte(sdu->size() - 1);
+		delete sdu;
+	}
+}
+
+static void enqueue(Sdu *sdu)
+{
+	ScopedLock lock(sQLock);
+	sQ.push_back(sdu);
+	sQSignal.signal();
+}
+
+struct Producer { int fd; unsigned count; };
+
+// Packet sizes like a downlink TCP download: mostly full size, some acks and small packets.
+static unsigned packetSize(unsigned n) { return (n % 4 == 3) ? 40 + n % 100 : 1400 + n % 100; }
+
+static void *producer(void *arg)
+{
+	Producer *pr = (Producer*)arg;
+	unsigned char buf[sMaxPdu];
+	memset(buf,0x55,sizeof(buf));
+	for (unsigned n = 0; n < pr->count; n++) {
+		unsigned len = packetSize(n);
+		memcpy(buf,&n,4);
+		buf[len-1] = n;
+		while (write(pr->fd,buf,len) < 0) { usleep(10); }
+	}
+	return NULL;
+}
+
+static uint32_t expectedChecksum(unsigned count)
+{
+	uint32_t sum = 0;
+	for (unsigned n = 0; n < count; n++) { sum += htonl(n) + (unsigned char)n; }
+	return sum;
+}
+
+static void run(bool zerocopy, unsigned count)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX,SOCK_DGRAM,0,fds)) { perror("socketpair"); exit(1); }
+	int sndbuf = 1<<20;
+	setsockopt(fds[0],SOL_SOCKET,SO_SNDBUF,&sndbuf,sizeof(sndbuf));
+	sDone = false;
+	sConsumed = sConsumedBytes = sChecksum = sCopies = sCopied = 0;
+	pthread_t cons, prod;
+	pthread_create(&cons,NULL,consumer,NULL);
+	Producer pr = { fds[0], count };
+	unsigned char *staticBuf = (unsigned char*)malloc(sMaxPdu + 2);
+	ByteVector rxBuf;
+	unsigned allocs0 = sAllocs;
+	double start = timef();
+	pthread_create(&prod,NULL,producer,&pr);
+	for (unsigned n = 0; n < count; n++) {
+		if (zerocopy) {
+			if (!rxBuf.isOwner()) {
+				ByteVector buf(sHeadroom + sMaxPdu + 2);
+				buf.trimLeft(sHeadroom);
+				rxBuf.transfer(buf);
+			}
+			int len = read(fds[1],rxBuf.begin(),sMaxPdu);
+			if (len <= 0) { perror("read"); exit(1); }
+			if ((unsigned)len <= sCopyBreak) {
+				ByteVector sdu(rxBuf.begin(),len);
+				sCopies++; sCopied += len;
+				enqueue(new Sdu(sdu,true));
+			} else {
+				rxBuf.setAppendP(len);
+				enqueue(new Sdu(rxBuf,true));
+			}
+		} else {
+			int len = read(fds[1],staticBuf,sMaxPdu);
+			if (len <= 0) { perror("read"); exit(1); }
+			ByteVector sdu(staticBuf,len);		// The old PdpContext::pdpWriteHighSide
+			sCopies++; sCopied += len;
+			enqueue(new Sdu(sdu));
+		}
+	}
+	{ ScopedLock lock(sQLock); sDone = true; sQSignal.signal(); }
+	pthread_join(cons,NULL);
+	pthread_join(prod,NULL);
+	double elapsed = timef() - start;
+	unsigned allocs = sAllocs - allocs0;
+	CHECK(sConsumed == count);
+	CHECK(sChecksum == expectedChecksum(count));
+	printf("%-9s %u packets %.0f packets/sec %.1f MB/sec: %.2f allocs/packet, %.2f copies/packet, %.0f bytes copied/packet\n",
+		zerocopy ? "zerocopy" : "copy", count, count / elapsed, sConsumedBytes / elapsed / 1e6,
+		(double)allocs / count, (double)sCopies / count, (double)sCopied / count);
+	free(staticBuf);
+	close(fds[0]); close(fds[1]);
+}
+
+static void testTransfer()
+{
+	ByteVector a(100);
+	a.setAppendP(0);
+	a.append("hello",5);
+	ByteVector shared(a);
+	CHECK(a.getRefCnt() == 2);
+	ByteVector b;
+	b.transfer(a);
+	CHECK(!a.isOwner() && a.size() == 0 && a.begin() == 0);
+	CHECK(b.getRefCnt() == 2 && b.size() == 5 && b.begin() == shared.begin());
+	shared.clear();
+	CHECK(b.getRefCnt() == 1);
+	// A vector that does not own its memory is copied.
+	ByteVectorTemp t(b.begin(),3);
+	ByteVector c;
+	c.transfer(t);
+	CHECK(c.isOwner() && c.size() == 3 && c.begin() != b.begin() && 0 == memcmp(c.begin(),"hel",3));
+	// Headroom survives the transfer.
+	ByteVector d(20);
+	d.trimLeft(8);
+	ByteVector e;
+	e.transfer(d);
+	e.growLeft(8);
+	CHECK(e.size() == 20);
+}
+
+int main(int argc, char **argv)
+{
+	testTransfer();
+	unsigned count = argc > 1 ? atoi(argv[1]) : 500000;
+	run(false,count);
+	run(true,count);
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+	return failures ? 1 : 0;
+}
@@ -39,6 +39,10 @@ static SgsnInfoList_t sSgsnInfoList;
 typedef std::list<GmmInfo*> GmmInfoList_t;
 static GmmInfoList_t sGmmInfoList;
 static Mutex sSgsnListMutex;	// One lock sufficient for all lists maintained by SGSN.
+// The SgsnInfos by mMsHandle, so finding the one for a message does not walk sSgsnInfoList.
+static HandleIndex<SgsnInfo> sSgsnInfoIndex;
+// SgsnInfos are scheduled on this to be looked at when they may have been idle for SGSN.Timer.MS.Idle.
+static IdleWheel sSgsnIdleWheel;
 static void dumpGmmInfo();
 #if RN_UMTS
 static void sendAuthenticationRequest(SgsnInfo *si, GmmInfo::SecurityState secState);
@@ -48,11 +52,32 @@ static void sendAuthenticationRequest(SgsnInfo *si, GmmInfo::SecurityState secSt
 static SgsnInfo *sgsnGetSgsnInfoByHandle(uint32_t mshandle, bool create);
 static int getNMO();
 
+// These are consulted on every message or log statement, so they are cached here
+// and reloaded by Sgsn::configChanged() rather than read from gConfig each time.
+static volatile int sSgsnDebug = -1;		// -1 means not loaded yet.
+static volatile int sSgsnIdleTime = -1;	// SGSN.Timer.MS.Idle
+
+static void sgsnLoadConfig()
+{
+	sSgsnDebug = gConfig.getBool("SGSN.Debug");
+	sSgsnIdleTime = gConfig.getNum("SGSN.Timer.MS.Idle");
+}
+
 bool sgsnDebug()
 {
-	return gConfig.getBool("SGSN.Debug");
+	if (sSgsnDebug < 0) { sgsnLoadConfig(); }
+	return sSgsnDebug;
+}
+
+static int sgsnIdleTime()
+{
+	if (sSgsnIdleTime < 0) { sgsnLoadConfig(); }
+	return sSgsnIdleTime;
 }
 
+// The idle wheel is one slot per second; longer idle times just go around more than once.
+static const unsigned sSgsnIdleWheelSlots = 1024;
+
 bool enableMultislot()
 {
 	return gConfig.getNum("GPRS.Multislot.Max.Downlink") > 1 ||
@@ -112,7 +137,10 @@ SgsnInfo::SgsnInfo(uint32_t wMsHandle) :
 #if RN_UMTS == 0
 	mLlcEngine = new LlcEngine(this);
 #endif
-	sSgsnInfoList.push_back(this);
+	mListPos = sSgsnInfoList.insert(sSgsnInfoList.end(),this);
+	sSgsnInfoIndex.insert(mMsHandle,this);
+	if (!sSgsnIdleWheel.inited()) { sSgsnIdleWheel.init(sSgsnIdleWheelSlots,mLastUseTime); }
+	sSgsnIdleWheel.schedule(this,mLastUseTime + sgsnIdleTime() + 1);
 }
 
 SgsnInfo::~SgsnInfo()
@@ -125,7 +153,9 @@ void SgsnInfo::sirm()
 	std::ostringstream ss;
 	sgsnInfoDump(this,ss);
 	SGSNLOG("Removing SgsnInfo:"<<ss);
-	sSgsnInfoList.remove(this);
+	sSgsnInfoList.erase(mListPos);
+	sSgsnInfoIndex.erase(mMsHandle,this);
+	sSgsnIdleWheel.remove(this);
 	delete this;
 }
 
@@ -1158,6 +1188,13 @@ void Sgsn::notifyGsmActivity(const char *imsi)
 {
 }
 
+// WARNING: This runs in whatever thread changed the config.
+void Sgsn::configChanged()
+{
+	sgsnLoadConfig();
+	miniggsn_config_changed();
+}
+
 // Return the TLLI or URNTI for the P-TMSI, or 0 if not found.
 uint32_t Sgsn::findHandleByPTmsi(uint32_t ptmsi)
 {
@@ -1351,33 +1388,55 @@ void handleL3Msg(SgsnInfo *si, ByteVector &bv)
 // The top bits of the TLLI encode where it came from.
 // A local TLLI has top 2 bits 11, and low 30 bits are the P-TMSI.
 // For UMTS, the handle is the invariant URNTI.
+// Kill off SgsnInfos that have been idle too long, except ones that are the primary one for a gmm.
+// Each SgsnInfo is on the idle wheel at the time it would expire if not used again.
+// Using it only updates mLastUseTime, so when it comes up on the wheel we check it again and put it back
+// if it has been used since.  That way the message path never touches the wheel,
+// and this only looks at SgsnInfos that are due, not at all of them.
+// Assumes sSgsnListMutex is locked on entry.
+static void sgsnExpireIdle(time_t now)
+{
+	if (!sSgsnIdleWheel.inited() || now <= sSgsnIdleWheel.now()) { return; }
+	int idletime = sgsnIdleTime();
+	std::vector<IdleWheelItem*> due;
+	sSgsnIdleWheel.advance(now,due);
+	for (unsigned i = 0; i < due.size(); i++) {
+		SgsnInfo *si = static_cast<SgsnInfo*>(due[i]);
+		GmmInfo *gmm = si->getGmm();
+		if ((gmm==NULL || gmm->getSI() != si) && now - si->mLastUseTime > idletime) {
+			si->sirm();
+		} else {
+			// Not idle, or a primary one which may become idle if the gmm moves to another si.
+			time_t when = si->mLastUseTime + idletime + 1;
+			sSgsnIdleWheel.schedule(si,when > now ? when : now + idletime);
+		}
+	}
+}
+
 SgsnInfo *findSgsnInfoByHandle(uint32_t handle, bool create)
 {
 	// Update: the lock is needed because the suspension request is sent by the GSM RR stack
 	// running in a separate thread.
 	ScopedLock lock(sSgsnListMutex); // I dont think this is necessary, but be safe.
 
-	SgsnInfo *si, *result = NULL;
 	// We can delete unused SgsnInfo as soon as the attach procedure is over,
 	// which is 15s, but let them hang around a bit longer so the user can see them.
-	int idletime = gConfig.getNum("SGSN.Timer.MS.Idle");
 	time_t now; time(&now);
-	RN_FOR_ALL(SgsnInfoList_t,sSgsnInfoList,si) {
-		if (si->mMsHandle == handle) {result=si; continue;}
+	sgsnExpireIdle(now);
+	SgsnInfo *result = sSgsnInfoIndex.find(handle);
 #if RN_UMTS
 #else
 #if NEW_TLLI_ASSIGN_PROCEDURE
-		if (si->mAltTlli == handle) {result=si;continue;}
-#endif
-#endif
-		// Kill off old ones, except ones that are the primary one for a gmm.
-		GmmInfo *gmm = si->getGmm();
-		if (gmm==NULL || gmm->getSI() != si) {
-			if (now - si->mLastUseTime > idletime) { si->sirm(); }
+	if (result == NULL) {
+		SgsnInfo *si;
+		RN_FOR_ALL(SgsnInfoList_t,sSgsnInfoList,si) {
+			if (si->mAltTlli == handle) {result=si;break;}
 		}
 	}
+#endif
+#endif
 	if (result) {
-		time(&result->mLastUseTime);
+		result->mLastUseTime = now;
 		return result;
 	}
 	if (!create) { return NULL; }
@@ -1732,7 +1791,9 @@ SgsnInfo * SgsnInfo::changeTlli(bool now)
 		killOtherTlli(si,newTlli);
 		if (now) {
 			si->mAltTlli = si->mMsHandle;
+			sSgsnInfoIndex.erase(si->mMsHandle,si);
 			si->mMsHandle = newTlli;
+			sSgsnInfoIndex.insert(newTlli,si);
 		} else {
 			si->mAltTlli = newTlli;
 		}
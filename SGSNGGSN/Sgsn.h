@@ -17,6 +17,8 @@
 #include "GPRSL3Messages.h"
 #include "SgsnExport.h"
 #include "GSMCommon.h"	// For Z100Timer
+#include "SgsnIndex.h"
+#include <list>
 #ifndef MIN
 #define MIN(a,b) ((a)<=(b)?(a):(b))
 #endif
@@ -225,7 +227,8 @@ class GmmInfo
 // The GmmInfo holds the Session Management info, and is associated with one
 // and only one MS identified by IMSI.
 // There are two major types of SgsnInfo:
-class SgsnInfo
+// The SgsnInfo is also an IdleWheelItem so the SGSN can forget idle ones without looking at all of them.
+class SgsnInfo : public IdleWheelItem
 {
 	friend class MSUEAdapter;
 
@@ -244,6 +247,7 @@ class SgsnInfo
 
 	LlcEngine *mLlcEngine;
 	time_t mLastUseTime;
+	std::list<SgsnInfo*>::iterator mListPos;	// Where it is in sSgsnInfoList, so sirm() does not search for it.
 
 	//GmmMobileIdentityIE mAttachMobileId;
 
@@ -16,6 +16,8 @@
 #include "Sgsn.h"
 #include "Utils.h"
 #include "Globals.h"
+#include "GgsnFirewall.h"
+#include "GgsnTrace.h"
 using namespace Utils;
 
 struct CliError {
@@ -111,6 +113,50 @@ static void sgsnCliFree(int argc, char **argv, int argi, ostream&os)
 	}
 }
 
+static void sgsnCliTunStat(int argc, char **argv, int argi, ostream&os)
+{
+	if (RN_CMD_OPTION("clear")) {
+		gMgTunStats.clear();
+		os << "tun statistics cleared\n";
+		return;
+	}
+	gMgTunStats.text(os);
+}
+
+static void sgsnCliFirewall(int argc, char **argv, int argi, ostream&os)
+{
+	GgsnFirewallRef fw;
+	if (fw.get() == NULL) { os << "GGSN firewall is disabled or GGSN not running\n"; return; }
+	fw->text(os);
+}
+
+static void sgsnCliTrace(int argc, char **argv, int argi, ostream&os)
+{
+	if (RN_CMD_OPTION("clear")) {
+		gGgsnTrace.clear();
+		os << "trace cleared\n";
+		return;
+	}
+	if (RN_CMD_OPTION("sample")) {
+		char *arg = RN_CMD_ARG;
+		if (arg == NULL) { os << "trace sample: missing rate\n"; return; }
+		// Lasts until the next config change; set GGSN.Trace.Sample to make it stick.
+		gGgsnTrace.setSample(atoi(arg));
+		os << "trace sample set to " << gGgsnTrace.sample() << "\n";
+		return;
+	}
+	if (RN_CMD_OPTION("save")) {
+		char *filename = RN_CMD_ARG;
+		if (filename == NULL) { os << "trace save: missing file name\n"; return; }
+		string errmsg;
+		if (!gGgsnTrace.save(filename,errmsg)) { os << errmsg << "\n"; return; }
+		os << "trace saved to " << filename << "\n";
+		return;
+	}
+	char *countstr = RN_CMD_ARG;
+	gGgsnTrace.dump(os,countstr ? atoi(countstr) : 50);
+}
+
 static void sgsnCliHelp(int argc, char **argv, int argi, ostream&os);
 static struct SgsnSubCmds {
 	const char *name;
@@ -119,6 +165,9 @@ static struct SgsnSubCmds {
 } sgsnSubCmds[] = {
 	{ "list",sgsnCliList, "list  [(imsi|tlli) id]  # list all or specified MS" },
 	{ "free",sgsnCliFree, "free (imsi|tlli) id     # Delete something" },
+	{ "tunstat",sgsnCliTunStat, "tunstat [clear]       # show or clear GGSN tun device I/O statistics" },
+	{ "firewall",sgsnCliFirewall, "firewall              # show the GGSN firewall rules" },
+	{ "trace",sgsnCliTrace, "trace [count] | clear | sample N | save file  # show the last count GGSN packet events, or control the trace" },
 	{ "help",sgsnCliHelp, "help                  # print this help" },
 	//{ "stat",gprsStats, "stat  # Show GPRS statistics" },
 	//{ "debug",gprsDebug,	"debug [level]  # Set debug level; 0 turns off" },
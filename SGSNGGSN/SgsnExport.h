@@ -115,6 +115,8 @@ class MSUEAdapter {
 	// This sends a pdu from the sgsn (or anywhere) to the ms.
 	// For UMTS the rbid is the rbid; For GPRS the rbid is the TLLI.
 	// This is the previous interface:
+	// The UE takes over the memory of dlpdu, which may be empty on return, so the downlink user data
+	// buffer goes from the GGSN to the RLC without a copy; see URlcTrans::rlcWriteHighSide.
 	virtual void msWriteHighSide(ByteVector &dlpdu, uint32_t rbidOrTlli, const char *descr) = 0;
 	// This is called when the RRC SecurityModeComplete or SecurityModeFailure is received.
 	void sgsnHandleSecurityModeComplete(bool success);
@@ -189,6 +191,8 @@ struct Sgsn {
 
 	static bool handleGprsSuspensionRequest(uint32_t wTlli, const ByteVector &wRaId);
 	static void notifyGsmActivity(const char *imsi);
+	// Called when the configuration changes, to pick up the options that may change while running.
+	static void configChanged();
 //#if RN_UMTS
 	// FIXME: make this work like gprs
 	//static void sgsnWriteLowSide(ByteVector &payload,SgsnInfo *si, unsigned rbid);	// UMTS only
@@ -0,0 +1,88 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "SgsnIndex.h"
+
+namespace SGSN {
+
+void IdleWheel::init(unsigned numSlots, time_t now)
+{
+	unsigned size = 2;
+	while (size < numSlots) { size <<= 1; }
+	mSlots.assign(size,(IdleWheelItem*)0);
+	mMask = size - 1;
+	mNow = now;
+	mCount = 0;
+}
+
+void IdleWheel::schedule(IdleWheelItem *item, time_t when)
+{
+	if (item->mIdleSlot >= 0) { remove(item); }
+	item->mIdleWhen = when;
+	// The slot for mNow has already been processed, and the slot for mNow+size is the same one.
+	time_t slotTime = when;
+	if (slotTime <= mNow) { slotTime = mNow + 1; }
+	if (slotTime > mNow + (time_t)mMask) { slotTime = mNow + mMask; }
+	unsigned slot = (unsigned)slotTime & mMask;
+	item->mIdleSlot = slot;
+	item->mIdlePrev = 0;
+	item->mIdleNext = mSlots[slot];
+	if (mSlots[slot]) { mSlots[slot]->mIdlePrev = item; }
+	mSlots[slot] = item;
+	mCount++;
+}
+
+void IdleWheel::remove(IdleWheelItem *item)
+{
+	if (item->mIdleSlot < 0) { return; }
+	if (item->mIdlePrev) {
+		item->mIdlePrev->mIdleNext = item->mIdleNext;
+	} else {
+		mSlots[item->mIdleSlot] = item->mIdleNext;
+	}
+	if (item->mIdleNext) { item->mIdleNext->mIdlePrev = item->mIdlePrev; }
+	item->mIdleNext = item->mIdlePrev = 0;
+	item->mIdleSlot = -1;
+	mCount--;
+}
+
+void IdleWheel::advance(time_t now, std::vector<IdleWheelItem*> &due)
+{
+	if (now <= mNow) { return; }
+	// If we were not called for longer than the wheel, every slot is due, but only once.
+	time_t first = mNow + 1;
+	if (now - first > (time_t)mMask) { first = now - mMask; }
+	std::vector<IdleWheelItem*> later;
+	for (time_t t = first; t <= now; t++) {
+		unsigned slot = (unsigned)t & mMask;
+		IdleWheelItem *item = mSlots[slot];
+		mSlots[slot] = 0;
+		while (item) {
+			IdleWheelItem *next = item->mIdleNext;
+			item->mIdleNext = item->mIdlePrev = 0;
+			item->mIdleSlot = -1;
+			mCount--;
+			if (item->mIdleWhen <= now) {
+				due.push_back(item);
+			} else {
+				later.push_back(item);	// It was too far out for the wheel.
+			}
+			item = next;
+		}
+	}
+	mNow = now;
+	for (unsigned i = 0; i < later.size(); i++) { schedule(later[i],later[i]->mIdleWhen); }
+}
+
+};	// namespace
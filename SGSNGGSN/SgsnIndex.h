@@ -0,0 +1,131 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef SGSNINDEX_H
+#define SGSNINDEX_H
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+namespace SGSN {
+
+// A hash index from a 32 bit handle (TLLI or URNTI) to an object, so that finding the SgsnInfo
+// for a message does not walk the list of every MS.
+// Open addressing with linear probing; the table doubles when it gets half full.
+// Not locked; the SGSN protects it with sSgsnListMutex like the lists it indexes.
+template <class T>
+class HandleIndex {
+	struct Slot {
+		uint32_t mKey;
+		T *mValue;		// NULL if empty.
+	};
+	std::vector<Slot> mSlots;
+	unsigned mCount;
+	unsigned mShift;	// 32 - log2(number of slots).
+
+	unsigned mask() const { return mSlots.size() - 1; }
+	// TLLIs share their top bits, so use the multiplicative hash and take the high bits.
+	unsigned home(uint32_t key) const { return (key * 2654435761u) >> mShift; }
+
+	void resize(unsigned numSlots) {
+		std::vector<Slot> old;
+		old.swap(mSlots);
+		Slot empty = { 0, 0 };
+		mSlots.assign(numSlots,empty);
+		mShift = 32;
+		for (unsigned n = numSlots; n > 1; n >>= 1) { mShift--; }
+		mCount = 0;
+		for (unsigned i = 0; i < old.size(); i++) {
+			if (old[i].mValue) { insert(old[i].mKey,old[i].mValue); }
+		}
+	}
+
+	public:
+	HandleIndex() : mCount(0), mShift(0) { resize(64); }
+	unsigned size() const { return mCount; }
+
+	T *find(uint32_t key) const {
+		for (unsigned i = home(key); mSlots[i].mValue; i = (i + 1) & mask()) {
+			if (mSlots[i].mKey == key) { return mSlots[i].mValue; }
+		}
+		return 0;
+	}
+
+	// Add or replace the entry for key.
+	void insert(uint32_t key, T *value) {
+		if (2 * (mCount + 1) > mSlots.size()) { resize(2 * mSlots.size()); }
+		unsigned i = home(key);
+		for ( ; mSlots[i].mValue; i = (i + 1) & mask()) {
+			if (mSlots[i].mKey == key) { mSlots[i].mValue = value; return; }
+		}
+		mSlots[i].mKey = key;
+		mSlots[i].mValue = value;
+		mCount++;
+	}
+
+	// Remove the entry for key if it maps to value.  Return true if it was removed.
+	bool erase(uint32_t key, T *value) {
+		unsigned i = home(key);
+		for ( ; mSlots[i].mValue; i = (i + 1) & mask()) {
+			if (mSlots[i].mKey == key) { break; }
+		}
+		if (mSlots[i].mValue == 0 || mSlots[i].mValue != value) { return false; }
+		// Shift back the entries that probed past this slot.
+		for (unsigned j = (i + 1) & mask(); mSlots[j].mValue; j = (j + 1) & mask()) {
+			unsigned h = home(mSlots[j].mKey);
+			if (((j - h) & mask()) >= ((j - i) & mask())) { mSlots[i] = mSlots[j]; i = j; }
+		}
+		mSlots[i].mValue = 0;
+		mCount--;
+		return true;
+	}
+};
+
+// Something that can be put on an IdleWheel.  Derive from this.
+struct IdleWheelItem {
+	IdleWheelItem *mIdleNext, *mIdlePrev;
+	time_t mIdleWhen;		// When the item is due.
+	int mIdleSlot;			// -1 if not on the wheel.
+	IdleWheelItem() : mIdleNext(0), mIdlePrev(0), mIdleWhen(0), mIdleSlot(-1) {}
+};
+
+// A timer wheel with one second slots for expiring idle objects.
+// Scheduling and removing an item is O(1), and advance() only looks at the slots for the seconds
+// that have passed and the items in them, not at every item.
+// Items due further out than the wheel is long are put in the last slot and rescheduled when it comes up.
+// The wheel does not delete anything: advance() returns the due items and the caller decides whether
+// each is really idle, deleting it or scheduling it again.
+class IdleWheel {
+	std::vector<IdleWheelItem*> mSlots;	// Head of a doubly linked list of items per slot.
+	unsigned mMask;
+	time_t mNow;						// Slots up to and including this second have been processed.
+	unsigned mCount;
+
+	public:
+	IdleWheel() : mMask(0), mNow(0), mCount(0) {}
+	// The number of slots is rounded up to a power of two.
+	void init(unsigned numSlots, time_t now);
+	bool inited() const { return mSlots.size() != 0; }
+	unsigned size() const { return mCount; }
+	time_t now() const { return mNow; }
+
+	// Put the item on the wheel to come due at when, taking it off first if it is already on.
+	void schedule(IdleWheelItem *item, time_t when);
+	void remove(IdleWheelItem *item);
+	// Process the seconds up to now and append the items that came due to due; they are off the wheel.
+	void advance(time_t now, std::vector<IdleWheelItem*> &due);
+};
+
+};	// namespace
+#endif
@@ -0,0 +1,251 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the SGSN handle index against a std::map and the idle wheel against looking at every entry,
+// then compare the cost of finding an SgsnInfo and expiring idle ones the old way, by walking the list
+// of all of them for every message, and the new way.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <list>
+#include <map>
+#include <set>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "SgsnIndex.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+
+// Stands in for an SgsnInfo.
+struct Ms : public IdleWheelItem {
+	uint32_t mHandle;
+	time_t mLastUse;
+	bool mPrimary;		// The SgsnInfo of a GmmInfo, which is never expired.
+	list<Ms*>::iterator mListPos;
+	Ms(uint32_t handle, time_t now) : mHandle(handle), mLastUse(now), mPrimary(false) {}
+};
+
+static uint32_t randTlli() { return 0xc0000000 | ((uint32_t)random() & 0x3fffffff); }
+
+static void testIndex()
+{
+	HandleIndex<Ms> index;
+	map<uint32_t,Ms*> model;
+	vector<Ms*> all;
+	for (unsigned n = 0; n < 200000; n++) {
+		uint32_t key = (n & 1) ? randTlli() : (random() % 5000);	// Sequential-ish URNTIs collide a lot.
+		unsigned op = random() % 3;
+		if (op < 2) {
+			Ms *ms = new Ms(key,0);
+			all.push_back(ms);
+			index.insert(key,ms);
+			model[key] = ms;
+		} else {
+			map<uint32_t,Ms*>::iterator it = model.find(key);
+			Ms *other = all.size() ? all[random() % all.size()] : 0;
+			if (it != model.end()) {
+				CHECK(!(other && other != it->second && index.erase(key,other)));
+				CHECK(index.erase(key,it->second));
+				model.erase(it);
+			} else {
+				CHECK(!index.erase(key,other));
+			}
+		}
+		if (n % 1000 == 0) {
+			for (map<uint32_t,Ms*>::iterator it = model.begin(); it != model.end(); it++) {
+				if (index.find(it->first) != it->second) { failures++; printf("FAIL: index lookup\n"); break; }
+			}
+			if (index.size() != model.size()) { failures++; printf("FAIL: index size\n"); }
+			for (unsigned i = 0; i < 100; i++) {
+				uint32_t key = randTlli();
+				if (model.find(key) == model.end() && index.find(key)) { failures++; printf("FAIL: found missing key\n"); }
+			}
+		}
+	}
+	for (unsigned i = 0; i < all.size(); i++) { delete all[i]; }
+	printf("index: %u entries at end\n",index.size());
+}
+
+// Run the wheel against looking at every entry each second, for idle times both shorter and longer
+// than the wheel, with entries being used, added and removed at random.
+static void testWheel(unsigned slots, int idle)
+{
+	IdleWheel wheel;
+	time_t now = 1000000;
+	wheel.init(slots,now);
+	set<Ms*> live;
+	unsigned expired = 0;
+	for (unsigned sec = 0; sec < 3000; sec++) {
+		// Sometimes the SGSN gets no messages for a while.
+		now += (random() % 50 == 0) ? 1 + random() % (3 * slots) : 1;
+		for (unsigned i = 0; i < 20; i++) {
+			Ms *ms = new Ms(randTlli(),now);
+			ms->mPrimary = random() % 8 == 0;
+			wheel.schedule(ms,now + idle + 1);
+			live.insert(ms);
+		}
+		// What should expire, the old way.
+		set<Ms*> expect;
+		for (set<Ms*>::iterator it = live.begin(); it != live.end(); it++) {
+			if (!(*it)->mPrimary && now - (*it)->mLastUse > idle) { expect.insert(*it); }
+		}
+		// The new way, as sgsnExpireIdle does it.
+		vector<IdleWheelItem*> due;
+		wheel.advance(now,due);
+		set<Ms*> got;
+		for (unsigned i = 0; i < due.size(); i++) {
+			Ms *ms = static_cast<Ms*>(due[i]);
+			if (!ms->mPrimary && now - ms->mLastUse > idle) {
+				got.insert(ms);
+			} else {
+				time_t when = ms->mLastUse + idle + 1;
+				wheel.schedule(ms,when > now ? when : now + idle);
+			}
+		}
+		if (got != expect) {
+			failures++;
+			printf("FAIL: wheel slots=%u idle=%d sec=%u expired %u expected %u\n",slots,idle,sec,(unsigned)got.size(),(unsigned)expect.size());
+			return;
+		}
+		for (set<Ms*>::iterator it = got.begin(); it != got.end(); it++) { live.erase(*it); delete *it; expired++; }
+		// Use some, remove some.
+		unsigned n = 0;
+		for (set<Ms*>::iterator it = live.begin(); it != live.end(); n++) {
+			Ms *ms = *it++;
+			unsigned r = random() % 100;
+			if (r < 5) { ms->mLastUse = now; }
+			else if (r < 6) { wheel.remove(ms); live.erase(ms); delete ms; }
+		}
+		CHECK(wheel.size() == live.size());
+	}
+	printf("wheel slots=%u idle=%d: %u live %u expired\n",slots,idle,(unsigned)live.size(),expired);
+	for (set<Ms*>::iterator it = live.begin(); it != live.end(); it++) { delete *it; }
+}
+
+// The old findSgsnInfoByHandle: walk the whole list, killing off idle ones as we go.
+static Ms *listFind(list<Ms*> &mslist, uint32_t handle, time_t now, int idle)
+{
+	Ms *result = 0;
+	for (list<Ms*>::iterator itr = mslist.begin(); itr != mslist.end(); ) {
+		Ms *ms = *itr++;
+		if (ms->mHandle == handle) { result = ms; continue; }
+		if (!ms->mPrimary && now - ms->mLastUse > idle) { mslist.remove(ms); delete ms; }
+	}
+	if (result) { result->mLastUse = now; }
+	return result;
+}
+
+struct NewSgsn {
+	list<Ms*> mList;
+	HandleIndex<Ms> mIndex;
+	IdleWheel mWheel;
+	int mIdle;
+	NewSgsn(time_t now, int idle) : mIdle(idle) { mWheel.init(1024,now); }
+	void add(Ms *ms) {
+		ms->mListPos = mList.insert(mList.end(),ms);
+		mIndex.insert(ms->mHandle,ms);
+		mWheel.schedule(ms,ms->mLastUse + mIdle + 1);
+	}
+	void rm(Ms *ms) {
+		mList.erase(ms->mListPos);
+		mIndex.erase(ms->mHandle,ms);
+		mWheel.remove(ms);
+		delete ms;
+	}
+	unsigned expire(time_t now) {
+		if (now <= mWheel.now()) { return 0; }
+		vector<IdleWheelItem*> due;
+		mWheel.advance(now,due);
+		unsigned count = 0;
+		for (unsigned i = 0; i < due.size(); i++) {
+			Ms *ms = static_cast<Ms*>(due[i]);
+			if (!ms->mPrimary && now - ms->mLastUse > mIdle) { rm(ms); count++; continue; }
+			time_t when = ms->mLastUse + mIdle + 1;
+			mWheel.schedule(ms,when > now ? when : now + mIdle);
+		}
+		return count;
+	}
+	Ms *find(uint32_t handle, time_t now) {
+		expire(now);
+		Ms *ms = mIndex.find(handle);
+		if (ms) { ms->mLastUse = now; }
+		return ms;
+	}
+};
+
+// numMs MSs sending messages, of which one in 16 goes idle and is expired during the run.
+static void bench(unsigned numMs)
+{
+	const int idle = 600;
+	time_t start = 1000000;
+	vector<uint32_t> handles;
+	list<Ms*> oldList;
+	NewSgsn sgsn(start,idle);
+	for (unsigned i = 0; i < numMs; i++) {
+		uint32_t handle = randTlli();
+		handles.push_back(handle);
+		// Spread their last use over the idle time so some expire during the run.
+		time_t last = start - (random() % idle);
+		Ms *ms = new Ms(handle,last);
+		ms->mPrimary = i % 4 != 0;
+		oldList.push_back(ms);
+		Ms *ms2 = new Ms(handle,last);
+		ms2->mPrimary = ms->mPrimary;
+		sgsn.add(ms2);
+	}
+	// One message per MS per second for 30 simulated seconds, except the idle ones.
+	unsigned messages = numMs * 30;
+	unsigned oldFound = 0, newFound = 0;
+	double t0 = timef();
+	for (unsigned n = 0; n < messages; n++) {
+		unsigned i = n % numMs;
+		if (i % 16 == 0) { continue; }
+		if (listFind(oldList,handles[i],start + n / numMs,idle)) { oldFound++; }
+	}
+	double t1 = timef();
+	for (unsigned n = 0; n < messages; n++) {
+		unsigned i = n % numMs;
+		if (i % 16 == 0) { continue; }
+		if (sgsn.find(handles[i],start + n / numMs)) { newFound++; }
+	}
+	double t2 = timef();
+	CHECK(oldFound == newFound);
+	CHECK(oldList.size() == sgsn.mList.size());
+	printf("%6u MSs: list walk %8.0f nsec/msg, index %5.0f nsec/msg, %u left of %u\n",numMs,
+		(t1 - t0) / messages * 1e9,(t2 - t1) / messages * 1e9,(unsigned)sgsn.mList.size(),numMs);
+
+	// Expiring everyone at once, as when the idle time passes after a busy period.
+	double t3 = timef();
+	unsigned count = sgsn.expire(start + 30 + 3 * idle);
+	printf("%6u MSs: expired %u at once in %.0f usec\n",numMs,count,(timef() - t3) * 1e6);
+	for (list<Ms*>::iterator it = oldList.begin(); it != oldList.end(); it++) { delete *it; }
+	while (sgsn.mList.size()) { sgsn.rm(sgsn.mList.front()); }
+}
+
+int main(int argc, char **argv)
+{
+	srandom(1);
+	testIndex();
+	testWheel(64,10);
+	testWheel(64,200);
+	testWheel(1024,600);
+	printf("%s\n",failures ? "FAILED" : "all tests passed");
+	unsigned sizes[] = { 100, 1000, 5000, 20000 };
+	for (unsigned i = 0; i < 4; i++) { bench(sizes[i]); }
+	return failures ? 1 : 0;
+}
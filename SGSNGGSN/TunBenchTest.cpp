@@ -0,0 +1,235 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Loopback benchmark for the GGSN tun device I/O.  Must be run as root.
+// Downlink: a local traffic generator sends UDP packets to addresses routed to the tun device
+// while the reader drains the tun the old way (poll, fcntl and read per packet)
+// or the new way (poll once, then drain a batch from each queue).
+// Uplink: a producer thread fills an InterthreadQueue and the consumer writes the packets to the tun
+// one dequeue per packet or one dequeue per batch.
+// Reports packets/sec and reader/writer CPU usecs per packet.
+// Usage: TunBenchTest [packets] [queues] [batch]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <Configuration.h>
+#include <Interthread.h>
+#include <LinkedLists.h>
+#include <Utils.h>
+#include "miniggsn.h"
+
+using namespace std;
+using namespace SGSN;
+
+ConfigurationTable gConfig;
+namespace SGSN {
+FILE *mg_log_fp = NULL;		// These normally live in miniggsn.cpp.
+int mg_debug_level = 0;
+};
+
+static const char *sTunName = "ggsnbench";
+static const char *sRoute = "192.168.213.0/24";
+static const unsigned sPayload = 100;
+static volatile bool sSending;
+
+static double threadCpu()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_THREAD,&ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+
+// The traffic generator.  Vary the destination address and port so a multi-queue tun spreads the flows.
+static unsigned sNumPackets;
+static void *generator(void *)
+{
+	int sock = socket(AF_INET,SOCK_DGRAM,0);
+	char payload[sPayload];
+	memset(payload,0x5a,sizeof(payload));
+	struct sockaddr_in to;
+	memset(&to,0,sizeof(to));
+	to.sin_family = AF_INET;
+	uint32_t base = ntohl(inet_addr("192.168.213.0"));
+	for (unsigned n = 0; n < sNumPackets; n++) {
+		to.sin_addr.s_addr = htonl(base + 1 + (n % 250));
+		to.sin_port = htons(5000 + (n % 64));
+		if (sendto(sock,payload,sizeof(payload),0,(struct sockaddr*)&to,sizeof(to)) < 0 && errno == ENOBUFS) {
+			usleep(10);	// The tun transmit queue is full; let the reader catch up.
+		}
+	}
+	close(sock);
+	sSending = false;
+	return 0;
+}
+
+// The reader loop as it was: one poll and one read per packet, with the fcntl check each time.
+static unsigned readSingle(int fd, unsigned char *buf)
+{
+	unsigned cnt = 0;
+	while (true) {
+		struct pollfd fds[1];
+		fds[0].fd = fd; fds[0].events = POLLIN; fds[0].revents = 0;
+		if (poll(fds,1,sSending ? 100 : 20) <= 0) { if (!sSending) break; continue; }
+		int flags = fcntl(fd,F_GETFL,0);
+		if (flags & O_NONBLOCK) { fcntl(fd,F_SETFL,flags & ~O_NONBLOCK); }
+		if (read(fd,buf,1520) > 0) { cnt++; }
+	}
+	return cnt;
+}
+
+// The batched reader: poll all the queues, then drain up to batch packets from each readable queue.
+static unsigned readBatched(int *fds, int nq, unsigned batch, unsigned char **bufs, unsigned *wakeups)
+{
+	unsigned cnt = 0;
+	struct pollfd pfds[MG_MAX_TUN_QUEUES];
+	while (true) {
+		for (int q = 0; q < nq; q++) { pfds[q].fd = fds[q]; pfds[q].events = POLLIN; pfds[q].revents = 0; }
+		if (poll(pfds,nq,sSending ? 100 : 20) <= 0) { if (!sSending) break; continue; }
+		(*wakeups)++;
+		for (int q = 0; q < nq; q++) {
+			if (!(pfds[q].revents & POLLIN)) { continue; }
+			for (unsigned b = 0; b < batch; b++) {
+				if (read(fds[q],bufs[b],1520) <= 0) { break; }
+				cnt++;
+			}
+		}
+	}
+	return cnt;
+}
+
+static void downlink(const char *what, int *fds, int nq, unsigned batch)
+{
+	unsigned nbufs = batch ? batch : 1;
+	unsigned char **bufs = new unsigned char*[nbufs];
+	for (unsigned b = 0; b < nbufs; b++) { bufs[b] = new unsigned char[1522]; }
+	// Flush anything left over from the previous run.
+	for (int q = 0; q < nq; q++) {
+		int flags = fcntl(fds[q],F_GETFL,0);
+		fcntl(fds[q],F_SETFL,flags | O_NONBLOCK);
+		while (read(fds[q],bufs[0],1520) > 0) {}
+		if (!batch) { fcntl(fds[q],F_SETFL,flags & ~O_NONBLOCK); }
+	}
+
+	sSending = true;
+	pthread_t gen;
+	double start = timef(), cpu = threadCpu();
+	pthread_create(&gen,NULL,generator,NULL);
+	unsigned wakeups = 0;
+	unsigned cnt = batch ? readBatched(fds,nq,batch,bufs,&wakeups) : readSingle(fds[0],bufs[0]);
+	pthread_join(gen,NULL);
+	double elapsed = timef() - start, cpuused = threadCpu() - cpu;
+	printf("downlink %-8s queues=%d batch=%-3u sent=%u received=%u %.0f packets/sec reader cpu=%.2f usecs/packet",
+		what,nq,batch,sNumPackets,cnt,cnt/elapsed,cnt ? 1e6*cpuused/cnt : 0.0);
+	if (wakeups) { printf(" avgbatch=%.1f",(double)cnt/wakeups); }
+	printf("\n");
+	for (unsigned b = 0; b < nbufs; b++) { delete [] bufs[b]; }
+	delete [] bufs;
+}
+
+struct BenchPdu : SingleLinkListNode {
+	unsigned char mData[sPayload+28];
+};
+static InterthreadQueue<BenchPdu,SingleLinkList<> > sTxQ;
+
+static void *producer(void *)
+{
+	uint32_t src = inet_addr("192.168.213.7"), dst = inet_addr("10.255.255.1");
+	for (unsigned n = 0; n < sNumPackets; n++) {
+		BenchPdu *pdu = new BenchPdu;
+		memset(pdu->mData,0,sizeof(pdu->mData));
+		struct iphdr *iph = (struct iphdr*)pdu->mData;
+		iph->version = 4; iph->ihl = 5; iph->ttl = 64; iph->protocol = IPPROTO_UDP;
+		iph->tot_len = htons(sizeof(pdu->mData)); iph->saddr = src; iph->daddr = dst;
+		iph->check = ip_checksum(iph,sizeof(*iph),NULL);
+		sTxQ.write(pdu);
+	}
+	return 0;
+}
+
+static void uplink(const char *what, int fd, unsigned batch)
+{
+	pthread_t prod;
+	double start = timef(), cpu = threadCpu();
+	pthread_create(&prod,NULL,producer,NULL);
+	BenchPdu **pdus = new BenchPdu*[batch ? batch : 1];
+	unsigned cnt = 0, wakeups = 0;
+	while (cnt < sNumPackets) {
+		unsigned n;
+		if (batch) {
+			n = sTxQ.readBatch(pdus,batch);
+		} else {
+			pdus[0] = sTxQ.read(); n = 1;
+		}
+		wakeups++;
+		for (unsigned i = 0; i < n; i++) {
+			if (write(fd,pdus[i]->mData,sizeof(pdus[i]->mData)) < 0) { perror("write"); }
+			delete pdus[i];
+		}
+		cnt += n;
+	}
+	pthread_join(prod,NULL);
+	double elapsed = timef() - start, cpuused = threadCpu() - cpu;
+	printf("uplink   %-8s batch=%-3u packets=%u %.0f packets/sec writer cpu=%.2f usecs/packet avgbatch=%.1f\n",
+		what,batch,cnt,cnt/elapsed,1e6*cpuused/cnt,(double)cnt/wakeups);
+	delete [] pdus;
+}
+
+int main(int argc, char **argv)
+{
+	sNumPackets = argc > 1 ? atoi(argv[1]) : 200000;
+	int queues = argc > 2 ? atoi(argv[2]) : 4;
+	unsigned batch = argc > 3 ? atoi(argv[3]) : 32;
+	if (queues > MG_MAX_TUN_QUEUES) { queues = MG_MAX_TUN_QUEUES; }
+
+	// The old code path only knows about one queue, so compare it on a single queue device,
+	// then run the batched reader on a multi-queue device.
+	int fds[MG_MAX_TUN_QUEUES];
+	if (ip_tun_open_queues(sTunName,sRoute,fds,1) <= 0) {
+		printf("could not open tun device %s; this test must be run as root\n",sTunName);
+		return 1;
+	}
+	downlink("single",fds,1,0);
+	downlink("batched",fds,1,batch);
+	uplink("single",fds[0],0);
+	uplink("batched",fds[0],batch);
+	close(fds[0]);
+	// The device was made persistent; remove it.
+	runcmd("/sbin/ip","ip","tuntap","del","dev",sTunName,"mode","tun",NULL);
+
+	if (queues > 1) {
+		int nq = ip_tun_open_queues(sTunName,sRoute,fds,queues);
+		if (nq <= 0) {
+			printf("could not open tun device %s with %d queues\n",sTunName,queues);
+			return 1;
+		}
+		printf("opened %s with %d of %d queues\n",sTunName,nq,queues);
+		downlink("batched",fds,nq,batch);
+		for (int q = 0; q < nq; q++) { close(fds[q]); }
+		runcmd("/sbin/ip","ip","tuntap","del","dev",sTunName,"mode","tun","multi_queue",NULL);
+	}
+	return 0;
+}
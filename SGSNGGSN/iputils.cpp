@@ -138,31 +138,72 @@ EXPORT const char *ip_proto_name(int ipproto)
 	}
 }
 
+// Add len bytes at ptr to the ones complement partial sum.
+// The sum is of 16 bit words in memory order, so the caller does not byte swap anything; see RFC 1071.
+// Because the ones complement sum of the 16 bit words can be had by adding 32 bit words
+// and folding the carries back in at the end, we add 32 bits at a time into a 64 bit accumulator,
+// which cannot overflow for any packet we will see, instead of a halfword at a time.
+// The data need not be aligned, but if it starts at an odd offset in the packet the caller must account for that.
+EXPORT uint32_t ip_csum_add(uint32_t sum, const void *ptr, unsigned len)
+{
+	const unsigned char *cp = (const unsigned char*)ptr;
+	uint64_t acc = sum;
+	uint32_t w0, w1, w2, w3;
+	while (len >= 16) {
+		// memcpy lets the compiler do an unaligned load without breaking the aliasing rules.
+		memcpy(&w0,cp,4); memcpy(&w1,cp+4,4); memcpy(&w2,cp+8,4); memcpy(&w3,cp+12,4);
+		acc += (uint64_t)w0 + w1 + w2 + w3;
+		cp += 16; len -= 16;
+	}
+	while (len >= 4) { memcpy(&w0,cp,4); acc += w0; cp += 4; len -= 4; }
+	if (len >= 2) { uint16_t h; memcpy(&h,cp,2); acc += h; cp += 2; len -= 2; }
+	if (len) {
+		// The odd byte is the first byte of a word padded with zero.
+		uint16_t h = 0;
+		*(unsigned char*)&h = *cp;
+		acc += h;
+	}
+	// Fold 64 bits to 32; the second fold takes care of the carry from the first.
+	acc = (acc >> 32) + (acc & 0xffffffff);
+	acc = (acc >> 32) + (acc & 0xffffffff);
+	return (uint32_t)acc;
+}
+
+// Fold a partial sum to 16 bits and complement it, giving the value for the checksum field.
+EXPORT uint16_t ip_csum_fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return 0xffff & ~sum;
+}
+
+// RFC 1624 incremental update: return the new checksum field for a header whose checksum field is check
+// after a 16 bit word in it changes from oldval to newval.  Everything is as it appears in the packet.
+// This is equation 3, HC' = ~(~HC + ~m + m'), which unlike equation 2 never produces a -0 checksum.
+EXPORT uint16_t ip_csum_update16(uint16_t check, uint16_t oldval, uint16_t newval)
+{
+	uint32_t sum = (uint16_t)~check + (uint32_t)(uint16_t)~oldval + newval;
+	return ip_csum_fold(sum);
+}
+
+// The same for a 32 bit field, such as an address or TCP sequence number, loaded from the packet without byte swapping.
+EXPORT uint16_t ip_csum_update32(uint16_t check, uint32_t oldval, uint32_t newval)
+{
+	uint32_t sum = (uint16_t)~check + (uint32_t)(uint16_t)~(oldval >> 16) + (uint16_t)~(oldval & 0xffff)
+		+ (newval >> 16) + (newval & 0xffff);
+	return ip_csum_fold(sum);
+}
+
 // IP standard checksum, see wikipedia "IPv4 Header"
 // len is in bytes, will normally be 20 == sizeof(struct iphdr).
+// The result is ready to store in the header; a correct header including its checksum field gives 0.
 EXPORT unsigned int ip_checksum(void *ptr, unsigned len, void *dummyhdr)
 {
-	//if (len != 20) printf("WARNING: unexpected header length in ip_checksum\n");
-    uint32_t i, sum = 0;
-    uint16_t *pp = (uint16_t*)ptr;
-	while (len > 1) { sum += *pp++; len -= 2; }
-	if (len == 1) {
-		uint16_t foo = 0;
-		unsigned char *cp = (unsigned char*)&foo;
-		*cp = *(unsigned char *)pp;
-		sum += foo;
-	}
+	uint32_t sum = ip_csum_add(0,ptr,len);
 	if (dummyhdr) {	// For TCP and UDP the dummy header is 3 words = 6 shorts.
-		pp = (uint16_t*)dummyhdr;
-		for (i = 0; i < 6; i++) { sum += pp[i]; }
+		sum = ip_csum_add(sum,dummyhdr,12);
 	}
-	//printf("intermediate sum=0x%x\n",sum);
-    // Convert from 2s complement to 1s complement:
-	//sum = ((sum >> 16)&0xffff) + (sum & 0xffff); /* add hi 16 to low 16 */
-	sum = ((sum >> 16)) + (sum & 0xffff); /* add hi 16 to low 16 */
-	sum += (sum >> 16);         /* add carry */
-	//printf("intermediate sum16=0x%x result=0x%x\n",sum,~sum);
-    return 0xffff & ~sum;
+	return ip_csum_fold(sum);
 }
 
 #if 0
@@ -284,7 +325,9 @@ EXPORT int runcmd(const char *path, ...)
 
 
 // The addrstr is the tunnel address and must include the mask, eg: "192.168.2.0/24"
-EXPORT int ip_tun_open(const char *tname, const char *addrstr) // int32_t ipaddr, int maskbits)
+// Attach a new fd to the named tun device with the specified TUNSETIFF flags.
+// Return the fd or -1 on failure.
+static int ip_tun_attach(const char *tname, short flags, bool quiet)
 {
 	struct ifreq ifr;
 	int fd;
@@ -294,21 +337,64 @@ EXPORT int ip_tun_open(const char *tname, const char *addrstr) // int32_t ipaddr
 		runcmd("/sbin/modprobe","modprobe","tun",NULL);
 		runcmd("/sbin/modprobe","modprobe","ipip",NULL);
 		sleep(2);
-	}
-	if ((fd = open(clonedev,O_RDWR)) < 0) {
-		MGERROR("error: Could not open: %s\n",clonedev);
-		return -1;
+		if ((fd = open(clonedev,O_RDWR)) < 0) {
+			MGERROR("error: Could not open: %s\n",clonedev);
+			return -1;
+		}
 	}
 
 	// This attaches to our existing mstun interface, if any, because
 	// of the magic TUNSETPERSIST flag.
 	memset(&ifr,0,sizeof(ifr));
 	strcpy(ifr.ifr_name,tname);
-	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;	// Disable packet info.
+	ifr.ifr_flags = flags;
 	if (ioctl(fd,TUNSETIFF,&ifr) < 0) {
-		MGERROR("could not create tunnel %s: ioctl error: %s\n",tname,strerror(errno));
+		if (!quiet) { MGERROR("could not create tunnel %s: ioctl error: %s\n",tname,strerror(errno)); }
+		close(fd);
 		return -1;
 	}
+	return fd;
+}
+
+EXPORT int ip_tun_open(const char *tname, const char *addrstr) // int32_t ipaddr, int maskbits)
+{
+	int fd = ip_tun_attach(tname,IFF_TUN | IFF_NO_PI,false);	// Disable packet info.
+	if (fd < 0) { return -1; }
+	ip_tun_setup(fd,tname,addrstr);
+	return fd;
+}
+
+// Open a multi-queue tun device and return the fds for the queues in fds[].
+// The kernel hashes each flow onto one of the queues, so several readers can drain the device
+// without contending for a single queue.
+// Returns the number of queues opened, which is 1 if the kernel does not support IFF_MULTI_QUEUE
+// or if the persistent device was originally created without it, or -1 on failure.
+EXPORT int ip_tun_open_queues(const char *tname, const char *addrstr, int *fds, int numQueues)
+{
+#ifdef IFF_MULTI_QUEUE
+	if (numQueues > 1) {
+		short flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+		int nopen = 0;
+		for ( ; nopen < numQueues; nopen++) {
+			if ((fds[nopen] = ip_tun_attach(tname,flags,true)) < 0) { break; }
+		}
+		if (nopen) {
+			if (nopen < numQueues) {
+				MGWARN("tunnel %s: only %d of %d queues opened: %s",tname,nopen,numQueues,strerror(errno));
+			}
+			ip_tun_setup(fds[0],tname,addrstr);
+			return nopen;
+		}
+		MGWARN("tunnel %s: multi-queue not available, using a single queue: %s",tname,strerror(errno));
+	}
+#endif
+	fds[0] = ip_tun_open(tname,addrstr);
+	return fds[0] < 0 ? -1 : 1;
+}
+
+// Make the tunnel persistent, bring it up and add the route.
+EXPORT void ip_tun_setup(int fd, const char *tname, const char *addrstr)
+{
 	if (ioctl(fd,TUNSETPERSIST,1) < 0) {
 		MGERROR("could not setpersist tunnel %s: ioctl error: %s\n",tname,strerror(errno));
 	}
@@ -349,8 +435,6 @@ EXPORT int ip_tun_open(const char *tname, const char *addrstr) // int32_t ipaddr
 	}
 	*/
 	// We wont set a broadcast address using SIOCSIFBRDADDR
-
-	return fd;
 }
 
 static int setprocoption(const char *procfn)
@@ -105,6 +105,10 @@
 #include "miniggsn.h"
 #undef NCC	// Make sure.  This is defined in ioctl.h, but used as a name in GSMConfig.h.
 #include "Ggsn.h"
+#include "MgConTable.h"
+#include "GgsnFirewall.h"
+#include "GgsnRewrite.h"
+#include "GgsnTrace.h"
 #include <Configuration.h>
 
 // A mini-GGSN included inside the SGSN.
@@ -123,6 +127,9 @@ namespace SGSN {
 
 int pdpWriteHighSide(PdpContext *pdp, unsigned char *packet, unsigned len);
 int tun_fd = -1; // This is the tunnel we use to talk with the MSs.
+int tun_fds[MG_MAX_TUN_QUEUES];
+int tun_nqueues = 0;
+MgTunStats gMgTunStats;
 FILE *mg_log_fp = NULL;		// Extra log file for IP traffic.
 int mg_debug_level = 0;
 
@@ -137,24 +144,76 @@ static struct GgsnConfig {
 								// the maximum number of simultaneous MS allowed.
 	unsigned mgIpTimeout;	// Dont reuse a connection for this many seconds.
 	unsigned mgIpTossDup;	// Toss duplicate packets.
+	unsigned mgTunQueues;	// Number of tun queues to open.
+	unsigned mgRxBatch;		// Max packets read from one tun queue per poll wakeup.
+	unsigned mgTxBatch;		// Max packets written per write thread wakeup.
+	unsigned mgRxCopyBreak;	// Packets up to this size are copied out of the receive buffer; see MgRxBuf.
+	unsigned mgWorkers;		// Number of forwarding worker threads.
+	std::vector<int> mgWorkerCpus;	// CPUs to pin the workers to, from GGSN.Workers.CPUs; empty to not pin them.
+	volatile unsigned mgMssClamp;	// Clamp the TCP MSS in SYNs to this, or 0.  May be changed while running.
 
 } ggConfig;
 
-// Mini-Firewall rules
+// Mini-Firewall rules.
+// The built-in deny rules are made once from GGSN.Firewall.Enable at startup; the operator rules from
+// GGSN.Firewall.Rules are added after them, so they can override them, and may be changed while running.
 struct GgsnFirewallRule {
-	GgsnFirewallRule *next;
 	uint32_t ipBasenl;
 	uint32_t ipMasknl;
-	GgsnFirewallRule(GgsnFirewallRule *wnext,uint32_t wipbasenl, uint32_t wmasknl) :
-		next(wnext),ipBasenl(wipbasenl),ipMasknl(wmasknl) {}
 };
-GgsnFirewallRule *gFirewallRules = NULL;
-void addFirewallRule(uint32_t ipbasenl,uint32_t masknl) {
-	gFirewallRules = new GgsnFirewallRule(gFirewallRules,ipbasenl,masknl);
+static std::vector<GgsnFirewallRule> gFirewallRules;
+static int gFirewallEnable = 0;
+static string gFirewallRulesLoaded;		// The GGSN.Firewall.Rules value in the installed firewall.
+static Mutex gFirewallLock;				// Config changes may reload the firewall from another thread.
+static void addFirewallRule(uint32_t ipbasenl,uint32_t masknl) {
+	GgsnFirewallRule rule = { ipbasenl, masknl };
+	gFirewallRules.push_back(rule);
+}
+
+// Compile the built-in rules plus GGSN.Firewall.Rules and install the result for the write thread.
+// If force is false we do nothing unless GGSN.Firewall.Rules has changed.
+// If GGSN.Firewall.Rules is invalid we keep the previous firewall and return false.
+static bool miniggsn_firewall_load(bool force)
+{
+	ScopedLock lock(gFirewallLock);
+	if (!gFirewallEnable) { return true; }
+	string rules = gConfig.getStr("GGSN.Firewall.Rules");
+	if (!force && rules == gFirewallRulesLoaded) { return true; }
+	GgsnFirewall *fw = new GgsnFirewall;
+	for (unsigned i = 0; i < gFirewallRules.size(); i++) {
+		if (!fw->addRule(gFirewallRules[i].ipBasenl,gFirewallRules[i].ipMasknl,GgsnFirewall::Deny)) {
+			char buf1[40], buf2[40];
+			MGWARN("ggsn: firewall mask is not a prefix, ignored: ip=%s mask=%s",
+				ip_ntoa(gFirewallRules[i].ipBasenl,buf1),ip_ntoa(gFirewallRules[i].ipMasknl,buf2));
+		}
+	}
+	string errmsg;
+	if (!fw->addRules(rules.c_str(),errmsg)) {
+		MGERROR("ggsn: GGSN.Firewall.Rules invalid, firewall not changed: %s",errmsg.c_str());
+		delete fw;
+		return false;
+	}
+	fw->compile();
+	std::ostringstream ss;
+	fw->text(ss);	// Before the install, after which another install may delete it.
+	ggsnFirewallInstall(fw);
+	gFirewallRulesLoaded = rules;
+	MGINFO("GGSN Firewall Rules: %s",ss.str().c_str());
+	return true;
+}
+
+// Called when the config changes, to pick up the options that may be changed while running.
+// This does nothing to the firewall if the GGSN has not been started.
+void miniggsn_config_changed()
+{
+	miniggsn_firewall_load(false);
+	gGgsnTrace.setSample(gConfig.getNum("GGSN.Trace.Sample"));
+	ggConfig.mgMssClamp = gConfig.getNum("GGSN.TCP.MSSClamp");
 }
 
 
 static mg_con_t *mg_cons = 0;
+static MgConTable mg_con_table;		// The indexes into mg_cons.
 
 
 // Now in Utils.cpp
@@ -181,65 +240,28 @@ static mg_con_t *mg_cons = 0;
 // until the BTS is power cycled.  The ptmsi is a unique id associated with the imsi.
 mg_con_t *mg_con_find_free(uint32_t ptmsi, int nsapi)
 {
-	// Start by looking for this specific old connection:
-	// TODO: This should use a map for efficiency.
-	int i;
-	mg_con_t *mgp = &mg_cons[0];
-	for (i=0; i < ggConfig.mgMaxConnections; i++, mgp++) {
-		if (mgp->mg_ptmsi == ptmsi && mgp->mg_nsapi == nsapi) {
-			return mgp;
-		}
-	}
-
-	// Look for an unused IP address.
-	double now = pat_timef();
-	static int mgnextindex = 0;
-	for (i=0; i < ggConfig.mgMaxConnections; i++) {
-		mgp = &mg_cons[mgnextindex];
-		if (++mgnextindex == ggConfig.mgMaxConnections) { mgnextindex = 0; }
-		if (mgp->mg_pdp == NULL) {
-			// Dont reuse an ip address for mg_ip_timeout.
-			// TCP packets will continue to arrive for an IP address
-			// for quite some time after it becomes inactive.
-			if (mgp->mg_time_last_close && mgp->mg_time_last_close + ggConfig.mgIpTimeout > now) continue;
-			//mgp->mg_pdp = pctx;
-			mgp->mg_ptmsi = ptmsi;
-			mgp->mg_nsapi = nsapi;
-			return mgp;
-		}
-	}
-	return NULL;
+	return mg_con_table.findFree(ptmsi,nsapi,pat_timef(),ggConfig.mgIpTimeout);
 }
 
 void mg_con_open(mg_con_t *mgp,PdpContext *pdp)
 {
-	mgp->mg_pdp = pdp;
+	mg_con_table.open(mgp,pdp);
 }
 
 void mg_con_close(mg_con_t *mgp)
 {
-	mgp->mg_pdp = NULL;
-	mgp->mg_time_last_close = pat_timef();
+	mg_con_table.close(mgp,pat_timef());
 }
 
-#if 0
-static mg_con_t *mg_con_find_by_ctx(PdpContext *pctx)
+mg_con_t *mg_con_find_by_ctx(PdpContext *pctx)
 {
-	int i; mg_con_t *mgp = mg_cons;
-	for (i=0; i < ggConfig.mgMaxConnections; i++, mgp++) {
-		if (mgp->mg_pdp == pctx) { return mgp; }
-	}
-	return NULL;
+	return mg_con_table.findByCtx(pctx);
 }
-#endif
 
+// This is the per-packet lookup for downlink packets.
 static mg_con_t *mg_con_find_by_ip(uint32_t addr)
 {
-	int i; mg_con_t *mgp = mg_cons;
-	for (i=0; i < ggConfig.mgMaxConnections; i++, mgp++) {
-		if (mgp->mg_ip == addr) { return mgp; }
-	}
-	return NULL;
+	return mg_con_table.findByIp(addr);
 }
 
 static bool verbose = true;
@@ -265,54 +287,72 @@ static char *packettoa(char *result,unsigned char *packet, int len)
 }
 
 
-unsigned char *miniggsn_rcv_npdu(int *plen, uint32_t *dstaddr)
-{
-	static unsigned char *recvbuf = NULL;
+// The receive buffers.  Each tun reader thread has its own set.  Each poll wakeup drains up to mgRxBatch
+// packets from a tun queue into these buffers before any of them are processed, so the tun fd is serviced
+// in a burst instead of once per poll().
+// The packet is read straight into a refcounted ByteVector which is handed down through the SGSN
+// to the RLC SDU queue, so a downlink packet is not copied between the tun read and the RLC.
+// A buffer that has been handed off is replaced by a new one at the next read.
+// Packets up to mgRxCopyBreak bytes are copied into a ByteVector of their own instead, and the receive
+// buffer is kept: the copy costs less than the allocation of a full sized buffer, and a queue of small
+// TCP acks does not tie up a maximum size buffer apiece.
+struct MgRxBuf {
+	ByteVector mBuf;
+	int mLen;
+};
 
-	if (recvbuf == NULL) {
-		recvbuf = (unsigned char*)malloc(ggConfig.mgMaxPduSize+2);
-		if (!recvbuf) { /**error = -ENOMEM;*/ return NULL; }
-	}
+// Leave room in front of the packet so a layer that prepends a header can use growLeft() instead of copying,
+// and room after it for a trailer, like the LLC FCS; see LlcUserDataFrame::encapsulate().
+// The tail room also lets us zero terminate for the convenience of the pinger.
+#define MG_RX_HEADROOM 16
+#define MG_RX_TAILROOM 4
 
-	// The O_NONBLOCK was set by default!  Is not happening any more.
-	{
-		int flags = fcntl(tun_fd,F_GETFL,0);
-		if (flags & O_NONBLOCK) {
-			//MGDEBUG(4,"O_NONBLOCK = %d",O_NONBLOCK & flags);
-			flags &= ~O_NONBLOCK;	// Want Blocking!
-			int fcntlstat = fcntl(tun_fd,F_SETFL,flags);
-			MGWARN("ggsn: WARNING: Turning off tun_fd blocking flag, fcntl=%d",fcntlstat);
-		}
-	}
+static void mg_rxbuf_alloc(MgRxBuf *rb)
+{
+	ByteVector buf(MG_RX_HEADROOM + ggConfig.mgMaxPduSize + MG_RX_TAILROOM);
+	buf.trimLeft(MG_RX_HEADROOM);
+	rb->mBuf.transfer(buf);
+	MG_STAT_ADD(mRxBufAllocs,1);
+}
 
-	// We can just read from the tunnel.
-	int ret = read(tun_fd,recvbuf,ggConfig.mgMaxPduSize);
-	if (ret < 0) {
-		MGERROR("ggsn: error: reading from tunnel: %s", strerror(errno));
-		//*error = ret;
-		return NULL;
-	} else if (ret == 0) {
-		MGERROR("ggsn: error: zero bytes reading from tunnel: %s", strerror(errno));
-		//*error = ret;	// huh?
-		return NULL;
-	} else {
-		struct iphdr *iph = (struct iphdr*)recvbuf;
-		{
-			char infobuf[200];
-			MGINFO("ggsn: received %s at %s",packettoa(infobuf,recvbuf,ret), timestr().c_str());
-			//MGLOGF("ggsn: received proto=%s %d byte npdu from %s for %s at %s",
-				//ip_proto_name(iph->protocol), ret,
-				//ip_ntoa(iph->saddr,nbuf),
-				//ip_ntoa(iph->daddr,NULL), timestr());
-		}
+MgRxBuf *miniggsn_rxbufs_alloc()
+{
+	MgRxBuf *bufs = new MgRxBuf[ggConfig.mgRxBatch];
+	for (unsigned i = 0; i < ggConfig.mgRxBatch; i++) { mg_rxbuf_alloc(&bufs[i]); }
+	return bufs;
+}
 
-		*dstaddr = iph->daddr;
-		// TODO: Do we have to allocate a new buffer?
-		*plen = ret;
-		// Zero terminate for the convenience of the pinger.
-		recvbuf[ret] = 0;
-		return recvbuf;
+// Read packets from the tun queue fd into the receive buffers until the queue is empty
+// or the buffers are full.  The tun fds are non-blocking, so read() returns EAGAIN
+// when we have drained it.  Return the number of packets read.
+static int miniggsn_rcv_npdus(int fd, MgRxBuf *bufs)
+{
+	unsigned cnt = 0;
+	while (cnt < ggConfig.mgRxBatch) {
+		MgRxBuf *rb = &bufs[cnt];
+		if (!rb->mBuf.isOwner()) { mg_rxbuf_alloc(rb); }	// The last one was handed off.
+		unsigned char *data = rb->mBuf.begin();
+		int ret = read(fd,data,ggConfig.mgMaxPduSize);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				MGERROR("ggsn: error: reading from tunnel: %s", strerror(errno));
+				MG_STAT_ADD(mRxErrors,1);
+			}
+			break;
+		} else if (ret == 0) {
+			MGERROR("ggsn: error: zero bytes reading from tunnel: %s", strerror(errno));
+			MG_STAT_ADD(mRxErrors,1);
+			break;
+		} else if (ret < (int)sizeof(struct iphdr)) {
+			MGERROR("ggsn: error: runt %d byte packet from tunnel",ret);
+			MG_STAT_ADD(mRxErrors,1);
+			continue;
+		}
+		rb->mLen = ret;
+		data[ret] = 0;
+		cnt++;
 	}
+	return cnt;
 }
 
 // If this is a duplicate TCP packet, throw it away.
@@ -320,76 +360,165 @@ unsigned char *miniggsn_rcv_npdu(int *plen, uint32_t *dstaddr)
 // which are unnecessary because we have reliable communication between here
 // and the MS, so just toss them.
 // Update 3-2012: Always do the check to print messages for dup packets even if not discarded.
-static int mg_toss_dup_packet(mg_con_t*mgp,unsigned char *packet, int packetlen)
+// The check is a fingerprint lookup in a small per-connection hash table; see MgDupFilter.h.
+// Return true if it is a duplicate; the caller decides whether to toss it.
+static bool mg_dup_packet(mg_con_t*mgp,unsigned char *packet, int packetlen, uint32_t now)
 {
-	struct iphdr *iph = (struct iphdr*)packet;
-	if (iph->protocol != IPPROTO_TCP) { return 0; }
-	struct tcphdr *tcph = (struct tcphdr*) (packet + 4 * iph->ihl);
-	if (tcph->rst | tcph->urg) { return 0; }
-	int i;
-	for (i = 0; i < MG_PACKET_HISTORY; i++) {
-		// 3-2012: Jpegs are not going through the system properly.
-		// I am adding some more checks here to see if we are tossing packets inappropriately.
-		// The tot_len includes headers, but if they are not the same in the duplicate packet, oh well.
-		// TODO: If the connection is reset we should zero out our history.
-		if (mgp->mg_packets[i].saddr == iph->saddr &&
-		    mgp->mg_packets[i].daddr == iph->daddr &&
-		    mgp->mg_packets[i].totlen == iph->tot_len &&
-		    //mgp->mg_packets[i].ipfragoff == iph->frag_off &&
-		    //mgp->mg_packets[i].ipid == iph->id &&
-		    mgp->mg_packets[i].seq == tcph->seq &&
-		    mgp->mg_packets[i].source == tcph->source &&
-		    mgp->mg_packets[i].dest == tcph->dest
-			) {
-				const char *what = ggConfig.mgIpTossDup ? "discarding " : "";
-				char buf1[40],buf2[40];
-				MGINFO("ggsn: %sduplicate %d byte packet seq=%d frag=%d id=%d src=%s:%d dst=%s:%d",what,
-					packetlen,tcph->seq,iph->frag_off,iph->id,
-					ip_ntoa(iph->saddr,buf1),tcph->source,
-					ip_ntoa(iph->daddr,buf2),tcph->dest);
-				return ggConfig.mgIpTossDup;	// Toss duplicate tcp packet if option set.
-			}
+	uint64_t fp = mgDupFingerprint(packet,packetlen);
+	if (fp == 0) { return false; }
+	// TODO: If the connection is reset we should zero out our history.
+	if (! mgp->mg_dups.check(fp,now,MG_DUP_WINDOW)) { return false; }
+	MG_STAT_ADD(mRxDuplicates,1);
+	if (ggConfig.mgIpTossDup) { MG_STAT_ADD(mRxDupTossed,1); }
+	if (MGTRACING()) {
+		struct iphdr *iph = (struct iphdr*)packet;
+		struct tcphdr *tcph = (struct tcphdr*) (packet + 4 * iph->ihl);
+		const char *what = ggConfig.mgIpTossDup ? "discarding " : "";
+		char buf1[40],buf2[40];
+		MGINFO("ggsn: %sduplicate %d byte packet seq=%u frag=%d id=%d src=%s:%d dst=%s:%d",what,
+			packetlen,ntohl(tcph->seq),iph->frag_off,iph->id,
+			ip_ntoa(iph->saddr,buf1),ntohs(tcph->source),
+			ip_ntoa(iph->daddr,buf2),ntohs(tcph->dest));
 	}
-	i = mgp->mg_oldest_packet;
-	if (++mgp->mg_oldest_packet >= MG_PACKET_HISTORY) { mgp->mg_oldest_packet = 0; }
-	mgp->mg_packets[i].saddr = iph->saddr;
-	mgp->mg_packets[i].daddr = iph->daddr;
-	mgp->mg_packets[i].totlen = iph->tot_len;
-	//mgp->mg_packets[i].ipfragoff = iph->frag_off;
-	//mgp->mg_packets[i].ipid = iph->id;
-	mgp->mg_packets[i].seq = tcph->seq;
-	mgp->mg_packets[i].source = tcph->source;
-	mgp->mg_packets[i].dest = tcph->dest;
-	return 0;	// Do not toss.
+	return true;
 }
 
-// There is data available on the socket.  Go get it.
-// see handle_nsip_read()
-void miniggsn_handle_read()
+// Send one packet from the tunnel to the PdpContext to which it belongs.
+// This runs in the worker thread that owns the connection, or in the reader if there is only one worker.
+// The pdu may be the receive buffer itself, which is handed off to the RLC, so it may be empty on return.
+void miniggsn_deliver_pdu(mg_con_t *mgp, ByteVector &pdu, uint32_t now)
 {
-	int packetlen;
-	uint32_t dstaddr;
-	unsigned char *packet = miniggsn_rcv_npdu(&packetlen, &dstaddr);
-	if (!packet) { return; }
+	unsigned char *packet = pdu.begin();
+	int packetlen = pdu.size();
+	// The context may have been closed after the reader looked it up.
+	PdpContext *pdp = mgp->mg_pdp;
+	if (pdp == NULL) {
+		MG_STAT_ADD(mRxNoContext,1);
+		gGgsnTrace.trace(GgsnTrace::Downlink,GgsnTrace::NoContext,mgp - mg_cons + 1,packet,packetlen);
+		return;
+	}
+
+	bool dup = mg_dup_packet(mgp,packet,packetlen,now);
+	if (dup && ggConfig.mgIpTossDup) {	// Toss duplicate tcp packet if option set.
+		gGgsnTrace.trace(GgsnTrace::Downlink,GgsnTrace::DupTossed,mgp - mg_cons + 1,packet,packetlen);
+		return;
+	}
+	gGgsnTrace.trace(GgsnTrace::Downlink,dup ? GgsnTrace::Duplicate : GgsnTrace::Forwarded,mgp - mg_cons + 1,packet,packetlen);
+	//MGDEBUG(2,"miniggsn_handle_read pdp=%p",pdp);
+	pdp->pdpWriteHighSide(pdu);
+}
+
+// Find the connection for one packet from the tunnel and pass it to the worker that owns the connection.
+static void miniggsn_dispatch(MgRxBuf *rb, uint32_t now)
+{
+	unsigned char *packet = rb->mBuf.begin();
+	int packetlen = rb->mLen;
+	struct iphdr *iph = (struct iphdr*)packet;
+	uint32_t dstaddr = iph->daddr;
+	if (MGTRACING()) {
+		char infobuf[200];
+		MGINFO("ggsn: received %s at %s",packettoa(infobuf,packet,packetlen), timestr().c_str());
+	}
 
 	// We need to reassociate the packet with the PdpContext to which it belongs.
 	mg_con_t *mgp = mg_con_find_by_ip(dstaddr);
 	if (mgp == NULL || mgp->mg_pdp == NULL) {
-		MGERROR("ggsn: error: cannot find PDP context for incoming packet for IP dstaddr=%s",
-			ip_ntoa(dstaddr,NULL));
+		MG_STAT_ADD(mRxNoContext,1);
+		gGgsnTrace.trace(GgsnTrace::Downlink,GgsnTrace::NoContext,mgp ? mgp - mg_cons + 1 : 0,packet,packetlen);
+		if (MGTRACING()) {
+			MGERROR("ggsn: error: cannot find PDP context for incoming packet for IP dstaddr=%s",
+				ip_ntoa(dstaddr,NULL));
+		}
 		return;	// -1;
 	}
 
-	if (mg_toss_dup_packet(mgp,packet,packetlen)) { return; }
+	unsigned mss = ggConfig.mgMssClamp;
+	if (mss && ip_rewrite_mss(packet,packetlen,mss)) { MG_STAT_ADD(mMssClamped,1); }
+
+	// With one worker the reader delivers the packet itself, which saves a trip through a queue.
+	bool inline_ = ggConfig.mgWorkers == 1;
+	if ((unsigned)packetlen <= ggConfig.mgRxCopyBreak) {
+		// The copy gets the same head and tail room as the receive buffer.
+		ByteVector sdu(MG_RX_HEADROOM + packetlen + MG_RX_TAILROOM);
+		sdu.trimLeft(MG_RX_HEADROOM);
+		sdu.setAppendP(0);
+		sdu.append(packet,packetlen);
+		MG_STAT_ADD(mRxCopied,1);
+		if (inline_) { miniggsn_deliver_pdu(mgp,sdu,now); } else { gGgsn.steerDownlink(mgp,sdu); }
+		return;
+	}
+	rb->mBuf.setAppendP(packetlen);
+	if (inline_) { miniggsn_deliver_pdu(mgp,rb->mBuf,now); } else { gGgsn.steerDownlink(mgp,rb->mBuf); }
+	if (rb->mBuf.isOwner()) {
+		// Not handed off, eg, the MS has gone away.  Reuse it unless someone kept a reference to it
+		// or a layer below put its headers on in place before giving up on it.
+		if (rb->mBuf.getRefCnt() == 1 && rb->mBuf.headroom() == MG_RX_HEADROOM) {
+			rb->mBuf.resetSize();
+		} else {
+			rb->mBuf.clear();
+		}
+	}
+}
 
-	PdpContext *pdp = mgp->mg_pdp;
-	//MGDEBUG(2,"miniggsn_handle_read pdp=%p",pdp);
-	pdp->pdpWriteHighSide(packet,packetlen);
+// There is data available on the tun queue fd.  Go get it.
+// We take one batch per queue per wakeup so one busy queue cannot starve the others;
+// if there is more data, the next poll() returns immediately.
+// Return the number of packets read.
+// see handle_nsip_read()
+int miniggsn_handle_read(int fd, MgRxBuf *bufs)
+{
+	int cnt = miniggsn_rcv_npdus(fd,bufs);
+	uint32_t now = time(NULL);	// Seconds is plenty for the duplicate window.
+	gGgsnTrace.tick();
+	for (int i = 0; i < cnt; i++) {
+		miniggsn_dispatch(&bufs[i],now);
+	}
+	MG_STAT_ADD(mRxPackets,cnt);
+	if ((unsigned)cnt > gMgTunStats.mRxBatchMax) { gMgTunStats.mRxBatchMax = cnt; }
+	return cnt;
+}
+
+unsigned miniggsn_tx_batch_size() { return ggConfig.mgTxBatch; }
+unsigned miniggsn_num_workers() { return ggConfig.mgWorkers; }
+
+// The CPU to pin the worker to, or -1 to leave it to the scheduler.
+// The list is used round robin if there are more workers than CPUs listed.
+int miniggsn_worker_cpu(unsigned worker)
+{
+	if (ggConfig.mgWorkerCpus.empty()) { return -1; }
+	return ggConfig.mgWorkerCpus[worker % ggConfig.mgWorkerCpus.size()];
+}
+
+void MgTunStats::clear()
+{
+	memset(this,0,sizeof(*this));
+	mStartTime = timef();
+}
+
+void MgTunStats::text(std::ostream &os) const
+{
+	double elapsed = timef() - mStartTime;
+	os << "tun queues=" << tun_nqueues << " rxbatch=" << ggConfig.mgRxBatch << " txbatch=" << ggConfig.mgTxBatch
+	   << " workers=" << ggConfig.mgWorkers << "\n";
+	os << "rx:" << LOGVAR2("wakeups",mRxWakeups) << LOGVAR2("packets",mRxPackets) << LOGVAR2("errors",mRxErrors)
+	   << LOGVAR2("maxbatch",mRxBatchMax)
+	   << format(" avgbatch=%.2f",mRxWakeups ? (double)mRxPackets/mRxWakeups : 0.0)
+	   << LOGVAR2("duplicates",mRxDuplicates) << LOGVAR2("duptossed",mRxDupTossed) << LOGVAR2("nocontext",mRxNoContext)
+	   << LOGVAR2("copied",mRxCopied) << LOGVAR2("bufallocs",mRxBufAllocs) << LOGVAR2("steered",mRxSteered) << "\n";
+	os << "tx:" << LOGVAR2("wakeups",mTxBatches) << LOGVAR2("packets",mTxPackets) << LOGVAR2("errors",mTxErrors)
+	   << LOGVAR2("maxbatch",mTxBatchMax)
+	   << format(" avgbatch=%.2f",mTxBatches ? (double)mTxPackets/mTxBatches : 0.0)
+	   << LOGVAR2("bad",mTxBad) << LOGVAR2("denied",mTxDenied) << "\n";
+	os << "rewrite:" << LOGVAR2("mssclamped",mMssClamped) << "\n";
+	if (elapsed > 0) {
+		os << format("rate: rx=%.1f tx=%.1f packets/sec over %.0f seconds\n",mRxPackets/elapsed,mTxPackets/elapsed,elapsed);
+	}
 }
 
 
 // The npdu is a raw packet including the ip header.
-int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len)
+// It is written to the tun queue fd, which is the one belonging to the worker thread calling this.
+int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len, int fd)
 {
     // Verify the IP header.
     struct iphdr *ipheader = (struct iphdr*)npdu;
@@ -398,21 +527,32 @@ int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len)
     uint32_t packet_source_ip_addr = ipheader->saddr;
     uint32_t packet_dest_ip_addr = ipheader->daddr;
 
-	char infobuf[200];
-	MGINFO("ggsn: writing %s at %s",packettoa(infobuf,npdu,len),timestr().c_str());
+	if (MGTRACING()) {
+		char infobuf[200];
+		MGINFO("ggsn: writing %s at %s",packettoa(infobuf,npdu,len),timestr().c_str());
+	}
 	//MGLOGF("ggsn: writing proto=%s %d byte npdu to %s from %s at %s",
 		//ip_proto_name(ipheader->protocol),
 		//len,ip_ntoa(packet_dest_ip_addr,NULL),
 		//ip_ntoa(packet_source_ip_addr,nbuf), timestr().c_str());
 
+	unsigned con = mgp - mg_cons + 1;
+	// The checks that fail are traced and counted, but only logged if tracing is on,
+	// so a misbehaving MS cannot flood the log.
 #define MUST_HAVE(assertion) \
-    if (! (assertion)) { MGERROR("ggsn: Packet failed test, discarded: %s",#assertion); return -1; }
+    if (! (assertion)) { \
+		MG_STAT_ADD(mTxBad,1); \
+		gGgsnTrace.trace(GgsnTrace::Uplink,GgsnTrace::BadPacket,con,npdu,len); \
+		if (MGTRACING()) { MGERROR("ggsn: Packet failed test, discarded: %s",#assertion); } \
+		return -1; \
+	}
 
     if (mg_debug_level > 2) ip_hdr_dump(npdu,"npdu");
     MUST_HAVE(ipheader->version == 4);	// 4 as in IPv4
     MUST_HAVE(ipheader->ihl >= 5);		// Minimum header length is 5 words.
 
-    int checksum = ip_checksum(ipheader,sizeof(*ipheader),NULL);
+    MUST_HAVE(len >= 4u * ipheader->ihl);
+    int checksum = ip_checksum(ipheader,4 * ipheader->ihl,NULL);
     MUST_HAVE(checksum == 0);				// If fails, packet is bad.
 
     MUST_HAVE(ipheader->ttl > 0);		// Time to live - how many hops allowed.
@@ -435,27 +575,34 @@ int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len)
     MUST_HAVE((packet_dest_ip_addr & net_mask) != (local_ip_addr & net_mask));
 #endif
 
-	for (GgsnFirewallRule *rp = gFirewallRules; rp; rp = rp->next) {
-		// 12-17: Change the message to indicate that this was a firewall rule violation.
-		//MUST_HAVE((packet_dest_ip_addr & rp->ipMasknl) != (rp->ipBasenl & rp->ipMasknl));
-		if (! ((packet_dest_ip_addr & rp->ipMasknl) != (rp->ipBasenl & rp->ipMasknl)) ) {
+	// 12-17: Change the message to indicate that this was a firewall rule violation.
+	// The firewall is compiled, so this costs the same no matter how many rules there are.
+	GgsnFirewallRef fw;
+	if (fw.get() && fw->denied(packet_dest_ip_addr)) {
+		MG_STAT_ADD(mTxDenied,1);
+		gGgsnTrace.trace(GgsnTrace::Uplink,GgsnTrace::Denied,con,npdu,len);
+		if (MGTRACING()) {
 			char ipaddrbuf[50]; ip_ntoa(packet_dest_ip_addr,ipaddrbuf);
 			MGERROR("ggsn: Packet wth dest ip = %s discarded by firewall",ipaddrbuf);
-			return -1;
 		}
+		return -1;
 	}
 
-    // Decrement ttl and recompute checksum.  We are doing this in place.
-    ipheader->ttl--;
-    ipheader->check = 0;
-    //ipheader->check = htons(ip_checksum(ipheader,sizeof(*ipheader),NULL));
-    ipheader->check = ip_checksum(ipheader,sizeof(*ipheader),NULL);
+    // Decrement ttl and update the checksum.  We are doing this in place.
+    // The checksum was verified above, so it is updated incrementally rather than recomputed.
+    ip_rewrite_ttl(npdu);
+	unsigned mss = ggConfig.mgMssClamp;
+	if (mss && ip_rewrite_mss(npdu,len,mss)) { MG_STAT_ADD(mMssClamped,1); }
 
 	// Just write to the MS-side tunnel device.
 
-	int result = write(tun_fd,npdu,len);
+	int result = write(fd,npdu,len);
 	if (result != (int) len) {
 		MGERROR("ggsn: error: write(tun_fd,%d) result=%d %s",len,result,strerror(errno));
+		MG_STAT_ADD(mTxErrors,1);
+		gGgsnTrace.trace(GgsnTrace::Uplink,GgsnTrace::WriteError,con,npdu,len);
+	} else {
+		gGgsnTrace.trace(GgsnTrace::Uplink,GgsnTrace::Forwarded,con,npdu,len);
 	}
     return 0;
 }
@@ -468,7 +615,7 @@ int miniggsn_snd_npdu(PdpContext *pctx,unsigned char *npdu, unsigned len)
 	// Find the fd from the pctx;  We should put this in the pdp_ctx.
 	mg_con_t *mgp = mg_con_find_by_ctx(pctx);
 	if (mgp == NULL) { return -1; }		// Whoops
-	return miniggsn_snd_npdu_by_mgc(mgp, npdu, len);
+	return miniggsn_snd_npdu_by_mgc(mgp, npdu, len, tun_fd);
 }
 #endif
 
@@ -488,6 +635,22 @@ bool miniggsn_init()
 	ggConfig.mgMaxPduSize = gConfig.getNum("GGSN.IP.MaxPacketSize");
 	ggConfig.mgMaxConnections = gConfig.getNum("GGSN.MS.IP.MaxCount");
 	ggConfig.mgIpTossDup = gConfig.getBool("GGSN.IP.TossDuplicatePackets");
+	ggConfig.mgTunQueues = gConfig.getNum("GGSN.Tun.Queues");
+	ggConfig.mgRxBatch = gConfig.getNum("GGSN.Tun.BatchSize");
+	ggConfig.mgTxBatch = ggConfig.mgRxBatch;
+	ggConfig.mgRxCopyBreak = gConfig.getNum("GGSN.Tun.CopyBreak");
+	if (ggConfig.mgTunQueues < 1) { ggConfig.mgTunQueues = 1; }
+	if (ggConfig.mgTunQueues > MG_MAX_TUN_QUEUES) { ggConfig.mgTunQueues = MG_MAX_TUN_QUEUES; }
+	if (ggConfig.mgRxBatch < 1) { ggConfig.mgRxBatch = ggConfig.mgTxBatch = 1; }
+	ggConfig.mgMssClamp = gConfig.getNum("GGSN.TCP.MSSClamp");
+	ggConfig.mgWorkers = gConfig.getNum("GGSN.Workers");
+	if (ggConfig.mgWorkers < 1) { ggConfig.mgWorkers = 1; }
+	if (ggConfig.mgWorkers > MG_MAX_WORKERS) { ggConfig.mgWorkers = MG_MAX_WORKERS; }
+	ggConfig.mgWorkerCpus.clear();
+	if (gConfig.defines("GGSN.Workers.CPUs")) {
+		std::vector<unsigned> cpus = gConfig.getVector("GGSN.Workers.CPUs");
+		ggConfig.mgWorkerCpus.assign(cpus.begin(),cpus.end());
+	}
 
 
 	string logfile = gConfig.getStr("GGSN.Logfile.Name");
@@ -573,7 +736,8 @@ bool miniggsn_init()
 	}
 
 	// Firewall rules:
-	bool firewall_enable;
+	int firewall_enable;
+	gFirewallRules.clear();
 	if ((firewall_enable = gConfig.getNum("GGSN.Firewall.Enable"))) {
 		// Block anything in the routed range:
 		addFirewallRule(route_basenl,route_masknl);
@@ -612,12 +776,16 @@ bool miniggsn_init()
 		MGINFO("  GGSN.IP.ReuseTimeout=%d", ggConfig.mgIpTimeout);
 		MGINFO("  GGSN.Firewall.Enable=%d", firewall_enable);
 		MGINFO("  GGSN.IP.TossDuplicatePackets=%d", ggConfig.mgIpTossDup);
+		MGINFO("  GGSN.Tun.Queues=%d", ggConfig.mgTunQueues);
+		MGINFO("  GGSN.Tun.BatchSize=%d", ggConfig.mgRxBatch);
+		MGINFO("  GGSN.Tun.CopyBreak=%d", ggConfig.mgRxCopyBreak);
+		MGINFO("  GGSN.TCP.MSSClamp=%d", ggConfig.mgMssClamp);
+		MGINFO("  GGSN.Workers=%d", ggConfig.mgWorkers);
+		MGINFO("  GGSN.Workers.CPUs=%s", gConfig.defines("GGSN.Workers.CPUs") ? gConfig.getStr("GGSN.Workers.CPUs").c_str() : "");
+		MGINFO("  GGSN.Trace.Sample=%d", (int)gConfig.getNum("GGSN.Trace.Sample"));
 	if (firewall_enable) {
-		MGINFO("GGSN Firewall Rules:");
-		for (GgsnFirewallRule *rp = gFirewallRules; rp; rp = rp->next) {
-			char buf1[40], buf2[40];
-			MGINFO("  block ip=%s mask=%s",ip_ntoa(rp->ipBasenl,buf1),ip_ntoa(rp->ipMasknl,buf2));
-		}
+		gFirewallEnable = firewall_enable;
+		miniggsn_firewall_load(true);
 	}
 	uint32_t dns[2];	// We dont use the result, we just want to print out the DNS servers now.
 	ip_finddns(dns);	// The dns servers are polled again later.
@@ -626,13 +794,28 @@ bool miniggsn_init()
 
 	if (tun_fd == -1) {
 		ip_init();
-		tun_fd = ip_tun_open(tun_if_name,route_str);
-		if (tun_fd < 0) {
+		tun_nqueues = ip_tun_open_queues(tun_if_name,route_str,tun_fds,ggConfig.mgTunQueues);
+		if (tun_nqueues <= 0) {
+			tun_nqueues = 0;
 			MGERROR("ggsn: ERROR: Could not open tun device %s",tun_if_name);
 			LOG(ALERT) << "Cound not open tun device:"<<tun_if_name;	// TEMPORARY MESSAGE
 			return false;
 		}
+		tun_fd = tun_fds[0];
+		// The read thread polls the queues and drains each one until EAGAIN, so they must be non-blocking.
+		for (int q = 0; q < tun_nqueues; q++) {
+			int flags = fcntl(tun_fds[q],F_GETFL,0);
+			if (fcntl(tun_fds[q],F_SETFL,flags | O_NONBLOCK) < 0) {
+				MGWARN("ggsn: WARNING: could not set tun queue %d non-blocking: %s",q,strerror(errno));
+			}
+		}
+		MGINFO("ggsn: opened tun device %s with %d queue(s)",tun_if_name,tun_nqueues);
+	}
+	gMgTunStats.clear();
+	if (!gGgsnTrace.init(gConfig.getNum("GGSN.Trace.Size"))) {
+		MGWARN("ggsn: could not allocate the packet trace");
 	}
+	gGgsnTrace.setSample(gConfig.getNum("GGSN.Trace.Sample"));
 
 	// DEBUG: Try it again.
 	//printf("DEBUG: Opening tunnel again: %d\n",ip_tun_open(tun_if_name,route_str));
@@ -658,6 +841,7 @@ bool miniggsn_init()
 		//mg_cons[i].mg_ip = inet_addr("192.168.1.99");
 		//printf("adding IP=%s\n",ip_ntoa(mg_cons[i].mg_ip,NULL));
 	}
+	mg_con_table.init(mg_cons,ggConfig.mgMaxConnections);
 	initstatus = 1;
 	return initstatus;
 }
@@ -16,6 +16,10 @@
 #define _MINIGGSN_H_
 #include <time.h>
 #include "Logger.h"
+#include "MgDupFilter.h"
+#include <arpa/inet.h>
+
+class ByteVector;
 
 namespace SGSN {
 
@@ -36,32 +40,74 @@ typedef struct mg_con_s {
 	uint32_t mg_ptmsi;		// The ptmsi that is using this IP connection.
 	int mg_nsapi;			// The nsapi in this ptmsi that is using this IP connection.
 	uint32_t mg_ip;			// The IP address used for this connection, in network order.
-	// Keep track of the last few tcp packets received:
-#define MG_PACKET_HISTORY 60
-	struct mg_packets {
-		uint16_t source, dest;	// TCP source and dest ports.
-		uint16_t totlen;		// IP length, which includes headers.
-		uint32_t seq;			// TCP sequence number
-		uint32_t saddr, daddr;	// source and destination IP addr
-		uint16_t ipid, ipfragoff;	// Added 3-2012
-	} mg_packets[MG_PACKET_HISTORY];
-	int mg_oldest_packet;
+	// Keep track of the last few tcp packets received, to find duplicates:
+	MgDupFilter mg_dups;
 	double mg_time_last_close;
 } mg_con_t;
 #define MG_CON_DEFINED
 
-unsigned char *miniggsn_rcv_npdu(int *error, int *plen, uint32_t *dstaddr);
+struct MgRxBuf;		// A tun reader's receive buffers.
+MgRxBuf *miniggsn_rxbufs_alloc();
 int miniggsn_snd_npdu(PdpContext *pctx,unsigned char *npdu, unsigned len);
-int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len);
-void miniggsn_handle_read();
+int miniggsn_snd_npdu_by_mgc(mg_con_t *mgp,unsigned char *npdu, unsigned len, int fd);
+int miniggsn_handle_read(int fd, MgRxBuf *bufs);
+void miniggsn_deliver_pdu(mg_con_t *mgp, ByteVector &pdu, uint32_t now);
+unsigned miniggsn_tx_batch_size();
+unsigned miniggsn_num_workers();
+int miniggsn_worker_cpu(unsigned worker);
+
+// The forwarding worker that owns the connection.  The addresses are consecutive, so this deals
+// the connections out to the workers in turn.  All the packets for a connection in both directions
+// are handled by its worker, which keeps them in order and means the per-connection state, like mg_dups,
+// is only touched by one thread.
+static inline unsigned mg_con_worker(const mg_con_t *mgp, unsigned numWorkers) {
+	return ntohl(mgp->mg_ip) % numWorkers;
+}
 bool miniggsn_init();
+void miniggsn_config_changed();
 mg_con_t *mg_con_find_free(uint32_t ptmsi, int nsapi);
 void mg_con_close(mg_con_t *mgp);
 void mg_con_open(mg_con_t *mgp,PdpContext *pdp);
+mg_con_t *mg_con_find_by_ctx(PdpContext *pctx);
 
 //extern int pinghttp(char *whoto,char *whofrom,mg_con_t *mgp);
 
 extern int tun_fd;
+// With GGSN.Tun.Queues > 1 the tun device is opened with IFF_MULTI_QUEUE and we get one fd per queue.
+// tun_fd is tun_fds[0].  Each forwarding worker writes to one of the queues; see Ggsn::start().
+#define MG_MAX_TUN_QUEUES 8
+extern int tun_fds[MG_MAX_TUN_QUEUES];
+extern int tun_nqueues;
+// Maximum GGSN.Workers.
+#define MG_MAX_WORKERS 16
+
+// Tun device I/O counters, shown by the "sgsn tunstat" command.
+// With GGSN.Workers > 1 several threads update them, so they are incremented with MG_STAT_ADD.
+// The max fields are not atomic; a lost update just understates the max.
+#define MG_STAT_ADD(field,n) __sync_fetch_and_add(&gMgTunStats.field,(n))
+struct MgTunStats {
+	unsigned mRxWakeups;	// Number of times poll() returned with something to read.
+	unsigned mRxPackets;
+	unsigned mRxBatchMax;	// Most packets read from one queue in one wakeup.
+	unsigned mRxErrors;
+	unsigned mRxDuplicates;	// Duplicate TCP packets seen.
+	unsigned mRxDupTossed;	// Duplicate TCP packets discarded, if GGSN.IP.TossDuplicatePackets.
+	unsigned mRxNoContext;	// No PDP context for the destination address.
+	unsigned mRxCopied;		// Small packets copied out of the receive buffer; see GGSN.Tun.CopyBreak.
+	unsigned mRxBufAllocs;	// Receive buffers allocated to replace ones handed off to the RLC.
+	unsigned mRxSteered;	// Packets passed from a reader thread to a worker thread.
+	unsigned mTxBatches;	// Number of worker wakeups that had uplink packets to write.
+	unsigned mTxPackets;
+	unsigned mTxBatchMax;
+	unsigned mTxErrors;
+	unsigned mTxBad;		// Failed the uplink header checks.
+	unsigned mTxDenied;		// Discarded by the firewall.
+	unsigned mMssClamped;	// TCP SYNs in either direction whose MSS was lowered to GGSN.TCP.MSSClamp.
+	double mStartTime;
+	void clear();
+	void text(std::ostream &os) const;
+};
+extern MgTunStats gMgTunStats;
 
 // From iputils.h:
 bool ip_addr_crack(const char *address,uint32_t *paddr, uint32_t *pmask);
@@ -70,9 +116,15 @@ char *ip_sockaddr2a(void * /*struct sockaddr * */ sap,char *buf);
 int ip_add_addr(char *ifname, int32_t ipaddr, int maskbits);
 const char *ip_proto_name(int ipproto);
 unsigned int ip_checksum(void *ptr, unsigned len, void *dummyhdr);
+uint32_t ip_csum_add(uint32_t sum, const void *ptr, unsigned len);
+uint16_t ip_csum_fold(uint32_t sum);
+uint16_t ip_csum_update16(uint16_t check, uint16_t oldval, uint16_t newval);
+uint16_t ip_csum_update32(uint16_t check, uint32_t oldval, uint32_t newval);
 void ip_hdr_dump(unsigned char *packet, const char *msg);
 int runcmd(const char *path, ...);
 int ip_tun_open(const char *tname, const char *addrstr);
+int ip_tun_open_queues(const char *tname, const char *addrstr, int *fds, int numQueues);
+void ip_tun_setup(int fd, const char *tname, const char *addrstr);
 void ip_init();
 int ip_finddns(uint32_t*);
 uint32_t *ip_findmyaddr();
@@ -96,6 +148,8 @@ extern time_t gGgsnInitTime;
 #define MGERROR(...) {MGLOGF(__VA_ARGS__) char *tmp;if (asprintf(&tmp,__VA_ARGS__)>0){LOG(ERR)<<tmp;free(tmp);}}
 #define MGWARN(...) {MGLOGF(__VA_ARGS__) char *tmp;if (asprintf(&tmp,__VA_ARGS__)>0){LOG(WARNING)<<tmp;free(tmp);}}
 #define MGINFO(...) {MGLOGF(__VA_ARGS__) char *tmp;if (asprintf(&tmp,__VA_ARGS__)>0){LOG(INFO)<<tmp;free(tmp);}}
+// The per-packet trace messages are expensive to format, so only build them if someone will see them.
+#define MGTRACING() (SGSN::mg_log_fp || IS_LOG_LEVEL(INFO))
 #define MGINFO2(...) {MGINFO(__VA_ARGS__) \
 	printf(__VA_ARGS__);putchar('\n');fflush(stdout); }
 
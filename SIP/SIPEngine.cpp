@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 #include <sys/types.h>
@@ -375,7 +376,7 @@ SIPState SIPEngine::MOCResendINVITE()
 	return mState;
 }
 
-SIPState  SIPEngine::MOCWaitForOK()
+SIPState  SIPEngine::MOCWaitForOK(unsigned readTimeout)
 {
 	LOG(INFO) << "user " << mSIPUsername << " state " << mState;
 
@@ -384,7 +385,7 @@ SIPState  SIPEngine::MOCWaitForOK()
 	// Read off the fifo. if time out will
 	// clean up and return false.
 	try {
-		msg = gSIPInterface.read(mCallID, gConfig.getNum("SIP.Timer.A"));
+		msg = gSIPInterface.read(mCallID, readTimeout);
 	}
 	catch (SIPTimeout& e) { 
 		LOG(DEBUG) << "timeout";
@@ -484,14 +485,14 @@ SIPState SIPEngine::MODResendBYE()
 	return mState;
 }
 
-SIPState SIPEngine::MODWaitForOK()
+SIPState SIPEngine::MODWaitForOK(bool wait)
 {
 	LOG(INFO) << "user " << mSIPUsername << " state " << mState;
 	bool responded = false;
-	Timeval byeTimeout(gConfig.getNum("SIP.Timer.F")); 
-	while (!byeTimeout.passed()) {
+	Timeval byeTimeout(wait ? gConfig.getNum("SIP.Timer.F") : 0);
+	do {
 		try {
-			osip_message_t * ok = gSIPInterface.read(mCallID, gConfig.getNum("SIP.Timer.E"));
+			osip_message_t * ok = gSIPInterface.read(mCallID, wait ? gConfig.getNum("SIP.Timer.E") : 0);
 			responded = true;
 			unsigned code = ok->status_code;
 			saveResponse(ok);
@@ -502,10 +503,11 @@ SIPState SIPEngine::MODWaitForOK()
 			break;
 		}
 		catch (SIPTimeout& e) {
+			if (!wait) break;
 			LOG(NOTICE) << "response timeout, resending BYE";
 			MODResendBYE();
 		}
-	}
+	} while (!byeTimeout.passed());
 
 	if (!responded) { LOG(ALERT) << "lost contact with proxy " << mProxyIP << ":" << mProxyPort; }
 
@@ -614,7 +616,7 @@ SIPState SIPEngine::MTCSendOK( short wRTPPort, unsigned wCodec )
 	return mState;
 }
 
-SIPState SIPEngine::MTCWaitForACK()
+SIPState SIPEngine::MTCWaitForACK(unsigned readTimeout)
 {
 	// wait for ack,set this to timeout of 
 	// of call channel.  If want a longer timeout 
@@ -625,7 +627,7 @@ SIPState SIPEngine::MTCWaitForACK()
 
 	// FIXME -- This is supposed to retransmit BYE on timer I.
 	try {
-		ack = gSIPInterface.read(mCallID, gConfig.getNum("SIP.Timer.H"));
+		ack = gSIPInterface.read(mCallID, readTimeout);
 	}
 	catch (SIPTimeout& e) {
 		LOG(NOTICE) << "timeout";
@@ -738,8 +740,12 @@ void SIPEngine::InitRTP(const osip_message_t * msg )
 		rtp_session_set_send_profile(mSession,profile);
 	}
 
-	rtp_session_set_blocking_mode(mSession, TRUE);
-	rtp_session_set_scheduling_mode(mSession, TRUE);
+	// The MediaRelay paces all the calls from one thread, so the reads must not block.
+	rtp_session_set_blocking_mode(mSession, FALSE);
+	rtp_session_set_scheduling_mode(mSession, FALSE);
+	// The call's JitterBuffer does the playout timing, so oRTP hands over packets as they come.
+	rtp_session_enable_adaptive_jitter_compensation(mSession, FALSE);
+	rtp_session_set_jitter_compensation(mSession, 0);
 	rtp_session_set_connected_mode(mSession, TRUE);
 	rtp_session_set_symmetric_rtp(mSession, TRUE);
 	// Hardcode RTP session type to GSM full rate (GSM 06.10).
@@ -843,6 +849,30 @@ int SIPEngine::rxFrame(unsigned char* frame)
 }
 
 
+int SIPEngine::rxPacket(unsigned char* frame, unsigned& timestamp, unsigned& sequence)
+{
+	if(mState!=Active) return 0;
+
+	// Ask for anything up to a second ahead of the playout clock; the caller orders them.
+	mblk_t *packet = rtp_session_recvm_with_ts(mSession, mRxTime+8000);
+	if (!packet) {
+		// Drained.  The playout clock moves once per frame period, on the last read.
+		mRxTime += 160;
+		return 0;
+	}
+	rtp_header_t *header = (rtp_header_t*)packet->b_rptr;
+	timestamp = header->timestamp;
+	sequence = header->seq_number;
+	unsigned char *payload;
+	int length = rtp_get_payload(packet, &payload);
+	// HACK -- Hardcoded for GSM/8000.
+	if (length>(int)RTPGSM610FrameBytes) length = RTPGSM610FrameBytes;
+	if (length>0) memcpy(frame, payload, length);
+	freemsg(packet);
+	return length>0 ? length : 0;
+}
+
+
 
 
 SIPState SIPEngine::MOSMSSendMESSAGE(const char * wCalledUsername, 
@@ -877,12 +907,12 @@ SIPState SIPEngine::MOSMSSendMESSAGE(const char * wCalledUsername,
 };
 
 
-SIPState SIPEngine::MOSMSWaitForSubmit()
+SIPState SIPEngine::MOSMSWaitForSubmit(unsigned readTimeout)
 {
 	LOG(INFO) << "user " << mSIPUsername << " state " << mState;
 
 	try {
-		osip_message_t * ok = gSIPInterface.read(mCallID, gConfig.getNum("SIP.Timer.A"));
+		osip_message_t * ok = gSIPInterface.read(mCallID, readTimeout);
 		// That should never return NULL.
 		assert(ok);
 		if((ok->status_code==200) || (ok->status_code==202) ) {
@@ -923,7 +953,7 @@ SIPState SIPEngine::MTSMSSendOK()
 
 
 
-bool SIPEngine::sendINFOAndWaitForOK(unsigned wInfo)
+void SIPEngine::sendINFO(unsigned wInfo)
 {
 	LOG(INFO) << "user " << mSIPUsername << " state " << mState;
 
@@ -937,10 +967,14 @@ bool SIPEngine::sendINFOAndWaitForOK(unsigned wInfo)
 		mMyTag.c_str(), mViaBranch.c_str(), mCallIDHeader, mCSeq); 
 	gSIPInterface.write(&mProxyAddr,info);
 	osip_message_free(info);
+}
+
 
+bool SIPEngine::waitForINFOOK(unsigned readTimeout)
+{
 	try {
 		// This will timeout on failure.  It will not return NULL.
-		osip_message_t *msg = gSIPInterface.read(mCallID, gConfig.getNum("SIP.Timer.A"));
+		osip_message_t *msg = gSIPInterface.read(mCallID, readTimeout);
 		LOG(DEBUG) << "received status " << msg->status_code << " " << msg->reason_phrase;
 		bool retVal = (msg->status_code==200);
 		osip_message_free(msg);
@@ -955,6 +989,13 @@ bool SIPEngine::sendINFOAndWaitForOK(unsigned wInfo)
 };
 
 
+bool SIPEngine::sendINFOAndWaitForOK(unsigned wInfo)
+{
+	sendINFO(wInfo);
+	return waitForINFOOK(gConfig.getNum("SIP.Timer.A"));
+}
+
+
 
 
 // vim: ts=4 sw=4
@@ -180,7 +180,12 @@ public:
 
 	SIPState MOCResendINVITE();
 
-	SIPState MOCWaitForOK();
+	/**
+		Read the next response to our INVITE and update the state from it.
+		@param readTimeout ms to wait for the response; 0 only takes one already queued.
+		@return New SIP call state, Timeout if there was no response.
+	*/
+	SIPState MOCWaitForOK(unsigned readTimeout);
 
 	SIPState MOCSendACK();
 
@@ -200,7 +205,8 @@ public:
 		const char * calledDomain, const char *messageText,
 		const char *contentType);
 
-	SIPState MOSMSWaitForSubmit();
+	/** Wait up to readTimeout ms for the response to our MESSAGE; Cleared if it was accepted. */
+	SIPState MOSMSWaitForSubmit(unsigned readTimeout);
 
 	SIPState MTSMSSendOK();
 
@@ -215,7 +221,8 @@ public:
 
 	SIPState MTCSendOK(short rtpPort, unsigned codec);
 
-	SIPState MTCWaitForACK();
+	/** Wait up to readTimeout ms for the ACK to our OK; Timeout if there was none. */
+	SIPState MTCWaitForACK(unsigned readTimeout);
 
 	SIPState MTCCheckForCancel();
 	//@}
@@ -235,7 +242,12 @@ public:
 
 	SIPState MODResendBYE();
 
-	SIPState MODWaitForOK();
+	/**
+		Wait for the response to our BYE, resending the BYE every Timer.E, for up to Timer.F.
+		If wait is false, only take a response that is already queued and give up if there is none.
+		Either way, the SIP side of the call is cleared on return.
+	*/
+	SIPState MODWaitForOK(bool wait=true);
 	//@}
 
 
@@ -257,12 +269,21 @@ public:
 	void txFrame(unsigned char* frame);
 
 	/**
-		Receive a vocoder frame over RTP.
+		Receive the vocoder frame for the next 20 ms over RTP, without waiting for it.
 		@param The vocoder frame
-		@return new RTP timestamp
+		@return the number of bytes received, 0 if there was none
 	*/
 	int  rxFrame(unsigned char* frame);
 
+	/**
+		Receive the next RTP packet as it arrived, without waiting, for a jitter buffer.
+		Call until it returns 0 once per frame period.
+		@param frame The vocoder frame
+		@param timestamp, sequence From the RTP header
+		@return the number of bytes received, 0 if there are no more
+	*/
+	int  rxPacket(unsigned char* frame, unsigned& timestamp, unsigned& sequence);
+
 	void MOCInitRTP();
 	void MTCInitRTP();
 
@@ -278,6 +299,15 @@ public:
 	*/
 	bool sendINFOAndWaitForOK(unsigned wInfo);
 
+	/** Send a SIP INFO message without waiting for the response. */
+	void sendINFO(unsigned wInfo);
+
+	/**
+		Wait up to readTimeout ms for the response to an INFO sent with sendINFO().
+		@return true if it was 200 OK.
+	*/
+	bool waitForINFOOK(unsigned readTimeout);
+
 	//@}
 
 
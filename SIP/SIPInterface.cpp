@@ -20,6 +20,7 @@
 #include <UMTSConfig.h>
 #include <ControlCommon.h>
 #include <TransactionTable.h>
+#include <ControlEngine.h>
 
 #include <Sockets.h>
 
@@ -41,55 +42,6 @@ using namespace Control;
 
 
 
-// SIPMessageMap method definitions.
-
-void SIPMessageMap::write(const std::string& call_id, osip_message_t * msg)
-{
-	LOG(DEBUG) << "call_id=" << call_id << " msg=" << msg;
-	OSIPMessageFIFO * fifo = mMap.readNoBlock(call_id);
-	if( fifo==NULL ) {
-		// FIXME -- If this write fails, send "call leg non-existent" response on SIP interface.
-		LOG(NOTICE) << "missing SIP FIFO "<<call_id;
-		throw SIPError();
-	}
-	LOG(DEBUG) << "write on fifo " << fifo;
-	fifo->write(msg);	
-}
-
-osip_message_t * SIPMessageMap::read(const std::string& call_id, unsigned readTimeout)
-{ 
-	LOG(DEBUG) << "call_id=" << call_id;
-	OSIPMessageFIFO * fifo = mMap.readNoBlock(call_id);
-	if (!fifo) {
-		LOG(NOTICE) << "missing SIP FIFO "<<call_id;
-		throw SIPError();
-	}	
-	LOG(DEBUG) << "blocking on fifo " << fifo;
-	osip_message_t * msg =  fifo->read(readTimeout);	
-	if (!msg) throw SIPTimeout();
-	return msg;
-}
-
-
-bool SIPMessageMap::add(const std::string& call_id, const struct sockaddr_in* returnAddress)
-{
-	OSIPMessageFIFO * fifo = new OSIPMessageFIFO(returnAddress);
-	mMap.write(call_id, fifo);
-	return true;
-}
-
-bool SIPMessageMap::remove(const std::string& call_id)
-{
-	OSIPMessageFIFO * fifo = mMap.readNoBlock(call_id);
-	if(fifo == NULL) return false;
-	mMap.remove(call_id);
-	return true;
-}
-
-
-
-
-
 // SIPInterface method definitions.
 
 bool SIPInterface::addCall(const string &call_id)
@@ -107,9 +59,7 @@ bool SIPInterface::removeCall(const string &call_id)
 
 int SIPInterface::fifoSize(const std::string& call_id )
 { 
-	OSIPMessageFIFO * fifo = mSIPMap.map().read(call_id,0);
-	if(fifo==NULL) return -1;
-	return fifo->size();
+	return mSIPMap.size(call_id);
 }	
 
 
@@ -129,6 +79,7 @@ void SIPInterface::start(){
 	ortp_scheduler_init();
 	// FIXME -- Can we coordinate this with the global logger?
 	//ortp_set_log_level_mask(ORTP_MESSAGE|ORTP_WARNING|ORTP_ERROR);
+	mRouter.start(this,gConfig.getNum("SIP.Receive.Workers"));
 	mDriveThread.start((void *(*)(void*))driveLoop,this );
 }
 
@@ -160,7 +111,9 @@ void SIPInterface::write(const struct sockaddr_in* dest, osip_message_t *msg)
 
 void SIPInterface::drive() 
 {
-	// All inbound SIP messages go here for processing.
+	// All inbound SIP messages go here.
+	// Only the headers needed to route the message are looked at in this thread,
+	// so a burst of registrations or pings doesn't hold up the messages of the calls.
 
 	LOG(DEBUG) << "blocking on socket";
 	int numRead = mSIPSocket.read(mReadBuffer);
@@ -168,7 +121,6 @@ void SIPInterface::drive()
 		LOG(ALERT) << "cannot read SIP socket.";
 		return;
 	}
-	// FIXME -- Is this +1 offset correct?  Check it.
 	mReadBuffer[numRead] = '\0';
 
 	// Get the proxy from the inbound message.
@@ -186,11 +138,58 @@ void SIPInterface::drive()
 	string proxy = string(msgHost) + string(":") + string(msgPort);
 #endif
 
+	// A CRLF keepalive needs no answer.
+	if (SIPHeaderScan::keepalive(mReadBuffer,numRead)) {
+		LOG(DEBUG) << "keepalive";
+		return;
+	}
+
 	char firstLine[101];
 	sscanf(mReadBuffer,"%100[^\n]",firstLine);
 	LOG(INFO) << "read " << firstLine;
 	LOG(DEBUG) << "read " << mReadBuffer;
 
+	SIPDatagram *datagram = new SIPDatagram(mReadBuffer,numRead,mSIPSocket.source());
+	if (!datagram->mHeaders.scan(mReadBuffer,numRead)) {
+		LOG(WARNING) << "message with no call id: " << mReadBuffer;
+		delete datagram;
+		return;
+	}
+
+	// Pings are answered here.
+	if (datagram->mHeaders.mRequest && datagram->mHeaders.mMethod=="OPTIONS") {
+		answerOPTIONS(datagram);
+		delete datagram;
+		return;
+	}
+
+	mRouter.route(datagram);
+}
+
+
+void SIPInterface::answerOPTIONS(const SIPDatagram *datagram)
+{
+	string reply = "SIP/2.0 200 OK\r\n" + datagram->mHeaders.mEcho + "Content-Length: 0\r\n\r\n";
+	LOG(DEBUG) << "write " << reply;
+	mSocketLock.lock();
+	mSIPSocket.send((const struct sockaddr*)&datagram->mSource,reply.c_str());
+	mSocketLock.unlock();
+}
+
+
+void SIPInterface::dispatch(SIPDatagram *datagram)
+{
+	const SIPHeaderScan &headers = datagram->mHeaders;
+	// The crowbars below work on the text directly.
+	char *text = const_cast<char*>(datagram->mText.c_str());
+
+	// Only an INVITE or MESSAGE can start a transaction.
+	// Anything else for a call that isn't there is dropped without the full parse.
+	bool initiating = headers.mRequest && (headers.mMethod=="INVITE" || headers.mMethod=="MESSAGE");
+	if (!initiating && !mSIPMap.exists(headers.mCallID)) {
+		LOG(NOTICE) << "missing SIP FIFO " << headers.mCallID << " for " << headers.mMethod;
+		return;
+	}
 
 	try {
 
@@ -198,19 +197,22 @@ void SIPInterface::drive()
 		osip_message_t * msg;
 		int i = osip_message_init(&msg);
 		LOG(INFO) << "osip_message_init " << i;
-		int j = osip_message_parse(msg, mReadBuffer, strlen(mReadBuffer));
+		int j = osip_message_parse(msg, text, datagram->mText.size());
 		// seems like it ought to do something more than display an error,
 		// but it used to not even do that.
 		LOG(INFO) << "osip_message_parse " << j;
 
+		// Authentication is only done on registration, so only look there.
+		bool registration = !headers.mRequest && headers.mMethod=="REGISTER";
+
 		// heroic efforts to get it to parse the www-authenticate header failed,
 		// so we'll just crowbar that sucker in.
-		char *p = strcasestr(mReadBuffer, "nonce");
+		char *p = registration ? strcasestr(text, "nonce") : NULL;
 		if (p && p[-1] != 'c') { // nonce but not cnonce
 			p += 6;
 			char *q = p;
 			while (isalnum(*q)) { q++; }
-			string RAND = string(mReadBuffer, p-mReadBuffer, q-p);
+			string RAND = string(text, p-text, q-p);
 			LOG(INFO) << "crowbar www-authenticate " << RAND;
 			osip_www_authenticate_t *auth;
 			osip_www_authenticate_init(&auth);
@@ -223,12 +225,12 @@ void SIPInterface::drive()
 
 		// The parser doesn't seem to be interested in authentication info either.
 		// Get kc from there and put it in tmsi table.
-		char *pp = strcasestr(mReadBuffer, "cnonce");
+		char *pp = registration ? strcasestr(text, "cnonce") : NULL;
 		if (pp) {
 			pp += 7;
 			char *qq = pp;
 			while (isalnum(*qq)) { qq++; } 
-			string kc = string(mReadBuffer, pp-mReadBuffer, qq-pp);
+			string kc = string(text, pp-text, qq-pp);
 			LOG(INFO) << "storing kc in TMSI table";  // mustn't display kc in log
 			const char *imsi = osip_uri_get_username(msg->to->url);
 			if (imsi && strlen(imsi) > 0) {
@@ -266,10 +268,16 @@ void SIPInterface::drive()
 		LOG(DEBUG) << "got message " << msg << " with call id " << call_id_num << " and writing it to the map.";
 		string call_num(call_id_num);
 		// Don't free msg.  Whoever reads the FIFO will do that.
-		mSIPMap.write(call_num, msg);
+		if (!mSIPMap.write(call_num, msg)) {
+			// FIXME -- Send "call leg non-existent" response on SIP interface.
+			osip_message_free(msg);
+			return;
+		}
+		// Wake up the control machine running the call, if there is one.
+		gControlEngine.post(call_num,Control::ControlMachine::SIPEvent);
 	}
 	catch(SIPException) {
-		LOG(WARNING) << "cannot parse SIP message: " << mReadBuffer;
+		LOG(WARNING) << "cannot parse SIP message: " << text;
 	}
 }
 
@@ -376,7 +384,7 @@ bool SIPInterface::checkInvite( osip_message_t * msg)
 	}
 
 	// Check SIP map.  Repeated entry?  Page again.
-	if (mSIPMap.map().readNoBlock(callIDNum) != NULL) { 
+	if (mSIPMap.exists(callIDNum)) { 
 		TransactionEntry* transaction= gTransactionTable.find(mobileID,callIDNum);
 		// There's a FIFO but no trasnaction record?
 		if (!transaction) {
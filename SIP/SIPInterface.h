@@ -23,6 +23,9 @@
 
 #include <string>
 
+#include "SIPMessageMap.h"
+#include "SIPRouter.h"
+
 
 namespace GSM {
 
@@ -34,101 +37,27 @@ class L3MobileIdentity;
 namespace SIP {
 
 
-typedef InterthreadQueue<osip_message_t> _OSIPMessageFIFO;
-
-class OSIPMessageFIFO : public _OSIPMessageFIFO {
-
-	private:
-
-	struct sockaddr_in mReturnAddress;
-
-	virtual void freeElement(osip_message_t* element) const { osip_message_free(element); };
-
-	public:
-
-	OSIPMessageFIFO(const struct sockaddr_in* wReturnAddress)
-		:_OSIPMessageFIFO()
-	{
-		memcpy(&mReturnAddress,wReturnAddress,sizeof(mReturnAddress));
-	}
-
-	virtual ~OSIPMessageFIFO()
-	{
-		// We must call clear() here, because if it is called from InterthreadQueue
-		// destructor, then clear() will call InterthreadQueue's freeElement() which
-		// is not what we want. This destructor behaviour is intntional, because
-		// inherited object's data is already destroyed at the time parent's destructor
-		// is called.
-		clear();
-	}
-
-	const struct sockaddr_in* returnAddress() const { return &mReturnAddress; }
-
-	size_t addressSize() const { return sizeof(mReturnAddress); }
-
-};
-
-
-
-class OSIPMessageFIFOMap : public InterthreadMap<std::string,OSIPMessageFIFO> {};
-
-
-std::ostream& operator<<(std::ostream& os, const OSIPMessageFIFO& m);
-
-
 /**
-	A Map the keeps a SIP message FIFO for each active SIP transaction.
-	Keyed by SIP call ID string.
-	Overall map is thread-safe.  Each FIFO is also thread-safe.
+	The SIP side of the BTS.
+	One thread reads the socket and looks only at the headers needed for routing,
+	answering keepalives itself; the SIPRouter's workers do the full parse and the delivery.
 */
-class SIPMessageMap 
-{
-
-private:
-
-	OSIPMessageFIFOMap mMap;
-
-public:
-
-	/** Write sip message to the map+fifo. used by sip interface. */
-	void write(const std::string& call_id, osip_message_t * sip_msg );
-
-	/** Read sip message out of map+fifo. used by sip engine. */
-	osip_message_t * read(const std::string& call_id, unsigned readTimeout=3600000);
-	
-	/** Create a new entry in the map. */
-	bool add(const std::string& call_id, const struct sockaddr_in* returnAddress);
-
-	/**
-		Remove a fifo from map (called at the end of a sip interaction).
-		@param call_id The call_id key string.
-		@return True if the call_id was there in the first place.
-	*/
-	bool remove(const std::string& call_id);
-
-	/** Direct access to the map. */
-	// FIXME -- This should probably be replaced with more specific methods.
-	OSIPMessageFIFOMap& map() {return mMap;}
-
-};
-
-std::ostream& operator<<(std::ostream& os, const SIPMessageMap& m);
-
-
-
-
-class SIPInterface 
+class SIPInterface : public SIPDispatcher
 {
 
 private:
 
-	char mReadBuffer[2048];		///< buffer for UDP reads
+	char mReadBuffer[MAX_UDP_LENGTH+1];		///< buffer for UDP reads
 
 	UDPSocket mSIPSocket;
 
 	Mutex mSocketLock;
 	Thread mDriveThread;	
 	SIPMessageMap mSIPMap;	
+	SIPRouter mRouter;
+
+	/** Answer an OPTIONS ping with 200 OK from its scanned headers, without the parser. */
+	void answerOPTIONS(const SIPDatagram *datagram);
 
 public:
 	// 2 ways to starte sip interface. 
@@ -149,12 +78,18 @@ public:
 	{ }
 
 	
-	/** Start the SIP drive loop. */
+	/** Start the SIP drive loop and the workers. */
 	void start();
 
-	/** Receive, parse and dispatch a single SIP message. */
+	/** Receive a single SIP message and route it to its worker. */
 	void drive();
 
+	/** Parse and deliver a message, in a worker. */
+	void dispatch(SIPDatagram *datagram);
+
+	/** The worker queues. */
+	const SIPRouter& router() const { return mRouter; }
+
 	/**
 		Look for incoming INVITE messages to start MTC.
 		@param msg The SIP message to check.
@@ -0,0 +1,148 @@
+/**@file The per-call FIFOs of inbound SIP messages. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2008 Free Software Foundation, Inc.
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdint.h>
+#include "SIPMessageMap.h"
+#include "SIPUtility.h"
+
+#include <Logger.h>
+
+using namespace std;
+using namespace SIP;
+
+
+unsigned SIP::callIDHash(const string& callID)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (unsigned i=0; i<callID.size(); i++) {
+		hash ^= (unsigned char)callID[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+
+// SIPMessageMap method definitions.
+
+OSIPMessageFIFO * SIPMessageMap::acquire(const std::string& call_id)
+{
+	Shard &shard = this->shard(call_id);
+	ScopedLock lock(shard.mLock);
+	map<string,OSIPMessageFIFO*>::iterator itr = shard.mMap.find(call_id);
+	if (itr==shard.mMap.end()) return NULL;
+	itr->second->ref();
+	return itr->second;
+}
+
+
+SIPMessageMap::~SIPMessageMap()
+{
+	for (unsigned i=0; i<Shards; i++) {
+		Shard &shard = mShards[i];
+		ScopedLock lock(shard.mLock);
+		for (map<string,OSIPMessageFIFO*>::iterator itr = shard.mMap.begin(); itr!=shard.mMap.end(); ++itr) {
+			itr->second->unref();
+		}
+		shard.mMap.clear();
+	}
+}
+
+
+bool SIPMessageMap::write(const std::string& call_id, osip_message_t * msg)
+{
+	LOG(DEBUG) << "call_id=" << call_id << " msg=" << msg;
+	OSIPMessageFIFO * fifo = acquire(call_id);
+	if (!fifo) {
+		LOG(NOTICE) << "missing SIP FIFO "<<call_id;
+		return false;
+	}
+	// The write wakes the reader, so make it outside the shard lock, or the reader
+	// may wake only to wait on that lock for its next read.
+	LOG(DEBUG) << "write on fifo " << fifo;
+	fifo->write(msg);
+	fifo->unref();
+	return true;
+}
+
+osip_message_t * SIPMessageMap::read(const std::string& call_id, unsigned readTimeout)
+{
+	LOG(DEBUG) << "call_id=" << call_id;
+	OSIPMessageFIFO * fifo = acquire(call_id);
+	if (!fifo) {
+		LOG(NOTICE) << "missing SIP FIFO "<<call_id;
+		throw SIPError();
+	}
+	LOG(DEBUG) << "blocking on fifo " << fifo;
+	osip_message_t * msg =  fifo->read(readTimeout);
+	fifo->unref();
+	if (!msg) throw SIPTimeout();
+	return msg;
+}
+
+
+bool SIPMessageMap::add(const std::string& call_id, const struct sockaddr_in* returnAddress)
+{
+	OSIPMessageFIFO * fifo = new OSIPMessageFIFO(returnAddress);
+	OSIPMessageFIFO * old = NULL;
+	{
+		Shard &shard = this->shard(call_id);
+		ScopedLock lock(shard.mLock);
+		OSIPMessageFIFO *&entry = shard.mMap[call_id];
+		old = entry;
+		entry = fifo;
+	}
+	if (old) old->unref();
+	return true;
+}
+
+bool SIPMessageMap::remove(const std::string& call_id)
+{
+	OSIPMessageFIFO * fifo;
+	{
+		Shard &shard = this->shard(call_id);
+		ScopedLock lock(shard.mLock);
+		map<string,OSIPMessageFIFO*>::iterator itr = shard.mMap.find(call_id);
+		if (itr==shard.mMap.end()) return false;
+		fifo = itr->second;
+		shard.mMap.erase(itr);
+	}
+	fifo->unref();
+	return true;
+}
+
+
+bool SIPMessageMap::exists(const std::string& call_id) const
+{
+	const Shard &shard = this->shard(call_id);
+	ScopedLock lock(shard.mLock);
+	return shard.mMap.find(call_id)!=shard.mMap.end();
+}
+
+
+int SIPMessageMap::size(const std::string& call_id) const
+{
+	const Shard &shard = this->shard(call_id);
+	ScopedLock lock(shard.mLock);
+	map<string,OSIPMessageFIFO*>::const_iterator itr = shard.mMap.find(call_id);
+	if (itr==shard.mMap.end()) return -1;
+	return itr->second->size();
+}
+
+
+// vim: ts=4 sw=4
@@ -0,0 +1,144 @@
+/**@file The per-call FIFOs of inbound SIP messages. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2008 Free Software Foundation, Inc.
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef SIPMESSAGEMAP_H
+#define SIPMESSAGEMAP_H
+
+#include <string.h>
+#include <netinet/in.h>
+#include <string>
+#include <map>
+#include <Threads.h>
+#include <Interthread.h>
+#include <osipparser2/osip_message.h>
+
+
+namespace SIP {
+
+
+/** The hash of a SIP call ID, for splitting work and tables by call. */
+unsigned callIDHash(const std::string& callID);
+
+
+typedef InterthreadQueue<osip_message_t> _OSIPMessageFIFO;
+
+class OSIPMessageFIFO : public _OSIPMessageFIFO {
+
+	private:
+
+	struct sockaddr_in mReturnAddress;
+
+	/** One for the map, and one for each read in progress. */
+	volatile int mRefs;
+
+	public:
+
+	OSIPMessageFIFO(const struct sockaddr_in* wReturnAddress)
+		:_OSIPMessageFIFO(),mRefs(1)
+	{
+		memcpy(&mReturnAddress,wReturnAddress,sizeof(mReturnAddress));
+	}
+
+	virtual ~OSIPMessageFIFO()
+	{
+		// InterthreadQueue::clear() would delete the messages, but libosip allocates
+		// them with malloc, so free whatever is left here before the base destructor runs.
+		while (osip_message_t *msg = readNoBlock()) osip_message_free(msg);
+	}
+
+	const struct sockaddr_in* returnAddress() const { return &mReturnAddress; }
+
+	size_t addressSize() const { return sizeof(mReturnAddress); }
+
+	void ref() { __sync_fetch_and_add(&mRefs,1); }
+
+	/** Drop a reference, deleting the FIFO with the last one. */
+	void unref() { if (__sync_sub_and_fetch(&mRefs,1)==0) delete this; }
+
+};
+
+
+std::ostream& operator<<(std::ostream& os, const OSIPMessageFIFO& m);
+
+
+/**
+	A Map the keeps a SIP message FIFO for each active SIP transaction.
+	Keyed by SIP call ID string.
+	The map is split into shards by call ID, each with its own lock, so the SIP workers
+	and the many controllers reading their FIFOs don't all wait on one lock.
+	A read blocks on the FIFO, not on the map, and a write signals only that FIFO,
+	so it wakes only the controller of that call.
+	The FIFOs are reference counted, so one removed during a read goes away when the read ends.
+*/
+class SIPMessageMap
+{
+
+private:
+
+	static const unsigned Shards = 16;
+
+	struct Shard {
+		mutable Mutex mLock;
+		std::map<std::string,OSIPMessageFIFO*> mMap;
+	};
+
+	Shard mShards[Shards];
+
+	Shard& shard(const std::string& call_id) { return mShards[callIDHash(call_id)%Shards]; }
+	const Shard& shard(const std::string& call_id) const { return mShards[callIDHash(call_id)%Shards]; }
+
+	/** The FIFO for the call ID with a reference taken, or NULL. */
+	OSIPMessageFIFO * acquire(const std::string& call_id);
+
+public:
+
+	~SIPMessageMap();
+
+	/**
+		Write sip message to the map+fifo. used by sip interface.
+		@return false if there is no FIFO for the call ID; the message is not taken then.
+	*/
+	bool write(const std::string& call_id, osip_message_t * sip_msg );
+
+	/** Read sip message out of map+fifo. used by sip engine. */
+	osip_message_t * read(const std::string& call_id, unsigned readTimeout=3600000);
+
+	/** Create a new entry in the map. */
+	bool add(const std::string& call_id, const struct sockaddr_in* returnAddress);
+
+	/**
+		Remove a fifo from map (called at the end of a sip interaction).
+		@param call_id The call_id key string.
+		@return True if the call_id was there in the first place.
+	*/
+	bool remove(const std::string& call_id);
+
+	/** True if there is a FIFO for the call ID. */
+	bool exists(const std::string& call_id) const;
+
+	/** The number of messages waiting for the call ID, or -1 if there is no FIFO. */
+	int size(const std::string& call_id) const;
+
+};
+
+std::ostream& operator<<(std::ostream& os, const SIPMessageMap& m);
+
+
+}	// SIP
+
+#endif
+// vim: ts=4 sw=4
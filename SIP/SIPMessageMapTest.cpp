@@ -0,0 +1,312 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the SIPMessageMap, then run many concurrent dialogs through it and through the old map,
+// one InterthreadMap behind a single lock.
+// Each dialog has a controller thread blocked in a read with a timeout on its own FIFO, as the
+// SIPEngine does; a few writer threads, standing in for the SIP workers, check each FIFO's size
+// and write a message to it, round robin over the dialogs, as fast as they can.
+// The new map then runs again with the dialogs turning over: after a few messages, a controller
+// removes its FIFO and adds one for a new call ID.  The old map can free a FIFO under a writer,
+// so it runs only without turnover.
+// Reports the messages delivered per second and two measures of lock contention: the time a
+// writer spends in the map for each message, and the context switches per message delivered,
+// since a thread that finds a lock held sleeps in the kernel until it is released.
+// Build with SIPMessageMap.cpp, CommonLibs and -losipparser2.
+// Usage: SIPMessageMapTest [dialogs] [seconds] [writers]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <vector>
+#include <osipparser2/osip_parser.h>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "SIPMessageMap.h"
+#include "SIPUtility.h"
+
+using namespace std;
+using namespace SIP;
+
+ConfigurationTable gConfig;
+
+static struct sockaddr_in gAddress;
+
+static osip_message_t *newMessage()
+{
+	osip_message_t *msg;
+	osip_message_init(&msg);
+	return msg;
+}
+
+
+static SIPMessageMap *gMap;
+
+static void *blockedReader(void *arg)
+{
+	bool *timedOut = (bool*)arg;
+	try {
+		osip_message_t *msg = gMap->read("removed",300);
+		osip_message_free(msg);
+	}
+	catch (SIPTimeout) { *timedOut = true; }
+	return NULL;
+}
+
+
+static void testMap()
+{
+	SIPMessageMap map;
+	CHECK(!map.exists("a"));
+	CHECK(map.size("a")==-1);
+	osip_message_t *msg = newMessage();
+	CHECK(!map.write("a",msg));
+	osip_message_free(msg);
+	CHECK(map.add("a",&gAddress));
+	CHECK(map.exists("a") && map.size("a")==0);
+	CHECK(map.write("a",newMessage()));
+	CHECK(map.write("a",newMessage()));
+	CHECK(map.size("a")==2);
+	osip_message_free(map.read("a",10));
+	CHECK(map.size("a")==1);
+	// Adding again replaces the FIFO, and whatever was in it.
+	CHECK(map.add("a",&gAddress));
+	CHECK(map.size("a")==0);
+	bool timedOut = false;
+	try { map.read("a",10); } catch (SIPTimeout) { timedOut = true; }
+	CHECK(timedOut);
+	bool missing = false;
+	try { map.read("b",10); } catch (SIPError) { missing = true; }
+	CHECK(missing);
+	CHECK(map.remove("a"));
+	CHECK(!map.remove("a"));
+
+	// A FIFO removed during a read stays until the read ends.
+	gMap = &map;
+	map.add("removed",&gAddress);
+	timedOut = false;
+	Thread reader;
+	reader.start(blockedReader,&timedOut);
+	msleep(50);
+	CHECK(map.remove("removed"));
+	reader.join();
+	CHECK(timedOut);
+	gMap = NULL;
+}
+
+
+
+// The old map, as it was.
+
+class OldMessageMap {
+
+	private:
+
+	InterthreadMap<string,OSIPMessageFIFO> mMap;
+
+	public:
+
+	bool write(const string& call_id, osip_message_t *msg)
+	{
+		OSIPMessageFIFO *fifo = mMap.readNoBlock(call_id);
+		if (!fifo) return false;
+		fifo->write(msg);
+		return true;
+	}
+
+	osip_message_t *read(const string& call_id, unsigned readTimeout)
+	{
+		OSIPMessageFIFO *fifo = mMap.readNoBlock(call_id);
+		if (!fifo) throw SIPError();
+		osip_message_t *msg = fifo->read(readTimeout);
+		if (!msg) throw SIPTimeout();
+		return msg;
+	}
+
+	bool add(const string& call_id) { mMap.write(call_id,new OSIPMessageFIFO(&gAddress)); return true; }
+
+	int size(const string& call_id)
+	{
+		OSIPMessageFIFO *fifo = mMap.read(call_id,0);
+		if (!fifo) return -1;
+		return fifo->size();
+	}
+};
+
+
+
+// The load.
+
+static const unsigned TurnoverMessages = 50;
+
+static OldMessageMap *gOldMap;
+static unsigned gNumDialogs;
+static bool gTurnover;
+static volatile bool gStopping;
+
+struct Dialog {
+	unsigned mIndex;
+	volatile unsigned mGeneration;
+	unsigned mDelivered;
+	Thread mThread;
+	// Small stacks, for the number of threads.
+	Dialog() :mIndex(0),mGeneration(0),mDelivered(0),mThread(64*1024) {}
+};
+
+static vector<Dialog*> gDialogs;
+
+static string callID(unsigned index, unsigned generation)
+{
+	char buf[40];
+	sprintf(buf,"%u-%u@127.0.0.1",index,generation);
+	return buf;
+}
+
+static void *controllerLoop(void *arg)
+{
+	Dialog *dialog = (Dialog*)arg;
+	unsigned count = 0;
+	while (!gStopping) {
+		string id = callID(dialog->mIndex,dialog->mGeneration);
+		try {
+			osip_message_t *msg = gMap ? gMap->read(id,100) : gOldMap->read(id,100);
+			osip_message_free(msg);
+			dialog->mDelivered++;
+			count++;
+		}
+		catch (SIPException) { continue; }
+		if (gTurnover && count%TurnoverMessages==0) {
+			// The call ends and another starts.
+			gMap->remove(id);
+			gMap->add(callID(dialog->mIndex,dialog->mGeneration+1),&gAddress);
+			dialog->mGeneration++;
+		}
+	}
+	return NULL;
+}
+
+struct Writer {
+	unsigned mStart;
+	unsigned mMisses;
+	unsigned mWrites;
+	double mInMap;			///< seconds spent in the map's size() and write() calls
+	Thread mThread;
+	Writer(unsigned wStart) :mStart(wStart),mMisses(0),mWrites(0),mInMap(0) {}
+};
+
+static void *writerLoop(void *arg)
+{
+	Writer *writer = (Writer*)arg;
+	unsigned *misses = &writer->mMisses;
+	for (unsigned i=writer->mStart; !gStopping; i++) {
+		Dialog *dialog = gDialogs[i%gNumDialogs];
+		string id = callID(dialog->mIndex,dialog->mGeneration);
+		double start = timef();
+		int size = gMap ? gMap->size(id) : gOldMap->size(id);
+		writer->mInMap += timef() - start;
+		if (size<0) { (*misses)++; continue; }
+		if (size>4) continue;
+		osip_message_t *msg = newMessage();
+		start = timef();
+		bool written = gMap ? gMap->write(id,msg) : gOldMap->write(id,msg);
+		writer->mInMap += timef() - start;
+		writer->mWrites++;
+		if (!written) {
+			osip_message_free(msg);
+			(*misses)++;
+		}
+	}
+	return NULL;
+}
+
+
+static void load(bool useNew, bool turnover, unsigned seconds, unsigned numWriters)
+{
+	gStopping = false;
+	gTurnover = turnover;
+	if (useNew) gMap = new SIPMessageMap;
+	else gOldMap = new OldMessageMap;
+	for (unsigned i=0; i<gNumDialogs; i++) {
+		Dialog *dialog = new Dialog;
+		dialog->mIndex = i;
+		gDialogs.push_back(dialog);
+		if (useNew) gMap->add(callID(i,0),&gAddress);
+		else gOldMap->add(callID(i,0));
+	}
+	for (unsigned i=0; i<gNumDialogs; i++) gDialogs[i]->mThread.start(controllerLoop,gDialogs[i]);
+	vector<Writer*> writers;
+	for (unsigned i=0; i<numWriters; i++) {
+		writers.push_back(new Writer(i*gNumDialogs/numWriters));
+		writers[i]->mThread.start(writerLoop,writers[i]);
+	}
+
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF,&before);
+	double start = timef();
+	sleep(seconds);
+	gStopping = true;
+	double elapsed = timef() - start;
+	getrusage(RUSAGE_SELF,&after);
+	unsigned misses = 0, writes = 0;
+	double inMap = 0;
+	for (unsigned i=0; i<numWriters; i++) {
+		writers[i]->mThread.join();
+		misses += writers[i]->mMisses;
+		writes += writers[i]->mWrites;
+		inMap += writers[i]->mInMap;
+		delete writers[i];
+	}
+	long switches = (after.ru_nvcsw-before.ru_nvcsw) + (after.ru_nivcsw-before.ru_nivcsw);
+	unsigned delivered = 0, turnovers = 0;
+	for (unsigned i=0; i<gNumDialogs; i++) {
+		gDialogs[i]->mThread.join();
+		delivered += gDialogs[i]->mDelivered;
+		turnovers += gDialogs[i]->mGeneration;
+		delete gDialogs[i];
+	}
+	gDialogs.clear();
+	printf(" %-4s: %.0f messages/sec delivered, %u dialog turnovers, %u writes missed\n",
+		useNew ? "new" : "old", delivered/elapsed, turnovers, misses);
+	printf("       %.2f us in the map per message written, %.2f context switches per message\n",
+		writes ? 1e6*inMap/writes : 0.0, delivered ? (double)switches/delivered : 0.0);
+	CHECK(delivered>0);
+	delete gMap;
+	gMap = NULL;
+	delete gOldMap;
+	gOldMap = NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+	gNumDialogs = argc>1 ? atoi(argv[1]) : 500;
+	unsigned seconds = argc>2 ? atoi(argv[2]) : 3;
+	unsigned numWriters = argc>3 ? atoi(argv[3]) : 2;
+	parser_init();
+	memset(&gAddress,0,sizeof(gAddress));
+
+	testMap();
+
+	printf("%u dialogs, %u writers, %u seconds:\n",gNumDialogs,numWriters,seconds);
+	load(false,false,seconds,numWriters);
+	load(true,false,seconds,numWriters);
+	load(true,true,seconds,numWriters);
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
+
+// vim: ts=4 sw=4
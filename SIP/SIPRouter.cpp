@@ -0,0 +1,208 @@
+/**@file Routing of inbound SIP messages to worker threads by Call-ID. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include "SIPMessageMap.h"
+#include "SIPRouter.h"
+
+#include <Logger.h>
+
+using namespace std;
+using namespace SIP;
+
+
+/** The end of the line starting here: its CR or LF, or the end of the text. */
+static const char *lineEnd(const char *line, const char *end)
+{
+	while (line<end && *line!='\r' && *line!='\n') line++;
+	return line;
+}
+
+/** The start of the next line after a line end. */
+static const char *nextLine(const char *eol, const char *end)
+{
+	if (eol<end && *eol=='\r') eol++;
+	if (eol<end && *eol=='\n') eol++;
+	return eol;
+}
+
+static bool nameIs(const char *name, unsigned length, const char *full, const char *compact)
+{
+	if (length==strlen(full) && strncasecmp(name,full,length)==0) return true;
+	return compact && length==strlen(compact) && strncasecmp(name,compact,length)==0;
+}
+
+
+bool SIPHeaderScan::scan(const char *text, unsigned length)
+{
+	mRequest = false;
+	mMethod.clear();
+	mStatus = 0;
+	mCallID.clear();
+	mCSeq = 0;
+	mEcho.clear();
+
+	const char *end = text+length;
+	const char *eol = lineEnd(text,end);
+	if (eol==text) return false;
+
+	// The start line: "SIP/2.0 200 OK" or "INVITE sip:... SIP/2.0".
+	if (eol-text>8 && strncmp(text,"SIP/2.0 ",8)==0) {
+		mStatus = strtoul(text+8,NULL,10);
+		if (mStatus<100) return false;
+	} else {
+		const char *space = (const char*)memchr(text,' ',eol-text);
+		if (!space || space==text) return false;
+		mRequest = true;
+		mMethod.assign(text,space-text);
+	}
+	bool echo = mRequest && mMethod=="OPTIONS";
+
+	// The headers, up to the blank line before the body.
+	for (const char *line = nextLine(eol,end); line<end; line = nextLine(eol,end)) {
+		eol = lineEnd(line,end);
+		if (eol==line) break;
+		const char *colon = (const char*)memchr(line,':',eol-line);
+		if (!colon) continue;
+		const char *nameEnd = colon;
+		while (nameEnd>line && (nameEnd[-1]==' ' || nameEnd[-1]=='\t')) nameEnd--;
+		unsigned nameLength = nameEnd-line;
+		const char *value = colon+1;
+		while (value<eol && (*value==' ' || *value=='\t')) value++;
+		const char *valueEnd = eol;
+		while (valueEnd>value && (valueEnd[-1]==' ' || valueEnd[-1]=='\t')) valueEnd--;
+
+		bool keep = false;
+		if (nameIs(line,nameLength,"Call-ID","i")) {
+			// Only the part before the '@', like osip_call_id_get_number.
+			const char *at = (const char*)memchr(value,'@',valueEnd-value);
+			mCallID.assign(value,(at?at:valueEnd)-value);
+			keep = true;
+		} else if (nameIs(line,nameLength,"CSeq",NULL)) {
+			char *methodStart;
+			mCSeq = strtoul(value,&methodStart,10);
+			while (methodStart<valueEnd && *methodStart==' ') methodStart++;
+			if (!mRequest) mMethod.assign(methodStart,valueEnd-methodStart);
+			keep = true;
+		} else if (echo) {
+			keep = nameIs(line,nameLength,"Via","v") || nameIs(line,nameLength,"From","f")
+				|| nameIs(line,nameLength,"To","t");
+		}
+		if (echo && keep) {
+			mEcho.append(line,eol-line);
+			mEcho.append("\r\n");
+		}
+	}
+	return !mCallID.empty();
+}
+
+
+bool SIPHeaderScan::keepalive(const char *text, unsigned length)
+{
+	for (unsigned i=0; i<length; i++) {
+		if (text[i]!='\r' && text[i]!='\n') return false;
+	}
+	return true;
+}
+
+
+
+namespace SIP {
+
+/** A worker thread and its queue. */
+struct SIPRouter::Shard {
+	SIPRouter *mRouter;
+	InterthreadQueue<SIPDatagram> mQueue;
+	Thread mThread;
+	volatile unsigned mRouted;			///< only written by the receive thread
+	volatile unsigned mDispatched;		///< only written by the worker
+
+	Shard(SIPRouter *wRouter) :mRouter(wRouter),mRouted(0),mDispatched(0) {}
+};
+
+}	// SIP
+
+
+void SIPRouter::start(SIPDispatcher *dispatcher, unsigned numShards)
+{
+	assert(dispatcher);
+	if (mShards.size()) return;
+	if (numShards==0) numShards = 1;
+	mDispatcher = dispatcher;
+	mStopping = false;
+	for (unsigned i=0; i<numShards; i++) {
+		Shard *shard = new Shard(this);
+		mShards.push_back(shard);
+		shard->mThread.start(workerLoop,shard);
+	}
+}
+
+
+void SIPRouter::stop()
+{
+	mStopping = true;
+	for (unsigned i=0; i<mShards.size(); i++) mShards[i]->mThread.join();
+	for (unsigned i=0; i<mShards.size(); i++) delete mShards[i];
+	mShards.clear();
+}
+
+
+unsigned SIPRouter::shard(const string& callID) const
+{
+	return callIDHash(callID) % mShards.size();
+}
+
+
+void SIPRouter::route(SIPDatagram *datagram)
+{
+	assert(mShards.size());
+	Shard *shard = mShards[this->shard(datagram->mHeaders.mCallID)];
+	shard->mRouted++;
+	shard->mQueue.write(datagram);
+}
+
+
+void *SIPRouter::workerLoop(void *arg)
+{
+	Shard *shard = static_cast<Shard*>(arg);
+	SIPRouter *router = shard->mRouter;
+	while (!router->mStopping) {
+		// The timeout is only to notice a stop.
+		SIPDatagram *datagram = shard->mQueue.read(100);
+		if (!datagram) continue;
+		router->mDispatcher->dispatch(datagram);
+		delete datagram;
+		shard->mDispatched++;
+	}
+	return NULL;
+}
+
+
+void SIPRouter::stats(ostream& os) const
+{
+	os << mShards.size() << " workers";
+	for (unsigned i=0; i<mShards.size(); i++) {
+		const Shard *shard = mShards[i];
+		os << ", " << i << ": " << shard->mRouted << " routed " << shard->mDispatched << " dispatched "
+			<< shard->mQueue.size() << " waiting";
+	}
+}
+
+
+// vim: ts=4 sw=4
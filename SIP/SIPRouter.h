@@ -0,0 +1,135 @@
+/**@file Routing of inbound SIP messages to worker threads by Call-ID. */
+
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef SIPROUTER_H
+#define SIPROUTER_H
+
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <Threads.h>
+#include <Interthread.h>
+
+
+namespace SIP {
+
+
+/**
+	The few header fields needed to route a SIP message, found by a scan of the raw text,
+	which is much cheaper than the osip parser.
+	Nothing is validated beyond what routing needs; the full parse comes later.
+*/
+class SIPHeaderScan {
+
+	public:
+
+	bool mRequest;				///< a request, else a response
+	std::string mMethod;		///< the request method, or for a response the CSeq method
+	unsigned mStatus;			///< the response status code
+	std::string mCallID;		///< the Call-ID number, without the @host, as the SIP FIFOs are keyed
+	unsigned mCSeq;
+	/** The Via, From, To, Call-ID and CSeq lines of an OPTIONS request, to answer it. */
+	std::string mEcho;
+
+	SIPHeaderScan() :mRequest(false),mStatus(0),mCSeq(0) {}
+
+	/**
+		Scan the start line and the headers.
+		@return true if it looks like SIP and has a Call-ID.
+	*/
+	bool scan(const char *text, unsigned length);
+
+	/** True for a CRLF keepalive (RFC-5626), a datagram of nothing but line ends. */
+	static bool keepalive(const char *text, unsigned length);
+};
+
+
+/** A received SIP message, as text, on its way to a worker. */
+class SIPDatagram {
+
+	public:
+
+	std::string mText;
+	struct sockaddr_in mSource;
+	SIPHeaderScan mHeaders;
+
+	SIPDatagram(const char *text, unsigned length, const struct sockaddr_in *source)
+		:mText(text,length)
+	{
+		mSource = *source;
+	}
+};
+
+
+/** Whatever handles the messages in the worker threads. */
+class SIPDispatcher {
+
+	public:
+
+	virtual ~SIPDispatcher() {}
+
+	/** Parse and deliver a message.  Called from a worker thread, which keeps the datagram. */
+	virtual void dispatch(SIPDatagram *datagram) = 0;
+};
+
+
+/**
+	Hands scanned messages to a set of worker threads, each with its own queue.
+	A Call-ID always goes to the same worker, so the messages of a dialog are
+	handled in order while different dialogs are parsed in parallel.
+*/
+class SIPRouter {
+
+	private:
+
+	struct Shard;
+
+	SIPDispatcher *mDispatcher;
+	std::vector<Shard*> mShards;
+	volatile bool mStopping;
+
+	static void *workerLoop(void *arg);
+
+	public:
+
+	SIPRouter() :mDispatcher(NULL),mStopping(false) {}
+
+	~SIPRouter() { stop(); }
+
+	/** Start the workers. */
+	void start(SIPDispatcher *dispatcher, unsigned numShards);
+
+	/** Stop the workers and drop anything still queued. */
+	void stop();
+
+	/** Queue a scanned message for its worker.  The router takes the datagram. */
+	void route(SIPDatagram *datagram);
+
+	/** The worker for a Call-ID. */
+	unsigned shard(const std::string& callID) const;
+
+	unsigned size() const { return mShards.size(); }
+
+	/** Messages routed, dispatched and waiting, by worker. */
+	void stats(std::ostream&) const;
+};
+
+
+}	// SIP
+
+#endif
+// vim: ts=4 sw=4
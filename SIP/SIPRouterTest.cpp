@@ -0,0 +1,379 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the SIPHeaderScan and the SIPRouter, then measure SIP receive throughput over local UDP.
+// A generator thread sends bursts of OPTIONS pings and REGISTER challenges mixed with in-call
+// messages for a set of calls, plus some strays for calls that are gone, as fast as it can.
+// The old way: one thread reads, parses every message with osip, scans for the nonce and cnonce
+// and delivers it.  The new way: the reading thread only scans the headers, answers the pings
+// and routes the rest to the workers, which parse and deliver.
+// Reports the messages handled per second and the delay of the in-call messages, which is what
+// a burst of registrations holds up.
+// Build with SIPRouter.cpp, SIPMessageMap.cpp, CommonLibs and -losipparser2.
+// Usage: SIPRouterTest [messages] [workers]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <map>
+#include <sstream>
+#include <osipparser2/osip_parser.h>
+#include <Configuration.h>
+#include <Sockets.h>
+#include <Utils.h>
+#include <UnitTest.h>
+#include "SIPRouter.h"
+
+using namespace std;
+using namespace SIP;
+
+ConfigurationTable gConfig;
+
+
+static void testScan()
+{
+	SIPHeaderScan scan;
+	const char *invite =
+		"INVITE sip:IMSI001010000000001@127.0.0.1:5062 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bK1\r\n"
+		"From: <sip:2101@127.0.0.1>;tag=1\r\n"
+		"To: <sip:IMSI001010000000001@127.0.0.1>\r\n"
+		"i:  abc@127.0.0.1 \r\n"
+		"cseq: 102 INVITE\r\n"
+		"Content-Length: 11\r\n"
+		"\r\n"
+		"Call-ID: no\r\n";
+	CHECK(scan.scan(invite,strlen(invite)));
+	CHECK(scan.mRequest && scan.mMethod=="INVITE");
+	// Compact form, any case, trimmed, and nothing taken from the body.
+	CHECK(scan.mCallID=="abc");
+	CHECK(scan.mCSeq==102);
+	CHECK(scan.mEcho.empty());
+
+	const char *response =
+		"SIP/2.0 401 Unauthorized\n"
+		"Call-ID: reg1\n"
+		"CSeq: 7 REGISTER\n"
+		"\n";
+	CHECK(scan.scan(response,strlen(response)));
+	CHECK(!scan.mRequest && scan.mStatus==401 && scan.mMethod=="REGISTER" && scan.mCSeq==7);
+
+	const char *options =
+		"OPTIONS sip:127.0.0.1:5062 SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bK2\r\n"
+		"Max-Forwards: 70\r\n"
+		"From: <sip:ping@127.0.0.1>;tag=2\r\n"
+		"To: <sip:127.0.0.1:5062>\r\n"
+		"Call-ID: ping1\r\n"
+		"CSeq: 1 OPTIONS\r\n"
+		"\r\n";
+	CHECK(scan.scan(options,strlen(options)));
+	CHECK(scan.mEcho==
+		"Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bK2\r\n"
+		"From: <sip:ping@127.0.0.1>;tag=2\r\n"
+		"To: <sip:127.0.0.1:5062>\r\n"
+		"Call-ID: ping1\r\n"
+		"CSeq: 1 OPTIONS\r\n");
+
+	const char *noCallID = "BYE sip:x SIP/2.0\r\nCSeq: 1 BYE\r\n\r\n";
+	CHECK(!scan.scan(noCallID,strlen(noCallID)));
+	CHECK(!scan.scan("",0));
+	CHECK(SIPHeaderScan::keepalive("\r\n\r\n",4));
+	CHECK(!SIPHeaderScan::keepalive(options,strlen(options)));
+}
+
+
+// Counts what the workers get, and checks it stays in order per call.
+class CountingDispatcher : public SIPDispatcher {
+
+	public:
+
+	Mutex mLock;
+	unsigned mCount;
+	map<string,unsigned> mLast;
+	bool mOrdered;
+
+	CountingDispatcher() :mCount(0),mOrdered(true) {}
+
+	void dispatch(SIPDatagram *datagram)
+	{
+		ScopedLock lock(mLock);
+		mCount++;
+		unsigned &last = mLast[datagram->mHeaders.mCallID];
+		if (datagram->mHeaders.mCSeq<=last) mOrdered = false;
+		last = datagram->mHeaders.mCSeq;
+	}
+};
+
+
+static void testRouter()
+{
+	SIPRouter router;
+	CountingDispatcher dispatcher;
+	router.start(&dispatcher,4);
+	CHECK(router.size()==4);
+	CHECK(router.shard("a@b")==router.shard("a@b"));
+	unsigned used[4] = {0,0,0,0};
+	struct sockaddr_in source;
+	memset(&source,0,sizeof(source));
+	for (unsigned n=1; n<=50; n++) {
+		for (unsigned c=0; c<20; c++) {
+			char text[200];
+			int length = sprintf(text,"INFO sip:x SIP/2.0\r\nCall-ID: call%u\r\nCSeq: %u INFO\r\n\r\n",c,n);
+			SIPDatagram *datagram = new SIPDatagram(text,length,&source);
+			CHECK(datagram->mHeaders.scan(text,length));
+			if (n==1) used[router.shard(datagram->mHeaders.mCallID)]++;
+			router.route(datagram);
+		}
+	}
+	for (unsigned i=0; i<50 && dispatcher.mCount<1000; i++) msleep(10);
+	CHECK(dispatcher.mCount==1000);
+	CHECK(dispatcher.mOrdered);
+	// 20 calls should reach every one of 4 workers.
+	for (unsigned i=0; i<4; i++) CHECK(used[i]>0);
+	router.stop();
+}
+
+
+
+// The load.
+
+static const unsigned NumCalls = 100;
+static unsigned gNumMessages;
+
+static char gNonce[] = "0123456789abcdef0123456789abcdef";
+
+/** Message n of the load, as text.  The in-call messages carry their send time. */
+static int makeMessage(char *text, unsigned n)
+{
+	char sent[40];
+	sprintf(sent,"%.6f",timef());
+	switch (n%8) {
+		case 0: case 1: case 2: case 3:
+			return sprintf(text,
+				"OPTIONS sip:127.0.0.1:5062 SIP/2.0\r\n"
+				"Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bKp%u\r\n"
+				"Max-Forwards: 70\r\n"
+				"From: <sip:ping@127.0.0.1>;tag=p%u\r\n"
+				"To: <sip:127.0.0.1:5062>\r\n"
+				"Call-ID: ping%u@127.0.0.1\r\n"
+				"CSeq: %u OPTIONS\r\n"
+				"Content-Length: 0\r\n\r\n",n,n,n,n);
+		case 4: case 5:
+			return sprintf(text,
+				"SIP/2.0 401 Unauthorized\r\n"
+				"Via: SIP/2.0/UDP 127.0.0.1:5062;branch=z9hG4bKr%u\r\n"
+				"From: <sip:IMSI0010100000%05u@127.0.0.1>;tag=r%u\r\n"
+				"To: <sip:IMSI0010100000%05u@127.0.0.1>;tag=s%u\r\n"
+				"Call-ID: reg%u@127.0.0.1\r\n"
+				"CSeq: 1 REGISTER\r\n"
+				"WWW-Authenticate: Digest realm=\"OpenBTS\", nonce=\"%s\"\r\n"
+				"Content-Length: 0\r\n\r\n",n,n%NumCalls,n,n%NumCalls,n,n%NumCalls,gNonce);
+		case 6:
+			return sprintf(text,
+				"INFO sip:IMSI0010100000%05u@127.0.0.1:5062 SIP/2.0\r\n"
+				"Via: SIP/2.0/UDP 127.0.0.1:5060;branch=z9hG4bKc%u\r\n"
+				"From: <sip:2101@127.0.0.1>;tag=c%u\r\n"
+				"To: <sip:IMSI0010100000%05u@127.0.0.1>;tag=d%u\r\n"
+				"Call-ID: call%u@127.0.0.1\r\n"
+				"CSeq: %u INFO\r\n"
+				"X-Sent: %s\r\n"
+				"Content-Length: 0\r\n\r\n",n%NumCalls,n,n%NumCalls,n%NumCalls,n%NumCalls,n%NumCalls,n,sent);
+		default:
+			// For a call that has ended.
+			return sprintf(text,
+				"SIP/2.0 200 OK\r\n"
+				"Via: SIP/2.0/UDP 127.0.0.1:5062;branch=z9hG4bKg%u\r\n"
+				"From: <sip:2101@127.0.0.1>;tag=g%u\r\n"
+				"To: <sip:IMSI001010000000001@127.0.0.1>;tag=h%u\r\n"
+				"Call-ID: gone%u@127.0.0.1\r\n"
+				"CSeq: 2 BYE\r\n"
+				"Content-Length: 0\r\n\r\n",n,n,n,n);
+	}
+}
+
+
+static unsigned short gPort;
+static volatile bool gStopping;
+
+static void *generatorLoop(void *)
+{
+	UDPSocket socket(0,"127.0.0.1",gPort);
+	char text[2000];
+	for (unsigned n=0; n<gNumMessages && !gStopping; n++) {
+		socket.write(text,makeMessage(text,n));
+		// Let the receiver keep up now and then, so the socket buffer doesn't overflow.
+		if (n%64==63) usleep(200);
+	}
+	return NULL;
+}
+
+
+/** The delivery end of both ways: the call FIFOs, and the delay of the in-call messages. */
+class Sink : public SIPDispatcher {
+
+	public:
+
+	Mutex mLock;
+	set<string> mCalls;			///< the calls with FIFOs
+	unsigned mHandled;			///< delivered, answered or dropped
+	unsigned mDelivered;
+	unsigned mInCall;
+	unsigned mNonces;
+	double mDelay;
+	double mMaxDelay;
+	bool mFullScan;				///< the old way: scan every message for authentication
+
+	Sink(bool wFullScan) :mHandled(0),mDelivered(0),mInCall(0),mNonces(0),mDelay(0),mMaxDelay(0),mFullScan(wFullScan)
+	{
+		for (unsigned n=0; n<NumCalls; n++) {
+			char callID[40];
+			sprintf(callID,"call%u",n);
+			mCalls.insert(callID);
+			sprintf(callID,"reg%u",n);
+			mCalls.insert(callID);
+		}
+	}
+
+	bool hasCall(const string& callID)
+	{
+		ScopedLock lock(mLock);
+		return mCalls.count(callID)>0;
+	}
+
+	void handled()
+	{
+		ScopedLock lock(mLock);
+		mHandled++;
+	}
+
+	/** Parse and deliver, as SIPInterface::dispatch does. */
+	void deliver(const char *text, unsigned length, bool scanAuthentication)
+	{
+		osip_message_t *msg;
+		osip_message_init(&msg);
+		osip_message_parse(msg,text,length);
+		unsigned nonces = 0;
+		if (scanAuthentication) {
+			if (strcasestr(text,"nonce")) nonces++;
+			if (strcasestr(text,"cnonce")) nonces++;
+		}
+		const char *callID = msg->call_id ? osip_call_id_get_number(msg->call_id) : NULL;
+		bool known = callID && hasCall(callID);
+		const char *sent = strstr(text,"X-Sent: ");
+		double delay = sent ? timef() - atof(sent+8) : 0;
+		osip_message_free(msg);
+		ScopedLock lock(mLock);
+		mHandled++;
+		mNonces += nonces;
+		if (!known) return;
+		mDelivered++;
+		if (sent) {
+			mInCall++;
+			mDelay += delay;
+			if (delay>mMaxDelay) mMaxDelay = delay;
+		}
+	}
+
+	void dispatch(SIPDatagram *datagram)
+	{
+		const SIPHeaderScan &headers = datagram->mHeaders;
+		bool initiating = headers.mRequest && (headers.mMethod=="INVITE" || headers.mMethod=="MESSAGE");
+		if (!initiating && !hasCall(headers.mCallID)) {
+			handled();
+			return;
+		}
+		deliver(datagram->mText.c_str(),datagram->mText.size(),!headers.mRequest && headers.mMethod=="REGISTER");
+	}
+};
+
+
+/** Run the load one way.  Return the messages received. */
+static unsigned load(bool useRouter, unsigned numWorkers)
+{
+	UDPSocket socket;
+	gPort = socket.port();
+	gStopping = false;
+	Sink sink(!useRouter);
+	SIPRouter router;
+	if (useRouter) router.start(&sink,numWorkers);
+
+	Thread generator;
+	generator.start(generatorLoop,NULL);
+	double start = timef();
+	double last = start;
+	char buffer[MAX_UDP_LENGTH+1];
+	unsigned received = 0;
+	// Stop once nothing has come for a while.
+	while (timef()-last < 0.5) {
+		int numRead = socket.read(buffer,100);
+		if (numRead<0) continue;
+		last = timef();
+		received++;
+		buffer[numRead] = '\0';
+		if (!useRouter) {
+			sink.deliver(buffer,numRead,true);
+			continue;
+		}
+		if (SIPHeaderScan::keepalive(buffer,numRead)) { sink.handled(); continue; }
+		SIPDatagram *datagram = new SIPDatagram(buffer,numRead,socket.source());
+		if (!datagram->mHeaders.scan(buffer,numRead)) { sink.handled(); delete datagram; continue; }
+		if (datagram->mHeaders.mRequest && datagram->mHeaders.mMethod=="OPTIONS") {
+			string reply = "SIP/2.0 200 OK\r\n" + datagram->mHeaders.mEcho + "Content-Length: 0\r\n\r\n";
+			socket.send((const struct sockaddr*)&datagram->mSource,reply.c_str());
+			sink.handled();
+			delete datagram;
+			continue;
+		}
+		router.route(datagram);
+	}
+	gStopping = true;
+	generator.join();
+	while (sink.mHandled<received) msleep(10);
+	double elapsed = last - start;
+
+	printf(" %-6s: %u received of %u, %.0f messages/sec, %u delivered, in-call delay mean %.2f ms max %.2f ms\n",
+		useRouter ? "router" : "old", received, gNumMessages, received/elapsed, sink.mDelivered,
+		sink.mInCall ? 1000*sink.mDelay/sink.mInCall : 0.0, 1000*sink.mMaxDelay);
+	if (useRouter) {
+		ostringstream os;
+		router.stats(os);
+		printf("         %s\n",os.str().c_str());
+	}
+	return received;
+}
+
+
+int main(int argc, char **argv)
+{
+	gNumMessages = argc>1 ? atoi(argv[1]) : 100000;
+	unsigned numWorkers = argc>2 ? atoi(argv[2]) : 2;
+	parser_init();
+
+	testScan();
+	testRouter();
+
+	printf("%u messages, %u workers:\n",gNumMessages,numWorkers);
+	unsigned oldReceived = load(false,numWorkers);
+	unsigned routerReceived = load(true,numWorkers);
+	// The old path parses on the receive thread and falls behind the sender.  The router must keep up,
+	// or where the workers share one CPU with the reader, at least lose fewer than the old path.
+	CHECK(routerReceived>0.9*gNumMessages || routerReceived>oldReceived);
+
+	printf("%s\n",failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
+
+// vim: ts=4 sw=4
@@ -44,6 +44,9 @@ enum RTPCodec {
 	RTPGSM610=3
 };
 
+/** Bytes in one 20 ms RTPGSM610 frame, RFC-3551 4.5.8. */
+const unsigned RTPGSM610FrameBytes = 33;
+
 
 /** Get owner IP address; return NULL if none found. */
 bool get_owner_ip( osip_message_t * msg, char * o_addr );
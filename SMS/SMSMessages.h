@@ -28,6 +28,7 @@
 #include <GSML3Message.h>
 #include <GSML3CCElements.h>
 #include <GSML3MMElements.h>
+#include <GSML3Decoder.h>
 
 
 namespace SMS {
@@ -723,6 +724,14 @@ class CPUserData : public GSM::L3ProtocolElement {
 		RPM.write(mRPDU);
 	}
 
+	/** From packed octets, as the fast decoder finds them. */
+	CPUserData(const unsigned char *octets, size_t length)
+		:L3ProtocolElement(),
+		mRPDU(UNDEFINED_PRIMITIVE,length*8)
+	{
+		mRPDU.unpack(octets);
+	}
+
 	const RLFrame& RPDU() const { return mRPDU; }
 
 	size_t lengthV() const { return mRPDU.size()/8; }
@@ -879,6 +888,12 @@ class CPData : public CPMessage
 		mData(RPM)
  	{ }
 
+	/** From the fast decoder. */
+	explicit CPData(const GSM::L3DecodedMessage& decoded)
+		:CPMessage(decoded.TI()),
+		mData(decoded.RPDU(),decoded.mRPDULength)
+	{ }
+
 	const CPUserData& data() const { return mData; }
 	const RLFrame& RPDU() const { return mData.RPDU(); }
 
@@ -36,6 +36,112 @@ namespace ASN {
 
 namespace UMTS {
 
+// The arena in use by the current thread, set by AsnArenaScope.
+static __thread AsnArena *sCurrentArena = NULL;
+// Each thread that builds messages keeps its own arena forever, so it stays warmed up.
+static __thread AsnArena *sThreadArena = NULL;
+
+AsnArena *AsnArena::current() { return sCurrentArena; }
+
+AsnArena::Chunk *AsnArena::newChunk(size_t minsize)
+{
+	size_t size = std::max(std::max(minsize,mHighWater),(size_t)4096);
+	Chunk *chunk = (Chunk*) malloc(sizeof(Chunk) + size);
+	assert(chunk);
+	chunk->mSize = size;
+	chunk->mUsed = 0;
+	chunk->mNext = mChunks;
+	mChunks = chunk;
+	mNumMallocs++;
+	return chunk;
+}
+
+void *AsnArena::alloc(size_t size)
+{
+	size = (size + 7) & ~(size_t)7;	// Keep everything 8 byte aligned.
+	Chunk *chunk = mChunks;
+	if (chunk == NULL || chunk->mUsed + size > chunk->mSize) {
+		chunk = newChunk(size);
+	}
+	char *result = (char*)chunk->mData + chunk->mUsed;
+	chunk->mUsed += size;
+	mTotalUsed += size;
+	memset(result,0,size);
+	return result;
+}
+
+// There is no free, so the old memory is simply abandoned until reset.
+void *AsnArena::realloc(void *ptr, size_t oldsize, size_t newsize)
+{
+	void *result = alloc(newsize);
+	if (ptr && oldsize) { memcpy(result,ptr,std::min(oldsize,newsize)); }
+	return result;
+}
+
+void AsnArena::reset()
+{
+	if (mTotalUsed > mHighWater) { mHighWater = mTotalUsed; }
+	mTotalUsed = 0;
+	if (mChunks && mChunks->mNext == NULL && mChunks->mSize >= mHighWater) {
+		mChunks->mUsed = 0;	// The usual case: keep the one chunk.
+		return;
+	}
+	// The message outgrew the chunk.  Free them all; the next alloc gets one chunk of mHighWater.
+	while (mChunks) {
+		Chunk *next = mChunks->mNext;
+		free(mChunks);
+		mChunks = next;
+	}
+}
+
+AsnArena::~AsnArena()
+{
+	while (mChunks) {
+		Chunk *next = mChunks->mNext;
+		free(mChunks);
+		mChunks = next;
+	}
+}
+
+AsnArenaScope::AsnArenaScope() : mPrevious(sCurrentArena)
+{
+	if (mPrevious) { return; }	// Nested; the outer scope owns the arena.
+	if (sThreadArena == NULL) { sThreadArena = new AsnArena; }
+	sCurrentArena = sThreadArena;
+}
+
+AsnArenaScope::~AsnArenaScope()
+{
+	if (mPrevious) { return; }
+	sCurrentArena->reset();
+	sCurrentArena = NULL;
+}
+
+// Same as calloc(1,size) but uses the current AsnArena if there is one.
+void *rnAsnCalloc(size_t size)
+{
+	if (sCurrentArena) { return sCurrentArena->alloc(size); }
+	void *result = calloc(1,size);
+	assert(result);
+	return result;
+}
+
+// Same as ASN_SEQUENCE_ADD but grows the list in the current AsnArena if there is one.
+// The argument must be an A_SEQUENCE_OF(something).
+typedef A_SEQUENCE_OF(void) asn_sequence_of_void;
+int rnAsnSequenceAdd(void *listp, void *ptr)
+{
+	if (sCurrentArena == NULL) { return ASN::asn_sequence_add(listp,ptr); }
+	asn_sequence_of_void *list = (asn_sequence_of_void*)listp;
+	if (list->count >= list->size) {
+		int newsize = list->size ? 2*list->size : 4;
+		list->array = (void**) sCurrentArena->realloc(list->array,list->size*sizeof(void*),newsize*sizeof(void*));
+		list->size = newsize;
+	}
+	list->array[list->count++] = ptr;
+	return 0;
+}
+
 // Return true on success, false on failure.
 // Make the ByteVector large enough to hold the expected encoded message,
 // and the ByteVector size will be shrink wrapped around the result before return.
@@ -96,7 +202,7 @@ void setAsnBIT_STRING(ASN::BIT_STRING_t *result,uint8_t *buf, unsigned numBits)
 ASN::BIT_STRING_t allocAsnBIT_STRING(unsigned numBits)
 {
 	ASN::BIT_STRING_t result;
-	setAsnBIT_STRING(&result,(uint8_t*)calloc(1,(7+numBits)/8),numBits);
+	setAsnBIT_STRING(&result,(uint8_t*)rnAsnCalloc((7+numBits)/8),numBits);
 	return result;
 }
 
@@ -105,10 +211,9 @@ void setASN1SeqOfDigits(void *seq, const char* digit)
 {
 	ASN::asn_sequence_empty(seq);
 	while (*digit != '\0') {
-		ASN::Digit_t* d = (ASN::Digit_t*)calloc(1,sizeof(ASN::Digit_t));
-		assert(d);
+		ASN::Digit_t* d = RN_CALLOC(ASN::Digit_t);
 		*d = *digit++ - '0';
-		int ret = ASN::ASN_SEQUENCE_ADD(seq,d);
+		int ret = RN_SEQUENCE_ADD(seq,d);
 		assert(ret==0);
 	}
 }
@@ -122,6 +227,13 @@ ASN::ENUMERATED_t toAsnEnumerated(unsigned value)
 {
 	ASN::ENUMERATED_t result;
 	memset(&result,0,sizeof(result));
+	if (sCurrentArena && value < 128) {
+		// Same one byte encoding that asn_long2INTEGER produces, but in the arena.
+		result.buf = (uint8_t*) sCurrentArena->alloc(1);
+		result.buf[0] = value;
+		result.size = 1;
+		return result;
+	}
 	asn_long2INTEGER(&result,value);
 	return result;
 }
@@ -16,9 +16,13 @@
 #define ASNHELPER_H
 #include "ByteVector.h"
 
+namespace UMTS { extern void *rnAsnCalloc(size_t size); };
+// All the asn structures we build go through here so they can land in the current AsnArena, if any.
 #ifndef RN_CALLOC
-#define RN_CALLOC(type) ((type*)calloc(1,sizeof(type)))
+#define RN_CALLOC(type) ((type*)UMTS::rnAsnCalloc(sizeof(type)))
 #endif
+// Use instead of ASN_SEQUENCE_ADD for lists in messages we build, for the same reason.
+#define RN_SEQUENCE_ADD(listp,ptr) UMTS::rnAsnSequenceAdd((void*)(listp),(void*)(ptr))
 
 #include "asn_system.h"	// Dont let other includes land in namespace ASN.
 #include <ctype.h>
@@ -32,6 +36,52 @@ namespace ASN {
 };
 
 namespace UMTS {
+
+// The downlink RRC messages are built from dozens of little calloced asn structures,
+// encoded once, and then thrown away.  An AsnArena holds all of them in one block
+// so the whole message is released in one go.  The arena remembers how big it had to get,
+// so once warmed up a message costs no allocations at all.
+// Only memory obtained via rnAsnCalloc (RN_CALLOC), rnAsnSequenceAdd (RN_SEQUENCE_ADD), allocAsnBIT_STRING
+// and toAsnEnumerated lands in the arena; memory allocated inside the asn1c library itself
+// (eg, asn_long2INTEGER) is still malloced.
+// WARNING: Nothing allocated while an arena is active may outlive the AsnArenaScope,
+// and you must not ASN_STRUCT_FREE a message built in an arena.
+class AsnArena {
+	struct Chunk {
+		Chunk *mNext;
+		size_t mSize, mUsed;
+		uint64_t mData[1];		// Force alignment of the data area.
+	};
+	Chunk *mChunks;			// Current chunk is first.
+	size_t mHighWater;		// Most memory used by any message so far.
+	size_t mTotalUsed;		// Memory used by the current message.
+	unsigned mNumMallocs;	// Statistics.
+	Chunk *newChunk(size_t minsize);
+	public:
+	AsnArena() : mChunks(0), mHighWater(0), mTotalUsed(0), mNumMallocs(0) {}
+	~AsnArena();
+	void *alloc(size_t size);	// Returns zeroed memory, like calloc.
+	void *realloc(void *ptr, size_t oldsize, size_t newsize);
+	// Release everything.  If the message needed more than one chunk,
+	// they are coalesced into a single chunk big enough for next time.
+	void reset();
+	size_t highWater() const { return mHighWater; }
+	unsigned numMallocs() const { return mNumMallocs; }
+
+	static AsnArena *current();		// The arena of the current scope for this thread, or NULL.
+};
+
+// Declare one of these at the top of any function that builds an asn message.
+// Scopes nest; only the outermost one resets the arena.
+class AsnArenaScope {
+	AsnArena *mPrevious;
+	public:
+	AsnArenaScope();
+	~AsnArenaScope();
+};
+
+extern void *rnAsnCalloc(size_t size);
+extern int rnAsnSequenceAdd(void *list, void *ptr);
 extern void setAsnBIT_STRING(ASN::BIT_STRING_t *result,uint8_t *buf, unsigned numBits);
 extern ASN::BIT_STRING_t allocAsnBIT_STRING(unsigned numBits);
 extern void setASN1SeqOfDigits(void *seq, const char* digit);
@@ -69,15 +69,8 @@ typedef union {
 static u16 KLi1[8], KLi2[8];
 static u16 KOi1[8], KOi2[8], KOi3[8];
 static u16 KIi1[8], KIi2[8], KIi3[8];
-/*---------------------------------------------------------------------
- * FI()
- *      The FI function (fig 3). It includes the S7 and S9 tables.
- *      Transforms a 16-bit value.
- *---------------------------------------------------------------------*/
-static u16 FI( u16 in, u16 subkey )
-{
-    u16 nine, seven;
-    static u16 S7[] = {
+// The S-boxes were moved out of FI() so the fast version can use them too.
+static const u16 S7[] = {
         54, 50, 62, 56, 22, 34, 94, 96, 38, 6, 63, 93, 2, 18,123, 33,
         55,113, 39,114, 21, 67, 65, 12, 47, 73, 46, 27, 25,111,124, 81,
         53, 9,121, 79, 52, 60, 58, 48,101,127, 40,120,104, 70, 71, 43,
@@ -86,7 +79,7 @@ static u16 FI( u16 in, u16 subkey )
         112, 51, 17, 5, 95, 14, 90, 84, 91, 8, 35,103, 32, 97, 28, 66,
         102, 31, 26, 45, 75, 4, 85, 92, 37, 74, 80, 49, 68, 29,115, 44,
         64,107,108, 24,110, 83, 36, 78, 42, 19, 15, 41, 88,119, 59, 3};
-    static u16 S9[] = {
+static const u16 S9[] = {
         167,239,161,379,391,334, 9,338, 38,226, 48,358,452,385, 90,397,
         183,253,147,331,415,340, 51,362,306,500,262, 82,216,159,356,177,
         175,241,489, 37,206, 17, 0,333, 44,254,378, 58,143,220, 81,400,
@@ -119,6 +112,14 @@ static u16 FI( u16 in, u16 subkey )
          97, 30,310,219, 94,160,129,493, 64,179,263,102,189,207,114,402,
         438,477,387,122,192, 42,381, 5,145,118,180,449,293,323,136,380,
          43, 66, 60,455,341,445,202,432, 8,237, 15,376,436,464, 59,461};
+/*---------------------------------------------------------------------
+ * FI()
+ *      The FI function (fig 3). It includes the S7 and S9 tables.
+ *      Transforms a 16-bit value.
+ *---------------------------------------------------------------------*/
+static u16 FI( u16 in, u16 subkey )
+{
+    u16 nine, seven;
     /* The sixteen bit input is split into two unequal halves, *
      * nine bits and seven bits - as is the subkey            */
     nine = (u16)(in>>7);
@@ -363,6 +364,419 @@ uint32_t AlgorithmF9( uint8_t *key, int count, int fresh, int dir, uint8_t *data
 
 }
 
+// ==================================================================
+// Confidentiality Algorithm f8 Code from 3GPP 35.201 Annex 1.
+// ==================================================================
+
+// The key is CK with length 128 bits.
+// The data is ciphered in place; length is in bits.
+// This is directly out of the spec, only renamed.  It is the reference for fastF8.
+void AlgorithmF8( uint8_t *key, int count, int bearer, int dir, uint8_t *data, int length )
+{
+	REGISTER64 A; /* the modifier */
+	REGISTER64 temp; /* The working register */
+	int i, n;
+	u8 ModKey[16]; /* Modified key */
+	u16 blkcnt; /* The block counter */
+	/* Start by building our global modifier */
+	temp.b32[0] = temp.b32[1] = 0;
+	A.b32[0] = A.b32[1] = 0;
+	/* initialise register in an endian correct manner*/
+	A.b8[0] = (u8) (count>>24);
+	A.b8[1] = (u8) (count>>16);
+	A.b8[2] = (u8) (count>>8);
+	A.b8[3] = (u8) (count);
+	A.b8[4] = (u8) (bearer<<3);
+	A.b8[4] |= (u8) (dir<<2);
+	/* Construct the modified key and then "kasumi" A */
+	for( n=0; n<16; ++n )
+		ModKey[n] = (u8)(key[n] ^ 0x55);
+	KeySchedule( ModKey );
+	Kasumi( A.b8 ); /* First encryption to create modifier */
+	/* Final initialisation steps */
+	blkcnt = 0;
+	KeySchedule( key );
+	/* Now run the block cipher */
+	while( length > 0 )
+	{
+		/* First we calculate the next 64-bits of keystream */
+		/* XOR in A and BLKCNT to last value */
+		temp.b32[0] ^= A.b32[0];
+		temp.b32[1] ^= A.b32[1];
+		temp.b8[7] ^= (u8) blkcnt;
+		temp.b8[6] ^= (u8) (blkcnt>>8);
+		/* KASUMI it to produce the next block of keystream */
+		Kasumi( temp.b8 );
+		/* Set <n> to the number of bytes of input data *
+		 * we have to modify. (=8 if length <= 64) */
+		if( length >= 64 )
+			n = 8;
+		else
+			n = (length+7)/8;
+		/* XOR the keystream with the input data stream */
+		for( i=0; i<n; ++i )
+			*data++ ^= temp.b8[i];
+		length -= 64; /* done another 64 bits */
+		++blkcnt; /* increment BLKCNT */
+	}
+}
+
+// ==================================================================
+// Fast Kasumi, f9 and f8.
+// ==================================================================
+// FI is two identical rounds of S9/S7 with the subkey xored in between.
+// Working through the algebra, one round taking (nine,seven) to the output layout (seven<<9 | nine) is:
+//		nine' = S9[nine] ^ seven
+//		seven' = S7[seven] ^ (nine' & 0x7f) = S7[seven] ^ seven ^ (S9[nine] & 0x7f)
+// which separates into two independent lookups xored together:
+//		round(nine,seven) = sFI9[nine] ^ sFI7[seven]
+// so FI is four lookups in two levels instead of four dependent lookups, and the tables total 1.3KB,
+// which stays in L1.  (A single 64K table indexed by the whole 16 bits needs only two lookups,
+// but they go to L2 and it measured slower.)
+static u16 sFI9[512], sFI7[128];
+
+static struct FITableInit {
+	FITableInit() {
+		for (unsigned nine = 0; nine < 512; nine++) {
+			sFI9[nine] = (u16)(((S9[nine] & 0x7f) << 9) | S9[nine]);
+		}
+		for (unsigned seven = 0; seven < 128; seven++) {
+			sFI7[seven] = (u16)(((S7[seven] ^ seven) << 9) | seven);
+		}
+	}
+} sFITableInit;
+
+static inline u16 fastFI(u16 in, u16 subkey)
+{
+	u16 x = (u16)(sFI9[in >> 7] ^ sFI7[in & 0x7f] ^ subkey);
+	return (u16)(sFI9[x & 0x1ff] ^ sFI7[x >> 9]);
+}
+
+static inline uint32_t loadBE32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Same as KeySchedule() but into a KasumiKey instead of the globals.
+void KasumiKey::setKey(const uint8_t *k)
+{
+	static const u16 C[] = { 0x0123,0x4567,0x89AB,0xCDEF, 0xFEDC,0xBA98,0x7654,0x3210 };
+	u16 key[8], Kprime[8];
+	for (int n = 0; n < 8; n++) {
+		key[n] = (u16)((k[2*n] << 8) + k[2*n+1]);
+		Kprime[n] = (u16)(key[n] ^ C[n]);
+	}
+	for (int n = 0; n < 8; n++) {
+		mKL1[n] = ROL16(key[n],1);
+		mKL2[n] = Kprime[(n+2)&0x7];
+		mKO1[n] = ROL16(key[(n+1)&0x7],5);
+		mKO2[n] = ROL16(key[(n+5)&0x7],8);
+		mKO3[n] = ROL16(key[(n+6)&0x7],13);
+		mKI1[n] = Kprime[(n+4)&0x7];
+		mKI2[n] = Kprime[(n+3)&0x7];
+		mKI3[n] = Kprime[(n+7)&0x7];
+	}
+}
+
+static inline u32 fastFL(const KasumiKey &k, int n, u32 in)
+{
+	u16 l = (u16)(in >> 16), r = (u16)in;
+	u16 a = (u16)(l & k.mKL1[n]);
+	r ^= ROL16(a,1);
+	u16 b = (u16)(r | k.mKL2[n]);
+	l ^= ROL16(b,1);
+	return ((u32)l << 16) | r;
+}
+
+static inline u32 fastFO(const KasumiKey &k, int n, u32 in)
+{
+	u16 l = (u16)(in >> 16), r = (u16)in;
+	l = fastFI((u16)(l ^ k.mKO1[n]),k.mKI1[n]) ^ r;
+	r = fastFI((u16)(r ^ k.mKO2[n]),k.mKI2[n]) ^ l;
+	l = fastFI((u16)(l ^ k.mKO3[n]),k.mKI3[n]) ^ r;
+	return ((u32)r << 16) | l;
+}
+
+void KasumiKey::encrypt(uint32_t &left, uint32_t &right) const
+{
+	u32 l = left, r = right;
+	for (int n = 0; n < 8; n += 2) {
+		r ^= fastFO(*this,n,fastFL(*this,n,l));
+		l ^= fastFL(*this,n+1,fastFO(*this,n+1,r));
+	}
+	left = l; right = r;
+}
+
+// Two independent encryptions interleaved.  Kasumi is one long chain of dependent table lookups,
+// so the CPU spends most of its time waiting on load latency; interleaving two blocks fills those slots.
+static inline void kasumi2(const KasumiKey &k1, u32 &left1, u32 &right1, const KasumiKey &k2, u32 &left2, u32 &right2)
+{
+	u32 l1 = left1, r1 = right1, l2 = left2, r2 = right2;
+	for (int n = 0; n < 8; n += 2) {
+		r1 ^= fastFO(k1,n,fastFL(k1,n,l1));
+		r2 ^= fastFO(k2,n,fastFL(k2,n,l2));
+		l1 ^= fastFL(k1,n+1,fastFO(k1,n+1,r1));
+		l2 ^= fastFL(k2,n+1,fastFO(k2,n+1,r2));
+	}
+	left1 = l1; right1 = r1; left2 = l2; right2 = r2;
+}
+
+void F9Key::setIK(const uint8_t *ik)
+{
+	uint8_t modKey[16];
+	for (int n = 0; n < 16; n++) { modKey[n] = ik[n] ^ 0xAA; }
+	mKey.setKey(ik);
+	mModKey.setKey(modKey);
+}
+
+// The f9 input as a sequence of 64-bit blocks: COUNT-I || FRESH, the whole message blocks,
+// then the last one or two blocks holding the remaining message bits, the direction bit, a 1 bit and zeros.
+// See AlgorithmF9 for the padding rules.  Unlike AlgorithmF9, the unused bits in the last byte
+// of the message are ignored rather than being included in the MAC.
+struct F9Blocks {
+	const uint8_t *mData;
+	unsigned mNumWhole;
+	uint64_t mFirst, mTail[2];
+	unsigned mNumTail;
+
+	F9Blocks(uint32_t count, uint32_t fresh, unsigned dir, const uint8_t *data, unsigned length) {
+		mData = data;
+		mNumWhole = length / 64;
+		mFirst = ((uint64_t)count << 32) | fresh;
+		data += 8 * mNumWhole;
+		length %= 64;
+		uint64_t tail = 0;
+		for (unsigned n = 0; 8*n < length; n++) { tail |= (uint64_t)data[n] << (56-8*n); }
+		if (length) { tail &= ~0ULL << (64-length); }
+		if (dir) { tail |= 1ULL << (63-length); }
+		if (length == 63) {
+			// The direction bit filled the block, so the 1 bit starts a new one.
+			mTail[0] = tail;
+			mTail[1] = 1ULL << 63;
+			mNumTail = 2;
+		} else {
+			mTail[0] = tail | (1ULL << (62-length));
+			mNumTail = 1;
+		}
+	}
+	unsigned size() const { return 1 + mNumWhole + mNumTail; }
+	uint64_t block(unsigned n) const {
+		if (n == 0) { return mFirst; }
+		if (--n < mNumWhole) {
+			const uint8_t *p = mData + 8*n;
+			return ((uint64_t)loadBE32(p) << 32) | loadBE32(p+4);
+		}
+		return mTail[n - mNumWhole];
+	}
+};
+
+// The CBC chain A and the running XOR B of all the Kasumi outputs.
+struct F9Chain {
+	u32 al, ar, bl, br;
+	F9Chain() : al(0), ar(0), bl(0), br(0) {}
+	void input(uint64_t block) { al ^= (u32)(block >> 32); ar ^= (u32)block; }
+	void output() { bl ^= al; br ^= ar; }
+};
+
+uint32_t fastF9(const F9Key &key, uint32_t count, uint32_t fresh, unsigned dir, const uint8_t *data, unsigned length)
+{
+	F9Blocks blocks(count,fresh,dir,data,length);
+	F9Chain c;
+	for (unsigned n = 0, size = blocks.size(); n < size; n++) {
+		c.input(blocks.block(n));
+		key.mKey.encrypt(c.al,c.ar);
+		c.output();
+	}
+	key.mModKey.encrypt(c.bl,c.br);
+	return c.bl;	// The left-most 32 bits.
+}
+
+// Run the jobs two at a time with the Kasumi calls interleaved.
+void fastF9Batch(F9Job *jobs, unsigned numJobs)
+{
+	unsigned j = 0;
+	for (; j + 1 < numJobs; j += 2) {
+		F9Job &j1 = jobs[j], &j2 = jobs[j+1];
+		const KasumiKey &k1 = j1.mKey->mKey, &k2 = j2.mKey->mKey;
+		F9Blocks b1(j1.mCount,j1.mFresh,j1.mDir,j1.mData,j1.mLength);
+		F9Blocks b2(j2.mCount,j2.mFresh,j2.mDir,j2.mData,j2.mLength);
+		unsigned size1 = b1.size(), size2 = b2.size();
+		F9Chain c1, c2;
+		unsigned n = 0;
+		for (; n < size1 && n < size2; n++) {
+			c1.input(b1.block(n));
+			c2.input(b2.block(n));
+			kasumi2(k1,c1.al,c1.ar,k2,c2.al,c2.ar);
+			c1.output();
+			c2.output();
+		}
+		for (unsigned m = n; m < size1; m++) { c1.input(b1.block(m)); k1.encrypt(c1.al,c1.ar); c1.output(); }
+		for (unsigned m = n; m < size2; m++) { c2.input(b2.block(m)); k2.encrypt(c2.al,c2.ar); c2.output(); }
+		kasumi2(j1.mKey->mModKey,c1.bl,c1.br,j2.mKey->mModKey,c2.bl,c2.br);
+		j1.mResult = c1.bl;
+		j2.mResult = c2.bl;
+	}
+	if (j < numJobs) {
+		F9Job &job = jobs[j];
+		job.mResult = fastF9(*job.mKey,job.mCount,job.mFresh,job.mDir,job.mData,job.mLength);
+	}
+}
+
+// ------------------------------------------------------------------
+// Fast f8.
+// The keystream is KS[n] = Kasumi(A ^ n ^ KS[n-1]) where A = Kasumi'(COUNT-C || BEARER || DIR || 0...)
+// under CK xor 0x5555...  Each block depends on the previous one, so a single PDU is a serial chain
+// of Kasumi calls; the speedup comes from the key schedules being precomputed, from generating the
+// keystream ahead of time (F8KeystreamWindow) and from running two bearers interleaved (fastF8Batch).
+// ------------------------------------------------------------------
+
+void F8Key::setCK(const uint8_t *ck)
+{
+	uint8_t modKey[16];
+	for (int n = 0; n < 16; n++) { modKey[n] = ck[n] ^ 0x55; }
+	mKey.setKey(ck);
+	mModKey.setKey(modKey);
+}
+
+static inline void storeBE32(uint8_t *p, uint32_t val)
+{
+	p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+}
+
+// XOR the keystream into the data a 64-bit word at a time.  Only the first length bits of data are changed.
+static void f8Xor(uint8_t *data, const uint8_t *keystream, unsigned length)
+{
+	unsigned bytes = length / 8;
+	unsigned n = 0;
+	for (; n + 8 <= bytes; n += 8) {
+		uint64_t d, k;
+		memcpy(&d,data+n,8);	// memcpy because the data need not be aligned; the compiler makes it a load.
+		memcpy(&k,keystream+n,8);
+		d ^= k;
+		memcpy(data+n,&d,8);
+	}
+	for (; n < bytes; n++) { data[n] ^= keystream[n]; }
+	if (length % 8) { data[bytes] ^= keystream[bytes] & (0xff << (8 - length%8)); }
+}
+
+// The per-message state of the keystream generator.
+struct F8Chain {
+	u32 al, ar;		// The modifier A.
+	u32 kl, kr;		// The last keystream block.
+	u32 blkcnt;
+	F8Chain(const F8Key &key, uint32_t count, unsigned bearer, unsigned dir) : kl(0), kr(0), blkcnt(0) {
+		al = count;
+		ar = ((bearer & 0x1f) << 27) | ((dir & 1) << 26);
+		key.mModKey.encrypt(al,ar);
+	}
+	void next() { kl ^= al; kr ^= ar ^ blkcnt++; }	// Set up the input for the next keystream block.
+	void store(uint8_t *out) const { storeBE32(out,kl); storeBE32(out+4,kr); }
+};
+
+void fastF8Keystream(const F8Key &key, uint32_t count, unsigned bearer, unsigned dir, uint8_t *keystream, unsigned numBlocks)
+{
+	F8Chain c(key,count,bearer,dir);
+	for (unsigned n = 0; n < numBlocks; n++, keystream += 8) {
+		c.next();
+		key.mKey.encrypt(c.kl,c.kr);
+		c.store(keystream);
+	}
+}
+
+// Keystream is generated into a buffer on the stack this many blocks at a time.
+static const unsigned sF8ChunkBlocks = 64;
+
+void fastF8(const F8Key &key, uint32_t count, unsigned bearer, unsigned dir, uint8_t *data, unsigned length)
+{
+	uint8_t keystream[8*sF8ChunkBlocks];
+	F8Chain c(key,count,bearer,dir);
+	while (length) {
+		unsigned chunkBits = length < 64*sF8ChunkBlocks ? length : 64*sF8ChunkBlocks;
+		unsigned numBlocks = (chunkBits + 63) / 64;
+		for (unsigned n = 0; n < numBlocks; n++) {
+			c.next();
+			key.mKey.encrypt(c.kl,c.kr);
+			c.store(keystream + 8*n);
+		}
+		f8Xor(data,keystream,chunkBits);
+		data += chunkBits / 8;	// chunkBits is a multiple of 8 unless this is the end.
+		length -= chunkBits;
+	}
+}
+
+// Run the jobs two at a time with the Kasumi calls interleaved.
+void fastF8Batch(F8Job *jobs, unsigned numJobs)
+{
+	uint8_t ks1[8*sF8ChunkBlocks], ks2[8*sF8ChunkBlocks];
+	unsigned j = 0;
+	for (; j + 1 < numJobs; j += 2) {
+		F8Job &j1 = jobs[j], &j2 = jobs[j+1];
+		const KasumiKey &k1 = j1.mKey->mKey, &k2 = j2.mKey->mKey;
+		F8Chain c1(*j1.mKey,j1.mCount,j1.mBearer,j1.mDir), c2(*j2.mKey,j2.mCount,j2.mBearer,j2.mDir);
+		uint8_t *d1 = j1.mData, *d2 = j2.mData;
+		unsigned len1 = j1.mLength, len2 = j2.mLength;
+		while (len1 || len2) {
+			unsigned bits1 = len1 < 64*sF8ChunkBlocks ? len1 : 64*sF8ChunkBlocks;
+			unsigned bits2 = len2 < 64*sF8ChunkBlocks ? len2 : 64*sF8ChunkBlocks;
+			unsigned blocks1 = (bits1 + 63) / 64, blocks2 = (bits2 + 63) / 64;
+			unsigned n = 0;
+			for (; n < blocks1 && n < blocks2; n++) {
+				c1.next(); c2.next();
+				kasumi2(k1,c1.kl,c1.kr,k2,c2.kl,c2.kr);
+				c1.store(ks1 + 8*n); c2.store(ks2 + 8*n);
+			}
+			for (unsigned m = n; m < blocks1; m++) { c1.next(); k1.encrypt(c1.kl,c1.kr); c1.store(ks1 + 8*m); }
+			for (unsigned m = n; m < blocks2; m++) { c2.next(); k2.encrypt(c2.kl,c2.kr); c2.store(ks2 + 8*m); }
+			f8Xor(d1,ks1,bits1); d1 += bits1/8; len1 -= bits1;
+			f8Xor(d2,ks2,bits2); d2 += bits2/8; len2 -= bits2;
+		}
+	}
+	if (j < numJobs) {
+		F8Job &job = jobs[j];
+		fastF8(*job.mKey,job.mCount,job.mBearer,job.mDir,job.mData,job.mLength);
+	}
+}
+
+void F8KeystreamWindow::configure(const F8Key &key, unsigned bearer, unsigned dir, unsigned window, unsigned maxBits)
+{
+	mKey = key;
+	mBearer = bearer;
+	mDir = dir;
+	mBlocks = (maxBits + 63) / 64;
+	mKeystream.resize(8 * mBlocks * window);
+	mSlotCount.resize(window);
+	mSlotValid.assign(window,false);
+}
+
+// Each COUNT-C has a fixed slot, count % window, so the window slides forward without copying anything.
+void F8KeystreamWindow::prepare(uint32_t count, unsigned numCounts)
+{
+	unsigned window = mSlotCount.size();
+	if (numCounts > window) { numCounts = window; }
+	for (uint32_t cnt = count; cnt != count + numCounts; cnt++) {
+		unsigned slot = cnt % window;
+		if (mSlotValid[slot] && mSlotCount[slot] == cnt) { continue; }
+		fastF8Keystream(mKey,cnt,mBearer,mDir,&mKeystream[8*mBlocks*slot],mBlocks);
+		mSlotCount[slot] = cnt;
+		mSlotValid[slot] = true;
+	}
+}
+
+void F8KeystreamWindow::apply(uint32_t count, uint8_t *data, unsigned length)
+{
+	unsigned window = mSlotCount.size();
+	if (window && length <= 64*mBlocks) {
+		unsigned slot = count % window;
+		if (mSlotValid[slot] && mSlotCount[slot] == count) {
+			f8Xor(data,&mKeystream[8*mBlocks*slot],length);
+			mHits++;
+			return;
+		}
+	}
+	mMisses++;
+	fastF8(mKey,count,mBearer,mDir,data,length);
+}
+
 // ==================================================================
 // Remainder of file added by pat.
 // ==================================================================
@@ -385,6 +799,7 @@ void IntegrityProtect::setKc(uint64_t kc)
 	for (n = 3; n >= 0; n--) { mIK[n] = mIK[12+n] = tmp&0xff; tmp = tmp >> 8; }
 	uint64_t tmp64 = kc;
 	for (n = 7; n >= 0; n--) { mIK[4+n] = tmp64&0xff; tmp64 = tmp64 >> 8; }
+	mF9Key.setIK(mIK);
 }
 
 void IntegrityProtect::setKcs(std::string kcs)
@@ -403,6 +818,9 @@ uint32_t IntegrityProtect::runF9(unsigned rbid, bool dir, ByteVector &msg)
 	// Since both the incombing ByteVector (from uperEncode...) and the F9 algorithm both take
 	// exact bit lengths, try preserving that exact bit length instead of rounding up to 8 bits.
 	// Update: It did not work, got stuck at DL_DCCH AuthenticationAndCiphering.
-	return AlgorithmF9(mIK,mDlCounti[rbid],mFresh,(dir ? 1 : 0),msg.begin(),8*msg.size());
+	uint32_t maci = fastF9(mF9Key,mDlCounti[rbid],mFresh,(dir ? 1 : 0),msg.begin(),8*msg.size());
+	LOG(DEBUG) << "MAC: " << std::hex << maci << std::dec << LOGVAR(rbid) << LOGVAR2("count",mDlCounti[rbid]);
+	return maci;
+	//return AlgorithmF9(mIK,mDlCounti[rbid],mFresh,(dir ? 1 : 0),msg.begin(),8*msg.size());
 	//return AlgorithmF9(mIK,mDlCounti[rbid],mFresh,(dir ? 1 : 0),msg.begin(),msg.sizeBits());
 }
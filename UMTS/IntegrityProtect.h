@@ -13,17 +13,103 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+#include <vector>
 #include "ByteVector.h"
 
 // This is the algorithm as defined in the spec.
 uint32_t AlgorithmF9( uint8_t *key, int count, int fresh, int dir, uint8_t *data, int length );
 
+// The reference algorithm above recomputes the Kasumi key schedule twice per message
+// and does everything a byte at a time.  The fast version below computes the key schedules once
+// when the key is set, works on 32-bit words, and uses combined S-box tables for the Kasumi FI function.
+// It must produce bit-identical results; see KasumiTest.cpp, which checks both against the 3GPP test data.
+struct KasumiKey {
+	uint16_t mKL1[8], mKL2[8], mKO1[8], mKO2[8], mKO3[8], mKI1[8], mKI2[8], mKI3[8];
+	KasumiKey() { memset(this,0,sizeof(*this)); }
+	void setKey(const uint8_t *key);	// 128 bit key.
+	// Encrypt one 64-bit block in place, passed as two big-endian 32-bit halves.
+	void encrypt(uint32_t &left, uint32_t &right) const;
+};
+
+// The two key schedules used by f9: one for IK and one for IK xor 0xAAAA...
+struct F9Key {
+	KasumiKey mKey, mModKey;
+	void setIK(const uint8_t *ik);
+};
+
+// Same arguments as AlgorithmF9, except the key schedule is precomputed.  length is in bits.
+uint32_t fastF9(const F9Key &key, uint32_t count, uint32_t fresh, unsigned dir, const uint8_t *data, unsigned length);
+
+// Batched f9: compute the MAC-I for each job into mResult.  The jobs may use different keys.
+// Faster than calling fastF9 for each because two messages are run through Kasumi interleaved.
+struct F9Job {
+	const F9Key *mKey;
+	uint32_t mCount, mFresh;
+	unsigned mDir;
+	const uint8_t *mData;
+	unsigned mLength;	// In bits.
+	uint32_t mResult;	// Output.
+};
+void fastF9Batch(F9Job *jobs, unsigned numJobs);
+
+// This is the f8 ciphering algorithm as defined in the spec.  Ciphers data in place.
+void AlgorithmF8( uint8_t *key, int count, int bearer, int dir, uint8_t *data, int length );
+
+// The two key schedules used by f8: one for CK and one for CK xor 0x5555...
+struct F8Key {
+	KasumiKey mKey, mModKey;
+	void setCK(const uint8_t *ck);
+};
+
+// Same as AlgorithmF8, except the key schedule is precomputed, and only the first length bits of data
+// are changed, whereas AlgorithmF8 ciphers the unused bits of the last byte too.  Ciphering and
+// deciphering are the same operation.  bearer is the 5 bit radio bearer identity, dir is 1 for downlink.
+void fastF8(const F8Key &key, uint32_t count, unsigned bearer, unsigned dir, uint8_t *data, unsigned length);
+// Generate the first numBlocks 64-bit blocks of the keystream into keystream, which must hold 8*numBlocks bytes.
+void fastF8Keystream(const F8Key &key, uint32_t count, unsigned bearer, unsigned dir, uint8_t *keystream, unsigned numBlocks);
+
+// Batched f8: cipher the data of each job in place.  The jobs may use different keys and bearers.
+struct F8Job {
+	const F8Key *mKey;
+	uint32_t mCount;	// COUNT-C
+	unsigned mBearer, mDir;
+	uint8_t *mData;
+	unsigned mLength;	// In bits.
+};
+void fastF8Batch(F8Job *jobs, unsigned numJobs);
+
+// The keystream for a PDU depends only on the key, bearer, direction and COUNT-C, and RLC knows the COUNT-C
+// values it is going to use next, so it can generate the keystream ahead of time, for example, while the
+// channel is idle, and then ciphering a PDU on the critical path is just an XOR.
+// One of these per radio bearer and direction.  Not locked; belongs to the RLC entity that uses it.
+class F8KeystreamWindow {
+	F8Key mKey;
+	unsigned mBearer, mDir;
+	unsigned mBlocks;						// Keystream blocks per COUNT-C, from the maximum PDU size.
+	std::vector<uint8_t> mKeystream;		// mBlocks*8 bytes for each slot.
+	std::vector<uint32_t> mSlotCount;		// The COUNT-C whose keystream is in each slot.
+	std::vector<bool> mSlotValid;
+	public:
+	unsigned mHits, mMisses;				// Statistics: PDUs ciphered from the window or the slow way.
+
+	F8KeystreamWindow() : mBearer(0), mDir(0), mBlocks(0), mHits(0), mMisses(0) {}
+	// Set the key and parameters and empty the window.  window is the number of COUNT-C values kept;
+	// maxBits is the largest PDU that will be ciphered, normally the RLC PDU size.
+	void configure(const F8Key &key, unsigned bearer, unsigned dir, unsigned window, unsigned maxBits);
+	// Make sure the keystream for count .. count+numCounts-1 is in the window.
+	void prepare(uint32_t count, unsigned numCounts);
+	// Cipher or decipher data in place, using the window if the keystream for count is there.
+	void apply(uint32_t count, uint8_t *data, unsigned length);
+};
+
 class IntegrityProtect
 {
 	static const int sIpNumSrbs = 5;
 	// For GSM subscribers (no USIM) IK is generated from Kc, after which we could discard Kc.
 	uint64_t mKc;		// Used to generate mIK.
 	uint8_t mIK[16];	// 128 bit Integrity Key; see setKc().
+	F9Key mF9Key;		// Key schedules for mIK, computed in setKc().
 	// 8.5.10 has the list of messages that are integrity protected, but they might as well not have bothered -
 	// it is just all messages on DCCH are integrity protected, and on other channels they are not.
 	// The spec goes on and on about Integrity Protection being started or not, but it is massive overkill:
@@ -0,0 +1,392 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+// Check the fast Kasumi, f9 and f8 against the 3GPP test data and the reference implementation,
+// and measure f9 messages per second and f8 Mbit/s.
+// Usage: KasumiTest [number of benchmark messages]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+#include "IntegrityProtect.h"
+#include <Logger.h>
+#include <Configuration.h>
+#include <Utils.h>
+#include <UnitTest.h>
+
+using namespace std;
+
+ConfigurationTable gConfig;
+
+static void hex2bytes(const char *hex, uint8_t *result)
+{
+	for (unsigned n = 0; hex[2*n]; n++) {
+		unsigned byte;
+		sscanf(&hex[2*n],"%2x",&byte);
+		result[n] = byte;
+	}
+}
+
+static void check(const char *what, uint32_t got, uint32_t expected)
+{
+	if (got != expected) {
+		printf("FAIL %s: got %08x expected %08x\n",what,got,expected);
+		failures++;
+	} else {
+		printf("ok   %s: %08x\n",what,got);
+	}
+}
+
+// 35.203 Kasumi test data.
+static struct KasumiVector { const char *key, *plain, *cipher; } kasumiVectors[] = {
+	{ "2BD6459F82C5B300952C49104881FF48", "EA024714AD5C4D84", "DF1F9B251C0BF45F" },
+	{ "9900AABBCCDDEEFF1122334455667788", "FEDCBA0987654321", "514896226CAA4F20" },
+};
+
+// 35.203 f9 test sets 1 and 4.
+static struct F9Vector { const char *ik; uint32_t count, fresh; unsigned dir; const char *msg; unsigned length; uint32_t maci; } f9Vectors[] = {
+	{ "2BD6459F82C5B300952C49104881FF48", 0x38A6F056, 0x05D2EC49, 0,
+		"6B227737296F393C8079353EDC87E2E805D2EC49A4F2D8E0",
+		189, 0xF63BD72C },
+	{ "C736C6AAB22BFFF91E2698D2E22AD57E", 0x14793E41, 0x0397E8FD, 1,
+		"D0A7D463DF9FB2B278833FA02E235AA172BD970C1473E12907FB648B6599AAA0B24A038665422B20A499276A50427009",
+		384, 0xDD7DFADD },
+};
+
+// 35.203 f8 test sets 1 to 5.
+static struct F8Vector { const char *ck; uint32_t count; unsigned bearer, dir; const char *plain, *cipher; unsigned length; } f8Vectors[] = {
+	{ "2BD6459F82C5B300952C49104881FF48", 0x72A4F20F, 0x0C, 1,
+		"7EC61272743BF1614726446A6C38CED166F6CA76EB5430044286346CEF130F92922B03450D3A9975E5BD2EA0EB55AD8E"
+		"1B199E3EC4316020E9A1B285E762795359B7BDFD39BEF4B2484583D5AFE082AEE638BF5FD5A606193901A08F4AB41AAB"
+		"9B134880",
+		"D1E2DE70EEF86C6964FB542BC2D460AABFAA10A4A093262B7D199E706FC2D4891553296910F3A973012682E41C4E2B02"
+		"BE2017B7253BBF9309DE5819CB42E81956F4C99BC9765CAF53B1D0BB8279826ADBBC5522E915C120A618A5A7F5E89708"
+		"9339650F",
+		798 },
+	{ "EFA8B2229E720C2A7C36EA55E9605695", 0xE28BCF7B, 0x18, 0,
+		"10111231E060253A43FD3F57E37607AB2827B599B6B1BBDA37A8ABCC5A8C550D1BFB2F494624FB50367FA36CE3BC68F1"
+		"1CF93B1510376B02130F812A9FA169D8",
+		"3DEACC7C15821CAA89EECADE9B5BD3614BD0C8419D710385DDBE5849EF1BAC5AE8B14A5B0A6741521EB4E00BB9ECF3E9"
+		"F7CCB9CAE74152D7F4E2A034B6EA00EC",
+		510 },
+	{ "5ACB1D644C0D51204EA5F1451010D852", 0xFA556B26, 0x03, 1,
+		"AD9C441F890B38C457A49D421407E8",
+		"9BC92CA803C67B28A11A4BEE5A0C25",
+		120 },
+	{ "D3C5D592327FB11C4035C6680AF8C6D1", 0x398A59B4, 0x05, 1,
+		"981BA6824C1BFB1AB485472029B71D808CE33E2CC3C0B5FC1F3DE8A6DC66B1F0",
+		"5BB9431BB1E98BD11B93DB7C3D45136559BB86A295AA204ECBEBF6F7A5101510",
+		253 },
+	{ "6090EAE04C83706EECBF652BE8E36566", 0x72A4F20F, 0x09, 0,
+		"40981BA6824C1BFB4286B299783DAF442C099F7AB0F58D5C8E46B104F08F01B41AB485472029B71D36BD1A3D90DC3A41"
+		"B46D51672AC4C9663A2BE063DA4BC8D2808CE33E2CCCBFC634E1B259060876A0FBB5A437EBCC8D31C19E4454318745E3"
+		"FA16BB11ADAE248879",
+		"DDB364DD2AAEC24DFF291957B78BAD063AC579CD9041BABE89FD195C0578CB9FDE4217566178D20240206D07CFA619EC"
+		"059F63514459FC10D42DC9934E56EBC0CBC60D4D2DF174774CBDCD5DA4A350317A7F12E1949471F8A295F272E68FC071"
+		"3BD08307FA10AFFD57",
+		837 },
+};
+
+// Compare the first length bits; the unused bits of the last byte are not defined by the test data.
+static bool sameBits(const uint8_t *a, const uint8_t *b, unsigned length)
+{
+	unsigned bytes = length / 8;
+	if (memcmp(a,b,bytes)) { return false; }
+	if (length % 8) {
+		uint8_t mask = 0xff << (8 - length%8);
+		if ((a[bytes] ^ b[bytes]) & mask) { return false; }
+	}
+	return true;
+}
+
+static void testVectors()
+{
+	for (unsigned v = 0; v < sizeof(kasumiVectors)/sizeof(kasumiVectors[0]); v++) {
+		uint8_t key[16], plain[8], cipher[8];
+		hex2bytes(kasumiVectors[v].key,key);
+		hex2bytes(kasumiVectors[v].plain,plain);
+		hex2bytes(kasumiVectors[v].cipher,cipher);
+		KasumiKey kk;
+		kk.setKey(key);
+		uint32_t left = (plain[0]<<24)|(plain[1]<<16)|(plain[2]<<8)|plain[3];
+		uint32_t right = (plain[4]<<24)|(plain[5]<<16)|(plain[6]<<8)|plain[7];
+		kk.encrypt(left,right);
+		check("kasumi left",left,(cipher[0]<<24)|(cipher[1]<<16)|(cipher[2]<<8)|cipher[3]);
+		check("kasumi right",right,(cipher[4]<<24)|(cipher[5]<<16)|(cipher[6]<<8)|cipher[7]);
+	}
+	for (unsigned v = 0; v < sizeof(f9Vectors)/sizeof(f9Vectors[0]); v++) {
+		F9Vector &vec = f9Vectors[v];
+		uint8_t ik[16], msg[200];
+		hex2bytes(vec.ik,ik);
+		hex2bytes(vec.msg,msg);
+		check("f9 reference",AlgorithmF9(ik,vec.count,vec.fresh,vec.dir,msg,vec.length),vec.maci);
+		F9Key key;
+		key.setIK(ik);
+		check("f9 fast",fastF9(key,vec.count,vec.fresh,vec.dir,msg,vec.length),vec.maci);
+	}
+	for (unsigned v = 0; v < sizeof(f8Vectors)/sizeof(f8Vectors[0]); v++) {
+		F8Vector &vec = f8Vectors[v];
+		uint8_t ck[16], msg[200], cipher[200];
+		hex2bytes(vec.ck,ck);
+		hex2bytes(vec.cipher,cipher);
+		hex2bytes(vec.plain,msg);
+		AlgorithmF8(ck,vec.count,vec.bearer,vec.dir,msg,vec.length);
+		check("f8 reference",!sameBits(msg,cipher,vec.length),0);
+		F8Key key;
+		key.setCK(ck);
+		hex2bytes(vec.plain,msg);
+		fastF8(key,vec.count,vec.bearer,vec.dir,msg,vec.length);
+		check("f8 fast",!sameBits(msg,cipher,vec.length),0);
+		fastF8(key,vec.count,vec.bearer,vec.dir,msg,vec.length);	// Deciphering is the same operation.
+		hex2bytes(vec.plain,cipher);
+		check("f8 fast decipher",!sameBits(msg,cipher,vec.length),0);
+	}
+}
+
+// Random keys, messages and lengths, including all the odd lengths around the block boundaries.
+static void testRandom()
+{
+	unsigned mismatches = 0;
+	for (unsigned trial = 0; trial < 20000; trial++) {
+		uint8_t ik[16], msg[64];
+		for (unsigned n = 0; n < 16; n++) { ik[n] = random(); }
+		for (unsigned n = 0; n < 64; n++) { msg[n] = random(); }
+		unsigned length = trial % 500;
+		// The reference includes the unused bits of the last byte in the MAC, so zero them.
+		if (length % 8) { msg[length/8] &= 0xff << (8 - length%8); }
+		uint32_t count = random(), fresh = random();
+		unsigned dir = trial & 1;
+		F9Key key;
+		key.setIK(ik);
+		if (fastF9(key,count,fresh,dir,msg,length) != AlgorithmF9(ik,count,fresh,dir,msg,length)) {
+			if (mismatches++ < 10) { printf("FAIL random trial %u length %u\n",trial,length); }
+		}
+	}
+	if (mismatches) { failures++; } else { printf("ok   random: fast matches reference\n"); }
+
+	// The batch pairs up jobs of different lengths and keys; use an odd number of jobs so the last one is alone.
+	const unsigned numJobs = 501;
+	static uint8_t msgs[numJobs][64];
+	static F9Key keys[numJobs];
+	static F9Job jobs[numJobs];
+	for (unsigned j = 0; j < numJobs; j++) {
+		uint8_t ik[16];
+		for (unsigned n = 0; n < 16; n++) { ik[n] = random(); }
+		for (unsigned n = 0; n < 64; n++) { msgs[j][n] = random(); }
+		keys[j].setIK(ik);
+		F9Job &job = jobs[j];
+		job.mKey = &keys[j];
+		job.mCount = random(); job.mFresh = random(); job.mDir = j & 1;
+		job.mData = msgs[j]; job.mLength = random() % 500;
+	}
+	fastF9Batch(jobs,numJobs);
+	mismatches = 0;
+	for (unsigned j = 0; j < numJobs; j++) {
+		F9Job &job = jobs[j];
+		if (job.mResult != fastF9(*job.mKey,job.mCount,job.mFresh,job.mDir,job.mData,job.mLength)) { mismatches++; }
+	}
+	if (mismatches) { printf("FAIL batch: %u mismatches\n",mismatches); failures++; } else { printf("ok   batch matches single\n"); }
+}
+
+static void testRandomF8()
+{
+	unsigned mismatches = 0;
+	for (unsigned trial = 0; trial < 5000; trial++) {
+		uint8_t ck[16], ref[300], fast[300];
+		for (unsigned n = 0; n < 16; n++) { ck[n] = random(); }
+		for (unsigned n = 0; n < 300; n++) { ref[n] = fast[n] = random(); }
+		unsigned length = 1 + trial % 2400;
+		uint32_t count = random();
+		unsigned bearer = random() % 32, dir = trial & 1;
+		F8Key key;
+		key.setCK(ck);
+		AlgorithmF8(ck,count,bearer,dir,ref,length);
+		fastF8(key,count,bearer,dir,fast,length);
+		// The reference ciphers the unused bits of the last byte too; fastF8 leaves them alone.
+		unsigned bytes = length / 8;
+		bool bad = memcmp(ref,fast,bytes) != 0;
+		if (length % 8) {
+			uint8_t mask = 0xff << (8 - length%8);
+			if ((ref[bytes] & mask) != (fast[bytes] & mask)) { bad = true; }
+		}
+		if (bad && mismatches++ < 10) { printf("FAIL random f8 trial %u length %u\n",trial,length); }
+	}
+	if (mismatches) { failures++; } else { printf("ok   random f8: fast matches reference\n"); }
+
+	// Batch and window against single.
+	const unsigned numJobs = 101;
+	static uint8_t data[numJobs][300], copy[numJobs][300];
+	static F8Key keys[numJobs];
+	static F8Job jobs[numJobs];
+	for (unsigned j = 0; j < numJobs; j++) {
+		uint8_t ck[16];
+		for (unsigned n = 0; n < 16; n++) { ck[n] = random(); }
+		for (unsigned n = 0; n < 300; n++) { data[j][n] = copy[j][n] = random(); }
+		keys[j].setCK(ck);
+		F8Job &job = jobs[j];
+		job.mKey = &keys[j];
+		job.mCount = random(); job.mBearer = random() % 32; job.mDir = j & 1;
+		job.mData = data[j]; job.mLength = 1 + random() % 2400;
+	}
+	fastF8Batch(jobs,numJobs);
+	mismatches = 0;
+	for (unsigned j = 0; j < numJobs; j++) {
+		F8Job &job = jobs[j];
+		fastF8(*job.mKey,job.mCount,job.mBearer,job.mDir,copy[j],job.mLength);
+		if (memcmp(data[j],copy[j],300)) { mismatches++; }
+	}
+	if (mismatches) { printf("FAIL f8 batch: %u mismatches\n",mismatches); failures++; } else { printf("ok   f8 batch matches single\n"); }
+
+	F8KeystreamWindow window;
+	window.configure(keys[0],5,1,16,336);
+	window.prepare(1000,16);
+	mismatches = 0;
+	for (uint32_t count = 990; count < 1030; count++) {
+		uint8_t a[42], b[42];
+		for (unsigned n = 0; n < 42; n++) { a[n] = b[n] = random(); }
+		window.apply(count,a,336);
+		fastF8(keys[0],count,5,1,b,336);
+		if (memcmp(a,b,42)) { mismatches++; }
+	}
+	if (mismatches || window.mHits != 16) {
+		printf("FAIL f8 window: %u mismatches, %u hits\n",mismatches,window.mHits); failures++;
+	} else {
+		printf("ok   f8 window matches single\n");
+	}
+}
+
+// RLC PDUs on a 384K bearer are 336 bits; use a mix of that and bigger ones.
+static void benchmarkF8(unsigned numPdus)
+{
+	const unsigned numBearers = 8, pduBytes = 42;
+	F8Key keys[numBearers];
+	for (unsigned k = 0; k < numBearers; k++) {
+		uint8_t ck[16];
+		for (unsigned n = 0; n < 16; n++) { ck[n] = random(); }
+		keys[k].setCK(ck);
+	}
+	static uint8_t pdus[numBearers][pduBytes];
+	for (unsigned k = 0; k < numBearers; k++) { for (unsigned n = 0; n < pduBytes; n++) { pdus[k][n] = random(); } }
+	double mbits = numPdus * pduBytes * 8 / 1e6;
+
+	uint8_t ck[16];
+	memset(ck,0x11,16);
+	double start = timef();
+	for (unsigned i = 0; i < numPdus; i++) { AlgorithmF8(ck,i,i%numBearers,1,pdus[i%numBearers],8*pduBytes); }
+	double refTime = timef() - start;
+
+	start = timef();
+	for (unsigned i = 0; i < numPdus; i++) { fastF8(keys[i%numBearers],i,i%numBearers,1,pdus[i%numBearers],8*pduBytes); }
+	double fastTime = timef() - start;
+
+	F8Job jobs[numBearers];
+	start = timef();
+	for (unsigned i = 0; i < numPdus; i += numBearers) {
+		for (unsigned k = 0; k < numBearers; k++) {
+			F8Job &job = jobs[k];
+			job.mKey = &keys[k]; job.mCount = i; job.mBearer = k; job.mDir = 1;
+			job.mData = pdus[k]; job.mLength = 8*pduBytes;
+		}
+		fastF8Batch(jobs,numBearers);
+	}
+	double batchTime = timef() - start;
+
+	// Keystream prepared in the window ahead of time; this is what the PDU critical path sees.
+	const unsigned windowSize = 64;
+	F8KeystreamWindow window;
+	window.configure(keys[0],0,1,windowSize,8*pduBytes);
+	double prepareTime = 0, applyTime = 0;
+	for (unsigned i = 0; i < numPdus; i += windowSize) {
+		start = timef();
+		window.prepare(i,windowSize);
+		prepareTime += timef() - start;
+		start = timef();
+		for (unsigned n = 0; n < windowSize; n++) { window.apply(i+n,pdus[0],8*pduBytes); }
+		applyTime += timef() - start;
+	}
+
+	printf("f8 benchmark, %u PDUs of %u bytes, one core:\n",numPdus,pduBytes);
+	printf("  reference:        %8.1f Mbit/s\n",mbits/refTime);
+	printf("  fast:             %8.1f Mbit/s\n",mbits/fastTime);
+	printf("  batch:            %8.1f Mbit/s\n",mbits/batchTime);
+	printf("  window prepare:   %8.1f Mbit/s\n",mbits/prepareTime);
+	printf("  window apply:     %8.1f Mbit/s\n",mbits/applyTime);
+}
+
+// Typical DCCH messages are 10 to 100 bytes; use a mix.
+static void benchmark(unsigned numMsgs)
+{
+	const unsigned numKeys = 16, batchSize = 32;
+	F9Key keys[numKeys];
+	uint8_t iks[numKeys][16];
+	for (unsigned k = 0; k < numKeys; k++) {
+		for (unsigned n = 0; n < 16; n++) { iks[k][n] = random(); }
+		keys[k].setIK(iks[k]);
+	}
+	uint8_t msgs[batchSize][100];
+	unsigned lengths[batchSize];
+	for (unsigned m = 0; m < batchSize; m++) {
+		for (unsigned n = 0; n < 100; n++) { msgs[m][n] = random(); }
+		lengths[m] = 8 * (10 + random() % 91);
+	}
+
+	unsigned totalBits = 0;
+	uint32_t sink = 0;
+	double start = timef();
+	for (unsigned i = 0; i < numMsgs; i++) {
+		unsigned m = i % batchSize;
+		sink ^= AlgorithmF9(iks[i%numKeys],i,0x12345678,1,msgs[m],lengths[m]);
+	}
+	double refTime = timef() - start;
+
+	start = timef();
+	for (unsigned i = 0; i < numMsgs; i++) {
+		unsigned m = i % batchSize;
+		sink ^= fastF9(keys[i%numKeys],i,0x12345678,1,msgs[m],lengths[m]);
+		totalBits += lengths[m];
+	}
+	double fastTime = timef() - start;
+
+	F9Job jobs[batchSize];
+	start = timef();
+	for (unsigned i = 0; i < numMsgs; i += batchSize) {
+		for (unsigned m = 0; m < batchSize; m++) {
+			F9Job &job = jobs[m];
+			job.mKey = &keys[(i+m)%numKeys];
+			job.mCount = i+m; job.mFresh = 0x12345678; job.mDir = 1;
+			job.mData = msgs[m]; job.mLength = lengths[m];
+		}
+		fastF9Batch(jobs,batchSize);
+		for (unsigned m = 0; m < batchSize; m++) { sink ^= jobs[m].mResult; }
+	}
+	double batchTime = timef() - start;
+
+	printf("f9 benchmark, %u messages, average %u bytes (sink %x):\n",numMsgs,totalBits/numMsgs/8,sink);
+	printf("  reference: %10.0f msgs/sec\n",numMsgs/refTime);
+	printf("  fast:      %10.0f msgs/sec\n",numMsgs/fastTime);
+	printf("  batch:     %10.0f msgs/sec\n",numMsgs/batchTime);
+}
+
+int main(int argc, char **argv)
+{
+	gLogInit("KasumiTest","NOTICE");
+	testVectors();
+	testRandom();
+	testRandomF8();
+	unsigned count = argc > 1 ? atoi(argv[1]) : 200000;
+	benchmark(count);
+	benchmarkF8(count);
+	if (failures) { printf("%d FAILURES\n",failures); }
+	return failures ? 1 : 0;
+}
@@ -27,6 +27,16 @@
 
 namespace UMTS {
 MacSwitch gMacSwitch;
+MacStats gMacStats;
+
+void MacStats::text(std::ostream &os) const
+{
+	os << "MAC TFC selection:\n";
+	os << "  findTfcForUe:     " << mFindTfc << "\n";
+	os << "  FACH per TTI:     " << mFachSelect << "\n";
+	os << "  DCH per TTI:      " << mDchSelect << "\n";
+	os << "  no tfc match:     " << mNoTfcMatch << "\n";
+}
 
 //void MACbEngine::writeHighSide(const RLCSDU& sdu)
 //{
@@ -567,7 +577,8 @@ void MacWithTfc::sendDownstreamTbs(MacTbs &tbs)
 // Technically, the term TBS [Transport Block Set] applies only to uplink,
 // but the concept applies to downlink so we use the same term.
 // As a simplifying assumption, all TB on a TrCh are the same size.
-void MacWithTfc::findTbAvail(UEInfo *uep, TfcMap *map)
+// The PDU counts come from the backlog snapshot, not the RLCs, so this does not touch any RLC locks.
+void MacWithTfc::findTbAvail(UEInfo *uep, const DlBacklogSnapshot &backlog, TfcMap *map)
 {
 	RN_UE_FOR_ALL_DLTRCH(uep,tcid) {
 		RN_UE_FOR_ALL_RLC(uep,rbid,rlc) {
@@ -577,7 +588,7 @@ void MacWithTfc::findTbAvail(UEInfo *uep, TfcMap *map)
 			// send multiple TB at a time, so I think we will handle
 			// that as a special case when we get there.
 			if (rlc->mTcid == tcid) {
-				map->tfcMapAdd(tcid,rbid,rlc->mDown->rlcGetPduCnt());
+				map->tfcMapAdd(tcid,rbid,backlog.mPdus[rbid]);
 			}
 		} // for each logical channel
 	} // for each trch
@@ -608,6 +619,7 @@ bool MacWithTfc::matchTfc(RrcTfc *tfc, UEInfo *uep, TfcMap *map)
 // However, for us, this is probably a bug.
 bool MacWithTfc::findTfcForUe(UEInfo *uep,TfcMap *result)
 {
+	double startTime = timef();
 	// Select TFC based on number of blocks in each TrCh/logical channel.
 	// There could be multiple matches, including one that is all zeros, so we want
 	// to select the TFC with the most bytes.
@@ -627,7 +639,9 @@ bool MacWithTfc::findTfcForUe(UEInfo *uep,TfcMap *result)
 	uep->uePullLowSide(config->dl()->getMaxAnyTfSize()/8);
 
 	// Step 2: How many TBs avail on each TrCh in this UE?
-	findTbAvail(uep,result);
+	DlBacklogSnapshot backlog;
+	uep->ueGetDlBacklog(&backlog);
+	findTbAvail(uep,backlog,result);
 
 	// Step 3: Find a TFC to match the avail TB.
 	RrcTfcs *tfcs = config->dl()->getTfcs();
@@ -644,6 +658,8 @@ bool MacWithTfc::findTfcForUe(UEInfo *uep,TfcMap *result)
 		}
 	} // for each tfc.
 
+	if (result->mtfc == 0 && backlog.mTotalBytes) { __sync_fetch_and_add(&gMacStats.mNoTfcMatch,1); }
+	gMacStats.mFindTfc.addPoint(timef() - startTime);
 	return result->mtfc != 0;
 }
 
@@ -736,6 +752,7 @@ bool MaccWithTfc::flushUE()
 	unsigned chosenPriority = 100;	// In this case, low priority is better.
 	unsigned chosenSize = 0;
 	UEInfo *uep = 0;	// unused init to shut up gcc.
+	double startTime = timef();
 
 	{
 		gRrc.mUEListLock.lock();
@@ -768,6 +785,7 @@ bool MaccWithTfc::flushUE()
 		}
 		gRrc.mUEListLock.unlock();
 	}
+	gMacStats.mFachSelect.addPoint(timef() - startTime);
 
 	if (chosenUE == 0) return false;	// Nothing to send anywhere.
 	if (chosenUE->ueGetState() != stCELL_FACH) {return false;} // in case user switched states during above loop
@@ -838,11 +856,13 @@ bool MacdWithTfc::flushUE()
 {
 	//LOG(INFO) << "flushUE: ueGetState at time " << gNodeB.clock().get();
 	if (mUep->ueGetState() != stCELL_DCH) { return false; } 	// This is Harvinds idea.
-	//LOG(INFO) << "flushUE: uePullLowSide at time " << gNodeB.clock().get();
-	mUep->uePullLowSide(mUep->ueGetTrChConfig()->dl()->getMaxAnyTfSize()/8);
+	// findTfcForUe pulls the RLCs itself, so we dont need to do it here too.
 	TfcMap map;
 	//LOG(INFO) << "flushUE: findTfcforUe at time " << gNodeB.clock().get();
-	if (! findTfcForUe(mUep,&map)) {
+	double startTime = timef();
+	bool found = findTfcForUe(mUep,&map);
+	gMacStats.mDchSelect.addPoint(timef() - startTime);
+	if (! found) {
 		// No TFC matched the data waiting in UE.
 		// This is bad, because there should have been an option even for no data.
 		LOG(WARNING) << "mac-d: No tfc matched available data in UE";
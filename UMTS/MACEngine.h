@@ -23,6 +23,7 @@
 #include <ByteVector.h>
 #include <list>
 #include <Defines.h>
+#include <Utils.h>
 #include "URRCDefs.h"
 #include "UMTSTransfer.h"
 #include "UMTSCommon.h"	// For L1FEC_t
@@ -51,6 +52,7 @@ class URlcTransUm;
 class DCHFEC;
 class RACHFEC;
 class FACHFEC;
+struct DlBacklogSnapshot;
 typedef DCHFEC DCHFEC_t;
 
 
@@ -229,6 +231,19 @@ class MacSwitch
 };
 extern MacSwitch gMacSwitch;
 
+// TFC selection cost, to see what the scheduler is costing us per TTI.
+// Updated by the FACH and DCH threads with atomic operations, so there is no lock.
+struct MacStats {
+	LatencyHistogram mFindTfc;		// One findTfcForUe call.
+	LatencyHistogram mFachSelect;	// Choosing the UE and TFC for one FACH TTI, all UEs.
+	LatencyHistogram mDchSelect;	// Choosing the TFC for one DCH TTI.
+	unsigned mNoTfcMatch;			// Data was waiting but no TFC matched it.
+	MacStats() : mNoTfcMatch(0) {}
+	void clear() { mFindTfc.clear(); mFachSelect.clear(); mDchSelect.clear(); mNoTfcMatch = 0; }
+	void text(std::ostream &os) const;
+};
+extern MacStats gMacStats;
+
 
 // These little tiny MAC classes are for David to glue on to the top of the TrChFEC classes.
 // Note that the whole conceptual point of MAC is to switch data between different channels,
@@ -284,7 +299,7 @@ class MacSimple : public virtual MacEngine
 // Also supports multiple TrCh, which was no extra effort.
 class MacWithTfc : public virtual MacEngine
 {	protected:
-	void findTbAvail(UEInfo *uep, TfcMap *map);
+	void findTbAvail(UEInfo *uep, const DlBacklogSnapshot &backlog, TfcMap *map);
 	bool matchTfc(RrcTfc *tfc, UEInfo *uep, TfcMap *match);
 	public:
 	bool findTfcForUe(UEInfo *uep,TfcMap *result);
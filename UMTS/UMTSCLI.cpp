@@ -20,6 +20,7 @@
 #include "URRCMessages.h"
 #include "URLC.h"
 #include "URRC.h"
+#include "URRCMsgTemplate.h"
 #include "GPRSL3Messages.h"	// For SmQoS
 #include <stdlib.h>	// for rand
 
@@ -526,6 +527,31 @@ int rrcTest(int argc, char** argv, ostream& os)
 		uep->ueSetState(stCELL_FACH);
 		sendRadioBearerRelease(uep,1<<5,1);
 		sendCellUpdateConfirm(uep);
+	} else if (0==strcmp(subcmd,"beacon")) {
+		// Print the cost of beacon regeneration and of each BCH frame.
+		// With "regen N", regenerate the beacon N times first to measure it.
+		if (arg1 && 0==strcmp(arg1,"regen")) {
+			int count = (argc > argi+1) ? atoi(argv[argi+1]) : 1;
+			for (int i = 0; i < count; i++) { gNodeB.regenerateBeacon(); }
+		}
+		gNodeB.beaconText(os);
+	} else if (0==strcmp(subcmd,"macstats")) {
+		// Print the MAC TFC selection time per TTI, or clear it.
+		if (arg1 && 0==strcmp(arg1,"clear")) { gMacStats.clear(); return 0; }
+		gMacStats.text(os);
+	} else if (0==strcmp(subcmd,"encstats")) {
+		// Print the RRC encode latency, or clear it.
+		if (arg1 && 0==strcmp(arg1,"clear")) { gRrcMsgTemplates.clearStats(); return 0; }
+		gRrcMsgTemplates.text(os);
+	} else if (0==strcmp(subcmd,"encbench")) {
+		// Encode a bunch of CellUpdateConfirms on a fake UE, then look at encstats.
+		// Run it once with UMTS.RRC.MessageTemplates on and once with it off to compare.
+		int count = arg1 ? atoi(arg1) : 1000;
+		UEInfo *uep = testCreateFakeUe();
+		uep->ueConnectRlc(gRrcDcchConfig,stCELL_FACH);
+		uep->ueSetState(stCELL_FACH);
+		for (int i = 0; i < count; i++) { sendCellUpdateConfirm(uep); }
+		gRrcMsgTemplates.text(os);
 	} else {
 		os << "invalid sub-command\n";
 		return 2;	// bad command
@@ -118,18 +118,33 @@ class BeaconConfig {
 	/**@ Beacon paramters. */
 	//@{
 	unsigned mMIBValueTag;
+	// The value tag for each SIB is advanced only when that SIB actually changes,
+	// so the UEs do not have to re-read the whole beacon every time someone touches the config.
+	unsigned mSibValueTag[sMaxSibId+1];
 
 	UInt_z mNumSibTypes;
 	SibInfo_t mSibInfo[sMaxSibId+1];
 
 	//static const ASN::SIBSb_TypeAndTag_PR SIBTypes[];
 	static const unsigned sMaxSibSegments = 4;	// Max segments required by a SIB.
+	static const unsigned sSfnPrimeBits = 11;	// SFN-Prime ::= INTEGER (0..2047)
 	//@}
 
 	// This lock protects mSibPhase1, which is regnerated and used asynchronously.
 	mutable Mutex mBeaconLock;		///< multithread access control
 	// ByteVectors to hold the output of the phase1 SIB encoding.
 	ByteVector *mSibPhase1[sMaxSibId+1];	// +1 for MIB
+	ByteVector *mSibScratch;		// The new phase1 encoding goes here first so we can see if it changed.
+	// Set when the phase1 encoding of a SIB changes; its transport blocks must be phase2 encoded again.
+	bool mSibDirty[sMaxSibId+1];
+	// The phase2 transport blocks differ from one beacon cycle to the next only in sfn-Prime,
+	// which is the first field of SystemInformation-BCH, so normally we just patch it in.
+	// This is cleared if encodeSI ever finds the sfn-Prime somewhere else.
+	bool mSfnPatchOk;
+	unsigned mGeneration;			// Advanced whenever any transport block changes other than sfn-Prime.
+	LatencyHistogram mRegenerateTime;	// CPU time per beacon change.
+	LatencyHistogram mPhase2Time;		// CPU time per beacon cycle to update the transport blocks.
+	LatencyHistogram mPhase2FullTime;	// Same, when some SIB had to be phase2 encoded again.
 
 	/**@ Beacon scheduling table. */
 	//@{
@@ -144,14 +159,16 @@ class BeaconConfig {
 	TransportBlock *mSibSched[msSibRepeat/2];
 	//@}
 
-	/** Encode an SIB to a transpoint block and populate it into the scheduling table. */
-	void encodeSIBPhase1(
+	/** Encode an SIB to a transpoint block and populate it into the scheduling table.
+		Return true if the encoding changed. */
+	bool encodeSIBPhase1(
 		unsigned sibIndex,	// Index into mSibInfo.
 		const char *sibId,		// The RRC spec SIB type number used only for user readable messages, may be double in future.
 		struct ASN::asn_TYPE_descriptor_s *type_descriptor,
 		void *struct_ptr);	/* Structure to be encoded */
 	void encodeSI(const char *sibId, ASN::SystemInformation_BCH &si, TransportBlock *trb, unsigned sfn);
 	void encodeSIBPhase2( SibInfo_t *plan, unsigned sfn);
+	void generateMIB();
 
 	void addSibPlan(const char *wSibId,		// user printable name for SIB type id (1,2,..) or 0 for MIB.
 		unsigned wSibPos,	// The position, of the first segment within one cycle.
@@ -165,6 +182,8 @@ class BeaconConfig {
 	BeaconConfig();
 	void regenerate();
 	void encodePhase2(unsigned sfn);
+	unsigned generation() const { return mGeneration; }
+	void beaconText(std::ostream &os);
 	TransportBlock *getSITB(unsigned sfn) {	// Get System Information Transport Block.
 		assert(!(sfn&1));
 		return mSibSched[(sfn % msSibRepeat)/2];
@@ -173,8 +192,10 @@ class BeaconConfig {
 static class BeaconConfig sBeacon;
 
 BeaconConfig::BeaconConfig()
-	: mMIBValueTag(0),mNumSibTypes(0)
+	: mMIBValueTag(0),mNumSibTypes(0),mSibScratch(0),mSfnPatchOk(true),mGeneration(0)
 {
+	memset(mSibValueTag,0,sizeof(mSibValueTag));
+	memset(mSibDirty,0,sizeof(mSibDirty));
 	memset(mSibPhase1,0,sizeof(mSibPhase1));	// overkill - be safe
 	memset(mSibInfo,0,sizeof(mSibInfo));		// overkill - be safe
 	memset(mSibSched,0,sizeof(mSibSched));		// overkill - be safe
@@ -332,6 +353,9 @@ void BeaconConfig::addSibPlan(const char *wSibId,	// user printable SIB type id
 	mSibPhase1[ind] = new ByteVector(1 + (sMaxSibSegments * sSIBTrBlockSize)/8);
 	mSibPhase1[ind]->fill(0);	// unnecessary but neat.
 	RN_MEMLOG(ByteVector,mSibPhase1[ind]);
+	mSibPhase1[ind]->setSizeBits(0);	// Nothing encoded yet, so the first encoding counts as a change.
+	mSibDirty[ind] = true;
+	if (mSibScratch == NULL) { mSibScratch = new ByteVector(mSibPhase1[ind]->size()); }
 	mNumSibTypes = mNumSibTypes + 1;
 }
 
@@ -359,8 +383,20 @@ void BeaconConfig::addSibPlan(const char *wSibId,	// user printable SIB type id
 //	while (pos < (lengthBits+7)/8) { buf[pos++] = 0; }
 //}
 
+// Return true if the first numBits bits of two ByteVectors are the same.
+static bool sameBits(const ByteVector &a, const ByteVector &b)
+{
+	if (a.sizeBits() != b.sizeBits()) { return false; }
+	unsigned numBits = a.sizeBits();
+	if (memcmp(a.begin(),b.begin(),numBits/8)) { return false; }
+	unsigned tail = numBits % 8;
+	return tail == 0 || a.getField(numBits-tail,tail) == b.getField(numBits-tail,tail);
+}
+
 // Encode the SIB into an ASN struct into the corresponding mSibPhase1[] buffer.
-void BeaconConfig::encodeSIBPhase1(
+// If the encoding has not changed since last time we leave everything alone; otherwise
+// advance the value tag for this SIB and mark it for phase2 encoding.
+bool BeaconConfig::encodeSIBPhase1(
 	unsigned sibIndex,
 	const char *sibId,
 	struct asn_TYPE_descriptor_s *type_descriptor,
@@ -370,21 +406,33 @@ void BeaconConfig::encodeSIBPhase1(
 	if (rn_asn_debug_beacon) { printf("=== Phase1 Encoding SIB %s\n",sibId); }
 	assert(0 == strcmp(sibId,mSibInfo[sibIndex].mSibId));
 	ByteVector *perBuf = mSibPhase1[sibIndex];
-	perBuf->resetSize();
+	ByteVector *newBuf = mSibScratch;
+	newBuf->resetSize();
+	newBuf->fill(0);
 
 	asn_enc_rval_t rval = uper_encode_to_buffer(
-		type_descriptor,struct_ptr,(void*)perBuf->begin(),perBuf->size());
+		type_descriptor,struct_ptr,(void*)newBuf->begin(),newBuf->size());
 	int numBits = rval.encoded;	// Must be an int to detect less than zero!!
 	if (numBits<0) {
-		LOG(ERR) << "failed to encode SIB " << sibId <<" into buf size="<<perBuf->size();
+		LOG(ERR) << "failed to encode SIB " << sibId <<" into buf size="<<newBuf->size();
 		assert(0);
 	}
+	newBuf->setSizeBits(numBits);
+	if (sameBits(*newBuf,*perBuf)) {
+		LOG(INFO) << "SIB " << sibId << " unchanged";
+		return false;
+	}
+	perBuf->resetSize();
+	memcpy(perBuf->begin(),newBuf->begin(),perBuf->size());
 	perBuf->setSizeBits(numBits);
+	mSibValueTag[sibIndex]++;
+	mSibDirty[sibIndex] = true;
 	printf("=== Phase1 Encoded SIB %s size %u blocks %g\n",sibId,numBits,numBits/226.0);
 	if (rn_asn_debug_beacon) {
 		cout << "SIB" << sibIndex << ": bytes: " << *perBuf << endl;
 	}
 	fflush(stdout);
+	return true;
 }
 
 // Encode the System Information message into a TransportBlock.
@@ -412,6 +460,10 @@ void BeaconConfig::encodeSI(const char *sibId, SystemInformation_BCH &si, Transp
 	// is busily debugging it.
 	trb->zero();	// Pat added.
 	trb->unpack(siPerBuf);
+	if (mSfnPatchOk && trb->peekField(0,sSfnPrimeBits) != (uint64_t)si.sfn_Prime) {
+		LOG(ERR) << "SIB " << sibId << " sfn-Prime not where expected, beacon will be fully encoded every cycle";
+		mSfnPatchOk = false;
+	}
 	trb->setSchedule(sfn);
 	trb->mDescr = (string)sibId;	// TODO: make sibId a string so this does not bother to allocate memory.
 }
@@ -752,29 +804,11 @@ static SCCPCH_SystemInformation *generateSCCPCH(unsigned fachChCode, bool addPIC
 		rn_asn_debug = asn_debug_beacon; \
 		}
 
-void BeaconConfig::regenerate()
+// Fill in the mMIB, which references the SIBs, so must be done after the SIBs are encoded.
+void BeaconConfig::generateMIB()
 {
 	bool asn_debug_beacon = gConfig.getNum("UMTS.Debug.ASN.Beacon");
 	bool asn_debug_free = gConfig.getNum("UMTS.Debug.ASN.Free");
-	rn_asn_debug = asn_debug_beacon;
-	// Note: we already locked UMTSConfig.
-	// Currently, the only other locker is encodePhase2 which is brief.
-	// But make sure you dont insert a race condition here.
-	// (pat) NOTE: The mutex we use is recursive, so it does not prevent the same
-	// thread from going right through here.
-	ScopedLock lock(mBeaconLock);
-
-	sPrevBeaconStart = sBeaconStartInvalid;	// Force beacon re-encoding, but hardly matters.
-
-	// Update everything from the configuration.
-	LOG(NOTICE) << "regenerating system information messages";
-
-	// TODO: Update LAI.
-	// TODO: We are throwing away the memory allocated in sub-structures, which is
-	// easy to fix, but the amount is small so defer.
-	// Note: You must clear the mMIB and mSIB structs before using them to make
-	// sure that the lists are inited to 0 size.  Otherwise they just get bigger
-	// every time through this loop.
 
 	// Generate the MIB.
 	// 3GPP 25.331 10.2.48.8.1
@@ -807,30 +841,30 @@ void BeaconConfig::regenerate()
 		switch (plan->mTypeTag) {
 			case SIBSb_TypeAndTag_PR_sysInfoType1:
 				// type is PLMN-ValueTag, 1..256
-				SIBSb->sibSb_Type.choice.sysInfoType1 = mMIBValueTag%256 + 1;
+				SIBSb->sibSb_Type.choice.sysInfoType1 = mSibValueTag[i]%256 + 1;
 				break;
 			case SIBSb_TypeAndTag_PR_sysInfoType2:
 				// type is CellValueTag, 1..4
-				SIBSb->sibSb_Type.choice.sysInfoType2 = mMIBValueTag%4 + 1;
+				SIBSb->sibSb_Type.choice.sysInfoType2 = mSibValueTag[i]%4 + 1;
 				break;
 			case SIBSb_TypeAndTag_PR_sysInfoType3:
 				// type is CellValueTag, 1..4
-				SIBSb->sibSb_Type.choice.sysInfoType3 = mMIBValueTag%4 + 1;
+				SIBSb->sibSb_Type.choice.sysInfoType3 = mSibValueTag[i]%4 + 1;
 				break;
 			case SIBSb_TypeAndTag_PR_sysInfoType5:
 				// type is CellValueTag, 1..4
-				SIBSb->sibSb_Type.choice.sysInfoType5 = mMIBValueTag%4 + 1;
+				SIBSb->sibSb_Type.choice.sysInfoType5 = mSibValueTag[i]%4 + 1;
 				break;
 			case SIBSb_TypeAndTag_PR_sysInfoType7:
 				// type is NULL
 				break;
 			case SIBSb_TypeAndTag_PR_sysInfoType11:
 				// type is CellValueTag, 1..4
-				SIBSb->sibSb_Type.choice.sysInfoType11 = mMIBValueTag%4 + 1;
+				SIBSb->sibSb_Type.choice.sysInfoType11 = mSibValueTag[i]%4 + 1;
 				break;
                         case SIBSb_TypeAndTag_PR_sysInfoType12:
                                 // type is CellValueTag, 1..4
-                                SIBSb->sibSb_Type.choice.sysInfoType12 = mMIBValueTag%4 + 1;
+                                SIBSb->sibSb_Type.choice.sysInfoType12 = mSibValueTag[i]%4 + 1;
                                 break;
 			default:
 				LOG(ERR) << "uncoded sys info type " <<plan->mSibId <<" asn type "<<(int)plan->mTypeTag;
@@ -887,8 +921,32 @@ void BeaconConfig::regenerate()
 
 		ASN_SEQUENCE_ADD(&mMIB.sibSb_ReferenceList.list,SIBSb);
 	}
-	//fillMIBSchedule();
-	mMIBValueTag++;
+}
+
+void BeaconConfig::regenerate()
+{
+	bool asn_debug_beacon = gConfig.getNum("UMTS.Debug.ASN.Beacon");
+	bool asn_debug_free = gConfig.getNum("UMTS.Debug.ASN.Free");
+	rn_asn_debug = asn_debug_beacon;
+	// Note: we already locked UMTSConfig.
+	// Currently, the only other locker is encodePhase2 which is brief.
+	// But make sure you dont insert a race condition here.
+	// (pat) NOTE: The mutex we use is recursive, so it does not prevent the same
+	// thread from going right through here.
+	ScopedLock lock(mBeaconLock);
+	double startTime = timef();
+
+	sPrevBeaconStart = sBeaconStartInvalid;	// Force beacon re-encoding, but hardly matters.
+
+	// Update everything from the configuration.
+	LOG(NOTICE) << "regenerating system information messages";
+
+	// TODO: Update LAI.
+	// TODO: We are throwing away the memory allocated in sub-structures, which is
+	// easy to fix, but the amount is small so defer.
+	// Note: You must clear the mMIB and mSIB structs before using them to make
+	// sure that the lists are inited to 0 size.  Otherwise they just get bigger
+	// every time through this loop.
 
 	// The SIBs themselves.
 	// Behold the glory that is UMTS!!
@@ -1470,7 +1528,6 @@ Comment this out until we are further along.
 	// Type 18
 	// All parts are optional, so do we need it?
 
-	LOG(INFO) << asn2string(&ASN::asn_DEF_MasterInformationBlock, &mMIB);
 	LOG(INFO) << asn2string(&ASN::asn_DEF_SysInfoType1, &mSIB1);
 	LOG(INFO) << asn2string(&ASN::asn_DEF_SysInfoType2, &mSIB2);
 	LOG(INFO) << asn2string(&ASN::asn_DEF_SysInfoType3, &mSIB3);
@@ -1481,7 +1538,7 @@ Comment this out until we are further along.
         //LOG(INFO) << asn2string(&ASN::asn_DEF_SysInfoType12, &mSIB12);
 
 	// Phase1 encoding - just turns them into a single buffer apiece.
-	encodeSIBPhase1(0, "MIB", &asn_DEF_MasterInformationBlock,&mMIB);
+	// Only the SIBs that actually changed get new value tags and are phase2 encoded again.
 	encodeSIBPhase1(1, "SIB1", &asn_DEF_SysInfoType1,(void*)&mSIB1);
 	encodeSIBPhase1(2, "SIB2", &asn_DEF_SysInfoType2,(void*)&mSIB2);
 	encodeSIBPhase1(3, "SIB3", &asn_DEF_SysInfoType3,(void*)&mSIB3);
@@ -1491,11 +1548,22 @@ Comment this out until we are further along.
         //encodeSIBPhase1(7, "SIB12",&asn_DEF_SysInfoType12,(void*)&mSIB12);
 	// We are done with the SIB structs; we could free them now.
 
+	// The MIB holds the SIB value tags so it goes last.  If it changed it needs a new value tag of its own.
+	generateMIB();
+	if (encodeSIBPhase1(0, "MIB", &asn_DEF_MasterInformationBlock,&mMIB)) {
+		mMIBValueTag++;
+		generateMIB();
+		encodeSIBPhase1(0, "MIB", &asn_DEF_MasterInformationBlock,&mMIB);
+	}
+	LOG(INFO) << asn2string(&ASN::asn_DEF_MasterInformationBlock, &mMIB);
+	mRegenerateTime.addPoint(timef() - startTime);
+
 	rn_asn_debug = gConfig.getNum("UMTS.Debug.ASN");
 }
 
 // Unfortunately the System Information messages in the beacon
-// include the SFN, so we must re-encode them, at least the phase2 part, for each beacon.
+// include the SFN, so we must update them for each beacon.  Normally that just means patching
+// the sfn-Prime, but any SIB whose phase1 encoding changed gets the full phase2 encoding.
 void BeaconConfig::encodePhase2(unsigned sfn)
 {
 	// Re-run the phase2 encoding for the beacon at the start of every beacon cycle,
@@ -1510,15 +1578,22 @@ void BeaconConfig::encodePhase2(unsigned sfn)
 	// BeaconLock makes sure we dont do this at the same time as regenerateBeacon
 	// Note: Do not lock the UMTSConfig here or you will create a deadlock race condition.
 	ScopedLock lock(mBeaconLock);
+	double startTime = timef();
 	sPrevBeaconStart = sfn;
 
-	// Debug test: clear out the scheduling from the TransportBlocks.
-	for (unsigned j = 0; j < sizeof(mSibSched)/sizeof(TransportBlock*); j++) {
-		mSibSched[j]->mScheduled = false;
+	// If we cant patch the sfn-Prime we have to do the whole thing every time.
+	bool full = !mSfnPatchOk;
+	if (full) {
+		// Debug test: clear out the scheduling from the TransportBlocks.
+		for (unsigned j = 0; j < sizeof(mSibSched)/sizeof(TransportBlock*); j++) {
+			mSibSched[j]->mScheduled = false;
+		}
 	}
 
+	bool changed = false;
 	for (unsigned i=0; i<mNumSibTypes; i++) {
 		SibInfo_t *plan = &mSibInfo[i];
+		if (!full && !mSibDirty[i]) { continue; }
 
 		// Now rerun the phase2 encoder to generate transport blocks
 		// for each location in the beacon where this SIB goes.
@@ -1526,11 +1601,37 @@ void BeaconConfig::encodePhase2(unsigned sfn)
 			//LOG(INFO) << "i: " << i << " sfn: " << sfn << " pos: " << pos;
 			encodeSIBPhase2(plan,sfn+pos);
 		}
+		mSibDirty[i] = false;
+		changed = true;
+	}
+	if (changed) { mGeneration++; }
+
+	if (mSfnPatchOk) {
+		// Everything else is unchanged from the previous beacon cycle except the sfn.
+		for (unsigned j = 0; j < msSibRepeat/2; j++) {
+			unsigned tbsfn = sfn + 2*j;
+			mSibSched[j]->fillField(0,tbsfn/2,sSfnPrimeBits);
+			mSibSched[j]->setSchedule(tbsfn);
+		}
 	}
 
 	for (unsigned j = 0; j < sizeof(mSibSched)/sizeof(TransportBlock*); j++) {
 		assert(mSibSched[j]->scheduled());
 	}
+	(changed ? mPhase2FullTime : mPhase2Time).addPoint(timef() - startTime);
+}
+
+void BeaconConfig::beaconText(std::ostream &os)
+{
+	ScopedLock lock(mBeaconLock);
+	os << "beacon regenerate:     " << mRegenerateTime << "\n";
+	os << "beacon cycle, patched: " << mPhase2Time << "\n";
+	os << "beacon cycle, encoded: " << mPhase2FullTime << "\n";
+	os << LOGVAR2("generation",mGeneration) << LOGVAR2("sfnPatch",mSfnPatchOk) << LOGVAR2("MIBValueTag",mMIBValueTag) << "\n";
+	for (unsigned i=1; i<mNumSibTypes; i++) {
+		os << " " << mSibInfo[i].mSibId << LOGVAR2("valueTag",mSibValueTag[i]) << LOGVAR2("bits",mSibPhase1[i]->sizeBits());
+	}
+	os << "\n";
 }
 
 
@@ -1641,6 +1742,17 @@ bool UMTSConfig::hold() const
 	return mHold;
 }
 
+unsigned UMTSConfig::beaconGeneration() const
+{
+	return sBeacon.generation();
+}
+
+void UMTSConfig::beaconText(std::ostream &os)
+{
+	sBeacon.beaconText(os);
+	if (mBCH) { mBCH->bchText(os); }
+}
+
 const TransportBlock* UMTSConfig::getTxSIB(unsigned SFN)
 {
 	// Note: This may take some time...
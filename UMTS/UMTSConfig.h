@@ -153,6 +153,10 @@ class UMTSConfig {
 		Must call fillSIBSchedule first for this to work.
 	*/
 	const TransportBlock* getTxSIB(unsigned SFN);
+	// Advanced whenever the beacon TransportBlocks change other than the SFN, so BCH can cache their encoding.
+	unsigned beaconGeneration() const;
+	// Print the beacon and BCH encode statistics.
+	void beaconText(std::ostream &os);
 
 
 	/** Populate the MIB into the scheduling table. */
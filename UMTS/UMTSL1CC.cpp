@@ -1078,6 +1078,18 @@ void getParity(const BitVector &in, BitVector &parity)
 // Downlink entry function to L1 from MAC.
 // Simplified version for BCH and maybe FACH.  Send just one TB.
 void L1CCTrChDownlink::l1WriteHighSide(const TransportBlock &tb)
+{
+        if (tb.scheduled()) mNextWriteTime = tb.time();
+	int tfci = l1EncodeTb(tb);
+	// Now send the result to the radio.
+	// This function is called only for TrCh with no TFC, so it is TFC 0
+	//LOG(INFO) << "Pushing BCH: " << tb << " at time " << mNextWriteTime;
+	l1PushRadioFrames(tfci);
+}
+
+// Run the TB through everything up to and including the TrCh multiplexer.
+// The result is in mMultiplexerBuf.
+int L1CCTrChDownlink::l1EncodeTb(const TransportBlock &tb)
 {
 	assert(getNumTrCh() == 1);
 	assert(isTrivial()); //getNumTfc() <= 1);
@@ -1086,12 +1098,18 @@ void L1CCTrChDownlink::l1WriteHighSide(const TransportBlock &tb)
 	assert(fpi->getNumTB() == 1);
 	TransportBlock const *blocklist[1];	// It is not a very interesting list in this case.
 	blocklist[0] = &tb;
-        if (tb.scheduled()) mNextWriteTime = tb.time();
 	this->mEncoders[0][tfci]->l1CrcAndTBConcatenation(fpi,blocklist);
-	// Now send the result to the radio.
-	// This function is called only for TrCh with no TFC, so it is TFC 0
-	//LOG(INFO) << "Pushing BCH: " << tb << " at time " << mNextWriteTime;
-	l1PushRadioFrames(tfci);
+	return tfci;
+}
+
+// Same as l1WriteHighSide but the caller already has the multiplexed radio frames for this TB.
+void L1CCTrChDownlink::l1WriteHighSideCoded(const TransportBlock &tb, BitVector *frames, int tfci)
+{
+        if (tb.scheduled()) mNextWriteTime = tb.time();
+	int numRF = l1GetNumRadioFrames(0);
+	for (int i = 0; i < numRF; i++) {
+		l1SendFrame2(frames[i],tfci);
+	}
 }
 
 // Downlink entry function to L1 from MAC.
@@ -623,6 +623,10 @@ class L1CCTrChDownlink : public L1CCTrChInfo, public virtual L1CCBase
 
 		// Downlink parts.
 		void l1WriteHighSide(const TransportBlock &tb);	// For the channels without a TFS that send just one TB.
+		// Split version of the above for channels that cache the coded frames, ie, BCH.
+		int l1EncodeTb(const TransportBlock &tb);	// Channel code the TB into the multiplexer buffers but dont send it; returns tfci.
+		const BitVector &l1GetMultiplexerBuf(unsigned rf) const { return mMultiplexerBuf[rf]; }
+		void l1WriteHighSideCoded(const TransportBlock &tb, BitVector *frames, int tfci);	// Send frames previously produced by l1EncodeTb.
 		void l1WriteHighSide(const MacTbs &tbs);	// For the channels that use non-trivial TFS
 		void l1Multiplexer(L1FecProgInfo *fpi, BitVector& frame, unsigned intraTTIFrameNum);
 		void l1SendFrame2(BitVector& frame, unsigned tfci);
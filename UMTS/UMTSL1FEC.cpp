@@ -1028,14 +1028,114 @@ void TrCHFECDecoderLowRate::decode(const SoftVector& c, BitVector& o)
 }
 
 
+// Channel code a TB and return the radio frames in frames.
+void BCHFEC::bchCodeFrames(const TransportBlock &tb, BitVector *frames)
+{
+	mTfci = l1EncodeTb(tb);
+	for (unsigned rf = 0; rf < sNumRF; rf++) {
+		frames[rf].clone(l1GetMultiplexerBuf(rf));
+	}
+}
+
+static void xorFrame(BitVector &result, const BitVector &other)
+{
+	char *rp = result.begin(), *rend = result.end();
+	const char *op = other.begin();
+	while (rp < rend) { *rp++ ^= *op++; }
+}
+
+// Code the all-zero TB and one TB for each SFN bit to get the delta for that bit.
+void BCHFEC::bchInitPrecode()
+{
+	mPrecodeInited = true;
+	assert(L1CCTrChDownlink::l1GetNumRadioFrames(0) == sNumRF);
+	unsigned tbsize = l1GetDlTrBkSz();
+	TransportBlock tb(tbsize);
+	tb.zero();
+	BitVector zero[sNumRF];
+	bchCodeFrames(tb,zero);
+	for (unsigned bit = 0; bit < sSfnBits; bit++) {
+		tb.zero();
+		tb[bit] = 1;
+		bchCodeFrames(tb,mSfnDelta[bit]);
+		for (unsigned rf = 0; rf < sNumRF; rf++) { xorFrame(mSfnDelta[bit][rf],zero[rf]); }
+	}
+	for (unsigned rf = 0; rf < sNumRF; rf++) {
+		// The trick only works if the coder output is pure bits, no DTX or other markers.
+		for (char *cp = zero[rf].begin(); cp < zero[rf].end(); cp++) {
+			if (*cp & ~1) { LOG(NOTICE) << "BCH coder output is not binary, not using precoded frames"; return; }
+		}
+		mOut[rf].clone(zero[rf]);	// Just to allocate it.
+	}
+	mPrecoded = true;
+}
+
+// Set mOut to the coded frames for tb.  Return false if we cant.
+bool BCHFEC::bchPrecodedFrames(const TransportBlock &tb)
+{
+	if (!tb.scheduled()) { return false; }
+	unsigned generation = gNodeB.beaconGeneration();
+	CodedTti &coded = mCoded[(tb.time().FN()/2) % sNumCodedTti];
+	bool verify = false;
+	if (coded.mTb != &tb || coded.mGeneration != generation) {
+		// First time for this TB in this beacon.
+		double start = timef();
+		TransportBlock base(tb.size());
+		tb.copyTo(base);
+		base.fill(0,0,sSfnBits);
+		bchCodeFrames(base,coded.mFrames);
+		coded.mTb = &tb;
+		coded.mGeneration = generation;
+		mCodeTime.addPoint(timef() - start);
+		verify = true;
+	}
+
+	for (unsigned rf = 0; rf < sNumRF; rf++) {
+		coded.mFrames[rf].copyTo(mOut[rf]);
+	}
+	for (unsigned bit = 0; bit < sSfnBits; bit++) {
+		if (tb[bit]) {
+			for (unsigned rf = 0; rf < sNumRF; rf++) { xorFrame(mOut[rf],mSfnDelta[bit][rf]); }
+		}
+	}
+
+	if (verify) {
+		// Paranoid check against the real coder, once per beacon change.
+		BitVector check[sNumRF];
+		bchCodeFrames(tb,check);
+		for (unsigned rf = 0; rf < sNumRF; rf++) {
+			if (check[rf].size() != mOut[rf].size() || memcmp(check[rf].begin(),mOut[rf].begin(),mOut[rf].size())) {
+				LOG(ERR) << "BCH precoded frame does not match coder output, not using precoded frames";
+				mPrecoded = false;
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 void BCHFEC::generate()
 {
 	//printf("BCHFEC::generate\n"); fflush(stdout);
 	l1WaitToSend();
+	double start = timef();
 	const TransportBlock *tb = gNodeB.getTxSIB(nextWriteTime().FN());
 	//printf("BCHFEC::generate calling writeHighSide\n"); fflush(stdout);
 	//LOG(NOTICE) << "BCH TB.time="<<tb->time() <<" clock="<<gNodeB.clock().FN() <<" t="<< format("%.2f",timef());
-	l1WriteHighSide(*tb);
+	if (!mPrecodeInited) { bchInitPrecode(); }
+	if (mPrecoded && bchPrecodedFrames(*tb)) {
+		l1WriteHighSideCoded(*tb,mOut,mTfci);
+	} else {
+		l1WriteHighSide(*tb);
+	}
+	mFrameTime.addPoint(timef() - start);
+}
+
+void BCHFEC::bchText(std::ostream &os)
+{
+	os << "BCH frame:     " << mFrameTime << "\n";
+	os << "BCH TB coding: " << mCodeTime << "\n";
+	os << LOGVAR2("precoded",mPrecoded) << "\n";
 }
 
 
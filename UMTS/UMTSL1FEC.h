@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 #include <BitVector.h>
+#include <Utils.h>
 #include <TurboCoder.h>
 #include <Interthread.h>
 #include "GSMCommon.h"
@@ -690,10 +691,40 @@ class TrCHFECDecoderTurbo : public TrCHFECDecoder
 class BCHFEC : public PhChDownlink, public L1FEC_t
 {
 	Thread mServiceThread;
+
+	// Pre-coded BCH frames.
+	// The beacon is the same every cycle except the sfn-Prime in the first 11 bits of each TB,
+	// and the BCH channel coding (CRC, convolutional code, interleaving) is affine over GF(2),
+	// so the coded frames for a TB are the coded frames for the TB with those bits zeroed,
+	// xored with a precomputed delta for each of those bits that is set.
+	// We code each TB of the beacon once per beacon change and thereafter just xor in the SFN.
+	static const unsigned sNumRF = 2;			// Radio frames per BCH TTI.
+	static const unsigned sNumCodedTti = 16;	// TBs per beacon cycle: 32 frames / TTI 20ms.
+	static const unsigned sSfnBits = 11;		// The bits at the start of the TB that change every cycle.
+	struct CodedTti {
+		const TransportBlock *mTb;	// The beacon TB these frames came from,
+		unsigned mGeneration;		// and the beacon generation.
+		BitVector mFrames[sNumRF];
+		CodedTti() : mTb(0), mGeneration(0) {}
+	};
+	CodedTti mCoded[sNumCodedTti];
+	BitVector mSfnDelta[sSfnBits][sNumRF];
+	BitVector mOut[sNumRF];
+	int mTfci;
+	bool mPrecodeInited;
+	bool mPrecoded;				// False if the precoded frames did not match the real encoder.
+	LatencyHistogram mFrameTime;	// CPU time per BCH frame.
+	LatencyHistogram mCodeTime;		// CPU time to code a new beacon TB.
+
+	void bchCodeFrames(const TransportBlock &tb, BitVector *frames);
+	void bchInitPrecode();
+	bool bchPrecodedFrames(const TransportBlock &tb);
+
 	public:
 	BCHFEC(ARFCNManager *wRadio) :
 		PhChDownlink(PCCPCHType,256,1,wRadio),			// Fixed by the UMTS spec
-		L1FEC_t(this)
+		L1FEC_t(this),
+		mTfci(0), mPrecodeInited(false), mPrecoded(false)
 	{
 		DEBUGF("construct BCHFEC\n");
 #if USE_OLD_FEC
@@ -715,6 +746,7 @@ class BCHFEC : public PhChDownlink, public L1FEC_t
 
 	void start();
 	void generate();
+	void bchText(std::ostream &os);
 };
 
 
@@ -19,6 +19,7 @@
 #include "URRCDefs.h"
 
 #include "ControlCommon.h"
+#include "ControlEngine.h"
 #include <GSML3MMMessages.h>
 
 namespace UMTS {
@@ -63,6 +64,9 @@ void LogicalChannel::l3writeHighSide(ByteVector &msg)
         //Control::DCCHDispatchMessage(msg2,thisChan);
         //delete msg2;
 	mL3RxQ.write(frame3);
+	// If a control machine is running a transaction on this channel, it reads the frame;
+	// otherwise the frame starts a new transaction in the DCCH dispatcher.
+	if (gControlEngine.post(this,Control::ControlMachine::L3Event)) return;
 	gDCCHLogicalChannelFIFO.write(dynamic_cast<UMTS::DCCHLogicalChannel*>(this));
 }
 
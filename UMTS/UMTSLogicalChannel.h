@@ -322,15 +322,18 @@ class DTCHLogicalChannel : public LogicalChannel {
 
 	public:
 	
-	DTCHLogicalChannel();
+	DTCHLogicalChannel() {}
 
 	ChannelTypeL3 type() const { return DTCHType; }
 
-	void sendTCH(const unsigned char* frame) {}// FIXME: stubbed out
+	// The speech frames go through these, so a channel with a vocoder path overrides them.
 
-	unsigned char* recvTCH() { return NULL;} // FIXME: stubbed out
+	virtual void sendTCH(const unsigned char* frame) {}// FIXME: stubbed out
 
-	unsigned queueSize() const { return 0; } // FIXME: stubbed out
+	/** The next uplink speech frame, allocated with new[], or NULL. */
+	virtual unsigned char* recvTCH() { return NULL;} // FIXME: stubbed out
+
+	virtual unsigned queueSize() const { return 0; } // FIXME: stubbed out
 
 	bool radioFailure() const {return false;} // FIXME: stubbed out
 };
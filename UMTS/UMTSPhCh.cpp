@@ -600,7 +600,7 @@ ASN::DL_DPCH_InfoPerRL *PhCh::toAsnDL_DPCH_InfoPerRL()
 		DORKINESS(512)
 		default:assert(0);
 	}
-	ASN_SEQUENCE_ADD(&result->choice.fdd.dl_ChannelisationCodeList,one);
+	RN_SEQUENCE_ADD(&result->choice.fdd.dl_ChannelisationCodeList,one);
 
 	// This is for multiple radio links, and we will never use it, so just default it:
 	// TPC_CombinationIndex_t   tpc_CombinationIndex;
@@ -630,7 +630,7 @@ ASN::DL_InformationPerRL_List * PhCh::toAsnDL_InformationPerRL_List()
 
 	// struct SCCPCH_InfoForFACH   *dummy  /* OPTIONAL */;
 
-	ASN_SEQUENCE_ADD(&result->list,one);
+	RN_SEQUENCE_ADD(&result->list,one);
 	return result;
 }
 
@@ -191,6 +191,7 @@ class PhCh
 	unsigned getSpCode() const { return mSpCode; }
 	unsigned SrCode() const { return mSrCode; }	// old name
 	unsigned getSrCode() const { return mSrCode; }
+	int getUlPuncturingLimit() const { return mUlPuncturingLimit; }
 	ARFCNManager *getRadio() const { return mRadio; }
 
 	// Uplink uses 2 bit tfci on both RACH and DCH.
@@ -244,7 +244,7 @@ void URlcRecv::rlcSendHighSide(URlcUpSdu *sdu)
 // and doesnt make sense for what I know - the C-RNTI is only used on phy, not up here.
 // Update: maybe the ue-id type indicator is used when the controlling RNC != serving RNC, which we never do.
 // nope: We're going to use CNF for both Confirmation and Discard requests.
-void URlcTrans::rlcWriteHighSide(ByteVector &data, bool DiscardReq, unsigned MUI,string descr)
+void URlcTrans::rlcWriteHighSide(ByteVector &data, bool DiscardReq, unsigned MUI,string descr, bool handoff)
 {
 	RLCLOG("rlcWriteHighSide sizebytes=%d rbid=%d descr=%s",
 		data.size(),mrbid,descr.c_str());
@@ -253,7 +253,8 @@ void URlcTrans::rlcWriteHighSide(ByteVector &data, bool DiscardReq, unsigned MUI
 	//ByteVector cloneData;
 	//cloneData.clone(data);
 	//URlcDownSdu *sdu = new URlcDownSdu(cloneData,DiscardReq,MUI,descr);
-	URlcDownSdu *sdu = new URlcDownSdu(data,DiscardReq,MUI,descr);
+	// The GGSN hands off the buffer it read the packet into, so user data arrives here without a copy.
+	URlcDownSdu *sdu = handoff ? new URlcDownSdu(data,DiscardReq,MUI,descr,true) : new URlcDownSdu(data,DiscardReq,MUI,descr);
 	RN_MEMLOG(URlcDownSdu,sdu);
 	ScopedLock lock(mQLock);
 	//printf("pushing SDU of size: %u, addr: %0x, descr=%s\n",data.size(),sdu,descr.c_str());
@@ -287,6 +288,7 @@ void URlcTrans::rlcWriteHighSide(ByteVector &data, bool DiscardReq, unsigned MUI
 		//sdu->mDiscarded = true;
 		//mSduTxQ.push_front(sdu);
 	}
+	sduQChanged();
 }
 
 // About the LI Length Indicator field.
@@ -531,6 +533,7 @@ bool URlcTransAmUm::fillPduData(URlcPdu *result,
 	if (remaining) {
 		result->appendFill(0,remaining);
 	}
+	sduQChanged();
 	mVTPDU++;
 	return mSduDiscarded;
 }
@@ -542,7 +545,9 @@ URlcBasePdu *URlcTransAmUm::rlcReadLowSide()
 	URlcPdu *pdu;
 	if (mRlcState == RLC_STOP) {return NULL;}
 	bool wasqueued = true;
-	if (! (pdu = mPduOutQ.readNoBlock())) {
+	if ((pdu = mPduOutQ.readNoBlock())) {
+		pduQChanged();
+	} else {
 		pdu = readLowSidePdu();
 		wasqueued = false;
 	}
@@ -564,11 +569,13 @@ URlcBasePdu *URlcTransTm::rlcReadLowSide()
 		if (sdu->mDiscarded) {
 			sdu->free();
 		} else {
+			sduQChanged();
 			RLCLOG("readlLowSide(sizebits=%d,descr=%s,rb=%d)",
 				sdu->sizeBits(), sdu->mDescr.c_str(),mrbid);
 			return sdu;
 		}
 	  }
+	  sduQChanged();
 	}
 	return NULL;	// Shouldnt happen - MAC should check q size first.
 }
@@ -579,8 +586,9 @@ void URlcTransAmUm::rlcPullLowSide(unsigned amt)
 {
 	URlcPdu *vec;
 	int cnt = 0;
-	while (mPduOutQ.totalSize() < amt && ((vec = readLowSidePdu())) ) {
+	while (mPduQBytes < amt && ((vec = readLowSidePdu())) ) {
 		mPduOutQ.write(vec);
+		pduQChanged();
 		cnt++;
 		//LOG(INFO) << "amt: " << amt << " sz: " << mPduOutQ.totalSize();
 	}
@@ -1374,6 +1382,7 @@ void URlcTransAmUm::transDoReset()
 		mSplitSdu->free();
 		mSplitSdu = NULL;
 	}
+	sduQChanged();
 }
 
 void URlcTransAm::transAmInit()
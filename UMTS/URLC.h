@@ -450,6 +450,11 @@ struct URlcDownSdu : public URlcBasePdu
 		URlcBasePdu(wData,wDescr), mDiscarded(0), mDiscardReq(wDR),
 		mMUI(wMUI), mNext(0)
 		{}
+	// This one takes over the memory of wData, which is left empty; see rlcWriteHighSide.
+	URlcDownSdu(ByteVector &wData, bool wDR, unsigned wMUI, string wDescr, bool) :
+		URlcBasePdu(0u,wDescr), mDiscarded(0), mDiscardReq(wDR),
+		mMUI(wMUI), mNext(0)
+		{ transfer(wData); }
 
 	// This class is always used by pointer and manually deleted, so no copy constructor
 	// is needed.
@@ -638,6 +643,16 @@ class URlcTrans : public virtual URlcBase
 	virtual bool pdusFinished() = 0;
 	unsigned rlcGetSduQBytesAvail();
 
+	// Running counts of the downlink backlog for MAC.  MAC asks several times per TTI per UE,
+	// so instead of walking the queues to ask them, every place that changes a queue updates these.
+	// They are all updated and read under mQLock, so MAC sees the byte and PDU counts of the same moment.
+	unsigned mSduQBytes, mSduQCnt;	// mSduTxQ plus mSplitSdu.
+	unsigned mPduQBytes, mPduQCnt;	// The AM/UM mPduOutQ.
+	void sduQChanged() {	// Caller must hold mQLock.
+		mSduQBytes = mSduTxQ.totalSize() + (mSplitSdu ? mSplitSdu->size() : 0);
+		mSduQCnt = mSduTxQ.size() + (mSplitSdu ? 1 : 0);
+	}
+
 	// If exceeded we have to throw away some SDUs.
 	// Where is this in the spec?
 	unsigned mTransmissionBufferSizeBytes;
@@ -647,10 +662,22 @@ class URlcTrans : public virtual URlcBase
 	URlcTrans();
 
 	virtual unsigned rlcGetBytesAvail() = 0;
+	// O(1) versions of rlcGetBytesAvail and rlcGetPduCnt for MAC; see mSduQBytes.
+	// One lock per call, so MAC takes it once per RB per TTI.
+	void rlcGetBacklog(unsigned *bytes, unsigned *pdus) {
+		ScopedLock lock(mQLock);
+		if (mRlcState == RLC_STOP) { *bytes = *pdus = 0; return; }
+		*bytes = mSduQBytes + mPduQBytes;
+		// In TM the SDUs are the PDUs.
+		*pdus = mRlcMode == URlcModeTm ? mSduQCnt : mPduQCnt;
+	}
+	unsigned rlcBacklogBytes() { unsigned bytes, pdus; rlcGetBacklog(&bytes,&pdus); return bytes; }
 
 	// Higher layer sends something to RLC. Same function for all modes:
 	// put in the queue, but check for overflow.
-	void rlcWriteHighSide(ByteVector &sdu, bool DR, unsigned MUI, string descr);
+	// The SDU shares the memory of sdu, unless handoff, in which case it takes it over and sdu is left empty.
+	// Use handoff when sdu comes from another thread, because the refcnt in the shared memory is not atomic.
+	void rlcWriteHighSide(ByteVector &sdu, bool DR, unsigned MUI, string descr, bool handoff=false);
 
 	// The mutex lock for both of these is in URlcTransAm::readLowSidePdu()
 	virtual void rlcPullLowSide(unsigned amt) = 0;
@@ -669,7 +696,7 @@ class URlcTrans : public virtual URlcBase
 	virtual void text(std::ostream &os) = 0;
 };
 #if URLC_IMPLEMENTATION
-	URlcTrans::URlcTrans() : mSplitSdu(0), mVTSDU(0) {
+	URlcTrans::URlcTrans() : mSplitSdu(0), mVTSDU(0), mSduQBytes(0), mSduQCnt(0), mPduQBytes(0), mPduQCnt(0) {
 		mTransmissionBufferSizeBytes = gConfig.getNum("UMTS.RLC.TransmissionBufferSize");
 	}
 	unsigned URlcTrans::rlcGetSduQBytesAvail() {
@@ -753,6 +780,7 @@ class URlcTransAmUm : // Transmit common to AM and UM modes.
 	void rlcPullLowSide(unsigned amt);
 	unsigned rlcGetPduCnt() { return mPduOutQ.size(); }
 	bool pdusFinished();
+	void pduQChanged() { ScopedLock lock(mQLock); mPduQBytes = mPduOutQ.totalSize(); mPduQCnt = mPduOutQ.size(); }
 
 	public:
 	// This class is not allocated alone; it is part of URlcTransAm or URlcTransUm.
@@ -826,7 +826,7 @@ unsigned UEInfo::getDlDataBytesAvail(unsigned *uePriority)
 {
 	// We are assuming that priority increases with RbId.
 	RN_UE_FOR_ALL_RLC_DOWN(this,rbid,rlcp) {
-		unsigned bytes = rlcp->rlcGetBytesAvail();
+		unsigned bytes = rlcp->rlcBacklogBytes();
 		if (bytes) {
 			*uePriority = rbid;
 			return bytes;
@@ -835,6 +835,19 @@ unsigned UEInfo::getDlDataBytesAvail(unsigned *uePriority)
 	return 0;
 }
 
+void UEInfo::ueGetDlBacklog(DlBacklogSnapshot *snap)
+{
+	snap->clear();
+	RN_UE_FOR_ALL_RLC_DOWN(this,rbid,rlcp) {
+		unsigned bytes, pdus;
+		rlcp->rlcGetBacklog(&bytes,&pdus);
+		snap->mBytes[rbid] = bytes;
+		snap->mPdus[rbid] = pdus;
+		snap->mTotalBytes += bytes;
+		if (bytes && rbid < snap->mPriority) { snap->mPriority = rbid; }
+	}
+}
+
 void UEInfo::uePullLowSide(unsigned amt)
 {
 	RN_UE_FOR_ALL_RLC_DOWN(this,rbid,rlcp) {
@@ -860,12 +873,13 @@ void UEInfo::msWriteHighSide(ByteVector &dlpdu, uint32_t rbid, const char *descr
 			delete result;
 		}
 	} else {
-		ueWriteHighSide((RbId) rbid, dlpdu, descr);
+		// User data from the GGSN thread.  The rlc takes the buffer, so dlpdu is empty after this.
+		ueWriteHighSide((RbId) rbid, dlpdu, descr, true);
 	}
 }		
 
 
-void UEInfo::ueWriteHighSide(RbId rbid, ByteVector &sdu, string descr)
+void UEInfo::ueWriteHighSide(RbId rbid, ByteVector &sdu, string descr, bool handoff)
 {
 	ueRegisterActivity();
 	PATLOG(1,format("ueWriteHighSide(%d,sizebytes=%d,%s)",rbid,sdu.size(),descr.c_str()));
@@ -877,7 +891,7 @@ void UEInfo::ueWriteHighSide(RbId rbid, ByteVector &sdu, string descr)
 		//delete sdu;
 		return;
 	}
-	rlc->rlcWriteHighSide(sdu,0,0,descr);
+	rlc->rlcWriteHighSide(sdu,0,0,descr,handoff);
 }
 
 // This is usually called from the SGSN or GGSN for SM PdpContextDeactivation
@@ -1198,6 +1212,7 @@ void RrcMasterChConfig::rrcConfigDchPS(DCHFEC *dch, int RABid, bool useTurbo)
 	// Define a simple multiplexed TrCh of width for dch.
 	if (this->mTrCh.dl()->getNumTrCh() == 0) {
 		this->mTrCh.configDchPS(dch, TTI10ms, 16, useTurbo, 340+40, 340);
+		this->mSignature = format("PS sf=%u,%u turbo=%d",dch->getUlSF(),dch->getDlSF(),useTurbo);
 	} else {
 		// TrCh setup already configured.
 		// We may be defining a second RAB for a second PDPContext.
@@ -1214,6 +1229,9 @@ void RrcMasterChConfig::rrcConfigDchPS(DCHFEC *dch, int RABid, bool useTurbo)
 
 	// Now what about the RAB?
 	assert(RABid >= 5 && RABid <= 15);
+	if (!this->mSignature.empty() && !((unsigned)RABid < mNumRB && mRB[RABid].valid())) {
+		this->mSignature += format(" rb%d",RABid);
+	}
 	//this->addRAB(rbid,CNDomainId)
 	// TODO: We may want to use RLC-UM for a PFT for TCP/UDP.  Clear?
 	this->setRB(RABid,PSDomain)->defaultConfigRlcAmPs();
@@ -1223,6 +1241,8 @@ void RrcMasterChConfig::rrcConfigDchPS(DCHFEC *dch, int RABid, bool useTurbo)
 // The DCH must be SF=128 or higher.
 void RrcMasterChConfig::rrcConfigDchCS(DCHFEC *dch)
 {
+	// RBs left over from another kind of config would stay in it.
+	bool fresh = mNumRB == 0 || mSignature == "CS";
 	this->mTrCh.defaultConfig3TrCh();
 	this->setSRB(1)->defaultConfig3Rb(1);
 	this->setSRB(2)->defaultConfig3Rb(2);
@@ -1231,6 +1251,7 @@ void RrcMasterChConfig::rrcConfigDchCS(DCHFEC *dch)
 	this->setRB(5,CSDomain)->defaultConfig3Rb(5);
 	this->setRB(6,CSDomain)->defaultConfig3Rb(6);
 	this->setRB(7,CSDomain)->defaultConfig3Rb(7);
+	this->mSignature = fresh ? "CS" : "";
 }
 
 // This is the entry point to send the big RB setup message for a PS (internet) data connection,
@@ -97,6 +97,10 @@ class RrcMasterChConfig : public RrcDefs
 	// This is used just to limit the loops that look through them.
 	unsigned mNumRB;
 
+	// What went into this config, for the RadioBearerSetup template key.
+	// Empty if the config was built some other way, in which case the message is not templated.
+	std::string mSignature;
+
 	RrcMasterChConfig():
 		mNumRB(0)
 		{}
@@ -279,6 +283,17 @@ struct UeTransaction : UEDefs
 // T314: 12sec, used for CS connection, timeout to idle mode after radio link failure.
 // T315: 180sec, used for PS connection, timeout to idle mode after radio link failure.
 // T319: unspecified, when to start DRX mode after entering CELL_PCH or URA_PCH state.
+// The downlink backlog of one UE, read from the RLC running counters.
+// MAC takes one of these per UE per TTI and does TFC selection from it, instead of querying the RLCs
+// over and over, and the total is the per-UE backlog.
+struct DlBacklogSnapshot {
+	unsigned mBytes[gsMaxRB];	// Bytes waiting on each rb, SDUs plus PDUs.
+	unsigned mPdus[gsMaxRB];	// PDUs ready to send on each rb.
+	unsigned mTotalBytes;		// Sum of mBytes.
+	unsigned mPriority;			// The lowest rbid with data, which is the highest priority, or gsMaxRB if none.
+	void clear() { memset(this,0,sizeof(*this)); mPriority = gsMaxRB; }
+};
+
 static int sNextUeDebugId = 1;	// Each UE gets a human-readable id for log messages.
 class UEInfo : public SGSN::MSUEAdapter, public UEDefs 
 {
@@ -403,7 +418,8 @@ class UEInfo : public SGSN::MSUEAdapter, public UEDefs
 	}
 
 	// Write bytes to the high side of the rlc on rbid.
-	void ueWriteHighSide(RbId rbid, ByteVector &sdu, string descr);
+	// If handoff the rlc takes over the memory of sdu; see URlcTrans::rlcWriteHighSide.
+	void ueWriteHighSide(RbId rbid, ByteVector &sdu, string descr, bool handoff=false);
 	// Write bits to the low side of the rlc on rbid for the two possible channels.
 	// There are two functions because we have two sets or RLCs simultaneously
 	// when changing the UE state - see gigantic comment above.
@@ -459,6 +475,8 @@ class UEInfo : public SGSN::MSUEAdapter, public UEDefs
 	// MAC Interface:
 	// Return the number of bytes waiting in the highest priority queue for this UE.
 	unsigned getDlDataBytesAvail(unsigned *uePriority);
+	// Take a snapshot of the downlink backlog on every rb.  MAC does this once per TTI and works from that.
+	void ueGetDlBacklog(DlBacklogSnapshot *snap);
 
 	// Return the size of the waiting pdu, and how many pdus.
 	// Note that for TM entities, not all pdus may be the same size.
@@ -41,8 +41,10 @@ extern int rrcDebugLevel;
 //#define PATLOG(level,msg) if (level & rrcDebugLevel) std::cout << msg <<"\n";
 #define PATLOG(level,msg) if (level & rrcDebugLevel) LOG(INFO) << msg;
 
+// Same as in AsnHelper.h: allocate in the current AsnArena, if any.
+extern void *rnAsnCalloc(size_t size);
 #ifndef RN_CALLOC
-#define RN_CALLOC(type) ((type*)calloc(1,sizeof(type)))
+#define RN_CALLOC(type) ((type*)UMTS::rnAsnCalloc(sizeof(type)))
 #endif
 #ifndef RN_BOUND
 // Bound value between min and max values.
@@ -20,6 +20,8 @@
 #include "SgsnExport.h"
 #include "URRC.h"
 #include "UMTSLogicalChannel.h"
+#include "URRCMsgTemplate.h"
+#include <GSML3CommonElements.h>
 //#include "asn_system.h"	included from AsnHelper.h
 namespace ASN {
 //#include "BIT_STRING.h"
@@ -28,6 +30,7 @@ namespace ASN {
 #include "UL-DCCH-Message.h"
 #include "DL-DCCH-Message.h"
 #include "InitialUE-Identity.h"
+#include "PCCH-Message.h"
 #define PAT_SAMSUNG_TEST 1	// Try to get the samsung galaxy to accept this message.
 
 #include "asn_SEQUENCE_OF.h"
@@ -42,6 +45,7 @@ using namespace SGSN;
 namespace UMTS {
 const std::string descrRrcConnectionSetup("RRC_Connection_Setup_Message");
 const std::string descrRrcConnectionRelease("RRC_Connection_Release_Message");
+const std::string descrPagingType1("Paging_Type_1_Message");
 const std::string descrRadioBearerSetup("RRC Radio Bearer Setup Message");
 const std::string descrRadioBearerRelease("RRC Radio Bearer Release Message");
 const std::string descrCellUpdateConfirm("RRC Cell Update Confirm Message");
@@ -153,7 +157,8 @@ ASN::RRC_StateIndicator UEState2Asn(UEState state)
 
 // Run the Integrity Protection Algorithm and ASN encode the message.
 // Return result in &result.
-static bool encodeDcchMsg(UEInfo *uep, RbId rbid, ASN::DL_DCCH_Message_t *msg, ByteVector &result, string descr)
+// The startTime is when the caller started building the message, for the encode latency statistics.
+static bool encodeDcchMsg(UEInfo *uep, RbId rbid, ASN::DL_DCCH_Message_t *msg, ByteVector &result, string descr, double startTime)
 {
 	if (uep->integrity.isStarted()) {
 		// Step 1: Set the integrity check info to the values for encoding specified in 10.3.3.16.
@@ -186,6 +191,7 @@ static bool encodeDcchMsg(UEInfo *uep, RbId rbid, ASN::DL_DCCH_Message_t *msg, B
 
 	// Encode the message (again), completely oblivious to cpu cycles consumed.
 	if (!uperEncodeToBV(&ASN::asn_DEF_DL_DCCH_Message,msg,result,descr)) {return false;}
+	gRrcMsgTemplates.addEncodeTime(descr,false,timef() - startTime);
 
 	std::string comment = format("DL_DCCH %s message size=%d",descr.c_str(),result.size());
 	asnLogMsg(rbid, &ASN::asn_DEF_DL_DCCH_Message, msg,comment.c_str(),uep);
@@ -203,12 +209,14 @@ static bool encodeDcchMsg(UEInfo *uep, RbId rbid, ASN::DL_DCCH_Message_t *msg, B
 static bool encodeCcchMsg(ASN::DL_CCCH_Message_t *msg, ByteVector &result,
 	string descr,	// Description for the log
 	UEInfo *uep,	// UE for the log, or NULL if none.
-	uint32_t urnti	// URNTI for the log, unneeded if uep is non-null.
+	uint32_t urnti,	// URNTI for the log, unneeded if uep is non-null.
+	double startTime	// When the caller started building the message, for statistics.
 	)
 {
 	// We can just return: uperEncodeToBV printed a message on failure.
 	bool stat = uperEncodeToBV(&ASN::asn_DEF_DL_CCCH_Message,msg,result,descr);
 	if (stat) {
+		gRrcMsgTemplates.addEncodeTime(descr,false,timef() - startTime);
 		string comment = format("DL_CCCH %s message size=%d",descr.c_str(),result.size());
 		asnLogMsg(0, &ASN::asn_DEF_DL_CCCH_Message, msg,comment.c_str(),uep,urnti);
 	}
@@ -220,6 +228,48 @@ static bool encodeCcchMsg(ASN::DL_CCCH_Message_t *msg, ByteVector &result,
 	return stat;
 }
 
+// Add the IntegrityCheckInfo to a message being built for a template.
+// The MAC-I and RRC SN are template fields; see encodeDcchMsgFromTemplate.
+static void templateIntegrityCheckInfo(ASN::DL_DCCH_Message_t *msg, const uint32_t *values)
+{
+	ASN::IntegrityCheckInfo *ici = RN_CALLOC(ASN::IntegrityCheckInfo);
+	msg->integrityCheckInfo = ici;
+	ici->messageAuthenticationCode = allocAsnBIT_STRING(32);
+	AsnBitString2BVTemp(ici->messageAuthenticationCode).setField(0,values[rtfMacI],32);
+	ici->rrc_MessageSequenceNumber = values[rtfRrcSn];
+}
+
+// Same as encodeDcchMsg but from a pre-encoded template.
+// The builder must call templateIntegrityCheckInfo if integrity protection is started.
+// Return false if the message could not be templated, in which case the caller builds it the old way.
+static bool encodeDcchMsgFromTemplate(UEInfo *uep, RbId rbid, string key, unsigned *widths,
+	RrcMsgBuilder builder, void *context, uint32_t *values, ByteVector &result, string descr, double startTime)
+{
+	bool integrity = uep->integrity.isStarted();
+	if (integrity) {
+		widths[rtfMacI] = 32;
+		widths[rtfRrcSn] = 4;
+		key += " integrity";
+	}
+	// Same as encodeDcchMsg: first encode with MAC-I = rbid and RRC SN = 0 as per 10.3.3.16, run f9 over that.
+	values[rtfMacI] = rbid;
+	values[rtfRrcSn] = 0;
+	if (!gRrcMsgTemplates.instantiate(key,&ASN::asn_DEF_DL_DCCH_Message,widths,builder,context,values,result,descr.c_str())) {
+		return false;
+	}
+	if (integrity) {
+		values[rtfMacI] = uep->integrity.runF9(rbid,1,result);
+		values[rtfRrcSn] = uep->integrity.getDlRrcSn(rbid); // 10.3.3.16 of 25.331
+		uep->integrity.advanceDlRrcSn(rbid);
+		if (!gRrcMsgTemplates.instantiate(key,&ASN::asn_DEF_DL_DCCH_Message,widths,builder,context,values,result,descr.c_str())) {
+			return false;	// Cant happen, we just used it.
+		}
+	}
+	gRrcMsgTemplates.addEncodeTime(descr,true,timef() - startTime);
+	LOG(INFO) << uep << format(" DL_DCCH %s message size=%d (template)",descr.c_str(),result.size());
+	return true;
+}
+
 
 // Same as RB_InformationSetup but without PDCP info.
 // The list we put these things in may be either SRB_InformationSetupList or SRB_InformationSetupList2,
@@ -241,7 +291,7 @@ static void toAsnSRB_InformationSetupList(RrcMasterChConfig *masterConfig, void*
 		TrChId tcid = rb->mTrChAssigned;
 		defaultRbMappingInfoToAsn(masterConfig->getUlTrChInfo(tcid),
 			masterConfig->getDlTrChInfo(tcid),rbid,&srbie->rb_MappingInfo);
-		ASN_SEQUENCE_ADD(srblist,srbie);
+		RN_SEQUENCE_ADD(srblist,srbie);
 	}
 }
 
@@ -266,7 +316,7 @@ static ASN::RB_InformationAffectedList *toAsnRB_InformationAffectedList(
 		TrChId tcid = rb->mTrChAssigned;
 		defaultRbMappingInfoToAsn(masterConfig->getUlTrChInfo(tcid),
 			masterConfig->getDlTrChInfo(tcid),rbid,&srbie->rb_MappingInfo);
-		ASN_SEQUENCE_ADD(&result->list,srbie);
+		RN_SEQUENCE_ADD(&result->list,srbie);
 	}
 	return result;
 }
@@ -278,7 +328,7 @@ static void toAsnRAB_Identity(int rbid,ASN::RAB_Identity_t *rabp)
 	// because we dont use it and the phone shouldnt care, although it may need to be unique,
 	// which we can insure simply by using the rbid.
 	rabp->present = ASN::RAB_Identity_PR_gsm_MAP_RAB_Identity;
-	setAsnBIT_STRING(&rabp->choice.gsm_MAP_RAB_Identity,(uint8_t*)calloc(1,1),8);
+	setAsnBIT_STRING(&rabp->choice.gsm_MAP_RAB_Identity,(uint8_t*)rnAsnCalloc(1),8);
 	AsnBitString2BVTemp(&rabp->choice.gsm_MAP_RAB_Identity).setField(0,rbid,8);
 }
 
@@ -355,7 +405,7 @@ static ASN::RAB_InformationSetup *toAsnRAB_InformationSetup(
 		rb = masterConfig->getRB(rbid);
 		// 3GPP 10.3.4.20
 		ASN::RB_InformationSetup *rbInfoIE = toAsnRB_InformationSetup(masterConfig, rb);
-		ASN_SEQUENCE_ADD(&result->rb_InformationSetupList.list,rbInfoIE);
+		RN_SEQUENCE_ADD(&result->rb_InformationSetupList.list,rbInfoIE);
 	}
 	return result;
 }
@@ -375,7 +425,7 @@ static void toAsnRAB_InformationSetupList(RrcMasterChConfig *masterConfig, ASN::
 		int numRBperRAB;
 		ASN::RAB_InformationSetup *rabSetupIE =
 			toAsnRAB_InformationSetup(masterConfig, rbid, &numRBperRAB);
-		ASN_SEQUENCE_ADD(&rbSetupListIE->list,rabSetupIE);
+		RN_SEQUENCE_ADD(&rbSetupListIE->list,rabSetupIE);
 		rbid += numRBperRAB;	// Advance by the number of rbids used by this RAB.
 	}
 }
@@ -441,7 +491,7 @@ ASN::UL_AddReconfTransChInfoList *toAsnUL_AddReconfTransChInfoList(RrcMasterChCo
 		// TransportFormatSet_t     transportFormatSet;
 		masterConfig->getUlTfs()->toAsnTfs(&addTcIE->transportFormatSet);
 
-		ASN_SEQUENCE_ADD(&result->list,addTcIE);
+		RN_SEQUENCE_ADD(&result->list,addTcIE);
 	}
 	return result;
 }
@@ -465,7 +515,7 @@ static void toAsnFakeUL_AddReconfTransChInfoList(ASN::UL_AddReconfTransChInfoLis
 	// This does not work; asn_CHOICE does not except PR_NOTHING, anywhere!
 	//dummyUlDCH->transportFormatSet.present = ASN::TransportFormatSet_PR_NOTHING;
 	ulfoo.getTfs()->toAsnTfs(&dummyUlDCH->transportFormatSet);
-	ASN_SEQUENCE_ADD(&ulchlist->list,dummyUlDCH);
+	RN_SEQUENCE_ADD(&ulchlist->list,dummyUlDCH);
 }
 
 static ASN::DL_AddReconfTransChInfoList *toAsnDL_AddReconfTransChInfoList(RrcMasterChConfig *masterConfig)
@@ -499,7 +549,7 @@ static ASN::DL_AddReconfTransChInfoList *toAsnDL_AddReconfTransChInfoList(RrcMas
 		// .. struct TM_SignallingInfo    *dummy  /* OPTIONAL */;
 		// ^^ struct DL_AddReconfTransChInformation__tfs_SignallingMode {...} tfs_SignallingMode;
 
-		ASN_SEQUENCE_ADD(&result->list,addTcIE);
+		RN_SEQUENCE_ADD(&result->list,addTcIE);
 		// ^ struct DL_AddReconfTransChInfoList
 	}
 	return result;
@@ -521,11 +571,13 @@ void toAsnDL_AddReconfTransChInfoListSameAsUl(
 	asn_long2INTEGER(&dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelType,
 				ASN::UL_TrCH_Type_dch);
 	dummyDlDCH->tfs_SignallingMode.choice.sameAsULTrCH.ul_TransportChannelIdentity = ultcid;
-	ASN_SEQUENCE_ADD(&dlchlist->list,dummyDlDCH);
+	RN_SEQUENCE_ADD(&dlchlist->list,dummyDlDCH);
 }
 
 ByteVector* sendDirectTransfer(UEInfo* uep, ByteVector &dlpdu, const char *descr, bool psDomain)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	ASN::DL_DCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
 	msg.message.present = ASN::DL_DCCH_MessageType_PR_downlinkDirectTransfer;
@@ -540,15 +592,15 @@ ByteVector* sendDirectTransfer(UEInfo* uep, ByteVector &dlpdu, const char *descr
 
 	ByteVector *result = new ByteVector(dlpdu.size()+100);
 	RN_MEMLOG(ByteVector,result);
-	if (!encodeDcchMsg(uep,SRB3,&msg,*result,descr)) {return NULL;}
+	if (!encodeDcchMsg(uep,SRB3,&msg,*result,descr,startTime)) {return NULL;}
 	return result;
 }
 
 static void toAsnURNTI(ASN::U_RNTI_t *urnti,unsigned srncid,unsigned srnti)
 {
-	setAsnBIT_STRING(&urnti->srnc_Identity,(uint8_t*)calloc(1,2),12);
+	setAsnBIT_STRING(&urnti->srnc_Identity,(uint8_t*)rnAsnCalloc(2),12);
 	AsnBitString2BVTemp(urnti->srnc_Identity).setField(0,srncid,12);
-	setAsnBIT_STRING(&urnti->s_RNTI,(uint8_t*)calloc(1,3),20);
+	setAsnBIT_STRING(&urnti->s_RNTI,(uint8_t*)rnAsnCalloc(3),20);
 	AsnBitString2BVTemp(urnti->s_RNTI).setField(0,srnti,20);
 }
 
@@ -557,7 +609,7 @@ static ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti)
 	// C_RNTI_t    *new_c_RNTI /* OPTIONAL */;
 	ASN::C_RNTI_t *result  = RN_CALLOC(ASN::C_RNTI_t);
 	// new_c_RNTI is a BIT_STRING_t
-	setAsnBIT_STRING(result,(uint8_t*)calloc(1,2),16);
+	setAsnBIT_STRING(result,(uint8_t*)rnAsnCalloc(2),16);
 	AsnBitString2BVTemp(result).setField(0,crnti,16);
 	return result;
 }
@@ -577,6 +629,8 @@ static ASN::C_RNTI_t *toAsnCRNTI(unsigned crnti)
 // so 11-16-2012 tried switching to release 4 version.
 void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	ASN::DL_CCCH_Message msg;
 	memset(&msg,0,sizeof(msg));
 	msg.message.present = ASN::DL_CCCH_MessageType_PR_rrcConnectionSetup;
@@ -684,7 +738,7 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 			// struct DL_InformationPerRL_List_r4  *dl_InformationPerRL_List   /* OPTIONAL */;
 		} // version 4
 
-		if (!encodeCcchMsg(&msg,result,descrRrcConnectionSetup,uep,0)) {return;}
+		if (!encodeCcchMsg(&msg,result,descrRrcConnectionSetup,uep,0,startTime)) {return;}
 
 		// Zero out the initialUE_Identity that we copied above so that there
 		// is only one copy of it and we dont try to free it twice.
@@ -773,7 +827,7 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 			int primarySC = gConfig.getNum("UMTS.Downlink.ScramblingCode");
 			one->modeSpecificInfo.choice.fdd.primaryCPICH_Info.primaryScramblingCode = primarySC;
 			//one->dl_DPCH_InfoPerRL = toAsnDL_DPCH_InfoPerRL();
-			ASN_SEQUENCE_ADD(&result2->list,one);
+			RN_SEQUENCE_ADD(&result2->list,one);
 			iep->dl_InformationPerRL_List = result2;*/
 
 		// struct FrequencyInfo    *frequencyInfo  /* OPTIONAL */;
@@ -781,7 +835,7 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 		// TODO: Do we need this?
 		// MaxAllowedUL_TX_Power_t *maxAllowedUL_TX_Power  /* OPTIONAL */;
 
-		if (!encodeCcchMsg(&msg,result,descrRrcConnectionSetup,uep,0)) {return;}
+		if (!encodeCcchMsg(&msg,result,descrRrcConnectionSetup,uep,0,startTime)) {return;}
 
 		// Zero out the initialUE_Identity that we copied above so that there
 		// is only one copy of it and we dont try to free it twice.
@@ -807,6 +861,8 @@ void sendRrcConnectionSetup(UEInfo *uep, ASN::InitialUE_Identity *ueInitialId)
 // Tell it to release the connection and start over.
 static void sendRrcConnectionReleaseCcch(int32_t urnti)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	ASN::DL_CCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
 	msg.message.present = ASN::DL_CCCH_MessageType_PR_rrcConnectionRelease;
@@ -821,13 +877,55 @@ static void sendRrcConnectionReleaseCcch(int32_t urnti)
 	m3->releaseCause = toAsnEnumerated(ASN::ReleaseCause_unspecified);	// TODO: What cause should we use?
 
 	ByteVector result(1000);
-	if (!encodeCcchMsg(&msg,result,descrRrcConnectionRelease,NULL,urnti)) {return;}
+	if (!encodeCcchMsg(&msg,result,descrRrcConnectionRelease,NULL,urnti,startTime)) {return;}
 	gMacSwitch.writeHighSideCcch(result,descrRrcConnectionRelease);
 }
 
+// 25.331 8.1.2: The PCCH message for one PCH block.
+// Everything paged here is a call or an SMS, so the domain is CS; we don't know which, so neither is the cause.
+bool encodePagingType1(const std::vector<GSM::L3MobileIdentity> &ids, ByteVector &result)
+{
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	ASN::PCCH_Message_t msg;
+	memset(&msg,0,sizeof(msg));
+	msg.message.present = ASN::PCCH_MessageType_PR_pagingType1;
+	ASN::PagingType1_t *m1 = &msg.message.choice.pagingType1;
+	m1->pagingRecordList = RN_CALLOC(ASN::PagingRecordList);
+	for (unsigned i=0; i<ids.size(); i++) {
+		const GSM::L3MobileIdentity &id = ids[i];
+		ASN::PagingRecord *record = RN_CALLOC(ASN::PagingRecord);
+		record->present = ASN::PagingRecord_PR_cn_Identity;
+		record->choice.cn_Identity.pagingCause = toAsnEnumerated(ASN::PagingCause_terminatingCauseUnknown);
+		record->choice.cn_Identity.cn_DomainIdentity = toAsnEnumerated(ASN::CN_DomainIdentity_cs_domain);
+		ASN::CN_PagedUE_Identity_t *ueid = &record->choice.cn_Identity.cn_pagedUE_Identity;
+		switch (id.type()) {
+			case GSM::IMSIType:
+				ueid->present = ASN::CN_PagedUE_Identity_PR_imsi_GSM_MAP;
+				setASN1SeqOfDigits(&ueid->choice.imsi_GSM_MAP,id.digits());
+				break;
+			case GSM::TMSIType:
+				ueid->present = ASN::CN_PagedUE_Identity_PR_tmsi_GSM_MAP;
+				ueid->choice.tmsi_GSM_MAP = allocAsnBIT_STRING(32);
+				AsnBitString2BVTemp(ueid->choice.tmsi_GSM_MAP).setField(0,id.TMSI(),32);
+				break;
+			default:
+				LOG(ERR) << "cannot page " << id;
+				continue;
+		}
+		RN_SEQUENCE_ADD(&m1->pagingRecordList->list,record);
+	}
+	if (m1->pagingRecordList->list.count==0) return false;
+	if (!uperEncodeToBV(&ASN::asn_DEF_PCCH_Message,&msg,result,descrPagingType1)) return false;
+	string comment = format("PCCH %s message size=%d",descrPagingType1.c_str(),result.size());
+	asnLogMsg(0, &ASN::asn_DEF_PCCH_Message, &msg,comment.c_str());
+	return true;
+}
+
 // This puts the phone in idle mode.
 void sendRrcConnectionRelease(UEInfo *uep) //, ASN::InitialUE_Identity *ueInitialId
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	// Create the RB Setup Message.
 	ASN::DL_DCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
@@ -857,7 +955,7 @@ void sendRrcConnectionRelease(UEInfo *uep) //, ASN::InitialUE_Identity *ueInitia
 	// struct Rplmn_Information    *rplmn_information  /* OPTIONAL */;
 
 	ByteVector result(1000);
-	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRrcConnectionRelease)) {return;}
+	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRrcConnectionRelease,startTime)) {return;}
 
 	// Prepare to receive the reply to this message:
 	UeTransaction(uep,UeTransaction::ttRrcConnectionRelease,0,transactionId,stIdleMode);
@@ -865,33 +963,14 @@ void sendRrcConnectionRelease(UEInfo *uep) //, ASN::InitialUE_Identity *ueInitia
 	uep->ueWriteHighSide(SRB2, result, descrRrcConnectionRelease);
 }
 
-// 3GPP 25.331 10.2.33
-// This is the main message to create DCH channels.
-// It is invoked by the SGSN to create a RAB for an internet connection.
-// It will also be invoked by GMM L3 to create CS connections.
-// In both cases a state machine in the caller must wait for the phones
-// response before proceeding.
-// 
-// We are sending a setup for a DCH and moving the UE to CELL_DCH state.
-// The masterConfig indicates the DCH L2 setup, for example, how many TrCh.
-// Return non-zero on error.
-bool sendRadioBearerSetup(UEInfo *uep, RrcMasterChConfig *masterConfig, PhCh *phch, bool srbstoo)
+// Fill in everything in a RadioBearerSetup except the transaction id.
+static void fillRadioBearerSetup(ASN::RadioBearerSetup_r3_IEs_t &rbs, RrcMasterChConfig *masterConfig, PhCh *phch,
+	bool srbstoo, bool haveDataCh)
 {
-	// Create the RB Setup Message.
-	ASN::DL_DCCH_Message_t msg;
-	memset(&msg,0,sizeof(msg));
-	msg.message.present = ASN::DL_DCCH_MessageType_PR_radioBearerSetup;
-	ASN::RadioBearerSetup_t &rbstop = msg.message.choice.radioBearerSetup;
-	// There are various versions of this message.  Lets use the oldest version:
-	rbstop.present = ASN::RadioBearerSetup_PR_r3;
-	ASN::RadioBearerSetup_r3_IEs_t &rbs = rbstop.choice.r3.radioBearerSetup_r3;
-
 	// =============== UE Information Elements ==============
 
 	// Comments are directly from the ASN::RadioBearerSetup_r3_IEs_t
-	// RRC_TransactionIdentifier_t  rrc_TransactionIdentifier;
-	unsigned transactionId = uep->newTransactionId();
-	rbs.rrc_TransactionIdentifier = transactionId;
+	// RRC_TransactionIdentifier_t  rrc_TransactionIdentifier;	set by the caller.
 
 	// struct IntegrityProtectionModeInfo  *integrityProtectionModeInfo    /* OPTIONAL */;
 	// struct CipheringModeInfo    *cipheringModeInfo  /* OPTIONAL */;
@@ -921,15 +1000,6 @@ bool sendRadioBearerSetup(UEInfo *uep, RrcMasterChConfig *masterConfig, PhCh *ph
 	// The RAB is where the new RBID for the data channel needs to go.
 	// struct RAB_InformationSetupList *rab_InformationSetupList   /* OPTIONAL */;
 
-
-	// The UE is allowed to request a PS channel on any of RBs 5..15, so check them all.
-	bool haveDataCh = false; // Does the config define any data channels?
-	RBInfo *rb;  unsigned rbid;
-	for (rbid = 5; rbid < masterConfig->mNumRB; rbid++) {
-		if (!(rb = masterConfig->getRB(rbid)) || !rb->valid()) { continue; }
-		haveDataCh = true;
-		break;
-	}
 	if (haveDataCh) {
 		// 3GPP 25.331 10.3.4.10 RAB Information for Setup.
 		// TODO: AMR rate defaults to "t7" - what is that?
@@ -995,14 +1065,130 @@ bool sendRadioBearerSetup(UEInfo *uep, RrcMasterChConfig *masterConfig, PhCh *ph
 
 	// struct DL_InformationPerRL_List *dl_InformationPerRL_List   /* OPTIONAL */;
 	rbs.dl_InformationPerRL_List = phch->toAsnDL_InformationPerRL_List();
+}
+
+// Template builder for RadioBearerSetup.
+// The message depends on the channel config and the kind of DCH, which go in the template key,
+// and on the codes of the DCH, which are template fields.
+struct RadioBearerSetupContext {
+	RrcMasterChConfig *mConfig;
+	PhCh *mPhCh;
+	bool mSrbsToo;
+	bool mHaveDataCh;
+	bool mIntegrity;
+};
+
+enum { rtfRbsUlScramblingCode = rtfFirstUser, rtfRbsDlChannelisationCode };
+
+// Set the downlink channelisation code in the list made by PhCh::toAsnDL_InformationPerRL_List.
+static void setAsnDlChannelisationCode(ASN::DL_InformationPerRL_List *rlList, unsigned code)
+{
+	ASN::DL_ChannelisationCode *one =
+		rlList->list.array[0]->dl_DPCH_InfoPerRL->choice.fdd.dl_ChannelisationCodeList.list.array[0];
+	switch (one->sf_AndCodeNumber.present) {
+	case ASN::SF512_AndCodeNumber_PR_sf4: one->sf_AndCodeNumber.choice.sf4 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf8: one->sf_AndCodeNumber.choice.sf8 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf16: one->sf_AndCodeNumber.choice.sf16 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf32: one->sf_AndCodeNumber.choice.sf32 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf64: one->sf_AndCodeNumber.choice.sf64 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf128: one->sf_AndCodeNumber.choice.sf128 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf256: one->sf_AndCodeNumber.choice.sf256 = code; break;
+	case ASN::SF512_AndCodeNumber_PR_sf512: one->sf_AndCodeNumber.choice.sf512 = code; break;
+	default: assert(0);
+	}
+}
+
+static void *buildRadioBearerSetup(const uint32_t *values, void *context)
+{
+	RadioBearerSetupContext *ctx = (RadioBearerSetupContext*)context;
+	ASN::DL_DCCH_Message_t *msg = RN_CALLOC(ASN::DL_DCCH_Message_t);
+	if (ctx->mIntegrity) { templateIntegrityCheckInfo(msg,values); }
+	msg->message.present = ASN::DL_DCCH_MessageType_PR_radioBearerSetup;
+	msg->message.choice.radioBearerSetup.present = ASN::RadioBearerSetup_PR_r3;
+	ASN::RadioBearerSetup_r3_IEs_t &rbs = msg->message.choice.radioBearerSetup.choice.r3.radioBearerSetup_r3;
+	rbs.rrc_TransactionIdentifier = values[rtfTransactionId];
+	fillRadioBearerSetup(rbs,ctx->mConfig,ctx->mPhCh,ctx->mSrbsToo,ctx->mHaveDataCh);
+	// The UL DPCH info is there only for a DPCH, and then so is the scrambling code field.
+	if (rbs.ul_ChannelRequirement) {
+		rbs.ul_ChannelRequirement->choice.ul_DPCH_Info.modeSpecificInfo.choice.fdd.scramblingCode =
+			values[rtfRbsUlScramblingCode];
+	}
+	setAsnDlChannelisationCode(rbs.dl_InformationPerRL_List,values[rtfRbsDlChannelisationCode]);
+	return msg;
+}
+
+// 3GPP 25.331 10.2.33
+// This is the main message to create DCH channels.
+// It is invoked by the SGSN to create a RAB for an internet connection.
+// It will also be invoked by GMM L3 to create CS connections.
+// In both cases a state machine in the caller must wait for the phones
+// response before proceeding.
+// 
+// We are sending a setup for a DCH and moving the UE to CELL_DCH state.
+// The masterConfig indicates the DCH L2 setup, for example, how many TrCh.
+// Return non-zero on error.
+bool sendRadioBearerSetup(UEInfo *uep, RrcMasterChConfig *masterConfig, PhCh *phch, bool srbstoo)
+{
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
+	unsigned transactionId = uep->newTransactionId();
+
+	// The UE is allowed to request a PS channel on any of RBs 5..15, so check them all.
+	bool haveDataCh = false; // Does the config define any data channels?
+	RBInfo *rb;  unsigned rbid;
+	for (rbid = 5; rbid < masterConfig->mNumRB; rbid++) {
+		if (!(rb = masterConfig->getRB(rbid)) || !rb->valid()) { continue; }
+		haveDataCh = true;
+		break;
+	}
+
+	ByteVector result(1000);
+	bool encoded = false;
+
+	// A config whose history we do not know has no signature and is always built the slow way.
+	if (gRrcMsgTemplates.enabled() && !masterConfig->mSignature.empty()) {
+		// Identical for every UE with the same config on the same kind of DCH,
+		// except the transaction id, the integrity info and the codes of the DCH.
+		RadioBearerSetupContext ctx;
+		ctx.mConfig = masterConfig;
+		ctx.mPhCh = phch;
+		ctx.mSrbsToo = srbstoo;
+		ctx.mHaveDataCh = haveDataCh;
+		ctx.mIntegrity = uep->integrity.isStarted();
+		unsigned widths[RrcMsgTemplate::sMaxFields] = {0};
+		uint32_t values[RrcMsgTemplate::sMaxFields] = {0};
+		widths[rtfTransactionId] = 2; values[rtfTransactionId] = transactionId;
+		if (phch->phChType() == DPDCHType) {
+			// UL-ScramblingCode is INTEGER (0..16777215).
+			widths[rtfRbsUlScramblingCode] = 24; values[rtfRbsUlScramblingCode] = phch->getSrCode();
+		}
+		// The sfN channelisation code is INTEGER (0..N-1).
+		widths[rtfRbsDlChannelisationCode] = phch->getDlSFLog2(); values[rtfRbsDlChannelisationCode] = phch->getSpCode();
+		string key = format("RadioBearerSetup %s srbs=%d data=%d type=%d sf=%u,%u pilot=%u punct=%d",
+			masterConfig->mSignature.c_str(),srbstoo,haveDataCh,(int)phch->phChType(),
+			phch->getUlSF(),phch->getDlSF(),phch->getDlSlot()->mNPilot,phch->getUlPuncturingLimit());
+		encoded = encodeDcchMsgFromTemplate(uep,SRB2,key,widths,
+				buildRadioBearerSetup,&ctx,values,result,descrRadioBearerSetup,startTime);
+	}
+
+	if (!encoded) {
+	// Create the RB Setup Message.
+	ASN::DL_DCCH_Message_t msg;
+	memset(&msg,0,sizeof(msg));
+	msg.message.present = ASN::DL_DCCH_MessageType_PR_radioBearerSetup;
+	ASN::RadioBearerSetup_t &rbstop = msg.message.choice.radioBearerSetup;
+	// There are various versions of this message.  Lets use the oldest version:
+	rbstop.present = ASN::RadioBearerSetup_PR_r3;
+	ASN::RadioBearerSetup_r3_IEs_t &rbs = rbstop.choice.r3.radioBearerSetup_r3;
+	rbs.rrc_TransactionIdentifier = transactionId;
+	fillRadioBearerSetup(rbs,masterConfig,phch,srbstoo,haveDataCh);
 
 		// note: encodeDcchMsg dumps the message to the log file.
         //asn_fprint(stdout,&ASN::asn_DEF_DL_DCCH_Message, &msg);  // Dump it all.
 		//fflush(stdout);
 
-
-	ByteVector result(1000);
-	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRadioBearerSetup)) {return 1;}
+	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRadioBearerSetup,startTime)) {return 1;}
+	}
 
         LOG(INFO) << "gNodeB: " << gNodeB.clock().get() << ", RadioBearerSetup: " << result;
 
@@ -1044,6 +1230,8 @@ void sendRadioBearerRelease(UEInfo *uep,
 	//return;	// Do nothing.  We will just leave the existing DCH setup alone; it does not matter
 #endif
 			// how many RBs are sharing the DCH.
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	UEState nextState = finished ? stCELL_FACH : stCELL_DCH;
 	ASN::DL_DCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
@@ -1105,7 +1293,7 @@ void sendRadioBearerRelease(UEInfo *uep,
 			if (rbr.rab_InformationReconfigList == NULL) {
 				rbr.rab_InformationReconfigList = RN_CALLOC(ASN::RAB_InformationReconfigList);
 			}
-			ASN_SEQUENCE_ADD(&rbr.rab_InformationReconfigList->list,rabreconfig);
+			RN_SEQUENCE_ADD(&rbr.rab_InformationReconfigList->list,rabreconfig);
 		}
 	}
 #endif
@@ -1116,7 +1304,7 @@ void sendRadioBearerRelease(UEInfo *uep,
 		if (rabMask & (1<<rbid)) {
 			ASN::RB_Identity_t *val = RN_CALLOC(ASN::RB_Identity_t);	// Its just a long.
 			*val = rbid;
-			ASN_SEQUENCE_ADD(&rbr.rb_InformationReleaseList.list,val);
+			RN_SEQUENCE_ADD(&rbr.rb_InformationReleaseList.list,val);
 		}
 	}
 
@@ -1171,7 +1359,7 @@ void sendRadioBearerRelease(UEInfo *uep,
 			// TODO: We are simply assuming that there is only one TrCh here.
 			//ult->ul_TransportChannelIdentity = uep->mUeDchConfig.getUlTrChInfo(0)->mTransportChannelIdentity;
 			ult->ul_TransportChannelIdentity = 1;
-			ASN_SEQUENCE_ADD(&rbr.ul_deletedTransChInfoList->list,ult);
+			RN_SEQUENCE_ADD(&rbr.ul_deletedTransChInfoList->list,ult);
 		}
 
 		{
@@ -1181,7 +1369,7 @@ void sendRadioBearerRelease(UEInfo *uep,
 			// TODO: We are simply assuming that there is only the TrCh here.
 			//dlt->dl_TransportChannelIdentity = uep->mUeDchConfig.getDlTrChInfo(0)->mTransportChannelIdentity;
 			dlt->dl_TransportChannelIdentity = 1;
-			ASN_SEQUENCE_ADD(&rbr.dl_DeletedTransChInfoList->list,dlt);
+			RN_SEQUENCE_ADD(&rbr.dl_DeletedTransChInfoList->list,dlt);
 		}
 
 		// The only example RadioBearerRelease message example I have is Nokia's "Call Setup PS" but that
@@ -1211,7 +1399,7 @@ void sendRadioBearerRelease(UEInfo *uep,
 	//struct DL_InformationPerRL_List *dl_InformationPerRL_List   /* OPTIONAL */;
 
 	ByteVector result(1000);
-	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRadioBearerRelease)) {return;}
+	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrRadioBearerRelease,startTime)) {return;}
 
 	if (finished) {
 		// Configure the UE to be ready for incoming on the new SRBs...
@@ -1224,16 +1412,15 @@ void sendRadioBearerRelease(UEInfo *uep,
 	uep->ueWriteHighSide(SRB2, result, descrRadioBearerRelease);
 }
 
-static unsigned commonCellUpdateConfirm(UEInfo *uep, ASN::CellUpdateConfirm_r3_IEs_t *ies)
+static void commonCellUpdateConfirm(ASN::CellUpdateConfirm_r3_IEs_t *ies, unsigned transactionId, UEState state)
 {
 
 	// Apparently even CCCH messages get a transaction id, which will be used if the UE
 	// replies to indicate an error in this message.
-	unsigned transactionId = uep->newTransactionId();
 	ies->rrc_TransactionIdentifier = transactionId;
 
 	// Huge message but almost everything is optional.  Here are the mandatory parts:
-	ies->rrc_StateIndicator = toAsnEnumerated(UEState2Asn(uep->ueGetState()));
+	ies->rrc_StateIndicator = toAsnEnumerated(UEState2Asn(state));
 	ies->rlc_Re_establishIndicatorRb2_3or4 = 0;
 	ies->rlc_Re_establishIndicatorRb5orAbove = 0;
 	ies->modeSpecificTransChInfo.present = ASN::CellUpdateConfirm_r3_IEs__modeSpecificTransChInfo_PR_fdd;
@@ -1241,7 +1428,35 @@ static unsigned commonCellUpdateConfirm(UEInfo *uep, ASN::CellUpdateConfirm_r3_I
 
 	// We can define a new URNTI.  
 	// TODO: Do we need to assign a new URNTI if this message is on CCCH?
-	return transactionId;
+}
+
+// Template builders for CellUpdateConfirm.
+struct CellUpdateConfirmContext {
+	UEState mState;
+	bool mIntegrity;
+};
+static void *buildCellUpdateConfirmDcch(const uint32_t *values, void *context)
+{
+	CellUpdateConfirmContext *ctx = (CellUpdateConfirmContext*)context;
+	ASN::DL_DCCH_Message_t *msg = RN_CALLOC(ASN::DL_DCCH_Message_t);
+	if (ctx->mIntegrity) { templateIntegrityCheckInfo(msg,values); }
+	msg->message.present = ASN::DL_DCCH_MessageType_PR_cellUpdateConfirm;
+	msg->message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_PR_r3;
+	commonCellUpdateConfirm(&msg->message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3,
+		values[rtfTransactionId],ctx->mState);
+	return msg;
+}
+
+enum { rtfCucSrncId = rtfFirstUser, rtfCucSRNTI };
+static void *buildCellUpdateConfirmCcch(const uint32_t *values, void *context)
+{
+	ASN::DL_CCCH_Message_t *msg = RN_CALLOC(ASN::DL_CCCH_Message_t);
+	msg->message.present = ASN::DL_CCCH_MessageType_PR_cellUpdateConfirm;
+	msg->message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_CCCH_PR_r3;
+	toAsnURNTI(&msg->message.choice.cellUpdateConfirm.choice.r3.u_RNTI,values[rtfCucSrncId],values[rtfCucSRNTI]);
+	commonCellUpdateConfirm(&msg->message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3,
+		values[rtfTransactionId],((CellUpdateConfirmContext*)context)->mState);
+	return msg;
 }
 
 
@@ -1250,6 +1465,26 @@ static unsigned commonCellUpdateConfirm(UEInfo *uep, ASN::CellUpdateConfirm_r3_I
 // TODO: It would be wise to implement the RLC re-establish indicators.
 static void sendCellUpdateConfirmDcch(UEInfo *uep)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
+	unsigned transactionId = uep->newTransactionId();
+	CellUpdateConfirmContext ctx;
+	ctx.mState = uep->ueGetState();
+	ctx.mIntegrity = uep->integrity.isStarted();
+	ByteVector result(1000);
+	bool encoded = false;
+
+	if (gRrcMsgTemplates.enabled()) {
+		// This message is identical for every UE except the transaction id and integrity info.
+		unsigned widths[RrcMsgTemplate::sMaxFields] = {0};
+		uint32_t values[RrcMsgTemplate::sMaxFields] = {0};
+		widths[rtfTransactionId] = 2;
+		values[rtfTransactionId] = transactionId;
+		encoded = encodeDcchMsgFromTemplate(uep,SRB2,format("CellUpdateConfirmDcch state=%d",ctx.mState),widths,
+				buildCellUpdateConfirmDcch,&ctx,values,result,descrCellUpdateConfirm,startTime);
+	}
+
+	if (!encoded) {
 	ASN::DL_DCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
 	// struct IntegrityCheckInfo   *integrityCheckInfo /* OPTIONAL */;
@@ -1257,16 +1492,42 @@ static void sendCellUpdateConfirmDcch(UEInfo *uep)
 	msg.message.choice.cellUpdateConfirm.present = ASN::CellUpdateConfirm_PR_r3;
 	ASN::CellUpdateConfirm_r3_IEs_t *ies =
 		&msg.message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3;
-	unsigned transactionId = commonCellUpdateConfirm(uep,ies);
+	commonCellUpdateConfirm(ies,transactionId,ctx.mState);
+
+	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrCellUpdateConfirm,startTime)) {return;}
+	}
 
-	ByteVector result(1000);
-	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrCellUpdateConfirm)) {return;}
 	UeTransaction(uep,UeTransaction::ttCellUpdateConfirm, 0, transactionId);
 	uep->ueWriteHighSide(SRB2, result, descrCellUpdateConfirm);
 }
 
 static void sendCellUpdateConfirmCcch(UEInfo *uep)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
+	unsigned transactionId = uep->newTransactionId();
+	CellUpdateConfirmContext ctx;
+	ctx.mState = uep->ueGetState();
+	ctx.mIntegrity = false;		// No integrity protection on CCCH.
+	ByteVector result(1000);
+	bool encoded = false;
+
+	if (gRrcMsgTemplates.enabled()) {
+		// Identical for every UE except the transaction id and the URNTI, which are fixed size fields.
+		unsigned widths[RrcMsgTemplate::sMaxFields] = {0};
+		uint32_t values[RrcMsgTemplate::sMaxFields] = {0};
+		widths[rtfTransactionId] = 2; values[rtfTransactionId] = transactionId;
+		widths[rtfCucSrncId] = 12; values[rtfCucSrncId] = uep->getSrncId();
+		widths[rtfCucSRNTI] = 20; values[rtfCucSRNTI] = uep->getSRNTI();
+		encoded = gRrcMsgTemplates.instantiate(format("CellUpdateConfirmCcch state=%d",ctx.mState),&ASN::asn_DEF_DL_CCCH_Message,
+				widths,buildCellUpdateConfirmCcch,&ctx,values,result,descrCellUpdateConfirm.c_str());
+		if (encoded) {
+			gRrcMsgTemplates.addEncodeTime(descrCellUpdateConfirm,true,timef() - startTime);
+			LOG(INFO) << uep << format(" DL_CCCH %s message size=%d (template)",descrCellUpdateConfirm.c_str(),result.size());
+		}
+	}
+
+	if (!encoded) {
 	ASN::DL_CCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
 	msg.message.present = ASN::DL_CCCH_MessageType_PR_cellUpdateConfirm;
@@ -1278,11 +1539,11 @@ static void sendCellUpdateConfirmCcch(UEInfo *uep)
 	// CellUpdateConfirm_r3_IEs_t   cellUpdateConfirm_r3;
 	ASN::CellUpdateConfirm_r3_IEs_t *ies =
 		&msg.message.choice.cellUpdateConfirm.choice.r3.cellUpdateConfirm_r3;
-	unsigned transactionId = commonCellUpdateConfirm(uep,ies);
+	commonCellUpdateConfirm(ies,transactionId,ctx.mState);
 
+	if (!encodeCcchMsg(&msg,result,descrCellUpdateConfirm,uep,0,startTime)) {return;}
+	}
 
-	ByteVector result(1000);
-	if (!encodeCcchMsg(&msg,result,descrCellUpdateConfirm,uep,0)) {return;}
 	UeTransaction(uep,UeTransaction::ttCellUpdateConfirm, 0, transactionId);
 
 	gMacSwitch.writeHighSideCcch(result,descrCellUpdateConfirm);
@@ -1306,6 +1567,8 @@ void sendCellUpdateConfirm(UEInfo *uep)
 // including the one for an L3 Service Request.
 void sendSecurityModeCommand(UEInfo *uep)
 {
+	AsnArenaScope arena;	// Everything RN_CALLOCed for this message goes away on return.
+	double startTime = timef();
 	ASN::DL_DCCH_Message_t msg;
 	memset(&msg,0,sizeof(msg));
 	msg.message.present = ASN::DL_DCCH_MessageType_PR_securityModeCommand;
@@ -1368,7 +1631,7 @@ void sendSecurityModeCommand(UEInfo *uep)
 	secCap->present = ASN::InterRAT_UE_SecurityCapability_PR_gsm;
 	secCap->choice.gsm.gsmSecurityCapability = allocAsnBIT_STRING(7);
 	AsnBitString2BVTemp(secCap->choice.gsm.gsmSecurityCapability).setField(ASN::GsmSecurityCapability_a5_1,1,1);
-	ASN_SEQUENCE_ADD(&ies->ue_SystemSpecificSecurityCap->list,secCap);
+	RN_SEQUENCE_ADD(&ies->ue_SystemSpecificSecurityCap->list,secCap);
 	*/
 
 	// 25.331 8.5.10 and 8.6.3.5 
@@ -1377,7 +1640,7 @@ void sendSecurityModeCommand(UEInfo *uep)
 	// 13.4.10: Integrity Protection is turned off when entering/leaving idle mode.
 	uep->integrity.integrityStart();
 	ByteVector result(1000);
-	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrSecurityModeCommand)) {return;}
+	if (!encodeDcchMsg(uep,SRB2,&msg,result,descrSecurityModeCommand,startTime)) {return;}
 	UeTransaction(uep,UeTransaction::ttSecurityModeCommand, 0, transactionId);
 	uep->ueWriteHighSide(SRB2, result, descrSecurityModeCommand);
 }
@@ -15,6 +15,7 @@
 #ifndef URRCMESSAGES_H
 #define URRCMESSAGES_H 1
 //#include "URRC.h"
+#include <vector>
 #include "ByteVector.h"
 
 #include "asn_system.h"	// Dont let other includes land in namespace ASN.
@@ -23,6 +24,10 @@ namespace ASN {
 #include "InitialUE-Identity.h"
 };
 
+namespace GSM {
+class L3MobileIdentity;
+}
+
 namespace UMTS {
 class PhCh;
 class RrcMasterChConfig;
@@ -44,6 +49,8 @@ void sendRadioBearerRelease(UEInfo *uep, unsigned rabMask, bool finished);
 void sendRrcConnectionRelease(UEInfo *uep);
 void sendCellUpdateConfirm(UEInfo *uep);
 void sendSecurityModeCommand(UEInfo *uep);
+// The PagingType1 message for one PCH block, up to maxPage1 identities.
+bool encodePagingType1(const std::vector<GSM::L3MobileIdentity> &ids, ByteVector &result);
 
 // The UE initially sends its identity in the RRC Connection Request Message.
 // We dont really care what it is, we just need to copy the exact
@@ -0,0 +1,177 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#include "URRCMsgTemplate.h"
+#include "Logger.h"
+#include <Configuration.h>
+extern ConfigurationTable gConfig;
+
+namespace UMTS {
+
+RrcMsgTemplateCache gRrcMsgTemplates;
+
+RrcMsgTemplate::RrcMsgTemplate(ASN::asn_TYPE_descriptor_t *asnType, const unsigned *widths)
+	: mAsnType(asnType), mEncoded(1000), mValid(false)
+{
+	for (unsigned f = 0; f < sMaxFields; f++) {
+		mWidth[f] = widths[f];
+		mOffset[f] = -1;
+	}
+}
+
+bool RrcMsgTemplate::encodeOne(RrcMsgBuilder builder, void *context, const uint32_t *values, ByteVector &result, const char *descr)
+{
+	AsnArenaScope arena;	// The probe messages are discarded as soon as they are encoded.
+	void *msg = builder(values,context);
+	if (msg == NULL) { return false; }
+	result.resetSize();
+	return uperEncodeToBV(mAsnType,msg,result,descr);
+}
+
+bool RrcMsgTemplate::learn(RrcMsgBuilder builder, void *context, const char *descr)
+{
+	mValid = false;
+	uint32_t values[sMaxFields];
+	memset(values,0,sizeof(values));
+	if (!encodeOne(builder,context,values,mEncoded,descr)) { return false; }
+
+	ByteVector probe(mEncoded.allocSize());
+	for (unsigned f = 0; f < sMaxFields; f++) {
+		unsigned width = mWidth[f];
+		if (width == 0) { continue; }
+		values[f] = (width >= 32) ? 0xffffffff : ((1u<<width) - 1);
+		bool ok = encodeOne(builder,context,values,probe,descr);
+		values[f] = 0;
+		if (!ok || probe.sizeBits() != mEncoded.sizeBits()) {
+			LOG(INFO) << descr << " template field "<<f<<" changes the message size";
+			return false;
+		}
+		// Find the bits that changed.  They must be exactly the field.
+		int first = -1, last = -1;
+		unsigned changed = 0;
+		const ByteType *base = mEncoded.begin(), *other = probe.begin();
+		for (unsigned byte = 0; byte < mEncoded.size(); byte++) {
+			unsigned diff = base[byte] ^ other[byte];
+			for (unsigned bit = 0; diff && bit < 8; bit++) {
+				if (diff & (0x80 >> bit)) {
+					int pos = 8*byte + bit;
+					if (first < 0) { first = pos; }
+					last = pos;
+					changed++;
+				}
+			}
+		}
+		if (changed != width || last - first + 1 != (int)width) {
+			LOG(INFO) << descr << " template field "<<f<<" is not a fixed position"<<LOGVAR(width)<<LOGVAR(changed);
+			return false;
+		}
+		mOffset[f] = first;
+	}
+
+	// Paranoid check that no two fields landed on top of each other.
+	for (unsigned f = 0; f < sMaxFields; f++) {
+		for (unsigned g = f+1; g < sMaxFields; g++) {
+			if (mWidth[f] == 0 || mWidth[g] == 0) { continue; }
+			if (mOffset[f] < mOffset[g] + (int)mWidth[g] && mOffset[g] < mOffset[f] + (int)mWidth[f]) {
+				LOG(INFO) << descr << " template fields "<<f<<" and "<<g<<" overlap";
+				return false;
+			}
+		}
+	}
+	return mValid = true;
+}
+
+bool RrcMsgTemplate::instantiate(const uint32_t *values, ByteVector &result) const
+{
+	if (!mValid || result.allocSize() < mEncoded.size()) { return false; }
+	memcpy(result.begin(),mEncoded.begin(),mEncoded.size());
+	result.setSizeBits(mEncoded.sizeBits());
+	for (unsigned f = 0; f < sMaxFields; f++) {
+		if (mWidth[f]) { result.setField(mOffset[f],values[f],mWidth[f]); }
+	}
+	return true;
+}
+
+bool RrcMsgTemplateCache::enabled()
+{
+	int result = mEnabled;
+	if (result < 0) { mEnabled = result = gConfig.getBool("UMTS.RRC.MessageTemplates"); }
+	return result;
+}
+
+bool RrcMsgTemplateCache::instantiate(const std::string &key, ASN::asn_TYPE_descriptor_t *asnType, const unsigned *widths,
+		RrcMsgBuilder builder, void *context, const uint32_t *values, ByteVector &result, const char *descr)
+{
+	ScopedLock lock(mLock);
+	RrcMsgTemplate *tmpl;
+	TemplateMap::iterator it = mTemplates.find(key);
+	if (it == mTemplates.end()) {
+		tmpl = new RrcMsgTemplate(asnType,widths);
+		if (tmpl->learn(builder,context,descr)) {
+			LOG(INFO) << "learned RRC message template " << key << LOGVAR2("bits",tmpl->sizeBits());
+		} else {
+			// We keep the invalid template so we dont try again.
+			LOG(INFO) << "RRC message can not be templated: " << key;
+		}
+		mTemplates[key] = tmpl;
+	} else {
+		tmpl = it->second;
+	}
+	return tmpl->instantiate(values,result);
+}
+
+void RrcMsgTemplateCache::flush()
+{
+	ScopedLock lock(mLock);
+	for (TemplateMap::iterator it = mTemplates.begin(); it != mTemplates.end(); it++) {
+		delete it->second;
+	}
+	mTemplates.clear();
+	mEnabled = -1;
+}
+
+void RrcMsgTemplateCache::addEncodeTime(const std::string &descr, bool fromTemplate, double seconds)
+{
+	ScopedLock lock(mLock);
+	EncodeStats &stats = mStats[descr];
+	(fromTemplate ? stats.mTemplate : stats.mFull).addPoint(seconds);
+}
+
+void RrcMsgTemplateCache::clearStats()
+{
+	ScopedLock lock(mLock);
+	mStats.clear();
+}
+
+void RrcMsgTemplateCache::text(std::ostream &os)
+{
+	ScopedLock lock(mLock);
+	os << "RRC encode latency:\n";
+	for (StatsMap::iterator it = mStats.begin(); it != mStats.end(); it++) {
+		os << "  " << it->first << "\n";
+		os << "    full:     " << it->second.mFull << "\n";
+		os << "    template: " << it->second.mTemplate << "\n";
+	}
+	os << "RRC message templates:\n";
+	for (TemplateMap::iterator it = mTemplates.begin(); it != mTemplates.end(); it++) {
+		os << "  " << it->first;
+		if (it->second->valid()) {
+			os << LOGVAR2("bits",it->second->sizeBits()) << "\n";
+		} else {
+			os << " (not templatable)\n";
+		}
+	}
+}
+
+}; // namespace UMTS
@@ -0,0 +1,104 @@
+/*
+ * OpenBTS provides an open source alternative to legacy telco protocols and
+ * traditionally complex, proprietary hardware systems.
+ *
+ * Copyright 2014 Range Networks, Inc.
+ *
+ * This software is distributed under the terms of the GNU Affero General
+ * Public License version 3. See the COPYING and NOTICE files in the main
+ * directory for licensing information.
+ *
+ * This use of this software may be subject to additional restrictions.
+ * See the LEGAL file in the main directory for details.
+ */
+
+#ifndef URRCMSGTEMPLATE_H
+#define URRCMSGTEMPLATE_H 1
+#include <map>
+#include <string>
+#include "ByteVector.h"
+#include "Threads.h"
+#include "Utils.h"
+#include "AsnHelper.h"
+
+namespace UMTS {
+
+// Pre-encoded downlink RRC messages.
+// Messages like RadioBearerSetup and CellUpdateConfirm come out identical for every UE with the same
+// channel configuration except for a few fields: the transaction id, the RNTIs, the codes.
+// uPER puts a constrained integer or fixed size BIT STRING at a fixed bit position as long as
+// everything in front of it is fixed, so we encode the message once and thereafter just patch those fields.
+//
+// The message builder is called with the values for all the fields and must return a freshly built
+// asn message in the current AsnArena.  The template learns where each field lives by encoding
+// the message with the field all zeros and all ones and diffing the results; if that does not produce
+// exactly 'width' contiguous changed bits, or the size changes, the message cannot be templated
+// and the caller must build it the slow way.  So a field must have a value range of exactly 2^width,
+// eg, rrc-TransactionIdentifier (0..3) or a BIT STRING (SIZE(n)).
+typedef void *(*RrcMsgBuilder)(const uint32_t *values, void *context);
+
+// Field numbers common to all templates.  Message specific fields start at rtfFirstUser.
+// A field whose width is 0 is not used by that template.
+enum RrcTemplateField {
+	rtfMacI,			// IntegrityCheckInfo message authentication code, 32 bits, DCCH only.
+	rtfRrcSn,			// IntegrityCheckInfo RRC message sequence number, 4 bits, DCCH only.
+	rtfTransactionId,	// rrc-TransactionIdentifier, 2 bits.
+	rtfFirstUser
+};
+
+class RrcMsgTemplate {
+	public:
+	static const unsigned sMaxFields = 8;
+	private:
+	ASN::asn_TYPE_descriptor_t *mAsnType;
+	ByteVector mEncoded;		// The message encoded with all the fields zero.
+	unsigned mWidth[sMaxFields];
+	int mOffset[sMaxFields];	// Bit position of each field in mEncoded.
+	bool mValid;
+	bool encodeOne(RrcMsgBuilder builder, void *context, const uint32_t *values, ByteVector &result, const char *descr);
+
+	public:
+	RrcMsgTemplate(ASN::asn_TYPE_descriptor_t *asnType, const unsigned *widths);
+	// Build the message with probe values and find the fields.  Sets and returns valid().
+	bool learn(RrcMsgBuilder builder, void *context, const char *descr);
+	bool valid() const { return mValid; }
+	// Copy the message into result, which must already be allocated large enough,
+	// and set the fields to the specified values.
+	bool instantiate(const uint32_t *values, ByteVector &result) const;
+	unsigned sizeBits() const { return mEncoded.sizeBits(); }
+};
+
+// The cache of templates, keyed by a string that must identify everything about the message
+// other than the fields, ie, the message type and whatever configuration went into it.
+// Also keeps the encode latency statistics for the full and template paths so we can see what we gained.
+class RrcMsgTemplateCache {
+	Mutex mLock;
+	typedef std::map<std::string,RrcMsgTemplate*> TemplateMap;
+	TemplateMap mTemplates;
+	struct EncodeStats {
+		LatencyHistogram mFull;		// Build and encode the asn structure.
+		LatencyHistogram mTemplate;	// Patch a template.
+	};
+	typedef std::map<std::string,EncodeStats> StatsMap;
+	StatsMap mStats;
+	volatile int mEnabled;	// UMTS.RRC.MessageTemplates, or -1 until it is read again after a flush.
+
+	public:
+	RrcMsgTemplateCache() : mEnabled(-1) {}
+	// Return true if templates are enabled by UMTS.RRC.MessageTemplates.
+	// The config is read once and again only after flush(), not on every message.
+	bool enabled();
+	// Encode a message from the template for key, learning the template first if necessary.
+	// Returns false if this message can not be templated, in which case the caller builds it the slow way.
+	bool instantiate(const std::string &key, ASN::asn_TYPE_descriptor_t *asnType, const unsigned *widths,
+		RrcMsgBuilder builder, void *context, const uint32_t *values, ByteVector &result, const char *descr);
+	// Throw everything away, for example, because the config changed.
+	void flush();
+	void addEncodeTime(const std::string &descr, bool fromTemplate, double seconds);
+	void clearStats();
+	void text(std::ostream &os);
+};
+extern RrcMsgTemplateCache gRrcMsgTemplates;
+
+}; // namespace UMTS
+#endif
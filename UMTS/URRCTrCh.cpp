@@ -17,6 +17,7 @@
 #include "UMTSPhCh.h"
 #include "UMTSL1FEC.h"
 #include "UMTSL1CC.h"
+#include "AsnHelper.h"
 #include "Utils.h"
 static const int cSamsungTest = 0;
 
@@ -522,7 +523,7 @@ void RrcTfcs::toAsnTfcs(ASN::TFCS *result, TrChType chtype)
 					(foo->powerOffsetInformation)->powerOffsetPp_m = new long(2);
 				}
 		}
-		ASN_SEQUENCE_ADD(list,foo);
+		RN_SEQUENCE_ADD(list,foo);
 	}
 }
 
@@ -758,7 +759,7 @@ ASN::DedicatedDynamicTF_Info *RrcTfs::DynamicTFInfo::toAsnDedicated1(RrcTfs *tfs
 		// WARNING: This setting interacts with defaultRbMappingOptionToAsn(), cf.
 		result->logicalChannelList.present = ASN::LogicalChannelList_PR_allSizes;
 	}
-	ASN_SEQUENCE_ADD(&result->numberOfTbSizeList.list,RrcTfsNumberOfTransportBlocks::toAsn(mNumTB));
+	RN_SEQUENCE_ADD(&result->numberOfTbSizeList.list,RrcTfsNumberOfTransportBlocks::toAsn(mNumTB));
 	return result;
 }
 
@@ -779,7 +780,7 @@ ASN::CommonDynamicTF_Info *RrcTfs::DynamicTFInfo::toAsnCommon1(ASN::CommonDynami
 		//result->logicalChannelList.present = ASN::LogicalChannelList_PR_configured; //allSizes;
 
 	}
-	ASN_SEQUENCE_ADD(&result->numberOfTbSizeList.list,RrcTfsNumberOfTransportBlocks::toAsn(mNumTB));
+	RN_SEQUENCE_ADD(&result->numberOfTbSizeList.list,RrcTfsNumberOfTransportBlocks::toAsn(mNumTB));
         //ASN_SEQUENCE_ADD(&result->numberOfTbSizeList.list,RrcTfsNumberOfTransportBlocks::toAsn(2));
 	return result;
 }
@@ -794,7 +795,7 @@ void RrcTfs::DynamicTFInfoList::toAsnDedicated(RrcTfs *tfs,ASN::DedicatedDynamic
 		} else {
 			// Create a new struct for this rlcSize and add to list.
 			tfi = mDynamicTFInfo[i].toAsnDedicated1(tfs,NULL);
-			ASN_SEQUENCE_ADD(&thing->list,tfi);
+			RN_SEQUENCE_ADD(&thing->list,tfi);
 		}
 	}
 }
@@ -809,7 +810,7 @@ void RrcTfs::DynamicTFInfoList::toAsnCommon(ASN::CommonDynamicTF_InfoList *thing
 		} else {
 			// Create a new struct for this rlcSize and add to list.
 			tfi = mDynamicTFInfo[i].toAsnCommon1(NULL, isDownlink);
-			ASN_SEQUENCE_ADD(&thing->list,tfi);
+			RN_SEQUENCE_ADD(&thing->list,tfi);
 		}
 	}
 }
@@ -941,7 +942,7 @@ static void defaultRbMappingOptionToAsn(TrChInfo *tcul,TrChInfo *tcdl,RbId rbid,
 			// The 1-based index in the TFS.  Our RACH should have a TFS with a single entry.
 			ASN::RLC_SizeInfo *tfIndex = RN_CALLOC(ASN::RLC_SizeInfo);
 			tfIndex->rlc_SizeIndex = 1;	// 0 does not work - ASN complains because range is 1..32
-			ASN_SEQUENCE_ADD(&ulm->rlc_SizeList.choice.explicitList.list,tfIndex);
+			RN_SEQUENCE_ADD(&ulm->rlc_SizeList.choice.explicitList.list,tfIndex);
 		} else {
 			// It is a DCH.
 			// All sizes in the TFS for this TrCh are valid for this (and all) logical channel.
@@ -988,7 +989,7 @@ static void defaultRbMappingOptionToAsn(TrChInfo *tcul,TrChInfo *tcdl,RbId rbid,
 		// The downlink does not have any 'RLC size list' or MAC logical channel priority.
 
 		rbo->dl_LogicalChannelMappingList = RN_CALLOC(ASN::DL_LogicalChannelMappingList);
-		ASN_SEQUENCE_ADD(&rbo->dl_LogicalChannelMappingList->list,dlm);
+		RN_SEQUENCE_ADD(&rbo->dl_LogicalChannelMappingList->list,dlm);
 	}  // End of downlink RBMappingOptions
 }
 
@@ -996,7 +997,7 @@ void defaultRbMappingInfoToAsn(TrChInfo *tcul,TrChInfo *tcdl,RbId rbid,ASN::RB_M
 {
 	ASN::RB_MappingOption *rbo = RN_CALLOC(ASN::RB_MappingOption);
 	defaultRbMappingOptionToAsn(tcul,tcdl,rbid,rbo);
-	ASN_SEQUENCE_ADD(&asnmsg->list,rbo);
+	RN_SEQUENCE_ADD(&asnmsg->list,rbo);
 }
 
 #if 0
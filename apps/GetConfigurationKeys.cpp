@@ -122,6 +122,18 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("Control.Engine.Threads","2",
+		"threads",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"1:16",
+		true,
+		"Number of event loop threads that run the call and SMS transactions.  "
+			"Each transaction stays on one thread, but a thread runs any number of them, so this does not limit the number of calls."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("Control.LUR.AttachDetach","1",
 		"",
 		ConfigurationKey::CUSTOMER,
@@ -298,6 +310,41 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("Control.Reporting.TMSIAccessFlushInterval","10",
+		"seconds",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"1:600",
+		true,
+		"How often the last access times of TMSITable entries are written to its database.  "
+			"Lookups are answered from memory and only record the access time, and all the times recorded between writes are written in one transaction."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("Control.Reporting.PhysStatusTable","/var/run/OpenBTS-UMTS-ChannelTable.db",
+		"",
+		ConfigurationKey::CUSTOMERWARN,
+		ConfigurationKey::FILEPATH,
+		"",
+		true,
+		"File path for channel status reporting database."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("Control.Reporting.PhysStatusFlushInterval","1000",
+		"milliseconds",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"100:60000",
+		true,
+		"How often the latest channel measurements are written to the channel status database by a background thread.  "
+			"Measurement reports only update the values kept in memory, which the physical CLI command shows, and each channel reported between writes is written once."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("Control.Reporting.TransactionTable","/var/run/OpenBTS-UMTS-TransactionTable.db",
 		"",
 		ConfigurationKey::CUSTOMERWARN,
@@ -309,6 +356,18 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("Control.Reporting.TransactionFlushInterval","250",
+		"milliseconds",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"10:10000",
+		true,
+		"How often changes to the transaction table are written to its database by a background thread.  "
+			"Call processing does not wait for the database, and several changes to a transaction between writes are written once."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	// TODO : this setting doesn't exist in C3.1, SMSCB incomplete: INSERT OR IGNORE INTO "CONFIG" VALUES('Control.SMSCB','1',0,1,'If not NULL, enable SMSCB.  If defined, ControlSMSCB.Table must also be defined.');
 	// TODO : no reference to this table yet, SMSCB incomplete: INSERT OR IGNORE INTO "CONFIG" VALUES('Control.SMSCB.Table','/var/run/OpenBTS-UMTS-SMSCB.db',1,1,'File path for SMSCB scheduling database.  Static.');
 
@@ -354,6 +413,20 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("GGSN.Firewall.Rules","",
+		"",
+		ConfigurationKey::CUSTOMERWARN,
+		ConfigurationKey::STRING_OPT,
+		"",
+		false,
+		"Additional firewall rules for MS traffic, applied after the rules selected by GGSN.Firewall.Enable and only if it is non-zero.  "
+			"A list of 'allow' or 'deny' followed by an address prefix, for example: deny 203.0.113.0/24 allow 203.0.113.7.  "
+			"The longest matching prefix wins and addresses matching no rule are allowed.  "
+			"May be changed while running."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("GGSN.IP.MaxPacketSize","1520",
 		"bytes",
 		ConfigurationKey::DEVELOPER,
@@ -377,6 +450,19 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("GGSN.TCP.MSSClamp","0",
+		"bytes",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"0:1460",// educated guess
+		false,
+		"If non-zero, lower the TCP maximum segment size offered in SYN packets in either direction to this value, "
+			"so TCP connections through the GGSN use segments that fit the path without fragmenting.  "
+			"0 leaves the MSS alone."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("GGSN.IP.TossDuplicatePackets","0",
 		"",
 		ConfigurationKey::CUSTOMER,
@@ -450,6 +536,94 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("GGSN.Tun.BatchSize","32",
+		"packets",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"1:256",// educated guess
+		true,
+		"Maximum number of packets the GGSN reads from each tun queue, or writes to the tun device, per wakeup.  "
+			"Larger batches reduce the per-packet overhead under load at the cost of a little latency for the last packet in the batch."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Tun.CopyBreak","256",
+		"bytes",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"0:1500",// educated guess
+		true,
+		"Downlink packets up to this size are copied out of the GGSN receive buffer; larger ones are handed to the RLC in the buffer they were read into, without a copy.  "
+			"Copying small packets saves allocating a full sized buffer for each one."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Workers","1",
+		"threads",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"1:16",// educated guess
+		true,
+		"Number of GGSN forwarding worker threads.  Each PDP context is assigned to one worker by its IP address, "
+			"which forwards all its packets in both directions, so the packets for a context stay in order.  "
+			"The tun queues, see GGSN.Tun.Queues, are read by min(GGSN.Tun.Queues,GGSN.Workers) reader threads.  "
+			"With 1 the reader forwards downlink packets itself, as before."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Workers.CPUs","",
+		"",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::STRING_OPT,
+		"^[0-9 ]*$",
+		true,
+		"Space separated list of CPU numbers to pin the GGSN worker threads to.  Worker n, and reader n if there is one, "
+			"is pinned to the n'th CPU in the list, wrapping around if there are more workers than CPUs.  "
+			"If empty the threads are not pinned."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Tun.Queues","1",
+		"queues",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"1:8",// educated guess
+		true,
+		"Number of queues to open on the GGSN tun device.  "
+			"Values greater than 1 require a kernel with multi-queue tun support; "
+			"if the kernel does not support it, or the persistent tun device was created as single queue, a single queue is used."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Trace.Sample","1",
+		"packets",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"0:1000000",// educated guess
+		false,
+		"Record GGSN packet events in the binary trace shown by 'sgsn trace'.  "
+			"0 turns the trace off; N records one in N forwarded packets.  "
+			"Dropped packets are always recorded while the trace is on."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
+	tmp = new ConfigurationKey("GGSN.Trace.Size","8192",
+		"records",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::VALRANGE,
+		"16:1048576",// educated guess
+		true,
+		"Number of packet events kept in the GGSN trace, rounded up to a power of two.  Each takes 32 bytes."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("GGSN.TunName","sgsntun",
 		"",
 		ConfigurationKey::DEVELOPER,
@@ -983,6 +1157,18 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("SIP.Receive.Workers","2",
+		"threads",
+		ConfigurationKey::CUSTOMERTUNE,
+		ConfigurationKey::VALRANGE,
+		"1:16",
+		true,
+		"Number of threads that parse and deliver inbound SIP messages.  "
+			"The messages of one call always go to the same thread, so they are handled in order."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("SIP.RegistrationPeriod","90",
 		"minutes",
 		ConfigurationKey::DEVELOPER,
@@ -1229,12 +1415,14 @@ ConfigurationKeyMap getConfigurationKeys()
     	dsi2->cn_DRX_CycleLengthCoeff = gConfig.getNum("UMTS.CN-DSI.CycleLengthCoeff");        // FIXME -- What does this mean?!
 	*/
 	tmp = new ConfigurationKey("UMTS.CN-DSI.CycleLengthCoeff","6",//DEFAULT INLINE WAS 8
-		"????",
+		"",
 		ConfigurationKey::FACTORY,
 		ConfigurationKey::VALRANGE,
-		"0:100",//??????
-		false,
-		"Have no idea."
+		"6:9",
+		true,
+		"CS domain DRX cycle length coefficient k, 3GPP 25.304 8.3.  "
+			"Idle UEs listen for pages once every 2^k radio frames, so the default of 6 is every 640 ms.  "
+			"Larger values save UE battery but make paging slower."
 	);
 	map[tmp->getName()] = *tmp;
 	delete tmp;
@@ -1622,6 +1810,18 @@ ConfigurationKeyMap getConfigurationKeys()
 	map[tmp->getName()] = *tmp;
 	delete tmp;
 
+	tmp = new ConfigurationKey("UMTS.RRC.MessageTemplates","1",
+		"",
+		ConfigurationKey::DEVELOPER,
+		ConfigurationKey::BOOLEAN,
+		"",
+		false,
+		"Encode common downlink RRC messages by patching a pre-encoded template instead of building and encoding the ASN.1 message every time.  "
+			"Use the CLI command 'rrctest encstats' to compare the encode latency of the two methods."
+	);
+	map[tmp->getName()] = *tmp;
+	delete tmp;
+
 	tmp = new ConfigurationKey("UMTS.SCCPCH.SF","64",
 		"",
 		ConfigurationKey::CUSTOMERTUNE,
@@ -23,13 +23,17 @@ ConfigurationTable gConfig("/etc/OpenBTS/OpenBTS-UMTS.db","OpenBTS-UMTS", getCon
 
 #include <TRXManager.h>
 #include <UMTSConfig.h>
+#include <URRCMsgTemplate.h>
 #include <SIPInterface.h>
 #include <TransactionTable.h>
+#include <ControlEngine.h>
+#include <MediaRelay.h>
 #include <ControlCommon.h>
 
 #include <Logger.h>
 #include <CLI.h>
 #include <NodeManager.h>
+#include <SgsnExport.h>
 
 #include <assert.h>
 #include <unistd.h>
@@ -64,9 +68,18 @@ TransceiverManager gTRX;	// init below with TransceiverManagerInit()
 // The TMSI Table.
 Control::TMSITable gTMSITable(gConfig.getStr("Control.Reporting.TMSITable").c_str());
 
+// The channel measurements.
+GSM::PhysicalStatus gPhysStatus(gConfig.getStr("Control.Reporting.PhysStatusTable").c_str());
+
 // The transaction table.
 Control::TransactionTable gTransactionTable(gConfig.getStr("Control.Reporting.TransactionTable").c_str());
 
+// The relay for the calls' speech frames.
+Control::MediaRelay gMediaRelay;
+
+// The event loops for the call and SMS transactions.
+Control::ControlEngine gControlEngine;
+
 // The global SIPInterface object.
 SIP::SIPInterface gSIPInterface;
 
@@ -83,6 +96,10 @@ void purgeConfig(void*,int,char const*, char const*, sqlite3_int64)
 	// But I'm leaving both calls to regenerateBeacon intact in case someone changes
 	// the initialization order in here, because it doesnt hurt to do it twice.
 	gNodeB.regenerateBeacon();
+	// The RRC message templates have configuration baked into them.
+	UMTS::gRrcMsgTemplates.flush();
+	// The GGSN firewall rules may be changed while running.
+	SGSN::Sgsn::configChanged();
 }
 
 
@@ -182,6 +199,16 @@ int main(int argc, char *argv[])
 	// Start the SIP interface.
 	LOG(INFO) << "Starting the SIP interface...";
 	gSIPInterface.start();
+	// Start writing the transaction table database.
+	gTransactionTable.start();
+	// Start writing the TMSI table access times.
+	gTMSITable.start();
+	// Start writing the channel measurements.
+	gPhysStatus.start();
+	// Start the event loops for the call and SMS transactions, before anything can hand them one.
+	gControlEngine.start(gConfig.getNum("Control.Engine.Threads"));
+	// Start moving the speech frames of calls in progress.
+	gMediaRelay.start();
 
 
 	//